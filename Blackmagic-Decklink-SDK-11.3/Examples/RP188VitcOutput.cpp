@@ -26,6 +26,8 @@
  */
 
 #include "platform.h"
+#include "OutputFramePool.h"
+#include "Timecode.h"
 
 #if defined(_WIN32)
 typedef BOOL BMDbool;
@@ -40,9 +42,16 @@ const BMDPixelFormat      kPixelFormat = bmdFormat10BitYUV;
 
 // Frame parameters
 const INT32_UNSIGNED kRowBytes = 5120;
+const INT32_UNSIGNED kPrerollFrames = 3;
+
+// Each frame carries its own timecode, so a frame cannot be rescheduled until the device
+// has finished with it. Two spare frames give the completion callback room to render.
+const INT32_UNSIGNED kFramePoolSize = kPrerollFrames + 2;
 BMDTimeValue         gFrameDuration = 0;
 BMDTimeScale         gTimeScale = 0;
-INT32_UNSIGNED       gDropFrames = 0;
+
+// Timecode conversions for the display mode's frame rate
+const TimecodeKernel* gTimecodeKernel = NULL;
 
 // Timecode options
 const bool kIsDropFrame = false;
@@ -50,54 +59,30 @@ const bool kIsDropFrame = false;
 // 10-bit YUV blue pixels
 const INT32_UNSIGNED kBlueData[4] = { 0x40aa298, 0x2a8a62a8, 0x298aa040, 0x2a8102a8 };
 
+// Content tag of the pooled frames, which are filled once when the pool is allocated
+const int64_t kFrameContentBlue = 0;
+
 // The display mode object corresponding to kDisplayMode
 IDeckLinkDisplayMode* gDisplayMode = NULL;
 
 // Keep track of the number of scheduled frames
 INT32_UNSIGNED gTotalFramesScheduled = 0;
 
-static void convertFrameCountToTimecode(INT32_UNSIGNED frameCount, INT8_UNSIGNED* hours, INT8_UNSIGNED* minutes, INT8_UNSIGNED* seconds, INT8_UNSIGNED* frames)
-{
-	INT32_UNSIGNED maxFPS = (INT32_UNSIGNED)(gTimeScale / 1000);
-
-	if (gDropFrames)
-	{
-		INT32_UNSIGNED deciMins, deciMinsRemainder;
-
-		INT32_UNSIGNED framesIn10mins = (INT32_UNSIGNED)((60 * 10 * maxFPS) - (9 * gDropFrames));
-		deciMins = frameCount / framesIn10mins;
-		deciMinsRemainder = frameCount - (deciMins * framesIn10mins);
-
-		// Add gDropFrames for 9 minutes of every 10 minutes that have elapsed
-		// AND gDropFrames for every minute (over the first minute) in this 10-minute block.
-		frameCount += gDropFrames * 9 * deciMins;
-		if (deciMinsRemainder >= gDropFrames)
-			frameCount += gDropFrames * ((deciMinsRemainder - gDropFrames) / (framesIn10mins / 10));
-	}
-
-	*frames = (INT8_UNSIGNED)(frameCount % maxFPS);
-	frameCount /= maxFPS;
-	*seconds = (INT8_UNSIGNED)(frameCount % 60);
-	frameCount /= 60;
-	*minutes = (INT8_UNSIGNED)(frameCount % 60);
-	frameCount /= 60;
-	*hours = (INT8_UNSIGNED)frameCount;
-}
-
-static HRESULT setRP188VitcTimecodeOnFrame(IDeckLinkMutableVideoFrame* videoFrame, INT8_UNSIGNED hours, INT8_UNSIGNED minutes, INT8_UNSIGNED seconds, INT8_UNSIGNED frames, BOOL setHFRTCTimecode)
+static HRESULT setRP188VitcTimecodeOnFrame(IDeckLinkMutableVideoFrame* videoFrame, const TimecodeComponents& timecode, BOOL setHFRTCTimecode)
 {
 	HRESULT	result = S_OK;
 
 	BMDTimecodeFlags flags = bmdTimecodeFlagDefault;
-	bool setVITC1Timecode = false;
-	bool setVITC2Timecode = false;
+	bool progressive = gDisplayMode->GetFieldDominance() == bmdProgressiveFrame;
+	unsigned vitcFields;
+	INT8_UNSIGNED vitcFrames;
 
-	if (kIsDropFrame)
+	if (gTimecodeKernel->dropFrame)
 		flags |= bmdTimecodeIsDropFrame;
 
 	if (setHFRTCTimecode)
 	{
-		result = videoFrame->SetTimecodeFromComponents(bmdTimecodeRP188HighFrameRate, hours, minutes, seconds, frames, flags);
+		result = videoFrame->SetTimecodeFromComponents(bmdTimecodeRP188HighFrameRate, timecode.hours, timecode.minutes, timecode.seconds, timecode.frames, flags);
 		if (result != S_OK)
 		{
 			fprintf(stderr, "Could not set HFRTC timecode on frame - result = %08x\n", result);
@@ -105,33 +90,15 @@ static HRESULT setRP188VitcTimecodeOnFrame(IDeckLinkMutableVideoFrame* videoFram
 		}
 	}
 	
-	if (gDisplayMode->GetFieldDominance() != bmdProgressiveFrame)
-	{
-		// An interlaced or PsF frame has both VITC1 and VITC2 set with the same timecode value (SMPTE ST 12-2:2014 7.2)
-		setVITC1Timecode = true;
-		setVITC2Timecode = true;
-	}
-	else if (gTimeScale / gFrameDuration <= 30)
-	{
-		// If this isn't a High-P mode, then just use VITC1 (SMPTE ST 12-2:2014 7.2)
-		setVITC1Timecode = true;
-	}
-	else if (gTimeScale / gFrameDuration <= 60)
-	{
-		// If this is a High-P mode then use VITC1 on even frames and VITC2 on odd frames. This is done because the 
-		// frames field of the RP188 VITC timecode cannot hold values greater than 30 (SMPTE ST 12-2:2014 7.2, 9.2)
-		if ((frames & 1) == 0)
-			setVITC1Timecode = true;
-		else
-			setVITC2Timecode = true;
-
-		// Shift the frame count so it's maximum is within the valid range
-		frames >>= 1;
-	}
+	// Interlaced and PsF frames carry the timecode in both VITC1 and VITC2. High-P modes alternate between
+	// VITC1 and VITC2 with half the frame count, as the frames field of the RP188 VITC timecode cannot hold
+	// values greater than 30 (SMPTE ST 12-2:2014 7.2, 9.2)
+	vitcFields = gTimecodeKernel->getVitcFields(timecode.frames, progressive);
+	vitcFrames = gTimecodeKernel->getVitcFrames(timecode.frames, progressive);
 
-	if (setVITC1Timecode)
+	if (vitcFields & kTimecodeVitc1)
 	{
-		result = videoFrame->SetTimecodeFromComponents(bmdTimecodeRP188VITC1, hours, minutes, seconds, frames, flags);
+		result = videoFrame->SetTimecodeFromComponents(bmdTimecodeRP188VITC1, timecode.hours, timecode.minutes, timecode.seconds, vitcFrames, flags);
 		if (result != S_OK)
 		{
 			fprintf(stderr, "Could not set VITC1 timecode on interlaced frame - result = %08x\n", result);
@@ -139,10 +106,10 @@ static HRESULT setRP188VitcTimecodeOnFrame(IDeckLinkMutableVideoFrame* videoFram
 		}
 	}
 
-	if (setVITC2Timecode)
+	if (vitcFields & kTimecodeVitc2)
 	{
 		// The VITC2 timecode also has the field mark flag set
-		result = videoFrame->SetTimecodeFromComponents(bmdTimecodeRP188VITC2, hours, minutes, seconds, frames, flags | bmdTimecodeFieldMark);
+		result = videoFrame->SetTimecodeFromComponents(bmdTimecodeRP188VITC2, timecode.hours, timecode.minutes, timecode.seconds, vitcFrames, flags | bmdTimecodeFieldMark);
 		if (result != S_OK)
 		{
 			fprintf(stderr, "Could not set VITC1 timecode on interlaced frame - result = %08x\n", result);
@@ -157,17 +124,24 @@ bail:
 class OutputCallback: public IDeckLinkVideoOutputCallback
 {
 public:
-	OutputCallback(IDeckLinkOutput* deckLinkOutput, BOOL deckLinkSupportsHFRTC) : m_refCount(1)
+	OutputCallback(IDeckLinkOutput* deckLinkOutput, OutputFramePool* framePool, BOOL deckLinkSupportsHFRTC) : m_refCount(1)
 	{
 		m_deckLinkOutput = deckLinkOutput;
 		m_deckLinkOutput->AddRef();
-		
+
+		m_framePool = framePool;
 		m_deckLinkSupportsHFRTC = deckLinkSupportsHFRTC;
 	}
 
 	virtual HRESULT	STDMETHODCALLTYPE ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult completionResult)
 	{
-		return scheduleNextFrame(completedFrame);
+		// Return the frame to the pool, then render the next timecode into a free frame
+		m_framePool->FrameCompleted(completedFrame);
+
+		if (completionResult == bmdOutputFrameFlushed)
+			return S_OK;
+
+		return scheduleNextFrame();
 	}
 
 	virtual HRESULT	STDMETHODCALLTYPE ScheduledPlaybackHasStopped(void)
@@ -196,41 +170,40 @@ public:
 		return newRefValue;
 	}
 
-	virtual HRESULT scheduleNextFrame(IDeckLinkVideoFrame* videoFrame)
+	virtual HRESULT scheduleNextFrame(void)
 	{
 		HRESULT                     result;
-		IDeckLinkMutableVideoFrame* mutableFrame = NULL;
-		INT8_UNSIGNED               hours;
-		INT8_UNSIGNED               minutes;
-		INT8_UNSIGNED               seconds;
-		INT8_UNSIGNED               frames;
-
-		convertFrameCountToTimecode(gTotalFramesScheduled, &hours, &minutes, &seconds, &frames);
+		IDeckLinkMutableVideoFrame* videoFrame = NULL;
+		TimecodeComponents          timecode = gTimecodeKernel->fromFrameCount(gTotalFramesScheduled);
 
-		result = videoFrame->QueryInterface(IID_IDeckLinkMutableVideoFrame, (void**)&mutableFrame);
+		// Every pooled frame is already blue, only the timecode changes from frame to frame
+		result = m_framePool->AcquireFrame(kFrameContentBlue, &videoFrame, NULL);
 		if (result != S_OK)
+		{
+			fprintf(stderr, "No free frame in the output frame pool\n");
 			goto bail;
+		}
 
-		result = setRP188VitcTimecodeOnFrame(mutableFrame, hours, minutes, seconds, frames, m_deckLinkSupportsHFRTC);
+		result = setRP188VitcTimecodeOnFrame(videoFrame, timecode, m_deckLinkSupportsHFRTC);
 		if (result != S_OK)
+		{
+			m_framePool->ReleaseFrame(videoFrame, kFrameContentBlue);
 			goto bail;
+		}
 
-		// When a video frame completes,reschedule another frame
-		result = m_deckLinkOutput->ScheduleVideoFrame(videoFrame, gTotalFramesScheduled * gFrameDuration, gFrameDuration, gTimeScale);
+		result = m_framePool->ScheduleFrame(videoFrame, kFrameContentBlue, gTotalFramesScheduled * gFrameDuration, gFrameDuration, gTimeScale);
 		if (result != S_OK)
 			goto bail;
 
 		gTotalFramesScheduled++;
 
 	bail:
-		if (mutableFrame)
-			mutableFrame->Release();
-
 		return result;
 	}
 
 private:
 	IDeckLinkOutput*  m_deckLinkOutput;
+	OutputFramePool*  m_framePool;
 	BOOL              m_deckLinkSupportsHFRTC;
 	INT32_SIGNED m_refCount;
 	
@@ -259,22 +232,21 @@ static void FillBlue(IDeckLinkMutableVideoFrame* theFrame)
 	}
 }
 
-static IDeckLinkMutableVideoFrame* CreateFrame(IDeckLinkOutput* deckLinkOutput)
+static HRESULT CreateFrame(IDeckLinkOutput* deckLinkOutput, IDeckLinkMutableVideoFrame** frame)
 {
 	HRESULT                         result;
-	IDeckLinkMutableVideoFrame*     frame = NULL;
 
-	result = deckLinkOutput->CreateVideoFrame((int)gDisplayMode->GetWidth(), (int)gDisplayMode->GetHeight(), kRowBytes, kPixelFormat, bmdFrameFlagDefault, &frame);
+	result = deckLinkOutput->CreateVideoFrame((int)gDisplayMode->GetWidth(), (int)gDisplayMode->GetHeight(), kRowBytes, kPixelFormat, bmdFrameFlagDefault, frame);
 	if (result != S_OK)
 	{
 		fprintf(stderr, "Could not create a video frame - result = %08x\n", result);
 		goto bail;
 	}
 
-	FillBlue(frame);
+	FillBlue(*frame);
 
 bail:
-	return frame;
+	return result;
 }
 
 
@@ -286,7 +258,8 @@ int main(int argc, const char * argv[])
 	IDeckLinkOutput*        deckLinkOutput   = NULL;
 	IDeckLinkProfileAttributes*	deckLinkAttributes = NULL;
 	OutputCallback*         outputCallback   = NULL;
-	IDeckLinkVideoFrame*    videoFrameBlue   = NULL;
+	OutputFramePool*        framePool        = NULL;
+	OutputFramePoolStatistics	poolStatistics;
 	BMDbool					supported;
 	BMDbool					deckLinkSupportsHFRTC;
 	HRESULT                 result;
@@ -332,8 +305,11 @@ int main(int argc, const char * argv[])
 		deckLinkSupportsHFRTC = false;
 	}
 
+	// Create the pool of output frames, which the callback fills from
+	framePool = new OutputFramePool(deckLinkOutput);
+
 	// Create an instance of output callback
-	outputCallback = new OutputCallback(deckLinkOutput, deckLinkSupportsHFRTC);
+	outputCallback = new OutputCallback(deckLinkOutput, framePool, deckLinkSupportsHFRTC);
 	if (outputCallback == NULL)
 	{
 		fprintf(stderr, "Could not create output callback object\n");
@@ -372,13 +348,17 @@ int main(int argc, const char * argv[])
 	// Store the frame duration and timesale for later use
 	gDisplayMode->GetFrameRate(&gFrameDuration, &gTimeScale);
 
-	// Frame rates with multiple 30-frame counting can implement Drop Frames compensation, refer to SMPTE 12-3
-	if (kIsDropFrame && gTimeScale % 30000 == 0)
+	// Only the 29.97, 59.94 and 119.88 fps rates can implement Drop Frames compensation, refer to SMPTE 12-3.
+	// Other rates count every frame.
+	gTimecodeKernel = GetTimecodeKernel(gFrameDuration, gTimeScale, kIsDropFrame);
+	if (gTimecodeKernel == NULL)
+		gTimecodeKernel = GetTimecodeKernel(gFrameDuration, gTimeScale, false);
+	if (gTimecodeKernel == NULL)
 	{
-		gDropFrames = 2 * (gTimeScale / 30000);
+		fprintf(stderr, "Timecode is not supported at the display mode's frame rate\n");
+		result = E_FAIL;
+		goto bail;
 	}
-	else
-		gDropFrames = 0;
 	
 	// Enable video output
 	result = deckLinkOutput->EnableVideoOutput(kDisplayMode, kOutputFlags);
@@ -388,13 +368,18 @@ int main(int argc, const char * argv[])
 		goto bail;
 	}
 
-	// Create a frame with defined format
-	videoFrameBlue = CreateFrame(deckLinkOutput);
+	// Create the blue frames that will carry the timecode
+	result = framePool->Allocate(kFramePoolSize, [deckLinkOutput](IDeckLinkMutableVideoFrame** frame) { return CreateFrame(deckLinkOutput, frame); });
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Could not allocate the output frame pool - result = %08x\n", result);
+		goto bail;
+	}
 
-	// Schedule a blue frame 3 times
-	for (int i = 0; i < 3; i++)
+	// Preroll blue frames with consecutive timecodes
+	for (INT32_UNSIGNED i = 0; i < kPrerollFrames; i++)
 	{
-		result = outputCallback->scheduleNextFrame(videoFrameBlue);
+		result = outputCallback->scheduleNextFrame();
 		if (result != S_OK)
 		{
 			fprintf(stderr, "Could not schedule video frame - result = %08x\n", result);
@@ -423,6 +408,10 @@ int main(int argc, const char * argv[])
 	// Disable the video input interface
 	result = deckLinkOutput->DisableVideoOutput();
 
+	framePool->GetStatistics(&poolStatistics);
+	printf("Frame pool: %u frames, at least %u free, at most %u queued on the device\n",
+		   poolStatistics.frameCount, poolStatistics.minFreeFrames, poolStatistics.maxQueuedFrames);
+
 	// Release resources
 bail:
 
@@ -442,14 +431,14 @@ bail:
 	if (deckLinkIterator != NULL)
 		deckLinkIterator->Release();
 
-	// Release the videoframe object
-	if (videoFrameBlue != NULL)
-		videoFrameBlue->Release();
-
 	// Release the outputCallback callback object
 	if (outputCallback != NULL)
 		outputCallback->Release();
 
+	// Release the pooled frames
+	if (framePool != NULL)
+		delete framePool;
+
 	return (result == S_OK) ? 0 : 1;
 }
 
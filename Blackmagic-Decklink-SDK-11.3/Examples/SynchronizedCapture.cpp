@@ -26,11 +26,15 @@
  */
 
 #include "platform.h"
+#include "CaptureGroupAligner.h"
+#include "CaptureLatencyProfiler.h"
+#include "Timecode.h"
 #include <array>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <memory>
 
 #define kDeviceCount 2
 
@@ -44,7 +48,14 @@ const INT32_UNSIGNED kFrameDuration = 1000;
 const INT32_UNSIGNED kTimeScale = 25000;
 const INT32_UNSIGNED kSynchronizedCaptureGroup = 2;
 
-static const BMDTimeScale kMicroSecondsTimeScale = 1000000;
+// Timecode of the stream times, at the capture frame rate
+typedef TimecodeRateOf<kTimeScale, kFrameDuration> CaptureTimecodeRate;
+
+// Interval between capture callback latency reports
+const unsigned kProfileReportInterval = 5000;
+
+// Longest wait for a late device before its frame is left out of a bundle, in milliseconds
+const unsigned kAlignmentTimeout = 20;
 
 class DeckLinkDevice;
 
@@ -134,14 +145,16 @@ public:
 		m_deckLinkNotification(nullptr),
 		m_notificationCallback(nullptr),
 		m_deckLinkInput(nullptr),
-		m_inputCallback(nullptr)
+		m_inputCallback(nullptr),
+		m_aligner(nullptr)
 	{
 	}
 
-	HRESULT setup(IDeckLink* deckLink, unsigned index)
+	HRESULT setup(IDeckLink* deckLink, unsigned index, CaptureGroupAligner* aligner)
 	{
 		m_deckLink = deckLink;
 		m_index = index;
+		m_aligner = aligner;
 
 		// Obtain the configuration interface for the DeckLink device
 		HRESULT result = m_deckLink->QueryInterface(IID_IDeckLinkConfiguration, (void**)&m_deckLinkConfig);
@@ -257,6 +270,13 @@ public:
 			goto bail;
 		}
 
+		// Profile each device's callback separately, its frames arrive on its own thread
+		{
+			char profileName[32];
+			snprintf(profileName, sizeof(profileName), "Device #%u", m_index);
+			m_profiler.reset(new CaptureLatencyProfiler(m_deckLinkInput, profileName, kProfileReportInterval));
+		}
+
 	bail:
 		return result;
 	}
@@ -296,35 +316,24 @@ public:
 			goto bail;
 		}
 
+		if (m_profiler)
+		{
+			m_profiler->WriteSummary(stderr);
+			m_profiler.reset();
+		}
+
 	bail:
 		return result;
 	}
 
 	HRESULT frameArrived(IDeckLinkVideoInputFrame* videoFrame)
 	{
-		BMDTimeValue time;
-		HRESULT result = videoFrame->GetStreamTime(&time, nullptr, kTimeScale);
-		if (result != S_OK)
-		{
-			fprintf(stderr, "Could not get stream time from frame - result = %08x\n", result);
-			return S_OK;
-		}
-
-		unsigned frames = (unsigned)((time % kTimeScale) / kFrameDuration);
-		unsigned seconds = (unsigned)((time / kTimeScale) % 60);
-		unsigned minutes = (unsigned)((time / kTimeScale / 60) % 60);
-		unsigned hours = (unsigned)(time / kTimeScale / 60 / 60);
-
-		BMDTimeValue hwTime;
-		result = videoFrame->GetHardwareReferenceTimestamp(kMicroSecondsTimeScale, &hwTime, NULL);
-		if (result != S_OK)
-		{
-			fprintf(stderr, "Could not get hardwar reference time from frame - result = %08x\n", result);
-			return S_OK;
-		}
+		CaptureProfileScope profileScope(m_profiler.get(), videoFrame);
 
-
-		printf("[%llu.%06llu] Device #%u: Frame %02u:%02u:%02u:%03u arrived\n", hwTime / kMicroSecondsTimeScale, hwTime % kMicroSecondsTimeScale, m_index, hours, minutes, seconds, frames);
+		// Frames are printed when the aligner has joined them with the other devices' frames
+		HRESULT result = m_aligner->FrameArrived(m_index, videoFrame);
+		if (FAILED(result))
+			fprintf(stderr, "Could not align frame from device #%u - result = %08x\n", m_index, result);
 
 		return S_OK;
 	}
@@ -370,6 +379,8 @@ private:
 	InputCallback*									m_inputCallback;
 	std::mutex										m_mutex;
 	std::condition_variable							m_signalCondition;
+	std::unique_ptr<CaptureLatencyProfiler>			m_profiler;
+	CaptureGroupAligner*							m_aligner;
 };
 
 HRESULT InputCallback::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode *newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags)
@@ -400,6 +411,32 @@ HRESULT NotificationCallback::Notify(BMDNotifications topic, uint64_t param1, ui
 	return S_OK;
 }
 
+static void bundleArrived(const CaptureFrameBundle& bundle)
+{
+	TimecodeComponents timecode = CaptureTimecodeRate::FromFrameCount((uint32_t)(bundle.streamTime / kFrameDuration));
+
+	printf("Frame %02u:%02u:%02u:%02u: %u of %u devices, skew %lld us\n", timecode.hours, timecode.minutes, timecode.seconds, timecode.frames,
+		(unsigned)bundle.frames.size() - bundle.missingFrames, (unsigned)bundle.frames.size(), (long long)(bundle.skew / 1000));
+}
+
+static void printAlignerStatistics(CaptureGroupAligner& aligner)
+{
+	CaptureGroupAlignerStatistics stats;
+
+	aligner.GetStatistics(&stats);
+
+	fprintf(stderr, "Aligned %llu frames: %llu partial (%llu timed out), %llu missing, %llu late, %llu realignments, skew p50 %lld p99 %lld max %lld us\n",
+		(unsigned long long)stats.bundlesDelivered,
+		(unsigned long long)stats.partialBundles,
+		(unsigned long long)stats.timeouts,
+		(unsigned long long)stats.missingFrames,
+		(unsigned long long)stats.lateFrames,
+		(unsigned long long)stats.realignments,
+		(long long)(stats.skewMedian / 1000),
+		(long long)(stats.skew99 / 1000),
+		(long long)(stats.skewMaximum / 1000));
+}
+
 static BOOL supportsSynchronizedCapture(IDeckLink* deckLink)
 {
 	IDeckLinkProfileAttributes* attributes = nullptr;
@@ -424,6 +461,7 @@ int main(int argc, const char * argv[])
 
 	IDeckLinkIterator*      deckLinkIterator = nullptr;
 	IDeckLink*				deckLink = nullptr;
+	CaptureGroupAligner		aligner(kDeviceCount, kTimeScale, kAlignmentTimeout, bundleArrived);
 	std::array<DeckLinkDevice, kDeviceCount> deckLinkDevices;
 	HRESULT                 result;
 	unsigned				index = 0;
@@ -456,7 +494,7 @@ int main(int argc, const char * argv[])
 			deckLink->Release();
 		}
 
-		result = device.setup(deckLink, index++);
+		result = device.setup(deckLink, index++, &aligner);
 		if (result != S_OK)
 			goto bail;
 
@@ -480,6 +518,10 @@ int main(int argc, const char * argv[])
 			goto bail;
 	}
 
+	result = aligner.Start();
+	if (result != S_OK)
+		goto bail;
+
 	// Start capture - This only needs to be performed on one device in the group
 	result = deckLinkDevices[0].startCapture();
 	if (result != S_OK)
@@ -495,6 +537,9 @@ int main(int argc, const char * argv[])
 	// Stop capture - This only needs to be performed on one device in the group
 	result = deckLinkDevices[0].stopCapture();
 
+	aligner.Stop();
+	printAlignerStatistics(aligner);
+
 	// Disable the video input interface
 	for (auto& device : deckLinkDevices)
 		result = device.cleanUpFromCapture();
@@ -26,11 +26,14 @@
  */
 
 #include "platform.h"
+#include "GroupPlayoutScheduler.h"
 #include <array>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <vector>
 
 #define kDeviceCount 4
 
@@ -47,6 +50,9 @@ const INT32_UNSIGNED kFrameHeight = 1080;
 const INT32_UNSIGNED kRowBytes = 5120;
 const INT32_UNSIGNED kSynchronizedPlaybackGroup = 2;
 
+// Frames kept scheduled on every device, rendered once and shared by the group
+const INT32_UNSIGNED kScheduledFrames = 3;
+
 // 10-bit YUV pixels
 static const size_t kFrameCount = 4;
 
@@ -75,24 +81,6 @@ static void FillFrame(IDeckLinkMutableVideoFrame* theFrame, const INT32_UNSIGNED
 	}
 }
 
-static IDeckLinkMutableVideoFrame* CreateFrame(IDeckLinkOutput* deckLinkOutput, const INT32_UNSIGNED frameData[4])
-{
-	HRESULT									result;
-	IDeckLinkMutableVideoFrame*				frame = nullptr;
-
-	result = deckLinkOutput->CreateVideoFrame(kFrameWidth, kFrameHeight, kRowBytes, kPixelFormat, bmdFrameFlagDefault, &frame);
-	if (result != S_OK)
-	{
-		fprintf(stderr, "Could not create a video frame - result = %08x\n", result);
-		goto bail;
-	}
-	FillFrame(frame, frameData);
-
-bail:
-	return frame;
-}
-
-
 class DeckLinkDevice;
 
 class OutputCallback: public IDeckLinkVideoOutputCallback
@@ -173,6 +161,7 @@ class DeckLinkDevice
 {
 public:
 	DeckLinkDevice() :
+		m_index(0),
 		m_deckLink(nullptr),
 		m_deckLinkConfig(nullptr),
 		m_deckLinkStatus(nullptr),
@@ -180,15 +169,15 @@ public:
 		m_notificationCallback(nullptr),
 		m_deckLinkOutput(nullptr),
 		m_outputCallback(nullptr),
-		m_totalFramesScheduled(0),
-		m_nextFrameToSchedule(0),
+		m_scheduler(nullptr),
 		m_stopped(false)
 	{
 	}
 
-	HRESULT setup(IDeckLink* deckLink)
+	HRESULT setup(IDeckLink* deckLink, unsigned index)
 	{
 		m_deckLink = deckLink;
+		m_index = index;
 
 		// Obtain the configuration interface for the DeckLink device
 		HRESULT result = m_deckLink->QueryInterface(IID_IDeckLinkConfiguration, (void**)&m_deckLinkConfig);
@@ -262,17 +251,6 @@ public:
 			goto bail;
 		}
 
-		for (size_t i = 0; i < kFrameCount; ++i)
-		{
-			m_frames[i] = CreateFrame(m_deckLinkOutput, kFrameData[i]);
-			if (!m_frames[i])
-			{
-				fprintf(stderr, "Could not create frame\n");
-				result = E_FAIL;
-				goto bail;
-			}
-		}
-
 	bail:
 		return result;
 	}
@@ -318,10 +296,6 @@ public:
 			goto bail;
 		}
 
-		// Schedule 3 frames
-		for (int i = 0; i < 3; i++)
-			scheduleNextFrame();
-
 	bail:
 		return result;
 	}
@@ -390,22 +364,21 @@ public:
 		return result;
 	}
 
-	HRESULT scheduleNextFrame()
+	IDeckLinkOutput* output() const
 	{
-		IDeckLinkVideoFrame* frameToSchedule = m_frames[m_nextFrameToSchedule];
-		m_nextFrameToSchedule = ++m_nextFrameToSchedule % kFrameCount;
-
-		HRESULT result = m_deckLinkOutput->ScheduleVideoFrame(frameToSchedule, m_totalFramesScheduled*kFrameDuration, kFrameDuration, kTimeScale);
-		if (result != S_OK)
-		{
-			fprintf(stderr, "Could not schedule video frame - result = %08x\n", result);
-			goto bail;
-		}
+		return m_deckLinkOutput;
+	}
 
-		++m_totalFramesScheduled;
+	void setScheduler(GroupPlayoutScheduler* scheduler)
+	{
+		m_scheduler = scheduler;
+	}
 
-	bail:
-		return result;
+	void frameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
+	{
+		// The scheduler renders the next frame for the whole group once every device is done with this one
+		if (m_scheduler)
+			m_scheduler->FrameCompleted(m_index, completedFrame, result);
 	}
 
 	~DeckLinkDevice()
@@ -436,15 +409,10 @@ public:
 
 		if (m_deckLinkNotification)
 			m_deckLinkNotification->Release();
-
-		for (auto frame : m_frames)
-		{
-			if (frame)
-				frame->Release();
-		}
 	}
 
 private:
+	unsigned										m_index;
 	IDeckLink*										m_deckLink;
 	IDeckLinkConfiguration*							m_deckLinkConfig;
 	IDeckLinkStatus*								m_deckLinkStatus;
@@ -452,9 +420,7 @@ private:
 	NotificationCallback*							m_notificationCallback;
 	IDeckLinkOutput*								m_deckLinkOutput;
 	OutputCallback*									m_outputCallback;
-	std::array<IDeckLinkVideoFrame*, kFrameCount>	m_frames;
-	INT32_UNSIGNED									m_totalFramesScheduled;
-	INT32_UNSIGNED									m_nextFrameToSchedule;
+	GroupPlayoutScheduler*							m_scheduler;
 	std::mutex										m_mutex;
 	bool											m_stopped;
 	std::condition_variable							m_stopCondition;
@@ -463,9 +429,7 @@ private:
 
 HRESULT	OutputCallback::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
 {
-	// When a video frame completes, reschedule another frame
-	if (!m_deckLinkDevice->stopped())
-		m_deckLinkDevice->scheduleNextFrame();
+	m_deckLinkDevice->frameCompleted(completedFrame, result);
 	return S_OK;
 }
 
@@ -487,6 +451,31 @@ HRESULT NotificationCallback::Notify(BMDNotifications topic, uint64_t param1, ui
 	return S_OK;
 }
 
+static HRESULT renderFrame(IDeckLinkMutableVideoFrame* frame, uint64_t tick)
+{
+	FillFrame(frame, kFrameData[tick % kFrameCount]);
+	return S_OK;
+}
+
+static void printSchedulerStatistics(GroupPlayoutScheduler* scheduler)
+{
+	GroupPlayoutStatistics stats;
+
+	scheduler->GetStatistics(&stats);
+
+	fprintf(stderr, "Rendered %llu frames once for %u devices (peak %llu us), %llu late, %llu dropped, minimum queue %u of %u frames, completion skew p50 %lld p99 %lld max %lld us\n",
+		(unsigned long long)stats.ticksRendered,
+		stats.outputCount,
+		(unsigned long long)stats.peakRenderMicroseconds,
+		(unsigned long long)stats.framesLate,
+		(unsigned long long)stats.framesDropped,
+		stats.minQueuedFrames,
+		stats.frameCount,
+		(long long)(stats.skewMedian / 1000),
+		(long long)(stats.skew99 / 1000),
+		(long long)(stats.skewMaximum / 1000));
+}
+
 static BOOL supportsSynchronizedPlayback(IDeckLink* deckLink)
 {
 	IDeckLinkProfileAttributes* attributes = nullptr;
@@ -511,8 +500,11 @@ int main(int argc, const char * argv[])
 
 	IDeckLinkIterator*      deckLinkIterator = nullptr;
 	IDeckLink*				deckLink = nullptr;
+	std::unique_ptr<GroupPlayoutScheduler> scheduler;
 	std::array<DeckLinkDevice, kDeviceCount> deckLinkDevices;
+	std::vector<IDeckLinkOutput*> outputs;
 	HRESULT                 result;
+	unsigned				index = 0;
 
 	Initialize();
 
@@ -542,13 +534,27 @@ int main(int argc, const char * argv[])
 			deckLink->Release();
 		}
 
-		result = device.setup(deckLink);
+		result = device.setup(deckLink, index++);
 		if (result != S_OK)
 			goto bail;
 
 		deckLink = nullptr;
+		outputs.push_back(device.output());
+	}
+
+	// One scheduler renders each frame once and plays it out of every device in the group
+	scheduler.reset(new GroupPlayoutScheduler(outputs, kFrameDuration, kTimeScale));
+
+	result = scheduler->Allocate(kScheduledFrames, kFrameWidth, kFrameHeight, kRowBytes, kPixelFormat, bmdFrameFlagDefault);
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Could not create frames - result = %08x\n", result);
+		goto bail;
 	}
 
+	for (auto& device : deckLinkDevices)
+		device.setScheduler(scheduler.get());
+
 	for (auto& device : deckLinkDevices)
 	{
 		result = device.prepareForPlayback();
@@ -556,6 +562,10 @@ int main(int argc, const char * argv[])
 			goto bail;
 	}
 
+	result = scheduler->Preroll(renderFrame);
+	if (result != S_OK)
+		goto bail;
+
 	// Wait for devices to lock to the reference signal
 	printf("Waiting for reference lock...\n");
 
@@ -578,6 +588,9 @@ int main(int argc, const char * argv[])
 
 	printf("Exiting.\n");
 
+	// Stop rendering before playback, so no frames are scheduled on a stopping device
+	scheduler->Stop();
+
 	// Stop capture - This only needs to be performed on one device in the group
 	result = deckLinkDevices[0].stopPlayback();
 
@@ -589,6 +602,8 @@ int main(int argc, const char * argv[])
 			goto bail;
 	}
 
+	printSchedulerStatistics(scheduler.get());
+
 	// Disable the video input interface
 	for (auto& device : deckLinkDevices)
 		result = device.cleanUpFromPlayback();
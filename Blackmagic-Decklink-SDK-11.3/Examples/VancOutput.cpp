@@ -26,6 +26,9 @@
  */
 
 #include "platform.h"
+#include "OutputFramePool.h"
+#include "PlayoutDepthController.h"
+#include "Scte104Scheduler.h"
 
 // Video mode parameters
 const BMDDisplayMode      kDisplayMode = bmdModeHD1080i50;
@@ -38,6 +41,12 @@ const INT32_UNSIGNED kTimeScale = 25000;
 const INT32_UNSIGNED kFrameWidth = 1920;
 const INT32_UNSIGNED kFrameHeight = 1080;
 const INT32_UNSIGNED kRowBytes = 5120;
+const INT32_UNSIGNED kPrerollFrames = 3;
+const INT32_UNSIGNED kMaximumQueueDepth = 8;
+
+// Ancillary packets belong to a frame, so each frame queued on the device needs its own.
+// Two spare frames give the completion callback room to work at the deepest queue.
+const INT32_UNSIGNED kFramePoolSize = kMaximumQueueDepth + 2;
 
 // 10-bit YUV blue pixels
 const INT32_UNSIGNED kBlueData[4] = { 0x40aa298, 0x2a8a62a8, 0x298aa040, 0x2a8102a8 };
@@ -56,25 +65,68 @@ const INT8_UNSIGNED kSDIRemoteControlSDID = 0x53;
 // Define VANC line for camera control
 const INT32_UNSIGNED kSDIRemoteControlLine = 16;
 
+// SCTE-104 ad breaks: out of the programme 10 seconds in and back 30 seconds later, once a minute.
+// Each splice request is sent its pre-roll time ahead of the splice point.
+const INT32_UNSIGNED kSpliceBreakCount = 4;
+const INT32_UNSIGNED kSpliceFirstBreakSeconds = 10;
+const INT32_UNSIGNED kSpliceBreakIntervalSeconds = 60;
+const INT32_UNSIGNED kSpliceBreakDurationSeconds = 30;
+const INT32_UNSIGNED kSplicePreRollMilliseconds = 4000;
+
+// Packets for every queued splice request plus those still on frames in flight
+const INT32_UNSIGNED kSplicePacketCount = 2 * kSpliceBreakCount + kFramePoolSize;
+
+// Content tag of the pooled frames, which are filled and given their packet once
+const int64_t kFrameContentBlueWithPacket = 0;
+
 // Keep track of the number of scheduled frames
 INT32_UNSIGNED gTotalFramesScheduled = 0;
 
 class OutputCallback: public IDeckLinkVideoOutputCallback
 {
 public:
-	OutputCallback(IDeckLinkOutput* deckLinkOutput) : m_refCount(1)
+	OutputCallback(IDeckLinkOutput* deckLinkOutput, OutputFramePool* framePool, PlayoutDepthController* depthController, Scte104Scheduler* spliceScheduler) : m_refCount(1)
 	{
 		m_deckLinkOutput = deckLinkOutput;
 		m_deckLinkOutput->AddRef();
+		m_framePool = framePool;
+		m_depthController = depthController;
+		m_spliceScheduler = spliceScheduler;
 	}
 
 	HRESULT	STDMETHODCALLTYPE ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
 	{
-		// When a video frame completes,reschedule another frame
-		m_deckLinkOutput->ScheduleVideoFrame(completedFrame, gTotalFramesScheduled*kFrameDuration, kFrameDuration, kTimeScale);
-		gTotalFramesScheduled++;
+		// When a video frame completes, return it to the pool and top the queue up to the chosen depth
+		m_framePool->FrameCompleted(completedFrame);
+		m_depthController->FrameCompleted(result);
+		if (result == bmdOutputFrameFlushed)
+			return S_OK;
+
+		for (INT32_UNSIGNED i = m_depthController->GetFramesToSchedule(); i > 0; i--)
+		{
+			if (scheduleNextFrame() != S_OK)
+				break;
+		}
 		return S_OK;
 	}
+
+	HRESULT scheduleNextFrame(void)
+	{
+		IDeckLinkMutableVideoFrame* videoFrame = NULL;
+		HRESULT                     result;
+
+		result = m_framePool->AcquireFrame(kFrameContentBlueWithPacket, &videoFrame, NULL);
+		if (result != S_OK)
+			return result;
+
+		// The splice requests were encoded when they were queued, so this only moves a packet
+		m_spliceScheduler->AttachPackets(videoFrame, gTotalFramesScheduled*kFrameDuration, kFrameDuration);
+
+		result = m_framePool->ScheduleFrame(videoFrame, kFrameContentBlueWithPacket, gTotalFramesScheduled*kFrameDuration, kFrameDuration, kTimeScale);
+		if (result == S_OK)
+			gTotalFramesScheduled++;
+		return result;
+	}
 	
 	HRESULT	STDMETHODCALLTYPE ScheduledPlaybackHasStopped(void)
 	{
@@ -103,6 +155,9 @@ public:
 
 private:
 	IDeckLinkOutput*  m_deckLinkOutput;
+	OutputFramePool*  m_framePool;
+	PlayoutDepthController* m_depthController;
+	Scte104Scheduler* m_spliceScheduler;
 	INT32_SIGNED m_refCount;
 
 	virtual ~OutputCallback(void)
@@ -221,7 +276,7 @@ static void FillBlue(IDeckLinkMutableVideoFrame* theFrame)
 	}
 }
 
-static IDeckLinkMutableVideoFrame* CreateFrame(IDeckLinkOutput* deckLinkOutput)
+static HRESULT CreateFrame(IDeckLinkOutput* deckLinkOutput, IDeckLinkMutableVideoFrame** newFrame)
 {
 	HRESULT									result;
 	IDeckLinkMutableVideoFrame*				frame = NULL;
@@ -251,7 +306,40 @@ static IDeckLinkMutableVideoFrame* CreateFrame(IDeckLinkOutput* deckLinkOutput)
 bail:
 	if (ancillaryPackets != NULL)
 		ancillaryPackets->Release();
-	return frame;
+	*newFrame = frame;
+	return (frame != NULL) ? S_OK : result;
+}
+
+// Queues the splice requests of the ad breaks ahead of playback
+static HRESULT QueueSpliceRequests(Scte104Scheduler* spliceScheduler)
+{
+	Scte104Message       message;
+	Scte104SpliceRequest request;
+	HRESULT              result = S_OK;
+
+	for (INT32_UNSIGNED i = 0; i < 2 * kSpliceBreakCount; i++)
+	{
+		bool           spliceOut = (i % 2) == 0;
+		INT64_SIGNED   spliceSeconds = kSpliceFirstBreakSeconds + (i / 2) * kSpliceBreakIntervalSeconds + (spliceOut ? 0 : kSpliceBreakDurationSeconds);
+
+		request.spliceInsertType = spliceOut ? kScte104SpliceStartNormal : kScte104SpliceEndNormal;
+		request.spliceEventId = 1000 + i / 2;
+		request.uniqueProgramId = 1;
+		request.preRollTime = kSplicePreRollMilliseconds;
+		request.breakDuration = spliceOut ? kSpliceBreakDurationSeconds * 10 : 0;
+		request.availNum = 0;
+		request.availsExpected = 0;
+		request.autoReturn = false;
+
+		message.Clear();
+		message.messageNumber = (INT8_UNSIGNED)i;
+		message.AddSpliceRequest(request);
+
+		result = spliceScheduler->Enqueue(spliceSeconds * 1000 - kSplicePreRollMilliseconds, 1000, message);
+		if (result != S_OK)
+			break;
+	}
+	return result;
 }
 
 
@@ -262,7 +350,13 @@ int main(int argc, const char * argv[])
 	IDeckLink*              deckLink         = NULL;
 	IDeckLinkOutput*        deckLinkOutput   = NULL;
 	OutputCallback*         outputCallback   = NULL;
-	IDeckLinkVideoFrame*    videoFrameBlue   = NULL;
+	OutputFramePool*        framePool        = NULL;
+	PlayoutDepthController* depthController  = NULL;
+	Scte104Scheduler*       spliceScheduler  = NULL;
+	PlayoutDepthSettings    depthSettings;
+	OutputFramePoolStatistics	poolStatistics;
+	PlayoutDepthStatistics	depthStatistics;
+	Scte104SchedulerStatistics	spliceStatistics;
 	HRESULT                 result;
 	
 	Initialize();
@@ -291,8 +385,25 @@ int main(int argc, const char * argv[])
 		goto bail;
 	}
 	
+	// Create the pool of output frames, which the callback schedules from
+	framePool = new OutputFramePool(deckLinkOutput);
+
+	// Start at 3 frames of preroll and let the queue adapt to late and dropped frames
+	depthSettings.initialDepth = kPrerollFrames;
+	depthSettings.maximumDepth = kMaximumQueueDepth;
+	depthController = new PlayoutDepthController(deckLinkOutput, kFrameDuration, kTimeScale, depthSettings);
+
+	// Queue the ad break splice requests, to be placed on their frames as they are scheduled
+	spliceScheduler = new Scte104Scheduler(kTimeScale, kSplicePacketCount, 0);
+	result = QueueSpliceRequests(spliceScheduler);
+	if(result != S_OK)
+	{
+		fprintf(stderr, "Could not queue the splice requests - result = %08x\n", result);
+		goto bail;
+	}
+
 	// Create an instance of output callback
-	outputCallback = new OutputCallback(deckLinkOutput);
+	outputCallback = new OutputCallback(deckLinkOutput, framePool, depthController, spliceScheduler);
 	if(outputCallback == NULL)
 	{
 		fprintf(stderr, "Could not create output callback object\n");
@@ -315,19 +426,23 @@ int main(int argc, const char * argv[])
 		goto bail;
 	}
 	
-	// Create a frame with defined format
-	videoFrameBlue = CreateFrame(deckLinkOutput);
+	// Create blue frames with the camera control packet attached
+	result = framePool->Allocate(kFramePoolSize, [deckLinkOutput](IDeckLinkMutableVideoFrame** frame) { return CreateFrame(deckLinkOutput, frame); });
+	if(result != S_OK)
+	{
+		fprintf(stderr, "Could not allocate the output frame pool - result = %08x\n", result);
+		goto bail;
+	}
 	
-	// Schedule a blue frame 3 times
-	for(int i = 0; i < 3; i++)
+	// Preroll blue frames up to the initial queue depth
+	for(INT32_UNSIGNED i = depthController->GetFramesToSchedule(); i > 0; i--)
 	{
-		result = deckLinkOutput->ScheduleVideoFrame(videoFrameBlue, gTotalFramesScheduled*kFrameDuration, kFrameDuration, kTimeScale);
+		result = outputCallback->scheduleNextFrame();
 		if(result != S_OK)
 		{
 			fprintf(stderr, "Could not schedule video frame - result = %08x\n", result);
 			goto bail;
 		}
-		gTotalFramesScheduled ++;
 	}
 	
 	// Start
@@ -351,6 +466,21 @@ int main(int argc, const char * argv[])
 	// Disable the video input interface
 	result = deckLinkOutput->DisableVideoOutput();
 	
+	framePool->GetStatistics(&poolStatistics);
+	printf("Frame pool: %u frames, at least %u free, at most %u queued on the device\n",
+		   poolStatistics.frameCount, poolStatistics.minFreeFrames, poolStatistics.maxQueuedFrames);
+	
+	depthController->GetStatistics(&depthStatistics);
+	printf("Queue depth: %u frames (largest %u), %llu late and %llu dropped frames\n",
+		   depthStatistics.targetDepth, depthStatistics.largestTargetDepth,
+		   (unsigned long long)depthStatistics.framesLate, (unsigned long long)depthStatistics.framesDropped);
+	depthController->WriteHistory(stdout);
+	
+	spliceScheduler->GetStatistics(&spliceStatistics);
+	printf("Splice requests: %llu of %llu sent, %llu late\n",
+		   (unsigned long long)spliceStatistics.messagesAttached, (unsigned long long)spliceStatistics.messagesQueued,
+		   (unsigned long long)spliceStatistics.messagesLate);
+	
 	// Release resources
 bail:
 	
@@ -366,14 +496,21 @@ bail:
 	if(deckLinkIterator != NULL)
 		deckLinkIterator->Release();
 	
-	// Release the videoframe object
-	if(videoFrameBlue != NULL)
-		videoFrameBlue->Release();
-	
 	// Release the outputCallback callback object
 	if(outputCallback != NULL)
 		outputCallback->Release();
 	
+	// Release the pooled frames
+	if(framePool != NULL)
+		delete framePool;
+	
+	if(depthController != NULL)
+		delete depthController;
+	
+	// Last, as the pooled frames held its packets
+	if(spliceScheduler != NULL)
+		delete spliceScheduler;
+	
 	return(result == S_OK) ? 0 : 1;
 }
 
@@ -0,0 +1,688 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <algorithm>
+#include "AsyncFileWriter.h"
+
+// Data is written in chunks of this size, which keeps every write offset and
+// length a multiple of the O_DIRECT alignment. The chunks are the buffering between
+// the writer thread and the disk: 128 MB, or about 20 frames of 1080p v210. Free
+// chunks are reused last in, first out, so a writer that is kept up with, such as an
+// audio file's, only ever touches a few of them.
+static const size_t		kChunkSize			= 4 * 1024 * 1024;
+static const unsigned	kChunkCount			= 32;
+static const size_t		kDirectIOAlignment	= 4096;
+
+// Maximum number of writes waiting for the writer thread, and so of frames or audio
+// packets held from the driver, before Write() drops
+static const unsigned	kMaxQueuedWrites	= 16;
+
+static uint64_t monotonicTimeNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+AsyncFileWriter::AsyncFileWriter() :
+	m_fd(-1),
+	m_directIO(false),
+	m_preallocationStep(0),
+	m_preallocatedSize(0),
+	m_openTime(0),
+	m_threadRunning(false),
+	m_copiedData(NULL),
+	m_queueHead(0),
+	m_queueCount(0),
+	m_writerWaiting(false),
+	m_closing(false),
+	m_wakeFd(-1),
+	m_fillingChunk(-1),
+	m_fileSize(0),
+	m_writesInFlight(0),
+	m_ringFd(-1),
+	m_sqRing(MAP_FAILED),
+	m_sqRingSize(0),
+	m_cqRing(MAP_FAILED),
+	m_cqRingSize(0),
+	m_sqes((io_uring_sqe*)MAP_FAILED),
+	m_sqesSize(0),
+	m_sqTail(NULL),
+	m_sqMask(NULL),
+	m_sqArray(NULL),
+	m_cqHead(NULL),
+	m_cqTail(NULL),
+	m_cqMask(NULL),
+	m_cqes(NULL)
+{
+	pthread_mutex_init(&m_writeMutex, NULL);
+	pthread_mutex_init(&m_mutex, NULL);
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	Close();
+
+	pthread_mutex_destroy(&m_mutex);
+	pthread_mutex_destroy(&m_writeMutex);
+}
+
+bool AsyncFileWriter::Open(const char* path, uint64_t preallocationStep)
+{
+	if (m_fd >= 0)
+		return false;
+
+	// tmpfs and some other file systems reject O_DIRECT
+	m_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT, 0664);
+	m_directIO = (m_fd >= 0);
+	if (m_fd < 0 && errno == EINVAL)
+		m_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+
+	if (m_fd < 0)
+		return false;
+
+	m_wakeFd = eventfd(0, EFD_CLOEXEC);
+	m_queue.resize(kMaxQueuedWrites);
+	m_copiedData = (uint8_t*)malloc(kMaxQueuedWrites * kMaxCopiedBytes);
+
+	if ((m_wakeFd < 0) || (m_copiedData == NULL))
+	{
+		Close();
+		return false;
+	}
+
+	for (unsigned i = 0; i < kChunkCount; i++)
+	{
+		Chunk chunk = { NULL, 0, 0, 0 };
+
+		if (posix_memalign((void**)&chunk.data, kDirectIOAlignment, kChunkSize) != 0)
+		{
+			Close();
+			return false;
+		}
+
+		m_chunks.push_back(chunk);
+		m_freeChunks.push_back(i);
+	}
+
+	memset(&m_statistics, 0, sizeof(m_statistics));
+	m_statistics.usingIoUring = setupRing();
+	m_statistics.usingDirectIO = m_directIO;
+
+	m_fileSize = 0;
+	m_fillingChunk = -1;
+	m_writesInFlight = 0;
+	m_queueHead = 0;
+	m_queueCount = 0;
+	m_writerWaiting = false;
+	m_preallocationStep = preallocationStep;
+	m_preallocatedSize = 0;
+	m_closing = false;
+	m_openTime = monotonicTimeNs();
+
+	if (pthread_create(&m_thread, NULL, writerThreadFunc, this) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_threadRunning = true;
+	return true;
+}
+
+void AsyncFileWriter::Close(void)
+{
+	uint64_t wake = 1;
+
+	if (m_threadRunning)
+	{
+		// Waits for a Write() in progress; the writer thread then drains the queue
+		pthread_mutex_lock(&m_writeMutex);
+		pthread_mutex_lock(&m_mutex);
+		m_closing = true;
+		pthread_mutex_unlock(&m_mutex);
+		pthread_mutex_unlock(&m_writeMutex);
+
+		if (write(m_wakeFd, &wake, sizeof(wake)) < 0)
+			fprintf(stderr, "Could not wake output file writer: %s\n", strerror(errno));
+
+		pthread_join(m_thread, NULL);
+		m_threadRunning = false;
+	}
+
+	destroyRing();
+
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+
+	if (m_wakeFd >= 0)
+	{
+		close(m_wakeFd);
+		m_wakeFd = -1;
+	}
+
+	for (Chunk& chunk : m_chunks)
+		free(chunk.data);
+
+	free(m_copiedData);
+	m_copiedData = NULL;
+
+	m_queue.clear();
+	m_chunks.clear();
+	m_freeChunks.clear();
+	m_fillingChunk = -1;
+}
+
+bool AsyncFileWriter::Write(const void* data, size_t size, IUnknown* owner)
+{
+	AsyncWriteSpan span = { data, size, owner };
+
+	return Write(&span, 1);
+}
+
+bool AsyncFileWriter::Write(const AsyncWriteSpan* spans, unsigned spanCount)
+{
+	PendingWrite*	pending = NULL;
+	uint8_t*		copiedData;
+	size_t			size = 0;
+	size_t			copiedSize = 0;
+	bool			wake = false;
+	uint64_t		wakeCount = 1;
+
+	for (unsigned i = 0; i < spanCount; i++)
+	{
+		size += spans[i].size;
+		if (spans[i].owner == NULL)
+			copiedSize += spans[i].size;
+	}
+
+	pthread_mutex_lock(&m_writeMutex);
+	pthread_mutex_lock(&m_mutex);
+
+	if (m_threadRunning && !m_closing && !m_statistics.failed)
+	{
+		if ((m_queueCount < kMaxQueuedWrites) && (spanCount <= kMaxWriteSpans) && (copiedSize <= kMaxCopiedBytes))
+		{
+			unsigned entry = (m_queueHead + m_queueCount) % kMaxQueuedWrites;
+
+			pending = &m_queue[entry];
+			copiedData = m_copiedData + entry * kMaxCopiedBytes;
+		}
+		else
+		{
+			m_statistics.writesDropped++;
+			m_statistics.bytesDropped += size;
+		}
+	}
+
+	pthread_mutex_unlock(&m_mutex);
+
+	if (pending != NULL)
+	{
+		// The entry past the end of the queue is not read by the writer thread until it
+		// is counted in below, so it is filled without the lock
+		pending->spanCount = 0;
+		for (unsigned i = 0; i < spanCount; i++)
+		{
+			AsyncWriteSpan& span = pending->spans[pending->spanCount];
+
+			if (spans[i].size == 0)
+				continue;
+
+			span = spans[i];
+			if (span.owner != NULL)
+			{
+				span.owner->AddRef();
+			}
+			else
+			{
+				memcpy(copiedData, span.data, span.size);
+				span.data = copiedData;
+				copiedData += span.size;
+			}
+			pending->spanCount++;
+		}
+
+		pthread_mutex_lock(&m_mutex);
+		m_queueCount++;
+		m_statistics.bytesQueued += size;
+		m_statistics.queueDepth = m_queueCount;
+		m_statistics.peakQueueDepth = std::max(m_statistics.peakQueueDepth, m_queueCount);
+		wake = m_writerWaiting;
+		m_writerWaiting = false;
+		pthread_mutex_unlock(&m_mutex);
+
+		// A busy writer thread comes back to the queue by itself, so only an idle one
+		// costs the caller a system call
+		if (wake && (write(m_wakeFd, &wakeCount, sizeof(wakeCount)) < 0))
+			fprintf(stderr, "Could not wake output file writer: %s\n", strerror(errno));
+	}
+
+	pthread_mutex_unlock(&m_writeMutex);
+	return (pending != NULL);
+}
+
+void AsyncFileWriter::GetStatistics(AsyncFileWriterStatistics* statistics)
+{
+	double elapsed = (monotonicTimeNs() - m_openTime) / 1000000000.0;
+
+	pthread_mutex_lock(&m_mutex);
+	*statistics = m_statistics;
+	pthread_mutex_unlock(&m_mutex);
+
+	statistics->bytesPerSecond = (elapsed > 0.0) ? statistics->bytesWritten / elapsed : 0.0;
+}
+
+void* AsyncFileWriter::writerThreadFunc(void* arg)
+{
+	((AsyncFileWriter*)arg)->writerThread();
+	return NULL;
+}
+
+void AsyncFileWriter::writerThread(void)
+{
+	struct sched_param	param;
+	bool				failed;
+
+	// A batch thread does not preempt the thread that woke it, so Write() returns to
+	// the capture callback before the copy starts, even on a single core
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+
+	pthread_mutex_lock(&m_mutex);
+
+	while (true)
+	{
+		if (m_queueCount == 0)
+		{
+			// Every write queued before Close() has been copied
+			if (m_closing)
+				break;
+
+			m_writerWaiting = true;
+			pthread_mutex_unlock(&m_mutex);
+
+			waitForWork();
+
+			pthread_mutex_lock(&m_mutex);
+			m_writerWaiting = false;
+			continue;
+		}
+
+		PendingWrite& pending = m_queue[m_queueHead];
+		failed = m_statistics.failed;
+
+		pthread_mutex_unlock(&m_mutex);
+
+		// Once the writer has failed, queued writes are only released
+		for (unsigned i = 0; i < pending.spanCount; i++)
+		{
+			if (!failed)
+				copyToChunks((const uint8_t*)pending.spans[i].data, pending.spans[i].size);
+
+			if (pending.spans[i].owner != NULL)
+				pending.spans[i].owner->Release();
+		}
+
+		pthread_mutex_lock(&m_mutex);
+		m_queueHead = (m_queueHead + 1) % kMaxQueuedWrites;
+		m_queueCount--;
+		m_statistics.queueDepth = m_queueCount;
+	}
+
+	pthread_mutex_unlock(&m_mutex);
+
+	flushFinalChunk();
+}
+
+void AsyncFileWriter::waitForWork(void)
+{
+	struct pollfd	fds[2];
+	nfds_t			fdCount = 0;
+	uint64_t		wakeCount;
+
+	// Waits on the ring too while writes are in flight, so completions are reaped and
+	// their chunks freed while the queue is empty
+	fds[fdCount].fd = m_wakeFd;
+	fds[fdCount++].events = POLLIN;
+
+	if ((m_ringFd >= 0) && (m_writesInFlight > 0))
+	{
+		fds[fdCount].fd = m_ringFd;
+		fds[fdCount++].events = POLLIN;
+	}
+
+	if (poll(fds, fdCount, -1) < 0)
+		return;
+
+	if ((fds[0].revents & POLLIN) && (read(m_wakeFd, &wakeCount, sizeof(wakeCount)) < 0))
+		fprintf(stderr, "Could not read output file writer wakeup: %s\n", strerror(errno));
+
+	reapCompletions(false);
+}
+
+void AsyncFileWriter::copyToChunks(const uint8_t* data, size_t size)
+{
+	size_t remaining = size;
+
+	while (remaining > 0)
+	{
+		if (m_fillingChunk < 0)
+		{
+			m_fillingChunk = (int)acquireChunk();
+			m_chunks[m_fillingChunk].fileOffset = m_fileSize;
+			m_chunks[m_fillingChunk].length = 0;
+		}
+
+		Chunk&	chunk = m_chunks[m_fillingChunk];
+		size_t	copySize = std::min(remaining, kChunkSize - chunk.length);
+
+		memcpy(chunk.data + chunk.length, data, copySize);
+		chunk.length += copySize;
+		m_fileSize += copySize;
+		data += copySize;
+		remaining -= copySize;
+
+		if (chunk.length == kChunkSize)
+		{
+			submitChunk(m_fillingChunk);
+			m_fillingChunk = -1;
+		}
+	}
+}
+
+unsigned AsyncFileWriter::acquireChunk(void)
+{
+	unsigned chunkIndex;
+
+	// Every chunk that is not free is being written, so a completion frees one. The
+	// queue fills meanwhile, which is how a slow disk comes to drop writes.
+	while (m_freeChunks.empty())
+		reapCompletions(true);
+
+	chunkIndex = m_freeChunks.back();
+	m_freeChunks.pop_back();
+	return chunkIndex;
+}
+
+void AsyncFileWriter::preallocate(uint64_t fileSize)
+{
+	// Keeps the file size, so a reader never sees the reserved space as data. File systems
+	// without fallocate() just go without the reservation.
+	while ((m_preallocationStep > 0) && (fileSize > m_preallocatedSize))
+	{
+		if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, (off_t)m_preallocatedSize, (off_t)m_preallocationStep) != 0)
+			m_preallocationStep = 0;
+
+		m_preallocatedSize += m_preallocationStep;
+	}
+}
+
+void AsyncFileWriter::submitChunk(unsigned chunkIndex)
+{
+	Chunk& chunk = m_chunks[chunkIndex];
+
+	chunk.written = 0;
+	preallocate(chunk.fileOffset + kChunkSize);
+
+	if (m_ringFd >= 0)
+	{
+		submitToRing(chunkIndex);
+		reapCompletions(false);
+	}
+	else
+	{
+		while (chunk.written < chunk.length)
+		{
+			ssize_t result = pwrite(m_fd, chunk.data + chunk.written, chunk.length - chunk.written, chunk.fileOffset + chunk.written);
+
+			if (result < 0 && errno == EINTR)
+				continue;
+
+			completeChunk(chunkIndex, (result < 0) ? -errno : (int)result);
+			if (result <= 0)
+				break;
+		}
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	m_statistics.writesInFlight = m_writesInFlight;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void AsyncFileWriter::flushFinalChunk(void)
+{
+	bool padded = false;
+
+	if (m_fillingChunk >= 0)
+	{
+		Chunk& chunk = m_chunks[m_fillingChunk];
+
+		// O_DIRECT needs a whole number of blocks; the padding is truncated away below
+		if (m_directIO && (chunk.length % kDirectIOAlignment) != 0)
+		{
+			size_t paddedLength = (chunk.length + kDirectIOAlignment - 1) / kDirectIOAlignment * kDirectIOAlignment;
+			memset(chunk.data + chunk.length, 0, paddedLength - chunk.length);
+			chunk.length = paddedLength;
+			padded = true;
+		}
+
+		if (!m_statistics.failed)
+			submitChunk(m_fillingChunk);
+		m_fillingChunk = -1;
+	}
+
+	while (m_writesInFlight > 0)
+		reapCompletions(true);
+
+	if (padded && ftruncate(m_fd, m_fileSize) != 0)
+		fprintf(stderr, "Could not truncate output file: %s\n", strerror(errno));
+}
+
+void AsyncFileWriter::completeChunk(unsigned chunkIndex, int result)
+{
+	Chunk&	chunk = m_chunks[chunkIndex];
+
+	if (result <= 0)
+	{
+		pthread_mutex_lock(&m_mutex);
+		if (!m_statistics.failed)
+			fprintf(stderr, "Write to output file failed: %s\n", strerror(result < 0 ? -result : EIO));
+		m_statistics.failed = true;
+		pthread_mutex_unlock(&m_mutex);
+
+		m_freeChunks.push_back(chunkIndex);
+		return;
+	}
+
+	chunk.written += result;
+
+	pthread_mutex_lock(&m_mutex);
+	m_statistics.bytesWritten += result;
+	m_statistics.writesInFlight = m_writesInFlight;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (chunk.written == chunk.length)
+		m_freeChunks.push_back(chunkIndex);
+	else if (m_ringFd >= 0)
+		submitToRing(chunkIndex);		// Short write; the synchronous path loops by itself
+}
+
+/* io_uring */
+
+bool AsyncFileWriter::setupRing(void)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+
+	m_ringFd = (int)syscall(__NR_io_uring_setup, kChunkCount, &params);
+	if (m_ringFd < 0)
+		return false;
+
+	m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+	m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+	if (m_sqRing == MAP_FAILED)
+		goto bail;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_cqRing = m_sqRing;
+	}
+	else
+	{
+		m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED)
+			goto bail;
+	}
+
+	m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = (io_uring_sqe*)mmap(NULL, m_sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+	if (m_sqes == MAP_FAILED)
+		goto bail;
+
+	m_sqTail	= (unsigned*)((uint8_t*)m_sqRing + params.sq_off.tail);
+	m_sqMask	= (unsigned*)((uint8_t*)m_sqRing + params.sq_off.ring_mask);
+	m_sqArray	= (unsigned*)((uint8_t*)m_sqRing + params.sq_off.array);
+	m_cqHead	= (unsigned*)((uint8_t*)m_cqRing + params.cq_off.head);
+	m_cqTail	= (unsigned*)((uint8_t*)m_cqRing + params.cq_off.tail);
+	m_cqMask	= (unsigned*)((uint8_t*)m_cqRing + params.cq_off.ring_mask);
+	m_cqes		= (io_uring_cqe*)((uint8_t*)m_cqRing + params.cq_off.cqes);
+
+	return true;
+
+bail:
+	destroyRing();
+	return false;
+}
+
+void AsyncFileWriter::destroyRing(void)
+{
+	if (m_sqes != MAP_FAILED)
+		munmap(m_sqes, m_sqesSize);
+
+	if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+		munmap(m_cqRing, m_cqRingSize);
+
+	if (m_sqRing != MAP_FAILED)
+		munmap(m_sqRing, m_sqRingSize);
+
+	if (m_ringFd >= 0)
+		close(m_ringFd);
+
+	m_sqes = (io_uring_sqe*)MAP_FAILED;
+	m_cqRing = MAP_FAILED;
+	m_sqRing = MAP_FAILED;
+	m_ringFd = -1;
+}
+
+void AsyncFileWriter::submitToRing(unsigned chunkIndex)
+{
+	Chunk&			chunk = m_chunks[chunkIndex];
+	unsigned		tail = *m_sqTail;
+	unsigned		index = tail & *m_sqMask;
+	io_uring_sqe*	sqe = &m_sqes[index];
+	int				result;
+
+	// The ring has one entry per chunk, so there is always room for a submission
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode		= IORING_OP_WRITE;
+	sqe->fd			= m_fd;
+	sqe->addr		= (uint64_t)(uintptr_t)(chunk.data + chunk.written);
+	sqe->len		= (uint32_t)(chunk.length - chunk.written);
+	sqe->off		= chunk.fileOffset + chunk.written;
+	sqe->user_data	= chunkIndex;
+
+	m_sqArray[index] = index;
+	__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+	m_writesInFlight++;
+
+	do
+	{
+		result = (int)syscall(__NR_io_uring_enter, m_ringFd, 1, 0, 0, NULL, 0);
+	}
+	while (result < 0 && errno == EINTR);
+
+	if (result < 0)
+	{
+		// Withdraw the entry that the kernel did not take
+		__atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+		m_writesInFlight--;
+		completeChunk(chunkIndex, -errno);
+	}
+}
+
+void AsyncFileWriter::reapCompletions(bool wait)
+{
+	unsigned head;
+
+	if (m_ringFd < 0)
+		return;
+
+	head = *m_cqHead;
+
+	if (wait && head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) && m_writesInFlight > 0)
+	{
+		while (syscall(__NR_io_uring_enter, m_ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno == EINTR)
+			;
+	}
+
+	while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+	{
+		io_uring_cqe*	cqe = &m_cqes[head & *m_cqMask];
+		unsigned		chunkIndex = (unsigned)cqe->user_data;
+		int				result = cqe->res;
+
+		head++;
+		__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+		m_writesInFlight--;
+
+		completeChunk(chunkIndex, result);
+	}
+}
@@ -0,0 +1,180 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#ifndef __ASYNC_FILE_WRITER_H__
+#define __ASYNC_FILE_WRITER_H__
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct AsyncFileWriterStatistics
+{
+	uint64_t	bytesQueued;
+	uint64_t	bytesWritten;
+	double		bytesPerSecond;		// Average since the file was opened
+	unsigned	queueDepth;			// Writes waiting to be copied to the write chunks
+	unsigned	peakQueueDepth;
+	unsigned	writesInFlight;
+	uint64_t	writesDropped;		// Calls to Write() that found the queue full
+	uint64_t	bytesDropped;
+	bool		usingIoUring;
+	bool		usingDirectIO;
+	bool		failed;
+};
+
+// One piece of the data given to a single Write(). With an owner, such as the frame or
+// audio packet holding the data, the writer keeps a reference on it until the data has
+// been copied. Without one, the data is copied into the queue before Write() returns,
+// which suits headers, padding and other small pieces the caller goes on to reuse.
+struct AsyncWriteSpan
+{
+	const void*		data;
+	size_t			size;
+	IUnknown*		owner;
+};
+
+// Appends to a file without blocking the DeckLink callback thread. Write() takes a
+// reference on the frame or packet that owns the data and queues it; a writer thread
+// copies queued data into page-aligned chunks and submits them with io_uring, so the
+// file can be opened with O_DIRECT. When io_uring is unavailable the writer thread
+// falls back to pwrite(), and when the file system refuses O_DIRECT the file is
+// written through the page cache.
+//
+// Write() never waits for the disk or the writer thread. If the queue is full, the
+// write is dropped and counted, and the caller carries on with its next frame.
+class AsyncFileWriter
+{
+public:
+	AsyncFileWriter();
+	~AsyncFileWriter();
+
+	// With a preallocation step, the writer thread reserves disk space that far ahead of
+	// the data with fallocate(), so a long recording is not fragmented and does not find
+	// the disk full part way through a chunk.
+	bool	Open(const char* path, uint64_t preallocationStep = 0);
+	void	Close(void);
+
+	// Queues size bytes at data for the end of the file. Returns false, having queued
+	// nothing, when the queue is full or the writer has failed.
+	bool	Write(const void* data, size_t size, IUnknown* owner = NULL);
+
+	// Queues the spans in order, all of them or, under the same conditions, none, so a
+	// caller that lays out the file itself never leaves part of a record behind. Also
+	// fails when there are more than kMaxWriteSpans spans, or more than kMaxCopiedBytes
+	// bytes without an owner.
+	bool	Write(const AsyncWriteSpan* spans, unsigned spanCount);
+
+	void	GetStatistics(AsyncFileWriterStatistics* statistics);
+
+	static const unsigned	kMaxWriteSpans	= 6;
+	static const size_t		kMaxCopiedBytes	= 128 * 1024;
+
+private:
+	struct PendingWrite
+	{
+		AsyncWriteSpan		spans[kMaxWriteSpans];
+		unsigned			spanCount;
+	};
+
+	struct Chunk
+	{
+		uint8_t*		data;
+		uint64_t		fileOffset;
+		size_t			length;
+		size_t			written;
+	};
+
+	static void*	writerThreadFunc(void* arg);
+	void			writerThread(void);
+	void			waitForWork(void);
+
+	void			copyToChunks(const uint8_t* data, size_t size);
+	unsigned		acquireChunk(void);
+	void			preallocate(uint64_t fileSize);
+	void			submitChunk(unsigned chunkIndex);
+	void			flushFinalChunk(void);
+
+	bool			setupRing(void);
+	void			destroyRing(void);
+	void			submitToRing(unsigned chunkIndex);
+	void			reapCompletions(bool wait);
+	void			completeChunk(unsigned chunkIndex, int result);
+
+	int							m_fd;
+	bool						m_directIO;
+	uint64_t					m_preallocationStep;
+	uint64_t					m_preallocatedSize;
+	uint64_t					m_openTime;
+
+	pthread_t					m_thread;
+	bool						m_threadRunning;
+
+	// Held by Write() while it fills a queue entry, so callers on several threads take
+	// turns; the writer thread never takes it
+	pthread_mutex_t				m_writeMutex;
+
+	pthread_mutex_t				m_mutex;
+	std::vector<PendingWrite>	m_queue;			// A ring of kMaxQueuedWrites entries
+	uint8_t*					m_copiedData;		// kMaxCopiedBytes for each queue entry
+	unsigned					m_queueHead;
+	unsigned					m_queueCount;
+	bool						m_writerWaiting;
+	bool						m_closing;
+	int							m_wakeFd;			// eventfd, so the writer can wait on the ring too
+
+	// Used only by the writer thread
+	std::vector<Chunk>			m_chunks;
+	std::vector<unsigned>		m_freeChunks;
+	int							m_fillingChunk;
+	uint64_t					m_fileSize;
+	unsigned					m_writesInFlight;
+
+	int							m_ringFd;
+	void*						m_sqRing;
+	size_t						m_sqRingSize;
+	void*						m_cqRing;
+	size_t						m_cqRingSize;
+	io_uring_sqe*				m_sqes;
+	size_t						m_sqesSize;
+	unsigned*					m_sqTail;
+	unsigned*					m_sqMask;
+	unsigned*					m_sqArray;
+	unsigned*					m_cqHead;
+	unsigned*					m_cqTail;
+	unsigned*					m_cqMask;
+	io_uring_cqe*				m_cqes;
+
+	AsyncFileWriterStatistics	m_statistics;
+};
+
+#endif
@@ -32,15 +32,26 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <csignal>
+#include <algorithm>
 
 #include "DeckLinkAPI.h"
 #include "Capture.h"
 #include "Config.h"
+#include "AsyncFileWriter.h"
+#include "CaptureLatencyProfiler.h"
+#include "HugePageMemoryAllocator.h"
+#include "SharedFrameRing.h"
+#include "CaptureContainer.h"
+#include "MovFileWriter.h"
 
 static pthread_mutex_t	g_sleepMutex;
 static pthread_cond_t	g_sleepCond;
-static int				g_videoOutputFile = -1;
-static int				g_audioOutputFile = -1;
+static AsyncFileWriter*	g_videoOutputFile = NULL;
+static AsyncFileWriter*	g_audioOutputFile = NULL;
+static CaptureLatencyProfiler*	g_profiler = NULL;
+static SharedFrameRingWriter*	g_sharedRing = NULL;
+static CaptureContainerWriter*	g_containerWriter = NULL;
+static MovFileWriter*			g_movieWriter = NULL;
 static bool				g_do_exit = false;
 
 static BMDConfig		g_config;
@@ -75,6 +86,11 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived(IDeckLinkVideoInputFrame
 	IDeckLinkVideoFrame3DExtensions*	threeDExtensions = NULL;
 	void*								frameBytes;
 	void*								audioFrameBytes;
+	CaptureProfileScope					profileScope(g_profiler, videoFrame);
+
+	// One copy into shared memory serves every reader process
+	if (g_sharedRing != NULL)
+		g_sharedRing->WriteFrame(videoFrame, audioFrame);
 
 	// Handle Video Frame
 	if (videoFrame)
@@ -115,19 +131,38 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived(IDeckLinkVideoInputFrame
 			if (timecodeString)
 				free((void*)timecodeString);
 
-			if (g_videoOutputFile != -1)
+			// The writer holds the frame until its thread has copied it, or drops it if the
+			// queue is full, so the callback never copies or waits for the disk
+			if (g_videoOutputFile != NULL)
 			{
+				AsyncWriteSpan	eyes[2];
+				unsigned		eyeCount = 0;
+
 				videoFrame->GetBytes(&frameBytes);
-				write(g_videoOutputFile, frameBytes, videoFrame->GetRowBytes() * videoFrame->GetHeight());
+				eyes[eyeCount].data = frameBytes;
+				eyes[eyeCount].size = videoFrame->GetRowBytes() * videoFrame->GetHeight();
+				eyes[eyeCount++].owner = videoFrame;
 
+				// Both eyes or neither, so the file stays in left, right order
 				if (rightEyeFrame)
 				{
 					rightEyeFrame->GetBytes(&frameBytes);
-					write(g_videoOutputFile, frameBytes, videoFrame->GetRowBytes() * videoFrame->GetHeight());
+					eyes[eyeCount].data = frameBytes;
+					eyes[eyeCount].size = videoFrame->GetRowBytes() * videoFrame->GetHeight();
+					eyes[eyeCount++].owner = rightEyeFrame;
 				}
+
+				g_videoOutputFile->Write(eyes, eyeCount);
 			}
 		}
 
+		// Indexes frames without input too, to keep the audio that came with them
+		if (g_containerWriter != NULL)
+			g_containerWriter->WriteFrame(videoFrame, rightEyeFrame, audioFrame);
+
+		if (g_movieWriter != NULL)
+			g_movieWriter->WriteFrame(videoFrame, audioFrame);
+
 		if (rightEyeFrame)
 			rightEyeFrame->Release();
 
@@ -137,10 +172,16 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived(IDeckLinkVideoInputFrame
 	// Handle Audio Frame
 	if (audioFrame)
 	{
-		if (g_audioOutputFile != -1)
+		if ((g_containerWriter != NULL) && (videoFrame == NULL))
+			g_containerWriter->WriteFrame(NULL, NULL, audioFrame);
+
+		if ((g_movieWriter != NULL) && (videoFrame == NULL))
+			g_movieWriter->WriteFrame(NULL, audioFrame);
+
+		if (g_audioOutputFile != NULL)
 		{
 			audioFrame->GetBytes(&audioFrameBytes);
-			write(g_audioOutputFile, audioFrameBytes, audioFrame->GetSampleFrameCount() * g_config.m_audioChannels * (g_config.m_audioSampleDepth / 8));
+			g_audioOutputFile->Write(audioFrameBytes, audioFrame->GetSampleFrameCount() * g_config.m_audioChannels * (g_config.m_audioSampleDepth / 8), audioFrame);
 		}
 	}
 
@@ -170,6 +211,26 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFormatChanged(BMDVideoInputFormatChan
 	if (displayModeName)
 		free(displayModeName);
 
+	// The next frame starts a new segment in the new format
+	if (g_containerWriter != NULL)
+	{
+		BMDTimeValue	frameDuration;
+		BMDTimeScale	timeScale;
+
+		mode->GetFrameRate(&frameDuration, &timeScale);
+		g_containerWriter->SetVideoFormat(mode->GetDisplayMode(), mode->GetFieldDominance(), frameDuration, timeScale, (g_config.m_inputFlags & bmdVideoInputDualStream3D) != 0);
+	}
+
+	// A movie keeps the format it started with; frames in the new format are skipped
+	if (g_movieWriter != NULL)
+	{
+		BMDTimeValue	frameDuration;
+		BMDTimeScale	timeScale;
+
+		mode->GetFrameRate(&frameDuration, &timeScale);
+		g_movieWriter->SetVideoFormat(frameDuration, timeScale, mode->GetFieldDominance());
+	}
+
 	if (g_deckLinkInput)
 	{
 		g_deckLinkInput->StopStreams();
@@ -188,6 +249,127 @@ bail:
 	return S_OK;
 }
 
+// DeckLink pads each row to a whole block of pixels: 48 for v210 and 64 for r210
+static long rowBytesForPixelFormat(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return width * 2;
+
+		case bmdFormat10BitYUV:
+			return ((width + 47) / 48) * 128;
+
+		case bmdFormat10BitRGB:
+			return ((width + 63) / 64) * 256;
+
+		default:
+			return 0;
+	}
+}
+
+// Largest frame of any of the input's display modes in any capture pixel format, for
+// format detection, which may switch to any of them
+static size_t largestVideoFrameBytes(IDeckLinkInput* deckLinkInput)
+{
+	static const BMDPixelFormat	kPixelFormats[] = { bmdFormat8BitYUV, bmdFormat10BitYUV, bmdFormat10BitRGB };
+	IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
+	IDeckLinkDisplayMode*			displayMode = NULL;
+	size_t							largest = 0;
+
+	if (deckLinkInput->GetDisplayModeIterator(&displayModeIterator) != S_OK)
+		return 0;
+
+	while (displayModeIterator->Next(&displayMode) == S_OK)
+	{
+		for (BMDPixelFormat pixelFormat : kPixelFormats)
+			largest = std::max(largest, (size_t)rowBytesForPixelFormat(pixelFormat, displayMode->GetWidth()) * displayMode->GetHeight());
+
+		displayMode->Release();
+	}
+
+	displayModeIterator->Release();
+	return largest;
+}
+
+static void printWriterStatistics(const char* name, AsyncFileWriter* writer)
+{
+	AsyncFileWriterStatistics stats;
+
+	writer->GetStatistics(&stats);
+
+	fprintf(stderr, "%s: %.1f MB written at %.1f MB/s, peak queue depth %u, %lu writes dropped (%.1f MB)%s%s%s\n",
+		name,
+		stats.bytesWritten / 1048576.0,
+		stats.bytesPerSecond / 1048576.0,
+		stats.peakQueueDepth,
+		(unsigned long)stats.writesDropped,
+		stats.bytesDropped / 1048576.0,
+		stats.usingIoUring ? ", io_uring" : "",
+		stats.usingDirectIO ? ", O_DIRECT" : "",
+		stats.failed ? ", FAILED" : "");
+}
+
+static void printAllocatorStatistics(HugePageMemoryAllocator* allocator)
+{
+	HugePageAllocatorStatistics stats;
+
+	allocator->GetStatistics(&stats);
+
+	fprintf(stderr, "Frame buffers: %u of %.1f MB in %s pages%s, peak %u in use, %lu from the heap, NUMA node %d%s\n",
+		stats.arenaBuffers,
+		stats.bufferSize / 1048576.0,
+		(stats.pageSize >= (1 << 30)) ? "1 GB" : (stats.pageSize >= (2 << 20)) ? "2 MB" : "4 kB",
+		stats.transparentHugePages ? " (transparent huge pages)" : "",
+		stats.peakOutstandingBuffers,
+		(unsigned long)stats.heapAllocations,
+		stats.numaNode,
+		(stats.numaNode < 0) ? " (unknown)" : stats.numaBound ? "" : " (not bound)");
+}
+
+static void printContainerStatistics(CaptureContainerWriter* writer)
+{
+	CaptureContainerStatistics stats;
+
+	writer->GetStatistics(&stats);
+
+	fprintf(stderr, "Segment files: %u segments, %lu frames, %lu dropped, %.1f MB written%s\n",
+		stats.segmentsClosed,
+		(unsigned long)stats.framesWritten,
+		(unsigned long)stats.framesDropped,
+		stats.bytesWritten / 1048576.0,
+		stats.failed ? ", FAILED" : "");
+}
+
+static void printMovieStatistics(MovFileWriter* writer)
+{
+	MovFileWriterStatistics stats;
+
+	writer->GetStatistics(&stats);
+
+	fprintf(stderr, "Movie file: %lu frames, %lu skipped, %lu dropped, %lu audio sample frames, %.1f MB written%s\n",
+		(unsigned long)stats.framesWritten,
+		(unsigned long)stats.framesSkipped,
+		(unsigned long)stats.framesDropped,
+		(unsigned long)stats.audioSampleFrames,
+		stats.bytesWritten / 1048576.0,
+		stats.failed ? ", FAILED" : "");
+}
+
+static void printSharedRingStatistics(SharedFrameRingWriter* ring)
+{
+	SharedFrameRingStatistics stats;
+
+	ring->GetStatistics(&stats);
+
+	fprintf(stderr, "Shared frame ring: %lu frames written, %lu dropped, %lu truncated, %u readers attached, %lu reclaimed\n",
+		(unsigned long)stats.framesWritten,
+		(unsigned long)stats.framesDropped,
+		(unsigned long)stats.framesTruncated,
+		stats.readersAttached,
+		(unsigned long)stats.readersReclaimed);
+}
+
 static void sigfunc(int signum)
 {
 	if (signum == SIGINT || signum == SIGTERM)
@@ -213,6 +395,7 @@ int main(int argc, char *argv[])
 	bool							supported;
 
 	DeckLinkCaptureDelegate*		delegate = NULL;
+	HugePageMemoryAllocator*		allocator = NULL;
 
 	pthread_mutex_init(&g_sleepMutex, NULL);
 	pthread_cond_init(&g_sleepCond, NULL);
@@ -259,6 +442,22 @@ int main(int argc, char *argv[])
 		goto bail;
 	}
 
+	// Capture into huge pages local to the card, to cut TLB misses and cross-socket traffic
+	if (g_config.m_hugePageBuffers)
+	{
+		HugePageAllocatorSettings allocatorSettings;
+
+		allocatorSettings.numaNode = GetDeckLinkNumaNode(deckLink);
+		allocator = new HugePageMemoryAllocator(allocatorSettings);
+
+		result = g_deckLinkInput->SetVideoInputFrameMemoryAllocator(allocator);
+		if (result != S_OK)
+		{
+			fprintf(stderr, "Could not set the input frame memory allocator\n");
+			goto bail;
+		}
+	}
+
 	// Get the display mode
 	if (g_config.m_displayModeIndex == -1)
 	{
@@ -312,6 +511,35 @@ int main(int argc, char *argv[])
 	// Print the selected configuration
 	g_config.DisplayConfiguration();
 
+	// Profile the capture callback before it is installed
+	if (g_config.m_profileInterval > 0)
+		g_profiler = new CaptureLatencyProfiler(g_deckLinkInput, "Capture", g_config.m_profileInterval);
+
+	if (g_config.m_sharedRingName != NULL)
+	{
+		SharedFrameRingSettings ringSettings;
+
+		// Format detection may switch to a larger mode or to RGB, so size slots for the
+		// largest frame the input could deliver
+		if (g_config.m_inputFlags & bmdVideoInputEnableFormatDetection)
+			ringSettings.maxVideoBytes = largestVideoFrameBytes(g_deckLinkInput);
+		else
+			ringSettings.maxVideoBytes = (size_t)rowBytesForPixelFormat(g_config.m_pixelFormat, displayMode->GetWidth()) * displayMode->GetHeight();
+
+		// Packets are one frame of audio; allow 100 ms
+		ringSettings.maxAudioBytes = 4800 * g_config.m_audioChannels * (g_config.m_audioSampleDepth / 8);
+		ringSettings.audioChannels = g_config.m_audioChannels;
+		ringSettings.audioSampleDepth = g_config.m_audioSampleDepth;
+		ringSettings.timecodeFormat = g_config.m_timecodeFormat;
+
+		g_sharedRing = new SharedFrameRingWriter();
+		if (g_sharedRing->Create(g_config.m_sharedRingName, ringSettings) != S_OK)
+		{
+			fprintf(stderr, "Could not create shared frame ring \"%s\"\n", g_config.m_sharedRingName);
+			goto bail;
+		}
+	}
+
 	// Configure the capture callback
 	delegate = new DeckLinkCaptureDelegate();
 	g_deckLinkInput->SetCallback(delegate);
@@ -319,18 +547,61 @@ int main(int argc, char *argv[])
 	// Open output files
 	if (g_config.m_videoOutputFile != NULL)
 	{
-		g_videoOutputFile = open(g_config.m_videoOutputFile, O_WRONLY|O_CREAT|O_TRUNC, 0664);
-		if (g_videoOutputFile < 0)
+		g_videoOutputFile = new AsyncFileWriter();
+		if (!g_videoOutputFile->Open(g_config.m_videoOutputFile))
 		{
 			fprintf(stderr, "Could not open video output file \"%s\"\n", g_config.m_videoOutputFile);
 			goto bail;
 		}
 	}
 
+	if (g_config.m_segmentBasePath != NULL)
+	{
+		CaptureContainerSettings	containerSettings;
+		BMDTimeValue				frameDuration;
+		BMDTimeScale				timeScale;
+
+		containerSettings.basePath = g_config.m_segmentBasePath;
+		containerSettings.maxSegmentBytes = (uint64_t)g_config.m_segmentMegabytes * 1024 * 1024;
+		containerSettings.maxSegmentSeconds = g_config.m_segmentSeconds;
+		containerSettings.audioChannels = g_config.m_audioChannels;
+		containerSettings.audioSampleDepth = g_config.m_audioSampleDepth;
+		containerSettings.timecodeFormat = g_config.m_timecodeFormat;
+
+		g_containerWriter = new CaptureContainerWriter();
+		if (!g_containerWriter->Open(containerSettings))
+			goto bail;
+
+		displayMode->GetFrameRate(&frameDuration, &timeScale);
+		g_containerWriter->SetVideoFormat(displayMode->GetDisplayMode(), displayMode->GetFieldDominance(), frameDuration, timeScale, (g_config.m_inputFlags & bmdVideoInputDualStream3D) != 0);
+	}
+
+	if (g_config.m_movieOutputFile != NULL)
+	{
+		MovFileWriterSettings	movieSettings;
+		BMDTimeValue			frameDuration;
+		BMDTimeScale			timeScale;
+
+		// 32 bit capture carries 24 bit samples, so the movie stores those
+		movieSettings.audioChannels = g_config.m_audioChannels;
+		movieSettings.audioSampleDepth = g_config.m_audioSampleDepth;
+		movieSettings.audioStoredBits = (g_config.m_audioSampleDepth == 32) ? 24 : 16;
+
+		g_movieWriter = new MovFileWriter();
+		if (!g_movieWriter->Open(g_config.m_movieOutputFile, movieSettings))
+		{
+			fprintf(stderr, "Could not open movie file \"%s\"\n", g_config.m_movieOutputFile);
+			goto bail;
+		}
+
+		displayMode->GetFrameRate(&frameDuration, &timeScale);
+		g_movieWriter->SetVideoFormat(frameDuration, timeScale, displayMode->GetFieldDominance());
+	}
+
 	if (g_config.m_audioOutputFile != NULL)
 	{
-		g_audioOutputFile = open(g_config.m_audioOutputFile, O_WRONLY|O_CREAT|O_TRUNC, 0664);
-		if (g_audioOutputFile < 0)
+		g_audioOutputFile = new AsyncFileWriter();
+		if (!g_audioOutputFile->Open(g_config.m_audioOutputFile))
 		{
 			fprintf(stderr, "Could not open audio output file \"%s\"\n", g_config.m_audioOutputFile);
 			goto bail;
@@ -370,11 +641,56 @@ int main(int argc, char *argv[])
 	}
 
 bail:
-	if (g_videoOutputFile != 0)
-		close(g_videoOutputFile);
+	if (g_videoOutputFile != NULL)
+	{
+		g_videoOutputFile->Close();
+		printWriterStatistics("Video output", g_videoOutputFile);
+		delete g_videoOutputFile;
+	}
 
-	if (g_audioOutputFile != 0)
-		close(g_audioOutputFile);
+	if (g_audioOutputFile != NULL)
+	{
+		g_audioOutputFile->Close();
+		printWriterStatistics("Audio output", g_audioOutputFile);
+		delete g_audioOutputFile;
+	}
+
+	if (g_containerWriter != NULL)
+	{
+		g_containerWriter->Close();
+		printContainerStatistics(g_containerWriter);
+		delete g_containerWriter;
+		g_containerWriter = NULL;
+	}
+
+	if (g_movieWriter != NULL)
+	{
+		g_movieWriter->Close();
+		printMovieStatistics(g_movieWriter);
+		delete g_movieWriter;
+		g_movieWriter = NULL;
+	}
+
+	if (g_profiler != NULL)
+	{
+		g_profiler->WriteSummary(stderr);
+		delete g_profiler;
+		g_profiler = NULL;
+	}
+
+	if (g_sharedRing != NULL)
+	{
+		printSharedRingStatistics(g_sharedRing);
+		g_sharedRing->Close();
+		delete g_sharedRing;
+		g_sharedRing = NULL;
+	}
+
+	if (allocator != NULL)
+	{
+		printAllocatorStatistics(allocator);
+		allocator->Release();
+	}
 
 	if (displayModeName != NULL)
 		free(displayModeName);
@@ -0,0 +1,773 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "CaptureContainer.h"
+#include "AsyncFileWriter.h"
+
+// The index is reserved when a segment is opened and never grows on the callback thread;
+// a segment ends when its index is full, keeping room for audio that arrives without video
+static const size_t kMaxSegmentIndexEntries		= 60 * 60 * 60;		// An hour at 60 frames per second
+static const size_t kSegmentIndexHeadroom		= 256;
+static const uint32_t kMaxFramesPerSecond		= 120;
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool WriteAll(int fd, const void* data, size_t size, uint64_t offset)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	while (size > 0)
+	{
+		ssize_t result = pwrite(fd, bytes, size, (off_t)offset);
+
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;
+
+		bytes += result;
+		offset += result;
+		size -= result;
+	}
+
+	return true;
+}
+
+size_t LayOutCaptureRecord(uint64_t fileOffset, uint32_t payloadAlignment, CaptureRecordHeader* header, uint8_t* block, uint64_t* payloadFileOffset)
+{
+	uint64_t headerOffset = AlignUp(fileOffset, kCaptureRecordAlignment);
+	uint64_t payloadOffset = AlignUp(headerOffset + sizeof(CaptureRecordHeader), payloadAlignment);
+
+	header->magic = kCaptureRecordMagic;
+	header->payloadOffset = (uint32_t)(payloadOffset - headerOffset);
+
+	if (block != NULL)
+	{
+		memset(block, 0, payloadOffset - fileOffset);
+		memcpy(block + (headerOffset - fileOffset), header, sizeof(CaptureRecordHeader));
+	}
+
+	*payloadFileOffset = payloadOffset;
+	return (size_t)(payloadOffset - fileOffset);
+}
+
+HRESULT WriteCaptureSegmentIndex(int fd, CaptureSegmentHeader* header, const std::vector<CaptureIndexEntry>& index)
+{
+	header->indexOffset = AlignUp(header->dataEnd, kCaptureRecordAlignment);
+	header->indexCount = index.size();
+
+	if (!WriteAll(fd, index.data(), index.size() * sizeof(CaptureIndexEntry), header->indexOffset))
+		return E_FAIL;
+
+	if (ftruncate(fd, (off_t)(header->indexOffset + index.size() * sizeof(CaptureIndexEntry))) != 0)
+		return E_FAIL;
+
+	// The index must be on disk before the header points at it
+	fdatasync(fd);
+
+	if (!WriteAll(fd, header, sizeof(CaptureSegmentHeader), 0))
+		return E_FAIL;
+
+	fdatasync(fd);
+	return S_OK;
+}
+
+CaptureContainerWriter::CaptureContainerWriter() :
+	m_segment(NULL),
+	m_nextSegmentNumber(0),
+	m_formatChanged(false),
+	m_displayMode(0),
+	m_fieldDominance(bmdUnknownFieldDominance),
+	m_frameDuration(0),
+	m_timeScale(0),
+	m_stereo3D(false),
+	m_threadRunning(false),
+	m_spare(NULL),
+	m_spareWanted(false),
+	m_spareOpening(false),
+	m_closing(false)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+CaptureContainerWriter::~CaptureContainerWriter()
+{
+	Close();
+
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+bool CaptureContainerWriter::Open(const CaptureContainerSettings& settings)
+{
+	if (m_threadRunning)
+		return false;
+
+	m_settings = settings;
+	m_nextSegmentNumber = 1;
+	m_spareWanted = false;
+	m_spareOpening = false;
+	m_closing = false;
+	memset(&m_statistics, 0, sizeof(m_statistics));
+
+	// Open the first segment's file straight away, to report a bad path now
+	m_spare = openSegment(0);
+	if (m_spare == NULL)
+		return false;
+
+	if (pthread_create(&m_thread, NULL, segmentThreadFunc, this) != 0)
+	{
+		discardSegment(m_spare);
+		m_spare = NULL;
+		return false;
+	}
+
+	m_threadRunning = true;
+	return true;
+}
+
+void CaptureContainerWriter::Close(void)
+{
+	if (!m_threadRunning)
+		return;
+
+	endSegment();
+
+	pthread_mutex_lock(&m_mutex);
+	m_closing = true;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+
+	pthread_join(m_thread, NULL);
+	m_threadRunning = false;
+
+	if (m_spare != NULL)
+	{
+		discardSegment(m_spare);
+		m_spare = NULL;
+	}
+}
+
+void CaptureContainerWriter::SetVideoFormat(BMDDisplayMode displayMode, BMDFieldDominance fieldDominance, BMDTimeValue frameDuration, BMDTimeScale timeScale, bool stereo3D)
+{
+	m_formatChanged = (m_segment != NULL) &&
+		((displayMode != m_displayMode) || (fieldDominance != m_fieldDominance) ||
+		 (frameDuration != m_frameDuration) || (timeScale != m_timeScale) || (stereo3D != m_stereo3D));
+
+	m_displayMode = displayMode;
+	m_fieldDominance = fieldDominance;
+	m_frameDuration = frameDuration;
+	m_timeScale = timeScale;
+	m_stereo3D = stereo3D;
+}
+
+CaptureContainerWriter::Segment* CaptureContainerWriter::openSegment(uint32_t segmentNumber)
+{
+	Segment*	segment = new Segment();
+	char		suffix[32];
+
+	snprintf(suffix, sizeof(suffix), "_%06u.dlcs", segmentNumber);
+
+	segment->number = segmentNumber;
+	segment->path = m_settings.basePath + suffix;
+	segment->writer = new AsyncFileWriter();
+	segment->fileOffset = 0;
+	memset(&segment->header, 0, sizeof(segment->header));
+
+	if (!segment->writer->Open(segment->path.c_str()))
+	{
+		fprintf(stderr, "Could not open capture segment \"%s\"\n", segment->path.c_str());
+		delete segment->writer;
+		delete segment;
+		return NULL;
+	}
+
+	if (m_settings.maxSegmentSeconds > 0)
+		segment->index.reserve(std::min((size_t)m_settings.maxSegmentSeconds * kMaxFramesPerSecond + kSegmentIndexHeadroom, kMaxSegmentIndexEntries));
+	else
+		segment->index.reserve(kMaxSegmentIndexEntries);
+	return segment;
+}
+
+void CaptureContainerWriter::discardSegment(Segment* segment)
+{
+	segment->writer->Close();
+	unlink(segment->path.c_str());
+
+	delete segment->writer;
+	delete segment;
+}
+
+bool CaptureContainerWriter::startSegment(IDeckLinkVideoInputFrame* videoFrame)
+{
+	Segment*				segment = NULL;
+	uint8_t					block[kCaptureSegmentHeaderSize];
+	uint32_t				segmentNumber;
+
+	pthread_mutex_lock(&m_mutex);
+
+	// Only segments shorter than the time it takes to open a file catch the spare
+	// still opening
+	while ((m_spare == NULL) && m_spareOpening)
+		pthread_cond_wait(&m_cond, &m_mutex);
+
+	segment = m_spare;
+	m_spare = NULL;
+	segmentNumber = (segment != NULL) ? segment->number : m_nextSegmentNumber++;
+
+	m_spareWanted = true;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+
+	// Opening the spare failed, so try again here
+	if (segment == NULL)
+		segment = openSegment(segmentNumber);
+	if (segment == NULL)
+		return false;
+
+	CaptureSegmentHeader& header = segment->header;
+
+	header.magic = kCaptureSegmentMagic;
+	header.version = kCaptureSegmentVersion;
+	header.segmentNumber = segmentNumber;
+	header.flags = m_stereo3D ? kCaptureSegmentStereo3D : 0;
+	header.displayMode = m_displayMode;
+	header.fieldDominance = m_fieldDominance;
+	header.pixelFormat = videoFrame->GetPixelFormat();
+	header.width = (uint32_t)videoFrame->GetWidth();
+	header.height = (uint32_t)videoFrame->GetHeight();
+	header.rowBytes = (uint32_t)videoFrame->GetRowBytes();
+	header.frameDuration = m_frameDuration;
+	header.timeScale = m_timeScale;
+	header.audioSampleRate = kCaptureAudioTimeScale;
+	header.audioChannels = m_settings.audioChannels;
+	header.audioSampleDepth = m_settings.audioSampleDepth;
+	header.timecodeFormat = m_settings.timecodeFormat;
+	header.creationTime = (int64_t)time(NULL);
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, &header, sizeof(header));
+	segment->writer->Write(block, sizeof(block));
+
+	segment->fileOffset = kCaptureSegmentHeaderSize;
+	m_segment = segment;
+	m_formatChanged = false;
+	return true;
+}
+
+void CaptureContainerWriter::endSegment(void)
+{
+	if (m_segment == NULL)
+		return;
+
+	m_segment->header.dataEnd = m_segment->fileOffset;
+
+	pthread_mutex_lock(&m_mutex);
+	m_finishQueue.push_back(m_segment);
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+
+	m_segment = NULL;
+}
+
+void CaptureContainerWriter::layOutRecord(CaptureRecordHeader* header, uint32_t payloadAlignment, uint8_t* block, uint64_t* fileOffset, uint64_t* payloadFileOffset, AsyncWriteSpan* span)
+{
+	// Copied into the writer's queue, so the block is free again once Write() returns
+	span->data = block;
+	span->size = LayOutCaptureRecord(*fileOffset, payloadAlignment, header, block, payloadFileOffset);
+	span->owner = NULL;
+
+	*fileOffset = *payloadFileOffset + header->payloadBytes;
+}
+
+bool CaptureContainerWriter::WriteFrame(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkVideoFrame* rightEyeFrame, IDeckLinkAudioInputPacket* audioPacket)
+{
+	CaptureIndexEntry	entry;
+	bool				hasVideo = (videoFrame != NULL) && !(videoFrame->GetFlags() & bmdFrameHasNoInputSource);
+	uint64_t			videoBytes = 0;
+	uint64_t			audioBytes = 0;
+	AsyncWriteSpan		spans[5];
+	unsigned			spanCount = 0;
+	uint64_t			fileOffset;
+	void*				bytes;
+
+	if (!m_threadRunning)
+		return false;
+
+	if (videoFrame != NULL)
+	{
+		videoBytes = (uint64_t)videoFrame->GetRowBytes() * videoFrame->GetHeight();
+		if (m_stereo3D)
+			videoBytes *= 2;
+	}
+
+	if (audioPacket != NULL)
+		audioBytes = (uint64_t)audioPacket->GetSampleFrameCount() * m_settings.audioChannels * (m_settings.audioSampleDepth / 8);
+
+	// Roll over to a new segment on a change of format, when this frame would take the
+	// segment past its size or duration limit, or when its index is nearly full
+	if ((m_segment != NULL) && (videoFrame != NULL))
+	{
+		const CaptureSegmentHeader& header = m_segment->header;
+		bool rollOver = m_formatChanged ||
+			(videoFrame->GetPixelFormat() != (BMDPixelFormat)header.pixelFormat) ||
+			(videoFrame->GetWidth() != header.width) ||
+			(videoFrame->GetHeight() != header.height) ||
+			(videoFrame->GetRowBytes() != header.rowBytes) ||
+			(m_segment->index.size() + kSegmentIndexHeadroom >= m_segment->index.capacity());
+
+		if (!m_segment->index.empty())
+		{
+			if ((m_settings.maxSegmentBytes > 0) &&
+				(m_segment->fileOffset + kCaptureVideoAlignment * 2 + videoBytes + audioBytes > m_settings.maxSegmentBytes))
+				rollOver = true;
+
+			if (m_settings.maxSegmentSeconds > 0)
+			{
+				BMDTimeValue streamTime;
+				BMDTimeValue frameDuration;
+
+				videoFrame->GetStreamTime(&streamTime, &frameDuration, header.timeScale);
+				if (streamTime + frameDuration - m_segment->index.front().streamTime > (int64_t)m_settings.maxSegmentSeconds * header.timeScale)
+					rollOver = true;
+			}
+		}
+
+		if (rollOver)
+			endSegment();
+	}
+
+	// A segment starts with a video frame, which decides its dimensions
+	if (m_segment == NULL)
+	{
+		if ((videoFrame == NULL) || !startSegment(videoFrame))
+			return false;
+	}
+
+	// Only a long run of audio without video fills the headroom
+	if (m_segment->index.size() == m_segment->index.capacity())
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_statistics.framesDropped++;
+		pthread_mutex_unlock(&m_mutex);
+		return false;
+	}
+
+	memset(&entry, 0, sizeof(entry));
+	fileOffset = m_segment->fileOffset;
+
+	if (videoFrame != NULL)
+	{
+		CaptureRecordHeader		record;
+		IDeckLinkTimecode*		timecode;
+
+		memset(&record, 0, sizeof(record));
+		record.type = kCaptureRecordVideo;
+		record.frameNumber = m_segment->index.size();
+		record.frameFlags = videoFrame->GetFlags();
+		videoFrame->GetStreamTime(&record.time, &record.duration, m_segment->header.timeScale);
+
+		if ((m_settings.timecodeFormat != 0) && (videoFrame->GetTimecode(m_settings.timecodeFormat, &timecode) == S_OK))
+		{
+			record.timecodeBCD = timecode->GetBCD();
+			record.timecodeFlags = timecode->GetFlags() | kCaptureTimecodeValid;
+			timecode->Release();
+		}
+
+		entry.streamTime = record.time;
+		entry.frameDuration = record.duration;
+		entry.timecodeBCD = record.timecodeBCD;
+		entry.timecodeFlags = record.timecodeFlags;
+		entry.frameFlags = record.frameFlags;
+
+		// Frames without input are indexed but carry no picture
+		if (hasVideo)
+		{
+			record.payloadBytes = videoBytes;
+			layOutRecord(&record, kCaptureVideoAlignment, m_recordBlocks[0], &fileOffset, &entry.videoOffset, &spans[spanCount++]);
+			entry.videoBytes = videoBytes;
+
+			videoFrame->GetBytes(&bytes);
+			spans[spanCount].data = bytes;
+			spans[spanCount].size = videoFrame->GetRowBytes() * videoFrame->GetHeight();
+			spans[spanCount++].owner = videoFrame;
+
+			if (m_stereo3D)
+			{
+				IDeckLinkVideoFrame* secondEye = (rightEyeFrame != NULL) ? rightEyeFrame : videoFrame;
+
+				// Without a right eye the left eye is repeated, to keep the payload size fixed
+				secondEye->GetBytes(&bytes);
+				spans[spanCount].data = bytes;
+				spans[spanCount].size = videoFrame->GetRowBytes() * videoFrame->GetHeight();
+				spans[spanCount++].owner = secondEye;
+			}
+		}
+		else
+		{
+			record.payloadBytes = 0;
+			layOutRecord(&record, kCaptureRecordAlignment, m_recordBlocks[0], &fileOffset, &entry.videoOffset, &spans[spanCount++]);
+			entry.videoOffset = 0;
+		}
+	}
+	else if (!m_segment->index.empty())
+	{
+		// Audio without video continues from the previous frame, with no duration
+		const CaptureIndexEntry& previous = m_segment->index.back();
+		entry.streamTime = previous.streamTime + previous.frameDuration;
+	}
+
+	if (audioPacket != NULL)
+	{
+		CaptureRecordHeader record;
+
+		memset(&record, 0, sizeof(record));
+		record.type = kCaptureRecordAudio;
+		record.frameNumber = m_segment->index.size();
+		record.sampleFrames = (uint32_t)audioPacket->GetSampleFrameCount();
+		record.payloadBytes = audioBytes;
+		audioPacket->GetPacketTime(&record.time, kCaptureAudioTimeScale);
+		record.duration = record.sampleFrames;
+
+		layOutRecord(&record, kCaptureRecordAlignment, m_recordBlocks[1], &fileOffset, &entry.audioOffset, &spans[spanCount++]);
+		entry.audioSampleFrames = record.sampleFrames;
+		entry.audioPacketTime = record.time;
+
+		audioPacket->GetBytes(&bytes);
+		spans[spanCount].data = bytes;
+		spans[spanCount].size = audioBytes;
+		spans[spanCount++].owner = audioPacket;
+	}
+
+	// The records of a call are written whole or not at all, so a frame the writer has no
+	// room for leaves no trace in the segment, and is missing from its index
+	if (!m_segment->writer->Write(spans, spanCount))
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_statistics.framesDropped++;
+		pthread_mutex_unlock(&m_mutex);
+		return false;
+	}
+
+	m_segment->fileOffset = fileOffset;
+	m_segment->index.push_back(entry);
+	return true;
+}
+
+void CaptureContainerWriter::GetStatistics(CaptureContainerStatistics* statistics)
+{
+	pthread_mutex_lock(&m_mutex);
+	*statistics = m_statistics;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void* CaptureContainerWriter::segmentThreadFunc(void* arg)
+{
+	((CaptureContainerWriter*)arg)->segmentThread();
+	return NULL;
+}
+
+void CaptureContainerWriter::segmentThread(void)
+{
+	pthread_mutex_lock(&m_mutex);
+
+	while (true)
+	{
+		while (m_finishQueue.empty() && !(m_spareWanted && (m_spare == NULL)) && !m_closing)
+			pthread_cond_wait(&m_cond, &m_mutex);
+
+		if (!m_finishQueue.empty())
+		{
+			Segment* segment = m_finishQueue.front();
+			m_finishQueue.pop_front();
+
+			pthread_mutex_unlock(&m_mutex);
+			finishSegment(segment);
+			pthread_mutex_lock(&m_mutex);
+			continue;
+		}
+
+		if (m_closing)
+			break;
+
+		// Open the next segment's file before it is needed
+		uint32_t segmentNumber = m_nextSegmentNumber++;
+		m_spareWanted = false;
+		m_spareOpening = true;
+
+		pthread_mutex_unlock(&m_mutex);
+		Segment* spare = openSegment(segmentNumber);
+		pthread_mutex_lock(&m_mutex);
+
+		m_spare = spare;
+		m_spareOpening = false;
+		pthread_cond_broadcast(&m_cond);
+	}
+
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void CaptureContainerWriter::finishSegment(Segment* segment)
+{
+	AsyncFileWriterStatistics	writerStatistics;
+	int							fd;
+	bool						failed;
+
+	// Waits for the queued frames to reach the disk
+	segment->writer->Close();
+	segment->writer->GetStatistics(&writerStatistics);
+	failed = writerStatistics.failed;
+
+	fd = open(segment->path.c_str(), O_WRONLY);
+	if ((fd < 0) || (WriteCaptureSegmentIndex(fd, &segment->header, segment->index) != S_OK))
+	{
+		fprintf(stderr, "Could not write the index of capture segment \"%s\"\n", segment->path.c_str());
+		failed = true;
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	pthread_mutex_lock(&m_mutex);
+	m_statistics.segmentsClosed++;
+	m_statistics.framesWritten += segment->index.size();
+	m_statistics.bytesWritten += writerStatistics.bytesWritten;
+	m_statistics.failed = m_statistics.failed || failed;
+	pthread_mutex_unlock(&m_mutex);
+
+	delete segment->writer;
+	delete segment;
+}
+
+CaptureSegmentReader::CaptureSegmentReader() :
+	m_fd(-1),
+	m_mapping(NULL),
+	m_mappingSize(0),
+	m_recovered(false)
+{
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+CaptureSegmentReader::~CaptureSegmentReader()
+{
+	Close();
+}
+
+HRESULT CaptureSegmentReader::Open(const char* path)
+{
+	struct stat		fileStat;
+	void*			mapping;
+
+	Close();
+
+	m_fd = open(path, O_RDONLY);
+	if (m_fd < 0)
+		return E_FAIL;
+
+	if ((fstat(m_fd, &fileStat) != 0) || ((size_t)fileStat.st_size < kCaptureSegmentHeaderSize))
+		goto bail;
+
+	mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (mapping == MAP_FAILED)
+		goto bail;
+
+	m_mapping = (const uint8_t*)mapping;
+	m_mappingSize = fileStat.st_size;
+	memcpy(&m_header, m_mapping, sizeof(m_header));
+
+	if ((m_header.magic != kCaptureSegmentMagic) || (m_header.version != kCaptureSegmentVersion))
+		goto bail;
+
+	if ((m_header.indexOffset != 0) &&
+		(m_header.indexOffset + m_header.indexCount * sizeof(CaptureIndexEntry) <= m_mappingSize))
+	{
+		const CaptureIndexEntry* index = (const CaptureIndexEntry*)(m_mapping + m_header.indexOffset);
+		m_index.assign(index, index + m_header.indexCount);
+		m_recovered = false;
+	}
+	else if (!rebuildIndex())
+		goto bail;
+
+	return S_OK;
+
+bail:
+	Close();
+	return E_FAIL;
+}
+
+void CaptureSegmentReader::Close(void)
+{
+	if (m_mapping != NULL)
+	{
+		munmap((void*)m_mapping, m_mappingSize);
+		m_mapping = NULL;
+		m_mappingSize = 0;
+	}
+
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+
+	m_index.clear();
+	m_recovered = false;
+}
+
+bool CaptureSegmentReader::rebuildIndex(void)
+{
+	uint64_t	offset = kCaptureSegmentHeaderSize;
+	uint64_t	dataEnd = m_mappingSize;
+	off_t		hole;
+
+	m_index.clear();
+	m_recovered = true;
+
+	// Chunks may complete out of order, so data is only trusted up to the first hole;
+	// past it, a record whose header made it to disk may still be missing its payload
+	hole = lseek(m_fd, 0, SEEK_HOLE);
+	if ((hole >= 0) && ((uint64_t)hole < dataEnd))
+		dataEnd = hole;
+
+	// Records are only read up to the first one that is missing or incomplete; frames
+	// written after it by out of order completions cannot be trusted
+	while (offset + sizeof(CaptureRecordHeader) <= dataEnd)
+	{
+		const CaptureRecordHeader*	record = (const CaptureRecordHeader*)(m_mapping + offset);
+		uint64_t					payloadOffset = offset + record->payloadOffset;
+
+		if ((record->magic != kCaptureRecordMagic) ||
+			(payloadOffset + record->payloadBytes > dataEnd) ||
+			(record->frameNumber + 1 < m_index.size()) ||
+			(record->frameNumber > m_index.size()))
+			break;
+
+		if (record->frameNumber == m_index.size())
+		{
+			CaptureIndexEntry entry;
+
+			memset(&entry, 0, sizeof(entry));
+			if ((record->type != kCaptureRecordVideo) && !m_index.empty())
+				entry.streamTime = m_index.back().streamTime + m_index.back().frameDuration;
+			m_index.push_back(entry);
+		}
+
+		CaptureIndexEntry& entry = m_index.back();
+
+		if (record->type == kCaptureRecordVideo)
+		{
+			entry.streamTime = record->time;
+			entry.frameDuration = record->duration;
+			entry.timecodeBCD = record->timecodeBCD;
+			entry.timecodeFlags = record->timecodeFlags;
+			entry.frameFlags = record->frameFlags;
+			if (record->payloadBytes > 0)
+			{
+				entry.videoOffset = payloadOffset;
+				entry.videoBytes = record->payloadBytes;
+			}
+		}
+		else if (record->type == kCaptureRecordAudio)
+		{
+			entry.audioOffset = payloadOffset;
+			entry.audioSampleFrames = record->sampleFrames;
+			entry.audioPacketTime = record->time;
+		}
+
+		offset = AlignUp(payloadOffset + record->payloadBytes, kCaptureRecordAlignment);
+		m_header.dataEnd = offset;
+	}
+
+	return true;
+}
+
+const void* CaptureSegmentReader::GetVideoBytes(uint64_t frame) const
+{
+	if ((frame >= m_index.size()) || (m_index[frame].videoOffset == 0))
+		return NULL;
+
+	return m_mapping + m_index[frame].videoOffset;
+}
+
+const void* CaptureSegmentReader::GetAudioBytes(uint64_t frame) const
+{
+	if ((frame >= m_index.size()) || (m_index[frame].audioOffset == 0))
+		return NULL;
+
+	return m_mapping + m_index[frame].audioOffset;
+}
+
+uint64_t CaptureSegmentReader::GetAudioByteCount(uint64_t frame) const
+{
+	if (frame >= m_index.size())
+		return 0;
+
+	return (uint64_t)m_index[frame].audioSampleFrames * m_header.audioChannels * (m_header.audioSampleDepth / 8);
+}
+
+int64_t CaptureSegmentReader::FindFrameAtStreamTime(BMDTimeValue streamTime) const
+{
+	// Stream times only increase within a segment
+	auto it = std::upper_bound(m_index.begin(), m_index.end(), streamTime,
+		[](BMDTimeValue time, const CaptureIndexEntry& entry) { return time < entry.streamTime; });
+
+	// Step back over entries of audio alone, which have no duration
+	while (it != m_index.begin())
+	{
+		--it;
+		if (it->frameDuration > 0)
+			return (streamTime < it->streamTime + it->frameDuration) ? (int64_t)(it - m_index.begin()) : -1;
+	}
+
+	return -1;
+}
+
+int64_t CaptureSegmentReader::FindFrameWithTimecode(BMDTimecodeBCD timecode) const
+{
+	for (size_t i = 0; i < m_index.size(); i++)
+	{
+		if ((m_index[i].timecodeFlags & kCaptureTimecodeValid) && (m_index[i].timecodeBCD == timecode))
+			return (int64_t)i;
+	}
+
+	return -1;
+}
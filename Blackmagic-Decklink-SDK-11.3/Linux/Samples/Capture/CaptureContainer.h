@@ -0,0 +1,279 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#ifndef __CAPTURE_CONTAINER_H__
+#define __CAPTURE_CONTAINER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+class AsyncFileWriter;
+struct AsyncWriteSpan;
+
+// A capture is written as a series of segment files, each holding one video format.
+// Layout of a segment:
+//
+//   CaptureSegmentHeader, padded to kCaptureSegmentHeaderSize
+//   records, in the order frames and audio packets arrived
+//   CaptureIndexEntry[indexCount], at indexOffset
+//
+// Each record is a CaptureRecordHeader on a kCaptureRecordAlignment boundary followed by
+// its payload. Video payloads start on a kCaptureVideoAlignment boundary so a mapped
+// frame can be handed straight to a DeckLink output or read with O_DIRECT. The index
+// is written when the segment is closed; a segment cut short by a crash has
+// indexOffset 0, and its index is rebuilt by stepping from record header to record
+// header. All fields are little endian.
+
+static const uint32_t kCaptureSegmentMagic			= 0x53434c44;	// "DLCS"
+static const uint32_t kCaptureRecordMagic			= 0x52434c44;	// "DLCR"
+static const uint32_t kCaptureSegmentVersion		= 1;
+static const uint32_t kCaptureSegmentHeaderSize		= 4096;
+static const uint32_t kCaptureVideoAlignment		= 4096;
+static const uint32_t kCaptureRecordAlignment		= 64;
+static const uint32_t kCaptureAudioTimeScale		= 48000;
+
+enum
+{
+	kCaptureSegmentStereo3D		= 1 << 0		// Video payloads are the left eye followed by the right eye
+};
+
+// Set in the timecode flags of records and index entries that carry a timecode
+static const uint32_t kCaptureTimecodeValid			= 1U << 31;
+
+enum
+{
+	kCaptureRecordVideo			= 1,
+	kCaptureRecordAudio			= 2
+};
+
+struct CaptureSegmentHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	segmentNumber;
+	uint32_t	flags;
+	uint32_t	displayMode;			// BMDDisplayMode
+	uint32_t	fieldDominance;			// BMDFieldDominance
+	uint32_t	pixelFormat;			// BMDPixelFormat
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	rowBytes;
+	int64_t		frameDuration;
+	int64_t		timeScale;				// Of frameDuration and the stream times in the index
+	uint32_t	audioSampleRate;
+	uint32_t	audioChannels;
+	uint32_t	audioSampleDepth;
+	uint32_t	timecodeFormat;			// BMDTimecodeFormat of the index timecodes, 0 for none
+	uint64_t	dataEnd;				// End of the last record
+	uint64_t	indexOffset;			// 0 until the segment is closed
+	uint64_t	indexCount;
+	int64_t		creationTime;			// Seconds since the epoch
+};
+
+struct CaptureRecordHeader
+{
+	uint32_t	magic;
+	uint32_t	type;
+	uint64_t	frameNumber;			// Index entry the record belongs to
+	uint32_t	payloadOffset;			// From the start of this header
+	uint32_t	sampleFrames;			// Audio records only
+	uint64_t	payloadBytes;
+	int64_t		time;					// Stream time of video, packet time of audio
+	int64_t		duration;
+	uint32_t	timecodeBCD;
+	uint32_t	timecodeFlags;
+	uint32_t	frameFlags;				// BMDFrameFlags
+	uint32_t	reserved;
+};
+
+struct CaptureIndexEntry
+{
+	int64_t		streamTime;
+	int64_t		frameDuration;
+	int64_t		audioPacketTime;		// In kCaptureAudioTimeScale units
+	uint64_t	videoOffset;			// Payloads, from the start of the file; 0 when absent
+	uint64_t	videoBytes;
+	uint64_t	audioOffset;
+	uint32_t	audioSampleFrames;
+	uint32_t	timecodeBCD;
+	uint32_t	timecodeFlags;			// BMDTimecodeFlags | kCaptureTimecodeValid
+	uint32_t	frameFlags;
+};
+
+// Lays out a record that starts at fileOffset: padding to kCaptureRecordAlignment, the
+// header, then padding so the payload lands on payloadAlignment. Fills header's
+// payloadOffset and returns the bytes to write before the payload, which are placed in
+// block when it is not NULL. *payloadFileOffset receives the payload's file offset.
+size_t	LayOutCaptureRecord(uint64_t fileOffset, uint32_t payloadAlignment, CaptureRecordHeader* header, uint8_t* block, uint64_t* payloadFileOffset);
+
+// Writes the index after dataEnd and rewrites the segment header to point at it
+HRESULT	WriteCaptureSegmentIndex(int fd, CaptureSegmentHeader* header, const std::vector<CaptureIndexEntry>& index);
+
+struct CaptureContainerSettings
+{
+	std::string			basePath;				// Segments are named <basePath>_NNNNNN.dlcs
+	uint64_t			maxSegmentBytes;		// 0 for no size limit
+	uint32_t			maxSegmentSeconds;		// 0 for no duration limit
+	uint32_t			audioChannels;
+	uint32_t			audioSampleDepth;
+	BMDTimecodeFormat	timecodeFormat;
+
+	CaptureContainerSettings() :
+		maxSegmentBytes(0),
+		maxSegmentSeconds(0),
+		audioChannels(2),
+		audioSampleDepth(16),
+		timecodeFormat(0)
+	{ }
+};
+
+// Totals over the segments closed so far
+struct CaptureContainerStatistics
+{
+	uint32_t	segmentsClosed;
+	uint64_t	framesWritten;
+	uint64_t	framesDropped;			// So far, left out as the disk had fallen behind
+	uint64_t	bytesWritten;
+	bool		failed;
+};
+
+// Writes captured frames and audio into segment files from the DeckLink callback thread.
+// The data goes through an AsyncFileWriter per segment, so the callback only queues
+// each frame, and drops it with its audio if the disk has fallen behind. A background
+// thread closes each finished segment and writes its index, and opens the next
+// segment's file ahead of time, so rolling over to a new segment does not wait for
+// the disk either. The index is reserved when the file is opened, for the duration
+// limit or an hour at 60 fps, and a segment whose index fills also rolls over.
+class CaptureContainerWriter
+{
+public:
+	CaptureContainerWriter();
+	~CaptureContainerWriter();
+
+	bool		Open(const CaptureContainerSettings& settings);
+	void		Close(void);
+
+	// Describes the video that follows. A change of format starts a new segment.
+	void		SetVideoFormat(BMDDisplayMode displayMode, BMDFieldDominance fieldDominance, BMDTimeValue frameDuration, BMDTimeScale timeScale, bool stereo3D);
+
+	// Either frame or packet may be NULL; each call adds one index entry, unless the
+	// writer drops it. Frames without an input source are indexed without video.
+	bool		WriteFrame(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkVideoFrame* rightEyeFrame, IDeckLinkAudioInputPacket* audioPacket);
+
+	void		GetStatistics(CaptureContainerStatistics* statistics);
+
+private:
+	struct Segment
+	{
+		uint32_t						number;
+		AsyncFileWriter*				writer;
+		std::string						path;
+		CaptureSegmentHeader			header;
+		std::vector<CaptureIndexEntry>	index;
+		uint64_t						fileOffset;
+	};
+
+	static void*	segmentThreadFunc(void* arg);
+	void			segmentThread(void);
+	void			finishSegment(Segment* segment);
+
+	Segment*		openSegment(uint32_t segmentNumber);
+	void			discardSegment(Segment* segment);
+	bool			startSegment(IDeckLinkVideoInputFrame* videoFrame);
+	void			endSegment(void);
+	void			layOutRecord(CaptureRecordHeader* header, uint32_t payloadAlignment, uint8_t* block, uint64_t* fileOffset, uint64_t* payloadFileOffset, AsyncWriteSpan* span);
+
+	CaptureContainerSettings	m_settings;
+	Segment*					m_segment;
+	uint32_t					m_nextSegmentNumber;
+	bool						m_formatChanged;
+
+	BMDDisplayMode				m_displayMode;
+	BMDFieldDominance			m_fieldDominance;
+	BMDTimeValue				m_frameDuration;
+	BMDTimeScale				m_timeScale;
+	bool						m_stereo3D;
+
+	pthread_t					m_thread;
+	bool						m_threadRunning;
+	pthread_mutex_t				m_mutex;
+	pthread_cond_t				m_cond;
+	std::deque<Segment*>		m_finishQueue;
+	Segment*					m_spare;				// Opened ahead for the next segment
+	bool						m_spareWanted;
+	bool						m_spareOpening;
+	bool						m_closing;
+
+	CaptureContainerStatistics	m_statistics;
+
+	// Record headers with their padding, for the video and audio of a frame
+	uint8_t						m_recordBlocks[2][kCaptureRecordAlignment + sizeof(CaptureRecordHeader) + kCaptureVideoAlignment];
+};
+
+// Read-only view of one segment, mapped into memory
+class CaptureSegmentReader
+{
+public:
+	CaptureSegmentReader();
+	~CaptureSegmentReader();
+
+	HRESULT							Open(const char* path);
+	void							Close(void);
+
+	const CaptureSegmentHeader&		GetHeader(void) const			{ return m_header; }
+	const std::vector<CaptureIndexEntry>& GetIndex(void) const		{ return m_index; }
+	uint64_t						GetFrameCount(void) const		{ return m_index.size(); }
+
+	// True when the segment was not closed and the index was rebuilt from the records,
+	// up to the first hole in the file
+	bool							WasRecovered(void) const		{ return m_recovered; }
+
+	const void*						GetVideoBytes(uint64_t frame) const;
+	const void*						GetAudioBytes(uint64_t frame) const;
+	uint64_t						GetAudioByteCount(uint64_t frame) const;
+
+	// Index of the frame showing at streamTime, or -1 if it lies outside the segment
+	int64_t							FindFrameAtStreamTime(BMDTimeValue streamTime) const;
+	// Index of the first frame with this timecode, or -1
+	int64_t							FindFrameWithTimecode(BMDTimecodeBCD timecode) const;
+
+private:
+	bool							rebuildIndex(void);
+
+	int								m_fd;
+	const uint8_t*					m_mapping;
+	size_t							m_mappingSize;
+	CaptureSegmentHeader			m_header;
+	std::vector<CaptureIndexEntry>	m_index;
+	bool							m_recovered;
+};
+
+#endif
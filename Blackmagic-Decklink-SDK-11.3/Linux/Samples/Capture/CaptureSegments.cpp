@@ -0,0 +1,327 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "CaptureContainer.h"
+
+// Lists, trims and recovers the segment files written by Capture -o. Everything works
+// from the segment index, so no command reads more of a segment than it needs.
+
+static void DisplayUsage(void)
+{
+	fprintf(stderr,
+		"\n"
+		"Usage: ./CaptureSegments <command> <segment> [arguments]\n"
+		"\n"
+		"    info <segment>                          Describe the segment\n"
+		"    frames <segment>                        List the frames in the index\n"
+		"    trim <segment> <first> <last> <output>  Copy frames first to last, inclusive, to a new segment\n"
+		"    recover <segment>                       Write the index of a segment cut short by a crash\n"
+		"\n"
+		"    ./CaptureSegments trim ingest_000000.dlcs 100 250 clip.dlcs\n"
+		);
+}
+
+static const char* GetPixelFormatName(uint32_t pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return "8 bit YUV (4:2:2)";
+		case bmdFormat10BitYUV:
+			return "10 bit YUV (4:2:2)";
+		case bmdFormat10BitRGB:
+			return "10 bit RGB (4:4:4)";
+	}
+	return "unknown pixel format";
+}
+
+static void FormatTimecode(const CaptureIndexEntry& entry, char* buffer, size_t size)
+{
+	uint32_t bcd = entry.timecodeBCD;
+
+	if (!(entry.timecodeFlags & kCaptureTimecodeValid))
+	{
+		snprintf(buffer, size, "--:--:--:--");
+		return;
+	}
+
+	snprintf(buffer, size, "%02x:%02x:%02x%c%02x",
+		(bcd >> 24) & 0xff,
+		(bcd >> 16) & 0xff,
+		(bcd >> 8) & 0xff,
+		(entry.timecodeFlags & bmdTimecodeIsDropFrame) ? ';' : ':',
+		bcd & 0xff);
+}
+
+static int ShowInfo(const CaptureSegmentReader& reader)
+{
+	const CaptureSegmentHeader&				header = reader.GetHeader();
+	const std::vector<CaptureIndexEntry>&	index = reader.GetIndex();
+	char									firstTimecode[16];
+	char									lastTimecode[16];
+	uint64_t								videoFrames = 0;
+	uint64_t								audioSampleFrames = 0;
+
+	for (const CaptureIndexEntry& entry : index)
+	{
+		if (entry.videoBytes > 0)
+			videoFrames++;
+		audioSampleFrames += entry.audioSampleFrames;
+	}
+
+	printf("Segment %u%s\n", header.segmentNumber, reader.WasRecovered() ? " (not closed, index rebuilt from the records)" : "");
+	printf(" - Video: %ux%u, %s, %u row bytes, %g FPS%s\n",
+		header.width,
+		header.height,
+		GetPixelFormatName(header.pixelFormat),
+		header.rowBytes,
+		(header.frameDuration > 0) ? (double)header.timeScale / header.frameDuration : 0.0,
+		(header.flags & kCaptureSegmentStereo3D) ? ", 3D" : "");
+	printf(" - Audio: %u channels, %u bit, %u Hz\n", header.audioChannels, header.audioSampleDepth, header.audioSampleRate);
+	printf(" - Index: %lu entries, %lu with video, %.2f seconds of audio\n",
+		(unsigned long)index.size(),
+		(unsigned long)videoFrames,
+		(double)audioSampleFrames / header.audioSampleRate);
+
+	if (!index.empty())
+	{
+		FormatTimecode(index.front(), firstTimecode, sizeof(firstTimecode));
+		FormatTimecode(index.back(), lastTimecode, sizeof(lastTimecode));
+		printf(" - Stream time: %ld to %ld (timescale %ld)\n",
+			(long)index.front().streamTime,
+			(long)(index.back().streamTime + index.back().frameDuration),
+			(long)header.timeScale);
+		printf(" - Timecode: %s to %s\n", firstTimecode, lastTimecode);
+	}
+
+	return 0;
+}
+
+static int ListFrames(const CaptureSegmentReader& reader)
+{
+	const std::vector<CaptureIndexEntry>&	index = reader.GetIndex();
+	char									timecode[16];
+
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		FormatTimecode(index[i], timecode, sizeof(timecode));
+		printf("%6lu  %s  stream time %-12ld video %10lu bytes at %-12lu audio %5u samples%s\n",
+			(unsigned long)i,
+			timecode,
+			(long)index[i].streamTime,
+			(unsigned long)index[i].videoBytes,
+			(unsigned long)index[i].videoOffset,
+			index[i].audioSampleFrames,
+			(index[i].frameFlags & bmdFrameHasNoInputSource) ? "  no input" : "");
+	}
+
+	return 0;
+}
+
+static bool AppendRecord(FILE* file, uint64_t* fileOffset, CaptureRecordHeader* record, uint32_t payloadAlignment, const void* payload, uint64_t* payloadFileOffset)
+{
+	std::vector<uint8_t>	block(LayOutCaptureRecord(*fileOffset, payloadAlignment, record, NULL, payloadFileOffset));
+
+	LayOutCaptureRecord(*fileOffset, payloadAlignment, record, block.data(), payloadFileOffset);
+
+	if (fwrite(block.data(), 1, block.size(), file) != block.size())
+		return false;
+
+	if ((record->payloadBytes > 0) && (fwrite(payload, 1, record->payloadBytes, file) != record->payloadBytes))
+		return false;
+
+	*fileOffset = *payloadFileOffset + record->payloadBytes;
+	return true;
+}
+
+static int TrimSegment(const CaptureSegmentReader& reader, uint64_t first, uint64_t last, const char* outputPath)
+{
+	const std::vector<CaptureIndexEntry>&	index = reader.GetIndex();
+	CaptureSegmentHeader					header = reader.GetHeader();
+	std::vector<CaptureIndexEntry>			trimmedIndex;
+	std::vector<uint8_t>					headerBlock(kCaptureSegmentHeaderSize, 0);
+	uint64_t								fileOffset = kCaptureSegmentHeaderSize;
+	FILE*									file;
+	int										exitStatus = 1;
+
+	if ((first > last) || (last >= index.size()))
+	{
+		fprintf(stderr, "Frames %lu to %lu are not in the segment, which has %lu\n", (unsigned long)first, (unsigned long)last, (unsigned long)index.size());
+		return 1;
+	}
+
+	file = fopen(outputPath, "wb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not create \"%s\"\n", outputPath);
+		return 1;
+	}
+
+	header.dataEnd = 0;
+	header.indexOffset = 0;
+	header.indexCount = 0;
+	memcpy(headerBlock.data(), &header, sizeof(header));
+	if (fwrite(headerBlock.data(), 1, headerBlock.size(), file) != headerBlock.size())
+		goto bail;
+
+	for (uint64_t i = first; i <= last; i++)
+	{
+		CaptureIndexEntry		entry = index[i];
+		CaptureRecordHeader		record;
+
+		memset(&record, 0, sizeof(record));
+		record.frameNumber = trimmedIndex.size();
+
+		if (entry.frameDuration > 0)
+		{
+			record.type = kCaptureRecordVideo;
+			record.payloadBytes = entry.videoBytes;
+			record.time = entry.streamTime;
+			record.duration = entry.frameDuration;
+			record.timecodeBCD = entry.timecodeBCD;
+			record.timecodeFlags = entry.timecodeFlags;
+			record.frameFlags = entry.frameFlags;
+
+			if (!AppendRecord(file, &fileOffset, &record, (entry.videoBytes > 0) ? kCaptureVideoAlignment : kCaptureRecordAlignment, reader.GetVideoBytes(i), &entry.videoOffset))
+				goto bail;
+			if (entry.videoBytes == 0)
+				entry.videoOffset = 0;
+		}
+
+		if (entry.audioOffset != 0)
+		{
+			memset(&record, 0, sizeof(record));
+			record.type = kCaptureRecordAudio;
+			record.frameNumber = trimmedIndex.size();
+			record.sampleFrames = entry.audioSampleFrames;
+			record.payloadBytes = reader.GetAudioByteCount(i);
+			record.time = entry.audioPacketTime;
+			record.duration = entry.audioSampleFrames;
+
+			if (!AppendRecord(file, &fileOffset, &record, kCaptureRecordAlignment, reader.GetAudioBytes(i), &entry.audioOffset))
+				goto bail;
+		}
+
+		trimmedIndex.push_back(entry);
+	}
+
+	if (fflush(file) != 0)
+		goto bail;
+
+	header.dataEnd = fileOffset;
+	if (WriteCaptureSegmentIndex(fileno(file), &header, trimmedIndex) != S_OK)
+		goto bail;
+
+	printf("Wrote frames %lu to %lu to %s\n", (unsigned long)first, (unsigned long)last, outputPath);
+	exitStatus = 0;
+
+bail:
+	if (exitStatus != 0)
+		fprintf(stderr, "Could not write \"%s\"\n", outputPath);
+
+	fclose(file);
+	return exitStatus;
+}
+
+static int RecoverSegment(CaptureSegmentReader& reader, const char* path)
+{
+	CaptureSegmentHeader				header = reader.GetHeader();
+	std::vector<CaptureIndexEntry>		index = reader.GetIndex();
+	int									fd;
+	HRESULT								result;
+
+	if (!reader.WasRecovered())
+	{
+		printf("%s was closed normally and needs no recovery\n", path);
+		return 0;
+	}
+
+	// The mapping must go before the file is extended past it
+	reader.Close();
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not open \"%s\" for writing\n", path);
+		return 1;
+	}
+
+	result = WriteCaptureSegmentIndex(fd, &header, index);
+	close(fd);
+
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Could not write the index of \"%s\"\n", path);
+		return 1;
+	}
+
+	printf("Recovered %lu frames of %s\n", (unsigned long)index.size(), path);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	CaptureSegmentReader	reader;
+	const char*				command;
+	const char*				path;
+
+	if (argc < 3)
+	{
+		DisplayUsage();
+		return 1;
+	}
+
+	command = argv[1];
+	path = argv[2];
+
+	if (reader.Open(path) != S_OK)
+	{
+		fprintf(stderr, "\"%s\" is not a capture segment\n", path);
+		return 1;
+	}
+
+	if ((strcmp(command, "info") == 0) && (argc == 3))
+		return ShowInfo(reader);
+
+	if ((strcmp(command, "frames") == 0) && (argc == 3))
+		return ListFrames(reader);
+
+	if ((strcmp(command, "trim") == 0) && (argc == 6))
+		return TrimSegment(reader, strtoull(argv[3], NULL, 10), strtoull(argv[4], NULL, 10), argv[5]);
+
+	if ((strcmp(command, "recover") == 0) && (argc == 3))
+		return RecoverSegment(reader, path);
+
+	DisplayUsage();
+	return 1;
+}
@@ -38,11 +38,18 @@ BMDConfig::BMDConfig() :
 	m_audioChannels(2),
 	m_audioSampleDepth(16),
 	m_maxFrames(-1),
+	m_profileInterval(0),
+	m_hugePageBuffers(false),
 	m_inputFlags(bmdVideoInputFlagDefault),
 	m_pixelFormat(bmdFormat8BitYUV),
 	m_timecodeFormat(),
 	m_videoOutputFile(),
 	m_audioOutputFile(),
+	m_sharedRingName(),
+	m_segmentBasePath(),
+	m_segmentSeconds(0),
+	m_segmentMegabytes(0),
+	m_movieOutputFile(),
 	m_deckLinkName(),
 	m_displayModeName()
 {
@@ -62,7 +69,7 @@ bool BMDConfig::ParseArguments(int argc,  char** argv)
 	int		ch;
 	bool	displayHelp = false;
 
-	while ((ch = getopt(argc, argv, "d:?h3c:s:v:a:m:n:p:t:")) != -1)
+	while ((ch = getopt(argc, argv, "d:?h3c:s:v:a:m:n:p:t:l:HS:o:r:R:M:")) != -1)
 	{
 		switch (ch)
 		{
@@ -106,6 +113,49 @@ bool BMDConfig::ParseArguments(int argc,  char** argv)
 				m_maxFrames = atoi(optarg);
 				break;
 
+			case 'l':
+				m_profileInterval = atoi(optarg);
+				if (m_profileInterval <= 0)
+				{
+					fprintf(stderr, "Invalid argument: Profile interval must be greater than 0 milliseconds\n");
+					return false;
+				}
+				break;
+
+			case 'H':
+				m_hugePageBuffers = true;
+				break;
+
+			case 'S':
+				m_sharedRingName = optarg;
+				break;
+
+			case 'o':
+				m_segmentBasePath = optarg;
+				break;
+
+			case 'r':
+				m_segmentSeconds = atoi(optarg);
+				if (m_segmentSeconds <= 0)
+				{
+					fprintf(stderr, "Invalid argument: Segment duration must be greater than 0 seconds\n");
+					return false;
+				}
+				break;
+
+			case 'R':
+				m_segmentMegabytes = atoi(optarg);
+				if (m_segmentMegabytes <= 0)
+				{
+					fprintf(stderr, "Invalid argument: Segment size must be greater than 0 MB\n");
+					return false;
+				}
+				break;
+
+			case 'M':
+				m_movieOutputFile = optarg;
+				break;
+
 			case '3':
 				m_inputFlags |= bmdVideoInputDualStream3D;
 				break;
@@ -426,11 +476,28 @@ bail:
 		"    -s <depth>           Audio Sample Depth (16 or 32 - default is 16)\n"
 		"    -n <frames>          Number of frames to capture (default is unlimited)\n"
 		"    -3                   Capture Stereoscopic 3D (Requires 3D Hardware support)\n"
+		"    -l <milliseconds>    Profile callback latency and jitter, reporting at this interval\n"
+		"    -H                   Capture into huge page buffers on the device's NUMA node\n"
+		"    -S <name>            Share frames with local SharedFrameReader processes through /dev/shm/<name>\n"
+		"    -o <basename>        Record video, audio and an index to segment files <basename>_NNNNNN.dlcs\n"
+		"    -r <seconds>         Start a new segment after this many seconds\n"
+		"    -R <megabytes>       Start a new segment before one grows past this size\n"
+		"    -M <filename>        Record uncompressed video and PCM audio to a QuickTime movie\n"
 		"\n"
 		"Capture video and/or audio to a file. Raw video and/or audio can be viewed with mplayer eg:\n"
 		"\n"
 		"    Capture -d 0 -m 2 -n 50 -v video.raw -a audio.raw\n"
 		"    mplayer video.raw -demuxer rawvideo -rawvideo pal:uyvy -audiofile audio.raw -audio-demuxer 20 -rawaudio rate=48000\n"
+		"\n"
+		"Segment files can be listed, trimmed and recovered after a crash with CaptureSegments eg:\n"
+		"\n"
+		"    Capture -d 0 -m 2 -t rp188 -o ingest -r 3600\n"
+		"    CaptureSegments trim ingest_000000.dlcs 100 250 clip.dlcs\n"
+		"\n"
+		"A movie left unfinished by a crash can be finished from its journal with RecoverMovie eg:\n"
+		"\n"
+		"    Capture -d 0 -m 2 -p 1 -M capture.mov\n"
+		"    RecoverMovie capture.mov\n"
 	);
 
 	if (deckLinkIterator != NULL)
@@ -458,13 +525,21 @@ void BMDConfig::DisplayConfiguration()
 		" - Video mode: %s %s\n"
 		" - Pixel format: %s\n"
 		" - Audio channels: %u\n"
-		" - Audio sample depth: %u bit \n",
+		" - Audio sample depth: %u bit \n"
+		" - Frame buffers: %s\n"
+		" - Shared frame ring: %s\n"
+		" - Segment files: %s\n"
+		" - Movie file: %s\n",
 		m_deckLinkName,
 		m_displayModeName,
 		(m_inputFlags & bmdVideoInputDualStream3D) ? "3D" : "",
 		GetPixelFormatName(m_pixelFormat),
 		m_audioChannels,
-		m_audioSampleDepth
+		m_audioSampleDepth,
+		m_hugePageBuffers ? "huge pages" : "default",
+		m_sharedRingName != NULL ? m_sharedRingName : "none",
+		m_segmentBasePath != NULL ? m_segmentBasePath : "none",
+		m_movieOutputFile != NULL ? m_movieOutputFile : "none"
 	);
 }
 
@@ -47,6 +47,8 @@ public:
 	int						m_audioSampleDepth;
 
 	int						m_maxFrames;
+	int						m_profileInterval;
+	bool					m_hugePageBuffers;
 
 	BMDVideoInputFlags		m_inputFlags;
 	BMDPixelFormat			m_pixelFormat;
@@ -54,6 +56,13 @@ public:
 
 	const char*				m_videoOutputFile;
 	const char*				m_audioOutputFile;
+	const char*				m_sharedRingName;
+
+	const char*				m_segmentBasePath;
+	int						m_segmentSeconds;
+	int						m_segmentMegabytes;
+
+	const char*				m_movieOutputFile;
 
 	IDeckLink* GetSelectedDeckLink(void);
 	IDeckLinkDisplayMode* GetSelectedDeckLinkDisplayMode(IDeckLink* deckLink);
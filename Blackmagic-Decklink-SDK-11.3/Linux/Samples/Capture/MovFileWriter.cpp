@@ -0,0 +1,955 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+#include <sys/stat.h>
+#include "MovFileWriter.h"
+#include "AsyncFileWriter.h"
+
+static const uint32_t	kMovJournalMagic		= 0x4a4d4c44;	// "DLMJ"
+static const uint32_t	kMovJournalVersion		= 1;
+static const uint32_t	kMovVideoAlignment		= 4096;
+
+static const uint8_t	kMovZeroPadding[kMovVideoAlignment] = { 0 };
+static const uint32_t	kMovAudioSampleRate		= 48000;
+static const uint64_t	kMovMdatOffset			= 20;			// After the ftyp atom
+static const uint64_t	kMovMdatHeaderSize		= 16;			// 64 bit size form
+static const int64_t	kMacEpochOffset			= 2082844800;	// Seconds from 1904 to 1970
+static const int		kJournalInterval		= 500;			// Milliseconds
+static const size_t		kSampleTableChunk		= 64 * 1024;	// Frames, about 18 minutes at 60 fps
+
+// Core Audio format flags of the lpcm sample description
+static const uint32_t	kAudioFormatFlagIsSignedInteger	= 1 << 2;
+static const uint32_t	kAudioFormatFlagIsPacked		= 1 << 3;
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool WriteAll(int fd, const void* data, size_t size, uint64_t offset)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	while (size > 0)
+	{
+		ssize_t result = pwrite(fd, bytes, size, (off_t)offset);
+
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;
+
+		bytes += result;
+		offset += result;
+		size -= result;
+	}
+
+	return true;
+}
+
+static uint32_t GetAudioBytesPerFrame(const MovJournalHeader& header)
+{
+	return header.audioChannels * (header.audioStoredBits / 8);
+}
+
+// The media data layout follows from the header and the audio sample count of each frame
+static uint64_t GetMediaLayout(const MovJournalHeader& header, const std::vector<uint32_t>& audioSampleFrames, size_t frameCount,
+							   std::vector<uint64_t>* videoOffsets, std::vector<uint64_t>* audioOffsets)
+{
+	uint64_t offset = header.mdatOffset + kMovMdatHeaderSize;
+	uint64_t videoBytes = (uint64_t)header.rowBytes * header.height;
+
+	for (size_t i = 0; i < frameCount; i++)
+	{
+		offset = AlignUp(offset, kMovVideoAlignment);
+		if (videoOffsets != NULL)
+			videoOffsets->push_back(offset);
+		offset += videoBytes;
+
+		if (audioOffsets != NULL)
+			audioOffsets->push_back(offset);
+		offset += (uint64_t)audioSampleFrames[i] * GetAudioBytesPerFrame(header);
+	}
+
+	return offset;
+}
+
+// Builds QuickTime atoms, big endian, patching each atom's size when it ends
+class MovAtomBuilder
+{
+public:
+	void	Begin(uint32_t type)		{ m_starts.push_back(m_data.size()); Put32(0); Put32(type); }
+	void	End(void)
+	{
+		size_t start = m_starts.back();
+		uint32_t size = (uint32_t)(m_data.size() - start);
+
+		m_starts.pop_back();
+		m_data[start] = (uint8_t)(size >> 24);
+		m_data[start + 1] = (uint8_t)(size >> 16);
+		m_data[start + 2] = (uint8_t)(size >> 8);
+		m_data[start + 3] = (uint8_t)size;
+	}
+
+	void	Put8(uint8_t value)			{ m_data.push_back(value); }
+	void	Put16(uint16_t value)		{ Put8((uint8_t)(value >> 8)); Put8((uint8_t)value); }
+	void	Put32(uint32_t value)		{ Put16((uint16_t)(value >> 16)); Put16((uint16_t)value); }
+	void	Put64(uint64_t value)		{ Put32((uint32_t)(value >> 32)); Put32((uint32_t)value); }
+	void	PutZeros(size_t count)		{ m_data.insert(m_data.end(), count, 0); }
+
+	void	PutFloat64(double value)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		Put64(bits);
+	}
+
+	// Version 1 atoms carry 64 bit times and durations
+	void	PutTime(bool version1, uint64_t value)
+	{
+		if (version1)
+			Put64(value);
+		else
+			Put32((uint32_t)value);
+	}
+
+	void	PutMatrix(void)
+	{
+		static const uint32_t kIdentity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+		for (uint32_t value : kIdentity)
+			Put32(value);
+	}
+
+	void	PutPascalString(const char* string, size_t fieldSize)
+	{
+		size_t length = strlen(string);
+
+		if (fieldSize > 0 && length > fieldSize - 1)
+			length = fieldSize - 1;
+
+		Put8((uint8_t)length);
+		m_data.insert(m_data.end(), string, string + length);
+		if (fieldSize > 0)
+			PutZeros(fieldSize - 1 - length);
+	}
+
+	const std::vector<uint8_t>&	GetData(void) const		{ return m_data; }
+
+private:
+	std::vector<uint8_t>	m_data;
+	std::vector<size_t>		m_starts;
+};
+
+static const char* GetCompressorName(uint32_t pixelFormat)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat10BitYUV:
+			return "Uncompressed 10-bit 4:2:2";
+		case bmdFormat8BitYUV:
+			return "Uncompressed 8-bit 4:2:2";
+		case bmdFormat10BitRGB:
+			return "Uncompressed 10-bit RGB";
+	}
+	return "Uncompressed";
+}
+
+static void PutHandlerAtoms(MovAtomBuilder& atoms, uint32_t componentType, uint32_t componentSubtype, const char* name)
+{
+	atoms.Begin('hdlr');
+	atoms.Put32(0);						// Version and flags
+	atoms.Put32(componentType);
+	atoms.Put32(componentSubtype);
+	atoms.Put32(0);						// Manufacturer
+	atoms.Put32(0);						// Flags
+	atoms.Put32(0);						// Flags mask
+	atoms.PutPascalString(name, 0);
+	atoms.End();
+}
+
+static void PutTrackHeader(MovAtomBuilder& atoms, uint32_t trackID, uint64_t creationTime, uint64_t movieDuration, bool isAudio, uint32_t width, uint32_t height)
+{
+	bool version1 = (movieDuration > UINT32_MAX);
+
+	atoms.Begin('tkhd');
+	atoms.Put8(version1 ? 1 : 0);
+	atoms.Put8(0);
+	atoms.Put16(0x000f);				// Enabled, in movie, in preview, in poster
+	atoms.PutTime(version1, creationTime);
+	atoms.PutTime(version1, creationTime);
+	atoms.Put32(trackID);
+	atoms.Put32(0);
+	atoms.PutTime(version1, movieDuration);
+	atoms.PutZeros(8);
+	atoms.Put16(0);						// Layer
+	atoms.Put16(0);						// Alternate group
+	atoms.Put16(isAudio ? 0x0100 : 0);	// Volume
+	atoms.Put16(0);
+	atoms.PutMatrix();
+	atoms.Put32(width << 16);
+	atoms.Put32(height << 16);
+	atoms.End();
+}
+
+static void PutMediaHeader(MovAtomBuilder& atoms, uint64_t creationTime, uint32_t timeScale, uint64_t duration)
+{
+	bool version1 = (duration > UINT32_MAX);
+
+	atoms.Begin('mdhd');
+	atoms.Put8(version1 ? 1 : 0);
+	atoms.PutZeros(3);
+	atoms.PutTime(version1, creationTime);
+	atoms.PutTime(version1, creationTime);
+	atoms.Put32(timeScale);
+	atoms.PutTime(version1, duration);
+	atoms.Put16(0);						// Language
+	atoms.Put16(0);						// Quality
+	atoms.End();
+}
+
+static void PutDataInformation(MovAtomBuilder& atoms)
+{
+	PutHandlerAtoms(atoms, 'dhlr', 'alis', "");
+
+	atoms.Begin('dinf');
+	atoms.Begin('dref');
+	atoms.Put32(0);
+	atoms.Put32(1);
+	atoms.Begin('alis');
+	atoms.Put32(1);						// Self reference, the media is in this file
+	atoms.End();
+	atoms.End();
+	atoms.End();
+}
+
+static void PutChunkOffsets(MovAtomBuilder& atoms, const std::vector<uint64_t>& offsets)
+{
+	atoms.Begin('co64');
+	atoms.Put32(0);
+	atoms.Put32((uint32_t)offsets.size());
+	for (uint64_t offset : offsets)
+		atoms.Put64(offset);
+	atoms.End();
+}
+
+static void PutVideoTrack(MovAtomBuilder& atoms, const MovJournalHeader& header, const std::vector<uint64_t>& videoOffsets, uint64_t movieDuration)
+{
+	uint32_t	frameCount = (uint32_t)videoOffsets.size();
+	bool		interlaced = (header.fieldDominance == bmdUpperFieldFirst) || (header.fieldDominance == bmdLowerFieldFirst);
+
+	atoms.Begin('trak');
+	PutTrackHeader(atoms, 1, header.creationTime, movieDuration, false, header.width, header.height);
+
+	atoms.Begin('mdia');
+	PutMediaHeader(atoms, header.creationTime, (uint32_t)header.timeScale, movieDuration);
+	PutHandlerAtoms(atoms, 'mhlr', 'vide', "");
+
+	atoms.Begin('minf');
+	atoms.Begin('vmhd');
+	atoms.Put32(0x00000001);			// Version 0, flags 1
+	atoms.Put16(0x0040);				// Dither copy
+	atoms.Put16(0x8000);
+	atoms.Put16(0x8000);
+	atoms.Put16(0x8000);
+	atoms.End();
+	PutDataInformation(atoms);
+
+	atoms.Begin('stbl');
+
+	atoms.Begin('stsd');
+	atoms.Put32(0);
+	atoms.Put32(1);
+	atoms.Begin(header.pixelFormat);	// The DeckLink pixel format codes are the QuickTime codec types
+	atoms.PutZeros(6);
+	atoms.Put16(1);						// Data reference index
+	atoms.Put16(0);						// Version
+	atoms.Put16(0);						// Revision
+	atoms.Put32(0);						// Vendor
+	atoms.Put32(0);						// Temporal quality
+	atoms.Put32(0x00000400);			// Spatial quality, lossless
+	atoms.Put16((uint16_t)header.width);
+	atoms.Put16((uint16_t)header.height);
+	atoms.Put32(72 << 16);				// Horizontal resolution
+	atoms.Put32(72 << 16);				// Vertical resolution
+	atoms.Put32(0);
+	atoms.Put16(1);						// Frames per sample
+	atoms.PutPascalString(GetCompressorName(header.pixelFormat), 32);
+	atoms.Put16(24);					// Depth
+	atoms.Put16(0xffff);				// No color table
+
+	atoms.Begin('fiel');
+	atoms.Put8(interlaced ? 2 : 1);
+	atoms.Put8(!interlaced ? 0 : (header.fieldDominance == bmdUpperFieldFirst) ? 9 : 14);
+	atoms.End();
+
+	// Rec.601 for SD frame heights, Rec.709 otherwise
+	atoms.Begin('colr');
+	atoms.Put32('nclc');
+	atoms.Put16((header.height == 576) ? 5 : (header.height <= 486) ? 6 : 1);
+	atoms.Put16(1);
+	atoms.Put16((header.height <= 576) ? 6 : 1);
+	atoms.End();
+
+	atoms.Begin('pasp');
+	atoms.Put32(1);
+	atoms.Put32(1);
+	atoms.End();
+
+	atoms.End();
+	atoms.End();
+
+	atoms.Begin('stts');
+	atoms.Put32(0);
+	atoms.Put32(1);
+	atoms.Put32(frameCount);
+	atoms.Put32((uint32_t)header.frameDuration);
+	atoms.End();
+
+	// Each frame is a chunk, since audio is interleaved between frames
+	atoms.Begin('stsc');
+	atoms.Put32(0);
+	atoms.Put32(1);
+	atoms.Put32(1);
+	atoms.Put32(1);
+	atoms.Put32(1);
+	atoms.End();
+
+	atoms.Begin('stsz');
+	atoms.Put32(0);
+	atoms.Put32(header.rowBytes * header.height);
+	atoms.Put32(frameCount);
+	atoms.End();
+
+	PutChunkOffsets(atoms, videoOffsets);
+
+	atoms.End();	// stbl
+	atoms.End();	// minf
+	atoms.End();	// mdia
+	atoms.End();	// trak
+}
+
+static void PutAudioTrack(MovAtomBuilder& atoms, const MovJournalHeader& header, const std::vector<uint32_t>& audioSampleFrames, const std::vector<uint64_t>& audioOffsets, uint64_t totalSampleFrames)
+{
+	std::vector<uint64_t>	chunkOffsets;
+	std::vector<uint32_t>	chunkSampleFrames;
+	uint64_t				movieDuration = totalSampleFrames * header.timeScale / kMovAudioSampleRate;
+	size_t					runCount = 0;
+
+	for (size_t i = 0; i < audioOffsets.size(); i++)
+	{
+		if (audioSampleFrames[i] == 0)
+			continue;
+
+		chunkOffsets.push_back(audioOffsets[i]);
+		chunkSampleFrames.push_back(audioSampleFrames[i]);
+		if ((chunkSampleFrames.size() == 1) || (chunkSampleFrames[chunkSampleFrames.size() - 2] != audioSampleFrames[i]))
+			runCount++;
+	}
+
+	atoms.Begin('trak');
+	PutTrackHeader(atoms, 2, header.creationTime, movieDuration, true, 0, 0);
+
+	atoms.Begin('mdia');
+	PutMediaHeader(atoms, header.creationTime, kMovAudioSampleRate, totalSampleFrames);
+	PutHandlerAtoms(atoms, 'mhlr', 'soun', "");
+
+	atoms.Begin('minf');
+	atoms.Begin('smhd');
+	atoms.Put32(0);
+	atoms.Put16(0);						// Balance
+	atoms.Put16(0);
+	atoms.End();
+	PutDataInformation(atoms);
+
+	atoms.Begin('stbl');
+
+	// Version 2 sound description, which allows any channel count and sample size
+	atoms.Begin('stsd');
+	atoms.Put32(0);
+	atoms.Put32(1);
+	atoms.Begin('lpcm');
+	atoms.PutZeros(6);
+	atoms.Put16(1);						// Data reference index
+	atoms.Put16(2);						// Version
+	atoms.Put16(0);						// Revision
+	atoms.Put32(0);						// Vendor
+	atoms.Put16(3);
+	atoms.Put16(16);
+	atoms.Put16(0xfffe);
+	atoms.Put16(0);
+	atoms.Put32(0x00010000);
+	atoms.Put32(72);					// Size of the description without extensions
+	atoms.PutFloat64(kMovAudioSampleRate);
+	atoms.Put32(header.audioChannels);
+	atoms.Put32(0x7f000000);
+	atoms.Put32(header.audioStoredBits);
+	atoms.Put32(kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked);	// Little endian
+	atoms.Put32(GetAudioBytesPerFrame(header));
+	atoms.Put32(1);						// Frames per packet
+	atoms.End();
+	atoms.End();
+
+	atoms.Begin('stts');
+	atoms.Put32(0);
+	atoms.Put32(1);
+	atoms.Put32((uint32_t)totalSampleFrames);
+	atoms.Put32(1);
+	atoms.End();
+
+	atoms.Begin('stsc');
+	atoms.Put32(0);
+	atoms.Put32((uint32_t)runCount);
+	for (size_t i = 0; i < chunkSampleFrames.size(); i++)
+	{
+		if ((i == 0) || (chunkSampleFrames[i - 1] != chunkSampleFrames[i]))
+		{
+			atoms.Put32((uint32_t)i + 1);
+			atoms.Put32(chunkSampleFrames[i]);
+			atoms.Put32(1);
+		}
+	}
+	atoms.End();
+
+	atoms.Begin('stsz');
+	atoms.Put32(0);
+	atoms.Put32(GetAudioBytesPerFrame(header));
+	atoms.Put32((uint32_t)totalSampleFrames);
+	atoms.End();
+
+	PutChunkOffsets(atoms, chunkOffsets);
+
+	atoms.End();	// stbl
+	atoms.End();	// minf
+	atoms.End();	// mdia
+	atoms.End();	// trak
+}
+
+// Appends the moov atom after the media data and sets the size of the mdat atom
+static HRESULT FinishMovie(int fd, const MovJournalHeader& header, const std::vector<uint32_t>& audioSampleFrames, size_t frameCount)
+{
+	std::vector<uint64_t>	videoOffsets;
+	std::vector<uint64_t>	audioOffsets;
+	uint64_t				mediaEnd = GetMediaLayout(header, audioSampleFrames, frameCount, &videoOffsets, &audioOffsets);
+	uint64_t				movieDuration = (uint64_t)frameCount * header.frameDuration;
+	uint64_t				totalSampleFrames = 0;
+	MovAtomBuilder			atoms;
+	uint8_t					mdatSize[8];
+
+	for (size_t i = 0; i < frameCount; i++)
+		totalSampleFrames += audioSampleFrames[i];
+
+	atoms.Begin('moov');
+
+	atoms.Begin('mvhd');
+	bool version1 = (movieDuration > UINT32_MAX);
+	atoms.Put8(version1 ? 1 : 0);
+	atoms.PutZeros(3);
+	atoms.PutTime(version1, header.creationTime);
+	atoms.PutTime(version1, header.creationTime);
+	atoms.Put32((uint32_t)header.timeScale);
+	atoms.PutTime(version1, movieDuration);
+	atoms.Put32(0x00010000);			// Rate
+	atoms.Put16(0x0100);				// Volume
+	atoms.PutZeros(10);
+	atoms.PutMatrix();
+	atoms.PutZeros(6 * 4);				// Preview, poster, selection and current times
+	atoms.Put32((header.audioChannels > 0 && totalSampleFrames > 0) ? 3 : 2);	// Next track ID
+	atoms.End();
+
+	PutVideoTrack(atoms, header, videoOffsets, movieDuration);
+	if (header.audioChannels > 0 && totalSampleFrames > 0)
+		PutAudioTrack(atoms, header, audioSampleFrames, audioOffsets, totalSampleFrames);
+
+	atoms.End();
+
+	for (int i = 0; i < 8; i++)
+		mdatSize[i] = (uint8_t)((mediaEnd - header.mdatOffset) >> (56 - i * 8));
+
+	// Drops any reserved space and any partial frame past the media data
+	if (ftruncate(fd, (off_t)mediaEnd) != 0)
+		return E_FAIL;
+
+	if (!WriteAll(fd, atoms.GetData().data(), atoms.GetData().size(), mediaEnd))
+		return E_FAIL;
+
+	if (!WriteAll(fd, mdatSize, sizeof(mdatSize), header.mdatOffset + 8))
+		return E_FAIL;
+
+	fdatasync(fd);
+	return S_OK;
+}
+
+MovFileWriter::MovFileWriter() :
+	m_writer(NULL),
+	m_journalFd(-1),
+	m_fileOffset(0),
+	m_started(false),
+	m_threadRunning(false),
+	m_closing(false),
+	m_frameCount(0),
+	m_journalledFrames(0)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	memset(&m_header, 0, sizeof(m_header));
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+MovFileWriter::~MovFileWriter()
+{
+	Close();
+
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+bool MovFileWriter::Open(const char* path, const MovFileWriterSettings& settings)
+{
+	if (m_writer != NULL)
+		return false;
+
+	m_path = path;
+	m_journalPath = m_path + ".journal";
+	m_settings = settings;
+	if (m_settings.audioStoredBits > m_settings.audioSampleDepth)
+		m_settings.audioStoredBits = m_settings.audioSampleDepth;
+
+	m_journalFd = open(m_journalPath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (m_journalFd < 0)
+		return false;
+
+	m_writer = new AsyncFileWriter();
+	if (!m_writer->Open(path, m_settings.preallocationStep))
+	{
+		Close();
+		return false;
+	}
+
+	memset(&m_header, 0, sizeof(m_header));
+	m_header.magic = kMovJournalMagic;
+	m_header.version = kMovJournalVersion;
+	m_header.fieldDominance = bmdProgressiveFrame;
+	m_header.audioChannels = m_settings.audioChannels;
+	m_header.audioStoredBits = m_settings.audioStoredBits;
+	m_header.mdatOffset = kMovMdatOffset;
+	m_header.creationTime = (uint64_t)time(NULL) + kMacEpochOffset;
+
+	m_started = false;
+	m_closing = false;
+	m_audioSampleFrames.clear();
+	m_audioSampleFrames.push_back(std::vector<uint32_t>(kSampleTableChunk));
+	m_frameCount = 0;
+	m_journalledFrames = 0;
+	memset(&m_statistics, 0, sizeof(m_statistics));
+
+	// Room for a packet of a frame at 23.98 fps, so packing does not allocate while capturing
+	m_packedAudio.resize(2048 * m_settings.audioChannels * (m_settings.audioStoredBits / 8));
+
+	// ftyp, then an mdat with a 64 bit size that Close() fills in
+	{
+		MovAtomBuilder atoms;
+
+		atoms.Begin('ftyp');
+		atoms.Put32('qt  ');
+		atoms.Put32(0x20050300);
+		atoms.Put32('qt  ');
+		atoms.End();
+		atoms.Put32(1);
+		atoms.Put32('mdat');
+		atoms.Put64(0);
+
+		m_writer->Write(atoms.GetData().data(), kMovMdatOffset + kMovMdatHeaderSize);
+	}
+	m_fileOffset = kMovMdatOffset + kMovMdatHeaderSize;
+
+	if (pthread_create(&m_thread, NULL, journalThreadFunc, this) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_threadRunning = true;
+	return true;
+}
+
+bool MovFileWriter::Close(void)
+{
+	AsyncFileWriterStatistics	writerStatistics;
+	bool						result = false;
+	int							fd;
+
+	if (m_writer == NULL)
+		return false;
+
+	if (m_threadRunning)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_closing = true;
+		pthread_cond_signal(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+
+		pthread_join(m_thread, NULL);
+		m_threadRunning = false;
+	}
+
+	// Waits for the media data to reach the disk
+	m_writer->Close();
+	m_writer->GetStatistics(&writerStatistics);
+	m_statistics.bytesWritten = writerStatistics.bytesWritten;
+	m_statistics.failed = writerStatistics.failed;
+
+	if (m_started && !writerStatistics.failed)
+	{
+		std::vector<uint32_t> audioSampleFrames;
+
+		audioSampleFrames.reserve(m_frameCount);
+		for (size_t i = 0; i < m_frameCount; i++)
+			audioSampleFrames.push_back(sampleTableEntry(i));
+
+		fd = open(m_path.c_str(), O_WRONLY);
+		if (fd >= 0)
+		{
+			result = (FinishMovie(fd, m_header, audioSampleFrames, m_frameCount) == S_OK);
+			close(fd);
+		}
+
+		if (!result)
+			fprintf(stderr, "Could not finish movie \"%s\"\n", m_path.c_str());
+	}
+	m_statistics.failed = m_statistics.failed || (m_started && !result);
+
+	if (m_journalFd >= 0)
+	{
+		close(m_journalFd);
+		m_journalFd = -1;
+	}
+
+	// Keep the journal of a movie that could not be finished, for RecoverMovFile()
+	if (result || !m_started)
+		unlink(m_journalPath.c_str());
+	if (!m_started)
+		unlink(m_path.c_str());
+
+	delete m_writer;
+	m_writer = NULL;
+
+	return result;
+}
+
+void MovFileWriter::SetVideoFormat(BMDTimeValue frameDuration, BMDTimeScale timeScale, BMDFieldDominance fieldDominance)
+{
+	// Fixed once the first frame is written
+	if (m_started)
+		return;
+
+	pthread_mutex_lock(&m_mutex);
+	m_header.frameDuration = frameDuration;
+	m_header.timeScale = timeScale;
+	m_header.fieldDominance = fieldDominance;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool MovFileWriter::WriteFrame(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket)
+{
+	AsyncWriteSpan	spans[3];
+	unsigned		spanCount = 0;
+	uint64_t		fileOffset = m_fileOffset;
+	uint64_t		videoOffset;
+	uint32_t		audioSampleFrames = 0;
+	void*			bytes;
+
+	if (!m_threadRunning)
+		return false;
+
+	if (videoFrame != NULL)
+	{
+		bool formatMatches = m_started &&
+			(videoFrame->GetPixelFormat() == (BMDPixelFormat)m_header.pixelFormat) &&
+			(videoFrame->GetWidth() == m_header.width) &&
+			(videoFrame->GetHeight() == m_header.height) &&
+			(videoFrame->GetRowBytes() == m_header.rowBytes);
+
+		// A movie holds one format, so frames without input, or after a change of format,
+		// are left out along with their audio
+		if ((videoFrame->GetFlags() & bmdFrameHasNoInputSource) || (m_started && !formatMatches))
+		{
+			m_statistics.framesSkipped++;
+			return false;
+		}
+
+		if (!m_started)
+		{
+			pthread_mutex_lock(&m_mutex);
+			m_header.pixelFormat = videoFrame->GetPixelFormat();
+			m_header.width = (uint32_t)videoFrame->GetWidth();
+			m_header.height = (uint32_t)videoFrame->GetHeight();
+			m_header.rowBytes = (uint32_t)videoFrame->GetRowBytes();
+			m_started = true;
+			pthread_mutex_unlock(&m_mutex);
+		}
+
+		videoOffset = AlignUp(m_fileOffset, kMovVideoAlignment);
+		spans[spanCount].data = kMovZeroPadding;
+		spans[spanCount].size = (size_t)(videoOffset - m_fileOffset);
+		spans[spanCount++].owner = NULL;
+
+		videoFrame->GetBytes(&bytes);
+		spans[spanCount].data = bytes;
+		spans[spanCount].size = (size_t)m_header.rowBytes * m_header.height;
+		spans[spanCount++].owner = videoFrame;
+		fileOffset = videoOffset + (uint64_t)m_header.rowBytes * m_header.height;
+	}
+	else if (m_frameCount == 0)
+	{
+		// Audio before the first frame has nowhere to go
+		return false;
+	}
+
+	if ((audioPacket != NULL) && (m_settings.audioChannels > 0))
+	{
+		size_t		sampleCount = (size_t)audioPacket->GetSampleFrameCount() * m_settings.audioChannels;
+		size_t		storedBytes = sampleCount * (m_settings.audioStoredBits / 8);
+
+		audioSampleFrames = (uint32_t)audioPacket->GetSampleFrameCount();
+		audioPacket->GetBytes(&bytes);
+		spans[spanCount].owner = audioPacket;
+
+		if (m_settings.audioStoredBits != m_settings.audioSampleDepth)
+		{
+			// Keep the most significant bytes of each 32 bit sample
+			const uint8_t*		source = (const uint8_t*)bytes;
+			uint8_t*			destination;
+			unsigned			storedSampleBytes = m_settings.audioStoredBits / 8;
+			unsigned			skippedBytes = (m_settings.audioSampleDepth / 8) - storedSampleBytes;
+
+			if (m_packedAudio.size() < storedBytes)
+				m_packedAudio.resize(storedBytes);
+
+			destination = m_packedAudio.data();
+			for (size_t i = 0; i < sampleCount; i++)
+			{
+				source += skippedBytes;
+				for (unsigned b = 0; b < storedSampleBytes; b++)
+					*destination++ = *source++;
+			}
+
+			// Packed samples are copied into the writer's queue, as the buffer is reused
+			bytes = m_packedAudio.data();
+			spans[spanCount].owner = NULL;
+		}
+
+		spans[spanCount].data = bytes;
+		spans[spanCount++].size = storedBytes;
+		fileOffset += storedBytes;
+	}
+
+	// The frame and its audio are written whole or not at all, so the sample tables
+	// describe the file whatever the writer drops
+	if (!m_writer->Write(spans, spanCount))
+	{
+		if (videoFrame != NULL)
+			m_statistics.framesDropped++;
+		return false;
+	}
+
+	m_fileOffset = fileOffset;
+	m_statistics.audioSampleFrames += audioSampleFrames;
+
+	pthread_mutex_lock(&m_mutex);
+	if (videoFrame != NULL)
+	{
+		// The journal thread adds a chunk long before this, unless it has stalled
+		if (m_frameCount == m_audioSampleFrames.size() * kSampleTableChunk)
+			m_audioSampleFrames.push_back(std::vector<uint32_t>(kSampleTableChunk));
+		sampleTableEntry(m_frameCount++) = audioSampleFrames;
+	}
+	else
+	{
+		sampleTableEntry(m_frameCount - 1) += audioSampleFrames;	// Audio without video follows the previous frame's
+	}
+	pthread_mutex_unlock(&m_mutex);
+
+	if (videoFrame != NULL)
+		m_statistics.framesWritten++;
+
+	return true;
+}
+
+uint32_t& MovFileWriter::sampleTableEntry(size_t frame)
+{
+	return m_audioSampleFrames[frame / kSampleTableChunk][frame % kSampleTableChunk];
+}
+
+void MovFileWriter::GetStatistics(MovFileWriterStatistics* statistics)
+{
+	*statistics = m_statistics;
+}
+
+void* MovFileWriter::journalThreadFunc(void* arg)
+{
+	((MovFileWriter*)arg)->journalThread();
+	return NULL;
+}
+
+void MovFileWriter::journalThread(void)
+{
+	struct timespec		deadline;
+	bool				closing = false;
+
+	while (!closing)
+	{
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += kJournalInterval * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+
+		pthread_mutex_lock(&m_mutex);
+		if (!m_closing)
+			pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+		closing = m_closing;
+		pthread_mutex_unlock(&m_mutex);
+
+		if (!flushJournal())
+		{
+			fprintf(stderr, "Could not write movie journal \"%s\"\n", m_journalPath.c_str());
+			break;
+		}
+	}
+}
+
+bool MovFileWriter::flushJournal(void)
+{
+	MovJournalHeader		header;
+	std::vector<uint32_t>	entries;
+	size_t					firstEntry;
+	bool					started;
+	bool					growTable;
+
+	// The last entry written may have grown with audio that arrived without video
+	pthread_mutex_lock(&m_mutex);
+	started = m_started;
+	header = m_header;
+	firstEntry = (m_journalledFrames > 0) ? m_journalledFrames - 1 : 0;
+	for (size_t i = firstEntry; i < m_frameCount; i++)
+		entries.push_back(sampleTableEntry(i));
+	growTable = (m_frameCount + kSampleTableChunk / 2 > m_audioSampleFrames.size() * kSampleTableChunk);
+	pthread_mutex_unlock(&m_mutex);
+
+	// Add the next chunk of the sample table here, so the capture callback never allocates
+	if (growTable)
+	{
+		std::vector<uint32_t> chunk(kSampleTableChunk);
+
+		pthread_mutex_lock(&m_mutex);
+		if (m_frameCount + kSampleTableChunk / 2 > m_audioSampleFrames.size() * kSampleTableChunk)
+			m_audioSampleFrames.push_back(std::move(chunk));
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	if (!started || entries.empty())
+		return true;
+
+	if (!WriteAll(m_journalFd, &header, sizeof(header), 0) ||
+		!WriteAll(m_journalFd, entries.data(), entries.size() * sizeof(uint32_t), sizeof(header) + firstEntry * sizeof(uint32_t)))
+		return false;
+
+	fdatasync(m_journalFd);
+	m_journalledFrames = firstEntry + entries.size();
+	return true;
+}
+
+HRESULT RecoverMovFile(const char* path, uint64_t* recoveredFrames)
+{
+	std::string				journalPath = std::string(path) + ".journal";
+	MovJournalHeader		header;
+	std::vector<uint32_t>	audioSampleFrames;
+	struct stat				journalStat;
+	struct stat				movieStat;
+	uint64_t				dataEnd;
+	off_t					hole;
+	size_t					frameCount;
+	int						journalFd = -1;
+	int						fd = -1;
+	HRESULT					result = E_FAIL;
+
+	*recoveredFrames = 0;
+
+	journalFd = open(journalPath.c_str(), O_RDONLY);
+	if (journalFd < 0)
+		goto bail;
+
+	if ((fstat(journalFd, &journalStat) != 0) || ((size_t)journalStat.st_size < sizeof(header)) ||
+		(pread(journalFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) ||
+		(header.magic != kMovJournalMagic) || (header.version != kMovJournalVersion))
+		goto bail;
+
+	audioSampleFrames.resize((journalStat.st_size - sizeof(header)) / sizeof(uint32_t));
+	if (pread(journalFd, audioSampleFrames.data(), audioSampleFrames.size() * sizeof(uint32_t), sizeof(header)) != (ssize_t)(audioSampleFrames.size() * sizeof(uint32_t)))
+		goto bail;
+
+	fd = open(path, O_RDWR);
+	if ((fd < 0) || (fstat(fd, &movieStat) != 0))
+		goto bail;
+
+	// Chunks may complete out of order, so data is only trusted up to the first hole
+	dataEnd = movieStat.st_size;
+	hole = lseek(fd, (off_t)(header.mdatOffset + kMovMdatHeaderSize), SEEK_HOLE);
+	if ((hole >= 0) && ((uint64_t)hole < dataEnd))
+		dataEnd = hole;
+
+	// Keep the frames whose video and audio are completely on disk
+	frameCount = audioSampleFrames.size();
+	while ((frameCount > 0) && (GetMediaLayout(header, audioSampleFrames, frameCount, NULL, NULL) > dataEnd))
+		frameCount--;
+
+	if (frameCount == 0)
+		goto bail;
+
+	result = FinishMovie(fd, header, audioSampleFrames, frameCount);
+	if (result == S_OK)
+	{
+		unlink(journalPath.c_str());
+		*recoveredFrames = frameCount;
+	}
+
+bail:
+	if (fd >= 0)
+		close(fd);
+
+	if (journalFd >= 0)
+		close(journalFd);
+
+	return result;
+}
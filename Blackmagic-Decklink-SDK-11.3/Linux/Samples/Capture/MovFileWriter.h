@@ -0,0 +1,146 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#ifndef __MOV_FILE_WRITER_H__
+#define __MOV_FILE_WRITER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+class AsyncFileWriter;
+
+struct MovFileWriterSettings
+{
+	uint32_t	audioChannels;				// 0 for no audio track
+	uint32_t	audioSampleDepth;			// As captured, 16 or 32
+	uint32_t	audioStoredBits;			// 16, 24 or 32; 24 keeps the top bits of 32 bit samples
+	uint64_t	preallocationStep;			// Disk space reserved ahead of the data, 0 for none
+
+	MovFileWriterSettings() :
+		audioChannels(2),
+		audioSampleDepth(16),
+		audioStoredBits(16),
+		preallocationStep(1ULL << 30)
+	{ }
+};
+
+struct MovFileWriterStatistics
+{
+	uint64_t	framesWritten;
+	uint64_t	framesSkipped;				// Frames without input, or in a different format
+	uint64_t	framesDropped;				// Left out with their audio, as the disk had fallen behind
+	uint64_t	audioSampleFrames;
+	uint64_t	bytesWritten;
+	bool		failed;
+};
+
+// Describes the movie in a recovery journal. Shared with RecoverMovFile().
+struct MovJournalHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	pixelFormat;				// BMDPixelFormat, which is also the QuickTime codec type
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	rowBytes;
+	uint32_t	fieldDominance;				// BMDFieldDominance
+	uint32_t	audioChannels;
+	uint32_t	audioStoredBits;
+	uint32_t	reserved;
+	int64_t		frameDuration;
+	int64_t		timeScale;
+	uint64_t	mdatOffset;
+	uint64_t	creationTime;				// Seconds since 1904, as QuickTime counts them
+};
+
+// Writes a QuickTime movie of uncompressed video (v210, 2vuy or r210, as captured) and
+// little endian PCM from the DeckLink callback thread. The media data is streamed
+// through an AsyncFileWriter in capture order, each frame followed by its audio. The
+// writer holds each frame and copies it once, into its O_DIRECT chunks on its own
+// thread. A frame the writer has no room for is dropped along with its audio, leaving
+// the movie one frame shorter. Video samples start on 4 kB boundaries for readers that
+// map or read them directly.
+//
+// The sample tables are kept in memory, in chunks the journal thread adds ahead of the
+// capture so the callback never reallocates them, and the moov atom is appended by
+// Close(). Until then a journal beside the movie (<path>.journal) records the format
+// and the audio sample count of every frame, flushed twice a second by that background
+// thread; the layout of the media data follows from it, so RecoverMovFile() can finish
+// a movie whose capture was cut short.
+class MovFileWriter
+{
+public:
+	MovFileWriter();
+	~MovFileWriter();
+
+	bool		Open(const char* path, const MovFileWriterSettings& settings);
+	bool		Close(void);
+
+	// The format of the movie; frames that arrive in a different format are skipped
+	void		SetVideoFormat(BMDTimeValue frameDuration, BMDTimeScale timeScale, BMDFieldDominance fieldDominance);
+
+	bool		WriteFrame(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket);
+
+	void		GetStatistics(MovFileWriterStatistics* statistics);
+
+private:
+	static void*	journalThreadFunc(void* arg);
+	void			journalThread(void);
+	bool			flushJournal(void);
+	uint32_t&		sampleTableEntry(size_t frame);
+
+	std::string					m_path;
+	std::string					m_journalPath;
+	MovFileWriterSettings		m_settings;
+	AsyncFileWriter*			m_writer;
+	std::vector<uint8_t>		m_packedAudio;				// Samples cut down to audioStoredBits
+	int							m_journalFd;
+	uint64_t					m_fileOffset;
+
+	MovJournalHeader			m_header;
+	bool						m_started;
+
+	pthread_t					m_thread;
+	bool						m_threadRunning;
+	pthread_mutex_t				m_mutex;
+	pthread_cond_t				m_cond;
+	bool						m_closing;
+	std::vector<std::vector<uint32_t> >	m_audioSampleFrames;	// Per video frame, in fixed size chunks
+	size_t						m_frameCount;
+	size_t						m_journalledFrames;
+
+	MovFileWriterStatistics		m_statistics;
+};
+
+// Finishes a movie whose capture stopped without Close(), from its journal. Frames not
+// completely on disk are dropped. Removes the journal on success.
+HRESULT		RecoverMovFile(const char* path, uint64_t* recoveredFrames);
+
+#endif
@@ -0,0 +1,65 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "MovFileWriter.h"
+
+// Finishes QuickTime movies written by Capture -M whose capture was cut short, from
+// the journal left beside each movie.
+
+int main(int argc, char* argv[])
+{
+	int exitStatus = 0;
+
+	if (argc < 2)
+	{
+		fprintf(stderr,
+			"\n"
+			"Usage: ./RecoverMovie <movie> [<movie> ...]\n"
+			"\n"
+			"    Finishes each movie from <movie>.journal\n"
+			);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		uint64_t recoveredFrames;
+
+		if (RecoverMovFile(argv[i], &recoveredFrames) != S_OK)
+		{
+			fprintf(stderr, "Could not recover \"%s\"; it needs its journal and at least one complete frame\n", argv[i]);
+			exitStatus = 1;
+			continue;
+		}
+
+		printf("%s: recovered %" PRIu64 " frames\n", argv[i], recoveredFrames);
+	}
+
+	return exitStatus;
+}
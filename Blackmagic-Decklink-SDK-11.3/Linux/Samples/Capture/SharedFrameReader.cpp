@@ -0,0 +1,150 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <csignal>
+#include "SharedFrameRing.h"
+
+// Attaches to the frame ring of a Capture -S process and reads its frames in place.
+// A delay per frame simulates a slow consumer, which skips frames rather than holding
+// up the capture or any other reader.
+
+static volatile sig_atomic_t	g_do_exit = 0;
+
+static void sigfunc(int signum)
+{
+	g_do_exit = 1;
+}
+
+static void DisplayUsage(void)
+{
+	fprintf(stderr,
+		"\n"
+		"Usage: ./SharedFrameReader [OPTIONS] <name>\n"
+		"\n"
+		"    -w <milliseconds>    Hold each frame for this long before releasing it (default is 0)\n"
+		"    -n <frames>          Number of frames to read (default is unlimited)\n"
+		"    -q                   Print only the summary\n"
+		"\n"
+		"Read the frames shared by a capture process started with -S <name>. eg:\n"
+		"\n"
+		"    ./Capture -d 0 -m 14 -S capture0 &\n"
+		"    ./SharedFrameReader -w 100 capture0\n"
+		);
+}
+
+int main(int argc, char* argv[])
+{
+	SharedFrameRingReader	reader;
+	SharedFrame				frame;
+	int						holdMilliseconds = 0;
+	long					maxFrames = -1;
+	bool					quiet = false;
+	int						ch;
+	HRESULT					result;
+
+	while ((ch = getopt(argc, argv, "w:n:qh?")) != -1)
+	{
+		switch (ch)
+		{
+			case 'w':
+				holdMilliseconds = atoi(optarg);
+				break;
+
+			case 'n':
+				maxFrames = atol(optarg);
+				break;
+
+			case 'q':
+				quiet = true;
+				break;
+
+			default:
+				DisplayUsage();
+				return 1;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		DisplayUsage();
+		return 1;
+	}
+
+	if (reader.Open(argv[optind]) != S_OK)
+	{
+		fprintf(stderr, "Could not attach to shared frame ring \"%s\". Is Capture -S running?\n", argv[optind]);
+		return 1;
+	}
+
+	signal(SIGINT, sigfunc);
+	signal(SIGTERM, sigfunc);
+
+	while (!g_do_exit && ((maxFrames < 0) || ((long)reader.GetFramesRead() < maxFrames)))
+	{
+		result = reader.AcquireFrame(&frame, 1000);
+		if (result == S_FALSE)
+			continue;
+		if (result != S_OK)
+		{
+			fprintf(stderr, "The capture process closed the ring\n");
+			break;
+		}
+
+		if (!quiet)
+		{
+			const SharedFrameInfo* info = frame.info;
+
+			printf("Frame #%lu %dx%d - %s - Video: %lu bytes, Audio: %u samples, Ancillary: %u packets%s",
+				(unsigned long)info->sequence,
+				info->width,
+				info->height,
+				(info->flags & bmdFrameHasNoInputSource) ? "No input signal detected" : "Valid Frame",
+				(unsigned long)info->videoBytes,
+				info->audioSampleFrames,
+				info->ancillaryPacketCount,
+				info->truncated ? " (truncated)" : "");
+
+			if (frame.skipped > 0)
+				printf(", skipped %lu", (unsigned long)frame.skipped);
+			printf("\n");
+		}
+
+		if (holdMilliseconds > 0)
+			usleep(holdMilliseconds * 1000);
+
+		reader.ReleaseFrame(frame);
+	}
+
+	fprintf(stderr, "Read %lu frames, skipped %lu\n", (unsigned long)reader.GetFramesRead(), (unsigned long)reader.GetFramesSkipped());
+
+	reader.Close();
+	return 0;
+}
@@ -0,0 +1,532 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "V210Conversion.h"
+#include "VancPacketScanner.h"
+
+// Times VancPacketScanner reading every ancillary packet of a frame's VANC lines.
+//
+// The synthetic benchmark builds the VANC lines here and compares the scanner with the
+// straightforward parse of the same memory, which unpacks each line whole and checks
+// every sample for the ancillary data flag. Both validate parity and checksums and must
+// find the same packets.
+//
+// With -d the scanner is timed on captured frames, beside the packet iterator of
+// IDeckLinkVideoFrameAncillaryPackets on the same frames. The driver has already built
+// the iterator's packets from the VANC it received, out of sight of the timing, so that
+// comparison only shows what each way costs the capture callback.
+
+static const long		kFrameWidth			= 1920;
+static const long		kFrameHeight		= 1080;
+static const long		kRowBytes			= ((kFrameWidth + 47) / 48) * 128;	// bmdFormat10BitYUV
+static const uint32_t	kFirstVancLine		= 9;
+static const uint32_t	kVancLineCount		= 12;
+
+struct SyntheticPacket
+{
+	uint8_t		did;
+	uint8_t		sdid;
+	uint8_t		dataCount;
+	uint32_t	line;
+};
+
+// ATC VITC timecode, AFD, SCTE-104 and a CEA-708 CDP, as typically found together
+static const SyntheticPacket kSyntheticPackets[] =
+{
+	{ 0x60, 0x60, 16,	kFirstVancLine },
+	{ 0x41, 0x05, 8,	kFirstVancLine + 2 },
+	{ 0x41, 0x07, 60,	kFirstVancLine + 3 },
+	{ 0x61, 0x01, 73,	kFirstVancLine + 4 },
+};
+
+static inline uint16_t addParity(uint8_t value)
+{
+	uint16_t b8 = (uint16_t)__builtin_parity(value);
+	return (uint16_t)(((b8 ^ 1) << 9) | (b8 << 8) | value);
+}
+
+// Writes a packet into the Y samples of a line of components, from the given sample on.
+// Returns the number of samples used.
+static uint32_t writePacket(uint16_t* components, uint32_t sample, uint8_t did, uint8_t sdid, const uint8_t* data, uint8_t dataCount)
+{
+	uint16_t*	luma = components + 1;
+	uint32_t	words = 0;
+	uint32_t	checksum = 0;
+
+	luma[2 * (sample + words++)] = 0x000;
+	luma[2 * (sample + words++)] = 0x3ff;
+	luma[2 * (sample + words++)] = 0x3ff;
+
+	uint16_t header[3] = { addParity(did), addParity(sdid), addParity(dataCount) };
+	for (int i = 0; i < 3; i++)
+	{
+		luma[2 * (sample + words++)] = header[i];
+		checksum += header[i] & 0x1ff;
+	}
+
+	for (uint32_t i = 0; i < dataCount; i++)
+	{
+		uint16_t word = addParity(data[i]);
+		luma[2 * (sample + words++)] = word;
+		checksum += word & 0x1ff;
+	}
+
+	checksum &= 0x1ff;
+	luma[2 * (sample + words++)] = (uint16_t)(((~checksum >> 8) & 1) << 9 | checksum);
+
+	return words;
+}
+
+// Reads every packet of a frame through the packet iterator. Returns the packet count.
+static uint32_t iteratePackets(IDeckLinkVideoFrameAncillaryPackets* ancillaryPackets, uint32_t* checksum)
+{
+	IDeckLinkAncillaryPacketIterator*	iterator = NULL;
+	IDeckLinkAncillaryPacket*			packet = NULL;
+	uint32_t							packetCount = 0;
+
+	if (ancillaryPackets->GetPacketIterator(&iterator) != S_OK)
+		return 0;
+
+	while (iterator->Next(&packet) == S_OK)
+	{
+		const void*	data;
+		uint32_t	size;
+
+		*checksum += packet->GetDID() + packet->GetSDID();
+		if (packet->GetBytes(bmdAncillaryPacketFormatUInt8, &data, &size) == S_OK)
+		{
+			for (uint32_t i = 0; i < size; i++)
+				*checksum += ((const uint8_t*)data)[i];
+		}
+
+		packet->Release();
+		packetCount++;
+	}
+
+	iterator->Release();
+	return packetCount;
+}
+
+// Reads every packet of the scanned line. Returns the packet count.
+static uint32_t readScannedPackets(const VancPacketScanner& scanner, uint32_t* checksum)
+{
+	for (uint32_t i = 0; i < scanner.GetPacketCount(); i++)
+	{
+		const VancPacketView& packet = scanner.GetPackets()[i];
+
+		*checksum += packet.did + packet.sdid;
+		for (uint32_t j = 0; j < packet.dataCount; j++)
+			*checksum += packet.GetByte(j);
+	}
+
+	return scanner.GetPacketCount();
+}
+
+static inline bool hasValidParity(uint16_t word)
+{
+	return word == addParity((uint8_t)word);
+}
+
+// Reads every packet of a v210 HD line the straightforward way: the whole line is unpacked,
+// then each Y and each C sample is compared with the start of an ancillary data flag.
+// Returns the packet count.
+static uint32_t parseLine(const void* v210Line, uint16_t* components, long width, uint32_t* checksum)
+{
+	uint32_t	componentCount = (uint32_t)width * 2;
+	uint32_t	packetCount = 0;
+
+	UnpackV210Row(v210Line, components, width);
+
+	for (uint32_t stream = 0; stream < 2; stream++)
+	{
+		for (uint32_t i = stream; i + 6 * 2 < componentCount; i += 2)
+		{
+			if ((components[i] != 0x000) || (components[i + 2] != 0x3ff) || (components[i + 4] != 0x3ff))
+				continue;
+
+			const uint16_t*	words = components + i + 6;
+			uint32_t		dataCount = words[4] & 0xff;
+			uint32_t		sum = 0;
+
+			if (!hasValidParity(words[0]) || !hasValidParity(words[2]) || !hasValidParity(words[4]))
+				continue;
+			if (i + 6 + (3 + dataCount) * 2 >= componentCount)
+				break;
+
+			for (uint32_t w = 0; w < 3 + dataCount; w++)
+				sum += words[w * 2] & 0x1ff;
+			sum &= 0x1ff;
+			if (words[(3 + dataCount) * 2] != (((~sum >> 8) & 1) << 9 | sum))
+				continue;
+
+			*checksum += (uint8_t)words[0] + (uint8_t)words[2];
+			for (uint32_t w = 0; w < dataCount; w++)
+				*checksum += (uint8_t)words[(3 + w) * 2];
+
+			packetCount++;
+			i += 6 + (3 + dataCount) * 2;
+		}
+	}
+
+	return packetCount;
+}
+
+static double elapsedNanoseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void printResult(const char* name, double nanoseconds, uint32_t frames, uint64_t packets)
+{
+	printf("    %-10s %8.2f us per frame, %6.1f ns per packet\n", name, nanoseconds / frames / 1000.0,
+		   packets ? nanoseconds / packets : 0.0);
+}
+
+static int runSyntheticBenchmark(uint32_t frames)
+{
+	std::vector<uint8_t>				vanc(kVancLineCount * kRowBytes);
+	std::vector<uint16_t>				components(GetComponentRowLength(kFrameWidth));
+	std::vector<uint8_t>				data[sizeof(kSyntheticPackets) / sizeof(kSyntheticPackets[0])];
+	VancPacketScanner					scanner(kFrameWidth);
+	uint64_t							expectedPackets = (uint64_t)frames * (sizeof(kSyntheticPackets) / sizeof(kSyntheticPackets[0]));
+	uint32_t							scanChecksum = 0;
+	uint32_t							parseChecksum = 0;
+	uint64_t							scannedPackets = 0;
+	uint64_t							parsedPackets = 0;
+	double								scanTime;
+	double								parseTime;
+
+	// Build the VANC lines: blank, with the packets in the Y samples of their lines
+	for (uint32_t line = 0; line < kVancLineCount; line++)
+	{
+		for (size_t i = 0; i < components.size(); i += 2)
+		{
+			components[i] = 0x200;
+			components[i + 1] = 0x040;
+		}
+
+		for (size_t p = 0; p < sizeof(kSyntheticPackets) / sizeof(kSyntheticPackets[0]); p++)
+		{
+			const SyntheticPacket& packet = kSyntheticPackets[p];
+
+			if (packet.line != kFirstVancLine + line)
+				continue;
+
+			data[p].resize(packet.dataCount);
+			for (uint32_t i = 0; i < packet.dataCount; i++)
+				data[p][i] = (uint8_t)(rand() & 0xff);
+
+			writePacket(components.data(), 0, packet.did, packet.sdid, data[p].data(), packet.dataCount);
+		}
+
+		PackComponentRow(bmdFormat10BitYUV, components.data(), vanc.data() + line * kRowBytes, kFrameWidth, kVideoConversionRec709);
+	}
+
+	printf("Synthetic %ldx%ld frame, %u VANC lines, %u packets, %u frames\n", kFrameWidth, kFrameHeight, kVancLineCount,
+		   (unsigned)(sizeof(kSyntheticPackets) / sizeof(kSyntheticPackets[0])), frames);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		for (uint32_t line = 0; line < kVancLineCount; line++)
+		{
+			scanner.ScanLine(vanc.data() + line * kRowBytes, kFrameWidth);
+			scannedPackets += readScannedPackets(scanner, &scanChecksum);
+		}
+	}
+	scanTime = elapsedNanoseconds(start);
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		for (uint32_t line = 0; line < kVancLineCount; line++)
+			parsedPackets += parseLine(vanc.data() + line * kRowBytes, components.data(), kFrameWidth, &parseChecksum);
+	}
+	parseTime = elapsedNanoseconds(start);
+
+	printResult("Scanner", scanTime, frames, scannedPackets);
+	printResult("Full parse", parseTime, frames, parsedPackets);
+	printf("    Scanner is %.1fx the speed of the full parse, reading %.1f GB/s of VANC\n", parseTime / scanTime,
+		   (double)vanc.size() * frames / scanTime);
+
+	if ((scannedPackets != expectedPackets) || (parsedPackets != expectedPackets) || (scanChecksum != parseChecksum))
+	{
+		fprintf(stderr, "The scanner found %llu packets and the full parse %llu, expected %llu\n", (unsigned long long)scannedPackets,
+				(unsigned long long)parsedPackets, (unsigned long long)expectedPackets);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Times both paths on each captured frame
+class CaptureBenchmark : public IDeckLinkInputCallback
+{
+public:
+	CaptureBenchmark(uint32_t frames) :
+		m_scanner(4096), m_framesWanted(frames), m_frames(0), m_vancFrames(0), m_iteratorPackets(0), m_scannedPackets(0),
+		m_iteratorTime(0), m_scanTime(0), m_checksum(0), m_refCount(1)
+	{
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket)
+	{
+		IDeckLinkVideoFrameAncillaryPackets*	ancillaryPackets = NULL;
+		IDeckLinkVideoFrameAncillary*			ancillary = NULL;
+
+		if ((videoFrame == NULL) || isDone())
+			return S_OK;
+
+		if (videoFrame->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&ancillaryPackets) == S_OK)
+		{
+			auto start = std::chrono::steady_clock::now();
+			m_iteratorPackets += iteratePackets(ancillaryPackets, &m_checksum);
+			m_iteratorTime += elapsedNanoseconds(start);
+			ancillaryPackets->Release();
+		}
+
+		if (videoFrame->GetAncillaryData(&ancillary) == S_OK)
+		{
+			// The first frame finds which lines the VANC buffer holds
+			if (m_vancLines.empty())
+			{
+				void* buffer;
+				for (uint32_t line = 1; line <= (uint32_t)videoFrame->GetHeight() + 45; line++)
+				{
+					if (ancillary->GetBufferForVerticalBlankingLine(line, &buffer) == S_OK)
+						m_vancLines.push_back(line);
+				}
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			for (uint32_t line : m_vancLines)
+			{
+				if (m_scanner.ScanFrameLine(ancillary, line, videoFrame->GetWidth()) == S_OK)
+					m_scannedPackets += readScannedPackets(m_scanner, &m_checksum);
+			}
+			m_scanTime += elapsedNanoseconds(start);
+			m_vancFrames++;
+			ancillary->Release();
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (++m_frames == m_framesWanted)
+			m_done.notify_all();
+
+		return S_OK;
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode* newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags)
+	{
+		return S_OK;
+	}
+
+	void WaitUntilDone(void)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_frames >= m_framesWanted; });
+	}
+
+	void PrintResults(void)
+	{
+		printf("Captured %u frames, %u with VANC lines (%u lines each)\n", m_frames, m_vancFrames, (unsigned)m_vancLines.size());
+		printResult("Iterator", m_iteratorTime, m_frames, m_iteratorPackets);
+		if (m_vancFrames > 0)
+			printResult("Scanner", m_scanTime, m_vancFrames, m_scannedPackets);
+		else
+			printf("    Scanner    not measured: the input frames have no VANC buffer\n");
+		printf("    Scan kernel %s: %llu packets, %llu checksum errors, %llu parity errors\n", GetVancScanKernelName(),
+			   (unsigned long long)m_scanner.GetStatistics().packets, (unsigned long long)m_scanner.GetStatistics().checksumErrors,
+			   (unsigned long long)m_scanner.GetStatistics().parityErrors);
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG STDMETHODCALLTYPE AddRef(void)
+	{
+		return __sync_add_and_fetch(&m_refCount, 1);
+	}
+
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		int32_t newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
+		if (newRefValue == 0)
+			delete this;
+		return newRefValue;
+	}
+
+private:
+	bool isDone(void)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_frames >= m_framesWanted;
+	}
+
+	VancPacketScanner			m_scanner;
+	std::vector<uint32_t>		m_vancLines;
+	uint32_t					m_framesWanted;
+	uint32_t					m_frames;
+	uint32_t					m_vancFrames;
+	uint64_t					m_iteratorPackets;
+	uint64_t					m_scannedPackets;
+	double						m_iteratorTime;
+	double						m_scanTime;
+	uint32_t					m_checksum;
+	std::mutex					m_mutex;
+	std::condition_variable		m_done;
+	int32_t						m_refCount;
+};
+
+static int runCaptureBenchmark(int deviceIndex, uint32_t frames)
+{
+	IDeckLinkIterator*	deckLinkIterator = CreateDeckLinkIteratorInstance();
+	IDeckLink*			deckLink = NULL;
+	IDeckLinkInput*		deckLinkInput = NULL;
+	CaptureBenchmark*	benchmark = NULL;
+	int					exitStatus = 1;
+
+	if (deckLinkIterator == NULL)
+	{
+		fprintf(stderr, "A DeckLink iterator could not be created.  The DeckLink drivers may not be installed.\n");
+		return 1;
+	}
+
+	for (int i = 0; i <= deviceIndex; i++)
+	{
+		if (deckLink != NULL)
+			deckLink->Release();
+		if (deckLinkIterator->Next(&deckLink) != S_OK)
+		{
+			deckLink = NULL;
+			break;
+		}
+	}
+
+	if ((deckLink == NULL) || (deckLink->QueryInterface(IID_IDeckLinkInput, (void**)&deckLinkInput) != S_OK))
+	{
+		fprintf(stderr, "Device %d has no input\n", deviceIndex);
+		goto bail;
+	}
+
+	benchmark = new CaptureBenchmark(frames);
+	deckLinkInput->SetCallback(benchmark);
+
+	if ((deckLinkInput->EnableVideoInput(bmdModeHD1080i50, bmdFormat10BitYUV, bmdVideoInputFlagDefault) != S_OK) ||
+		(deckLinkInput->StartStreams() != S_OK))
+	{
+		fprintf(stderr, "Could not start capture on device %d\n", deviceIndex);
+		goto bail;
+	}
+
+	benchmark->WaitUntilDone();
+	deckLinkInput->StopStreams();
+	deckLinkInput->DisableVideoInput();
+
+	benchmark->PrintResults();
+	exitStatus = 0;
+
+bail:
+	if (deckLinkInput != NULL)
+	{
+		deckLinkInput->SetCallback(NULL);
+		deckLinkInput->Release();
+	}
+	if (benchmark != NULL)
+		benchmark->Release();
+	if (deckLink != NULL)
+		deckLink->Release();
+	deckLinkIterator->Release();
+
+	return exitStatus;
+}
+
+static void DisplayUsage(void)
+{
+	fprintf(stderr,
+		"\n"
+		"Usage: ./VancScanBenchmark [OPTIONS]\n"
+		"\n"
+		"    -d <device index>    Measure on frames captured in 1080i50 from this device, rather than synthetic VANC\n"
+		"    -n <frames>          Number of frames (default is 100000 synthetic, or 500 captured)\n"
+		"\n"
+		"Time reading the ancillary packets of a frame with the VANC scanner, against a full parse of the\n"
+		"same synthetic lines, or against the packet iterator on captured frames. eg:\n"
+		"\n"
+		"    ./VancScanBenchmark\n"
+		"    ./VancScanBenchmark -d 0 -n 250\n"
+		);
+}
+
+int main(int argc, char* argv[])
+{
+	int			deviceIndex = -1;
+	long		frames = 0;
+	int			ch;
+
+	while ((ch = getopt(argc, argv, "d:n:h?")) != -1)
+	{
+		switch (ch)
+		{
+			case 'd':
+				deviceIndex = atoi(optarg);
+				break;
+
+			case 'n':
+				frames = atol(optarg);
+				break;
+
+			default:
+				DisplayUsage();
+				return 1;
+		}
+	}
+
+	if ((optind != argc) || (deviceIndex < -1) || (frames < 0))
+	{
+		DisplayUsage();
+		return 1;
+	}
+
+	printf("VANC scan kernel %s, v210 unpack kernel %s\n", GetVancScanKernelName(), GetV210KernelName());
+
+	if (deviceIndex >= 0)
+		return runCaptureBenchmark(deviceIndex, frames ? (uint32_t)frames : 500);
+
+	return runSyntheticBenchmark(frames ? (uint32_t)frames : 100000);
+}
@@ -28,6 +28,7 @@
 //
 
 #include <stdio.h>
+#include <algorithm>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
@@ -40,6 +41,7 @@
 #include "DeckLinkInputDevice.h"
 #include "DeckLinkAPI.h"
 #include "ImageWriter.h"
+#include "ImageWriterPipeline.h"
 
 // Pixel format tuple encoding {BMDPixelFormat enum, Pixel format display name}
 const std::vector<std::tuple<BMDPixelFormat, std::string>> kSupportedPixelFormats
@@ -59,8 +61,21 @@ enum {
 	kPixelFormatString
 };
 
+// Overflow policy tuple encoding {VideoFrameQueueOverflowPolicy enum, Policy command line name}
+const std::vector<std::tuple<VideoFrameQueueOverflowPolicy, std::string>> kOverflowPolicies
+{
+	std::make_tuple(kVideoFrameQueueDropOldest, "drop-oldest"),
+	std::make_tuple(kVideoFrameQueueDropNewest, "drop-newest"),
+	std::make_tuple(kVideoFrameQueueBlockWithTimeout, "block"),
+};
+enum {
+	kOverflowPolicyValue = 0,
+	kOverflowPolicyName
+};
+
 void CaptureStills(DeckLinkInputDevice* deckLinkInput, const int captureInterval, const int framesToCapture,
-				   const std::string& captureDirectory, const std::string& filenamePrefix)
+				   const std::string& captureDirectory, const std::string& filenamePrefix,
+				   const unsigned encoderThreadCount, const PNGEncodeOptions& pngEncodeOptions)
 {
 	int							captureFrameCount		= 0;
 	HRESULT						result					= S_OK;
@@ -70,6 +85,9 @@ void CaptureStills(DeckLinkInputDevice* deckLinkInput, const int captureInterval
 	IDeckLinkVideoConversion*	deckLinkFrameConverter	= NULL;
 	IDeckLinkVideoFrame*		bgra32Frame				= NULL;
 
+	// Frames are encoded in parallel; CaptureStills only waits when every encoder is busy
+	ImageWriterPipeline			imageWriter(encoderThreadCount, pngEncodeOptions);
+
 	// Create frame conversion instance
 	result = GetDeckLinkVideoConversion(&deckLinkFrameConverter);
 	if (result != S_OK)
@@ -118,12 +136,8 @@ void CaptureStills(DeckLinkInputDevice* deckLinkInput, const int captureInterval
 					}
 				}
 
-				result = ImageWriter::WriteBgra32VideoFrameToPNG(bgra32Frame, outputFileName);
-				if (FAILED(result))
-				{
-					fprintf(stderr, "Image encoding to file was unsuccessful\n");
+				if (captureRunning && !imageWriter.Submit(bgra32Frame, outputFileName))
 					captureRunning = false;
-				}
 
 				bgra32Frame->Release();
 				
@@ -142,6 +156,9 @@ void CaptureStills(DeckLinkInputDevice* deckLinkInput, const int captureInterval
 		}
 	}
 
+	// Wait for the frames still being encoded
+	imageWriter.Flush();
+
 	if (deckLinkFrameConverter != NULL)
 	{
 		deckLinkFrameConverter->Release();
@@ -271,6 +288,11 @@ void DisplayUsage(DeckLinkInputDevice* selectedDeckLinkInput, const std::vector<
 		"    -n <frames>          Number of frames to capture (default is 1)\n"
 		"    -i <interval>        Capture frame interval rate (default is 1 - every frame)\n"
 		"    -f <prefix>          Filename prefix (default is \"image_\")\n"
+		"    -q <policy>          Frame queue overflow policy: drop-oldest (default), drop-newest or block\n"
+		"    -e <threads>         Number of PNG encoder threads (default is one per CPU)\n"
+		"    -z <level>           PNG zlib compression level, 0-9 (default is libpng's)\n"
+		"    -F <filter>          PNG row filters: none, sub, up, fast (none/sub/up) or all (default)\n"
+		"    -S <strategy>        PNG zlib strategy: default, filtered, huffman, rle or fixed\n"
 		"    <capturedirectory>\n"
 		"\n"
 		"Capture image stills to a specified directory. eg:\n"
@@ -290,6 +312,10 @@ int main(int argc, char* argv[])
 	int							captureInterval			= 1;
 	int							pixelFormatIndex		= 0;
 	bool						enableFormatDetection	= false;
+	VideoFrameQueueOverflowPolicy	overflowPolicy		= kVideoFrameQueueDropOldest;
+	VideoFrameQueueStatistics	frameQueueStatistics;
+	int							encoderThreadCount		= 0;
+	PNGEncodeOptions			pngEncodeOptions;
 	std::string					filenamePrefix;
 	std::string					captureDirectory;
 
@@ -334,6 +360,58 @@ int main(int argc, char* argv[])
 		else if (strcmp(argv[i], "-f") == 0)
 			filenamePrefix = argv[++i];
 
+		else if (strcmp(argv[i], "-q") == 0)
+		{
+			const char*	policyName = argv[++i];
+			bool		policyFound = false;
+
+			for (auto& policy : kOverflowPolicies)
+			{
+				if (std::get<kOverflowPolicyName>(policy) == policyName)
+				{
+					overflowPolicy = std::get<kOverflowPolicyValue>(policy);
+					policyFound = true;
+				}
+			}
+
+			if (!policyFound)
+			{
+				fprintf(stderr, "Invalid frame queue overflow policy \"%s\"\n", policyName);
+				displayHelp = true;
+			}
+		}
+
+		else if (strcmp(argv[i], "-e") == 0)
+			encoderThreadCount = atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "-z") == 0)
+		{
+			pngEncodeOptions.compressionLevel = atoi(argv[++i]);
+			if ((pngEncodeOptions.compressionLevel < 0) || (pngEncodeOptions.compressionLevel > 9))
+			{
+				fprintf(stderr, "Invalid PNG compression level %d\n", pngEncodeOptions.compressionLevel);
+				displayHelp = true;
+			}
+		}
+
+		else if (strcmp(argv[i], "-F") == 0)
+		{
+			if (!ImageWriter::ParsePNGFilterName(argv[++i], pngEncodeOptions.filters))
+			{
+				fprintf(stderr, "Invalid PNG filter \"%s\"\n", argv[i]);
+				displayHelp = true;
+			}
+		}
+
+		else if (strcmp(argv[i], "-S") == 0)
+		{
+			if (!ImageWriter::ParsePNGStrategyName(argv[++i], pngEncodeOptions.strategy))
+			{
+				fprintf(stderr, "Invalid PNG strategy \"%s\"\n", argv[i]);
+				displayHelp = true;
+			}
+		}
+
 		else if ((strcmp(argv[i], "?") == 0) || (strcmp(argv[i], "-h") == 0))
 			displayHelp = true;
 
@@ -403,7 +481,7 @@ int main(int argc, char* argv[])
 				result = deckLinkAttributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection, &formatDetectionSupportAttribute);
 				supportsFormatDetection = (result == S_OK) && formatDetectionSupportAttribute;
 
-				selectedDeckLinkInput = new DeckLinkInputDevice(deckLink);
+				selectedDeckLinkInput = new DeckLinkInputDevice(deckLink, overflowPolicy);
 			}
 			
 			deckLinkAttributes->Release();
@@ -525,7 +603,8 @@ int main(int argc, char* argv[])
 
 	// Start thread for capture processing
 	captureStillsThread = std::thread([&]{
-		CaptureStills(selectedDeckLinkInput, captureInterval, framesToCapture, captureDirectory, filenamePrefix);
+		CaptureStills(selectedDeckLinkInput, captureInterval, framesToCapture, captureDirectory, filenamePrefix,
+					  (unsigned)std::max(0, encoderThreadCount), pngEncodeOptions);
 	});
 
 	keyPressThread = std::thread([&]{
@@ -537,6 +616,13 @@ int main(int argc, char* argv[])
 	captureStillsThread.join();
 	selectedDeckLinkInput->StopCapture();
 
+	selectedDeckLinkInput->GetVideoFrameQueueStatistics(&frameQueueStatistics);
+	fprintf(stderr, "Frame queue: %llu frames queued, %llu dropped, %llu pushes blocked\n",
+		(unsigned long long)frameQueueStatistics.framesQueued,
+		(unsigned long long)frameQueueStatistics.framesDropped,
+		(unsigned long long)frameQueueStatistics.pushesBlocked
+		);
+
 	keyPressThread.join();
 
 	// All Okay.
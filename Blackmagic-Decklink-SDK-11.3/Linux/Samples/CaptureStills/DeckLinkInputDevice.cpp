@@ -29,10 +29,17 @@
 #include "platform.h"
 #include "DeckLinkInputDevice.h"
 
-static const std::chrono::seconds kValidFrameTimeout{5};
+static const std::chrono::seconds		kValidFrameTimeout{5};
 
-DeckLinkInputDevice::DeckLinkInputDevice(IDeckLink* device)
-	: m_deckLink(device), m_deckLinkInput(NULL), m_cancelCapture(false), m_refCount(1)
+// Frames waiting for the capture thread. When PNG encoding falls behind, frames are
+// dropped according to the overflow policy rather than holding on to driver buffers.
+static const unsigned					kVideoFrameQueueCapacity = 4;
+static const std::chrono::milliseconds	kVideoFrameQueueBlockTimeout{100};
+
+DeckLinkInputDevice::DeckLinkInputDevice(IDeckLink* device, VideoFrameQueueOverflowPolicy overflowPolicy)
+	: m_deckLink(device), m_deckLinkInput(NULL),
+	m_videoFrameQueue(kVideoFrameQueueCapacity, overflowPolicy, kVideoFrameQueueBlockTimeout),
+	m_refCount(1)
 {
 	m_deckLink->AddRef();
 }
@@ -143,12 +150,8 @@ bail:
 
 void DeckLinkInputDevice::CancelCapture()
 {
-	{
-		// signal cancel flag to terminate wait condition
-		std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-		m_cancelCapture = true;
-	}
-	m_deckLinkInputCondition.notify_one();
+	// signal cancel flag to terminate wait for frame
+	m_videoFrameQueue.Cancel();
 }
 
 void DeckLinkInputDevice::StopCapture()
@@ -158,15 +161,8 @@ void DeckLinkInputDevice::StopCapture()
 		// Unregister capture callback
 		m_deckLinkInput->SetCallback(NULL);
 		
-		{
-			// Clear video frame queue
-			std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-			while (!m_videoFrameQueue.empty())
-			{
-				m_videoFrameQueue.front()->Release();
-				m_videoFrameQueue.pop();
-			}
-		}
+		// Clear video frame queue
+		m_videoFrameQueue.Clear();
 
 		// Stop the capture
 		m_deckLinkInput->StopStreams();
@@ -178,19 +174,7 @@ void DeckLinkInputDevice::StopCapture()
 
 bool DeckLinkInputDevice::WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled)
 {
-	std::unique_lock<std::mutex> lock(m_deckLinkInputMutex);
-	if (!m_deckLinkInputCondition.wait_for(lock, kValidFrameTimeout, [&]{ return !m_videoFrameQueue.empty() || m_cancelCapture; }))
-		// wait_for timeout
-		return false;
-
-	if (!m_videoFrameQueue.empty())
-	{
-		*frame = m_videoFrameQueue.front();
-		m_videoFrameQueue.pop();
-	}
-
-	captureCancelled = m_cancelCapture;
-	return true;
+	return m_videoFrameQueue.Wait(frame, kValidFrameTimeout, captureCancelled);
 }
 
 HRESULT DeckLinkInputDevice::VideoInputFormatChanged(/* in */ BMDVideoInputFormatChangedEvents notificationEvents, /* in */ IDeckLinkDisplayMode *newMode, /* in */ BMDDetectedVideoInputFormatFlags detectedSignalFlags)
@@ -251,13 +235,8 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(/* in */ IDeckLinkVideoInput
 
 		if (inputFrameValid && m_prevInputFrameValid)
 		{
-			// If valid frame, add to queue for processing and notify
-			videoFrame->AddRef();
-			{
-				std::lock_guard<std::mutex> lock(m_deckLinkInputMutex);
-				m_videoFrameQueue.push(videoFrame);
-			}
-			m_deckLinkInputCondition.notify_one();
+			// If valid frame, add to queue for processing; the queue takes its own reference
+			m_videoFrameQueue.Push(videoFrame);
 		}
 
 		m_prevInputFrameValid = inputFrameValid;
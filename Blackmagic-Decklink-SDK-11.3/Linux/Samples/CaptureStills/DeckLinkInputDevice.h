@@ -28,11 +28,9 @@
 #pragma once
 
 #include <atomic>
-#include <condition_variable>
-#include <mutex>
-#include <queue>
 #include <vector>
 #include "DeckLinkAPI.h"
+#include "VideoFrameQueue.h"
 
 
 class DeckLinkInputDevice : public IDeckLinkInputCallback
@@ -43,16 +41,13 @@ private:
 	IDeckLinkInput*						m_deckLinkInput;
 	std::vector<IDeckLinkDisplayMode*>	m_modeList;
 
-	std::queue<IDeckLinkVideoFrame*>	m_videoFrameQueue;
-	std::condition_variable				m_deckLinkInputCondition;
-	std::mutex							m_deckLinkInputMutex;
-	bool								m_cancelCapture;
+	VideoFrameQueue						m_videoFrameQueue;
 	bool								m_prevInputFrameValid;
 
 	std::atomic<uint32_t>				m_refCount;
 
 public:
-	DeckLinkInputDevice(IDeckLink* device);
+	DeckLinkInputDevice(IDeckLink* device, VideoFrameQueueOverflowPolicy overflowPolicy);
 	virtual ~DeckLinkInputDevice();
 
 	HRESULT								Init(void);
@@ -63,6 +58,7 @@ public:
 	IDeckLinkInput*						GetDeckLinkInput(void) const { return m_deckLinkInput; };
 	std::vector<IDeckLinkDisplayMode*>& GetDisplayModeList(void) { return m_modeList; };
 	bool								WaitForVideoFrameArrived(IDeckLinkVideoFrame** frame, bool& captureCancelled);
+	void								GetVideoFrameQueueStatistics(VideoFrameQueueStatistics* statistics) const { m_videoFrameQueue.GetStatistics(statistics); };
 
 	// IDeckLinkInputCallback interface
 	virtual HRESULT STDMETHODCALLTYPE	VideoInputFormatChanged (BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode *newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags);
@@ -32,8 +32,30 @@
 #include <stdint.h>
 #include "DeckLinkAPI.h"
 
+#include <vector>
+
+// PNG compression settings; -1 leaves a setting at the library default
+struct PNGEncodeOptions
+{
+	int		compressionLevel;	// zlib level, 0-9
+	int		filters;			// Bitwise OR of PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, ...
+	int		strategy;			// zlib strategy, eg Z_FILTERED or Z_RLE
+
+	PNGEncodeOptions() : compressionLevel(-1), filters(-1), strategy(-1) {}
+};
+
 namespace ImageWriter
 {
 	HRESULT GetNextFilenameWithPrefix(const std::string& path, const std::string& filenamePrefix, std::string& nextFileName);
 	HRESULT WriteBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32VideoFrame, const std::string& pngFilename);
+
+	// Encodes to memory. rowPointers is scratch space that callers may keep between
+	// frames to avoid reallocating it; pngData is replaced with the encoded file.
+	HRESULT EncodeBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32VideoFrame, const PNGEncodeOptions& options,
+										std::vector<uint8_t*>& rowPointers, std::vector<uint8_t>& pngData);
+	HRESULT WriteDataToFile(const std::vector<uint8_t>& data, const std::string& filename);
+
+	// Parse the command line names of filter and strategy settings; return false if unknown
+	bool	ParsePNGFilterName(const std::string& name, int& filters);
+	bool	ParsePNGStrategyName(const std::string& name, int& strategy);
 };
\ No newline at end of file
@@ -26,6 +26,7 @@
 */
 
 #include <png.h>
+#include <zlib.h>
 #include <sys/stat.h>
 #include <iomanip>
 #include <sstream>
@@ -56,13 +57,36 @@ HRESULT ImageWriter::GetNextFilenameWithPrefix(const std::string& path, const st
 	return result;
 }
 
+static void appendPNGData(png_structp pngDataPtr, png_bytep data, png_size_t length)
+{
+	std::vector<uint8_t>* pngData = (std::vector<uint8_t>*)png_get_io_ptr(pngDataPtr);
+	pngData->insert(pngData->end(), data, data + length);
+}
+
+static void flushPNGData(png_structp pngDataPtr)
+{
+}
+
 HRESULT ImageWriter::WriteBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32VideoFrame, const std::string& pngFilename)
 {
-	bool        result         = E_FAIL;
+	HRESULT					result;
+	std::vector<uint8_t*>	rowPointers;
+	std::vector<uint8_t>	pngData;
+
+	result = EncodeBgra32VideoFrameToPNG(bgra32VideoFrame, PNGEncodeOptions(), rowPointers, pngData);
+	if (result != S_OK)
+		return result;
+
+	return WriteDataToFile(pngData, pngFilename);
+}
+
+HRESULT ImageWriter::EncodeBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32VideoFrame, const PNGEncodeOptions& options,
+												 std::vector<uint8_t*>& rowPointers, std::vector<uint8_t>& pngData)
+{
+	HRESULT		result         = E_FAIL;
 	png_structp pngDataPtr     = nullptr;
 	png_infop   pngInfoPtr     = nullptr;
 	png_bytep   deckLinkBuffer = nullptr;
-	png_bytepp  rowPtrs        = nullptr;
 
 	// Ensure video frame has expected pixel format
 	if (bgra32VideoFrame->GetPixelFormat() != bmdFormat8BitBGRA)
@@ -70,14 +94,20 @@ HRESULT ImageWriter::WriteBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32Video
 		fprintf(stderr, "Video frame is not in 8-Bit BGRA pixel format\n");
 		return E_FAIL;
 	}
-	
-	FILE *pngFile = fopen(pngFilename.c_str(), "wb");
-	if (!pngFile)
+
+	if (bgra32VideoFrame->GetBytes((void**)&deckLinkBuffer) != S_OK)
 	{
-		fprintf(stderr, "Could not open PNG file %s for writing\n", pngFilename.c_str());
-		return false;
+		fprintf(stderr, "Could not get DeckLinkVideoFrame buffer pointer\n");
+		return E_FAIL;
 	}
 
+	// Set row pointers from the buffer, reusing the caller's array
+	rowPointers.resize(bgra32VideoFrame->GetHeight());
+	for (uint32_t row = 0; row < bgra32VideoFrame->GetHeight(); ++row)
+		rowPointers[row] = &deckLinkBuffer[row * bgra32VideoFrame->GetRowBytes()];
+
+	pngData.clear();
+
 	pngDataPtr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (!pngDataPtr)
 	{
@@ -98,7 +128,16 @@ HRESULT ImageWriter::WriteBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32Video
 		goto bail;
 	}
 
-	png_init_io(pngDataPtr, pngFile);
+	png_set_write_fn(pngDataPtr, &pngData, appendPNGData, flushPNGData);
+
+	if (options.compressionLevel >= 0)
+		png_set_compression_level(pngDataPtr, options.compressionLevel);
+
+	if (options.filters >= 0)
+		png_set_filter(pngDataPtr, PNG_FILTER_TYPE_BASE, options.filters);
+
+	if (options.strategy >= 0)
+		png_set_compression_strategy(pngDataPtr, options.strategy);
 
 	png_set_IHDR(pngDataPtr, pngInfoPtr, bgra32VideoFrame->GetWidth(), bgra32VideoFrame->GetHeight(),
 					8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, 
@@ -107,27 +146,72 @@ HRESULT ImageWriter::WriteBgra32VideoFrameToPNG(IDeckLinkVideoFrame* bgra32Video
 
 	png_set_bgr(pngDataPtr);
 
-	if (bgra32VideoFrame->GetBytes((void**)&deckLinkBuffer) != S_OK)
-	{
-		fprintf(stderr, "Could not get DeckLinkVideoFrame buffer pointer\n");
-		goto bail;
-	}
-
-	rowPtrs = (png_bytep*)malloc(sizeof(png_bytep) * bgra32VideoFrame->GetHeight());
-
-	// Set row pointers from the buffer
-	for (uint32_t row = 0; row < bgra32VideoFrame->GetHeight(); ++row)
-		rowPtrs[row] = &deckLinkBuffer[row * bgra32VideoFrame->GetRowBytes()];
-
-	png_write_image(pngDataPtr, rowPtrs);
+	png_write_image(pngDataPtr, rowPointers.data());
 	png_write_end(pngDataPtr, NULL);
 
 	result = S_OK;
 
 bail:
-	fclose(pngFile);
 	png_destroy_write_struct(&pngDataPtr, &pngInfoPtr);
-	free(rowPtrs);
-	
+
+	return result;
+}
+
+HRESULT ImageWriter::WriteDataToFile(const std::vector<uint8_t>& data, const std::string& filename)
+{
+	HRESULT	result = S_OK;
+	FILE*	file = fopen(filename.c_str(), "wb");
+
+	if (!file)
+	{
+		fprintf(stderr, "Could not open PNG file %s for writing\n", filename.c_str());
+		return E_FAIL;
+	}
+
+	if (fwrite(data.data(), 1, data.size(), file) != data.size())
+	{
+		fprintf(stderr, "Could not write PNG file %s\n", filename.c_str());
+		result = E_FAIL;
+	}
+
+	if (fclose(file) != 0)
+		result = E_FAIL;
+
 	return result;
 }
+
+bool ImageWriter::ParsePNGFilterName(const std::string& name, int& filters)
+{
+	if (name == "none")
+		filters = PNG_FILTER_NONE;
+	else if (name == "sub")
+		filters = PNG_FILTER_SUB;
+	else if (name == "up")
+		filters = PNG_FILTER_UP;
+	else if (name == "fast")
+		filters = PNG_FILTER_NONE | PNG_FILTER_SUB | PNG_FILTER_UP;
+	else if (name == "all")
+		filters = PNG_ALL_FILTERS;
+	else
+		return false;
+
+	return true;
+}
+
+bool ImageWriter::ParsePNGStrategyName(const std::string& name, int& strategy)
+{
+	if (name == "default")
+		strategy = Z_DEFAULT_STRATEGY;
+	else if (name == "filtered")
+		strategy = Z_FILTERED;
+	else if (name == "huffman")
+		strategy = Z_HUFFMAN_ONLY;
+	else if (name == "rle")
+		strategy = Z_RLE;
+	else if (name == "fixed")
+		strategy = Z_FIXED;
+	else
+		return false;
+
+	return true;
+}
@@ -0,0 +1,152 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <algorithm>
+#include "ImageWriterPipeline.h"
+
+// Frames allowed in the pipeline per encoder thread, counting those waiting to be written
+static const unsigned kPendingJobsPerEncoderThread = 2;
+
+ImageWriterPipeline::ImageWriterPipeline(unsigned encoderThreadCount, const PNGEncodeOptions& options)
+	: m_options(options), m_nextSequence(0), m_nextWriteSequence(0), m_pendingJobs(0), m_stopping(false), m_failed(false)
+{
+	if (encoderThreadCount == 0)
+		encoderThreadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	m_maxPendingJobs = encoderThreadCount * kPendingJobsPerEncoderThread;
+
+	for (unsigned i = 0; i < encoderThreadCount; i++)
+		m_encoderThreads.emplace_back(&ImageWriterPipeline::encoderThread, this);
+
+	m_writerThread = std::thread(&ImageWriterPipeline::writerThread, this);
+}
+
+ImageWriterPipeline::~ImageWriterPipeline()
+{
+	Flush();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_encodeCondition.notify_all();
+	m_writeCondition.notify_all();
+
+	for (std::thread& encoderThread : m_encoderThreads)
+		encoderThread.join();
+
+	m_writerThread.join();
+}
+
+bool ImageWriterPipeline::Submit(IDeckLinkVideoFrame* bgra32VideoFrame, const std::string& pngFilename)
+{
+	std::unique_ptr<Job>			job(new Job());
+	std::unique_lock<std::mutex>	lock(m_mutex);
+
+	m_spaceCondition.wait(lock, [&]{ return (m_pendingJobs < m_maxPendingJobs) || m_failed; });
+	if (m_failed)
+		return false;
+
+	bgra32VideoFrame->AddRef();
+
+	job->sequence = m_nextSequence++;
+	job->frame = bgra32VideoFrame;
+	job->filename = pngFilename;
+	job->result = E_FAIL;
+
+	m_encodeQueue.push_back(std::move(job));
+	m_pendingJobs++;
+	m_encodeCondition.notify_one();
+
+	return true;
+}
+
+void ImageWriterPipeline::Flush(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_spaceCondition.wait(lock, [&]{ return m_pendingJobs == 0; });
+}
+
+void ImageWriterPipeline::encoderThread(void)
+{
+	// Kept for the life of the thread so that each frame reuses the previous allocation
+	std::vector<uint8_t*>			rowPointers;
+	std::unique_lock<std::mutex>	lock(m_mutex);
+
+	while (true)
+	{
+		m_encodeCondition.wait(lock, [&]{ return !m_encodeQueue.empty() || m_stopping; });
+		if (m_encodeQueue.empty())
+			break;
+
+		std::unique_ptr<Job> job = std::move(m_encodeQueue.front());
+		m_encodeQueue.pop_front();
+
+		lock.unlock();
+
+		job->result = ImageWriter::EncodeBgra32VideoFrameToPNG(job->frame, m_options, rowPointers, job->pngData);
+		job->frame->Release();
+		job->frame = NULL;
+
+		lock.lock();
+
+		m_encodedJobs[job->sequence] = std::move(job);
+		m_writeCondition.notify_one();
+	}
+}
+
+void ImageWriterPipeline::writerThread(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_writeCondition.wait(lock, [&]{ return (m_encodedJobs.count(m_nextWriteSequence) != 0) || (m_stopping && m_pendingJobs == 0); });
+		if (m_encodedJobs.count(m_nextWriteSequence) == 0)
+			break;
+
+		std::unique_ptr<Job> job = std::move(m_encodedJobs[m_nextWriteSequence]);
+		m_encodedJobs.erase(m_nextWriteSequence);
+
+		lock.unlock();
+
+		if (job->result == S_OK)
+			job->result = ImageWriter::WriteDataToFile(job->pngData, job->filename);
+
+		if (job->result != S_OK)
+			fprintf(stderr, "Image encoding to file %s was unsuccessful\n", job->filename.c_str());
+
+		lock.lock();
+
+		if (job->result != S_OK)
+			m_failed = true;
+
+		m_nextWriteSequence++;
+		m_pendingJobs--;
+		m_spaceCondition.notify_all();
+	}
+}
@@ -0,0 +1,90 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "ImageWriter.h"
+
+// Encodes BGRA frames to PNG on a pool of encoder threads and writes the files on a
+// single writer thread in the order the frames were submitted, so that files appear
+// on disk in filename order.
+class ImageWriterPipeline
+{
+public:
+	// An encoder thread count of 0 uses one thread per CPU
+	ImageWriterPipeline(unsigned encoderThreadCount, const PNGEncodeOptions& options);
+	~ImageWriterPipeline();
+
+	// Queues a frame for encoding, holding a reference to it until it is encoded. Blocks
+	// while the pipeline is full. Returns false once any encode or write has failed.
+	bool		Submit(IDeckLinkVideoFrame* bgra32VideoFrame, const std::string& pngFilename);
+
+	// Blocks until every submitted frame has been written
+	void		Flush(void);
+
+	unsigned	GetEncoderThreadCount(void) const { return (unsigned)m_encoderThreads.size(); };
+
+private:
+	struct Job
+	{
+		uint64_t				sequence;
+		IDeckLinkVideoFrame*	frame;
+		std::string				filename;
+		std::vector<uint8_t>	pngData;
+		HRESULT					result;
+	};
+
+	void		encoderThread(void);
+	void		writerThread(void);
+
+	PNGEncodeOptions							m_options;
+	unsigned									m_maxPendingJobs;
+
+	std::mutex									m_mutex;
+	std::condition_variable						m_encodeCondition;
+	std::condition_variable						m_writeCondition;
+	std::condition_variable						m_spaceCondition;
+	std::deque<std::unique_ptr<Job>>			m_encodeQueue;
+	std::map<uint64_t, std::unique_ptr<Job>>	m_encodedJobs;
+	uint64_t									m_nextSequence;
+	uint64_t									m_nextWriteSequence;
+	unsigned									m_pendingJobs;
+	bool										m_stopping;
+	bool										m_failed;
+
+	std::vector<std::thread>					m_encoderThreads;
+	std::thread									m_writerThread;
+};
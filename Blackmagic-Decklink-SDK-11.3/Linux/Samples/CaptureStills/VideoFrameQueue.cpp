@@ -0,0 +1,201 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <errno.h>
+#include <time.h>
+#include <thread>
+#include "VideoFrameQueue.h"
+
+static const std::chrono::microseconds kBlockPollInterval{200};
+
+static unsigned roundUpToPowerOfTwo(unsigned value)
+{
+	unsigned result = 1;
+
+	while (result < value)
+		result <<= 1;
+
+	return result;
+}
+
+VideoFrameQueue::VideoFrameQueue(unsigned capacity, VideoFrameQueueOverflowPolicy overflowPolicy, std::chrono::milliseconds blockTimeout) :
+	m_capacity(roundUpToPowerOfTwo(capacity > 0 ? capacity : 1)),
+	m_mask(m_capacity - 1),
+	m_overflowPolicy(overflowPolicy),
+	m_blockTimeout(blockTimeout),
+	m_slots(new std::atomic<IDeckLinkVideoFrame*>[m_capacity]),
+	m_head(0),
+	m_tail(0),
+	m_cancelled(false),
+	m_framesQueued(0),
+	m_framesDropped(0),
+	m_pushesBlocked(0)
+{
+	for (uint64_t i = 0; i < m_capacity; i++)
+		m_slots[i].store(NULL, std::memory_order_relaxed);
+
+	sem_init(&m_frameSemaphore, 0, 0);
+}
+
+VideoFrameQueue::~VideoFrameQueue()
+{
+	Clear();
+	sem_destroy(&m_frameSemaphore);
+}
+
+bool VideoFrameQueue::Push(IDeckLinkVideoFrame* frame)
+{
+	uint64_t								tail = m_tail.load(std::memory_order_relaxed);
+	bool									blocked = false;
+	std::chrono::steady_clock::time_point	deadline;
+
+	while (true)
+	{
+		uint64_t head = m_head.load(std::memory_order_acquire);
+
+		if (tail - head < m_capacity)
+			break;
+
+		if (m_overflowPolicy == kVideoFrameQueueDropNewest)
+		{
+			m_framesDropped++;
+			return false;
+		}
+		else if (m_overflowPolicy == kVideoFrameQueueDropOldest)
+		{
+			IDeckLinkVideoFrame* oldestFrame;
+
+			// Competes with the consumer for the oldest slot; whoever advances the head owns it
+			if (tryPopAt(head, &oldestFrame))
+			{
+				oldestFrame->Release();
+				m_framesDropped++;
+			}
+		}
+		else
+		{
+			if (!blocked)
+			{
+				blocked = true;
+				deadline = std::chrono::steady_clock::now() + m_blockTimeout;
+				m_pushesBlocked++;
+			}
+			else if (m_cancelled || (std::chrono::steady_clock::now() >= deadline))
+			{
+				m_framesDropped++;
+				return false;
+			}
+
+			std::this_thread::sleep_for(kBlockPollInterval);
+		}
+	}
+
+	frame->AddRef();
+	m_slots[tail & m_mask].store(frame, std::memory_order_relaxed);
+	m_tail.store(tail + 1, std::memory_order_release);
+	m_framesQueued++;
+
+	sem_post(&m_frameSemaphore);
+	return true;
+}
+
+bool VideoFrameQueue::tryPopAt(uint64_t head, IDeckLinkVideoFrame** frame)
+{
+	// The slot is read before claiming it. If the head has moved on in the meantime the
+	// slot may since have been reused, but then the exchange fails and the value is discarded.
+	IDeckLinkVideoFrame* slotFrame = m_slots[head & m_mask].load(std::memory_order_acquire);
+
+	if (!m_head.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel))
+		return false;
+
+	*frame = slotFrame;
+	return true;
+}
+
+bool VideoFrameQueue::Pop(IDeckLinkVideoFrame** frame)
+{
+	while (true)
+	{
+		uint64_t head = m_head.load(std::memory_order_acquire);
+
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		if (tryPopAt(head, frame))
+			return true;
+	}
+}
+
+bool VideoFrameQueue::Wait(IDeckLinkVideoFrame** frame, std::chrono::milliseconds timeout, bool& cancelled)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout.count() / 1000;
+	deadline.tv_nsec += (timeout.count() % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	// The semaphore is only a wake-up hint; its count can run ahead of the queue
+	// when frames are dropped, so the queue itself is always checked first
+	while (true)
+	{
+		cancelled = m_cancelled;
+		if (cancelled)
+			return true;
+
+		if (Pop(frame))
+			return true;
+
+		if ((sem_timedwait(&m_frameSemaphore, &deadline) != 0) && (errno == ETIMEDOUT))
+			return false;
+	}
+}
+
+void VideoFrameQueue::Clear(void)
+{
+	IDeckLinkVideoFrame* frame;
+
+	while (Pop(&frame))
+		frame->Release();
+}
+
+void VideoFrameQueue::Cancel(void)
+{
+	m_cancelled = true;
+	sem_post(&m_frameSemaphore);
+}
+
+void VideoFrameQueue::GetStatistics(VideoFrameQueueStatistics* statistics) const
+{
+	statistics->framesQueued = m_framesQueued;
+	statistics->framesDropped = m_framesDropped;
+	statistics->pushesBlocked = m_pushesBlocked;
+}
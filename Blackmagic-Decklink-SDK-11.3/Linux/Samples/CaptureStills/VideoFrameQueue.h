@@ -0,0 +1,95 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <semaphore.h>
+#include "DeckLinkAPI.h"
+
+enum VideoFrameQueueOverflowPolicy
+{
+	kVideoFrameQueueDropOldest,
+	kVideoFrameQueueDropNewest,
+	kVideoFrameQueueBlockWithTimeout
+};
+
+struct VideoFrameQueueStatistics
+{
+	uint64_t	framesQueued;
+	uint64_t	framesDropped;
+	uint64_t	pushesBlocked;		// Pushes that had to wait for space (block policy only)
+};
+
+// Fixed-capacity single-producer, single-consumer queue of video frames. The queue
+// holds a reference on every frame it contains. Push() takes no locks and never
+// allocates, so it is safe to call from the DeckLink callback thread. When the queue
+// is full, the overflow policy decides whether the oldest queued frame is released,
+// the new frame is refused, or the producer waits up to the block timeout for space
+// before refusing it.
+class VideoFrameQueue
+{
+public:
+	VideoFrameQueue(unsigned capacity, VideoFrameQueueOverflowPolicy overflowPolicy, std::chrono::milliseconds blockTimeout);
+	~VideoFrameQueue();
+
+	// Producer side
+	bool		Push(IDeckLinkVideoFrame* frame);
+
+	// Consumer side. Wait() returns false on timeout; when cancelled it returns true
+	// with no frame. The caller owns the reference on any frame returned.
+	bool		Pop(IDeckLinkVideoFrame** frame);
+	bool		Wait(IDeckLinkVideoFrame** frame, std::chrono::milliseconds timeout, bool& cancelled);
+	void		Clear(void);
+
+	void		Cancel(void);
+
+	void		GetStatistics(VideoFrameQueueStatistics* statistics) const;
+	VideoFrameQueueOverflowPolicy	GetOverflowPolicy(void) const { return m_overflowPolicy; }
+
+private:
+	bool		tryPopAt(uint64_t head, IDeckLinkVideoFrame** frame);
+
+	const uint64_t									m_capacity;
+	const uint64_t									m_mask;
+	const VideoFrameQueueOverflowPolicy				m_overflowPolicy;
+	const std::chrono::milliseconds					m_blockTimeout;
+	std::unique_ptr<std::atomic<IDeckLinkVideoFrame*>[]>	m_slots;
+
+	// Monotonic counters; the producer may also advance the head to drop the oldest frame
+	std::atomic<uint64_t>							m_head;
+	std::atomic<uint64_t>							m_tail;
+
+	sem_t											m_frameSemaphore;
+	std::atomic<bool>								m_cancelled;
+
+	std::atomic<uint64_t>							m_framesQueued;
+	std::atomic<uint64_t>							m_framesDropped;
+	std::atomic<uint64_t>							m_pushesBlocked;
+};
@@ -26,6 +26,7 @@
 */
 
 #include "platform.h"
+#include "ParallelVideoConversion.h"
 
 HRESULT GetDeckLinkIterator(IDeckLinkIterator **deckLinkIterator)
 {
@@ -46,7 +47,7 @@ HRESULT GetDeckLinkVideoConversion(IDeckLinkVideoConversion **deckLinkVideoConve
 {
 	HRESULT result = S_OK;
 
-	*deckLinkVideoConversion = CreateVideoConversionInstance();
+	*deckLinkVideoConversion = CreateParallelVideoConversionInstance();
 	if (*deckLinkVideoConversion == NULL)
 	{
 		fprintf(stderr, "A DeckLink video conversion interface could not be created.\n");
@@ -0,0 +1,278 @@
+/* -LICENSE-START-
+ ** Copyright (c) 2016 Blackmagic Design
+ **
+ ** Permission is hereby granted, free of charge, to any person or organization
+ ** obtaining a copy of the software and accompanying documentation covered by
+ ** this license (the "Software") to use, reproduce, display, distribute,
+ ** execute, and transmit the Software, and to prepare derivative works of the
+ ** Software, and to permit third-parties to whom the Software is furnished to
+ ** do so, all subject to the following:
+ **
+ ** The copyright notices in the Software and this entire statement, including
+ ** the above license grant, this restriction and the following disclaimer,
+ ** must be included in all copies of the Software, in whole or in part, and
+ ** all derivative works of the Software, unless such copies or derivative
+ ** works are solely in the form of machine-executable object code generated by
+ ** a source language processor.
+ **
+ ** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ ** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ ** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ ** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ ** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ ** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ ** DEALINGS IN THE SOFTWARE.
+ ** -LICENSE-END-
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include "CEA708_CaptionStream.h"
+#include "CEA708_Decoder.h"
+
+// Encodes a timed caption script into a caption stream for ClosedCaptions -s. No DeckLink
+// device is needed; every frame's CDP is encoded here, ahead of playout, and the stream is
+// then decoded again to check that every caption comes back whole.
+
+struct FrameRateName
+{
+	const char*		name;
+	int64_t			frameDuration;
+	int64_t			timeScale;
+};
+
+static const FrameRateName kFrameRateNames[] =
+{
+	{ "23.98",	1001,	24000 },
+	{ "24",		1000,	24000 },
+	{ "25",		1000,	25000 },
+	{ "29.97",	1001,	30000 },
+	{ "30",		1000,	30000 },
+	{ "50",		1000,	50000 },
+	{ "59.94",	1001,	60000 },
+	{ "60",		1000,	60000 },
+};
+
+// The UTF-8 text a decoder reports for a cue's G0 and G1 characters
+static std::string GetCueText(const CEA708::CaptionCue& cue)
+{
+	std::string text;
+
+	for (unsigned row = 0; row < cue.lineCount; row++)
+	{
+		for (const char* p = cue.lines[row]; *p != '\0'; p++)
+		{
+			uint8_t ch = *p;
+
+			if (ch == 0x7F)
+				text += "\xE2\x99\xAA";		// G0 music note
+			else if (ch >= 0x80)
+				text += { (char)(0xC0 | (ch >> 6)), (char)(0x80 | (ch & 0x3F)) };
+			else
+				text += (char)ch;
+		}
+	}
+
+	return text;
+}
+
+/* Decodes the caption stream and follows the windows the cues are sent to, checking that
+ * each cue's text is in its window when the window is displayed, that the cues are
+ * displayed in order and never early, and that exactly lateCues of them are late. */
+static bool VerifyCaptionStream(const char* path, const std::vector<CEA708::CaptionCue>& cues, uint32_t lateCues)
+{
+	CEA708::CaptionStream	stream;
+	CEA708::Decoder			decoder;
+	std::string				windowText[8];
+	int						windowCue[8];
+	uint8_t					currentWindow = 0;
+	size_t					nextDefined = 0;
+	size_t					nextDisplayed = 0;
+	uint32_t				late = 0;
+	size_t					expectedCues = 0;
+	bool					valid = true;
+
+	if (stream.open(path) != S_OK)
+		return false;
+
+	for (int& cue : windowCue)
+		cue = -1;
+
+	for (uint32_t frame = 0; frame < stream.frameCount() && valid; frame++)
+	{
+		const CEA708::EncodedCaptionDistributionPacket* packet = stream.packet(frame);
+
+		if (decoder.decodeCDP(packet->data, packet->size) != S_OK)
+		{
+			fprintf(stderr, "Frame %u of %s does not hold a valid CDP\n", frame, path);
+			valid = false;
+			break;
+		}
+
+		for (uint32_t i = 0; i < decoder.eventCount(); i++)
+		{
+			const CEA708::CaptionEvent& event = decoder.events()[i];
+
+			switch (event.type)
+			{
+				case CEA708::captionEvent_DefineWindow:
+					windowCue[event.window] = (int)nextDefined++;
+					windowText[event.window].clear();
+					currentWindow = event.window;
+					break;
+
+				case CEA708::captionEvent_SetCurrentWindow:
+					currentWindow = event.window;
+					break;
+
+				case CEA708::captionEvent_Text:
+					windowText[currentWindow].append((const char*)event.data, event.length);
+					break;
+
+				case CEA708::captionEvent_DisplayWindows:
+					for (unsigned window = 0; window < 8; window++)
+					{
+						if ((event.data[0] & (1 << window)) == 0)
+							continue;
+
+						int cue = windowCue[window];
+						if ((cue != (int)nextDisplayed) || (windowText[window] != GetCueText(cues[cue])))
+						{
+							fprintf(stderr, "Frame %u of %s displays the wrong text for caption %zu\n", frame, path, nextDisplayed + 1);
+							valid = false;
+						}
+						else if (frame < cues[cue].startFrame)
+						{
+							fprintf(stderr, "Frame %u of %s displays caption %d early\n", frame, path, cue + 1);
+							valid = false;
+						}
+						else if (frame > cues[cue].startFrame)
+						{
+							late++;
+						}
+						nextDisplayed++;
+					}
+					break;
+
+				case CEA708::captionEvent_Discontinuity:
+					fprintf(stderr, "Frame %u of %s breaks the caption channel packet sequence\n", frame, path);
+					valid = false;
+					break;
+			}
+		}
+	}
+
+	const CEA708::DecoderStatistics& statistics = decoder.statistics();
+	if (valid && (statistics.channelPacketErrors > 0 || statistics.eventsDropped > 0))
+	{
+		fprintf(stderr, "%s holds %llu malformed caption channel packets\n", path,
+				(unsigned long long)(statistics.channelPacketErrors + statistics.eventsDropped));
+		valid = false;
+	}
+
+	for (const CEA708::CaptionCue& cue : cues)
+	{
+		if (cue.startFrame < stream.frameCount())
+			expectedCues++;
+	}
+
+	if (valid && (nextDisplayed != expectedCues || late != lateCues))
+	{
+		fprintf(stderr, "%s displays %zu of %zu captions, %u late rather than %u\n", path, nextDisplayed, expectedCues, late, lateCues);
+		valid = false;
+	}
+
+	return valid;
+}
+
+static void DisplayUsage(void)
+{
+	fprintf(stderr,
+		"\n"
+		"Usage: ./BuildCaptionStream [OPTIONS] <captionscript> <captionstream>\n"
+		"\n"
+		"    -r <frame rate>\n        23.98, 24, 25, 29.97, 30, 50, 59.94 or 60 (default is 25, as played by ClosedCaptions)\n"
+		"    -n <frames>\n        Length of the stream (default is up to the end of the last caption)\n"
+		"\n"
+		"Encode the captions of a SubRip style script into a caption stream. eg:\n"
+		"\n"
+		"    ./BuildCaptionStream -r 25 programme.srt programme.dlcs\n"
+		);
+}
+
+int main(int argc, char* argv[])
+{
+	int64_t								frameDuration	= 1000;
+	int64_t								timeScale		= 25000;
+	uint32_t							frameCount		= 0;
+	bool								displayHelp		= false;
+	std::vector<const char*>			positionalArgs;
+	std::vector<CEA708::CaptionCue>		cues;
+	CEA708::CaptionStreamStatistics		statistics;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc))
+		{
+			const char* name = argv[++i];
+
+			displayHelp = true;
+			for (const FrameRateName& rateName : kFrameRateNames)
+			{
+				if (strcmp(name, rateName.name) == 0)
+				{
+					frameDuration = rateName.frameDuration;
+					timeScale = rateName.timeScale;
+					displayHelp = false;
+				}
+			}
+		}
+		else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc))
+		{
+			int frames = atoi(argv[++i]);
+			if (frames <= 0)
+				displayHelp = true;
+			frameCount = (uint32_t)frames;
+		}
+		else if ((strcmp(argv[i], "?") == 0) || (strcmp(argv[i], "-h") == 0))
+			displayHelp = true;
+		else
+			positionalArgs.push_back(argv[i]);
+	}
+
+	if (positionalArgs.size() != 2)
+		displayHelp = true;
+
+	if (displayHelp)
+	{
+		DisplayUsage();
+		return 1;
+	}
+
+	if (CEA708::LoadCaptionScript(positionalArgs[0], frameDuration, timeScale, cues) != S_OK)
+		return 1;
+
+	if (cues.empty() && frameCount == 0)
+	{
+		fprintf(stderr, "No captions found in %s\n", positionalArgs[0]);
+		return 1;
+	}
+
+	if (CEA708::EncodeCaptionStream(cues, frameDuration, timeScale, frameCount, positionalArgs[1], &statistics) != S_OK)
+		return 1;
+
+	if (!VerifyCaptionStream(positionalArgs[1], cues, statistics.lateCues))
+	{
+		fprintf(stderr, "Decoding %s did not give back its captions\n", positionalArgs[1]);
+		return 1;
+	}
+
+	fprintf(stderr, "Encoded %u captions into %u frames in %s\n", statistics.cues, statistics.frames, positionalArgs[1]);
+	if (statistics.lateCues > 0)
+		fprintf(stderr, "%u captions are displayed late, as their text could not be sent ahead in time\n", statistics.lateCues);
+
+	return 0;
+}
@@ -0,0 +1,468 @@
+/* -LICENSE-START-
+ ** Copyright (c) 2016 Blackmagic Design
+ **
+ ** Permission is hereby granted, free of charge, to any person or organization
+ ** obtaining a copy of the software and accompanying documentation covered by
+ ** this license (the "Software") to use, reproduce, display, distribute,
+ ** execute, and transmit the Software, and to prepare derivative works of the
+ ** Software, and to permit third-parties to whom the Software is furnished to
+ ** do so, all subject to the following:
+ **
+ ** The copyright notices in the Software and this entire statement, including
+ ** the above license grant, this restriction and the following disclaimer,
+ ** must be included in all copies of the Software, in whole or in part, and
+ ** all derivative works of the Software, unless such copies or derivative
+ ** works are solely in the form of machine-executable object code generated by
+ ** a source language processor.
+ **
+ ** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ ** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ ** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ ** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ ** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ ** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ ** DEALINGS IN THE SOFTWARE.
+ ** -LICENSE-END-
+ */
+
+#include "CEA708_CaptionStream.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace CEA708
+{
+
+// Script parsing
+
+static const char* ParseNumber(const char* text, unsigned* value)
+{
+	if (*text < '0' || *text > '9')
+		return NULL;
+
+	*value = 0;
+	while (*text >= '0' && *text <= '9')
+		*value = *value * 10 + (*text++ - '0');
+
+	return text;
+}
+
+// Parses HH:MM:SS,mmm (or '.') in milliseconds, or HH:MM:SS:FF (';' for drop frame) in frames
+static const char* ParseScriptTime(const char* text, int64_t frameDuration, int64_t timeScale, uint32_t* frame)
+{
+	unsigned	hours, minutes, seconds, fraction;
+	char		separator;
+
+	if (((text = ParseNumber(text, &hours)) == NULL) || (*text++ != ':') ||
+		((text = ParseNumber(text, &minutes)) == NULL) || (*text++ != ':') ||
+		((text = ParseNumber(text, &seconds)) == NULL))
+		return NULL;
+
+	separator = *text++;
+	if ((text = ParseNumber(text, &fraction)) == NULL)
+		return NULL;
+
+	if (separator == ',' || separator == '.')
+	{
+		int64_t milliseconds = ((hours * 60 + minutes) * 60 + seconds) * 1000LL + fraction;
+		*frame = (uint32_t)((milliseconds * timeScale + 500 * frameDuration) / (1000 * frameDuration));
+	}
+	else if (separator == ':' || separator == ';')
+	{
+		int64_t		framesPerSecond = (timeScale + frameDuration / 2) / frameDuration;
+		unsigned	totalMinutes = hours * 60 + minutes;
+		int64_t		frames = (totalMinutes * 60LL + seconds) * framesPerSecond + fraction;
+
+		// Drop frame timecode skips 2 frame numbers (4 at 59.94) each minute, except every tenth
+		if (separator == ';')
+			frames -= (framesPerSecond / 15) * (totalMinutes - totalMinutes / 10);
+
+		*frame = (uint32_t)frames;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	return text;
+}
+
+// Appends a line of UTF-8 text as CEA-708 G0 / G1 characters
+static void ConvertScriptText(const char* text, char* line)
+{
+	unsigned column = 0;
+
+	while (*text != '\0' && column < CaptionCue::kMaxColumns)
+	{
+		uint8_t ch = *text;
+
+		if (ch == '<' || ch == '{')
+		{
+			// Skip SubRip markup such as <i> and {\an8}
+			const char* end = strchr(text, (ch == '<') ? '>' : '}');
+			if (end != NULL)
+			{
+				text = end + 1;
+				continue;
+			}
+		}
+
+		if (ch < 0x80)
+		{
+			line[column++] = (ch == '\t') ? ' ' : (ch < 0x20) ? '?' : ch;
+			text++;
+		}
+		else if ((ch & 0xE0) == 0xC0 && ((uint8_t)text[1] & 0xC0) == 0x80)
+		{
+			uint32_t codePoint = ((ch & 0x1F) << 6) | (text[1] & 0x3F);
+			line[column++] = (codePoint >= 0xA0 && codePoint <= 0xFF) ? (char)codePoint : '?';
+			text += 2;
+		}
+		else
+		{
+			// Longer sequences, and stray continuation bytes
+			line[column++] = '?';
+			text++;
+			while (((uint8_t)*text & 0xC0) == 0x80)
+				text++;
+		}
+	}
+
+	line[column] = '\0';
+}
+
+static bool CueStartsBefore(const CaptionCue& a, const CaptionCue& b)
+{
+	return a.startFrame < b.startFrame;
+}
+
+HRESULT LoadCaptionScript(const char* path, int64_t frameDuration, int64_t timeScale, std::vector<CaptionCue>& cues)
+{
+	FILE*		file;
+	char		text[1024];
+	unsigned	lineNumber = 0;
+	bool		inCue = false;
+	CaptionCue	cue;
+	HRESULT		result = S_OK;
+
+	if (frameDuration <= 0 || timeScale <= 0)
+		return E_INVALIDARG;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not open caption script %s\n", path);
+		return E_FAIL;
+	}
+
+	cues.clear();
+
+	while (true)
+	{
+		bool endOfFile = (fgets(text, sizeof(text), file) == NULL);
+		size_t length = endOfFile ? 0 : strlen(text);
+
+		while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r'))
+			text[--length] = '\0';
+		lineNumber++;
+
+		if (length == 0)
+		{
+			// A blank line ends the cue
+			if (inCue && cue.lineCount > 0)
+			{
+				if (cue.endFrame > cue.startFrame)
+					cues.push_back(cue);
+				else
+					fprintf(stderr, "%s:%u: Caption ends before it starts, skipped\n", path, lineNumber - 1);
+			}
+			inCue = false;
+
+			if (endOfFile)
+				break;
+			continue;
+		}
+
+		if (!inCue)
+		{
+			const char* timing = text;
+			unsigned	cueNumber;
+
+			// An optional cue number before the timing line
+			if (strstr(text, "-->") == NULL)
+			{
+				const char* end = ParseNumber(text, &cueNumber);
+				if (end != NULL && *end == '\0')
+					continue;
+			}
+
+			memset(&cue, 0, sizeof(cue));
+
+			timing = ParseScriptTime(timing, frameDuration, timeScale, &cue.startFrame);
+			if (timing != NULL)
+			{
+				timing += strspn(timing, " \t");
+				timing = (strncmp(timing, "-->", 3) == 0) ? timing + 3 + strspn(timing + 3, " \t") : NULL;
+			}
+			if (timing != NULL)
+				timing = ParseScriptTime(timing, frameDuration, timeScale, &cue.endFrame);
+
+			if (timing == NULL)
+			{
+				fprintf(stderr, "%s:%u: Expected a caption timing line\n", path, lineNumber);
+				result = E_FAIL;
+				break;
+			}
+
+			inCue = true;
+		}
+		else if (cue.lineCount < CaptionCue::kMaxLines)
+		{
+			ConvertScriptText(text, cue.lines[cue.lineCount++]);
+		}
+	}
+
+	fclose(file);
+
+	std::stable_sort(cues.begin(), cues.end(), CueStartsBefore);
+	return result;
+}
+
+// Offline encoding
+
+static const int kCueWindowCount = 2;
+
+// Sends a cue's text to a hidden window, ready to be displayed
+static void EncodeCue(Encoder& encoder, const CaptionCue& cue, WindowID window)
+{
+	// 8.11 Proper Order of Data
+	encoder << DefineWindow(window, priority_Highest, anchor_BottomCenter, true, 90, 50, cue.lineCount - 1, CaptionCue::kMaxColumns - 1, true, true, false, windowStyle_NTSCPopup, penStyle_NTSCProportionalSans);
+	encoder << ClearWindows(1 << window);
+	encoder << SetWindowAttributes(justify_Center, printDirection_LeftToRight, scrollDirection_BottomToTop, false, displayEffect_Snap, effectDirection_LeftToRight, 0, colour_Black, opacity_Translucent, borderType_None, colour_Black);
+	encoder << SetPenAttributes(penSize_Standard, font_ProportionalSans, textTag_Dialog, textOffset_Normal, false, false, edgeType_None);
+
+	for (uint8_t row = 0; row < cue.lineCount; row++)
+		encoder << SetPenLocation(row, 0) << cue.lines[row];
+
+	encoder << EndOfText();
+	encoder.flush();
+}
+
+HRESULT EncodeCaptionStream(const std::vector<CaptionCue>& cues, int64_t frameDuration, int64_t timeScale, uint32_t frameCount,
+							const char* path, CaptionStreamStatistics* statistics)
+{
+	Encoder							encoder(frameDuration, timeScale);
+	EncodedCaptionDistributionPacket	packet;
+	CaptionStreamHeader				header;
+	FILE*							file;
+	uint32_t						leadFrames = (uint32_t)((timeScale + frameDuration / 2) / frameDuration);
+	size_t							nextEncode = 0;
+	size_t							nextShow = 0;
+	int								shownCue = -1;
+	HRESULT							result = S_OK;
+
+	if (frameDuration <= 0 || timeScale <= 0)
+		return E_INVALIDARG;
+
+	if (frameCount == 0)
+	{
+		for (size_t i = 0; i < cues.size(); i++)
+			frameCount = std::max(frameCount, cues[i].endFrame + 1);
+		if (frameCount == 0)
+			return E_INVALIDARG;
+	}
+
+	memset(statistics, 0, sizeof(*statistics));
+
+	file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Could not create caption stream %s\n", path);
+		return E_FAIL;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic			= 0;		// Set once every frame is written
+	header.version			= kCaptionStreamVersion;
+	header.frameDuration	= frameDuration;
+	header.timeScale		= timeScale;
+	header.frameCount		= frameCount;
+	header.packetSize		= sizeof(EncodedCaptionDistributionPacket);
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		result = E_FAIL;
+
+	for (uint32_t frame = 0; frame < frameCount && result == S_OK; frame++)
+	{
+		// Display the cues starting on this frame. The display command is only on time if
+		// the cue's text has already been sent, leaving nothing queued in the encoder.
+		while (nextShow < cues.size() && cues[nextShow].startFrame <= frame)
+		{
+			if (nextEncode == nextShow)
+			{
+				EncodeCue(encoder, cues[nextShow], (WindowID)(nextShow % kCueWindowCount));
+				nextEncode++;
+			}
+
+			if (!encoder.empty())
+				statistics->lateCues++;
+
+			encoder << HideWindows() << DisplayWindows(1 << (nextShow % kCueWindowCount));
+			encoder.flush();
+
+			shownCue = (int)nextShow++;
+			statistics->cues++;
+		}
+
+		if (shownCue >= 0 && cues[shownCue].endFrame <= frame)
+		{
+			encoder << HideWindows();
+			encoder.flush();
+			shownCue = -1;
+		}
+
+		// Send the next cue up to a second ahead, into the window the cue before last used
+		if (nextEncode == nextShow && nextEncode < cues.size() && cues[nextEncode].startFrame <= frame + leadFrames)
+		{
+			EncodeCue(encoder, cues[nextEncode], (WindowID)(nextEncode % kCueWindowCount));
+			nextEncode++;
+		}
+
+		// A pad packet describes the caption services on frames with nothing else to send
+		if (encoder.empty())
+			encoder.flush();
+
+		if (!encoder.pop(&packet))
+			packet.size = 0;
+
+		if (fwrite(&packet, sizeof(packet), 1, file) != 1)
+			result = E_FAIL;
+	}
+
+	statistics->frames = frameCount;
+	statistics->overflows = encoder.overflows();
+	statistics->encodeErrors = encoder.encodeErrors();
+
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Could not write caption stream %s\n", path);
+	}
+	else if (statistics->overflows > 0 || statistics->encodeErrors > 0)
+	{
+		// The captions in the dropped CDPs are lost, so the stream is left without its magic
+		fprintf(stderr, "%u CDPs were dropped by the encoder, captions in %s are incomplete\n",
+				statistics->overflows + statistics->encodeErrors, path);
+		result = E_FAIL;
+	}
+	else
+	{
+		header.magic = kCaptionStreamMagic;
+
+		if ((fseeko(file, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, file) != 1))
+		{
+			fprintf(stderr, "Could not write caption stream %s\n", path);
+			result = E_FAIL;
+		}
+	}
+
+	if ((fclose(file) != 0) && (result == S_OK))
+	{
+		fprintf(stderr, "Could not write caption stream %s\n", path);
+		result = E_FAIL;
+	}
+
+	return result;
+}
+
+// CaptionStream
+
+CaptionStream::CaptionStream() :
+	m_fd(-1),
+	m_mapping(NULL),
+	m_mappingSize(0),
+	m_packets(NULL)
+{
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+CaptionStream::~CaptionStream()
+{
+	close();
+}
+
+HRESULT CaptionStream::open(const char* path)
+{
+	struct stat	fileStatus;
+	uint64_t	streamSize;
+
+	close();
+
+	m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if ((m_fd < 0) || (fstat(m_fd, &fileStatus) != 0))
+	{
+		fprintf(stderr, "Could not open caption stream %s\n", path);
+		goto bail;
+	}
+
+	if ((size_t)fileStatus.st_size < sizeof(CaptionStreamHeader))
+		goto invalid;
+
+	m_mappingSize = (size_t)fileStatus.st_size;
+	m_mapping = (uint8_t*)mmap(NULL, m_mappingSize, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (m_mapping == MAP_FAILED)
+	{
+		m_mapping = NULL;
+		fprintf(stderr, "Could not map caption stream %s\n", path);
+		goto bail;
+	}
+
+	memcpy(&m_header, m_mapping, sizeof(CaptionStreamHeader));
+	if ((m_header.magic != kCaptionStreamMagic) || (m_header.version != kCaptionStreamVersion) ||
+		(m_header.packetSize != sizeof(EncodedCaptionDistributionPacket)) ||
+		(m_header.frameDuration <= 0) || (m_header.timeScale <= 0))
+		goto invalid;
+
+	streamSize = sizeof(CaptionStreamHeader) + (uint64_t)m_header.frameCount * sizeof(EncodedCaptionDistributionPacket);
+	if ((m_header.frameCount == 0) || (streamSize > m_mappingSize))
+		goto invalid;
+
+	m_packets = (const EncodedCaptionDistributionPacket*)(m_mapping + sizeof(CaptionStreamHeader));
+	for (uint32_t i = 0; i < m_header.frameCount; i++)
+	{
+		if (m_packets[i].size > kMaxCDPSize)
+			goto invalid;
+	}
+
+	// Playout reads the stream from start to end
+	madvise(m_mapping, m_mappingSize, MADV_WILLNEED);
+
+	return S_OK;
+
+invalid:
+	fprintf(stderr, "%s is not a valid caption stream\n", path);
+
+bail:
+	close();
+	return E_FAIL;
+}
+
+void CaptionStream::close()
+{
+	if (m_mapping != NULL)
+		munmap(m_mapping, m_mappingSize);
+
+	if (m_fd >= 0)
+		::close(m_fd);
+
+	m_fd = -1;
+	m_mapping = NULL;
+	m_mappingSize = 0;
+	m_packets = NULL;
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+}
@@ -0,0 +1,135 @@
+/* -LICENSE-START-
+ ** Copyright (c) 2016 Blackmagic Design
+ **
+ ** Permission is hereby granted, free of charge, to any person or organization
+ ** obtaining a copy of the software and accompanying documentation covered by
+ ** this license (the "Software") to use, reproduce, display, distribute,
+ ** execute, and transmit the Software, and to prepare derivative works of the
+ ** Software, and to permit third-parties to whom the Software is furnished to
+ ** do so, all subject to the following:
+ **
+ ** The copyright notices in the Software and this entire statement, including
+ ** the above license grant, this restriction and the following disclaimer,
+ ** must be included in all copies of the Software, in whole or in part, and
+ ** all derivative works of the Software, unless such copies or derivative
+ ** works are solely in the form of machine-executable object code generated by
+ ** a source language processor.
+ **
+ ** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ ** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ ** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ ** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ ** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ ** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ ** DEALINGS IN THE SOFTWARE.
+ ** -LICENSE-END-
+ */
+#ifndef __CEA708_CAPTION_STREAM_H__
+#define __CEA708_CAPTION_STREAM_H__
+#include <stdint.h>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "CEA708_Encoder.h"
+
+namespace CEA708
+{
+
+/* Offline caption encoding. For a programme whose captions are all known in advance, a
+ * timed caption script is encoded ahead of time into a caption stream file holding the
+ * CDP of every frame. Playout maps the file and attaches the CDP at index frameNumber,
+ * so no caption encoding happens on the real-time path. Layout:
+ *
+ *   CaptionStreamHeader
+ *   EncodedCaptionDistributionPacket[frameCount]
+ *
+ * All fields are little endian. */
+
+static const uint32_t kCaptionStreamMagic	= 0x53434c44;	// "DLCS"
+static const uint32_t kCaptionStreamVersion	= 1;
+
+struct CaptionStreamHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	int64_t		frameDuration;
+	int64_t		timeScale;
+	uint32_t	frameCount;
+	uint32_t	packetSize;			// sizeof(EncodedCaptionDistributionPacket)
+};
+
+// One caption of a script, shown pop-on from its start frame up to its end frame
+struct CaptionCue
+{
+	enum
+	{
+		kMaxLines = 4,
+		kMaxColumns = 32
+	};
+
+	uint32_t	startFrame;
+	uint32_t	endFrame;
+	uint8_t		lineCount;
+	char		lines[kMaxLines][kMaxColumns + 1];	// CEA-708 G0 and G1 characters
+};
+
+/* Reads a timed caption script. Cues are separated by blank lines, and each is an optional
+ * number, a timing line and up to kMaxLines lines of text:
+ *
+ *   1
+ *   00:00:01,000 --> 00:00:03,500		SubRip times, in milliseconds
+ *   First caption
+ *
+ *   00:00:04:12 --> 00:00:06:00		Timecodes, ';' before the frames for drop frame
+ *   Second caption
+ *
+ * Text is converted from UTF-8. Characters outside Latin-1 become '?', markup tags are
+ * removed, and lines longer than kMaxColumns are cut. Cues are returned in start order. */
+HRESULT LoadCaptionScript(const char* path, int64_t frameDuration, int64_t timeScale, std::vector<CaptionCue>& cues);
+
+struct CaptionStreamStatistics
+{
+	uint32_t	frames;
+	uint32_t	cues;
+	uint32_t	lateCues;		// Cues whose text had not all been sent by their start frame
+	uint32_t	overflows;		// CDPs dropped by the encoder
+	uint32_t	encodeErrors;	// CDPs whose caption data could not be encoded whole
+};
+
+/* Encodes the cues into a caption stream of frameCount frames, or up to the end of the
+ * last cue when frameCount is 0. Each cue is sent ahead into a hidden window, alternating
+ * between two windows, and displayed by a single command on its start frame. Fails, leaving
+ * an invalid stream, if any CDP is dropped by the encoder. */
+HRESULT EncodeCaptionStream(const std::vector<CaptionCue>& cues, int64_t frameDuration, int64_t timeScale, uint32_t frameCount,
+							const char* path, CaptionStreamStatistics* statistics);
+
+// Read-only view of a caption stream file, mapped into memory
+class CaptionStream
+{
+public:
+	CaptionStream();
+	~CaptionStream();
+
+	HRESULT open(const char* path);
+	void close();
+
+	uint32_t frameCount() const		{ return m_header.frameCount; }
+	int64_t frameDuration() const	{ return m_header.frameDuration; }
+	int64_t timeScale() const		{ return m_header.timeScale; }
+
+	// The CDP of a frame, or NULL past the end of the stream
+	const EncodedCaptionDistributionPacket* packet(uint32_t frame) const
+	{
+		return (frame < m_header.frameCount) ? &m_packets[frame] : NULL;
+	}
+
+private:
+	int										m_fd;
+	uint8_t*								m_mapping;
+	size_t									m_mappingSize;
+	CaptionStreamHeader						m_header;
+	const EncodedCaptionDistributionPacket*	m_packets;
+};
+
+}
+
+#endif
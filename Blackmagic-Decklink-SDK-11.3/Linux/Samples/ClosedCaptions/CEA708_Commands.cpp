@@ -89,6 +89,14 @@ SyntacticElement DefineWindow(WindowID windowID, Priority priority, Anchor ancho
 	return cmd;
 }
 
+SyntacticElement ClearWindows(uint8_t windowMask)
+{
+	SyntacticElement cmd(2);
+	cmd[0] = 0x88;
+	cmd[1] = windowMask;
+	return cmd;
+}
+
 SyntacticElement DeleteWindows()
 {
 	SyntacticElement cmd(2);
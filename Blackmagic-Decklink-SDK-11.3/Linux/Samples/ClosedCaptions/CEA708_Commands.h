@@ -72,6 +72,9 @@ SyntacticElement SetCurrentWindow(WindowID windowID);
 // 8.10.5.2 DEFINE WINDOW - (DF0 ... DF7)
 SyntacticElement DefineWindow(WindowID windowID, Priority priority, Anchor anchorPoint, bool relativePositioning, uint8_t anchorVertical, uint8_t anchorHorizontal, uint8_t rowCount, uint8_t columnCount, bool rowLock, bool columnLock, bool visible, WindowStyle windowStyle, PenStyle penStyle);
 
+// 8.10.5.3 CLEAR WINDOWS - (CLW)
+SyntacticElement ClearWindows(uint8_t windowMask);
+
 // 8.10.5.4 DELETE WINDOWS - (DLW)
 SyntacticElement DeleteWindows();
 
@@ -0,0 +1,756 @@
+/* -LICENSE-START-
+ ** Copyright (c) 2016 Blackmagic Design
+ **
+ ** Permission is hereby granted, free of charge, to any person or organization
+ ** obtaining a copy of the software and accompanying documentation covered by
+ ** this license (the "Software") to use, reproduce, display, distribute,
+ ** execute, and transmit the Software, and to prepare derivative works of the
+ ** Software, and to permit third-parties to whom the Software is furnished to
+ ** do so, all subject to the following:
+ **
+ ** The copyright notices in the Software and this entire statement, including
+ ** the above license grant, this restriction and the following disclaimer,
+ ** must be included in all copies of the Software, in whole or in part, and
+ ** all derivative works of the Software, unless such copies or derivative
+ ** works are solely in the form of machine-executable object code generated by
+ ** a source language processor.
+ **
+ ** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ ** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ ** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ ** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ ** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ ** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ ** DEALINGS IN THE SOFTWARE.
+ ** -LICENSE-END-
+ */
+
+#include "CEA708_Decoder.h"
+#include <cstring>
+
+namespace CEA708
+{
+
+enum
+{
+	kCDPIdentifier1 = 0x96,
+	kCDPIdentifier2 = 0x69,
+	kCDPHeaderLength = 7,
+	kCDPFooterLength = 4,
+	kCDPMinimumLength = kCDPHeaderLength + kCDPFooterLength,
+
+	// SMPTE 334-2 5 CDP section IDs
+	kTimeCodeSectionID = 0x71,
+	kCCDataSectionID = 0x72,
+	kServiceInfoSectionID = 0x73,
+	kFooterSectionID = 0x74,
+	kFutureSectionFirstID = 0x75,
+	kFutureSectionLastID = 0xEF
+};
+
+// CEA-708 4.4 cc_type
+enum
+{
+	ccType_608Field1 = 0,
+	ccType_608Field2,
+	ccType_DTVCCData,
+	ccType_DTVCCStart
+};
+
+// Coding layer code kinds, besides the event types
+enum
+{
+	codeKind_Ignore = 0xF0,		// NUL and reserved codes without parameters
+	codeKind_Text,				// A character from G0 or G1
+	codeKind_Extended,			// EXT1, followed by a C2, G2, C3 or G3 code
+	codeKind_P16				// A 16 bit character
+};
+
+struct CodeInfo
+{
+	uint8_t		length;			// Bytes, including the code
+	uint8_t		kind;			// CaptionEventType or codeKind_
+};
+
+// Lookup tables for every layer, built once
+struct DecoderTables
+{
+	CodeInfo	code[256];				// CEA-708 7.1 base code space, C0 G0 C1 G1
+	uint16_t	text[256];				// Unicode of the G0 and G1 characters
+	uint16_t	g2[128];				// Unicode of the G2 characters, 0 if unassigned
+	uint8_t		extendedLength[256];	// Bytes after EXT1 for each C2 and C3 code, less variable length C3
+	uint16_t	text608[128];			// CEA-608 standard characters
+	uint16_t	special608[16];			// CEA-608 special characters (0x11 0x30 - 0x3F)
+	uint16_t	extended608[2][32];		// CEA-608 extended characters (0x12 and 0x13, 0x20 - 0x3F)
+	int8_t		row608[16];				// PAC row, indexed by the code's low 3 bits and bit 5 of the second byte
+
+	DecoderTables();
+};
+
+static const DecoderTables gTables;
+
+DecoderTables::DecoderTables()
+{
+	std::memset(this, 0, sizeof(*this));
+
+	// 7.1.4 C0: 1, 2 or 3 bytes according to the code range
+	for (unsigned c = 0x00; c < 0x20; c++)
+		code[c] = { static_cast<uint8_t>(c < 0x10 ? 1 : c < 0x18 ? 2 : 3), codeKind_Ignore };
+	code[0x03].kind = captionEvent_EndOfText;
+	code[0x08].kind = captionEvent_Backspace;
+	code[0x0C].kind = captionEvent_FormFeed;
+	code[0x0D].kind = captionEvent_CarriageReturn;
+	code[0x0E].kind = captionEvent_HorizontalCarriageReturn;
+	code[0x10].kind = codeKind_Extended;
+	code[0x18].kind = codeKind_P16;
+
+	// 7.1.6 G0 and 7.1.7 G1
+	for (unsigned c = 0x20; c < 0x80; c++)
+	{
+		code[c] = { 1, codeKind_Text };
+		text[c] = c;
+	}
+	text[0x7F] = 0x266A;		// Music note
+	for (unsigned c = 0xA0; c < 0x100; c++)
+	{
+		code[c] = { 1, codeKind_Text };
+		text[c] = c;			// ISO 8859-1
+	}
+
+	// 7.1.5 C1 and 8.10.5 Caption Commands
+	for (unsigned c = 0x80; c < 0x88; c++)
+		code[c] = { 1, captionEvent_SetCurrentWindow };
+	code[0x88] = { 2, captionEvent_ClearWindows };
+	code[0x89] = { 2, captionEvent_DisplayWindows };
+	code[0x8A] = { 2, captionEvent_HideWindows };
+	code[0x8B] = { 2, captionEvent_ToggleWindows };
+	code[0x8C] = { 2, captionEvent_DeleteWindows };
+	code[0x8D] = { 2, captionEvent_Delay };
+	code[0x8E] = { 1, captionEvent_DelayCancel };
+	code[0x8F] = { 1, captionEvent_Reset };
+	code[0x90] = { 3, captionEvent_SetPenAttributes };
+	code[0x91] = { 4, captionEvent_SetPenColour };
+	code[0x92] = { 3, captionEvent_SetPenLocation };
+	for (unsigned c = 0x93; c < 0x97; c++)
+		code[c] = { 1, codeKind_Ignore };
+	code[0x97] = { 5, captionEvent_SetWindowAttributes };
+	for (unsigned c = 0x98; c < 0xA0; c++)
+		code[c] = { 7, captionEvent_DefineWindow };
+
+	// 7.1.8 C2 and 7.1.10 C3 parameter lengths
+	for (unsigned c = 0x00; c < 0x20; c++)
+		extendedLength[c] = (c < 0x08) ? 0 : (c < 0x10) ? 1 : (c < 0x18) ? 2 : 3;
+	for (unsigned c = 0x80; c < 0x90; c++)
+		extendedLength[c] = (c < 0x88) ? 4 : 5;
+
+	// 7.1.9 G2
+	static const struct { uint8_t code; uint16_t unicode; } kG2[] =
+	{
+		{ 0x20, 0x0020 }, { 0x21, 0x00A0 }, { 0x25, 0x2026 }, { 0x2A, 0x0160 }, { 0x2C, 0x0152 },
+		{ 0x30, 0x2588 }, { 0x31, 0x2018 }, { 0x32, 0x2019 }, { 0x33, 0x201C }, { 0x34, 0x201D },
+		{ 0x35, 0x2022 }, { 0x39, 0x2122 }, { 0x3A, 0x0161 }, { 0x3C, 0x0153 }, { 0x3D, 0x2120 },
+		{ 0x3F, 0x0178 }, { 0x76, 0x215B }, { 0x77, 0x215C }, { 0x78, 0x215D }, { 0x79, 0x215E },
+		{ 0x7A, 0x2502 }, { 0x7B, 0x2510 }, { 0x7C, 0x2514 }, { 0x7D, 0x2500 }, { 0x7E, 0x2518 },
+		{ 0x7F, 0x250C }
+	};
+	for (const auto& entry : kG2)
+		g2[entry.code] = entry.unicode;
+
+	// CEA-608 Annex A: standard characters are ASCII, less nine substitutions
+	for (unsigned c = 0x20; c < 0x80; c++)
+		text608[c] = c;
+	text608[0x2A] = 0x00E1;
+	text608[0x5C] = 0x00E9;
+	text608[0x5E] = 0x00ED;
+	text608[0x5F] = 0x00F3;
+	text608[0x60] = 0x00FA;
+	text608[0x7B] = 0x00E7;
+	text608[0x7C] = 0x00F7;
+	text608[0x7D] = 0x00D1;
+	text608[0x7E] = 0x00F1;
+	text608[0x7F] = 0x2588;
+
+	static const uint16_t kSpecial[16] =
+	{
+		0x00AE, 0x00B0, 0x00BD, 0x00BF, 0x2122, 0x00A2, 0x00A3, 0x266A,
+		0x00E0, 0x00A0, 0x00E8, 0x00E2, 0x00EA, 0x00EE, 0x00F4, 0x00FB
+	};
+	std::memcpy(special608, kSpecial, sizeof(special608));
+
+	static const uint16_t kExtended[2][32] =
+	{
+		// Spanish, miscellaneous and French
+		{
+			0x00C1, 0x00C9, 0x00D3, 0x00DA, 0x00DC, 0x00FC, 0x2018, 0x00A1,
+			0x002A, 0x0027, 0x2014, 0x00A9, 0x2120, 0x2022, 0x201C, 0x201D,
+			0x00C0, 0x00C2, 0x00C7, 0x00C8, 0x00CA, 0x00CB, 0x00EB, 0x00CE,
+			0x00CF, 0x00EF, 0x00D4, 0x00D9, 0x00F9, 0x00DB, 0x00AB, 0x00BB
+		},
+		// Portuguese, German and Danish
+		{
+			0x00C3, 0x00E3, 0x00CD, 0x00CC, 0x00EC, 0x00D2, 0x00F2, 0x00D5,
+			0x00F5, 0x007B, 0x007D, 0x005C, 0x005E, 0x005F, 0x007C, 0x007E,
+			0x00C4, 0x00E4, 0x00D6, 0x00F6, 0x00DF, 0x00A5, 0x00A4, 0x2502,
+			0x00C5, 0x00E5, 0x00D8, 0x00F8, 0x250C, 0x2510, 0x2514, 0x2518
+		}
+	};
+	std::memcpy(extended608, kExtended, sizeof(extended608));
+
+	// CEA-608 Table 53: rows of the preamble address codes; 0x10 addresses row 11 only
+	static const int8_t kRows[16] =
+	{
+		11, 1, 3, 12, 14, 5, 7, 9,		// Second byte 0x40 - 0x5F
+		11, 2, 4, 13, 15, 6, 8, 10		// Second byte 0x60 - 0x7F
+	};
+	std::memcpy(row608, kRows, sizeof(row608));
+}
+
+static bool HasOddParity(uint8_t byte)
+{
+	return __builtin_parity(byte) == 1;
+}
+
+//=====================================================================
+
+Decoder::Decoder()
+{
+	reset();
+}
+
+void Decoder::reset()
+{
+	m_packetSize = 0;
+	m_packetExpected = 0;
+	m_packetSequence = -1;
+	m_cdpSequence = -1;
+	m_frame = 0;
+	m_608Channel[0] = m_608Channel[1] = 1;
+	m_608LastControl[0] = m_608LastControl[1] = 0;
+	m_608XDS = false;
+	m_eventCount = 0;
+	std::memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+HRESULT Decoder::decodeFrame(IDeckLinkVideoFrame* frame)
+{
+	IDeckLinkVideoFrameAncillaryPackets*	ancillaryPackets = NULL;
+	IDeckLinkAncillaryPacket*				packet = NULL;
+	const void*								data = NULL;
+	uint32_t								size = 0;
+	HRESULT									result;
+
+	m_eventCount = 0;
+
+	result = frame->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&ancillaryPackets);
+	if (result != S_OK)
+		goto bail;
+
+	if (ancillaryPackets->GetFirstPacketByID(kCDPDataID, kCDPSecondaryDataID, &packet) != S_OK)
+	{
+		result = S_FALSE;
+		goto bail;
+	}
+
+	result = packet->GetBytes(bmdAncillaryPacketFormatUInt8, &data, &size);
+	if (result != S_OK)
+		goto bail;
+
+	result = decodeCDP((const uint8_t*)data, size);
+
+bail:
+	if (packet != NULL)
+		packet->Release();
+
+	if (ancillaryPackets != NULL)
+		ancillaryPackets->Release();
+
+	return result;
+}
+
+HRESULT Decoder::decodeCDP(const uint8_t* cdp, uint32_t size)
+{
+	uint8_t		checksum = 0;
+	unsigned	cdpLength;
+	unsigned	offset;
+	uint16_t	sequence;
+
+	m_eventCount = 0;
+	m_frame++;
+	m_statistics.cdps++;
+
+	// SMPTE 334-2 5.2 cdp_header
+	if ((size < kCDPMinimumLength) || (cdp[0] != kCDPIdentifier1) || (cdp[1] != kCDPIdentifier2) ||
+		(cdp[2] < kCDPMinimumLength) || (cdp[2] > size))
+	{
+		m_statistics.malformedCDPs++;
+		return E_FAIL;
+	}
+	cdpLength = cdp[2];
+
+	// The packet checksum makes the sum of all of its bytes zero
+	for (unsigned i = 0; i < cdpLength; i++)
+		checksum += cdp[i];
+	if (checksum != 0)
+	{
+		m_statistics.checksumErrors++;
+		return E_FAIL;
+	}
+
+	sequence = (cdp[5] << 8) | cdp[6];
+	if ((cdp[cdpLength - kCDPFooterLength] != kFooterSectionID) ||
+		(cdp[cdpLength - 3] != cdp[5]) || (cdp[cdpLength - 2] != cdp[6]))
+	{
+		m_statistics.malformedCDPs++;
+		return E_FAIL;
+	}
+
+	if ((m_cdpSequence >= 0) && (sequence != ((m_cdpSequence + 1) & 0xFFFF)))
+	{
+		m_statistics.cdpSequenceGaps++;
+		discontinuity();
+	}
+	m_cdpSequence = sequence;
+
+	// Walk the sections between the header and footer
+	offset = kCDPHeaderLength;
+	while (offset < cdpLength - kCDPFooterLength)
+	{
+		uint8_t		sectionID = cdp[offset];
+		unsigned	sectionLength;
+
+		if (sectionID == kTimeCodeSectionID)
+			sectionLength = 5;
+		else if (sectionID == kCCDataSectionID)
+			sectionLength = 2 + 3 * (cdp[offset + 1] & 0x1F);
+		else if (sectionID == kServiceInfoSectionID)
+			sectionLength = 2 + 7 * (cdp[offset + 1] & 0x0F);
+		else if ((sectionID >= kFutureSectionFirstID) && (sectionID <= kFutureSectionLastID))
+			sectionLength = 2 + cdp[offset + 1];
+		else
+			break;
+
+		if (offset + sectionLength > cdpLength - kCDPFooterLength)
+			break;
+
+		if (sectionID == kCCDataSectionID)
+			decodeCCData(cdp + offset + 2, cdp[offset + 1] & 0x1F);
+
+		offset += sectionLength;
+	}
+
+	if (offset != cdpLength - kCDPFooterLength)
+	{
+		m_statistics.malformedCDPs++;
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+void Decoder::decodeCCData(const uint8_t* ccData, unsigned ccCount)
+{
+	for (unsigned i = 0; i < ccCount; i++, ccData += 3)
+	{
+		bool		ccValid = (ccData[0] & 0x04) != 0;
+		unsigned	ccType = ccData[0] & 0x03;
+
+		if (ccType <= ccType_608Field2)
+		{
+			if (ccValid)
+				decode608Pair(ccType, ccData[1], ccData[2]);
+			continue;
+		}
+
+		// CEA-708 4.4: a DTVCC packet starts with a DTVCC_PACKET_START pair and continues
+		// in DTVCC_PACKET_DATA pairs. Invalid pairs are padding.
+		if (!ccValid)
+			continue;
+
+		if (ccType == ccType_DTVCCStart)
+		{
+			if (m_packetExpected != 0)
+				m_statistics.channelPacketErrors++;		// The previous packet was cut short
+
+			// 5 DTVCC Packet Layer: packet_size_code in 2 byte units, 0 for 128 bytes
+			m_packetExpected = (ccData[1] & 0x3F) ? (ccData[1] & 0x3F) * 2 : 128;
+			m_packetSize = 0;
+		}
+		else if (m_packetExpected == 0)
+		{
+			continue;		// Data before any start
+		}
+
+		m_packet[m_packetSize++] = ccData[1];
+		m_packet[m_packetSize++] = ccData[2];
+
+		if (m_packetSize >= m_packetExpected)
+		{
+			decodeChannelPacket();
+			m_packetExpected = 0;
+			m_packetSize = 0;
+		}
+	}
+}
+
+void Decoder::decodeChannelPacket()
+{
+	int			sequence = m_packet[0] >> 6;
+	unsigned	offset = 1;
+
+	m_statistics.channelPackets++;
+
+	if ((m_packetSequence >= 0) && (sequence != ((m_packetSequence + 1) & 0x3)))
+	{
+		m_statistics.channelPacketErrors++;
+		addEvent(captionEvent_Discontinuity, 0);
+	}
+	m_packetSequence = sequence;
+
+	// 6.2 Service Blocks
+	while (offset < m_packetExpected)
+	{
+		uint8_t		service = m_packet[offset] >> 5;
+		unsigned	blockSize = m_packet[offset] & 0x1F;
+
+		if ((service == 0) || (blockSize == 0 && service != 7))
+			break;		// Null block header, the rest of the packet is padding
+
+		offset++;
+		if (service == 7)
+		{
+			// 6.2.2 Extended Service Block Header
+			if (offset >= m_packetExpected)
+				break;
+			service = m_packet[offset++] & 0x3F;
+		}
+
+		if (offset + blockSize > m_packetExpected)
+		{
+			m_statistics.channelPacketErrors++;
+			break;
+		}
+
+		decodeServiceBlock(service, m_packet + offset, blockSize);
+		offset += blockSize;
+	}
+}
+
+void Decoder::decodeServiceBlock(uint8_t service, const uint8_t* data, unsigned size)
+{
+	unsigned offset = 0;
+
+	m_statistics.serviceBlocks++;
+
+	// 7 DTVCC Coding Layer: syntactic elements never straddle service blocks
+	while (offset < size)
+	{
+		uint8_t				byte = data[offset];
+		const CodeInfo&		info = gTables.code[byte];
+		unsigned			length = info.length;
+
+		if (offset + length > size)
+			break;
+
+		switch (info.kind)
+		{
+			case codeKind_Text:
+				addText(captionEvent_Text, service, gTables.text[byte]);
+				break;
+
+			case codeKind_Ignore:
+				break;
+
+			case codeKind_P16:
+				addText(captionEvent_Text, service, (data[offset + 1] << 8) | data[offset + 2]);
+				break;
+
+			case codeKind_Extended:
+			{
+				// 7.1.8 - 7.1.11: the code after EXT1 selects C2, G2, C3 or G3
+				uint8_t extended = data[offset + 1];
+
+				if (extended >= 0x20 && extended < 0x80)
+				{
+					if (gTables.g2[extended] != 0)
+						addText(captionEvent_Text, service, gTables.g2[extended]);
+				}
+				else if (extended >= 0xA0)
+				{
+					addText(captionEvent_Text, service, (extended == 0xA0) ? 0x1F16D : 0xFFFD);	// [CC] icon
+				}
+				else
+				{
+					unsigned parameters = gTables.extendedLength[extended];
+
+					// 7.1.11.2 Variable Length Codes, with a header byte giving the length
+					if (extended >= 0x90)
+						parameters = (offset + 2 < size) ? 1 + (data[offset + 2] & 0x1F) : size;
+
+					CaptionEvent* event = addEvent(captionEvent_Unsupported, service);
+					if (event != NULL)
+					{
+						event->length = 2;
+						event->data[0] = byte;
+						event->data[1] = extended;
+					}
+					length += parameters;
+				}
+				break;
+			}
+
+			default:
+			{
+				// Commands, with their parameters copied as coded
+				CaptionEvent* event = addEvent(info.kind, service);
+				if (event != NULL)
+				{
+					if ((info.kind == captionEvent_SetCurrentWindow) || (info.kind == captionEvent_DefineWindow))
+						event->window = byte & 0x07;
+					event->length = length - 1;
+					std::memcpy(event->data, data + offset + 1, length - 1);
+				}
+				break;
+			}
+		}
+
+		offset += length;
+	}
+}
+
+void Decoder::decode608Pair(unsigned field, uint8_t byte1, uint8_t byte2)
+{
+	uint8_t code1 = byte1 & 0x7F;
+	uint8_t code2 = byte2 & 0x7F;
+
+	if (!HasOddParity(byte1) || !HasOddParity(byte2))
+	{
+		m_statistics.parityErrors++;
+		if (!HasOddParity(byte1))
+			return;
+		code2 = 0x7F;		// CEA-608 requires a solid block in place of a bad character
+	}
+
+	if (code1 == 0 && code2 == 0)
+		return;				// Padding
+
+	// CEA-608 9: XDS packets on field 2 run from a start or continue code (0x01 - 0x0E)
+	// to the end code (0x0F) and its checksum. A caption or text control code suspends
+	// a packet, and its pairs in between are data, not characters of CC3 or CC4.
+	if (field == ccType_608Field2)
+	{
+		if (code1 >= 0x01 && code1 <= 0x0F)
+		{
+			m_608XDS = (code1 != 0x0F);
+			m_608LastControl[field] = 0;
+			m_statistics.xdsPairs++;
+			return;
+		}
+
+		if (m_608XDS && (code1 < 0x10 || code1 >= 0x20))
+		{
+			m_statistics.xdsPairs++;
+			return;
+		}
+
+		m_608XDS = false;
+	}
+
+	if (code1 >= 0x10 && code1 < 0x20)
+	{
+		decode608Control(field, code1, code2);
+		return;
+	}
+
+	// Characters
+	m_608LastControl[field] = 0;
+
+	uint8_t channel = (uint8_t)(field * 2 + m_608Channel[field]);
+	if (code1 >= 0x20)
+		addText(captionEvent_608Text, channel, gTables.text608[code1]);
+	if (code2 >= 0x20)
+		addText(captionEvent_608Text, channel, gTables.text608[code2]);
+}
+
+void Decoder::decode608Control(unsigned field, uint8_t code1, uint8_t code2)
+{
+	uint16_t		control = (code1 << 8) | code2;
+	uint8_t			base = code1 & ~0x08;
+	CaptionEvent*	event;
+
+	// Control codes are sent twice in a row for robustness
+	if (control == m_608LastControl[field])
+	{
+		m_608LastControl[field] = 0;
+		return;
+	}
+	m_608LastControl[field] = control;
+
+	m_608Channel[field] = (code1 & 0x08) ? 2 : 1;
+	uint8_t channel = (uint8_t)(field * 2 + m_608Channel[field]);
+
+	if (code2 >= 0x40)
+	{
+		// Preamble address code: row, then an indent or a colour
+		int8_t row = gTables.row608[(base & 0x07) | ((code2 & 0x20) >> 2)];
+
+		event = addEvent(captionEvent_608Preamble, channel);
+		if (event != NULL)
+		{
+			event->length = 4;
+			event->data[0] = row;
+			event->data[1] = (code2 & 0x10) ? ((code2 & 0x0E) >> 1) * 4 : 0;
+			event->data[2] = (code2 & 0x10) ? 0 : (code2 & 0x0E) >> 1;
+			event->data[3] = code2 & 0x01;
+		}
+	}
+	else if ((base == 0x14 || base == 0x15) && code2 >= 0x20 && code2 < 0x30)
+	{
+		// Miscellaneous control codes; 0x15 is their field 2 form
+		event = addEvent(captionEvent_608Control, channel);
+		if (event != NULL)
+		{
+			event->length = 1;
+			event->data[0] = code2;
+		}
+	}
+	else if (base == 0x17 && code2 >= 0x21 && code2 <= 0x23)
+	{
+		event = addEvent(captionEvent_608TabOffset, channel);
+		if (event != NULL)
+		{
+			event->length = 1;
+			event->data[0] = code2 - 0x20;
+		}
+	}
+	else if (base == 0x11 && code2 >= 0x20 && code2 < 0x30)
+	{
+		event = addEvent(captionEvent_608MidRow, channel);
+		if (event != NULL)
+		{
+			event->length = 2;
+			event->data[0] = (code2 - 0x20) >> 1;
+			event->data[1] = code2 & 0x01;
+		}
+	}
+	else if (base == 0x11 && code2 >= 0x30 && code2 < 0x40)
+	{
+		addText(captionEvent_608Text, channel, gTables.special608[code2 - 0x30]);
+	}
+	else if ((base == 0x12 || base == 0x13) && code2 >= 0x20 && code2 < 0x40)
+	{
+		// An extended character replaces the standard character sent before it
+		event = addEvent(captionEvent_608Control, channel);
+		if (event != NULL)
+		{
+			event->length = 1;
+			event->data[0] = 0x21;		// Backspace
+		}
+		addText(captionEvent_608Text, channel, gTables.extended608[base - 0x12][code2 - 0x20]);
+	}
+	else
+	{
+		event = addEvent(captionEvent_Unsupported, channel);
+		if (event != NULL)
+		{
+			event->length = 2;
+			event->data[0] = code1;
+			event->data[1] = code2;
+		}
+	}
+}
+
+void Decoder::discontinuity()
+{
+	if (m_packetExpected != 0)
+		m_statistics.channelPacketErrors++;
+
+	m_packetExpected = 0;
+	m_packetSize = 0;
+	m_packetSequence = -1;
+	m_608LastControl[0] = m_608LastControl[1] = 0;
+
+	addEvent(captionEvent_Discontinuity, 0);
+}
+
+CaptionEvent* Decoder::addEvent(uint8_t type, uint8_t channel)
+{
+	if (m_eventCount == kMaxEventsPerCDP)
+	{
+		m_statistics.eventsDropped++;
+		return NULL;
+	}
+
+	CaptionEvent* event = &m_events[m_eventCount++];
+	event->frame = m_frame;
+	event->type = type;
+	event->channel = channel;
+	event->window = 0;
+	event->length = 0;
+
+	m_statistics.events++;
+	return event;
+}
+
+void Decoder::addText(uint8_t type, uint8_t channel, uint32_t codePoint)
+{
+	uint8_t		utf8[4];
+	unsigned	length;
+
+	if (codePoint < 0x80)
+	{
+		utf8[0] = codePoint;
+		length = 1;
+	}
+	else if (codePoint < 0x800)
+	{
+		utf8[0] = 0xC0 | (codePoint >> 6);
+		utf8[1] = 0x80 | (codePoint & 0x3F);
+		length = 2;
+	}
+	else if (codePoint < 0x10000)
+	{
+		utf8[0] = 0xE0 | (codePoint >> 12);
+		utf8[1] = 0x80 | ((codePoint >> 6) & 0x3F);
+		utf8[2] = 0x80 | (codePoint & 0x3F);
+		length = 3;
+	}
+	else
+	{
+		utf8[0] = 0xF0 | (codePoint >> 18);
+		utf8[1] = 0x80 | ((codePoint >> 12) & 0x3F);
+		utf8[2] = 0x80 | ((codePoint >> 6) & 0x3F);
+		utf8[3] = 0x80 | (codePoint & 0x3F);
+		length = 4;
+	}
+
+	// Extend the last event while the text continues in the same channel
+	CaptionEvent* event = (m_eventCount > 0) ? &m_events[m_eventCount - 1] : NULL;
+	if ((event == NULL) || (event->type != type) || (event->channel != channel) || (event->length + length > CaptionEvent::kMaxData))
+	{
+		event = addEvent(type, channel);
+		if (event == NULL)
+			return;
+	}
+
+	std::memcpy(event->data + event->length, utf8, length);
+	event->length += length;
+}
+
+const char* GetCaptionEventName(uint8_t type)
+{
+	static const char* const kNames[] =
+	{
+		"Text", "EndOfText", "Backspace", "FormFeed", "CarriageReturn", "HorizontalCarriageReturn",
+		"SetCurrentWindow", "ClearWindows", "DisplayWindows", "HideWindows", "ToggleWindows", "DeleteWindows",
+		"Delay", "DelayCancel", "Reset", "SetPenAttributes", "SetPenColour", "SetPenLocation",
+		"SetWindowAttributes", "DefineWindow", "Unsupported",
+		"608Text", "608Control", "608Preamble", "608MidRow", "608TabOffset",
+		"Discontinuity"
+	};
+
+	if (type >= sizeof(kNames) / sizeof(kNames[0]))
+		return "Unknown";
+	return kNames[type];
+}
+
+}
@@ -0,0 +1,180 @@
+/* -LICENSE-START-
+ ** Copyright (c) 2016 Blackmagic Design
+ **
+ ** Permission is hereby granted, free of charge, to any person or organization
+ ** obtaining a copy of the software and accompanying documentation covered by
+ ** this license (the "Software") to use, reproduce, display, distribute,
+ ** execute, and transmit the Software, and to prepare derivative works of the
+ ** Software, and to permit third-parties to whom the Software is furnished to
+ ** do so, all subject to the following:
+ **
+ ** The copyright notices in the Software and this entire statement, including
+ ** the above license grant, this restriction and the following disclaimer,
+ ** must be included in all copies of the Software, in whole or in part, and
+ ** all derivative works of the Software, unless such copies or derivative
+ ** works are solely in the form of machine-executable object code generated by
+ ** a source language processor.
+ **
+ ** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ ** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ ** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ ** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ ** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ ** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ ** DEALINGS IN THE SOFTWARE.
+ ** -LICENSE-END-
+ */
+
+#ifndef __CEA708_DECODER_H__
+#define __CEA708_DECODER_H__
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+namespace CEA708
+{
+
+// ITU-R BT.1364 / SMPTE 334-1 IDs of the ancillary packet carrying CDPs
+enum
+{
+	kCDPDataID = 0x61,
+	kCDPSecondaryDataID = 0x01
+};
+
+enum CaptionEventType
+{
+	// CEA-708 7.1.4 C0 and 7.1.5 C1 codes, and text from the G0 - G3 code sets
+	captionEvent_Text = 0,					// UTF-8 text; longer runs are split over several events
+	captionEvent_EndOfText,
+	captionEvent_Backspace,
+	captionEvent_FormFeed,
+	captionEvent_CarriageReturn,
+	captionEvent_HorizontalCarriageReturn,
+	captionEvent_SetCurrentWindow,			// window
+	captionEvent_ClearWindows,				// data[0] window bitmap
+	captionEvent_DisplayWindows,			// data[0] window bitmap
+	captionEvent_HideWindows,				// data[0] window bitmap
+	captionEvent_ToggleWindows,				// data[0] window bitmap
+	captionEvent_DeleteWindows,				// data[0] window bitmap
+	captionEvent_Delay,						// data[0] tenths of a second
+	captionEvent_DelayCancel,
+	captionEvent_Reset,
+	captionEvent_SetPenAttributes,			// data: the 2 parameter bytes as coded
+	captionEvent_SetPenColour,				// data: the 3 parameter bytes as coded
+	captionEvent_SetPenLocation,			// data[0] row, data[1] column
+	captionEvent_SetWindowAttributes,		// data: the 4 parameter bytes as coded
+	captionEvent_DefineWindow,				// window; data: the 6 parameter bytes as coded
+	captionEvent_Unsupported,				// Any other code; data holds its first bytes
+
+	// CEA-608 data carried in the CDP's cc_data; channel is CC1 - CC4
+	captionEvent_608Text,					// UTF-8 text
+	captionEvent_608Control,				// data[0] second byte of a miscellaneous control code (0x20 RCL ... 0x2F EOC)
+	captionEvent_608Preamble,				// data[0] row 1-15, data[1] indent, data[2] colour 0-6 or 7 italics, data[3] underline
+	captionEvent_608MidRow,					// data[0] colour 0-6 or 7 italics, data[1] underline
+	captionEvent_608TabOffset,				// data[0] columns 1-3
+
+	// CDPs or caption channel packets were lost, and any partial packet discarded
+	captionEvent_Discontinuity
+};
+
+// One entry of the decoded event stream, 32 bytes
+struct CaptionEvent
+{
+	enum
+	{
+		kMaxData = 24
+	};
+
+	uint32_t	frame;				// Number of the CDP the event was decoded from
+	uint8_t		type;				// CaptionEventType
+	uint8_t		channel;			// DTVCC service number 1-63, or CEA-608 channel 1-4
+	uint8_t		window;				// Window ID of SetCurrentWindow and DefineWindow
+	uint8_t		length;				// Bytes used in data
+	uint8_t		data[kMaxData];
+};
+
+struct DecoderStatistics
+{
+	uint64_t	cdps;
+	uint64_t	malformedCDPs;
+	uint64_t	checksumErrors;
+	uint64_t	cdpSequenceGaps;
+	uint64_t	channelPackets;			// Complete DTVCC caption channel packets
+	uint64_t	channelPacketErrors;	// Out of sequence, interrupted or with a malformed service block
+	uint64_t	serviceBlocks;
+	uint64_t	parityErrors;			// CEA-608 bytes with bad parity
+	uint64_t	xdsPairs;				// CEA-608 field 2 extended data service pairs, skipped
+	uint64_t	events;
+	uint64_t	eventsDropped;			// More events in one CDP than kMaxEventsPerCDP
+};
+
+/* Decodes the CEA-708 and CEA-608 captions of one input, a CDP per frame.
+ *
+ * Each layer is parsed with lookup tables, in a single pass over the bytes: the CDP
+ * sections, the cc_data triplets, the DTVCC caption channel packets reassembled from
+ * them, the service blocks, and finally the coding layer, whose code table gives the
+ * length and event of every code. CEA-608 byte pairs are decoded alongside, less the
+ * extended data services (XDS) interleaved with the captions of field 2, which are
+ * counted and skipped.
+ *
+ * The decoder keeps all of its state, including the events of the last CDP, in fixed
+ * size members, so decoding allocates nothing. Decoders are independent, one per input. */
+class Decoder
+{
+public:
+	enum
+	{
+		kMaxEventsPerCDP = 256
+	};
+
+	Decoder();
+
+	void reset();
+
+	// Decodes the CDP on a captured frame. Returns S_FALSE if the frame carries none.
+	HRESULT decodeFrame(IDeckLinkVideoFrame* frame);
+
+	// Decodes one CDP. Returns E_FAIL if it is malformed or fails its checksum.
+	HRESULT decodeCDP(const uint8_t* cdp, uint32_t size);
+
+	// The events decoded from the last CDP
+	const CaptionEvent* events() const			{ return m_events; }
+	uint32_t eventCount() const					{ return m_eventCount; }
+
+	const DecoderStatistics& statistics() const	{ return m_statistics; }
+
+private:
+	void decodeCCData(const uint8_t* ccData, unsigned ccCount);
+	void decodeChannelPacket();
+	void decodeServiceBlock(uint8_t service, const uint8_t* data, unsigned size);
+	void decode608Pair(unsigned field, uint8_t byte1, uint8_t byte2);
+	void decode608Control(unsigned field, uint8_t code1, uint8_t code2);
+
+	void discontinuity();
+	CaptionEvent* addEvent(uint8_t type, uint8_t channel);
+	void addText(uint8_t type, uint8_t channel, uint32_t codePoint);
+
+	// DTVCC caption channel packet being reassembled
+	uint8_t				m_packet[128];
+	unsigned			m_packetSize;
+	unsigned			m_packetExpected;		// 0 when not in a packet
+	int					m_packetSequence;		// -1 until the first packet
+
+	int					m_cdpSequence;			// -1 until the first CDP
+	uint32_t			m_frame;
+
+	// CEA-608, per field
+	uint8_t				m_608Channel[2];		// Data channel 1 or 2 selected by the last control code
+	uint16_t			m_608LastControl[2];	// Control codes are sent twice; the repeat is ignored
+	bool				m_608XDS;				// Field 2 is in an XDS packet
+
+	CaptionEvent		m_events[kMaxEventsPerCDP];
+	uint32_t			m_eventCount;
+
+	DecoderStatistics	m_statistics;
+};
+
+const char* GetCaptionEventName(uint8_t type);
+
+}
+
+#endif
@@ -26,6 +26,7 @@
  */
 
 #include "CEA708_Encoder.h"
+#include <algorithm>
 #include <cstring>
 
 namespace CEA708
@@ -37,7 +38,7 @@ static uint8_t FrameRateToCDPCCCount(int64_t frameDuration, int64_t timeScale)
 {
 	static const unsigned kCDPPayloadRate = 600;	// 9600bps / 16 bits per cc_data
 	double cc_count = kCDPPayloadRate / (static_cast<double>(timeScale) / frameDuration);
-	return static_cast<uint8_t>(cc_count);
+	return static_cast<uint8_t>(std::min(cc_count, static_cast<double>(kMaxCCCount)));
 }
 static CDPFrameRate FrameRateToCDPFrameRate(int64_t frameDuration, int64_t timeScale)
 {
@@ -67,6 +68,53 @@ static CDPFrameRate FrameRateToCDPFrameRate(int64_t frameDuration, int64_t timeS
 
 //=====================================================================
 
+CDPRing::CDPRing()
+: m_head(0), m_count(0), m_overflows(0)
+{
+}
+
+EncodedCaptionDistributionPacket* CDPRing::beginPush()
+{
+	if (m_count == kCapacity)
+	{
+		++m_overflows;
+		return NULL;
+	}
+	
+	return &m_slots[(m_head + m_count) % kCapacity];
+}
+
+void CDPRing::endPush()
+{
+	++m_count;
+}
+
+bool CDPRing::empty() const
+{
+	return m_count == 0;
+}
+
+bool CDPRing::pop(EncodedCaptionDistributionPacket* packet)
+{
+	if (m_count == 0)
+		return false;
+	
+	const EncodedCaptionDistributionPacket& slot = m_slots[m_head];
+	std::memcpy(packet->data, slot.data, slot.size);
+	packet->size = slot.size;
+	
+	m_head = (m_head + 1) % kCapacity;
+	--m_count;
+	return true;
+}
+
+uint32_t CDPRing::overflows() const
+{
+	return m_overflows;
+}
+
+//=====================================================================
+
 ServiceBlockEncoder::ServiceBlockEncoder(CaptionChannelPacketEncoder& packetEncoder, uint8_t serviceNumber)
 : m_packetEncoder(packetEncoder), m_serviceNumber(serviceNumber)
 {
@@ -89,10 +137,13 @@ void ServiceBlockEncoder::updateHeader()
 
 void ServiceBlockEncoder::push(const uint8_t* buffer, uint8_t count)
 {
-	if (count > kMaximumData)
+	// At high frame rates a caption channel packet holds less than a full service block
+	std::size_t maxDataLength = std::min(m_packetEncoder.maxDataSize() - kHeaderSize, static_cast<std::size_t>(kMaximumData));
+	
+	if (count > maxDataLength)
 		return;	// Ignore oversize indivisible unit
 	
-	if (m_blockSize + count > kMaximumData)
+	if (m_blockSize + count > maxDataLength)
 	{
 		updateHeader();
 		m_packetEncoder.push(m_block, kHeaderSize + m_blockSize);
@@ -147,12 +198,19 @@ void CaptionChannelPacketEncoder::updateHeader()
 	m_sequence %= 4;
 }
 
-void CaptionChannelPacketEncoder::push(const uint8_t* block, uint8_t blockLength)
+std::size_t CaptionChannelPacketEncoder::maxDataSize() const
 {
 	/* As service block data and caption packets cannot be fragmented,
 	   the maximum data which can be packed depends on the cc_count of the 
-	   cdp packet into which this caption packet will be encoded. */
-	std::size_t maxDataLength = std::min(m_CDPEncoder.maxPayloadSize(), static_cast<std::size_t>(kMaximumData));
+	   cdp packet into which this caption packet will be encoded. The header
+	   and the padding to a whole number of cc_data pairs must fit as well. */
+	std::size_t maxPacketSize = std::min(m_CDPEncoder.maxPayloadSize(), static_cast<std::size_t>(kHeaderSize + kMaximumData));
+	return (maxPacketSize & ~static_cast<std::size_t>(1)) - kHeaderSize;
+}
+
+void CaptionChannelPacketEncoder::push(const uint8_t* block, uint8_t blockLength)
+{
+	std::size_t maxDataLength = maxDataSize();
 	
 	if (blockLength > maxDataLength)
 		return;	// service block cannot be larger than caption channel packet.
@@ -180,13 +238,13 @@ void CaptionChannelPacketEncoder::flush()
 
 //=====================================================================
 
-CaptionDistributionPacketEncoder::CaptionDistributionPacketEncoder(CDPQueue& cdpQueue, int64_t frameDuration, int64_t timeScale)
-: m_cdpQueue(cdpQueue), m_sequence(0), m_CCCount(FrameRateToCDPCCCount(frameDuration, timeScale)), m_frameRate(FrameRateToCDPFrameRate(frameDuration, timeScale))
+CaptionDistributionPacketEncoder::CaptionDistributionPacketEncoder(CDPRing& cdpRing, int64_t frameDuration, int64_t timeScale)
+: m_cdpRing(cdpRing), m_sequence(0), m_CCCount(FrameRateToCDPCCCount(frameDuration, timeScale)), m_frameRate(FrameRateToCDPFrameRate(frameDuration, timeScale)), m_payloadSize(0), m_encodeErrors(0)
 {
 
 }
 
-void CaptionDistributionPacketEncoder::encode_ccdata(uint8_t*& buffer)
+bool CaptionDistributionPacketEncoder::encode_ccdata(uint8_t*& buffer)
 {
 	static const uint8_t CCDATA_ID = 0x72;
 	
@@ -198,11 +256,11 @@ void CaptionDistributionPacketEncoder::encode_ccdata(uint8_t*& buffer)
 		cc_type_708_start
 	};
 	
-	unsigned payloadPackets = static_cast<unsigned>(m_payload.size() / 2);
+	unsigned payloadPackets = m_payloadSize / 2;
 	unsigned padPackets = m_CCCount - payloadPackets;
 	
 	if (payloadPackets > m_CCCount)
-		return;
+		return false;
 	
 	uint8_t* ccdata_header = buffer;
 	ccdata_header[0] = CCDATA_ID;
@@ -210,7 +268,7 @@ void CaptionDistributionPacketEncoder::encode_ccdata(uint8_t*& buffer)
 	ccdata_header[1] |= m_CCCount & 0x1F;
 	buffer += 2;
 	
-	uint8_t* cc_data_x = m_payload.data();
+	uint8_t* cc_data_x = m_payload;
 	for (unsigned i = 0; i < payloadPackets; ++i)
 	{
 		uint8_t* ccdata = buffer;
@@ -230,6 +288,8 @@ void CaptionDistributionPacketEncoder::encode_ccdata(uint8_t*& buffer)
 		ccdata[2] = 0;
 		buffer += 3;
 	}
+	
+	return true;
 }
 
 void CaptionDistributionPacketEncoder::encode_svcinfo(uint8_t*& buffer)
@@ -267,7 +327,7 @@ void CaptionDistributionPacketEncoder::encode_svcinfo(uint8_t*& buffer)
 	buffer += kServiceDataLength;
 }
 
-EncodedCaptionDistributionPacket CaptionDistributionPacketEncoder::encode()
+bool CaptionDistributionPacketEncoder::encode()
 {
 	static const uint16_t	CDP_IDENTIFIER = 0x9669;
 	static const uint8_t	CDP_FOOTER_ID = 0x74;
@@ -279,15 +339,24 @@ EncodedCaptionDistributionPacket CaptionDistributionPacketEncoder::encode()
 		kCDPFooterLength = 4
 	};
 	
-	if (m_frameRate == cdpFrameRate_Forbidden)
-		return EncodedCaptionDistributionPacket();
+	// A CDP without its caption data is never sent
+	if ((m_frameRate == cdpFrameRate_Forbidden) || (m_payloadSize > maxPayloadSize()))
+	{
+		++m_encodeErrors;
+		return false;
+	}
 	
 	uint8_t cc_data_length = 2 + 3 * m_CCCount;
 	uint8_t cdp_length = kCDPHeaderLength + cc_data_length + kServiceInfoLength + kCDPFooterLength;
 	
-	EncodedCaptionDistributionPacket encoded;
-	encoded.resize(cdp_length);
-	uint8_t* buffer = encoded.data();
+	// A full ring drops the packet; the consumer is more than kCapacity frames behind
+	EncodedCaptionDistributionPacket* encoded = m_cdpRing.beginPush();
+	if (encoded == NULL)
+		return false;
+	
+	std::memset(encoded->data, 0, cdp_length);
+	encoded->size = cdp_length;
+	uint8_t* buffer = encoded->data;
 	
 	enum cdp_flags
 	{
@@ -312,7 +381,11 @@ EncodedCaptionDistributionPacket CaptionDistributionPacketEncoder::encode()
 	cdp_header[6] = (m_sequence & 0x00FF);
 	buffer += kCDPHeaderLength;
 	
-	encode_ccdata(buffer);
+	if (!encode_ccdata(buffer))
+	{
+		++m_encodeErrors;
+		return false;
+	}
 	encode_svcinfo(buffer);
 	
 	uint8_t* cdp_footer = buffer;
@@ -321,45 +394,45 @@ EncodedCaptionDistributionPacket CaptionDistributionPacketEncoder::encode()
 	cdp_footer[2] = (m_sequence & 0x00FF);
 	cdp_footer[3] = 0 /* checksum filled below */;
 	
-	for (unsigned i = 0; i < encoded.size()-1; ++i)
-		cdp_footer[3] += encoded[i];
+	for (unsigned i = 0; i < cdp_length - 1u; ++i)
+		cdp_footer[3] += encoded->data[i];
 	cdp_footer[3] = cdp_footer[3] ? 256 - cdp_footer[3] : 0;
 	
 	buffer += kCDPFooterLength;
 	
 	++m_sequence;
 	
-	return encoded;
+	m_cdpRing.endPush();
+	return true;
 }
 
 void CaptionDistributionPacketEncoder::reset()
 {
-	m_payload.clear();
+	m_payloadSize = 0;
 }
 
 void CaptionDistributionPacketEncoder::push(const uint8_t* packet, uint8_t packetLength)
 {
-	if (m_payload.size() + packetLength > maxPayloadSize())
+	if (m_payloadSize + packetLength > maxPayloadSize())
 	{
-		EncodedCaptionDistributionPacket packet = encode();
-		m_cdpQueue.push(packet);
+		encode();
 		reset();
 	}
 	
-	m_payload.insert(m_payload.end(), packet, packet + packetLength);
+	std::memcpy(m_payload + m_payloadSize, packet, packetLength);
+	m_payloadSize += packetLength;
 }
 
 void CaptionDistributionPacketEncoder::flush()
 {
-	EncodedCaptionDistributionPacket packet = encode();
-	m_cdpQueue.push(packet);
+	encode();
 	reset();
 }
 
 //=====================================================================
 
 Encoder::Encoder(int64_t frameDuration, int64_t timeScale)
-: m_cdpQueue(), m_cdpEncoder(m_cdpQueue, frameDuration, timeScale), m_packetEncoder(m_cdpEncoder), m_serviceBlockEncoder(m_packetEncoder, serviceNumber_PrimaryCaptionService)
+: m_cdpRing(), m_cdpEncoder(m_cdpRing, frameDuration, timeScale), m_packetEncoder(m_cdpEncoder), m_serviceBlockEncoder(m_packetEncoder, serviceNumber_PrimaryCaptionService)
 {
 }
 
@@ -383,18 +456,22 @@ Encoder& Encoder::operator<<(const char* captionText)
 
 bool Encoder::empty() const
 {
-	return m_cdpQueue.empty();
+	return m_cdpRing.empty();
 }
 
 bool Encoder::pop(EncodedCaptionDistributionPacket* packet)
 {
-	if (!m_cdpQueue.empty())
-	{
-		*packet = m_cdpQueue.front();
-		m_cdpQueue.pop();
-		return true;
-	}
-	return false;
+	return m_cdpRing.pop(packet);
+}
+
+uint32_t Encoder::overflows() const
+{
+	return m_cdpRing.overflows();
+}
+
+uint32_t Encoder::encodeErrors() const
+{
+	return m_cdpEncoder.encodeErrors();
 }
 
 void Encoder::flush()
@@ -27,8 +27,7 @@
 
 #ifndef __CEA708_ENCODER_H__
 #define __CEA708_ENCODER_H__
-#include <queue>
-#include <vector>
+#include <cstddef>
 #include <stdint.h>
 #include "CEA708_Commands.h"
 
@@ -60,8 +59,49 @@ enum CDPFrameRate
 	cdpFrameRate_60				// '0b1000'
 };
 
-typedef std::vector<uint8_t> EncodedCaptionDistributionPacket;
-typedef std::queue<EncodedCaptionDistributionPacket> CDPQueue;
+// cc_count is a 5 bit field; 23.98 fps needs the most, 25 per frame
+enum
+{
+	kMaxCCCount = 31,
+	kMaxCDPSize = 7 + 2 + 3 * kMaxCCCount + 9 + 4	// header, ccdata, svcinfo, footer
+};
+
+struct EncodedCaptionDistributionPacket
+{
+	uint8_t		data[kMaxCDPSize];
+	uint8_t		size;
+};
+
+/* Fixed-capacity FIFO of encoded CDPs. Packets are encoded in place into the ring's slots
+ * and copied out once by pop(), so the per-frame caption path never allocates.
+ * Not thread safe: the encoder and its consumer run on the same thread. */
+class CDPRing
+{
+public:
+	enum
+	{
+		kCapacity = 32
+	};
+
+	CDPRing();
+
+	// The slot for the next packet, or NULL if the ring is full and the packet must be dropped
+	EncodedCaptionDistributionPacket* beginPush();
+	void endPush();
+
+	bool empty() const;
+	bool pop(EncodedCaptionDistributionPacket* packet);
+
+	// Packets dropped because the consumer fell kCapacity packets behind
+	uint32_t overflows() const;
+
+private:
+	EncodedCaptionDistributionPacket	m_slots[kCapacity];
+	uint32_t							m_head;
+	uint32_t							m_count;
+	uint32_t							m_overflows;
+};
+
 class ServiceBlockEncoder;
 class CaptionChannelPacketEncoder;
 class CaptionDistributionPacketEncoder;
@@ -124,6 +164,9 @@ public:
 	
 	explicit CaptionChannelPacketEncoder(CaptionDistributionPacketEncoder& cdpEncoder);
 	
+	// The most service block bytes a packet can carry, so that the padded packet fits one CDP
+	std::size_t maxDataSize() const;
+	
 	/* Add an encoded service block to the caption channel packet.
 	 * When full, updates header and pushes encoded caption channel packet to CaptionDistributionPacketEncoder */
 	void push(const uint8_t* block, uint8_t blockLength);
@@ -138,21 +181,25 @@ public:
 class CaptionDistributionPacketEncoder
 {
 private:
-	CDPQueue&				m_cdpQueue;
+	CDPRing&				m_cdpRing;
 	uint16_t				m_sequence;
 	uint8_t					m_CCCount;
 	CDPFrameRate			m_frameRate;
-	std::vector<uint8_t>	m_payload;
+	uint8_t					m_payload[kMaxCCCount * 2];
+	uint8_t					m_payloadSize;
+	uint32_t				m_encodeErrors;
 	
-	void encode_ccdata(uint8_t*& buffer);
+	bool encode_ccdata(uint8_t*& buffer);
 	void encode_svcinfo(uint8_t*& buffer);
 	
-	EncodedCaptionDistributionPacket encode();
+	// Encodes the payload into the next slot of the CDPRing. Returns false, and pushes
+	// nothing, if the CDP cannot be encoded whole or the ring is full.
+	bool encode();
 	
 	void reset();
 	
 public:
-	CaptionDistributionPacketEncoder(CDPQueue& cdpQueue, int64_t frameDuration, int64_t timeScale);
+	CaptionDistributionPacketEncoder(CDPRing& cdpRing, int64_t frameDuration, int64_t timeScale);
 	
 	inline std::size_t maxPayloadSize() const
 	{
@@ -160,11 +207,17 @@ public:
 	}
 	
 	/* Add an encoded caption channel packet to the caption distribution packet.
-	 * When full, encodes the cdp and pushes the completed CDP onto the CDPQueue. */
+	 * When full, encodes the cdp and pushes the completed CDP onto the CDPRing. */
 	void push(const uint8_t* packet, uint8_t packetLength);
 	
-	/* Encodes CDP and pushes the completed CDP onto the CDPQueue */
+	/* Encodes CDP and pushes the completed CDP onto the CDPRing */
 	void flush();
+	
+	// CDPs that could not be encoded whole, and were not pushed
+	uint32_t encodeErrors() const
+	{
+		return m_encodeErrors;
+	}
 };
 
 
@@ -173,7 +226,7 @@ public:
 class Encoder
 {
 private:
-	CDPQueue							m_cdpQueue;
+	CDPRing								m_cdpRing;
 	CaptionDistributionPacketEncoder	m_cdpEncoder;
 	CaptionChannelPacketEncoder			m_packetEncoder;
 	ServiceBlockEncoder					m_serviceBlockEncoder;
@@ -185,11 +238,17 @@ public:
 	Encoder& operator<<(const SyntacticElement& command);
 	Encoder& operator<<(const char* captionText);
 	
-	// True if there are no fully-encoded packets in the queue.
+	// True if there are no fully-encoded packets in the ring.
 	bool empty() const;
 	
-	// Pop an encoded CDP from the queue
+	// Pop an encoded CDP from the ring
 	bool pop(EncodedCaptionDistributionPacket* packet);
+
+	// Encoded CDPs dropped because the ring was full
+	uint32_t overflows() const;
+	
+	// CDPs dropped because their payload could not be encoded whole
+	uint32_t encodeErrors() const;
 	
 	// Flush any remaining data through the encoder stack.
 	// If there was no partial data a pad packet is generated.
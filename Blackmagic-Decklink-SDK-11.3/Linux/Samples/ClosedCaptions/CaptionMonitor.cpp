@@ -0,0 +1,328 @@
+/* -LICENSE-START-
+ ** Copyright (c) 2016 Blackmagic Design
+ **
+ ** Permission is hereby granted, free of charge, to any person or organization
+ ** obtaining a copy of the software and accompanying documentation covered by
+ ** this license (the "Software") to use, reproduce, display, distribute,
+ ** execute, and transmit the Software, and to prepare derivative works of the
+ ** Software, and to permit third-parties to whom the Software is furnished to
+ ** do so, all subject to the following:
+ **
+ ** The copyright notices in the Software and this entire statement, including
+ ** the above license grant, this restriction and the following disclaimer,
+ ** must be included in all copies of the Software, in whole or in part, and
+ ** all derivative works of the Software, unless such copies or derivative
+ ** works are solely in the form of machine-executable object code generated by
+ ** a source language processor.
+ **
+ ** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ ** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ ** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+ ** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+ ** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ ** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ ** DEALINGS IN THE SOFTWARE.
+ ** -LICENSE-END-
+ */
+
+// Decodes and prints the captions of one or more inputs, with a decoder per input
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <vector>
+
+#include "DeckLinkAPI.h"
+#include "CEA708_Decoder.h"
+
+// Inputs start in this mode and follow the detected format from then on
+const BMDDisplayMode      kDisplayMode = bmdModeHD1080i50;
+const BMDPixelFormat      kPixelFormat = bmdFormat10BitYUV;
+
+const int kMaxInputs = 16;
+
+static uint64_t GetTimeNanoseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+class CaptionMonitor : public IDeckLinkInputCallback
+{
+public:
+	CaptionMonitor(int index, IDeckLinkInput* deckLinkInput, bool quiet) :
+		m_refCount(1), m_index(index), m_deckLinkInput(deckLinkInput), m_quiet(quiet),
+		m_frames(0), m_framesWithCaptions(0), m_decodeTime(0), m_maxDecodeTime(0)
+	{
+		m_deckLinkInput->AddRef();
+	}
+	
+	virtual ~CaptionMonitor()
+	{
+		m_deckLinkInput->Release();
+	}
+	
+	// IDeckLinkInputCallback
+	virtual HRESULT STDMETHODCALLTYPE VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket)
+	{
+		uint64_t	start;
+		uint64_t	elapsed;
+		HRESULT		result;
+		
+		if (videoFrame == NULL)
+			return S_OK;
+		
+		start = GetTimeNanoseconds();
+		result = m_decoder.decodeFrame(videoFrame);
+		elapsed = GetTimeNanoseconds() - start;
+		
+		m_frames++;
+		m_decodeTime += elapsed;
+		if (elapsed > m_maxDecodeTime)
+			m_maxDecodeTime = elapsed;
+		
+		if (result == S_FALSE)
+			return S_OK;
+		m_framesWithCaptions++;
+		
+		if (!m_quiet)
+			printEvents();
+		
+		return S_OK;
+	}
+	
+	// IDeckLinkInputCallback
+	virtual HRESULT STDMETHODCALLTYPE VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode* newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags)
+	{
+		const char*	displayModeName = NULL;
+		
+		// Restart the streams in the new mode; captions carry on from the next CDP
+		m_deckLinkInput->PauseStreams();
+		m_deckLinkInput->EnableVideoInput(newDisplayMode->GetDisplayMode(), kPixelFormat, bmdVideoInputEnableFormatDetection);
+		m_deckLinkInput->FlushStreams();
+		m_deckLinkInput->StartStreams();
+		
+		newDisplayMode->GetName(&displayModeName);
+		fprintf(stderr, "Input %d: video format changed to %s\n", m_index, displayModeName ? displayModeName : "unknown");
+		if (displayModeName)
+			free((void*)displayModeName);
+		
+		return S_OK;
+	}
+	
+	int GetIndex() const
+	{
+		return m_index;
+	}
+	
+	void PrintStatistics()
+	{
+		const CEA708::DecoderStatistics&	statistics = m_decoder.statistics();
+		
+		printf("Input %d: %llu frames, %llu with captions\n", m_index, (unsigned long long)m_frames, (unsigned long long)m_framesWithCaptions);
+		printf("    CDPs %llu, malformed %llu, checksum errors %llu, sequence gaps %llu\n",
+			   (unsigned long long)statistics.cdps, (unsigned long long)statistics.malformedCDPs,
+			   (unsigned long long)statistics.checksumErrors, (unsigned long long)statistics.cdpSequenceGaps);
+		printf("    Caption channel packets %llu, errors %llu, service blocks %llu, 608 parity errors %llu, XDS pairs %llu\n",
+			   (unsigned long long)statistics.channelPackets, (unsigned long long)statistics.channelPacketErrors,
+			   (unsigned long long)statistics.serviceBlocks, (unsigned long long)statistics.parityErrors,
+			   (unsigned long long)statistics.xdsPairs);
+		printf("    Events %llu, dropped %llu\n", (unsigned long long)statistics.events, (unsigned long long)statistics.eventsDropped);
+		if (m_frames > 0)
+			printf("    Decode time %.2f us average, %.2f us maximum\n", m_decodeTime / 1000.0 / m_frames, m_maxDecodeTime / 1000.0);
+	}
+	
+	// IUnknown
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		return E_NOINTERFACE;
+	}
+	
+	virtual ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return __sync_add_and_fetch(&m_refCount, 1);
+	}
+	
+	virtual ULONG STDMETHODCALLTYPE Release()
+	{
+		int32_t newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
+		if (newRefValue == 0)
+			delete this;
+		
+		return newRefValue;
+	}
+	
+private:
+	void printEvents()
+	{
+		const CEA708::CaptionEvent*	events = m_decoder.events();
+		
+		for (uint32_t i = 0; i < m_decoder.eventCount(); i++)
+		{
+			const CEA708::CaptionEvent&	event = events[i];
+			char						line[128];
+			int							length;
+			
+			length = snprintf(line, sizeof(line), "%d %6u %-4s%-2u %-24s", m_index, event.frame,
+							  (event.type >= CEA708::captionEvent_608Text && event.type < CEA708::captionEvent_Discontinuity) ? "CC" : "SVC",
+							  event.channel, CEA708::GetCaptionEventName(event.type));
+			
+			if (event.type == CEA708::captionEvent_Text || event.type == CEA708::captionEvent_608Text)
+			{
+				snprintf(line + length, sizeof(line) - length, " \"%.*s\"", event.length, event.data);
+			}
+			else
+			{
+				if (event.type == CEA708::captionEvent_SetCurrentWindow || event.type == CEA708::captionEvent_DefineWindow)
+					length += snprintf(line + length, sizeof(line) - length, " window %u", event.window);
+				
+				for (uint8_t j = 0; j < event.length; j++)
+					length += snprintf(line + length, sizeof(line) - length, " %02x", event.data[j]);
+			}
+			
+			printf("%s\n", line);
+		}
+	}
+	
+	int32_t				m_refCount;
+	int					m_index;
+	IDeckLinkInput*		m_deckLinkInput;
+	bool				m_quiet;
+	CEA708::Decoder		m_decoder;
+	
+	// Updated on the input's callback thread and only read once the input stops
+	uint64_t			m_frames;
+	uint64_t			m_framesWithCaptions;
+	uint64_t			m_decodeTime;
+	uint64_t			m_maxDecodeTime;
+};
+
+static void Usage(const char* programName)
+{
+	fprintf(stderr,
+		"Usage: %s [-d <device index>]... [-q]\n"
+		"    -d <index>  Monitor the input of this device; may be repeated (default: every device with an input)\n"
+		"    -q          Print the statistics of each input on exit, without the caption events\n"
+		"\n"
+		"Each input starts in 1080i50 and follows the detected video format. The events print as:\n"
+		"    <input> <CDP number> <SVC service | CC channel> <event> <text or parameter bytes>\n",
+		programName);
+}
+
+int main(int argc, char* argv[])
+{
+	IDeckLinkIterator*				deckLinkIterator = NULL;
+	IDeckLink*						deckLink = NULL;
+	std::vector<int>				deviceIndexes;
+	std::vector<IDeckLinkInput*>	inputs;
+	std::vector<CaptionMonitor*>	monitors;
+	bool							quiet = false;
+	int								deviceIndex = 0;
+	int								ch;
+	HRESULT							result = S_OK;
+	
+	while ((ch = getopt(argc, argv, "d:qh")) != -1)
+	{
+		switch (ch)
+		{
+			case 'd':
+				deviceIndexes.push_back(atoi(optarg));
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'h':
+			default:
+				Usage(argv[0]);
+				return 1;
+		}
+	}
+	
+	deckLinkIterator = CreateDeckLinkIteratorInstance();
+	if (deckLinkIterator == NULL)
+	{
+		fprintf(stderr, "A DeckLink iterator could not be created.  The DeckLink drivers may not be installed.\n");
+		return 1;
+	}
+	
+	while (deckLinkIterator->Next(&deckLink) == S_OK && (int)inputs.size() < kMaxInputs)
+	{
+		IDeckLinkInput*		deckLinkInput = NULL;
+		bool				selected = deviceIndexes.empty();
+		
+		for (size_t i = 0; i < deviceIndexes.size(); i++)
+			selected |= (deviceIndexes[i] == deviceIndex);
+		
+		if (selected && deckLink->QueryInterface(IID_IDeckLinkInput, (void**)&deckLinkInput) == S_OK)
+		{
+			CaptionMonitor* monitor = new CaptionMonitor(deviceIndex, deckLinkInput, quiet);
+			
+			deckLinkInput->SetCallback(monitor);
+			
+			result = deckLinkInput->EnableVideoInput(kDisplayMode, kPixelFormat, bmdVideoInputEnableFormatDetection);
+			if (result != S_OK)
+			{
+				fprintf(stderr, "Could not enable the input of device %d - result = %08x\n", deviceIndex, result);
+				deckLinkInput->SetCallback(NULL);
+				monitor->Release();
+				deckLinkInput->Release();
+			}
+			else
+			{
+				inputs.push_back(deckLinkInput);
+				monitors.push_back(monitor);
+			}
+		}
+		else if (selected && !deviceIndexes.empty())
+		{
+			fprintf(stderr, "Device %d has no input\n", deviceIndex);
+		}
+		
+		deckLink->Release();
+		deviceIndex++;
+	}
+	
+	if (inputs.empty())
+	{
+		fprintf(stderr, "No inputs to monitor\n");
+		result = E_FAIL;
+		goto bail;
+	}
+	
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		result = inputs[i]->StartStreams();
+		if (result != S_OK)
+			fprintf(stderr, "Could not start input %d - result = %08x\n", monitors[i]->GetIndex(), result);
+	}
+	
+	fprintf(stderr, "Monitoring %d input(s)... Press <RETURN> to exit\n", (int)inputs.size());
+	getchar();
+	
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		inputs[i]->StopStreams();
+		inputs[i]->DisableVideoInput();
+		inputs[i]->SetCallback(NULL);
+	}
+	
+	for (size_t i = 0; i < monitors.size(); i++)
+		monitors[i]->PrintStatistics();
+	
+	result = S_OK;
+	
+bail:
+	for (size_t i = 0; i < monitors.size(); i++)
+		monitors[i]->Release();
+	
+	for (size_t i = 0; i < inputs.size(); i++)
+		inputs[i]->Release();
+	
+	deckLinkIterator->Release();
+	
+	return (result == S_OK) ? 0 : 1;
+}
@@ -29,6 +29,7 @@
 #include <cstdio>
 
 #include "CEA708_Encoder.h"
+#include "CEA708_CaptionStream.h"
 
 // Video mode parameters
 const BMDDisplayMode      kDisplayMode = bmdModeHD1080i50;
@@ -72,13 +73,27 @@ static void FillBlue(IDeckLinkMutableVideoFrame* theFrame)
 	}
 }
 
+// A caption packet from a CaptionAncillaryPacketPool. Its storage belongs to the pool, and a
+// packet with no references is free to be handed out again, so the final Release() returns
+// it to the pool rather than deleting it.
 class CaptionAncillaryPacket: public IDeckLinkAncillaryPacket
 {
 public:
-	CaptionAncillaryPacket(const CEA708::EncodedCaptionDistributionPacket& userData)
+	CaptionAncillaryPacket()
 	{
-		m_refCount = 1;
-		m_userData = userData;
+		m_refCount = 0;
+		m_userData.size = 0;
+	}
+	
+	// Claims the packet with the first reference if it is free
+	bool TryAcquire()
+	{
+		return __sync_bool_compare_and_swap(&m_refCount, 0, 1);
+	}
+	
+	CEA708::EncodedCaptionDistributionPacket* GetCaptionData()
+	{
+		return &m_userData;
 	}
 	
 	// IDeckLinkAncillaryPacket
@@ -91,9 +106,9 @@ public:
 			return E_NOTIMPL;
 		}
 		if (size) // Optional
-			*size = (uint32_t)m_userData.size();
+			*size = m_userData.size;
 		if (data) // Optional
-			*data = m_userData.data();
+			*data = m_userData.data;
 		return S_OK;
 	}
 	
@@ -141,12 +156,8 @@ public:
 	ULONG STDMETHODCALLTYPE Release()
 	{
 		// gcc atomic operation builtin
-		int32_t newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
-		
-		if (newRefValue == 0)
-			delete this;
-		
-		return newRefValue;
+		// At zero the packet is back in its pool
+		return __sync_sub_and_fetch(&m_refCount, 1);
 	}
 
 private:
@@ -154,15 +165,43 @@ private:
 	CEA708::EncodedCaptionDistributionPacket m_userData;
 };
 
+// Preallocated caption packets, enough for every frame in flight to carry one, so
+// attaching captions to a frame does not allocate
+class CaptionAncillaryPacketPool
+{
+public:
+	enum
+	{
+		kPoolSize = 16
+	};
+	
+	// Returns a packet holding one reference, or NULL if all are attached to frames
+	CaptionAncillaryPacket* Acquire()
+	{
+		for (int i = 0; i < kPoolSize; i++)
+		{
+			if (m_packets[i].TryAcquire())
+				return &m_packets[i];
+		}
+		return NULL;
+	}
+	
+private:
+	CaptionAncillaryPacket m_packets[kPoolSize];
+};
+
 class OutputCallback: public IDeckLinkVideoOutputCallback
 {
 private:
-	int32_t				m_refCount;
-	CEA708::Encoder		m_CC708Encoder;
-	IDeckLinkOutput*	m_deckLinkOutput;
+	int32_t						m_refCount;
+	CEA708::Encoder				m_CC708Encoder;
+	CaptionAncillaryPacketPool	m_packetPool;
+	IDeckLinkOutput*			m_deckLinkOutput;
+	const CEA708::CaptionStream*	m_captionStream;
 public:
-	OutputCallback(IDeckLinkOutput* deckLinkOutput)
-	: m_refCount(1), m_CC708Encoder(kFrameDuration, kTimeScale), m_deckLinkOutput(deckLinkOutput)
+	// With a caption stream, each frame's CDP is looked up from it instead of being encoded
+	OutputCallback(IDeckLinkOutput* deckLinkOutput, const CEA708::CaptionStream* captionStream)
+	: m_refCount(1), m_CC708Encoder(kFrameDuration, kTimeScale), m_deckLinkOutput(deckLinkOutput), m_captionStream(captionStream)
 	{
 		m_deckLinkOutput->AddRef();
 	}
@@ -176,41 +215,56 @@ public:
 		HRESULT										result = S_OK;
 		IDeckLinkVideoFrameAncillaryPackets*		frameAncillaryPackets = NULL;
 		IDeckLinkAncillaryPacket*					ancillaryPacket = NULL;
-		CEA708::EncodedCaptionDistributionPacket	packet;
+		CaptionAncillaryPacket*						captionPacket = NULL;
 		
-		// Resend the given caption data every second.
-		unsigned fps = kTimeScale / kFrameDuration;
-		if (gTotalFramesScheduled % fps == 0)
+		if (m_captionStream != NULL)
 		{
-			using namespace CEA708;
-			Encoder& cc = m_CC708Encoder;
-			
-			// 8.11 Proper Order of Data
-			cc << DeleteWindows();
-			cc << DefineWindow(window_0, priority_Highest, anchor_BottomCenter, false, 27, 44, 2, 22, true, true, true, windowStyle_NTSCPopup, penStyle_NTSCProportionalSans);
-			cc << SetWindowAttributes(justify_Left, printDirection_LeftToRight, scrollDirection_BottomToTop, false, displayEffect_Snap, effectDirection_LeftToRight, 0, colour_Black, opacity_Translucent, borderType_None, colour_Black);
-			cc << SetPenLocation(0, 0) << "\r";
-			
-			cc << SetPenAttributes(penSize_Standard, font_ProportionalSans, textTag_Dialog, textOffset_Normal, false, false, edgeType_None);
-			cc << SetPenLocation(0, 0) << "CEA-708 Closed Captions";
-			cc << SetPenLocation(1, 0) << "Second line of text!";
-			cc << EndOfText();
+			// Encoded ahead by BuildCaptionStream; the programme loops at the end of the stream
+			const CEA708::EncodedCaptionDistributionPacket* cdp = m_captionStream->packet(gTotalFramesScheduled % m_captionStream->frameCount());
 			
-			cc << DisplayWindows(1 << window_0);
-			cc.flush();
+			if (cdp->size > 0 && (captionPacket = m_packetPool.Acquire()) != NULL)
+				*captionPacket->GetCaptionData() = *cdp;
 		}
-		
-		if (m_CC708Encoder.empty())
+		else
 		{
-			// If there is no caption data to be sent on this frame, generate a pad packet which includes the
-			// headers which describe the available caption services.
-			// Calling flush with an empty buffer will achieve this, by encoding a null service block.
-			m_CC708Encoder.flush();
+			// Resend the given caption data every second.
+			unsigned fps = kTimeScale / kFrameDuration;
+			if (gTotalFramesScheduled % fps == 0)
+			{
+				using namespace CEA708;
+				Encoder& cc = m_CC708Encoder;
+				
+				// 8.11 Proper Order of Data
+				cc << DeleteWindows();
+				cc << DefineWindow(window_0, priority_Highest, anchor_BottomCenter, false, 27, 44, 2, 22, true, true, true, windowStyle_NTSCPopup, penStyle_NTSCProportionalSans);
+				cc << SetWindowAttributes(justify_Left, printDirection_LeftToRight, scrollDirection_BottomToTop, false, displayEffect_Snap, effectDirection_LeftToRight, 0, colour_Black, opacity_Translucent, borderType_None, colour_Black);
+				cc << SetPenLocation(0, 0) << "\r";
+				
+				cc << SetPenAttributes(penSize_Standard, font_ProportionalSans, textTag_Dialog, textOffset_Normal, false, false, edgeType_None);
+				cc << SetPenLocation(0, 0) << "CEA-708 Closed Captions";
+				cc << SetPenLocation(1, 0) << "Second line of text!";
+				cc << EndOfText();
+				
+				cc << DisplayWindows(1 << window_0);
+				cc.flush();
+			}
+			
+			if (m_CC708Encoder.empty())
+			{
+				// If there is no caption data to be sent on this frame, generate a pad packet which includes the
+				// headers which describe the available caption services.
+				// Calling flush with an empty buffer will achieve this, by encoding a null service block.
+				m_CC708Encoder.flush();
+			}
+		
+			// With no free packet the CDP waits in the encoder for the next frame
+			if (!m_CC708Encoder.empty() && (captionPacket = m_packetPool.Acquire()) != NULL)
+				m_CC708Encoder.pop(captionPacket->GetCaptionData());
 		}
 		
-		if (m_CC708Encoder.pop(&packet))
+		// With no free packet the frame keeps its previous captions
+		if (captionPacket != NULL)
 		{
-		
 			result = videoFrame->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&frameAncillaryPackets);
 			if (result != S_OK)
 			{
@@ -228,12 +282,15 @@ public:
 				ancillaryPacket = NULL;
 			}
 			
-			result = frameAncillaryPackets->AttachPacket(new CaptionAncillaryPacket(packet));
+			result = frameAncillaryPackets->AttachPacket(captionPacket);
 			if (result != S_OK)
 			{
 				fprintf(stderr, "Could not attach packet = %08x\n", result);
 				goto bail;
 			}
+			
+			// The frame took over our reference to the packet
+			captionPacket = NULL;
 
 		}
 
@@ -249,6 +306,9 @@ public:
 		
 	bail:
 		
+		if (captionPacket != NULL)
+			captionPacket->Release();
+		
 		if (frameAncillaryPackets != NULL)
 		{
 			frameAncillaryPackets->Release();
@@ -335,14 +395,36 @@ HRESULT GetDeckLinkIterator(IDeckLinkIterator **deckLinkIterator)
 	return result;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	IDeckLinkIterator*      deckLinkIterator = NULL;
 	IDeckLink*              deckLink         = NULL;
 	IDeckLinkOutput*        deckLinkOutput   = NULL;
 	OutputCallback*         outputCallback   = NULL;
+	CEA708::CaptionStream   captionStream;
+	bool                    useCaptionStream = false;
 	HRESULT                 result;
 	
+	// -s <captionstream> plays the captions of a stream made by BuildCaptionStream
+	if (argc == 3 && strcmp(argv[1], "-s") == 0)
+	{
+		result = captionStream.open(argv[2]);
+		if (result != S_OK)
+			return 1;
+		
+		if (captionStream.frameDuration() != kFrameDuration || captionStream.timeScale() != kTimeScale)
+		{
+			fprintf(stderr, "The caption stream was not encoded at %g fps\n", (double)kTimeScale / kFrameDuration);
+			return 1;
+		}
+		useCaptionStream = true;
+	}
+	else if (argc != 1)
+	{
+		fprintf(stderr, "Usage: %s [-s <captionstream>]\n", argv[0]);
+		return 1;
+	}
+	
 	// Create an IDeckLinkIterator object to enumerate all DeckLink cards in the system
 	result = GetDeckLinkIterator(&deckLinkIterator);
 	if (result != S_OK)
@@ -368,7 +450,7 @@ int main()
 	}
 	
 	// Create an instance of output callback
-	outputCallback = new OutputCallback(deckLinkOutput);
+	outputCallback = new OutputCallback(deckLinkOutput, useCaptionStream ? &captionStream : NULL);
 	if (outputCallback == NULL)
 	{
 		fprintf(stderr, "Could not create output callback object\n");
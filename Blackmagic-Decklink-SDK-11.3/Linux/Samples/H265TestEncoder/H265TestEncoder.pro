@@ -35,6 +35,7 @@ lessThan(QT_VERSION, 5.2) {
 }
 
 QT += widgets
+CONFIG += c++11
 
 TARGET = H265TestEncoder
 TEMPLATE = app
@@ -65,4 +66,4 @@ ICON    = Encoder_icon.icns
 
 RESOURCES += H265TestEncoder.qrc
 
-LIBS += -ldl -fPIC
+LIBS += -ldl -lpthread -fPIC
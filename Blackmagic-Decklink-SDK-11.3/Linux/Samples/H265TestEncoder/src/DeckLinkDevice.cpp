@@ -32,6 +32,9 @@ using namespace std;
 #include <QDesktopServices>
 #include <QTime>
 
+// Long recordings roll over to a new file at the first keyframe after this duration
+static const uint32_t kRecordingSegmentSeconds = 10 * 60;
+
 DeckLinkDevice::DeckLinkDevice(ControllerImp* ui, IDeckLink* device) :
 	m_deckLink(device),
 	m_deckLinkEncoderInput(NULL),
@@ -166,7 +169,7 @@ bool DeckLinkDevice::startCapture(int videoModeIndex, uint32_t bitrate)
 		return false;
 	}
 
-	if (!m_videoWriter->open())
+	if (!m_videoWriter->open(timeScale, kRecordingSegmentSeconds))
 	{
 		m_uiDelegate->showErrorMessage("Error starting recording", "Failed to open output file");
 		return false;
@@ -200,6 +203,10 @@ bool DeckLinkDevice::startCapture(int videoModeIndex, uint32_t bitrate)
 
 	m_deckLinkEncoderInput->SetCallback(this);
 
+	// The recording continues without audio if the encoder cannot provide it
+	if (m_deckLinkEncoderInput->EnableAudioInput(bmdAudioFormatPCM, bmdAudioSampleRate48kHz, bmdAudioSampleType32bitInteger, 2) != S_OK)
+		qWarning("Unable to enable audio input, recording video only");
+
 	if (m_deckLinkEncoderInput->EnableVideoInput(m_modeList[videoModeIndex]->GetDisplayMode(), bmdFormatH265, videoInputFlags) != S_OK)
 	{
 		m_uiDelegate->showErrorMessage("Error starting recording", "This application was unable to select the chosen video mode. Perhaps, the selected device is currently in-use.");
@@ -222,6 +229,7 @@ void DeckLinkDevice::stopCapture(bool deleteFile)
 	m_deckLinkEncoderInput->StopStreams();
 	m_deckLinkEncoderInput->SetCallback(NULL);
 	m_deckLinkEncoderInput->DisableVideoInput();
+	m_deckLinkEncoderInput->DisableAudioInput();
 
 	if (m_videoWriter)
 	{
@@ -279,20 +287,18 @@ QString DeckLinkDevice::getDisplayModeName(int displayModeIndex)
 
 HRESULT DeckLinkDevice::VideoPacketArrived(IDeckLinkEncoderVideoPacket* videoPacket)
 {
-	void* buffer = NULL;
-	videoPacket->GetBytes(&buffer);
-
-	if (buffer && m_videoWriter)
-	{
-		if (videoPacket->GetPacketType() == bmdPacketTypeStreamData)
-			m_videoWriter->writeVideo((uint8_t*)buffer, videoPacket->GetSize());
-	}
+	// Only queues a reference to the packet; the writer's thread does the file I/O
+	if (m_videoWriter && (videoPacket->GetPacketType() == bmdPacketTypeStreamData))
+		m_videoWriter->writeVideo(videoPacket);
 
 	return S_OK;
 }
 
-HRESULT DeckLinkDevice::AudioPacketArrived(IDeckLinkEncoderAudioPacket*)
+HRESULT DeckLinkDevice::AudioPacketArrived(IDeckLinkEncoderAudioPacket* audioPacket)
 {
+	if (m_videoWriter && (audioPacket->GetPacketType() == bmdPacketTypeStreamData))
+		m_videoWriter->writeAudio(audioPacket);
+
 	return S_OK;
 }
 
@@ -26,52 +26,476 @@
  */
 
 #include "VideoWriter.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+static const size_t		kQueueCapacity		= 4096;					// Packets
+static const long		kQueueByteLimit		= 256 * 1024 * 1024;	// About 20 seconds at the highest bitrates
+static const size_t		kMaxBatchPackets	= 512;
+static const size_t		kMaxPendingNALs		= 64;
+
+// H.265 NAL unit types (ITU-T H.265 table 7-1)
+static const uint8_t	kNALTypeIRAPFirst	= 16;	// BLA_W_LP
+static const uint8_t	kNALTypeIRAPLast	= 23;	// RSV_IRAP_VCL23
+static const uint8_t	kNALTypeVCLLast		= 31;
+
+// first_slice_segment_in_pic_flag, the first bit after the two byte NAL unit header
+static bool IsFirstSliceSegment(IDeckLinkH265NALPacket* nal)
+{
+	uint8_t* bytes = NULL;
+
+	if ((nal->GetSizeNoPrefix() < 3) || (nal->GetBytesNoPrefix((void**)&bytes) != S_OK) || (bytes == NULL))
+		return false;
+
+	return (bytes[2] & 0x80) != 0;
+}
 
 VideoWriter::VideoWriter(const QString& filename)
 :
-	m_filename(filename)
+	m_filename(filename),
+	m_timeScale(1),
+	m_segmentSeconds(0),
+	m_queueHead(0),
+	m_queueCount(0),
+	m_queuedBytes(0),
+	m_droppedVideo(false),
+	m_droppedAudio(false),
+	m_stopping(false),
+	m_videoFd(-1),
+	m_audioFd(-1),
+	m_indexFile(NULL),
+	m_videoOffset(0),
+	m_segmentNumber(0),
+	m_segmentStartTime(0),
+	m_waitForKeyframe(true)
 {
+	memset(&m_statistics, 0, sizeof(m_statistics));
 }
 
 VideoWriter::~VideoWriter()
-{	
+{
+	close();
 }
 
-bool VideoWriter::writeVideo(uint8_t* buffer, uint32_t length)
+bool VideoWriter::open(BMDTimeScale timeScale, uint32_t segmentSeconds)
 {
-	fwrite(buffer, 1, length, m_file);
+	m_timeScale = timeScale;
+	m_segmentSeconds = segmentSeconds;
+	m_segmentNumber = 0;
+	m_segmentStartTime = 0;
+	m_waitForKeyframe = true;
+	m_files.clear();
+	memset(&m_statistics, 0, sizeof(m_statistics));
+
+	if (!addVideoStream() || !addAudioStream())
+	{
+		closeStreams();
+		return false;
+	}
+
+	m_queue.assign(kQueueCapacity, QueuedPacket());
+	m_queueHead = 0;
+	m_queueCount = 0;
+	m_queuedBytes = 0;
+	m_droppedVideo = false;
+	m_droppedAudio = false;
+	m_stopping = false;
+
+	m_videoWrites.reserve(IOV_MAX);
+	m_audioWrites.reserve(IOV_MAX);
+	m_writtenPackets.reserve(2 * IOV_MAX);
+	m_pendingNALs.reserve(kMaxPendingNALs);
+
+	m_thread = std::thread(&VideoWriter::writerThread, this);
 	return true;
 }
 
-bool VideoWriter::writeAudio(uint64_t)
+void VideoWriter::close(bool deleteFile)
+{
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_condition.notify_one();
+		m_thread.join();
+	}
+
+	closeStreams();
+
+	if (deleteFile)
+	{
+		for (const QString& file : m_files)
+			remove(file.toStdString().c_str());
+	}
+	m_files.clear();
+}
+
+bool VideoWriter::writeVideo(IDeckLinkEncoderVideoPacket* packet)
+{
+	return enqueue(packet, false);
+}
+
+bool VideoWriter::writeAudio(IDeckLinkEncoderAudioPacket* packet)
+{
+	return enqueue(packet, true);
+}
+
+void VideoWriter::getStatistics(VideoWriterStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	*statistics = m_statistics;
+}
+
+bool VideoWriter::enqueue(IDeckLinkEncoderPacket* packet, bool isAudio)
 {
+	long size = packet->GetSize();
+	bool& dropped = isAudio ? m_droppedAudio : m_droppedVideo;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_thread.joinable() || m_stopping)
+			return false;
+
+		// Never wait for the writer; drop the packet and let the writer resynchronise
+		if ((m_queueCount == m_queue.size()) || (m_queuedBytes + size > kQueueByteLimit))
+		{
+			m_statistics.packetsDropped++;
+			dropped = true;
+			return false;
+		}
+
+		QueuedPacket& entry = m_queue[(m_queueHead + m_queueCount) % m_queue.size()];
+		packet->AddRef();
+		entry.packet = packet;
+		entry.isAudio = isAudio;
+		entry.discontinuity = dropped;
+		dropped = false;
+
+		m_queueCount++;
+		m_queuedBytes += size;
+		if (m_queueCount > m_statistics.peakQueuedPackets)
+			m_statistics.peakQueuedPackets = (uint32_t)m_queueCount;
+	}
+
+	m_condition.notify_one();
 	return true;
 }
 
-bool VideoWriter::addVideoStream()
+void VideoWriter::writerThread()
+{
+	QueuedPacket	batch[kMaxBatchPackets];
+	size_t			batchCount;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			m_condition.wait(lock, [this]{ return (m_queueCount > 0) || m_stopping; });
+			if (m_queueCount == 0)
+				break;
+
+			// Take everything queued, up to a batch, in one visit to the lock
+			batchCount = std::min(m_queueCount, kMaxBatchPackets);
+			for (size_t i = 0; i < batchCount; i++)
+			{
+				batch[i] = m_queue[m_queueHead];
+				m_queuedBytes -= batch[i].packet->GetSize();
+				m_queueHead = (m_queueHead + 1) % m_queue.size();
+			}
+			m_queueCount -= batchCount;
+		}
+
+		for (size_t i = 0; i < batchCount; i++)
+			writePacket(batch[i]);
+
+		flushWrites();
+	}
+
+	// Parameter sets with no picture after them are not worth keeping
+	for (IDeckLinkH265NALPacket* nal : m_pendingNALs)
+		nal->Release();
+	m_pendingNALs.clear();
+}
+
+void VideoWriter::writePacket(const QueuedPacket& entry)
+{
+	if (entry.isAudio)
+	{
+		IDeckLinkEncoderAudioPacket* audioPacket = (IDeckLinkEncoderAudioPacket*)entry.packet;
+
+		if ((m_audioFd >= 0) && (audioPacket->GetAudioFormat() == bmdAudioFormatPCM))
+		{
+			appendPacket(m_audioFd, audioPacket);
+			m_statistics.audioPackets++;
+		}
+	}
+	else
+	{
+		// Only lost video breaks the prediction chain
+		if (entry.discontinuity)
+			m_waitForKeyframe = true;
+		writeVideoPacket((IDeckLinkEncoderVideoPacket*)entry.packet, entry.discontinuity);
+	}
+
+	entry.packet->Release();
+}
+
+void VideoWriter::writeVideoPacket(IDeckLinkEncoderVideoPacket* packet, bool discontinuity)
 {
+	IDeckLinkH265NALPacket*		nal = NULL;
+	uint8_t						unitType;
+	BMDTimeValue				streamTime;
+
+	if ((packet->QueryInterface(IID_IDeckLinkH265NALPacket, (void**)&nal) != S_OK) || (nal->GetUnitType(&unitType) != S_OK))
+	{
+		if (nal != NULL)
+			nal->Release();
+		m_statistics.packetsDropped++;
+		return;
+	}
+
+	// Parameter sets and SEI are held until the picture they belong to is known, so a
+	// new segment can start with them
+	if (unitType > kNALTypeVCLLast)
+	{
+		if (discontinuity)
+		{
+			for (IDeckLinkH265NALPacket* pending : m_pendingNALs)
+				pending->Release();
+			m_pendingNALs.clear();
+		}
+
+		m_pendingNALs.push_back(nal);
+		if (m_pendingNALs.size() < kMaxPendingNALs)
+			return;
+
+		// Not a stream of access units we understand; write the units as they come
+		unitType = kNALTypeVCLLast;
+		nal = NULL;
+	}
+
+	// A picture may be coded as several slice segments, each in its own NAL unit; the
+	// access unit is indexed, and resynchronised on, at its first
+	bool isIRAP = (unitType >= kNALTypeIRAPFirst) && (unitType <= kNALTypeIRAPLast) && IsFirstSliceSegment(nal);
+
+	if (m_waitForKeyframe && !isIRAP)
+	{
+		for (IDeckLinkH265NALPacket* pending : m_pendingNALs)
+			pending->Release();
+		m_pendingNALs.clear();
+
+		if (nal != NULL)
+			nal->Release();
+		m_statistics.packetsDropped++;
+		return;
+	}
+
+	if (isIRAP)
+	{
+		m_waitForKeyframe = false;
+		nal->GetStreamTime(&streamTime, m_timeScale);
+
+		if (m_statistics.keyframes == 0)
+			m_segmentStartTime = streamTime;
+
+		if ((m_segmentSeconds > 0) && (streamTime - m_segmentStartTime >= (BMDTimeValue)m_segmentSeconds * m_timeScale))
+		{
+			flushWrites();
+			closeStreams();
+
+			m_segmentNumber++;
+			m_segmentStartTime = streamTime;
+			if (!addVideoStream() || !addAudioStream())
+				m_statistics.failed = true;
+		}
+
+		if (m_indexFile != NULL)
+			fprintf(m_indexFile, "%llu %lld %u\n", (unsigned long long)m_videoOffset, (long long)streamTime, unitType);
+		m_statistics.keyframes++;
+	}
+
+	for (IDeckLinkH265NALPacket* pending : m_pendingNALs)
+	{
+		appendPacket(m_videoFd, pending);
+		pending->Release();
+	}
+	m_statistics.videoPackets += m_pendingNALs.size();
+	m_pendingNALs.clear();
+
+	if (nal != NULL)
+	{
+		appendPacket(m_videoFd, nal);
+		nal->Release();
+		m_statistics.videoPackets++;
+	}
+}
+
+void VideoWriter::appendPacket(int fd, IDeckLinkEncoderPacket* packet)
+{
+	std::vector<struct iovec>&	writes = (fd == m_audioFd) ? m_audioWrites : m_videoWrites;
+	struct iovec				write;
+
+	if (fd < 0)
+		return;
+
+	if (writes.size() == IOV_MAX)
+		flushWrites();
+
+	packet->GetBytes(&write.iov_base);
+	write.iov_len = packet->GetSize();
+	if (write.iov_base == NULL || write.iov_len == 0)
+		return;
+
+	// The buffer stays valid until the packet is released after the write
+	packet->AddRef();
+	m_writtenPackets.push_back(packet);
+	writes.push_back(write);
+
+	if (fd == m_videoFd)
+		m_videoOffset += write.iov_len;
+}
+
+static bool WriteVector(int fd, std::vector<struct iovec>& writes, uint64_t* bytesWritten)
+{
+	struct iovec*	iov = writes.data();
+	int				count = (int)writes.size();
+
+	while (count > 0)
+	{
+		ssize_t result = writev(fd, iov, count);
+
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;
+
+		*bytesWritten += result;
+
+		// Step over what was written, including part of a buffer
+		while (count > 0 && (size_t)result >= iov->iov_len)
+		{
+			result -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (uint8_t*)iov->iov_base + result;
+			iov->iov_len -= result;
+		}
+	}
+
 	return true;
 }
 
-bool VideoWriter::addAudioStream()
+bool VideoWriter::flushWrites()
 {
+	bool result = true;
+
+	if (!m_videoWrites.empty())
+		result = WriteVector(m_videoFd, m_videoWrites, &m_statistics.bytesWritten) && result;
+	if (!m_audioWrites.empty())
+		result = WriteVector(m_audioFd, m_audioWrites, &m_statistics.bytesWritten) && result;
+
+	m_videoWrites.clear();
+	m_audioWrites.clear();
+
+	for (IDeckLinkEncoderPacket* packet : m_writtenPackets)
+		packet->Release();
+	m_writtenPackets.clear();
+
+	if (m_indexFile != NULL)
+		fflush(m_indexFile);
+
+	if (!result)
+		m_statistics.failed = true;
+
+	return result;
+}
+
+QString VideoWriter::segmentPath(const char* extension) const
+{
+	QString path = m_filename;
+
+	if (m_segmentSeconds > 0)
+	{
+		int dot = path.lastIndexOf('.');
+		if (dot > path.lastIndexOf('/'))
+			path.truncate(dot);
+		path += QString(" %1.hevc").arg(m_segmentNumber, 3, 10, QChar('0'));
+	}
+
+	if (extension != NULL)
+	{
+		int dot = path.lastIndexOf('.');
+		if (dot > path.lastIndexOf('/'))
+			path.truncate(dot);
+		path += extension;
+	}
+
+	return path;
+}
+
+bool VideoWriter::addVideoStream()
+{
+	QString videoPath = segmentPath(NULL);
+	QString indexPath = videoPath + ".idx";
+
+	m_videoFd = ::open(videoPath.toStdString().c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (m_videoFd < 0)
+		return false;
+	m_files << videoPath;
+
+	m_indexFile = fopen(indexPath.toStdString().c_str(), "w");
+	if (m_indexFile == NULL)
+		return false;
+	m_files << indexPath;
+
+	fprintf(m_indexFile, "# IRAP access units: byte offset, stream time (timescale %lld), NAL unit type\n", (long long)m_timeScale);
+
+	m_videoOffset = 0;
+	m_statistics.segments++;
 	return true;
 }
 
-bool VideoWriter::open()
+bool VideoWriter::addAudioStream()
 {
-	m_file = fopen(m_filename.toStdString().c_str(), "wb");
-	if (!m_file)
+	// Raw PCM as captured, 48 kHz, see DeckLinkDevice::startCapture
+	QString audioPath = segmentPath(".pcm");
+
+	m_audioFd = ::open(audioPath.toStdString().c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (m_audioFd < 0)
 		return false;
-	
+	m_files << audioPath;
+
 	return true;
 }
 
-void VideoWriter::close(bool deleteFile)
+void VideoWriter::closeStreams()
 {
-	fclose(m_file);
-	if (deleteFile)
-		remove(m_filename.toStdString().c_str());
-	m_file = 0;
+	if (m_videoFd >= 0)
+	{
+		::close(m_videoFd);
+		m_videoFd = -1;
+	}
+
+	if (m_audioFd >= 0)
+	{
+		::close(m_audioFd);
+		m_audioFd = -1;
+	}
+
+	if (m_indexFile != NULL)
+	{
+		fclose(m_indexFile);
+		m_indexFile = NULL;
+	}
 }
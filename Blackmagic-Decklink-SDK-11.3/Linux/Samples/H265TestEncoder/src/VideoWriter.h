@@ -28,27 +28,105 @@
 #pragma once
 
 #include <stdint.h>
-#include <cstdio>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <QString>
+#include <QStringList>
+#include "DeckLinkAPI.h"
 
+struct VideoWriterStatistics
+{
+	uint64_t				videoPackets;
+	uint64_t				audioPackets;
+	uint64_t				packetsDropped;			// Queue full, or waiting for a keyframe after a drop
+	uint64_t				bytesWritten;
+	uint64_t				keyframes;				// IRAP access units
+	uint32_t				segments;
+	uint32_t				peakQueuedPackets;
+	bool					failed;
+};
+
+// Records the encoder's H.265 NAL packets to an elementary stream, and its PCM audio to
+// a raw file beside it. The encoder callbacks only take a reference to each packet and
+// append it to a bounded queue; a writer thread drains the queue in batches, gathering
+// the packet buffers into one writev() per file, so the callbacks never wait on the disk.
+// When the queue is full the packet is dropped. After a video drop the video resumes at
+// the next IRAP picture so the stream stays decodable; a dropped audio packet only
+// leaves a gap in the audio.
+//
+// Alongside each stream the writer keeps a text index (<stream>.idx) of the byte offset
+// and stream time of every IRAP access unit, for seeking. With a segment duration set,
+// the recording rolls over to a new set of files at the first IRAP access unit after the
+// duration, so every segment starts with the parameter sets and a keyframe.
 class VideoWriter
 {
 public:
 	VideoWriter(const QString& filename);
 	~VideoWriter();
 
-	bool					open();
+	// Stream times in the index are in timeScale units. segmentSeconds of 0 records one file.
+	bool					open(BMDTimeScale timeScale, uint32_t segmentSeconds = 0);
 	void					close(bool deleteFile = false);
 
-	bool					writeVideo(uint8_t* buffer, uint32_t length);
-	bool					writeAudio(uint64_t seq);
+	bool					writeVideo(IDeckLinkEncoderVideoPacket* packet);
+	bool					writeAudio(IDeckLinkEncoderAudioPacket* packet);
+
+	// Complete once close() has returned
+	void					getStatistics(VideoWriterStatistics* statistics);
 
 private:
+	struct QueuedPacket
+	{
+		IDeckLinkEncoderPacket*	packet;
+		bool					isAudio;
+		bool					discontinuity;		// Packets were dropped before this one
+	};
+
+	bool					enqueue(IDeckLinkEncoderPacket* packet, bool isAudio);
+	void					writerThread();
+	void					writePacket(const QueuedPacket& entry);
+	void					writeVideoPacket(IDeckLinkEncoderVideoPacket* packet, bool discontinuity);
+	void					appendPacket(int fd, IDeckLinkEncoderPacket* packet);
+	bool					flushWrites();
 
 	bool					addVideoStream();
 	bool					addAudioStream();
+	void					closeStreams();
+	QString					segmentPath(const char* extension) const;
 
 	QString					m_filename;
-	FILE*					m_file;
-};
+	BMDTimeScale			m_timeScale;
+	uint32_t				m_segmentSeconds;
+
+	// Packet queue, shared with the encoder callbacks
+	std::mutex				m_mutex;
+	std::condition_variable	m_condition;
+	std::vector<QueuedPacket>	m_queue;
+	size_t					m_queueHead;
+	size_t					m_queueCount;
+	long					m_queuedBytes;
+	bool					m_droppedVideo;			// Since the last queued packet of each stream
+	bool					m_droppedAudio;
+	bool					m_stopping;
+	std::thread				m_thread;
 
+	// Writer thread state
+	int						m_videoFd;
+	int						m_audioFd;
+	FILE*					m_indexFile;
+	uint64_t				m_videoOffset;
+	uint32_t				m_segmentNumber;
+	BMDTimeValue			m_segmentStartTime;
+	bool					m_waitForKeyframe;
+	std::vector<IDeckLinkH265NALPacket*>	m_pendingNALs;		// Non-VCL units of the next access unit
+	std::vector<struct iovec>	m_videoWrites;
+	std::vector<struct iovec>	m_audioWrites;
+	std::vector<IDeckLinkEncoderPacket*>	m_writtenPackets;	// Released once their bytes are written
+	QStringList				m_files;
+
+	VideoWriterStatistics	m_statistics;
+};
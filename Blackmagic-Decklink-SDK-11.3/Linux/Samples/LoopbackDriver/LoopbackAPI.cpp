@@ -0,0 +1,356 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include "DeckLinkAPI.h"
+#include "DeckLinkAPIVersion.h"
+#include "LoopbackDevice.h"
+#include "LoopbackVideoFrame.h"
+#include "V210Conversion.h"
+
+// Entry points resolved by DeckLinkAPIDispatch.cpp. The suffixes must match the
+// versions of the interfaces declared in the SDK headers this library is built against.
+extern "C" {
+	IDeckLinkIterator*						CreateDeckLinkIteratorInstance_0004(void);
+	IDeckLinkAPIInformation*				CreateDeckLinkAPIInformationInstance_0001(void);
+	IDeckLinkVideoConversion*				CreateVideoConversionInstance_0001(void);
+	IDeckLinkDiscovery*						CreateDeckLinkDiscoveryInstance_0003(void);
+	IDeckLinkVideoFrameAncillaryPackets*	CreateVideoFrameAncillaryPacketsInstance_0001(void);
+}
+
+class LoopbackIterator : public IDeckLinkIterator
+{
+public:
+	LoopbackIterator() : m_index(0), m_refCount(1) {}
+
+	// IDeckLinkIterator interface
+	virtual HRESULT		STDMETHODCALLTYPE	Next(IDeckLink** deckLinkInstance)
+	{
+		LoopbackDevice* device;
+
+		if (deckLinkInstance == NULL)
+			return E_POINTER;
+
+		*deckLinkInstance = NULL;
+
+		device = LoopbackDevice::GetDevice(m_index);
+		if (device == NULL)
+			return S_FALSE;
+
+		m_index++;
+		device->AddRef();
+		*deckLinkInstance = device;
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+
+		if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+			(memcmp(&iid, &IID_IDeckLinkIterator, sizeof(REFIID)) == 0))
+		{
+			*ppv = (IDeckLinkIterator*)this;
+			AddRef();
+			return S_OK;
+		}
+
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG		STDMETHODCALLTYPE	AddRef()		{ return ++m_refCount; }
+	virtual ULONG		STDMETHODCALLTYPE	Release()
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+		return newRefValue;
+	}
+
+private:
+	virtual ~LoopbackIterator() {}
+
+	unsigned				m_index;
+	std::atomic<ULONG>		m_refCount;
+};
+
+class LoopbackAPIInformation : public IDeckLinkAPIInformation
+{
+public:
+	LoopbackAPIInformation() : m_refCount(1) {}
+
+	// IDeckLinkAPIInformation interface
+	virtual HRESULT		STDMETHODCALLTYPE	GetFlag(BMDDeckLinkAPIInformationID cfgID, bool* value)
+	{
+		return E_INVALIDARG;
+	}
+
+	virtual HRESULT		STDMETHODCALLTYPE	GetInt(BMDDeckLinkAPIInformationID cfgID, int64_t* value)
+	{
+		if (value == NULL)
+			return E_POINTER;
+
+		if (cfgID != BMDDeckLinkAPIVersion)
+			return E_INVALIDARG;
+
+		*value = BLACKMAGIC_DECKLINK_API_VERSION;
+		return S_OK;
+	}
+
+	virtual HRESULT		STDMETHODCALLTYPE	GetFloat(BMDDeckLinkAPIInformationID cfgID, double* value)
+	{
+		return E_INVALIDARG;
+	}
+
+	virtual HRESULT		STDMETHODCALLTYPE	GetString(BMDDeckLinkAPIInformationID cfgID, const char** value)
+	{
+		if (value == NULL)
+			return E_POINTER;
+
+		if (cfgID != BMDDeckLinkAPIVersion)
+			return E_INVALIDARG;
+
+		*value = strdup(BLACKMAGIC_DECKLINK_API_VERSION_STRING);
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+
+		if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+			(memcmp(&iid, &IID_IDeckLinkAPIInformation, sizeof(REFIID)) == 0))
+		{
+			*ppv = (IDeckLinkAPIInformation*)this;
+			AddRef();
+			return S_OK;
+		}
+
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG		STDMETHODCALLTYPE	AddRef()		{ return ++m_refCount; }
+	virtual ULONG		STDMETHODCALLTYPE	Release()
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+		return newRefValue;
+	}
+
+private:
+	virtual ~LoopbackAPIInformation() {}
+
+	std::atomic<ULONG>		m_refCount;
+};
+
+class LoopbackDiscovery : public IDeckLinkDiscovery
+{
+public:
+	LoopbackDiscovery() : m_refCount(1), m_callback(NULL) {}
+
+	// IDeckLinkDiscovery interface
+	virtual HRESULT		STDMETHODCALLTYPE	InstallDeviceNotifications(IDeckLinkDeviceNotificationCallback* deviceNotificationCallback)
+	{
+		if (deviceNotificationCallback == NULL)
+			return E_INVALIDARG;
+
+		if (m_callback != NULL)
+			return E_FAIL;
+
+		m_callback = deviceNotificationCallback;
+		m_callback->AddRef();
+
+		// Loopback devices are never hot-plugged, so every device arrives immediately
+		for (unsigned i = 0; i < LoopbackDevice::GetDeviceCount(); i++)
+			m_callback->DeckLinkDeviceArrived(LoopbackDevice::GetDevice(i));
+
+		return S_OK;
+	}
+
+	virtual HRESULT		STDMETHODCALLTYPE	UninstallDeviceNotifications(void)
+	{
+		if (m_callback != NULL)
+		{
+			m_callback->Release();
+			m_callback = NULL;
+		}
+
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+
+		if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+			(memcmp(&iid, &IID_IDeckLinkDiscovery, sizeof(REFIID)) == 0))
+		{
+			*ppv = (IDeckLinkDiscovery*)this;
+			AddRef();
+			return S_OK;
+		}
+
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG		STDMETHODCALLTYPE	AddRef()		{ return ++m_refCount; }
+	virtual ULONG		STDMETHODCALLTYPE	Release()
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+		return newRefValue;
+	}
+
+private:
+	virtual ~LoopbackDiscovery()
+	{
+		UninstallDeviceNotifications();
+	}
+
+	std::atomic<ULONG>						m_refCount;
+	IDeckLinkDeviceNotificationCallback*	m_callback;
+};
+
+class LoopbackVideoConversion : public IDeckLinkVideoConversion
+{
+public:
+	LoopbackVideoConversion() : m_refCount(1) {}
+
+	// IDeckLinkVideoConversion interface
+	virtual HRESULT		STDMETHODCALLTYPE	ConvertFrame(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame)
+	{
+		void*	srcBytes;
+		void*	dstBytes;
+		long	copyBytes;
+		HRESULT	result;
+
+		if ((srcFrame == NULL) || (dstFrame == NULL))
+			return E_INVALIDARG;
+
+		if ((srcFrame->GetWidth() != dstFrame->GetWidth()) || (srcFrame->GetHeight() != dstFrame->GetHeight()))
+			return E_INVALIDARG;
+
+		result = ConvertVideoFrameWithKernels(srcFrame, dstFrame);
+		if (result != E_NOTIMPL)
+			return result;
+
+		// Other pixel formats can only be copied to a frame of the same format
+		if (srcFrame->GetPixelFormat() != dstFrame->GetPixelFormat())
+			return E_NOTIMPL;
+
+		if ((srcFrame->GetBytes(&srcBytes) != S_OK) || (dstFrame->GetBytes(&dstBytes) != S_OK))
+			return E_FAIL;
+
+		copyBytes = std::min(srcFrame->GetRowBytes(), dstFrame->GetRowBytes());
+		for (long y = 0; y < srcFrame->GetHeight(); y++)
+			memcpy((uint8_t*)dstBytes + y * dstFrame->GetRowBytes(), (uint8_t*)srcBytes + y * srcFrame->GetRowBytes(), copyBytes);
+
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+
+		if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+			(memcmp(&iid, &IID_IDeckLinkVideoConversion, sizeof(REFIID)) == 0))
+		{
+			*ppv = (IDeckLinkVideoConversion*)this;
+			AddRef();
+			return S_OK;
+		}
+
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG		STDMETHODCALLTYPE	AddRef()		{ return ++m_refCount; }
+	virtual ULONG		STDMETHODCALLTYPE	Release()
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+		return newRefValue;
+	}
+
+private:
+	virtual ~LoopbackVideoConversion() {}
+
+	std::atomic<ULONG>		m_refCount;
+};
+
+IDeckLinkIterator* CreateDeckLinkIteratorInstance_0004(void)
+{
+	return new LoopbackIterator();
+}
+
+IDeckLinkAPIInformation* CreateDeckLinkAPIInformationInstance_0001(void)
+{
+	return new LoopbackAPIInformation();
+}
+
+IDeckLinkVideoConversion* CreateVideoConversionInstance_0001(void)
+{
+	return new LoopbackVideoConversion();
+}
+
+IDeckLinkDiscovery* CreateDeckLinkDiscoveryInstance_0003(void)
+{
+	return new LoopbackDiscovery();
+}
+
+IDeckLinkVideoFrameAncillaryPackets* CreateVideoFrameAncillaryPacketsInstance_0001(void)
+{
+	return new LoopbackAncillaryPackets();
+}
@@ -0,0 +1,850 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "LoopbackDevice.h"
+#include "LoopbackInput.h"
+#include "LoopbackOutput.h"
+
+static const unsigned	kDefaultDeviceCount		= 4;
+static const unsigned	kMaxDeviceCount			= 16;
+static const int64_t	kNanosecondsPerSecond	= 1000000000;
+
+static std::once_flag					gDevicesOnceFlag;
+static std::vector<LoopbackDevice*>		gDevices;
+
+// Built-in test signal, for capture tools run without a playback client in the same process.
+// DECKLINK_LOOPBACK_TEST_SIGNAL names a display mode (eg "1080p25") to present a fixed signal,
+// or any other value to present a signal matching whatever mode the input is enabled in.
+static std::once_flag					gTestSignalOnceFlag;
+static bool								gTestSignalEnabled = false;
+static const LoopbackDisplayModeInfo*	gTestSignalMode = NULL;
+
+static void initTestSignal(void)
+{
+	const char* value = getenv("DECKLINK_LOOPBACK_TEST_SIGNAL");
+
+	if ((value == NULL) || (value[0] == '\0'))
+		return;
+
+	gTestSignalEnabled = true;
+
+	for (unsigned i = 0; i < GetLoopbackDisplayModeCount(); i++)
+	{
+		const LoopbackDisplayModeInfo* info = GetLoopbackDisplayModeInfo(i);
+		if (strcmp(info->name, value) == 0)
+			gTestSignalMode = info;
+	}
+}
+
+static const LoopbackDisplayModeInfo* testSignalMode(BMDDisplayMode inputMode)
+{
+	std::call_once(gTestSignalOnceFlag, initTestSignal);
+
+	if (!gTestSignalEnabled)
+		return NULL;
+
+	if (gTestSignalMode != NULL)
+		return gTestSignalMode;
+
+	return FindLoopbackDisplayModeInfo(inputMode);
+}
+
+/* Reference clock */
+
+int64_t LoopbackNowNs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * kNanosecondsPerSecond + now.tv_nsec;
+}
+
+int64_t LoopbackTickTimeNs(const LoopbackDisplayModeInfo* mode, int64_t tick)
+{
+	return (int64_t)((__int128)tick * mode->frameDuration * kNanosecondsPerSecond / mode->timeScale);
+}
+
+int64_t LoopbackTickIndexAt(const LoopbackDisplayModeInfo* mode, int64_t timeNs)
+{
+	__int128 numerator = (__int128)timeNs * mode->timeScale;
+	__int128 denominator = (__int128)mode->frameDuration * kNanosecondsPerSecond;
+	__int128 tick = numerator / denominator;
+
+	if ((numerator % denominator != 0) && (numerator < 0))
+		tick--;
+
+	return (int64_t)tick;
+}
+
+uint32_t LoopbackAudioSamplesForTick(const LoopbackDisplayModeInfo* mode, int64_t startTick, int64_t tick)
+{
+	// Distribute 48kHz samples over frames so that non-integer rates (eg 29.97) never drift
+	int64_t k = tick - startTick;
+	int64_t samplesBefore = (int64_t)((__int128)k * mode->frameDuration * bmdAudioSampleRate48kHz / mode->timeScale);
+	int64_t samplesAfter = (int64_t)((__int128)(k + 1) * mode->frameDuration * bmdAudioSampleRate48kHz / mode->timeScale);
+
+	return (uint32_t)(samplesAfter - samplesBefore);
+}
+
+/* LoopbackProfileAttributes */
+
+HRESULT LoopbackProfileAttributes::GetFlag(BMDDeckLinkAttributeID cfgID, bool* value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	switch (cfgID)
+	{
+		case BMDDeckLinkSupportsInputFormatDetection:
+		case BMDDeckLinkSupportsSynchronizeToCaptureGroup:
+		case BMDDeckLinkSupportsSynchronizeToPlaybackGroup:
+		case BMDDeckLinkSupportsIdleOutput:
+		case BMDDeckLinkSupportsHighFrameRateTimecode:
+			*value = true;
+			return S_OK;
+
+		case BMDDeckLinkSupportsInternalKeying:
+		case BMDDeckLinkSupportsExternalKeying:
+		case BMDDeckLinkHasReferenceInput:
+		case BMDDeckLinkHasSerialPort:
+		case BMDDeckLinkHasAnalogVideoOutputGain:
+		case BMDDeckLinkCanOnlyAdjustOverallVideoOutputGain:
+		case BMDDeckLinkHasVideoInputAntiAliasingFilter:
+		case BMDDeckLinkHasBypass:
+		case BMDDeckLinkSupportsClockTimingAdjustment:
+		case BMDDeckLinkSupportsFullFrameReferenceInputTimingOffset:
+		case BMDDeckLinkSupportsSMPTELevelAOutput:
+		case BMDDeckLinkSupportsDualLinkSDI:
+		case BMDDeckLinkSupportsQuadLinkSDI:
+		case BMDDeckLinkVANCRequires10BitYUVVideoFrames:
+		case BMDDeckLinkHasLTCTimecodeInput:
+		case BMDDeckLinkSupportsHDRMetadata:
+		case BMDDeckLinkSupportsColorspaceMetadata:
+		case BMDDeckLinkSupportsHDMITimecode:
+			*value = false;
+			return S_OK;
+
+		default:
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT LoopbackProfileAttributes::GetInt(BMDDeckLinkAttributeID cfgID, int64_t* value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	switch (cfgID)
+	{
+		case BMDDeckLinkMaximumAudioChannels:
+			*value = 16;
+			return S_OK;
+
+		case BMDDeckLinkMaximumAnalogAudioInputChannels:
+		case BMDDeckLinkMaximumAnalogAudioOutputChannels:
+		case BMDDeckLinkSubDeviceIndex:
+			*value = 0;
+			return S_OK;
+
+		case BMDDeckLinkNumberOfSubDevices:
+			*value = 1;
+			return S_OK;
+
+		case BMDDeckLinkPersistentID:
+		case BMDDeckLinkTopologicalID:
+			*value = 0x4C500000 | m_device->Index();
+			return S_OK;
+
+		case BMDDeckLinkDeviceGroupID:
+			*value = 0x4C500000;
+			return S_OK;
+
+		case BMDDeckLinkVideoInputConnections:
+		case BMDDeckLinkVideoOutputConnections:
+			*value = bmdVideoConnectionSDI;
+			return S_OK;
+
+		case BMDDeckLinkAudioInputConnections:
+		case BMDDeckLinkAudioOutputConnections:
+			*value = bmdAudioConnectionEmbedded;
+			return S_OK;
+
+		case BMDDeckLinkVideoIOSupport:
+			*value = bmdDeviceSupportsCapture | bmdDeviceSupportsPlayback;
+			return S_OK;
+
+		case BMDDeckLinkDeckControlConnections:
+			*value = 0;
+			return S_OK;
+
+		case BMDDeckLinkDeviceInterface:
+			*value = bmdDeviceInterfacePCI;
+			return S_OK;
+
+		case BMDDeckLinkProfileID:
+			*value = bmdProfileOneSubDeviceFullDuplex;
+			return S_OK;
+
+		case BMDDeckLinkDuplex:
+			*value = bmdDuplexFull;
+			return S_OK;
+
+		default:
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT LoopbackProfileAttributes::GetFloat(BMDDeckLinkAttributeID cfgID, double* value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	return E_INVALIDARG;
+}
+
+HRESULT LoopbackProfileAttributes::GetString(BMDDeckLinkAttributeID cfgID, const char** value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	switch (cfgID)
+	{
+		case BMDDeckLinkVendorName:
+			*value = strdup("Blackmagic Design");
+			return S_OK;
+
+		case BMDDeckLinkModelName:
+			return m_device->GetModelName(value);
+
+		case BMDDeckLinkDisplayName:
+			return m_device->GetDisplayName(value);
+
+		case BMDDeckLinkDeviceHandle:
+		{
+			char handle[32];
+			snprintf(handle, sizeof(handle), "loopback:%u", m_device->Index());
+			*value = strdup(handle);
+			return S_OK;
+		}
+
+		default:
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT LoopbackProfileAttributes::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG LoopbackProfileAttributes::AddRef()
+{
+	return m_device->AddRef();
+}
+
+ULONG LoopbackProfileAttributes::Release()
+{
+	return m_device->Release();
+}
+
+/* LoopbackConfiguration */
+
+LoopbackConfiguration::LoopbackConfiguration(LoopbackDevice* device) :
+	m_device(device)
+{
+	// Defaults reported before a client changes anything
+	m_flags[bmdDeckLinkConfig444SDIVideoOutput] = false;
+
+	m_ints[bmdDeckLinkConfigCaptureGroup] = 0;
+	m_ints[bmdDeckLinkConfigPlaybackGroup] = 0;
+	m_ints[bmdDeckLinkConfigVideoInputConnection] = bmdVideoConnectionSDI;
+	m_ints[bmdDeckLinkConfigVideoOutputConnection] = bmdVideoConnectionSDI;
+	m_ints[bmdDeckLinkConfigAudioInputConnection] = bmdAudioConnectionEmbedded;
+	m_ints[bmdDeckLinkConfigCapturePassThroughMode] = bmdDeckLinkCapturePassthroughModeDisabled;
+	m_ints[bmdDeckLinkConfigSDIOutputLinkConfiguration] = bmdLinkConfigurationSingleLink;
+	m_ints[bmdDeckLinkConfigVideoOutputIdleOperation] = bmdIdleVideoOutputBlack;
+
+	m_strings[bmdDeckLinkConfigDeviceInformationLabel] = "";
+}
+
+HRESULT LoopbackConfiguration::SetFlag(BMDDeckLinkConfigurationID cfgID, bool value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_flags[cfgID] = value;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::GetFlag(BMDDeckLinkConfigurationID cfgID, bool* value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_flags.find(cfgID);
+
+	if (value == NULL)
+		return E_POINTER;
+
+	if (iter == m_flags.end())
+		return E_INVALIDARG;
+
+	*value = iter->second;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::SetInt(BMDDeckLinkConfigurationID cfgID, int64_t value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_ints[cfgID] = value;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::GetInt(BMDDeckLinkConfigurationID cfgID, int64_t* value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_ints.find(cfgID);
+
+	if (value == NULL)
+		return E_POINTER;
+
+	if (iter == m_ints.end())
+		return E_INVALIDARG;
+
+	*value = iter->second;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::SetFloat(BMDDeckLinkConfigurationID cfgID, double value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_floats[cfgID] = value;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::GetFloat(BMDDeckLinkConfigurationID cfgID, double* value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_floats.find(cfgID);
+
+	if (value == NULL)
+		return E_POINTER;
+
+	if (iter == m_floats.end())
+		return E_INVALIDARG;
+
+	*value = iter->second;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::SetString(BMDDeckLinkConfigurationID cfgID, const char* value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (value == NULL)
+		return E_POINTER;
+
+	m_strings[cfgID] = value;
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::GetString(BMDDeckLinkConfigurationID cfgID, const char** value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_strings.find(cfgID);
+
+	if (value == NULL)
+		return E_POINTER;
+
+	if (iter == m_strings.end())
+		return E_INVALIDARG;
+
+	*value = strdup(iter->second.c_str());
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::WriteConfigurationToPreferences(void)
+{
+	// Loopback settings only last for the lifetime of the process
+	return S_OK;
+}
+
+HRESULT LoopbackConfiguration::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG LoopbackConfiguration::AddRef()
+{
+	return m_device->AddRef();
+}
+
+ULONG LoopbackConfiguration::Release()
+{
+	return m_device->Release();
+}
+
+/* LoopbackStatus */
+
+HRESULT LoopbackStatus::GetFlag(BMDDeckLinkStatusID statusID, bool* value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	switch (statusID)
+	{
+		case bmdDeckLinkStatusVideoInputSignalLocked:
+			*value = (m_device->GetDetectedInputMode() != bmdModeUnknown);
+			return S_OK;
+
+		case bmdDeckLinkStatusReferenceSignalLocked:
+			// All loopback devices share a common reference clock
+			*value = true;
+			return S_OK;
+
+		case bmdDeckLinkStatusReceivedEDID:
+			return E_NOTIMPL;
+
+		default:
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT LoopbackStatus::GetInt(BMDDeckLinkStatusID statusID, int64_t* value)
+{
+	LoopbackInput*		input = m_device->Input();
+	LoopbackOutput*		output = m_device->Output();
+
+	if (value == NULL)
+		return E_POINTER;
+
+	switch (statusID)
+	{
+		case bmdDeckLinkStatusDetectedVideoInputMode:
+			*value = m_device->GetDetectedInputMode();
+			return S_OK;
+
+		case bmdDeckLinkStatusDetectedVideoInputFlags:
+		case bmdDeckLinkStatusReferenceSignalFlags:
+			*value = 0;
+			return S_OK;
+
+		case bmdDeckLinkStatusCurrentVideoInputMode:
+			*value = input->CurrentMode();
+			return S_OK;
+
+		case bmdDeckLinkStatusCurrentVideoInputPixelFormat:
+			*value = input->CurrentPixelFormat();
+			return S_OK;
+
+		case bmdDeckLinkStatusCurrentVideoInputFlags:
+			*value = input->CurrentFlags();
+			return S_OK;
+
+		case bmdDeckLinkStatusCurrentVideoOutputMode:
+			*value = output->CurrentMode();
+			return S_OK;
+
+		case bmdDeckLinkStatusCurrentVideoOutputFlags:
+			*value = output->CurrentFlags();
+			return S_OK;
+
+		case bmdDeckLinkStatusLastVideoOutputPixelFormat:
+			*value = output->LastPixelFormat();
+			return S_OK;
+
+		case bmdDeckLinkStatusReferenceSignalMode:
+			*value = bmdModeUnknown;
+			return S_OK;
+
+		case bmdDeckLinkStatusBusy:
+			*value = (input->IsBusy() ? bmdDeviceCaptureBusy : 0) | (output->IsBusy() ? bmdDevicePlaybackBusy : 0);
+			return S_OK;
+
+		case bmdDeckLinkStatusInterchangeablePanelType:
+			*value = bmdPanelNotDetected;
+			return S_OK;
+
+		case bmdDeckLinkStatusPCIExpressLinkWidth:
+		case bmdDeckLinkStatusPCIExpressLinkSpeed:
+		case bmdDeckLinkStatusDeviceTemperature:
+			return E_NOTIMPL;
+
+		default:
+			return E_INVALIDARG;
+	}
+}
+
+HRESULT LoopbackStatus::GetFloat(BMDDeckLinkStatusID statusID, double* value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	return E_INVALIDARG;
+}
+
+HRESULT LoopbackStatus::GetString(BMDDeckLinkStatusID statusID, const char** value)
+{
+	if (value == NULL)
+		return E_POINTER;
+
+	return E_INVALIDARG;
+}
+
+HRESULT LoopbackStatus::GetBytes(BMDDeckLinkStatusID statusID, void* buffer, uint32_t* bufferSize)
+{
+	if (bufferSize == NULL)
+		return E_POINTER;
+
+	if (statusID == bmdDeckLinkStatusReceivedEDID)
+		return E_NOTIMPL;
+
+	return E_INVALIDARG;
+}
+
+HRESULT LoopbackStatus::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG LoopbackStatus::AddRef()
+{
+	return m_device->AddRef();
+}
+
+ULONG LoopbackStatus::Release()
+{
+	return m_device->Release();
+}
+
+/* LoopbackNotification */
+
+void LoopbackNotification::Notify(BMDNotifications topic, uint64_t param1, uint64_t param2)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (Subscription& subscription : m_subscriptions)
+	{
+		IDeckLinkNotificationCallback* callback = subscription.callback;
+
+		if (subscription.topic != topic)
+			continue;
+
+		callback->AddRef();
+		m_queue.Post([callback, topic, param1, param2]() {
+			callback->Notify(topic, param1, param2);
+			callback->Release();
+		});
+	}
+}
+
+HRESULT LoopbackNotification::Subscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Subscription subscription = { topic, theCallback };
+
+	if (theCallback == NULL)
+		return E_INVALIDARG;
+
+	theCallback->AddRef();
+	m_subscriptions.push_back(subscription);
+	return S_OK;
+}
+
+HRESULT LoopbackNotification::Unsubscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto iter = m_subscriptions.begin(); iter != m_subscriptions.end(); ++iter)
+	{
+		if ((iter->topic == topic) && (iter->callback == theCallback))
+		{
+			m_subscriptions.erase(iter);
+			theCallback->Release();
+			return S_OK;
+		}
+	}
+
+	return E_INVALIDARG;
+}
+
+HRESULT LoopbackNotification::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG LoopbackNotification::AddRef()
+{
+	return m_device->AddRef();
+}
+
+ULONG LoopbackNotification::Release()
+{
+	return m_device->Release();
+}
+
+/* LoopbackDevice */
+
+unsigned LoopbackDevice::GetDeviceCount(void)
+{
+	std::call_once(gDevicesOnceFlag, []() {
+		const char*	value = getenv("DECKLINK_LOOPBACK_DEVICE_COUNT");
+		unsigned	deviceCount = kDefaultDeviceCount;
+
+		if (value != NULL)
+			deviceCount = std::min((unsigned)strtoul(value, NULL, 10), kMaxDeviceCount);
+
+		for (unsigned i = 0; i < deviceCount; i++)
+			gDevices.push_back(new LoopbackDevice(i));
+	});
+
+	return (unsigned)gDevices.size();
+}
+
+LoopbackDevice* LoopbackDevice::GetDevice(unsigned index)
+{
+	if (index >= GetDeviceCount())
+		return NULL;
+
+	return gDevices[index];
+}
+
+LoopbackDevice::LoopbackDevice(unsigned index) :
+	m_index(index), m_refCount(1),
+	m_attributes(this), m_configuration(this), m_status(this), m_notification(this),
+	m_clockChanged(false)
+{
+	m_output = new LoopbackOutput(this);
+	m_input = new LoopbackInput(this);
+
+	std::thread(&LoopbackDevice::clockThread, this).detach();
+}
+
+void LoopbackDevice::ClockModeChanged(void)
+{
+	std::lock_guard<std::mutex> lock(m_clockMutex);
+	m_clockChanged = true;
+	m_clockCondition.notify_all();
+}
+
+void LoopbackDevice::StatusChanged(BMDDeckLinkStatusID statusID)
+{
+	m_notification.Notify(bmdStatusChanged, statusID, 0);
+}
+
+bool LoopbackDevice::GetInputSignal(BMDDisplayMode inputMode, LoopbackInputSignal* signal)
+{
+	const LoopbackDisplayModeInfo* mode;
+
+	// The output of the same device is looped back to its input
+	if (m_output->GetLoopbackSignal(signal))
+		return true;
+
+	mode = testSignalMode(inputMode);
+	if (mode == NULL)
+		return false;
+
+	signal->mode = mode;
+	signal->frame = NULL;
+	signal->audio.clear();
+	signal->audioSampleFrames = 0;
+	return true;
+}
+
+BMDDisplayMode LoopbackDevice::GetDetectedInputMode(void)
+{
+	BMDDisplayMode					outputMode = m_output->CurrentMode();
+	const LoopbackDisplayModeInfo*	mode;
+
+	if (outputMode != bmdModeUnknown)
+		return outputMode;
+
+	mode = testSignalMode(m_input->CurrentMode());
+	return (mode != NULL) ? mode->displayMode : bmdModeUnknown;
+}
+
+void LoopbackDevice::clockThread(void)
+{
+	// Input is processed before output at the same instant, so a frame played
+	// on one tick is captured on the next, one frame of loopback latency.
+	struct ClockTrack
+	{
+		const LoopbackDisplayModeInfo*	mode;
+		int64_t							nextTick;
+	};
+
+	ClockTrack						tracks[2] = { { NULL, 0 }, { NULL, 0 } };
+	std::unique_lock<std::mutex>	lock(m_clockMutex);
+
+	for (;;)
+	{
+		const LoopbackDisplayModeInfo*	modes[2];
+		int64_t							now;
+		int64_t							deadline = INT64_MAX;
+
+		m_clockChanged = false;
+
+		lock.unlock();
+		modes[0] = m_input->ClockMode();
+		modes[1] = m_output->ClockMode();
+		now = LoopbackNowNs();
+		lock.lock();
+
+		for (int i = 0; i < 2; i++)
+		{
+			ClockTrack& track = tracks[i];
+
+			if (modes[i] != track.mode)
+			{
+				track.mode = modes[i];
+				if (track.mode != NULL)
+					track.nextTick = LoopbackTickIndexAt(track.mode, now) + 1;
+			}
+
+			if (track.mode == NULL)
+				continue;
+
+			// If the thread fell behind by more than a frame, resume at the current frame
+			if (LoopbackTickTimeNs(track.mode, track.nextTick + 1) <= now)
+				track.nextTick = LoopbackTickIndexAt(track.mode, now);
+
+			deadline = std::min(deadline, LoopbackTickTimeNs(track.mode, track.nextTick));
+		}
+
+		if (deadline > now)
+		{
+			if (deadline == INT64_MAX)
+				m_clockCondition.wait(lock, [this] { return m_clockChanged; });
+			else
+				m_clockCondition.wait_for(lock, std::chrono::nanoseconds(deadline - now), [this] { return m_clockChanged; });
+			continue;
+		}
+
+		for (int i = 0; i < 2; i++)
+		{
+			ClockTrack&	track = tracks[i];
+			int64_t		tick;
+			int64_t		tickTimeNs;
+
+			if ((track.mode == NULL) || (LoopbackTickTimeNs(track.mode, track.nextTick) > now))
+				continue;
+
+			tick = track.nextTick++;
+			tickTimeNs = LoopbackTickTimeNs(track.mode, tick);
+
+			lock.unlock();
+			if (i == 0)
+				m_input->ProcessTick(tick, tickTimeNs);
+			else
+				m_output->ProcessTick(tick, tickTimeNs);
+			lock.lock();
+		}
+	}
+}
+
+HRESULT LoopbackDevice::GetModelName(const char** modelName)
+{
+	if (modelName == NULL)
+		return E_POINTER;
+
+	*modelName = strdup("DeckLink Loopback");
+	return S_OK;
+}
+
+HRESULT LoopbackDevice::GetDisplayName(const char** displayName)
+{
+	char name[64];
+
+	if (displayName == NULL)
+		return E_POINTER;
+
+	snprintf(name, sizeof(name), "DeckLink Loopback (%u)", m_index + 1);
+	*displayName = strdup(name);
+	return S_OK;
+}
+
+HRESULT LoopbackDevice::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLink, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLink*)this;
+	}
+	else if (memcmp(&iid, &IID_IDeckLinkOutput, sizeof(REFIID)) == 0)
+	{
+		*ppv = (IDeckLinkOutput*)m_output;
+	}
+	else if (memcmp(&iid, &IID_IDeckLinkInput, sizeof(REFIID)) == 0)
+	{
+		*ppv = (IDeckLinkInput*)m_input;
+	}
+	else if (memcmp(&iid, &IID_IDeckLinkProfileAttributes, sizeof(REFIID)) == 0)
+	{
+		*ppv = (IDeckLinkProfileAttributes*)&m_attributes;
+	}
+	else if (memcmp(&iid, &IID_IDeckLinkConfiguration, sizeof(REFIID)) == 0)
+	{
+		*ppv = (IDeckLinkConfiguration*)&m_configuration;
+	}
+	else if (memcmp(&iid, &IID_IDeckLinkStatus, sizeof(REFIID)) == 0)
+	{
+		*ppv = (IDeckLinkStatus*)&m_status;
+	}
+	else if (memcmp(&iid, &IID_IDeckLinkNotification, sizeof(REFIID)) == 0)
+	{
+		*ppv = (IDeckLinkNotification*)&m_notification;
+	}
+	else
+	{
+		return E_NOINTERFACE;
+	}
+
+	((IUnknown*)*ppv)->AddRef();
+	return S_OK;
+}
+
+ULONG LoopbackDevice::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackDevice::Release()
+{
+	// Devices live for the lifetime of the process, as installed hardware does
+	ULONG newRefValue = --m_refCount;
+	return newRefValue;
+}
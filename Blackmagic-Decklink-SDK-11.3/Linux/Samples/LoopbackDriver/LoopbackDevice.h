@@ -0,0 +1,218 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "LoopbackDispatchQueue.h"
+#include "LoopbackDisplayMode.h"
+
+class LoopbackDevice;
+class LoopbackOutput;
+class LoopbackInput;
+
+// The loopback hardware reference clock, in nanoseconds on CLOCK_MONOTONIC
+int64_t		LoopbackNowNs(void);
+
+// Frame ticks are aligned to the origin of the reference clock, so every
+// device running the same display mode shares frame boundaries, as if all
+// devices were genlocked to a common reference.
+int64_t		LoopbackTickTimeNs(const LoopbackDisplayModeInfo* mode, int64_t tick);
+int64_t		LoopbackTickIndexAt(const LoopbackDisplayModeInfo* mode, int64_t timeNs);
+
+// Number of sample frames at 48kHz belonging to frame tick 'tick', counted from 'startTick'
+uint32_t	LoopbackAudioSamplesForTick(const LoopbackDisplayModeInfo* mode, int64_t startTick, int64_t tick);
+
+// What the input connector of a device currently sees
+struct LoopbackInputSignal
+{
+	const LoopbackDisplayModeInfo*	mode;
+	IDeckLinkVideoFrame*			frame;				// AddRef'd, may be NULL (black)
+	std::vector<uint8_t>			audio;
+	uint32_t						audioSampleFrames;
+	BMDAudioSampleType				audioSampleType;
+	uint32_t						audioChannelCount;
+};
+
+class LoopbackProfileAttributes : public IDeckLinkProfileAttributes
+{
+public:
+	LoopbackProfileAttributes(LoopbackDevice* device) : m_device(device) {}
+
+	// IDeckLinkProfileAttributes interface
+	virtual HRESULT		STDMETHODCALLTYPE	GetFlag(BMDDeckLinkAttributeID cfgID, bool* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetInt(BMDDeckLinkAttributeID cfgID, int64_t* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetFloat(BMDDeckLinkAttributeID cfgID, double* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetString(BMDDeckLinkAttributeID cfgID, const char** value);
+
+	// IUnknown interface, delegated to the device
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	LoopbackDevice*		m_device;
+};
+
+class LoopbackConfiguration : public IDeckLinkConfiguration
+{
+public:
+	LoopbackConfiguration(LoopbackDevice* device);
+
+	// IDeckLinkConfiguration interface
+	virtual HRESULT		STDMETHODCALLTYPE	SetFlag(BMDDeckLinkConfigurationID cfgID, bool value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetFlag(BMDDeckLinkConfigurationID cfgID, bool* value);
+	virtual HRESULT		STDMETHODCALLTYPE	SetInt(BMDDeckLinkConfigurationID cfgID, int64_t value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetInt(BMDDeckLinkConfigurationID cfgID, int64_t* value);
+	virtual HRESULT		STDMETHODCALLTYPE	SetFloat(BMDDeckLinkConfigurationID cfgID, double value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetFloat(BMDDeckLinkConfigurationID cfgID, double* value);
+	virtual HRESULT		STDMETHODCALLTYPE	SetString(BMDDeckLinkConfigurationID cfgID, const char* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetString(BMDDeckLinkConfigurationID cfgID, const char** value);
+	virtual HRESULT		STDMETHODCALLTYPE	WriteConfigurationToPreferences(void);
+
+	// IUnknown interface, delegated to the device
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	LoopbackDevice*										m_device;
+	std::mutex											m_mutex;
+	std::map<BMDDeckLinkConfigurationID, bool>			m_flags;
+	std::map<BMDDeckLinkConfigurationID, int64_t>		m_ints;
+	std::map<BMDDeckLinkConfigurationID, double>		m_floats;
+	std::map<BMDDeckLinkConfigurationID, std::string>	m_strings;
+};
+
+class LoopbackStatus : public IDeckLinkStatus
+{
+public:
+	LoopbackStatus(LoopbackDevice* device) : m_device(device) {}
+
+	// IDeckLinkStatus interface
+	virtual HRESULT		STDMETHODCALLTYPE	GetFlag(BMDDeckLinkStatusID statusID, bool* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetInt(BMDDeckLinkStatusID statusID, int64_t* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetFloat(BMDDeckLinkStatusID statusID, double* value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetString(BMDDeckLinkStatusID statusID, const char** value);
+	virtual HRESULT		STDMETHODCALLTYPE	GetBytes(BMDDeckLinkStatusID statusID, void* buffer, uint32_t* bufferSize);
+
+	// IUnknown interface, delegated to the device
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	LoopbackDevice*		m_device;
+};
+
+class LoopbackNotification : public IDeckLinkNotification
+{
+public:
+	LoopbackNotification(LoopbackDevice* device) : m_device(device) {}
+
+	// Deliver a notification to every subscriber of the topic, on the notification thread
+	void				Notify(BMDNotifications topic, uint64_t param1, uint64_t param2);
+
+	// IDeckLinkNotification interface
+	virtual HRESULT		STDMETHODCALLTYPE	Subscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback);
+	virtual HRESULT		STDMETHODCALLTYPE	Unsubscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback);
+
+	// IUnknown interface, delegated to the device
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	struct Subscription
+	{
+		BMDNotifications					topic;
+		IDeckLinkNotificationCallback*		callback;
+	};
+
+	LoopbackDevice*					m_device;
+	std::mutex						m_mutex;
+	std::vector<Subscription>		m_subscriptions;
+	LoopbackDispatchQueue			m_queue;
+};
+
+// A virtual DeckLink device with one input and one output. Frames displayed
+// by the output are looped back to the input of the same device; when the
+// output is idle the input can be fed by a built-in test signal instead.
+// Devices are created on first use and live for the rest of the process.
+class LoopbackDevice : public IDeckLink
+{
+public:
+	static unsigned			GetDeviceCount(void);
+	static LoopbackDevice*	GetDevice(unsigned index);
+
+	unsigned				Index(void) const				{ return m_index; }
+	LoopbackOutput*			Output(void)					{ return m_output; }
+	LoopbackInput*			Input(void)						{ return m_input; }
+	LoopbackConfiguration*	Configuration(void)				{ return &m_configuration; }
+
+	// Called by the output and input when their display mode or running state changes
+	void					ClockModeChanged(void);
+	void					StatusChanged(BMDDeckLinkStatusID statusID);
+
+	bool					GetInputSignal(BMDDisplayMode inputMode, LoopbackInputSignal* signal);
+	BMDDisplayMode			GetDetectedInputMode(void);
+
+	// IDeckLink interface
+	virtual HRESULT			STDMETHODCALLTYPE	GetModelName(const char** modelName);
+	virtual HRESULT			STDMETHODCALLTYPE	GetDisplayName(const char** displayName);
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG			STDMETHODCALLTYPE	AddRef();
+	virtual ULONG			STDMETHODCALLTYPE	Release();
+
+private:
+	LoopbackDevice(unsigned index);
+	virtual ~LoopbackDevice() {}
+
+	void					clockThread(void);
+
+	unsigned					m_index;
+	std::atomic<ULONG>			m_refCount;
+
+	LoopbackOutput*				m_output;
+	LoopbackInput*				m_input;
+	LoopbackProfileAttributes	m_attributes;
+	LoopbackConfiguration		m_configuration;
+	LoopbackStatus				m_status;
+	LoopbackNotification		m_notification;
+
+	std::mutex					m_clockMutex;
+	std::condition_variable		m_clockCondition;
+	bool						m_clockChanged;
+};
@@ -0,0 +1,91 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include "LoopbackDispatchQueue.h"
+
+LoopbackDispatchQueue::LoopbackDispatchQueue() :
+	m_busy(false), m_started(false)
+{
+}
+
+void LoopbackDispatchQueue::Post(std::function<void()> work)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_started)
+	{
+		std::thread thread(&LoopbackDispatchQueue::threadMain, this);
+
+		// Queues are owned by devices that are never destroyed
+		m_threadId = thread.get_id();
+		thread.detach();
+		m_started = true;
+	}
+
+	m_work.push_back(std::move(work));
+	m_workCondition.notify_one();
+}
+
+size_t LoopbackDispatchQueue::Pending(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_work.size() + (m_busy ? 1 : 0);
+}
+
+void LoopbackDispatchQueue::Drain(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idleCondition.wait(lock, [this]{ return m_work.empty() && !m_busy; });
+}
+
+bool LoopbackDispatchQueue::IsCurrentThread(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_started && (m_threadId == std::this_thread::get_id());
+}
+
+void LoopbackDispatchQueue::threadMain(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_workCondition.wait(lock, [this]{ return !m_work.empty(); });
+
+		std::function<void()> work = std::move(m_work.front());
+		m_work.pop_front();
+		m_busy = true;
+
+		lock.unlock();
+		work();
+		lock.lock();
+
+		m_busy = false;
+		if (m_work.empty())
+			m_idleCondition.notify_all();
+	}
+}
@@ -0,0 +1,61 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Serial work queue with its own thread, used to deliver application callbacks
+// without holding any driver locks. The thread is started on first use and
+// lives for the rest of the process, like the hardware driver's callback threads.
+class LoopbackDispatchQueue
+{
+public:
+	LoopbackDispatchQueue();
+
+	void		Post(std::function<void()> work);
+	size_t		Pending(void);
+
+	// Blocks until everything posted so far has run. Must not be called from the queue thread.
+	void		Drain(void);
+	bool		IsCurrentThread(void);
+
+private:
+	void		threadMain(void);
+
+	std::mutex							m_mutex;
+	std::condition_variable				m_workCondition;
+	std::condition_variable				m_idleCondition;
+	std::deque<std::function<void()>>	m_work;
+	bool								m_busy;
+	bool								m_started;
+	std::thread::id						m_threadId;
+};
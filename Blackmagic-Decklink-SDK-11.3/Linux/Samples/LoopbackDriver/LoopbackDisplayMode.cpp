@@ -0,0 +1,248 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "LoopbackDisplayMode.h"
+
+#define kSDFlags	(bmdDisplayModeColorspaceRec601)
+#define kHDFlags	(bmdDisplayModeColorspaceRec709)
+#define kUHDFlags	(bmdDisplayModeColorspaceRec709 | bmdDisplayModeColorspaceRec2020)
+
+static const LoopbackDisplayModeInfo kDisplayModes[] =
+{
+	{ bmdModeNTSC,			"NTSC",			720,	486,	1001,	30000,	bmdLowerFieldFirst,		kSDFlags },
+	{ bmdModePAL,			"PAL",			720,	576,	1000,	25000,	bmdUpperFieldFirst,		kSDFlags },
+	{ bmdModeHD720p50,		"720p50",		1280,	720,	1000,	50000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD720p5994,	"720p59.94",	1280,	720,	1001,	60000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD720p60,		"720p60",		1280,	720,	1000,	60000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p2398,	"1080p23.98",	1920,	1080,	1001,	24000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p24,		"1080p24",		1920,	1080,	1000,	24000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p25,		"1080p25",		1920,	1080,	1000,	25000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p2997,	"1080p29.97",	1920,	1080,	1001,	30000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p30,		"1080p30",		1920,	1080,	1000,	30000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080i50,		"1080i50",		1920,	1080,	1000,	25000,	bmdUpperFieldFirst,		kHDFlags },
+	{ bmdModeHD1080i5994,	"1080i59.94",	1920,	1080,	1001,	30000,	bmdUpperFieldFirst,		kHDFlags },
+	{ bmdModeHD1080i6000,	"1080i60",		1920,	1080,	1000,	30000,	bmdUpperFieldFirst,		kHDFlags },
+	{ bmdModeHD1080p50,		"1080p50",		1920,	1080,	1000,	50000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p5994,	"1080p59.94",	1920,	1080,	1001,	60000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdModeHD1080p6000,	"1080p60",		1920,	1080,	1000,	60000,	bmdProgressiveFrame,	kHDFlags },
+	{ bmdMode4K2160p2398,	"2160p23.98",	3840,	2160,	1001,	24000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p24,		"2160p24",		3840,	2160,	1000,	24000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p25,		"2160p25",		3840,	2160,	1000,	25000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p2997,	"2160p29.97",	3840,	2160,	1001,	30000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p30,		"2160p30",		3840,	2160,	1000,	30000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p50,		"2160p50",		3840,	2160,	1000,	50000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p5994,	"2160p59.94",	3840,	2160,	1001,	60000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode4K2160p60,		"2160p60",		3840,	2160,	1000,	60000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p2398,	"4320p23.98",	7680,	4320,	1001,	24000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p24,		"4320p24",		7680,	4320,	1000,	24000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p25,		"4320p25",		7680,	4320,	1000,	25000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p2997,	"4320p29.97",	7680,	4320,	1001,	30000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p30,		"4320p30",		7680,	4320,	1000,	30000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p50,		"4320p50",		7680,	4320,	1000,	50000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p5994,	"4320p59.94",	7680,	4320,	1001,	60000,	bmdProgressiveFrame,	kUHDFlags },
+	{ bmdMode8K4320p60,		"4320p60",		7680,	4320,	1000,	60000,	bmdProgressiveFrame,	kUHDFlags },
+};
+
+unsigned GetLoopbackDisplayModeCount(void)
+{
+	return sizeof(kDisplayModes) / sizeof(kDisplayModes[0]);
+}
+
+const LoopbackDisplayModeInfo* GetLoopbackDisplayModeInfo(unsigned index)
+{
+	if (index >= GetLoopbackDisplayModeCount())
+		return NULL;
+
+	return &kDisplayModes[index];
+}
+
+const LoopbackDisplayModeInfo* FindLoopbackDisplayModeInfo(BMDDisplayMode displayMode)
+{
+	for (unsigned i = 0; i < GetLoopbackDisplayModeCount(); i++)
+	{
+		if (kDisplayModes[i].displayMode == displayMode)
+			return &kDisplayModes[i];
+	}
+
+	return NULL;
+}
+
+bool IsLoopbackPixelFormatSupported(BMDPixelFormat pixelFormat)
+{
+	return GetLoopbackRowBytes(pixelFormat, 1) > 0;
+}
+
+long GetLoopbackRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	// Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return width * 2;
+
+		case bmdFormat10BitYUV:
+			return ((width + 47) / 48) * 128;
+
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+			return width * 4;
+
+		case bmdFormat10BitRGB:
+		case bmdFormat10BitRGBXLE:
+		case bmdFormat10BitRGBX:
+			return ((width + 63) / 64) * 256;
+
+		case bmdFormat12BitRGB:
+		case bmdFormat12BitRGBLE:
+			return ((width + 7) / 8) * 36;
+
+		default:
+			return 0;
+	}
+}
+
+/* LoopbackDisplayMode class */
+
+LoopbackDisplayMode::LoopbackDisplayMode(const LoopbackDisplayModeInfo* info) :
+	m_info(info), m_refCount(1)
+{
+}
+
+HRESULT LoopbackDisplayMode::GetName(const char** name)
+{
+	if (name == NULL)
+		return E_POINTER;
+
+	// As with the hardware driver, the caller owns the returned string
+	*name = strdup(m_info->name);
+	return S_OK;
+}
+
+HRESULT LoopbackDisplayMode::GetFrameRate(BMDTimeValue* frameDuration, BMDTimeScale* timeScale)
+{
+	if (frameDuration)
+		*frameDuration = m_info->frameDuration;
+	if (timeScale)
+		*timeScale = m_info->timeScale;
+
+	return S_OK;
+}
+
+HRESULT LoopbackDisplayMode::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkDisplayMode, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkDisplayMode*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackDisplayMode::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackDisplayMode::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* LoopbackDisplayModeIterator class */
+
+LoopbackDisplayModeIterator::LoopbackDisplayModeIterator() :
+	m_index(0), m_refCount(1)
+{
+}
+
+HRESULT LoopbackDisplayModeIterator::Next(IDeckLinkDisplayMode** deckLinkDisplayMode)
+{
+	const LoopbackDisplayModeInfo*	info;
+
+	if (deckLinkDisplayMode == NULL)
+		return E_POINTER;
+
+	*deckLinkDisplayMode = NULL;
+
+	info = GetLoopbackDisplayModeInfo(m_index);
+	if (info == NULL)
+		return S_FALSE;
+
+	m_index++;
+	*deckLinkDisplayMode = new LoopbackDisplayMode(info);
+	return S_OK;
+}
+
+HRESULT LoopbackDisplayModeIterator::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkDisplayModeIterator, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkDisplayModeIterator*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackDisplayModeIterator::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackDisplayModeIterator::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
@@ -0,0 +1,95 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include "DeckLinkAPI.h"
+
+// Static description of a display mode presented by the loopback devices
+struct LoopbackDisplayModeInfo
+{
+	BMDDisplayMode			displayMode;
+	const char*				name;
+	long					width;
+	long					height;
+	BMDTimeValue			frameDuration;
+	BMDTimeScale			timeScale;
+	BMDFieldDominance		fieldDominance;
+	BMDDisplayModeFlags		flags;
+};
+
+unsigned						GetLoopbackDisplayModeCount(void);
+const LoopbackDisplayModeInfo*	GetLoopbackDisplayModeInfo(unsigned index);
+const LoopbackDisplayModeInfo*	FindLoopbackDisplayModeInfo(BMDDisplayMode displayMode);
+
+bool	IsLoopbackPixelFormatSupported(BMDPixelFormat pixelFormat);
+long	GetLoopbackRowBytes(BMDPixelFormat pixelFormat, long width);
+
+class LoopbackDisplayMode : public IDeckLinkDisplayMode
+{
+public:
+	LoopbackDisplayMode(const LoopbackDisplayModeInfo* info);
+	virtual ~LoopbackDisplayMode() {}
+
+	// IDeckLinkDisplayMode interface
+	virtual HRESULT				STDMETHODCALLTYPE	GetName(const char** name);
+	virtual BMDDisplayMode		STDMETHODCALLTYPE	GetDisplayMode(void)		{ return m_info->displayMode; }
+	virtual long				STDMETHODCALLTYPE	GetWidth(void)				{ return m_info->width; }
+	virtual long				STDMETHODCALLTYPE	GetHeight(void)				{ return m_info->height; }
+	virtual HRESULT				STDMETHODCALLTYPE	GetFrameRate(BMDTimeValue* frameDuration, BMDTimeScale* timeScale);
+	virtual BMDFieldDominance	STDMETHODCALLTYPE	GetFieldDominance(void)		{ return m_info->fieldDominance; }
+	virtual BMDDisplayModeFlags	STDMETHODCALLTYPE	GetFlags(void)				{ return m_info->flags; }
+
+	// IUnknown interface
+	virtual HRESULT				STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG				STDMETHODCALLTYPE	AddRef();
+	virtual ULONG				STDMETHODCALLTYPE	Release();
+
+private:
+	const LoopbackDisplayModeInfo*	m_info;
+	std::atomic<ULONG>				m_refCount;
+};
+
+class LoopbackDisplayModeIterator : public IDeckLinkDisplayModeIterator
+{
+public:
+	LoopbackDisplayModeIterator();
+	virtual ~LoopbackDisplayModeIterator() {}
+
+	// IDeckLinkDisplayModeIterator interface
+	virtual HRESULT				STDMETHODCALLTYPE	Next(IDeckLinkDisplayMode** deckLinkDisplayMode);
+
+	// IUnknown interface
+	virtual HRESULT				STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG				STDMETHODCALLTYPE	AddRef();
+	virtual ULONG				STDMETHODCALLTYPE	Release();
+
+private:
+	unsigned					m_index;
+	std::atomic<ULONG>			m_refCount;
+};
@@ -0,0 +1,782 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "LoopbackInput.h"
+#include "LoopbackMemoryAllocator.h"
+#include "LoopbackVideoFrame.h"
+
+// Frames waiting for a slow client beyond this depth are dropped, as the hardware would
+static const uint32_t	kMaxPendingFrames	= 8;
+
+static bool isRGBPixelFormat(BMDPixelFormat pixelFormat)
+{
+	return (pixelFormat != bmdFormat8BitYUV) && (pixelFormat != bmdFormat10BitYUV);
+}
+
+static void fillBlack(void* buffer, BMDPixelFormat pixelFormat, long rowBytes, long height)
+{
+	uint32_t*	nextWord = (uint32_t*)buffer;
+	size_t		wordsRemaining = (size_t)(rowBytes * height) / 4;
+
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			while (wordsRemaining-- > 0)
+				*(nextWord++) = 0x10801080;
+			break;
+
+		case bmdFormat10BitYUV:
+			// v210 rows are a multiple of 128 bytes, so each group of four words is complete
+			for (size_t i = 0; i + 4 <= wordsRemaining; i += 4)
+			{
+				nextWord[i + 0] = 0x20010200;
+				nextWord[i + 1] = 0x04080040;
+				nextWord[i + 2] = 0x20010200;
+				nextWord[i + 3] = 0x04080040;
+			}
+			break;
+
+		default:
+			memset(buffer, 0, (size_t)(rowBytes * height));
+			break;
+	}
+}
+
+static void copyAudio(const LoopbackInputSignal* signal, void* destination, uint32_t sampleFrames, BMDAudioSampleType sampleType, uint32_t channelCount)
+{
+	uint32_t	framesToCopy = std::min(sampleFrames, signal->audioSampleFrames);
+	uint32_t	channelsToCopy = std::min(channelCount, signal->audioChannelCount);
+	const uint8_t*	source = signal->audio.data();
+
+	for (uint32_t frame = 0; frame < framesToCopy; frame++)
+	{
+		for (uint32_t channel = 0; channel < channelsToCopy; channel++)
+		{
+			size_t	sourceIndex = (size_t)frame * signal->audioChannelCount + channel;
+			size_t	destinationIndex = (size_t)frame * channelCount + channel;
+			int32_t	sample;
+
+			if (signal->audioSampleType == bmdAudioSampleType16bitInteger)
+				sample = (int32_t)((const int16_t*)source)[sourceIndex] << 16;
+			else
+				sample = ((const int32_t*)source)[sourceIndex];
+
+			if (sampleType == bmdAudioSampleType16bitInteger)
+				((int16_t*)destination)[destinationIndex] = (int16_t)(sample >> 16);
+			else
+				((int32_t*)destination)[destinationIndex] = sample;
+		}
+	}
+}
+
+LoopbackInput::LoopbackInput(LoopbackDevice* device) :
+	m_device(device), m_refCount(0),
+	m_callback(NULL), m_allocator(NULL), m_defaultAllocator(new LoopbackMemoryAllocator()),
+	m_videoEnabled(false), m_mode(NULL), m_pixelFormat(bmdFormat8BitYUV), m_inputFlags(bmdVideoInputFlagDefault), m_reportedMode(NULL),
+	m_audioEnabled(false), m_audioSampleType(bmdAudioSampleType16bitInteger), m_audioChannelCount(0),
+	m_streaming(false), m_paused(false), m_startTick(0), m_streamGeneration(0), m_pendingFrames(0), m_droppedFrames(0)
+{
+}
+
+/* Driver interface */
+
+const LoopbackDisplayModeInfo* LoopbackInput::ClockMode(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_mode : NULL;
+}
+
+void LoopbackInput::ProcessTick(int64_t tick, int64_t tickTimeNs)
+{
+	LoopbackInputSignal			signal;
+	BMDDisplayMode				inputMode;
+	bool						hasSignal;
+
+	signal.mode = NULL;
+	signal.frame = NULL;
+	signal.audioSampleFrames = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_videoEnabled || !m_streaming || m_paused || (tick <= m_startTick))
+			return;
+
+		inputMode = m_mode->displayMode;
+	}
+
+	// Sample the connector without holding our lock, the output may be on another device
+	hasSignal = m_device->GetInputSignal(inputMode, &signal);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_videoEnabled && m_streaming && !m_paused && (tick > m_startTick))
+		{
+			LoopbackVideoInputFrame*	videoFrame;
+			LoopbackAudioInputPacket*	audioPacket;
+
+			if (hasSignal && (signal.mode != m_mode))
+			{
+				if (m_inputFlags & bmdVideoInputEnableFormatDetection)
+					postFormatChangedLocked(&signal);
+
+				// The signal cannot be decoded in the enabled mode
+				hasSignal = false;
+			}
+
+			videoFrame = captureFrameLocked(tick, hasSignal ? &signal : NULL);
+			audioPacket = captureAudioLocked(tick, hasSignal ? &signal : NULL);
+			postFrameLocked(videoFrame, audioPacket);
+		}
+	}
+
+	if (signal.frame != NULL)
+		signal.frame->Release();
+}
+
+BMDDisplayMode LoopbackInput::CurrentMode(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_mode->displayMode : bmdModeUnknown;
+}
+
+BMDPixelFormat LoopbackInput::CurrentPixelFormat(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_pixelFormat : bmdFormatUnspecified;
+}
+
+BMDVideoInputFlags LoopbackInput::CurrentFlags(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_inputFlags : bmdVideoInputFlagDefault;
+}
+
+bool LoopbackInput::IsBusy(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled || m_audioEnabled;
+}
+
+void LoopbackInput::JoinGroupStart(int64_t group, const LoopbackDisplayModeInfo* mode, int64_t startTick)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int64_t	ourGroup;
+
+		if (!m_videoEnabled || (m_streaming && !m_paused) || (m_mode != mode))
+			return;
+
+		if (!isGroupedLocked(&ourGroup) || (ourGroup != group))
+			return;
+
+		startLocked(startTick);
+	}
+
+	m_device->ClockModeChanged();
+}
+
+void LoopbackInput::JoinGroupStop(int64_t group)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int64_t	ourGroup;
+
+		if (!m_streaming)
+			return;
+
+		if (!isGroupedLocked(&ourGroup) || (ourGroup != group))
+			return;
+
+		m_streaming = false;
+		m_paused = false;
+		m_streamGeneration++;
+	}
+
+	m_device->ClockModeChanged();
+	waitForCallbacks();
+}
+
+/* Internal helpers, m_mutex must be held */
+
+bool LoopbackInput::isGroupedLocked(int64_t* group)
+{
+	if ((m_inputFlags & bmdVideoInputSynchronizeToCaptureGroup) == 0)
+		return false;
+
+	if (m_device->Configuration()->GetInt(bmdDeckLinkConfigCaptureGroup, group) != S_OK)
+		return false;
+
+	return *group != 0;
+}
+
+void LoopbackInput::startLocked(int64_t startTick)
+{
+	m_streaming = true;
+	m_paused = false;
+	m_startTick = startTick;
+}
+
+LoopbackVideoInputFrame* LoopbackInput::captureFrameLocked(int64_t tick, const LoopbackInputSignal* signal)
+{
+	LoopbackVideoInputFrame*	videoFrame;
+	IDeckLinkMemoryAllocator*	allocator = (m_allocator != NULL) ? m_allocator : m_defaultAllocator;
+	long						rowBytes = GetLoopbackRowBytes(m_pixelFormat, m_mode->width);
+	BMDFrameFlags				flags = (signal != NULL) ? bmdFrameFlagDefault : bmdFrameHasNoInputSource;
+	void*						bytes;
+
+	// The frame delivered on a tick is the one received during the preceding frame period
+	videoFrame = new LoopbackVideoInputFrame(m_mode->width, m_mode->height, rowBytes, m_pixelFormat, flags,
+											 (tick - 1 - m_startTick) * m_mode->frameDuration, m_mode->frameDuration, m_mode->timeScale,
+											 LoopbackTickTimeNs(m_mode, tick - 1));
+
+	if (videoFrame->Allocate(allocator) != S_OK)
+	{
+		videoFrame->Release();
+		return NULL;
+	}
+
+	videoFrame->GetBytes(&bytes);
+
+	IDeckLinkVideoFrame* source = (signal != NULL) ? signal->frame : NULL;
+	void* sourceBytes = NULL;
+
+	if ((source != NULL) &&
+		(source->GetPixelFormat() == m_pixelFormat) &&
+		(source->GetWidth() == m_mode->width) && (source->GetHeight() == m_mode->height) &&
+		(source->GetBytes(&sourceBytes) == S_OK) && (sourceBytes != NULL))
+	{
+		long sourceRowBytes = source->GetRowBytes();
+
+		if (sourceRowBytes == rowBytes)
+		{
+			memcpy(bytes, sourceBytes, (size_t)(rowBytes * m_mode->height));
+		}
+		else
+		{
+			long copyBytes = std::min(rowBytes, sourceRowBytes);
+			for (long y = 0; y < m_mode->height; y++)
+				memcpy((uint8_t*)bytes + y * rowBytes, (uint8_t*)sourceBytes + y * sourceRowBytes, copyBytes);
+		}
+
+		videoFrame->Store().CopyMetadataFrom(source);
+	}
+	else
+	{
+		// No signal, a test signal, or a pixel format this loopback does not convert
+		fillBlack(bytes, m_pixelFormat, rowBytes, m_mode->height);
+
+		if (source != NULL)
+			videoFrame->Store().CopyMetadataFrom(source);
+	}
+
+	return videoFrame;
+}
+
+LoopbackAudioInputPacket* LoopbackInput::captureAudioLocked(int64_t tick, const LoopbackInputSignal* signal)
+{
+	LoopbackAudioInputPacket*	audioPacket;
+	uint32_t					sampleFrames;
+	uint32_t					bytesPerSampleFrame;
+	BMDTimeValue				packetTime;
+
+	if (!m_audioEnabled)
+		return NULL;
+
+	sampleFrames = LoopbackAudioSamplesForTick(m_mode, m_startTick + 1, tick);
+	bytesPerSampleFrame = m_audioChannelCount * (m_audioSampleType / 8);
+	packetTime = LoopbackRescaleTime((tick - 1 - m_startTick) * m_mode->frameDuration, m_mode->timeScale, bmdAudioSampleRate48kHz);
+
+	audioPacket = new LoopbackAudioInputPacket(sampleFrames, bytesPerSampleFrame, packetTime, bmdAudioSampleRate48kHz);
+
+	if ((signal != NULL) && (signal->audioSampleFrames > 0))
+		copyAudio(signal, audioPacket->Bytes(), sampleFrames, m_audioSampleType, m_audioChannelCount);
+
+	return audioPacket;
+}
+
+void LoopbackInput::postFormatChangedLocked(const LoopbackInputSignal* signal)
+{
+	BMDVideoInputFormatChangedEvents	events = bmdVideoInputDisplayModeChanged;
+	BMDDetectedVideoInputFormatFlags	detectedFlags = bmdDetectedVideoInputYCbCr422;
+	const LoopbackDisplayModeInfo*		newMode = signal->mode;
+
+	// Report each change once, until the client switches mode
+	if (newMode == m_reportedMode)
+		return;
+
+	if (newMode->fieldDominance != m_mode->fieldDominance)
+		events |= bmdVideoInputFieldDominanceChanged;
+
+	if ((signal->frame != NULL) && isRGBPixelFormat(signal->frame->GetPixelFormat()))
+	{
+		detectedFlags = bmdDetectedVideoInputRGB444;
+		if (!isRGBPixelFormat(m_pixelFormat))
+			events |= bmdVideoInputColorspaceChanged;
+	}
+	else if (isRGBPixelFormat(m_pixelFormat))
+	{
+		events |= bmdVideoInputColorspaceChanged;
+	}
+
+	m_reportedMode = newMode;
+
+	m_callbackQueue.Post([this, events, newMode, detectedFlags]() {
+		IDeckLinkInputCallback* callback;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			callback = m_callback;
+			if (callback != NULL)
+				callback->AddRef();
+		}
+
+		if (callback != NULL)
+		{
+			LoopbackDisplayMode* displayMode = new LoopbackDisplayMode(newMode);
+			callback->VideoInputFormatChanged(events, displayMode, detectedFlags);
+			displayMode->Release();
+			callback->Release();
+		}
+	});
+}
+
+void LoopbackInput::postFrameLocked(LoopbackVideoInputFrame* videoFrame, LoopbackAudioInputPacket* audioPacket)
+{
+	uint32_t generation = m_streamGeneration;
+
+	if ((videoFrame == NULL) || (m_pendingFrames >= kMaxPendingFrames))
+	{
+		m_droppedFrames++;
+
+		if (videoFrame != NULL)
+			videoFrame->Release();
+		if (audioPacket != NULL)
+			audioPacket->Release();
+		return;
+	}
+
+	m_pendingFrames++;
+
+	m_callbackQueue.Post([this, videoFrame, audioPacket, generation]() {
+		IDeckLinkInputCallback* callback = NULL;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (generation == m_streamGeneration)
+			{
+				callback = m_callback;
+				if (callback != NULL)
+					callback->AddRef();
+			}
+		}
+
+		if (callback != NULL)
+		{
+			callback->VideoInputFrameArrived(videoFrame, audioPacket);
+			callback->Release();
+		}
+
+		videoFrame->Release();
+		if (audioPacket != NULL)
+			audioPacket->Release();
+
+		m_pendingFrames--;
+	});
+}
+
+void LoopbackInput::waitForCallbacks(void)
+{
+	// Once streams are stopped no further frames may be delivered, unless the
+	// request came from inside a callback, which cannot wait for itself
+	if (!m_callbackQueue.IsCurrentThread())
+		m_callbackQueue.Drain();
+}
+
+void LoopbackInput::reset(void)
+{
+	IDeckLinkInputCallback*		callback;
+	IDeckLinkMemoryAllocator*	allocator;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_streaming = false;
+		m_paused = false;
+		m_streamGeneration++;
+		m_videoEnabled = false;
+		m_mode = NULL;
+		m_audioEnabled = false;
+
+		callback = m_callback;
+		allocator = m_allocator;
+		m_callback = NULL;
+		m_allocator = NULL;
+	}
+
+	m_device->ClockModeChanged();
+	m_device->StatusChanged(bmdDeckLinkStatusCurrentVideoInputMode);
+	waitForCallbacks();
+
+	if (callback != NULL)
+		callback->Release();
+	if (allocator != NULL)
+		allocator->Release();
+}
+
+/* IDeckLinkInput interface */
+
+HRESULT LoopbackInput::DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat, BMDSupportedVideoModeFlags flags, bool* supported)
+{
+	if (supported == NULL)
+		return E_POINTER;
+
+	*supported = (FindLoopbackDisplayModeInfo(requestedMode) != NULL) &&
+				 ((requestedPixelFormat == bmdFormatUnspecified) || IsLoopbackPixelFormatSupported(requestedPixelFormat));
+
+	return S_OK;
+}
+
+HRESULT LoopbackInput::GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode)
+{
+	const LoopbackDisplayModeInfo* info = FindLoopbackDisplayModeInfo(displayMode);
+
+	if (resultDisplayMode == NULL)
+		return E_POINTER;
+
+	*resultDisplayMode = NULL;
+
+	if (info == NULL)
+		return E_INVALIDARG;
+
+	*resultDisplayMode = new LoopbackDisplayMode(info);
+	return S_OK;
+}
+
+HRESULT LoopbackInput::GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator)
+{
+	if (iterator == NULL)
+		return E_POINTER;
+
+	*iterator = new LoopbackDisplayModeIterator();
+	return S_OK;
+}
+
+HRESULT LoopbackInput::SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT LoopbackInput::EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags)
+{
+	const LoopbackDisplayModeInfo* mode = FindLoopbackDisplayModeInfo(displayMode);
+
+	if ((mode == NULL) || !IsLoopbackPixelFormatSupported(pixelFormat))
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_videoEnabled = true;
+		m_mode = mode;
+		m_pixelFormat = pixelFormat;
+		m_inputFlags = flags;
+		m_reportedMode = mode;
+	}
+
+	m_device->ClockModeChanged();
+	m_device->StatusChanged(bmdDeckLinkStatusCurrentVideoInputMode);
+	m_device->StatusChanged(bmdDeckLinkStatusDetectedVideoInputMode);
+	return S_OK;
+}
+
+HRESULT LoopbackInput::DisableVideoInput(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_videoEnabled)
+			return S_OK;
+
+		m_streaming = false;
+		m_paused = false;
+		m_streamGeneration++;
+		m_videoEnabled = false;
+		m_mode = NULL;
+	}
+
+	m_device->ClockModeChanged();
+	m_device->StatusChanged(bmdDeckLinkStatusCurrentVideoInputMode);
+	m_device->StatusChanged(bmdDeckLinkStatusDetectedVideoInputMode);
+	waitForCallbacks();
+	return S_OK;
+}
+
+HRESULT LoopbackInput::GetAvailableVideoFrameCount(uint32_t* availableFrameCount)
+{
+	if (availableFrameCount == NULL)
+		return E_POINTER;
+
+	*availableFrameCount = m_pendingFrames;
+	return S_OK;
+}
+
+HRESULT LoopbackInput::SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator)
+{
+	IDeckLinkMemoryAllocator* previous;
+
+	if (theAllocator != NULL)
+		theAllocator->AddRef();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		previous = m_allocator;
+		m_allocator = theAllocator;
+	}
+
+	if (previous != NULL)
+		previous->Release();
+
+	return S_OK;
+}
+
+HRESULT LoopbackInput::EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (sampleRate != bmdAudioSampleRate48kHz)
+		return E_INVALIDARG;
+
+	if ((sampleType != bmdAudioSampleType16bitInteger) && (sampleType != bmdAudioSampleType32bitInteger))
+		return E_INVALIDARG;
+
+	if ((channelCount == 0) || (channelCount > 16))
+		return E_INVALIDARG;
+
+	m_audioEnabled = true;
+	m_audioSampleType = sampleType;
+	m_audioChannelCount = channelCount;
+	return S_OK;
+}
+
+HRESULT LoopbackInput::DisableAudioInput(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_audioEnabled = false;
+	return S_OK;
+}
+
+HRESULT LoopbackInput::GetAvailableAudioSampleFrameCount(uint32_t* availableSampleFrameCount)
+{
+	if (availableSampleFrameCount == NULL)
+		return E_POINTER;
+
+	// Audio is always delivered together with its video frame
+	*availableSampleFrameCount = 0;
+	return S_OK;
+}
+
+HRESULT LoopbackInput::StartStreams(void)
+{
+	const LoopbackDisplayModeInfo*	mode;
+	int64_t							startTick;
+	int64_t							group;
+	bool							grouped;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_videoEnabled)
+			return E_ACCESSDENIED;
+
+		if (m_streaming && !m_paused)
+			return E_ACCESSDENIED;
+
+		// Capture begins with the next complete frame period
+		mode = m_mode;
+		startTick = LoopbackTickIndexAt(mode, LoopbackNowNs()) + 1;
+		grouped = isGroupedLocked(&group);
+
+		startLocked(startTick);
+	}
+
+	m_device->ClockModeChanged();
+
+	if (grouped)
+	{
+		for (unsigned i = 0; i < LoopbackDevice::GetDeviceCount(); i++)
+		{
+			LoopbackDevice* device = LoopbackDevice::GetDevice(i);
+			if (device != m_device)
+				device->Input()->JoinGroupStart(group, mode, startTick);
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT LoopbackInput::StopStreams(void)
+{
+	int64_t		group;
+	bool		grouped;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_streaming)
+			return S_OK;
+
+		grouped = isGroupedLocked(&group);
+
+		m_streaming = false;
+		m_paused = false;
+		m_streamGeneration++;
+	}
+
+	m_device->ClockModeChanged();
+
+	if (grouped)
+	{
+		for (unsigned i = 0; i < LoopbackDevice::GetDeviceCount(); i++)
+		{
+			LoopbackDevice* device = LoopbackDevice::GetDevice(i);
+			if (device != m_device)
+				device->Input()->JoinGroupStop(group);
+		}
+	}
+
+	waitForCallbacks();
+	return S_OK;
+}
+
+HRESULT LoopbackInput::PauseStreams(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_streaming)
+			return E_ACCESSDENIED;
+
+		m_paused = true;
+	}
+
+	m_device->ClockModeChanged();
+	return S_OK;
+}
+
+HRESULT LoopbackInput::FlushStreams(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Frames already queued for delivery are discarded
+	m_streamGeneration++;
+	return S_OK;
+}
+
+HRESULT LoopbackInput::SetCallback(IDeckLinkInputCallback* theCallback)
+{
+	IDeckLinkInputCallback* previous;
+
+	if (theCallback != NULL)
+		theCallback->AddRef();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		previous = m_callback;
+		m_callback = theCallback;
+	}
+
+	if (previous != NULL)
+		previous->Release();
+
+	return S_OK;
+}
+
+HRESULT LoopbackInput::GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame)
+{
+	const LoopbackDisplayModeInfo*	mode;
+	int64_t							now = LoopbackNowNs();
+
+	if (desiredTimeScale == 0)
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		mode = m_videoEnabled ? m_mode : NULL;
+	}
+
+	if (hardwareTime != NULL)
+		*hardwareTime = LoopbackRescaleTime(now, 1000000000, desiredTimeScale);
+
+	if (timeInFrame != NULL)
+		*timeInFrame = (mode != NULL) ? LoopbackRescaleTime(now - LoopbackTickTimeNs(mode, LoopbackTickIndexAt(mode, now)), 1000000000, desiredTimeScale) : 0;
+
+	if (ticksPerFrame != NULL)
+		*ticksPerFrame = (mode != NULL) ? LoopbackRescaleTime(mode->frameDuration, mode->timeScale, desiredTimeScale) : 0;
+
+	return S_OK;
+}
+
+/* IUnknown interface */
+
+HRESULT LoopbackInput::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkInput, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkInput*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG LoopbackInput::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackInput::Release()
+{
+	// As with the output, the last client reference returns the input to idle
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		reset();
+
+	return newRefValue;
+}
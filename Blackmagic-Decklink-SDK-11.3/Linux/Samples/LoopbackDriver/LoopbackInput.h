@@ -0,0 +1,128 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include "DeckLinkAPI.h"
+#include "LoopbackDevice.h"
+#include "LoopbackDispatchQueue.h"
+
+class LoopbackVideoInputFrame;
+class LoopbackAudioInputPacket;
+
+class LoopbackInput : public IDeckLinkInput
+{
+public:
+	LoopbackInput(LoopbackDevice* device);
+
+	// Driver interface, called from the device clock thread
+	const LoopbackDisplayModeInfo*	ClockMode(void);
+	void							ProcessTick(int64_t tick, int64_t tickTimeNs);
+
+	// Status reporting
+	BMDDisplayMode					CurrentMode(void);
+	BMDPixelFormat					CurrentPixelFormat(void);
+	BMDVideoInputFlags				CurrentFlags(void);
+	bool							IsBusy(void);
+
+	// Capture group members are started and stopped together
+	void							JoinGroupStart(int64_t group, const LoopbackDisplayModeInfo* mode, int64_t startTick);
+	void							JoinGroupStop(int64_t group);
+
+	// IDeckLinkInput interface
+	virtual HRESULT		STDMETHODCALLTYPE	DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat, BMDSupportedVideoModeFlags flags, bool* supported);
+	virtual HRESULT		STDMETHODCALLTYPE	GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode);
+	virtual HRESULT		STDMETHODCALLTYPE	GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator);
+	virtual HRESULT		STDMETHODCALLTYPE	SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback);
+
+	virtual HRESULT		STDMETHODCALLTYPE	EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags);
+	virtual HRESULT		STDMETHODCALLTYPE	DisableVideoInput(void);
+	virtual HRESULT		STDMETHODCALLTYPE	GetAvailableVideoFrameCount(uint32_t* availableFrameCount);
+	virtual HRESULT		STDMETHODCALLTYPE	SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator);
+
+	virtual HRESULT		STDMETHODCALLTYPE	EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount);
+	virtual HRESULT		STDMETHODCALLTYPE	DisableAudioInput(void);
+	virtual HRESULT		STDMETHODCALLTYPE	GetAvailableAudioSampleFrameCount(uint32_t* availableSampleFrameCount);
+
+	virtual HRESULT		STDMETHODCALLTYPE	StartStreams(void);
+	virtual HRESULT		STDMETHODCALLTYPE	StopStreams(void);
+	virtual HRESULT		STDMETHODCALLTYPE	PauseStreams(void);
+	virtual HRESULT		STDMETHODCALLTYPE	FlushStreams(void);
+	virtual HRESULT		STDMETHODCALLTYPE	SetCallback(IDeckLinkInputCallback* theCallback);
+
+	virtual HRESULT		STDMETHODCALLTYPE	GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackInput() {}
+
+	// Helpers below require m_mutex to be held
+	bool						isGroupedLocked(int64_t* group);
+	void						startLocked(int64_t startTick);
+	LoopbackVideoInputFrame*	captureFrameLocked(int64_t tick, const LoopbackInputSignal* signal);
+	LoopbackAudioInputPacket*	captureAudioLocked(int64_t tick, const LoopbackInputSignal* signal);
+	void						postFormatChangedLocked(const LoopbackInputSignal* signal);
+	void						postFrameLocked(LoopbackVideoInputFrame* videoFrame, LoopbackAudioInputPacket* audioPacket);
+
+	void						waitForCallbacks(void);
+	void						reset(void);
+
+	LoopbackDevice*						m_device;
+	std::atomic<ULONG>					m_refCount;
+	std::mutex							m_mutex;
+	LoopbackDispatchQueue				m_callbackQueue;
+
+	IDeckLinkInputCallback*				m_callback;
+	IDeckLinkMemoryAllocator*			m_allocator;
+	IDeckLinkMemoryAllocator*			m_defaultAllocator;
+
+	// Video input state
+	bool								m_videoEnabled;
+	const LoopbackDisplayModeInfo*		m_mode;
+	BMDPixelFormat						m_pixelFormat;
+	BMDVideoInputFlags					m_inputFlags;
+	const LoopbackDisplayModeInfo*		m_reportedMode;
+
+	// Audio input state
+	bool								m_audioEnabled;
+	BMDAudioSampleType					m_audioSampleType;
+	uint32_t							m_audioChannelCount;
+
+	// Stream state; frames already queued for a previous generation are discarded
+	bool								m_streaming;
+	bool								m_paused;
+	int64_t								m_startTick;
+	uint32_t							m_streamGeneration;
+	std::atomic<uint32_t>				m_pendingFrames;
+	uint64_t							m_droppedFrames;
+};
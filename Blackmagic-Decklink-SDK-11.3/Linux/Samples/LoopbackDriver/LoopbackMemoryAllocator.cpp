@@ -0,0 +1,159 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "LoopbackMemoryAllocator.h"
+
+// Frame buffers are page aligned, matching the DMA requirements of the hardware driver
+static const size_t		kBufferAlignment	= 4096;
+static const size_t		kMaxFreeBuffers		= 32;
+
+LoopbackMemoryAllocator::LoopbackMemoryAllocator() :
+	m_refCount(1), m_freeBufferSize(0)
+{
+}
+
+LoopbackMemoryAllocator::~LoopbackMemoryAllocator()
+{
+	flushFreeList();
+
+	// Any buffers still outstanding are owned by frames that outlived us
+	for (auto& buffer : m_bufferSizes)
+		free(buffer.first);
+}
+
+HRESULT LoopbackMemoryAllocator::AllocateBuffer(uint32_t bufferSize, void** allocatedBuffer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (allocatedBuffer == NULL)
+		return E_POINTER;
+
+	*allocatedBuffer = NULL;
+
+	if (bufferSize != m_freeBufferSize)
+	{
+		flushFreeList();
+		m_freeBufferSize = bufferSize;
+	}
+
+	if (!m_freeBuffers.empty())
+	{
+		*allocatedBuffer = m_freeBuffers.back();
+		m_freeBuffers.pop_back();
+		return S_OK;
+	}
+
+	if (posix_memalign(allocatedBuffer, kBufferAlignment, bufferSize) != 0)
+	{
+		*allocatedBuffer = NULL;
+		return E_OUTOFMEMORY;
+	}
+
+	m_bufferSizes[*allocatedBuffer] = bufferSize;
+	return S_OK;
+}
+
+HRESULT LoopbackMemoryAllocator::ReleaseBuffer(void* buffer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_bufferSizes.find(buffer);
+
+	if (iter == m_bufferSizes.end())
+		return E_INVALIDARG;
+
+	if ((iter->second == m_freeBufferSize) && (m_freeBuffers.size() < kMaxFreeBuffers))
+	{
+		m_freeBuffers.push_back(buffer);
+	}
+	else
+	{
+		m_bufferSizes.erase(iter);
+		free(buffer);
+	}
+
+	return S_OK;
+}
+
+HRESULT LoopbackMemoryAllocator::Commit(void)
+{
+	return S_OK;
+}
+
+HRESULT LoopbackMemoryAllocator::Decommit(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	flushFreeList();
+	return S_OK;
+}
+
+void LoopbackMemoryAllocator::flushFreeList(void)
+{
+	// Caller must hold m_mutex
+	for (void* buffer : m_freeBuffers)
+	{
+		m_bufferSizes.erase(buffer);
+		free(buffer);
+	}
+
+	m_freeBuffers.clear();
+}
+
+HRESULT LoopbackMemoryAllocator::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkMemoryAllocator, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkMemoryAllocator*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackMemoryAllocator::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackMemoryAllocator::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
@@ -0,0 +1,66 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Default allocator used for frames created by LoopbackOutput::CreateVideoFrame
+// and for captured frames when the application has not installed its own.
+// Released buffers are kept on a free list while they match the most recently
+// requested size, so that steady-state streaming does not hit the heap.
+class LoopbackMemoryAllocator : public IDeckLinkMemoryAllocator
+{
+public:
+	LoopbackMemoryAllocator();
+
+	// IDeckLinkMemoryAllocator interface
+	virtual HRESULT		STDMETHODCALLTYPE	AllocateBuffer(uint32_t bufferSize, void** allocatedBuffer);
+	virtual HRESULT		STDMETHODCALLTYPE	ReleaseBuffer(void* buffer);
+	virtual HRESULT		STDMETHODCALLTYPE	Commit(void);
+	virtual HRESULT		STDMETHODCALLTYPE	Decommit(void);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackMemoryAllocator();
+
+	void				flushFreeList(void);
+
+	std::atomic<ULONG>				m_refCount;
+	std::mutex						m_mutex;
+	uint32_t						m_freeBufferSize;
+	std::vector<void*>				m_freeBuffers;
+	std::map<void*, uint32_t>		m_bufferSizes;
+};
@@ -0,0 +1,977 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "LoopbackOutput.h"
+#include "LoopbackMemoryAllocator.h"
+#include "LoopbackVideoFrame.h"
+
+static const uint32_t	kAudioRingSeconds		= 4;
+static const size_t		kMaxCompletionTimes		= 64;
+
+LoopbackOutput::LoopbackOutput(LoopbackDevice* device) :
+	m_device(device), m_refCount(0),
+	m_callback(NULL), m_audioCallback(NULL), m_allocator(NULL), m_defaultAllocator(new LoopbackMemoryAllocator()),
+	m_videoEnabled(false), m_mode(NULL), m_outputFlags(bmdVideoOutputFlagDefault),
+	m_onAirFrame(NULL), m_onAirScheduled(false), m_onAirLate(false), m_lastPixelFormat(bmdFormatUnspecified),
+	m_running(false), m_startTick(0), m_startStreamTime(0), m_playbackSpeed(1.0), m_stopPending(false), m_stopStreamTime(0),
+	m_audioEnabled(false), m_audioPrerolling(false), m_renderAudioPending(false),
+	m_audioSampleType(bmdAudioSampleType16bitInteger), m_audioChannelCount(0), m_audioFrameBytes(0),
+	m_audioRingFrames(0), m_audioReadIndex(0), m_audioBufferedFrames(0), m_playedAudioFrames(0)
+{
+}
+
+/* Driver interface */
+
+const LoopbackDisplayModeInfo* LoopbackOutput::ClockMode(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_mode : NULL;
+}
+
+void LoopbackOutput::ProcessTick(int64_t tick, int64_t tickTimeNs)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_videoEnabled)
+		return;
+
+	if (m_running && (tick >= m_startTick))
+	{
+		BMDTimeValue streamTime = m_startStreamTime + (BMDTimeValue)((tick - m_startTick) * m_mode->frameDuration * m_playbackSpeed);
+
+		if (m_stopPending && (streamTime >= m_stopStreamTime))
+		{
+			stopLocked(tickTimeNs);
+		}
+		else
+		{
+			ScheduledFrame	due = { NULL, 0, 0 };
+
+			// The latest frame whose display time has been reached goes on air;
+			// any earlier frames that were never displayed are dropped.
+			while (!m_scheduledFrames.empty() && (m_scheduledFrames.begin()->first <= streamTime))
+			{
+				if (due.frame != NULL)
+					completeFrameLocked(due.frame, bmdOutputFrameDropped, tickTimeNs);
+
+				due = m_scheduledFrames.begin()->second;
+				m_scheduledFrames.erase(m_scheduledFrames.begin());
+			}
+
+			// On underrun the previous frame is repeated
+			if (due.frame != NULL)
+				replaceOnAirLocked(due.frame, true, due.displayTime < streamTime, tickTimeNs);
+
+			consumeAudioLocked(LoopbackAudioSamplesForTick(m_mode, m_startTick, tick));
+		}
+	}
+
+	postRenderAudioLocked();
+}
+
+bool LoopbackOutput::GetLoopbackSignal(LoopbackInputSignal* signal)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_videoEnabled)
+		return false;
+
+	signal->mode = m_mode;
+	signal->frame = m_onAirFrame;
+	if (signal->frame != NULL)
+		signal->frame->AddRef();
+
+	signal->audioSampleFrames = m_playedAudioFrames;
+	signal->audioSampleType = m_audioSampleType;
+	signal->audioChannelCount = m_audioChannelCount;
+	if (m_playedAudioFrames > 0)
+		signal->audio.assign(m_playedAudio.begin(), m_playedAudio.begin() + m_playedAudioFrames * m_audioFrameBytes);
+
+	return true;
+}
+
+BMDDisplayMode LoopbackOutput::CurrentMode(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_mode->displayMode : bmdModeUnknown;
+}
+
+BMDVideoOutputFlags LoopbackOutput::CurrentFlags(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled ? m_outputFlags : bmdVideoOutputFlagDefault;
+}
+
+BMDPixelFormat LoopbackOutput::LastPixelFormat(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_lastPixelFormat;
+}
+
+bool LoopbackOutput::IsBusy(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_videoEnabled || m_audioEnabled;
+}
+
+void LoopbackOutput::JoinGroupStart(int64_t group, const LoopbackDisplayModeInfo* mode, BMDTimeValue startTime, double speed, int64_t startTick)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int64_t	ourGroup;
+
+	if (!m_videoEnabled || m_running || (m_mode != mode))
+		return;
+
+	if (isGroupedLocked(&ourGroup) && (ourGroup == group))
+		startLocked(startTime, speed, startTick);
+}
+
+void LoopbackOutput::JoinGroupStop(int64_t group, BMDTimeValue stopPlaybackAtTime, BMDTimeScale timeScale)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int64_t	ourGroup;
+
+	if (!m_running)
+		return;
+
+	if (isGroupedLocked(&ourGroup) && (ourGroup == group))
+		stopAtLocked(stopPlaybackAtTime, timeScale);
+}
+
+/* Internal helpers, m_mutex must be held */
+
+bool LoopbackOutput::isGroupedLocked(int64_t* group)
+{
+	if ((m_outputFlags & bmdVideoOutputSynchronizeToPlaybackGroup) == 0)
+		return false;
+
+	if (m_device->Configuration()->GetInt(bmdDeckLinkConfigPlaybackGroup, group) != S_OK)
+		return false;
+
+	return *group != 0;
+}
+
+void LoopbackOutput::startLocked(BMDTimeValue startTime, double speed, int64_t startTick)
+{
+	m_running = true;
+	m_startTick = startTick;
+	m_startStreamTime = startTime;
+	m_playbackSpeed = speed;
+	m_stopPending = false;
+	m_audioPrerolling = false;
+}
+
+BMDTimeValue LoopbackOutput::stopAtLocked(BMDTimeValue stopPlaybackAtTime, BMDTimeScale timeScale)
+{
+	BMDTimeValue	now = LoopbackNowNs();
+	BMDTimeValue	currentStreamTime = streamTimeAtLocked(now);
+	BMDTimeValue	stopStreamTime = 0;
+
+	if (timeScale != 0)
+		stopStreamTime = LoopbackRescaleTime(stopPlaybackAtTime, timeScale, m_mode->timeScale);
+
+	// A stop time of zero, or one that has already passed, stops immediately
+	if (stopStreamTime <= currentStreamTime)
+	{
+		stopLocked(now);
+		return currentStreamTime;
+	}
+
+	m_stopPending = true;
+	m_stopStreamTime = stopStreamTime;
+	return stopStreamTime;
+}
+
+void LoopbackOutput::stopLocked(int64_t completionTimeNs)
+{
+	if ((m_onAirFrame != NULL) && m_onAirScheduled)
+	{
+		completeFrameLocked(m_onAirFrame, m_onAirLate ? bmdOutputFrameDisplayedLate : bmdOutputFrameCompleted, completionTimeNs);
+		m_onAirFrame = NULL;
+	}
+
+	flushScheduledLocked(completionTimeNs);
+
+	m_running = false;
+	m_stopPending = false;
+	m_audioPrerolling = false;
+	m_audioBufferedFrames = 0;
+	m_playedAudioFrames = 0;
+
+	m_callbackQueue.Post([this]() {
+		IDeckLinkVideoOutputCallback* callback;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			callback = m_callback;
+			if (callback != NULL)
+				callback->AddRef();
+		}
+
+		if (callback != NULL)
+		{
+			callback->ScheduledPlaybackHasStopped();
+			callback->Release();
+		}
+	});
+}
+
+void LoopbackOutput::flushScheduledLocked(int64_t completionTimeNs)
+{
+	for (auto& scheduled : m_scheduledFrames)
+		completeFrameLocked(scheduled.second.frame, bmdOutputFrameFlushed, completionTimeNs);
+
+	m_scheduledFrames.clear();
+}
+
+void LoopbackOutput::replaceOnAirLocked(IDeckLinkVideoFrame* frame, bool scheduled, bool late, int64_t completionTimeNs)
+{
+	if (m_onAirFrame != NULL)
+	{
+		if (m_onAirScheduled)
+			completeFrameLocked(m_onAirFrame, m_onAirLate ? bmdOutputFrameDisplayedLate : bmdOutputFrameCompleted, completionTimeNs);
+		else
+			m_onAirFrame->Release();
+	}
+
+	m_onAirFrame = frame;
+	m_onAirScheduled = scheduled;
+	m_onAirLate = late;
+
+	if (frame != NULL)
+		m_lastPixelFormat = frame->GetPixelFormat();
+}
+
+void LoopbackOutput::completeFrameLocked(IDeckLinkVideoFrame* frame, BMDOutputFrameCompletionResult result, int64_t completionTimeNs)
+{
+	// Takes ownership of the reference held on frame
+	m_completionTimes.push_back(std::make_pair(frame, completionTimeNs));
+	if (m_completionTimes.size() > kMaxCompletionTimes)
+		m_completionTimes.pop_front();
+
+	m_callbackQueue.Post([this, frame, result]() {
+		IDeckLinkVideoOutputCallback* callback;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			callback = m_callback;
+			if (callback != NULL)
+				callback->AddRef();
+		}
+
+		if (callback != NULL)
+		{
+			callback->ScheduledFrameCompleted(frame, result);
+			callback->Release();
+		}
+
+		frame->Release();
+	});
+}
+
+void LoopbackOutput::postRenderAudioLocked(void)
+{
+	if (!m_audioEnabled || (m_audioCallback == NULL) || m_renderAudioPending)
+		return;
+
+	if (!m_audioPrerolling && !m_running)
+		return;
+
+	// Only one request is outstanding at a time, so a slow client is not flooded
+	m_renderAudioPending = true;
+
+	m_callbackQueue.Post([this]() {
+		IDeckLinkAudioOutputCallback*	callback;
+		bool							preroll;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_renderAudioPending = false;
+			preroll = !m_running;
+			callback = (m_audioPrerolling || m_running) ? m_audioCallback : NULL;
+			if (callback != NULL)
+				callback->AddRef();
+		}
+
+		if (callback != NULL)
+		{
+			callback->RenderAudioSamples(preroll);
+			callback->Release();
+		}
+	});
+}
+
+uint32_t LoopbackOutput::writeAudioLocked(const void* buffer, uint32_t sampleFrameCount)
+{
+	const uint8_t*	source = (const uint8_t*)buffer;
+	uint32_t		framesToWrite = std::min(sampleFrameCount, m_audioRingFrames - m_audioBufferedFrames);
+	uint32_t		writeIndex = (m_audioReadIndex + m_audioBufferedFrames) % m_audioRingFrames;
+	uint32_t		firstPart = std::min(framesToWrite, m_audioRingFrames - writeIndex);
+
+	memcpy(&m_audioRing[writeIndex * m_audioFrameBytes], source, firstPart * m_audioFrameBytes);
+	memcpy(&m_audioRing[0], source + firstPart * m_audioFrameBytes, (framesToWrite - firstPart) * m_audioFrameBytes);
+
+	m_audioBufferedFrames += framesToWrite;
+	return framesToWrite;
+}
+
+void LoopbackOutput::consumeAudioLocked(uint32_t sampleFrames)
+{
+	if (!m_audioEnabled)
+	{
+		m_playedAudioFrames = 0;
+		return;
+	}
+
+	uint32_t	framesAvailable = std::min(sampleFrames, m_audioBufferedFrames);
+	uint32_t	firstPart = std::min(framesAvailable, m_audioRingFrames - m_audioReadIndex);
+
+	if (m_playedAudio.size() < sampleFrames * m_audioFrameBytes)
+		m_playedAudio.resize(sampleFrames * m_audioFrameBytes);
+
+	memcpy(&m_playedAudio[0], &m_audioRing[m_audioReadIndex * m_audioFrameBytes], firstPart * m_audioFrameBytes);
+	memcpy(&m_playedAudio[firstPart * m_audioFrameBytes], &m_audioRing[0], (framesAvailable - firstPart) * m_audioFrameBytes);
+
+	// Audio underrun plays silence
+	memset(&m_playedAudio[framesAvailable * m_audioFrameBytes], 0, (sampleFrames - framesAvailable) * m_audioFrameBytes);
+
+	m_audioReadIndex = (m_audioReadIndex + framesAvailable) % m_audioRingFrames;
+	m_audioBufferedFrames -= framesAvailable;
+	m_playedAudioFrames = sampleFrames;
+}
+
+BMDTimeValue LoopbackOutput::streamTimeAtLocked(int64_t timeNs)
+{
+	if (!m_running)
+		return 0;
+
+	int64_t startTimeNs = LoopbackTickTimeNs(m_mode, m_startTick);
+	if (timeNs <= startTimeNs)
+		return m_startStreamTime;
+
+	return m_startStreamTime + (BMDTimeValue)(LoopbackRescaleTime(timeNs - startTimeNs, 1000000000, m_mode->timeScale) * m_playbackSpeed);
+}
+
+void LoopbackOutput::reset(void)
+{
+	IDeckLinkVideoOutputCallback*	callback;
+	IDeckLinkAudioOutputCallback*	audioCallback;
+	IDeckLinkMemoryAllocator*		allocator;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int64_t now = LoopbackNowNs();
+
+		if (m_running)
+			stopLocked(now);
+
+		flushScheduledLocked(now);
+		replaceOnAirLocked(NULL, false, false, now);
+
+		m_videoEnabled = false;
+		m_mode = NULL;
+		m_audioEnabled = false;
+
+		callback = m_callback;
+		audioCallback = m_audioCallback;
+		allocator = m_allocator;
+		m_callback = NULL;
+		m_audioCallback = NULL;
+		m_allocator = NULL;
+	}
+
+	if (callback != NULL)
+		callback->Release();
+	if (audioCallback != NULL)
+		audioCallback->Release();
+	if (allocator != NULL)
+		allocator->Release();
+
+	m_device->ClockModeChanged();
+	m_device->StatusChanged(bmdDeckLinkStatusCurrentVideoOutputMode);
+	m_device->StatusChanged(bmdDeckLinkStatusDetectedVideoInputMode);
+}
+
+/* IDeckLinkOutput interface */
+
+HRESULT LoopbackOutput::DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat, BMDSupportedVideoModeFlags flags, BMDDisplayMode* actualMode, bool* supported)
+{
+	if (supported == NULL)
+		return E_POINTER;
+
+	*supported = (FindLoopbackDisplayModeInfo(requestedMode) != NULL) &&
+				 ((requestedPixelFormat == bmdFormatUnspecified) || IsLoopbackPixelFormatSupported(requestedPixelFormat));
+
+	if (actualMode != NULL)
+		*actualMode = *supported ? requestedMode : bmdModeUnknown;
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode)
+{
+	const LoopbackDisplayModeInfo* info = FindLoopbackDisplayModeInfo(displayMode);
+
+	if (resultDisplayMode == NULL)
+		return E_POINTER;
+
+	*resultDisplayMode = NULL;
+
+	if (info == NULL)
+		return E_INVALIDARG;
+
+	*resultDisplayMode = new LoopbackDisplayMode(info);
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator)
+{
+	if (iterator == NULL)
+		return E_POINTER;
+
+	*iterator = new LoopbackDisplayModeIterator();
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT LoopbackOutput::EnableVideoOutput(BMDDisplayMode displayMode, BMDVideoOutputFlags flags)
+{
+	const LoopbackDisplayModeInfo* mode = FindLoopbackDisplayModeInfo(displayMode);
+
+	if (mode == NULL)
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_running)
+			return E_ACCESSDENIED;
+
+		if (m_videoEnabled && (m_mode != mode))
+		{
+			int64_t now = LoopbackNowNs();
+			flushScheduledLocked(now);
+			replaceOnAirLocked(NULL, false, false, now);
+		}
+
+		m_videoEnabled = true;
+		m_mode = mode;
+		m_outputFlags = flags;
+	}
+
+	m_device->ClockModeChanged();
+	m_device->StatusChanged(bmdDeckLinkStatusCurrentVideoOutputMode);
+	m_device->StatusChanged(bmdDeckLinkStatusDetectedVideoInputMode);
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::DisableVideoOutput(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		int64_t now = LoopbackNowNs();
+
+		if (!m_videoEnabled)
+			return S_OK;
+
+		if (m_running)
+			stopLocked(now);
+
+		flushScheduledLocked(now);
+		replaceOnAirLocked(NULL, false, false, now);
+
+		m_videoEnabled = false;
+		m_mode = NULL;
+	}
+
+	m_device->ClockModeChanged();
+	m_device->StatusChanged(bmdDeckLinkStatusCurrentVideoOutputMode);
+	m_device->StatusChanged(bmdDeckLinkStatusDetectedVideoInputMode);
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::SetVideoOutputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator)
+{
+	IDeckLinkMemoryAllocator* previous;
+
+	if (theAllocator != NULL)
+		theAllocator->AddRef();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		previous = m_allocator;
+		m_allocator = theAllocator;
+	}
+
+	if (previous != NULL)
+		previous->Release();
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::CreateVideoFrame(int32_t width, int32_t height, int32_t rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags, IDeckLinkMutableVideoFrame** outFrame)
+{
+	IDeckLinkMemoryAllocator*	allocator;
+	LoopbackVideoFrame*			frame;
+	long						minimumRowBytes = GetLoopbackRowBytes(pixelFormat, width);
+	HRESULT						result;
+
+	if (outFrame == NULL)
+		return E_POINTER;
+
+	*outFrame = NULL;
+
+	if ((width <= 0) || (height <= 0) || (minimumRowBytes == 0) || (rowBytes < minimumRowBytes))
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		allocator = (m_allocator != NULL) ? m_allocator : m_defaultAllocator;
+		allocator->AddRef();
+	}
+
+	frame = new LoopbackVideoFrame(width, height, rowBytes, pixelFormat, flags);
+	result = frame->Allocate(allocator);
+	allocator->Release();
+
+	if (result != S_OK)
+	{
+		frame->Release();
+		return E_OUTOFMEMORY;
+	}
+
+	*outFrame = frame;
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::CreateAncillaryData(BMDPixelFormat pixelFormat, IDeckLinkVideoFrameAncillary** outBuffer)
+{
+	// Legacy VANC buffers are not supported, use IDeckLinkVideoFrameAncillaryPackets
+	return E_NOTIMPL;
+}
+
+HRESULT LoopbackOutput::DisplayVideoFrameSync(IDeckLinkVideoFrame* theFrame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (theFrame == NULL)
+		return E_INVALIDARG;
+
+	if (!m_videoEnabled || m_running)
+		return E_ACCESSDENIED;
+
+	if ((theFrame->GetWidth() != m_mode->width) || (theFrame->GetHeight() != m_mode->height))
+		return E_INVALIDARG;
+
+	theFrame->AddRef();
+	replaceOnAirLocked(theFrame, false, false, LoopbackNowNs());
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::ScheduleVideoFrame(IDeckLinkVideoFrame* theFrame, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	ScheduledFrame	scheduled;
+
+	if ((theFrame == NULL) || (timeScale == 0))
+		return E_INVALIDARG;
+
+	if (!m_videoEnabled)
+		return E_ACCESSDENIED;
+
+	if ((theFrame->GetWidth() != m_mode->width) || (theFrame->GetHeight() != m_mode->height))
+		return E_INVALIDARG;
+
+	theFrame->AddRef();
+	scheduled.frame = theFrame;
+	scheduled.displayTime = LoopbackRescaleTime(displayTime, timeScale, m_mode->timeScale);
+	scheduled.displayDuration = LoopbackRescaleTime(displayDuration, timeScale, m_mode->timeScale);
+	m_scheduledFrames.insert(std::make_pair(scheduled.displayTime, scheduled));
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::SetScheduledFrameCompletionCallback(IDeckLinkVideoOutputCallback* theCallback)
+{
+	IDeckLinkVideoOutputCallback* previous;
+
+	if (theCallback != NULL)
+		theCallback->AddRef();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		previous = m_callback;
+		m_callback = theCallback;
+	}
+
+	if (previous != NULL)
+		previous->Release();
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetBufferedVideoFrameCount(uint32_t* bufferedFrameCount)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (bufferedFrameCount == NULL)
+		return E_POINTER;
+
+	*bufferedFrameCount = (uint32_t)m_scheduledFrames.size();
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::EnableAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount, BMDAudioOutputStreamType streamType)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (sampleRate != bmdAudioSampleRate48kHz)
+		return E_INVALIDARG;
+
+	if ((sampleType != bmdAudioSampleType16bitInteger) && (sampleType != bmdAudioSampleType32bitInteger))
+		return E_INVALIDARG;
+
+	if ((channelCount == 0) || (channelCount > 16))
+		return E_INVALIDARG;
+
+	if (m_audioEnabled)
+		return E_ACCESSDENIED;
+
+	m_audioEnabled = true;
+	m_audioSampleType = sampleType;
+	m_audioChannelCount = channelCount;
+	m_audioFrameBytes = channelCount * (sampleType / 8);
+	m_audioRingFrames = kAudioRingSeconds * bmdAudioSampleRate48kHz;
+	m_audioRing.assign((size_t)m_audioRingFrames * m_audioFrameBytes, 0);
+	m_audioReadIndex = 0;
+	m_audioBufferedFrames = 0;
+	m_playedAudioFrames = 0;
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::DisableAudioOutput(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_audioEnabled = false;
+	m_audioPrerolling = false;
+	m_audioBufferedFrames = 0;
+	m_playedAudioFrames = 0;
+	std::vector<uint8_t>().swap(m_audioRing);
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::WriteAudioSamplesSync(void* buffer, uint32_t sampleFrameCount, uint32_t* sampleFramesWritten)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	uint32_t written;
+
+	if (!m_audioEnabled)
+		return E_ACCESSDENIED;
+
+	if ((buffer == NULL) && (sampleFrameCount > 0))
+		return E_INVALIDARG;
+
+	written = writeAudioLocked(buffer, sampleFrameCount);
+	if (sampleFramesWritten != NULL)
+		*sampleFramesWritten = written;
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::BeginAudioPreroll(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_audioEnabled)
+		return E_ACCESSDENIED;
+
+	m_audioPrerolling = true;
+	postRenderAudioLocked();
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::EndAudioPreroll(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_audioPrerolling = false;
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::ScheduleAudioSamples(void* buffer, uint32_t sampleFrameCount, BMDTimeValue streamTime, BMDTimeScale timeScale, uint32_t* sampleFramesWritten)
+{
+	// Samples are played as one continuous stream; stream time stamps are not used to place them
+	return WriteAudioSamplesSync(buffer, sampleFrameCount, sampleFramesWritten);
+}
+
+HRESULT LoopbackOutput::GetBufferedAudioSampleFrameCount(uint32_t* bufferedSampleFrameCount)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (bufferedSampleFrameCount == NULL)
+		return E_POINTER;
+
+	*bufferedSampleFrameCount = m_audioBufferedFrames;
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::FlushBufferedAudioSamples(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_audioBufferedFrames = 0;
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::SetAudioCallback(IDeckLinkAudioOutputCallback* theCallback)
+{
+	IDeckLinkAudioOutputCallback* previous;
+
+	if (theCallback != NULL)
+		theCallback->AddRef();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		previous = m_audioCallback;
+		m_audioCallback = theCallback;
+	}
+
+	if (previous != NULL)
+		previous->Release();
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::StartScheduledPlayback(BMDTimeValue playbackStartTime, BMDTimeScale timeScale, double playbackSpeed)
+{
+	const LoopbackDisplayModeInfo*	mode;
+	BMDTimeValue					startTime;
+	int64_t							startTick;
+	int64_t							group;
+	bool							grouped;
+
+	if ((timeScale == 0) || (playbackSpeed <= 0.0))
+		return E_INVALIDARG;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_videoEnabled || m_running)
+			return E_ACCESSDENIED;
+
+		// Playback begins on the next frame boundary of the reference clock
+		mode = m_mode;
+		startTime = LoopbackRescaleTime(playbackStartTime, timeScale, mode->timeScale);
+		startTick = LoopbackTickIndexAt(mode, LoopbackNowNs()) + 1;
+		grouped = isGroupedLocked(&group);
+
+		startLocked(startTime, playbackSpeed, startTick);
+	}
+
+	if (grouped)
+	{
+		for (unsigned i = 0; i < LoopbackDevice::GetDeviceCount(); i++)
+		{
+			LoopbackDevice* device = LoopbackDevice::GetDevice(i);
+			if (device != m_device)
+				device->Output()->JoinGroupStart(group, mode, startTime, playbackSpeed, startTick);
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::StopScheduledPlayback(BMDTimeValue stopPlaybackAtTime, BMDTimeValue* actualStopTime, BMDTimeScale timeScale)
+{
+	BMDTimeValue	stopTime = 0;
+	BMDTimeScale	modeTimeScale = 1;
+	int64_t			group;
+	bool			grouped;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_videoEnabled)
+			return E_ACCESSDENIED;
+
+		grouped = isGroupedLocked(&group);
+		modeTimeScale = m_mode->timeScale;
+
+		if (m_running)
+		{
+			stopTime = stopAtLocked(stopPlaybackAtTime, timeScale);
+		}
+		else
+		{
+			// Cancel any audio preroll and still report the stop, so that a client
+			// waiting on ScheduledPlaybackHasStopped does not wait forever
+			stopLocked(LoopbackNowNs());
+		}
+	}
+
+	if (actualStopTime != NULL)
+		*actualStopTime = (timeScale != 0) ? LoopbackRescaleTime(stopTime, modeTimeScale, timeScale) : 0;
+
+	if (grouped)
+	{
+		for (unsigned i = 0; i < LoopbackDevice::GetDeviceCount(); i++)
+		{
+			LoopbackDevice* device = LoopbackDevice::GetDevice(i);
+			if (device != m_device)
+				device->Output()->JoinGroupStop(group, stopPlaybackAtTime, timeScale);
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::IsScheduledPlaybackRunning(bool* active)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (active == NULL)
+		return E_POINTER;
+
+	*active = m_running;
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetScheduledStreamTime(BMDTimeScale desiredTimeScale, BMDTimeValue* streamTime, double* playbackSpeed)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if ((streamTime == NULL) || (desiredTimeScale == 0))
+		return E_INVALIDARG;
+
+	if (!m_running)
+	{
+		*streamTime = 0;
+		if (playbackSpeed != NULL)
+			*playbackSpeed = 0.0;
+		return S_OK;
+	}
+
+	*streamTime = LoopbackRescaleTime(streamTimeAtLocked(LoopbackNowNs()), m_mode->timeScale, desiredTimeScale);
+	if (playbackSpeed != NULL)
+		*playbackSpeed = m_playbackSpeed;
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetReferenceStatus(BMDReferenceStatus* referenceStatus)
+{
+	if (referenceStatus == NULL)
+		return E_POINTER;
+
+	// All loopback devices are locked to the shared reference clock
+	*referenceStatus = bmdReferenceLocked;
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame)
+{
+	const LoopbackDisplayModeInfo*	mode = ClockMode();
+	int64_t							now = LoopbackNowNs();
+
+	if (desiredTimeScale == 0)
+		return E_INVALIDARG;
+
+	if (hardwareTime != NULL)
+		*hardwareTime = LoopbackRescaleTime(now, 1000000000, desiredTimeScale);
+
+	if (timeInFrame != NULL)
+		*timeInFrame = (mode != NULL) ? LoopbackRescaleTime(now - LoopbackTickTimeNs(mode, LoopbackTickIndexAt(mode, now)), 1000000000, desiredTimeScale) : 0;
+
+	if (ticksPerFrame != NULL)
+		*ticksPerFrame = (mode != NULL) ? LoopbackRescaleTime(mode->frameDuration, mode->timeScale, desiredTimeScale) : 0;
+
+	return S_OK;
+}
+
+HRESULT LoopbackOutput::GetFrameCompletionReferenceTimestamp(IDeckLinkVideoFrame* theFrame, BMDTimeScale desiredTimeScale, BMDTimeValue* frameCompletionTimestamp)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if ((frameCompletionTimestamp == NULL) || (desiredTimeScale == 0))
+		return E_INVALIDARG;
+
+	for (auto iter = m_completionTimes.rbegin(); iter != m_completionTimes.rend(); ++iter)
+	{
+		if (iter->first == theFrame)
+		{
+			*frameCompletionTimestamp = LoopbackRescaleTime(iter->second, 1000000000, desiredTimeScale);
+			return S_OK;
+		}
+	}
+
+	return E_FAIL;
+}
+
+/* IUnknown interface */
+
+HRESULT LoopbackOutput::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkOutput, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkOutput*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG LoopbackOutput::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackOutput::Release()
+{
+	// The output is owned by its device; when the last client reference goes
+	// away it is returned to its idle state, as a hardware output is on close.
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		reset();
+
+	return newRefValue;
+}
@@ -0,0 +1,166 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "LoopbackDevice.h"
+#include "LoopbackDispatchQueue.h"
+
+class LoopbackOutput : public IDeckLinkOutput
+{
+public:
+	LoopbackOutput(LoopbackDevice* device);
+
+	// Driver interface, called from the device clock thread
+	const LoopbackDisplayModeInfo*	ClockMode(void);
+	void							ProcessTick(int64_t tick, int64_t tickTimeNs);
+	bool							GetLoopbackSignal(LoopbackInputSignal* signal);
+
+	// Status reporting
+	BMDDisplayMode					CurrentMode(void);
+	BMDVideoOutputFlags				CurrentFlags(void);
+	BMDPixelFormat					LastPixelFormat(void);
+	bool							IsBusy(void);
+
+	// Playback group members are started and stopped together
+	void							JoinGroupStart(int64_t group, const LoopbackDisplayModeInfo* mode, BMDTimeValue startTime, double speed, int64_t startTick);
+	void							JoinGroupStop(int64_t group, BMDTimeValue stopPlaybackAtTime, BMDTimeScale timeScale);
+
+	// IDeckLinkOutput interface
+	virtual HRESULT		STDMETHODCALLTYPE	DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat, BMDSupportedVideoModeFlags flags, BMDDisplayMode* actualMode, bool* supported);
+	virtual HRESULT		STDMETHODCALLTYPE	GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode);
+	virtual HRESULT		STDMETHODCALLTYPE	GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator);
+	virtual HRESULT		STDMETHODCALLTYPE	SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback);
+
+	virtual HRESULT		STDMETHODCALLTYPE	EnableVideoOutput(BMDDisplayMode displayMode, BMDVideoOutputFlags flags);
+	virtual HRESULT		STDMETHODCALLTYPE	DisableVideoOutput(void);
+	virtual HRESULT		STDMETHODCALLTYPE	SetVideoOutputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator);
+	virtual HRESULT		STDMETHODCALLTYPE	CreateVideoFrame(int32_t width, int32_t height, int32_t rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags, IDeckLinkMutableVideoFrame** outFrame);
+	virtual HRESULT		STDMETHODCALLTYPE	CreateAncillaryData(BMDPixelFormat pixelFormat, IDeckLinkVideoFrameAncillary** outBuffer);
+	virtual HRESULT		STDMETHODCALLTYPE	DisplayVideoFrameSync(IDeckLinkVideoFrame* theFrame);
+	virtual HRESULT		STDMETHODCALLTYPE	ScheduleVideoFrame(IDeckLinkVideoFrame* theFrame, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale);
+	virtual HRESULT		STDMETHODCALLTYPE	SetScheduledFrameCompletionCallback(IDeckLinkVideoOutputCallback* theCallback);
+	virtual HRESULT		STDMETHODCALLTYPE	GetBufferedVideoFrameCount(uint32_t* bufferedFrameCount);
+
+	virtual HRESULT		STDMETHODCALLTYPE	EnableAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount, BMDAudioOutputStreamType streamType);
+	virtual HRESULT		STDMETHODCALLTYPE	DisableAudioOutput(void);
+	virtual HRESULT		STDMETHODCALLTYPE	WriteAudioSamplesSync(void* buffer, uint32_t sampleFrameCount, uint32_t* sampleFramesWritten);
+	virtual HRESULT		STDMETHODCALLTYPE	BeginAudioPreroll(void);
+	virtual HRESULT		STDMETHODCALLTYPE	EndAudioPreroll(void);
+	virtual HRESULT		STDMETHODCALLTYPE	ScheduleAudioSamples(void* buffer, uint32_t sampleFrameCount, BMDTimeValue streamTime, BMDTimeScale timeScale, uint32_t* sampleFramesWritten);
+	virtual HRESULT		STDMETHODCALLTYPE	GetBufferedAudioSampleFrameCount(uint32_t* bufferedSampleFrameCount);
+	virtual HRESULT		STDMETHODCALLTYPE	FlushBufferedAudioSamples(void);
+	virtual HRESULT		STDMETHODCALLTYPE	SetAudioCallback(IDeckLinkAudioOutputCallback* theCallback);
+
+	virtual HRESULT		STDMETHODCALLTYPE	StartScheduledPlayback(BMDTimeValue playbackStartTime, BMDTimeScale timeScale, double playbackSpeed);
+	virtual HRESULT		STDMETHODCALLTYPE	StopScheduledPlayback(BMDTimeValue stopPlaybackAtTime, BMDTimeValue* actualStopTime, BMDTimeScale timeScale);
+	virtual HRESULT		STDMETHODCALLTYPE	IsScheduledPlaybackRunning(bool* active);
+	virtual HRESULT		STDMETHODCALLTYPE	GetScheduledStreamTime(BMDTimeScale desiredTimeScale, BMDTimeValue* streamTime, double* playbackSpeed);
+	virtual HRESULT		STDMETHODCALLTYPE	GetReferenceStatus(BMDReferenceStatus* referenceStatus);
+
+	virtual HRESULT		STDMETHODCALLTYPE	GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame);
+	virtual HRESULT		STDMETHODCALLTYPE	GetFrameCompletionReferenceTimestamp(IDeckLinkVideoFrame* theFrame, BMDTimeScale desiredTimeScale, BMDTimeValue* frameCompletionTimestamp);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackOutput() {}
+
+	struct ScheduledFrame
+	{
+		IDeckLinkVideoFrame*	frame;
+		BMDTimeValue			displayTime;		// In display mode time scale
+		BMDTimeValue			displayDuration;
+	};
+
+	// Helpers below require m_mutex to be held
+	bool				isGroupedLocked(int64_t* group);
+	void				startLocked(BMDTimeValue startTime, double speed, int64_t startTick);
+	BMDTimeValue		stopAtLocked(BMDTimeValue stopPlaybackAtTime, BMDTimeScale timeScale);
+	void				stopLocked(int64_t completionTimeNs);
+	void				flushScheduledLocked(int64_t completionTimeNs);
+	void				replaceOnAirLocked(IDeckLinkVideoFrame* frame, bool scheduled, bool late, int64_t completionTimeNs);
+	void				completeFrameLocked(IDeckLinkVideoFrame* frame, BMDOutputFrameCompletionResult result, int64_t completionTimeNs);
+	void				postRenderAudioLocked(void);
+	uint32_t			writeAudioLocked(const void* buffer, uint32_t sampleFrameCount);
+	void				consumeAudioLocked(uint32_t sampleFrames);
+	BMDTimeValue		streamTimeAtLocked(int64_t timeNs);
+
+	void				reset(void);
+
+	LoopbackDevice*							m_device;
+	std::atomic<ULONG>						m_refCount;
+	std::mutex								m_mutex;
+	LoopbackDispatchQueue					m_callbackQueue;
+
+	IDeckLinkVideoOutputCallback*			m_callback;
+	IDeckLinkAudioOutputCallback*			m_audioCallback;
+	IDeckLinkMemoryAllocator*				m_allocator;
+	IDeckLinkMemoryAllocator*				m_defaultAllocator;
+
+	// Video output state
+	bool									m_videoEnabled;
+	const LoopbackDisplayModeInfo*			m_mode;
+	BMDVideoOutputFlags						m_outputFlags;
+	std::multimap<BMDTimeValue, ScheduledFrame>	m_scheduledFrames;
+	IDeckLinkVideoFrame*					m_onAirFrame;
+	bool									m_onAirScheduled;
+	bool									m_onAirLate;
+	BMDPixelFormat							m_lastPixelFormat;
+	std::deque<std::pair<IDeckLinkVideoFrame*, int64_t>>	m_completionTimes;
+
+	// Scheduled playback state
+	bool									m_running;
+	int64_t									m_startTick;
+	BMDTimeValue							m_startStreamTime;
+	double									m_playbackSpeed;
+	bool									m_stopPending;
+	BMDTimeValue							m_stopStreamTime;
+
+	// Audio output state
+	bool									m_audioEnabled;
+	bool									m_audioPrerolling;
+	bool									m_renderAudioPending;
+	BMDAudioSampleType						m_audioSampleType;
+	uint32_t								m_audioChannelCount;
+	uint32_t								m_audioFrameBytes;
+	std::vector<uint8_t>					m_audioRing;
+	uint32_t								m_audioRingFrames;
+	uint32_t								m_audioReadIndex;
+	uint32_t								m_audioBufferedFrames;
+	std::vector<uint8_t>					m_playedAudio;
+	uint32_t								m_playedAudioFrames;
+};
@@ -0,0 +1,846 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LoopbackVideoFrame.h"
+
+BMDTimeValue LoopbackRescaleTime(BMDTimeValue value, BMDTimeScale fromScale, BMDTimeScale toScale)
+{
+	if ((fromScale == toScale) || (fromScale == 0))
+		return value;
+
+	// 128-bit intermediate so that nanosecond clocks can be rescaled to large time scales
+	__int128 scaled = (__int128)value * toScale;
+	if (scaled < 0)
+		return (BMDTimeValue)((scaled - fromScale + 1) / fromScale);
+
+	return (BMDTimeValue)(scaled / fromScale);
+}
+
+static inline uint32_t toBCD(uint8_t value)
+{
+	return ((value / 10) << 4) | (value % 10);
+}
+
+static bool sameIID(REFIID a, REFIID b)
+{
+	return memcmp(&a, &b, sizeof(REFIID)) == 0;
+}
+
+static bool isIUnknown(REFIID iid)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+	return memcmp(&iid, &iunknown, sizeof(REFIID)) == 0;
+}
+
+/* LoopbackTimecode class */
+
+LoopbackTimecode::LoopbackTimecode(const LoopbackTimecodeValue& value) :
+	m_value(value), m_refCount(1)
+{
+}
+
+BMDTimecodeBCD LoopbackTimecode::GetBCD(void)
+{
+	return (toBCD(m_value.hours) << 24) | (toBCD(m_value.minutes) << 16) | (toBCD(m_value.seconds) << 8) | toBCD(m_value.frames);
+}
+
+HRESULT LoopbackTimecode::GetComponents(uint8_t* hours, uint8_t* minutes, uint8_t* seconds, uint8_t* frames)
+{
+	if (hours)
+		*hours = m_value.hours;
+	if (minutes)
+		*minutes = m_value.minutes;
+	if (seconds)
+		*seconds = m_value.seconds;
+	if (frames)
+		*frames = m_value.frames;
+
+	return S_OK;
+}
+
+HRESULT LoopbackTimecode::GetString(const char** timecode)
+{
+	char	buffer[16];
+
+	if (timecode == NULL)
+		return E_POINTER;
+
+	snprintf(buffer, sizeof(buffer), "%02u:%02u:%02u%c%02u",
+			m_value.hours, m_value.minutes, m_value.seconds,
+			(m_value.flags & bmdTimecodeIsDropFrame) ? ';' : ':',
+			m_value.frames);
+
+	*timecode = strdup(buffer);
+	return S_OK;
+}
+
+HRESULT LoopbackTimecode::GetTimecodeUserBits(BMDTimecodeUserBits* userBits)
+{
+	if (userBits == NULL)
+		return E_POINTER;
+
+	*userBits = m_value.userBits;
+	return S_OK;
+}
+
+HRESULT LoopbackTimecode::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkTimecode))
+	{
+		*ppv = (IDeckLinkTimecode*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackTimecode::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackTimecode::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* LoopbackAncillaryPacket class */
+
+LoopbackAncillaryPacket::LoopbackAncillaryPacket(uint8_t did, uint8_t sdid, uint32_t lineNumber, uint8_t dataStreamIndex, const void* data, uint32_t size) :
+	m_did(did), m_sdid(sdid), m_lineNumber(lineNumber), m_dataStreamIndex(dataStreamIndex),
+	m_data((const uint8_t*)data, (const uint8_t*)data + size), m_refCount(1)
+{
+}
+
+HRESULT LoopbackAncillaryPacket::GetBytes(BMDAncillaryPacketFormat format, const void** data, uint32_t* size)
+{
+	// Only the 8-bit user data word representation is carried through the loopback
+	if (format != bmdAncillaryPacketFormatUInt8)
+		return E_NOTIMPL;
+
+	if (data)
+		*data = m_data.data();
+	if (size)
+		*size = (uint32_t)m_data.size();
+
+	return S_OK;
+}
+
+HRESULT LoopbackAncillaryPacket::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkAncillaryPacket))
+	{
+		*ppv = (IDeckLinkAncillaryPacket*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackAncillaryPacket::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackAncillaryPacket::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* LoopbackAncillaryPacketIterator class */
+
+class LoopbackAncillaryPacketIterator : public IDeckLinkAncillaryPacketIterator
+{
+public:
+	LoopbackAncillaryPacketIterator(const std::vector<IDeckLinkAncillaryPacket*>& packets) :
+		m_packets(packets), m_index(0), m_refCount(1)
+	{
+		for (IDeckLinkAncillaryPacket* packet : m_packets)
+			packet->AddRef();
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE Next(IDeckLinkAncillaryPacket** packet)
+	{
+		if (packet == NULL)
+			return E_POINTER;
+
+		if (m_index >= m_packets.size())
+		{
+			*packet = NULL;
+			return S_FALSE;
+		}
+
+		*packet = m_packets[m_index++];
+		(*packet)->AddRef();
+		return S_OK;
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+
+		if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkAncillaryPacketIterator))
+		{
+			*ppv = (IDeckLinkAncillaryPacketIterator*)this;
+			AddRef();
+			return S_OK;
+		}
+
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return ++m_refCount;
+	}
+
+	virtual ULONG STDMETHODCALLTYPE Release()
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+
+		return newRefValue;
+	}
+
+private:
+	virtual ~LoopbackAncillaryPacketIterator()
+	{
+		for (IDeckLinkAncillaryPacket* packet : m_packets)
+			packet->Release();
+	}
+
+	std::vector<IDeckLinkAncillaryPacket*>	m_packets;
+	size_t									m_index;
+	std::atomic<ULONG>						m_refCount;
+};
+
+/* LoopbackAncillaryPackets class */
+
+LoopbackAncillaryPackets::LoopbackAncillaryPackets() :
+	m_refCount(1)
+{
+}
+
+LoopbackAncillaryPackets::~LoopbackAncillaryPackets()
+{
+	DetachAllPackets();
+}
+
+void LoopbackAncillaryPackets::CopyFrom(IDeckLinkVideoFrameAncillaryPackets* source)
+{
+	IDeckLinkAncillaryPacketIterator*		iterator = NULL;
+	IDeckLinkAncillaryPacket*				packet = NULL;
+	std::vector<IDeckLinkAncillaryPacket*>	copies;
+
+	if (source->GetPacketIterator(&iterator) == S_OK)
+	{
+		while (iterator->Next(&packet) == S_OK)
+		{
+			const void*		data;
+			uint32_t		size;
+
+			if (packet->GetBytes(bmdAncillaryPacketFormatUInt8, &data, &size) == S_OK)
+			{
+				copies.push_back(new LoopbackAncillaryPacket(packet->GetDID(), packet->GetSDID(), packet->GetLineNumber(),
+															 packet->GetDataStreamIndex(), data, size));
+			}
+
+			packet->Release();
+		}
+
+		iterator->Release();
+	}
+
+	DetachAllPackets();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_packets.swap(copies);
+}
+
+HRESULT LoopbackAncillaryPackets::GetPacketIterator(IDeckLinkAncillaryPacketIterator** iterator)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (iterator == NULL)
+		return E_POINTER;
+
+	*iterator = new LoopbackAncillaryPacketIterator(m_packets);
+	return S_OK;
+}
+
+HRESULT LoopbackAncillaryPackets::GetFirstPacketByID(uint8_t DID, uint8_t SDID, IDeckLinkAncillaryPacket** packet)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (packet == NULL)
+		return E_POINTER;
+
+	*packet = NULL;
+
+	for (IDeckLinkAncillaryPacket* candidate : m_packets)
+	{
+		if ((candidate->GetDID() == DID) && (candidate->GetSDID() == SDID))
+		{
+			candidate->AddRef();
+			*packet = candidate;
+			return S_OK;
+		}
+	}
+
+	return S_FALSE;
+}
+
+HRESULT LoopbackAncillaryPackets::AttachPacket(IDeckLinkAncillaryPacket* packet)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (packet == NULL)
+		return E_INVALIDARG;
+
+	// The store takes ownership of the caller's reference
+	for (IDeckLinkAncillaryPacket* existing : m_packets)
+	{
+		if (existing == packet)
+			return E_INVALIDARG;
+	}
+
+	m_packets.push_back(packet);
+	return S_OK;
+}
+
+HRESULT LoopbackAncillaryPackets::DetachPacket(IDeckLinkAncillaryPacket* packet)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto iter = m_packets.begin(); iter != m_packets.end(); ++iter)
+	{
+		if (*iter == packet)
+		{
+			m_packets.erase(iter);
+			packet->Release();
+			return S_OK;
+		}
+	}
+
+	return E_INVALIDARG;
+}
+
+HRESULT LoopbackAncillaryPackets::DetachAllPackets(void)
+{
+	std::vector<IDeckLinkAncillaryPacket*>	packets;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		packets.swap(m_packets);
+	}
+
+	for (IDeckLinkAncillaryPacket* packet : packets)
+		packet->Release();
+
+	return S_OK;
+}
+
+HRESULT LoopbackAncillaryPackets::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkVideoFrameAncillaryPackets))
+	{
+		*ppv = (IDeckLinkVideoFrameAncillaryPackets*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackAncillaryPackets::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackAncillaryPackets::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* LoopbackFrameStore class */
+
+LoopbackFrameStore::LoopbackFrameStore(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags) :
+	m_width(width), m_height(height), m_rowBytes(rowBytes), m_pixelFormat(pixelFormat), m_flags(flags),
+	m_allocator(NULL), m_buffer(NULL), m_ancillaryPackets(new LoopbackAncillaryPackets())
+{
+	memset(m_timecodes, 0, sizeof(m_timecodes));
+}
+
+LoopbackFrameStore::~LoopbackFrameStore()
+{
+	if (m_allocator != NULL)
+	{
+		if (m_buffer != NULL)
+			m_allocator->ReleaseBuffer(m_buffer);
+
+		m_allocator->Release();
+	}
+
+	m_ancillaryPackets->Release();
+}
+
+HRESULT LoopbackFrameStore::Allocate(IDeckLinkMemoryAllocator* allocator)
+{
+	HRESULT result;
+
+	if ((allocator == NULL) || (m_allocator != NULL))
+		return E_INVALIDARG;
+
+	m_allocator = allocator;
+	m_allocator->AddRef();
+
+	result = m_allocator->AllocateBuffer((uint32_t)(m_rowBytes * m_height), &m_buffer);
+	if (result != S_OK)
+		m_buffer = NULL;
+
+	return result;
+}
+
+LoopbackTimecodeValue* LoopbackFrameStore::findTimecode(BMDTimecodeFormat format)
+{
+	for (int i = 0; i < kLoopbackTimecodeFormatCount; i++)
+	{
+		if (kLoopbackTimecodeFormats[i] == format)
+			return &m_timecodes[i];
+	}
+
+	return NULL;
+}
+
+HRESULT LoopbackFrameStore::GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode)
+{
+	LoopbackTimecodeValue*	value = NULL;
+
+	if (timecode == NULL)
+		return E_POINTER;
+
+	*timecode = NULL;
+
+	if (format == bmdTimecodeRP188Any)
+	{
+		// First valid timecode in {HFRTC, VITC1, LTC, VITC2}
+		for (int i = 0; i < 4; i++)
+		{
+			if (m_timecodes[i].valid)
+			{
+				value = &m_timecodes[i];
+				break;
+			}
+		}
+	}
+	else
+	{
+		value = findTimecode(format);
+		if (value == NULL)
+			return E_INVALIDARG;
+	}
+
+	if ((value == NULL) || !value->valid)
+		return S_FALSE;
+
+	*timecode = new LoopbackTimecode(*value);
+	return S_OK;
+}
+
+HRESULT LoopbackFrameStore::SetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode* timecode)
+{
+	LoopbackTimecodeValue*	value = findTimecode(format);
+
+	if (value == NULL)
+		return E_INVALIDARG;
+
+	if (timecode == NULL)
+	{
+		value->valid = false;
+		return S_OK;
+	}
+
+	timecode->GetComponents(&value->hours, &value->minutes, &value->seconds, &value->frames);
+	value->flags = timecode->GetFlags();
+	if (timecode->GetTimecodeUserBits(&value->userBits) != S_OK)
+		value->userBits = 0;
+	value->valid = true;
+
+	return S_OK;
+}
+
+HRESULT LoopbackFrameStore::SetTimecodeFromComponents(BMDTimecodeFormat format, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags)
+{
+	LoopbackTimecodeValue*	value = findTimecode(format);
+
+	if (value == NULL)
+		return E_INVALIDARG;
+
+	value->hours	= hours;
+	value->minutes	= minutes;
+	value->seconds	= seconds;
+	value->frames	= frames;
+	value->flags	= flags;
+	value->valid	= true;
+
+	return S_OK;
+}
+
+HRESULT LoopbackFrameStore::SetTimecodeUserBits(BMDTimecodeFormat format, BMDTimecodeUserBits userBits)
+{
+	LoopbackTimecodeValue*	value = findTimecode(format);
+
+	if (value == NULL)
+		return E_INVALIDARG;
+
+	// As with the hardware driver, user bits can only be attached to an existing timecode
+	if (!value->valid)
+		return E_FAIL;
+
+	value->userBits = userBits;
+	return S_OK;
+}
+
+HRESULT LoopbackFrameStore::QueryAncillaryPackets(LPVOID *ppv)
+{
+	m_ancillaryPackets->AddRef();
+	*ppv = (IDeckLinkVideoFrameAncillaryPackets*)m_ancillaryPackets;
+	return S_OK;
+}
+
+void LoopbackFrameStore::CopyMetadataFrom(IDeckLinkVideoFrame* source)
+{
+	IDeckLinkTimecode*						timecode;
+	IDeckLinkVideoFrameAncillaryPackets*	ancillaryPackets = NULL;
+
+	for (int i = 0; i < kLoopbackTimecodeFormatCount; i++)
+	{
+		timecode = NULL;
+		if ((source->GetTimecode(kLoopbackTimecodeFormats[i], &timecode) == S_OK) && (timecode != NULL))
+		{
+			SetTimecode(kLoopbackTimecodeFormats[i], timecode);
+			timecode->Release();
+		}
+		else
+		{
+			m_timecodes[i].valid = false;
+		}
+	}
+
+	if (source->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&ancillaryPackets) == S_OK)
+	{
+		m_ancillaryPackets->CopyFrom(ancillaryPackets);
+		ancillaryPackets->Release();
+	}
+	else
+	{
+		m_ancillaryPackets->DetachAllPackets();
+	}
+}
+
+/* LoopbackVideoFrame class */
+
+LoopbackVideoFrame::LoopbackVideoFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags) :
+	m_store(width, height, rowBytes, pixelFormat, flags), m_refCount(1)
+{
+}
+
+HRESULT LoopbackVideoFrame::GetBytes(void** buffer)
+{
+	if (buffer == NULL)
+		return E_POINTER;
+
+	*buffer = m_store.Bytes();
+	return (*buffer != NULL) ? S_OK : E_FAIL;
+}
+
+HRESULT LoopbackVideoFrame::GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode)
+{
+	return m_store.GetTimecode(format, timecode);
+}
+
+HRESULT LoopbackVideoFrame::GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary)
+{
+	// Only IDeckLinkVideoFrameAncillaryPackets is supported by the loopback driver
+	return E_NOTIMPL;
+}
+
+HRESULT LoopbackVideoFrame::SetFlags(BMDFrameFlags newFlags)
+{
+	m_store.SetFlags(newFlags);
+	return S_OK;
+}
+
+HRESULT LoopbackVideoFrame::SetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode* timecode)
+{
+	return m_store.SetTimecode(format, timecode);
+}
+
+HRESULT LoopbackVideoFrame::SetTimecodeFromComponents(BMDTimecodeFormat format, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags)
+{
+	return m_store.SetTimecodeFromComponents(format, hours, minutes, seconds, frames, flags);
+}
+
+HRESULT LoopbackVideoFrame::SetAncillaryData(IDeckLinkVideoFrameAncillary* ancillary)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT LoopbackVideoFrame::SetTimecodeUserBits(BMDTimecodeFormat format, BMDTimecodeUserBits userBits)
+{
+	return m_store.SetTimecodeUserBits(format, userBits);
+}
+
+HRESULT LoopbackVideoFrame::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkVideoFrame))
+	{
+		*ppv = (IDeckLinkVideoFrame*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	if (sameIID(iid, IID_IDeckLinkMutableVideoFrame))
+	{
+		*ppv = (IDeckLinkMutableVideoFrame*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	if (sameIID(iid, IID_IDeckLinkVideoFrameAncillaryPackets))
+		return m_store.QueryAncillaryPackets(ppv);
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackVideoFrame::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackVideoFrame::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* LoopbackVideoInputFrame class */
+
+LoopbackVideoInputFrame::LoopbackVideoInputFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags,
+												 BMDTimeValue streamTime, BMDTimeValue frameDuration, BMDTimeScale timeScale, BMDTimeValue hardwareTimeNs) :
+	m_store(width, height, rowBytes, pixelFormat, flags),
+	m_streamTime(streamTime), m_frameDuration(frameDuration), m_timeScale(timeScale), m_hardwareTimeNs(hardwareTimeNs),
+	m_refCount(1)
+{
+}
+
+HRESULT LoopbackVideoInputFrame::GetBytes(void** buffer)
+{
+	if (buffer == NULL)
+		return E_POINTER;
+
+	*buffer = m_store.Bytes();
+	return (*buffer != NULL) ? S_OK : E_FAIL;
+}
+
+HRESULT LoopbackVideoInputFrame::GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode)
+{
+	return m_store.GetTimecode(format, timecode);
+}
+
+HRESULT LoopbackVideoInputFrame::GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT LoopbackVideoInputFrame::GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+{
+	if (timeScale == 0)
+		return E_INVALIDARG;
+
+	if (frameTime)
+		*frameTime = LoopbackRescaleTime(m_streamTime, m_timeScale, timeScale);
+	if (frameDuration)
+		*frameDuration = LoopbackRescaleTime(m_frameDuration, m_timeScale, timeScale);
+
+	return S_OK;
+}
+
+HRESULT LoopbackVideoInputFrame::GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration)
+{
+	if (timeScale == 0)
+		return E_INVALIDARG;
+
+	if (frameTime)
+		*frameTime = LoopbackRescaleTime(m_hardwareTimeNs, 1000000000, timeScale);
+	if (frameDuration)
+		*frameDuration = LoopbackRescaleTime(m_frameDuration, m_timeScale, timeScale);
+
+	return S_OK;
+}
+
+HRESULT LoopbackVideoInputFrame::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkVideoFrame))
+	{
+		*ppv = (IDeckLinkVideoFrame*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	if (sameIID(iid, IID_IDeckLinkVideoInputFrame))
+	{
+		*ppv = (IDeckLinkVideoInputFrame*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	if (sameIID(iid, IID_IDeckLinkVideoFrameAncillaryPackets))
+		return m_store.QueryAncillaryPackets(ppv);
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackVideoInputFrame::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackVideoInputFrame::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+/* LoopbackAudioInputPacket class */
+
+LoopbackAudioInputPacket::LoopbackAudioInputPacket(uint32_t sampleFrameCount, uint32_t bytesPerSampleFrame, BMDTimeValue packetTime, BMDTimeScale timeScale) :
+	m_sampleFrameCount(sampleFrameCount), m_buffer((size_t)sampleFrameCount * bytesPerSampleFrame),
+	m_packetTime(packetTime), m_timeScale(timeScale), m_refCount(1)
+{
+}
+
+HRESULT LoopbackAudioInputPacket::GetBytes(void** buffer)
+{
+	if (buffer == NULL)
+		return E_POINTER;
+
+	*buffer = m_buffer.data();
+	return S_OK;
+}
+
+HRESULT LoopbackAudioInputPacket::GetPacketTime(BMDTimeValue* packetTime, BMDTimeScale timeScale)
+{
+	if ((packetTime == NULL) || (timeScale == 0))
+		return E_INVALIDARG;
+
+	*packetTime = LoopbackRescaleTime(m_packetTime, m_timeScale, timeScale);
+	return S_OK;
+}
+
+HRESULT LoopbackAudioInputPacket::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if (isIUnknown(iid) || sameIID(iid, IID_IDeckLinkAudioInputPacket))
+	{
+		*ppv = (IDeckLinkAudioInputPacket*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG LoopbackAudioInputPacket::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG LoopbackAudioInputPacket::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
@@ -0,0 +1,286 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Timecode formats carried through the loopback, in RP188Any search order
+static const BMDTimecodeFormat kLoopbackTimecodeFormats[] =
+{
+	bmdTimecodeRP188HighFrameRate,
+	bmdTimecodeRP188VITC1,
+	bmdTimecodeRP188LTC,
+	bmdTimecodeRP188VITC2,
+	bmdTimecodeVITC,
+	bmdTimecodeVITCField2,
+	bmdTimecodeSerial,
+};
+static const int kLoopbackTimecodeFormatCount = sizeof(kLoopbackTimecodeFormats) / sizeof(kLoopbackTimecodeFormats[0]);
+
+struct LoopbackTimecodeValue
+{
+	bool					valid;
+	uint8_t					hours;
+	uint8_t					minutes;
+	uint8_t					seconds;
+	uint8_t					frames;
+	BMDTimecodeFlags		flags;
+	BMDTimecodeUserBits		userBits;
+};
+
+class LoopbackTimecode : public IDeckLinkTimecode
+{
+public:
+	LoopbackTimecode(const LoopbackTimecodeValue& value);
+
+	// IDeckLinkTimecode interface
+	virtual BMDTimecodeBCD		STDMETHODCALLTYPE	GetBCD(void);
+	virtual HRESULT				STDMETHODCALLTYPE	GetComponents(uint8_t* hours, uint8_t* minutes, uint8_t* seconds, uint8_t* frames);
+	virtual HRESULT				STDMETHODCALLTYPE	GetString(const char** timecode);
+	virtual BMDTimecodeFlags	STDMETHODCALLTYPE	GetFlags(void)		{ return m_value.flags; }
+	virtual HRESULT				STDMETHODCALLTYPE	GetTimecodeUserBits(BMDTimecodeUserBits* userBits);
+
+	// IUnknown interface
+	virtual HRESULT				STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG				STDMETHODCALLTYPE	AddRef();
+	virtual ULONG				STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackTimecode() {}
+
+	LoopbackTimecodeValue		m_value;
+	std::atomic<ULONG>			m_refCount;
+};
+
+// Captured ancillary packet, holding a private copy of the 8-bit user data words
+class LoopbackAncillaryPacket : public IDeckLinkAncillaryPacket
+{
+public:
+	LoopbackAncillaryPacket(uint8_t did, uint8_t sdid, uint32_t lineNumber, uint8_t dataStreamIndex, const void* data, uint32_t size);
+
+	// IDeckLinkAncillaryPacket interface
+	virtual HRESULT		STDMETHODCALLTYPE	GetBytes(BMDAncillaryPacketFormat format, const void** data, uint32_t* size);
+	virtual uint8_t		STDMETHODCALLTYPE	GetDID(void)				{ return m_did; }
+	virtual uint8_t		STDMETHODCALLTYPE	GetSDID(void)				{ return m_sdid; }
+	virtual uint32_t	STDMETHODCALLTYPE	GetLineNumber(void)			{ return m_lineNumber; }
+	virtual uint8_t		STDMETHODCALLTYPE	GetDataStreamIndex(void)	{ return m_dataStreamIndex; }
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackAncillaryPacket() {}
+
+	uint8_t						m_did;
+	uint8_t						m_sdid;
+	uint32_t					m_lineNumber;
+	uint8_t						m_dataStreamIndex;
+	std::vector<uint8_t>		m_data;
+	std::atomic<ULONG>			m_refCount;
+};
+
+class LoopbackAncillaryPackets : public IDeckLinkVideoFrameAncillaryPackets
+{
+public:
+	LoopbackAncillaryPackets();
+
+	// Replace the contents with copies of every packet in the source store
+	void				CopyFrom(IDeckLinkVideoFrameAncillaryPackets* source);
+
+	// IDeckLinkVideoFrameAncillaryPackets interface
+	virtual HRESULT		STDMETHODCALLTYPE	GetPacketIterator(IDeckLinkAncillaryPacketIterator** iterator);
+	virtual HRESULT		STDMETHODCALLTYPE	GetFirstPacketByID(uint8_t DID, uint8_t SDID, IDeckLinkAncillaryPacket** packet);
+	virtual HRESULT		STDMETHODCALLTYPE	AttachPacket(IDeckLinkAncillaryPacket* packet);
+	virtual HRESULT		STDMETHODCALLTYPE	DetachPacket(IDeckLinkAncillaryPacket* packet);
+	virtual HRESULT		STDMETHODCALLTYPE	DetachAllPackets(void);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackAncillaryPackets();
+
+	std::mutex								m_mutex;
+	std::vector<IDeckLinkAncillaryPacket*>	m_packets;
+	std::atomic<ULONG>						m_refCount;
+};
+
+// Storage shared by output and captured frames: the pixel buffer, timecodes and ancillary packets
+class LoopbackFrameStore
+{
+public:
+	LoopbackFrameStore(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags);
+	~LoopbackFrameStore();
+
+	HRESULT				Allocate(IDeckLinkMemoryAllocator* allocator);
+
+	long				Width(void) const			{ return m_width; }
+	long				Height(void) const			{ return m_height; }
+	long				RowBytes(void) const		{ return m_rowBytes; }
+	BMDPixelFormat		PixelFormat(void) const		{ return m_pixelFormat; }
+	BMDFrameFlags		Flags(void) const			{ return m_flags; }
+	void				SetFlags(BMDFrameFlags flags)	{ m_flags = flags; }
+	void*				Bytes(void) const			{ return m_buffer; }
+
+	HRESULT				GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode);
+	HRESULT				SetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode* timecode);
+	HRESULT				SetTimecodeFromComponents(BMDTimecodeFormat format, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags);
+	HRESULT				SetTimecodeUserBits(BMDTimecodeFormat format, BMDTimecodeUserBits userBits);
+
+	HRESULT				QueryAncillaryPackets(LPVOID *ppv);
+
+	// Copies timecodes and ancillary packets (but not pixels) from any frame implementation
+	void				CopyMetadataFrom(IDeckLinkVideoFrame* source);
+
+private:
+	LoopbackTimecodeValue*		findTimecode(BMDTimecodeFormat format);
+
+	long						m_width;
+	long						m_height;
+	long						m_rowBytes;
+	BMDPixelFormat				m_pixelFormat;
+	BMDFrameFlags				m_flags;
+	IDeckLinkMemoryAllocator*	m_allocator;
+	void*						m_buffer;
+	LoopbackTimecodeValue		m_timecodes[kLoopbackTimecodeFormatCount];
+	LoopbackAncillaryPackets*	m_ancillaryPackets;
+};
+
+// Frame returned by IDeckLinkOutput::CreateVideoFrame
+class LoopbackVideoFrame : public IDeckLinkMutableVideoFrame
+{
+public:
+	LoopbackVideoFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags);
+
+	HRESULT				Allocate(IDeckLinkMemoryAllocator* allocator)	{ return m_store.Allocate(allocator); }
+
+	// IDeckLinkVideoFrame interface
+	virtual long				STDMETHODCALLTYPE	GetWidth(void)				{ return m_store.Width(); }
+	virtual long				STDMETHODCALLTYPE	GetHeight(void)				{ return m_store.Height(); }
+	virtual long				STDMETHODCALLTYPE	GetRowBytes(void)			{ return m_store.RowBytes(); }
+	virtual BMDPixelFormat		STDMETHODCALLTYPE	GetPixelFormat(void)		{ return m_store.PixelFormat(); }
+	virtual BMDFrameFlags		STDMETHODCALLTYPE	GetFlags(void)				{ return m_store.Flags(); }
+	virtual HRESULT				STDMETHODCALLTYPE	GetBytes(void** buffer);
+	virtual HRESULT				STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode);
+	virtual HRESULT				STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary);
+
+	// IDeckLinkMutableVideoFrame interface
+	virtual HRESULT				STDMETHODCALLTYPE	SetFlags(BMDFrameFlags newFlags);
+	virtual HRESULT				STDMETHODCALLTYPE	SetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode* timecode);
+	virtual HRESULT				STDMETHODCALLTYPE	SetTimecodeFromComponents(BMDTimecodeFormat format, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags);
+	virtual HRESULT				STDMETHODCALLTYPE	SetAncillaryData(IDeckLinkVideoFrameAncillary* ancillary);
+	virtual HRESULT				STDMETHODCALLTYPE	SetTimecodeUserBits(BMDTimecodeFormat format, BMDTimecodeUserBits userBits);
+
+	// IUnknown interface
+	virtual HRESULT				STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG				STDMETHODCALLTYPE	AddRef();
+	virtual ULONG				STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackVideoFrame() {}
+
+	LoopbackFrameStore			m_store;
+	std::atomic<ULONG>			m_refCount;
+};
+
+// Frame delivered to IDeckLinkInputCallback::VideoInputFrameArrived
+class LoopbackVideoInputFrame : public IDeckLinkVideoInputFrame
+{
+public:
+	LoopbackVideoInputFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags,
+							BMDTimeValue streamTime, BMDTimeValue frameDuration, BMDTimeScale timeScale, BMDTimeValue hardwareTimeNs);
+
+	HRESULT				Allocate(IDeckLinkMemoryAllocator* allocator)	{ return m_store.Allocate(allocator); }
+	LoopbackFrameStore&	Store(void)										{ return m_store; }
+
+	// IDeckLinkVideoFrame interface
+	virtual long				STDMETHODCALLTYPE	GetWidth(void)				{ return m_store.Width(); }
+	virtual long				STDMETHODCALLTYPE	GetHeight(void)				{ return m_store.Height(); }
+	virtual long				STDMETHODCALLTYPE	GetRowBytes(void)			{ return m_store.RowBytes(); }
+	virtual BMDPixelFormat		STDMETHODCALLTYPE	GetPixelFormat(void)		{ return m_store.PixelFormat(); }
+	virtual BMDFrameFlags		STDMETHODCALLTYPE	GetFlags(void)				{ return m_store.Flags(); }
+	virtual HRESULT				STDMETHODCALLTYPE	GetBytes(void** buffer);
+	virtual HRESULT				STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode);
+	virtual HRESULT				STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary);
+
+	// IDeckLinkVideoInputFrame interface
+	virtual HRESULT				STDMETHODCALLTYPE	GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale);
+	virtual HRESULT				STDMETHODCALLTYPE	GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration);
+
+	// IUnknown interface
+	virtual HRESULT				STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG				STDMETHODCALLTYPE	AddRef();
+	virtual ULONG				STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackVideoInputFrame() {}
+
+	LoopbackFrameStore			m_store;
+	BMDTimeValue				m_streamTime;
+	BMDTimeValue				m_frameDuration;
+	BMDTimeScale				m_timeScale;
+	BMDTimeValue				m_hardwareTimeNs;
+	std::atomic<ULONG>			m_refCount;
+};
+
+class LoopbackAudioInputPacket : public IDeckLinkAudioInputPacket
+{
+public:
+	LoopbackAudioInputPacket(uint32_t sampleFrameCount, uint32_t bytesPerSampleFrame, BMDTimeValue packetTime, BMDTimeScale timeScale);
+
+	void*				Bytes(void)		{ return m_buffer.data(); }
+
+	// IDeckLinkAudioInputPacket interface
+	virtual long		STDMETHODCALLTYPE	GetSampleFrameCount(void)	{ return m_sampleFrameCount; }
+	virtual HRESULT		STDMETHODCALLTYPE	GetBytes(void** buffer);
+	virtual HRESULT		STDMETHODCALLTYPE	GetPacketTime(BMDTimeValue* packetTime, BMDTimeScale timeScale);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~LoopbackAudioInputPacket() {}
+
+	uint32_t					m_sampleFrameCount;
+	std::vector<uint8_t>		m_buffer;
+	BMDTimeValue				m_packetTime;
+	BMDTimeScale				m_timeScale;
+	std::atomic<ULONG>			m_refCount;
+};
+
+// Rescale a time value between time scales without intermediate overflow
+BMDTimeValue LoopbackRescaleTime(BMDTimeValue value, BMDTimeScale fromScale, BMDTimeScale toScale);
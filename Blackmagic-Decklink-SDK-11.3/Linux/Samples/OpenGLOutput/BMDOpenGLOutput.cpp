@@ -32,7 +32,7 @@
 #include "BMDOpenGLOutput.h"
 
 BMDOpenGLOutput::BMDOpenGLOutput()
-	: pFrameBuf(NULL), pDL(NULL), pDLOutput(NULL)
+	: pFrameBuf(NULL), pDL(NULL), pDLOutput(NULL), pFramePool(NULL)
 {
 	QGLFormat fmt;
 	fmt.setRedBufferSize(8);
@@ -47,6 +47,9 @@ BMDOpenGLOutput::BMDOpenGLOutput()
 
 BMDOpenGLOutput::~BMDOpenGLOutput()
 {
+	delete pFramePool;
+	pFramePool = NULL;
+
 	if (pDLOutput != NULL)
 	{
 		pDLOutput->Release();
@@ -75,35 +78,20 @@ void BMDOpenGLOutput::SetPreroll()
 	IDeckLinkMutableVideoFrame* pDLVideoFrame = NULL;
 
 	// Set 3 frame preroll
-	for (uint32_t i=0; i < 3; i++)
+	for (uint32_t i=0; i < kPrerollFrames; i++)
 	{
-		// Flip frame vertical, because OpenGL rendering starts from left bottom corner
-		if (pDLOutput->CreateVideoFrame(uiFrameWidth, uiFrameHeight, uiFrameWidth*4, bmdFormat8BitBGRA, bmdFrameFlagFlipVertical, &pDLVideoFrame) != S_OK)
-			goto bail;
-
-		if (pDLOutput->ScheduleVideoFrame(pDLVideoFrame, (uiTotalFrames * frameDuration), frameDuration, frameTimescale) != S_OK)
-			goto bail;
+		if (pFramePool->AcquireFrame(kOutputFrameContentUnknown, &pDLVideoFrame, NULL) != S_OK)
+			return;
 
-		/* The local reference to the IDeckLinkVideoFrame is released here, as the ownership has now been passed to
-		 *  the DeckLinkAPI via ScheduleVideoFrame.
-		 *
-		 * After the API has finished with the frame, it is returned to the application via ScheduledFrameCompleted.
-		 * In ScheduledFrameCompleted, this application updates the video frame and passes it to ScheduleVideoFrame,
-		 * returning ownership to the DeckLink API.
+		/* The frame stays owned by the pool. After the API has finished with the frame, it is returned to the
+		 * application via ScheduledFrameCompleted, which hands it back to the pool and renders the current scene
+		 * into a free frame. A frame is never drawn into while the device may still be reading it.
 		 */
-		pDLVideoFrame->Release();
-		pDLVideoFrame = NULL;
+		if (pFramePool->ScheduleFrame(pDLVideoFrame, kOutputFrameContentUnknown, (uiTotalFrames * frameDuration), frameDuration, frameTimescale) != S_OK)
+			return;
 
 		uiTotalFrames++;
 	}
-	return;
-
-bail:
-	if (pDLVideoFrame)
-	{
-		pDLVideoFrame->Release();
-		pDLVideoFrame = NULL;
-	}
 }
 
 bool BMDOpenGLOutput::InitDeckLink()
@@ -225,6 +213,11 @@ bool BMDOpenGLOutput::Start()
 		goto bail;
 	
 	uiTotalFrames = 0;
+
+	// Flip frames vertical, because OpenGL rendering starts from left bottom corner
+	pFramePool = new OutputFramePool(pDLOutput);
+	if (pFramePool->Allocate(kPrerollFrames + kSpareFrames, uiFrameWidth, uiFrameHeight, uiFrameWidth*4, bmdFormat8BitBGRA, bmdFrameFlagFlipVertical) != S_OK)
+		goto bail;
 	
 	SetPreroll();
 
@@ -283,6 +276,9 @@ bool BMDOpenGLOutput::Stop()
 	pDLOutput->DisableVideoOutput();
 	
 	Mutex.lock();
+
+	delete pFramePool;
+	pFramePool = NULL;
 	
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 
@@ -310,17 +306,33 @@ void BMDOpenGLOutput::UpdateScene()
 	Mutex.unlock();
 }
 
-void BMDOpenGLOutput::RenderToDevice(IDeckLinkVideoFrame* pDLVideoFrame)
+void BMDOpenGLOutput::RenderToDevice(IDeckLinkVideoFrame* pCompletedFrame)
 {
 	Mutex.lock();
 
+	IDeckLinkMutableVideoFrame*	pDLVideoFrame;
 	void*	pFrame;
 
+	// Playback is stopping once the pool has gone
+	if ((pFramePool == NULL) || (pFrameBuf == NULL))
+	{
+		Mutex.unlock();
+		return;
+	}
+
+	pFramePool->FrameCompleted(pCompletedFrame);
+
+	if (pFramePool->AcquireFrame(kOutputFrameContentUnknown, &pDLVideoFrame, NULL) != S_OK)
+	{
+		Mutex.unlock();
+		return;
+	}
+
 	pDLVideoFrame->GetBytes((void**)&pFrame);
 
 	memcpy(pFrame, pFrameBuf, pDLVideoFrame->GetRowBytes() * uiFrameHeight);
 
-	if (pDLOutput->ScheduleVideoFrame(pDLVideoFrame, (uiTotalFrames * frameDuration), frameDuration, frameTimescale) != S_OK)
+	if (pFramePool->ScheduleFrame(pDLVideoFrame, kOutputFrameContentUnknown, (uiTotalFrames * frameDuration), frameDuration, frameTimescale) != S_OK)
 	{
 		Mutex.unlock();
 		return;
@@ -38,9 +38,15 @@
 
 #include "DeckLinkAPI.h"
 #include "GLScene.h"
+#include "OutputFramePool.h"
 
 class RenderDelegate;
 
+const uint32_t kPrerollFrames = 3;
+
+// Frames beyond the preroll, so a free frame is ready when a completion arrives
+const uint32_t kSpareFrames = 2;
+
 class BMDOpenGLOutput
 {
 private:
@@ -58,6 +64,7 @@ private:
 	
 	IDeckLink*					pDL;
 	IDeckLinkOutput*			pDLOutput;
+	OutputFramePool*			pFramePool;
 	
 	BMDTimeValue				frameDuration;
 	BMDTimeScale				frameTimescale;
@@ -79,7 +86,7 @@ public:
 	void UpdateScene();
 	bool Stop();
 
-	void RenderToDevice(IDeckLinkVideoFrame* pDLVideoFrame);
+	void RenderToDevice(IDeckLinkVideoFrame* pCompletedFrame);
 };
 
 ////////////////////////////////////////////
@@ -2,20 +2,22 @@ TEMPLATE  	= app
 LANGUAGE  	= C++
 CONFIG		+= qt opengl
 QT			+= opengl
-INCLUDEPATH =	../../include 
+INCLUDEPATH =	../../include ../VideoConversion
 LIBS		+= -lGLU -ldl
 
 HEADERS 	=	OpenGLOutput.h \
     CDeckLinkGLWidget.h \
     BMDOpenGLOutput.h \
     GLScene.h \
-    GLExtensions.h
+    GLExtensions.h \
+    ../VideoConversion/OutputFramePool.h
 SOURCES 	= 	main.cpp \
             	../../include/DeckLinkAPIDispatch.cpp \
             	OpenGLOutput.cpp \
     CDeckLinkGLWidget.cpp \
     BMDOpenGLOutput.cpp \
     GLScene.cpp \
-    GLExtensions.cpp
+    GLExtensions.cpp \
+    ../VideoConversion/OutputFramePool.cpp
 
 FORMS 		= 	OpenGLOutput.ui
@@ -0,0 +1,178 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "platform.h"
+#include "ImageLoader.h"
+#include "FrameStore.h"
+#include "V210Conversion.h"
+
+// Packs a directory of PNG stills into a frame store for PlaybackStills -s. No DeckLink
+// device is needed; frames are laid out exactly as CreateVideoFrame would lay them out.
+
+struct PixelFormatName
+{
+	const char*		name;
+	BMDPixelFormat	pixelFormat;
+};
+
+static const PixelFormatName kPixelFormatNames[] =
+{
+	{ "v210",	bmdFormat10BitYUV },
+	{ "2vuy",	bmdFormat8BitYUV },
+	{ "bgra",	bmdFormat8BitBGRA },
+};
+
+static void DisplayUsage(void)
+{
+	fprintf(stderr,
+		"\n"
+		"Usage: ./BuildFrameStore [OPTIONS] <imagedirectory> <framestore>\n"
+		"\n"
+		"    -p <pixel format>\n        Stored pixel format: v210, 2vuy or bgra (default is v210)\n"
+		"    -s <width>x<height>\n        Frame size (default is 1920x1080)\n"
+		"\n"
+		"Pack PNG image stills from a directory into a frame store, in filename order. eg:\n"
+		"\n"
+		"    ./BuildFrameStore -p v210 -s 1920x1080 ~/Pictures/ stills.dlfs\n"
+		);
+}
+
+int main(int argc, char* argv[])
+{
+	BMDPixelFormat					pixelFormat		= bmdFormat10BitYUV;
+	long							width			= 1920;
+	long							height			= 1080;
+	bool							displayHelp		= false;
+	std::vector<std::string>		positionalArgs;
+	std::vector<std::string>		pngFiles;
+	std::vector<uint8_t>			decodeBuffer;
+	std::vector<uint8_t>			storeBuffer;
+	FrameStoreVideoFrame*			decodeFrame		= NULL;
+	FrameStoreWriter				writer;
+	long							decodeRowBytes;
+	int								exitStatus		= 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc))
+		{
+			const char* name = argv[++i];
+
+			displayHelp = true;
+			for (const PixelFormatName& formatName : kPixelFormatNames)
+			{
+				if (strcmp(name, formatName.name) == 0)
+				{
+					pixelFormat = formatName.pixelFormat;
+					displayHelp = false;
+				}
+			}
+		}
+		else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc))
+		{
+			if ((sscanf(argv[++i], "%ldx%ld", &width, &height) != 2) || (width <= 0) || (height <= 0))
+				displayHelp = true;
+		}
+		else if ((strcmp(argv[i], "?") == 0) || (strcmp(argv[i], "-h") == 0))
+			displayHelp = true;
+		else
+			positionalArgs.push_back(argv[i]);
+	}
+
+	if (positionalArgs.size() != 2)
+		displayHelp = true;
+	else if (!IsPathDirectory(positionalArgs[0]))
+	{
+		fprintf(stderr, "Invalid directory specified\n");
+		displayHelp = true;
+	}
+	else if ((ImageLoader::GetPNGFilesFromDir(positionalArgs[0], pngFiles) != S_OK) || pngFiles.empty())
+	{
+		fprintf(stderr, "No images found in image directory\n");
+		displayHelp = true;
+	}
+
+	if (displayHelp)
+	{
+		DisplayUsage();
+		return 1;
+	}
+
+	if (writer.Create(positionalArgs[1], pixelFormat, width, height, (uint32_t)pngFiles.size()) != S_OK)
+		return 1;
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	// PNGs are decoded to BGRA, then packed into the stored format at the device row stride
+	decodeRowBytes = GetFrameStoreRowBytes(ImageLoader::kImageLoaderPixelFormat, width);
+	decodeBuffer.resize(decodeRowBytes * height);
+	storeBuffer.resize(writer.GetRowBytes() * height);
+	decodeFrame = new FrameStoreVideoFrame(NULL, decodeBuffer.data(), width, height, decodeRowBytes, ImageLoader::kImageLoaderPixelFormat);
+
+	for (const std::string& pngFile : pngFiles)
+	{
+		if (ImageLoader::ConvertPNGToDeckLinkVideoFrame(pngFile, decodeFrame) != S_OK)
+		{
+			fprintf(stderr, "Error reading PNG file: %s\n", pngFile.c_str());
+			goto bail;
+		}
+
+		if (ConvertPixelRows(ImageLoader::kImageLoaderPixelFormat, decodeBuffer.data(), decodeRowBytes,
+							 pixelFormat, storeBuffer.data(), writer.GetRowBytes(),
+							 width, height, GetColorspaceForFrameHeight(height)) != S_OK)
+		{
+			fprintf(stderr, "Unable to convert PNG file: %s\n", pngFile.c_str());
+			goto bail;
+		}
+
+		if (writer.AppendFrame(storeBuffer.data()) != S_OK)
+		{
+			fprintf(stderr, "Error writing frame store\n");
+			goto bail;
+		}
+	}
+
+	if (writer.Finish() != S_OK)
+	{
+		fprintf(stderr, "Error writing frame store\n");
+		goto bail;
+	}
+
+	fprintf(stderr, "Stored %d frames of %ldx%ld in %s (%.1f s)\n", (int)pngFiles.size(), width, height, positionalArgs[1].c_str(),
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+	exitStatus = 0;
+
+bail:
+	if (decodeFrame != NULL)
+		decodeFrame->Release();
+
+	return exitStatus;
+}
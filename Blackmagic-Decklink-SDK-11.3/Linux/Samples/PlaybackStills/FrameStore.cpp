@@ -0,0 +1,366 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "FrameStore.h"
+
+static inline bool CompareREFIID(const REFIID& ref1, const REFIID& ref2)
+{
+	return memcmp(&ref1, &ref2, sizeof(REFIID)) == 0;
+}
+
+static inline uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + kFrameStoreAlignment - 1) & ~(uint64_t)(kFrameStoreAlignment - 1);
+}
+
+int32_t GetFrameStoreRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return (int32_t)width * 2;
+
+		case bmdFormat10BitYUV:
+			return (int32_t)((width + 47) / 48) * 128;
+
+		case bmdFormat8BitBGRA:
+			return (int32_t)width * 4;
+
+		default:
+			return 0;
+	}
+}
+
+// FrameStoreVideoFrame
+
+FrameStoreVideoFrame::FrameStoreVideoFrame(FrameStore* owner, void* bytes, long width, long height, long rowBytes, BMDPixelFormat pixelFormat) :
+	m_owner(owner),
+	m_bytes(bytes),
+	m_width(width),
+	m_height(height),
+	m_rowBytes(rowBytes),
+	m_pixelFormat(pixelFormat),
+	m_refCount(1)
+{
+	if (m_owner)
+		m_owner->AddRef();
+}
+
+FrameStoreVideoFrame::~FrameStoreVideoFrame()
+{
+	if (m_owner)
+		m_owner->Release();
+	m_owner = NULL;
+}
+
+HRESULT FrameStoreVideoFrame::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	if (CompareREFIID(iid, IID_IUnknown))
+		*ppv = static_cast<IDeckLinkVideoFrame*>(this);
+	else if (CompareREFIID(iid, IID_IDeckLinkVideoFrame))
+		*ppv = static_cast<IDeckLinkVideoFrame*>(this);
+	else
+	{
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	AddRef();
+	return S_OK;
+}
+
+ULONG FrameStoreVideoFrame::AddRef(void)
+{
+	// gcc atomic operation builtin
+	return __sync_add_and_fetch(&m_refCount, 1);
+}
+
+ULONG FrameStoreVideoFrame::Release(void)
+{
+	// gcc atomic operation builtin
+	ULONG newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
+	if (!newRefValue)
+		delete this;
+	return newRefValue;
+}
+
+long FrameStoreVideoFrame::GetWidth(void)
+{
+	return m_width;
+}
+
+long FrameStoreVideoFrame::GetHeight(void)
+{
+	return m_height;
+}
+
+long FrameStoreVideoFrame::GetRowBytes(void)
+{
+	return m_rowBytes;
+}
+
+BMDPixelFormat FrameStoreVideoFrame::GetPixelFormat(void)
+{
+	return m_pixelFormat;
+}
+
+BMDFrameFlags FrameStoreVideoFrame::GetFlags(void)
+{
+	return bmdFrameFlagDefault;
+}
+
+HRESULT FrameStoreVideoFrame::GetBytes(void** buffer)
+{
+	*buffer = m_bytes;
+	return S_OK;
+}
+
+HRESULT FrameStoreVideoFrame::GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode)
+{
+	*timecode = NULL;
+	return S_FALSE;
+}
+
+HRESULT FrameStoreVideoFrame::GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary)
+{
+	*ancillary = NULL;
+	return S_FALSE;
+}
+
+// FrameStore
+
+FrameStore::FrameStore() :
+	m_refCount(1),
+	m_fd(-1),
+	m_mapping(NULL),
+	m_mappingSize(0),
+	m_index(NULL)
+{
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+FrameStore::~FrameStore()
+{
+	if (m_mapping != NULL)
+		munmap(m_mapping, m_mappingSize);
+
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+HRESULT FrameStore::Open(const std::string& path, FrameStore** frameStore)
+{
+	FrameStore*	store	= new FrameStore();
+	struct stat	fileStatus;
+	uint64_t	frameBytes;
+	uint64_t	indexEnd;
+
+	*frameStore = NULL;
+
+	store->m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ((store->m_fd < 0) || (fstat(store->m_fd, &fileStatus) != 0))
+	{
+		fprintf(stderr, "Could not open frame store %s\n", path.c_str());
+		goto bail;
+	}
+
+	if ((size_t)fileStatus.st_size < sizeof(FrameStoreHeader))
+		goto invalid;
+
+	store->m_mappingSize = (size_t)fileStatus.st_size;
+	store->m_mapping = (uint8_t*)mmap(NULL, store->m_mappingSize, PROT_READ, MAP_SHARED, store->m_fd, 0);
+	if (store->m_mapping == MAP_FAILED)
+	{
+		store->m_mapping = NULL;
+		fprintf(stderr, "Could not map frame store %s\n", path.c_str());
+		goto bail;
+	}
+
+	memcpy(&store->m_header, store->m_mapping, sizeof(FrameStoreHeader));
+	if ((store->m_header.magic != kFrameStoreMagic) || (store->m_header.version != kFrameStoreVersion))
+		goto invalid;
+
+	if ((store->m_header.rowBytes == 0) || (store->m_header.rowBytes != (uint32_t)GetFrameStoreRowBytes(store->GetPixelFormat(), store->m_header.width)))
+		goto invalid;
+
+	indexEnd = sizeof(FrameStoreHeader) + (uint64_t)store->m_header.frameCount * sizeof(FrameStoreIndexEntry);
+	if ((store->m_header.frameCount == 0) || (indexEnd > store->m_mappingSize))
+		goto invalid;
+
+	store->m_index = (const FrameStoreIndexEntry*)(store->m_mapping + sizeof(FrameStoreHeader));
+	frameBytes = (uint64_t)store->m_header.rowBytes * store->m_header.height;
+
+	for (uint32_t i = 0; i < store->m_header.frameCount; i++)
+	{
+		const FrameStoreIndexEntry& entry = store->m_index[i];
+
+		if ((entry.size != frameBytes) || (entry.offset < indexEnd) || (entry.offset + entry.size > store->m_mappingSize))
+			goto invalid;
+	}
+
+	// Start reading the frames in now, so playout rarely takes a page fault
+	madvise(store->m_mapping, store->m_mappingSize, MADV_WILLNEED);
+
+	*frameStore = store;
+	return S_OK;
+
+invalid:
+	fprintf(stderr, "%s is not a valid frame store\n", path.c_str());
+
+bail:
+	store->Release();
+	return E_FAIL;
+}
+
+ULONG FrameStore::AddRef(void)
+{
+	// gcc atomic operation builtin
+	return __sync_add_and_fetch(&m_refCount, 1);
+}
+
+ULONG FrameStore::Release(void)
+{
+	// gcc atomic operation builtin
+	ULONG newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
+	if (!newRefValue)
+		delete this;
+	return newRefValue;
+}
+
+HRESULT FrameStore::GetFrame(uint32_t frameIndex, IDeckLinkVideoFrame** frame)
+{
+	if (frameIndex >= m_header.frameCount)
+		return E_INVALIDARG;
+
+	*frame = new FrameStoreVideoFrame(this, m_mapping + m_index[frameIndex].offset,
+									  m_header.width, m_header.height, m_header.rowBytes, GetPixelFormat());
+	return S_OK;
+}
+
+// FrameStoreWriter
+
+FrameStoreWriter::FrameStoreWriter() :
+	m_file(NULL),
+	m_nextOffset(0)
+{
+	memset(&m_header, 0, sizeof(m_header));
+}
+
+FrameStoreWriter::~FrameStoreWriter()
+{
+	if (m_file != NULL)
+		fclose(m_file);
+}
+
+HRESULT FrameStoreWriter::Create(const std::string& path, BMDPixelFormat pixelFormat, long width, long height, uint32_t frameCount)
+{
+	int32_t rowBytes = GetFrameStoreRowBytes(pixelFormat, width);
+
+	if ((rowBytes == 0) || (height <= 0) || (frameCount == 0))
+		return E_INVALIDARG;
+
+	m_file = fopen(path.c_str(), "wb");
+	if (m_file == NULL)
+	{
+		fprintf(stderr, "Could not create frame store %s\n", path.c_str());
+		return E_FAIL;
+	}
+
+	m_header.magic			= 0;		// Set by Finish()
+	m_header.version		= kFrameStoreVersion;
+	m_header.pixelFormat	= pixelFormat;
+	m_header.width			= (uint32_t)width;
+	m_header.height			= (uint32_t)height;
+	m_header.rowBytes		= (uint32_t)rowBytes;
+	m_header.frameCount		= frameCount;
+
+	m_index.clear();
+	m_index.reserve(frameCount);
+	m_nextOffset = alignOffset(sizeof(FrameStoreHeader) + (uint64_t)frameCount * sizeof(FrameStoreIndexEntry));
+	m_padding.assign(kFrameStoreAlignment, 0);
+
+	// Reserve space for the header and index up to the first frame
+	if (fseeko(m_file, (off_t)m_nextOffset, SEEK_SET) != 0)
+		return E_FAIL;
+
+	return S_OK;
+}
+
+HRESULT FrameStoreWriter::AppendFrame(const void* bytes)
+{
+	FrameStoreIndexEntry	entry;
+	uint64_t				paddedSize;
+
+	if ((m_file == NULL) || (m_index.size() >= m_header.frameCount))
+		return E_FAIL;
+
+	entry.offset = m_nextOffset;
+	entry.size = (uint64_t)m_header.rowBytes * m_header.height;
+	paddedSize = alignOffset(entry.size);
+
+	if (fwrite(bytes, 1, entry.size, m_file) != entry.size)
+		return E_FAIL;
+
+	if (fwrite(m_padding.data(), 1, paddedSize - entry.size, m_file) != paddedSize - entry.size)
+		return E_FAIL;
+
+	m_index.push_back(entry);
+	m_nextOffset += paddedSize;
+	return S_OK;
+}
+
+HRESULT FrameStoreWriter::Finish(void)
+{
+	HRESULT result = S_OK;
+
+	if (m_file == NULL)
+		return E_FAIL;
+
+	if (m_index.size() != m_header.frameCount)
+		result = E_FAIL;
+
+	if (result == S_OK)
+	{
+		m_header.magic = kFrameStoreMagic;
+
+		if ((fseeko(m_file, 0, SEEK_SET) != 0) ||
+			(fwrite(&m_header, sizeof(m_header), 1, m_file) != 1) ||
+			(fwrite(m_index.data(), sizeof(FrameStoreIndexEntry), m_index.size(), m_file) != m_index.size()))
+			result = E_FAIL;
+	}
+
+	if (fclose(m_file) != 0)
+		result = E_FAIL;
+	m_file = NULL;
+
+	return result;
+}
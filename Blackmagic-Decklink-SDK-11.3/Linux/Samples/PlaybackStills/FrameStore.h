@@ -0,0 +1,159 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// A frame store is a file of frames already packed in an output pixel format, so that
+// playout can map it and schedule the mapped pages directly, with no decode, conversion
+// or copy per frame. Layout:
+//
+//   FrameStoreHeader
+//   FrameStoreIndexEntry[frameCount]
+//   frame data, each frame starting on a kFrameStoreAlignment boundary
+//
+// All fields are little endian. Frames are stored at the same row stride that
+// IDeckLinkOutput::CreateVideoFrame uses for the pixel format.
+
+static const uint32_t kFrameStoreMagic		= 0x53464c44;	// "DLFS"
+static const uint32_t kFrameStoreVersion	= 1;
+static const uint32_t kFrameStoreAlignment	= 4096;
+
+struct FrameStoreHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	pixelFormat;		// BMDPixelFormat
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	rowBytes;
+	uint32_t	frameCount;
+	uint32_t	reserved;
+};
+
+struct FrameStoreIndexEntry
+{
+	uint64_t	offset;				// From the start of the file
+	uint64_t	size;
+};
+
+// Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats. Returns 0 for formats the frame
+// store does not support.
+int32_t		GetFrameStoreRowBytes(BMDPixelFormat pixelFormat, long width);
+
+class FrameStore;
+
+// IDeckLinkVideoFrame over memory owned by something else. Frames handed out by a
+// FrameStore keep the store, and so its mapping, alive until they are released.
+class FrameStoreVideoFrame : public IDeckLinkVideoFrame
+{
+public:
+	FrameStoreVideoFrame(FrameStore* owner, void* bytes, long width, long height, long rowBytes, BMDPixelFormat pixelFormat);
+	virtual ~FrameStoreVideoFrame();
+
+	// IUnknown methods
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG STDMETHODCALLTYPE AddRef(void);
+	virtual ULONG STDMETHODCALLTYPE Release(void);
+
+	// IDeckLinkVideoFrame methods
+	virtual long GetWidth(void);
+	virtual long GetHeight(void);
+	virtual long GetRowBytes(void);
+	virtual BMDPixelFormat GetPixelFormat(void);
+	virtual BMDFrameFlags GetFlags(void);
+	virtual HRESULT GetBytes(/* out */ void** buffer);
+
+	virtual HRESULT GetTimecode (/* in */ BMDTimecodeFormat format, /* out */ IDeckLinkTimecode** timecode);
+	virtual HRESULT GetAncillaryData (/* out */ IDeckLinkVideoFrameAncillary** ancillary);
+
+private:
+	FrameStore*		m_owner;
+	void*			m_bytes;
+	long			m_width;
+	long			m_height;
+	long			m_rowBytes;
+	BMDPixelFormat	m_pixelFormat;
+	int32_t			m_refCount;
+};
+
+// Read-only view of a frame store file, mapped into memory
+class FrameStore
+{
+public:
+	static HRESULT	Open(const std::string& path, FrameStore** frameStore);
+
+	ULONG			AddRef(void);
+	ULONG			Release(void);
+
+	long			GetWidth(void) const		{ return m_header.width; }
+	long			GetHeight(void) const		{ return m_header.height; }
+	long			GetRowBytes(void) const		{ return m_header.rowBytes; }
+	BMDPixelFormat	GetPixelFormat(void) const	{ return (BMDPixelFormat)m_header.pixelFormat; }
+	uint32_t		GetFrameCount(void) const	{ return m_header.frameCount; }
+
+	// Returns a new frame wrapping the mapped pages of one stored frame
+	HRESULT			GetFrame(uint32_t frameIndex, IDeckLinkVideoFrame** frame);
+
+private:
+	FrameStore();
+	~FrameStore();
+
+	int32_t						m_refCount;
+	int							m_fd;
+	uint8_t*					m_mapping;
+	size_t						m_mappingSize;
+	FrameStoreHeader			m_header;
+	const FrameStoreIndexEntry*	m_index;
+};
+
+// Writes a frame store file one frame at a time. The index is written by Finish(), so an
+// interrupted build never leaves a file that looks complete.
+class FrameStoreWriter
+{
+public:
+	FrameStoreWriter();
+	~FrameStoreWriter();
+
+	HRESULT		Create(const std::string& path, BMDPixelFormat pixelFormat, long width, long height, uint32_t frameCount);
+	HRESULT		AppendFrame(const void* bytes);
+	HRESULT		Finish(void);
+
+	long		GetRowBytes(void) const		{ return m_header.rowBytes; }
+
+private:
+	FILE*								m_file;
+	FrameStoreHeader					m_header;
+	std::vector<FrameStoreIndexEntry>	m_index;
+	uint64_t							m_nextOffset;
+	std::vector<uint8_t>				m_padding;
+};
@@ -0,0 +1,183 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include "FrameStorePlayer.h"
+
+// Stills scheduled ahead of the one on air
+static const int kPrerollStills = 3;
+
+FrameStorePlayer::FrameStorePlayer(IDeckLinkOutput* deckLinkOutput, FrameStore* frameStore, int updateInterval, bool loopPlayback) :
+	m_refCount(1),
+	m_deckLinkOutput(deckLinkOutput),
+	m_frameStore(frameStore),
+	m_updateInterval(updateInterval > 0 ? updateInterval : 1),
+	m_loopPlayback(loopPlayback),
+	m_running(false),
+	m_nextFrameIndex(0),
+	m_nextDisplayTime(0),
+	m_stillDuration(0),
+	m_timeScale(0),
+	m_framesLate(0),
+	m_framesDropped(0)
+{
+	m_deckLinkOutput->AddRef();
+	m_frameStore->AddRef();
+}
+
+FrameStorePlayer::~FrameStorePlayer()
+{
+	for (IDeckLinkVideoFrame* frame : m_frames)
+		frame->Release();
+
+	m_frameStore->Release();
+	m_deckLinkOutput->Release();
+}
+
+HRESULT FrameStorePlayer::Start(BMDTimeValue frameDuration, BMDTimeScale timeScale)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Wrap every stored frame once; scheduling then only passes pointers into the mapping
+	for (uint32_t i = 0; i < m_frameStore->GetFrameCount(); i++)
+	{
+		IDeckLinkVideoFrame* frame;
+
+		if (m_frameStore->GetFrame(i, &frame) != S_OK)
+			return E_FAIL;
+		m_frames.push_back(frame);
+	}
+
+	m_stillDuration = frameDuration * m_updateInterval;
+	m_timeScale = timeScale;
+	m_nextFrameIndex = 0;
+	m_nextDisplayTime = 0;
+
+	if (m_deckLinkOutput->SetScheduledFrameCompletionCallback(this) != S_OK)
+	{
+		fprintf(stderr, "Could not set scheduled frame completion callback\n");
+		return E_FAIL;
+	}
+
+	for (int i = 0; i < kPrerollStills; i++)
+	{
+		if (scheduleNextFrameLocked() != S_OK)
+			break;
+	}
+
+	m_running = true;
+	if (m_deckLinkOutput->StartScheduledPlayback(0, m_timeScale, 1.0) != S_OK)
+	{
+		fprintf(stderr, "Could not start scheduled playback\n");
+		m_running = false;
+		m_deckLinkOutput->SetScheduledFrameCompletionCallback(NULL);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+void FrameStorePlayer::Stop(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_running)
+			return;
+		m_running = false;
+	}
+
+	m_deckLinkOutput->StopScheduledPlayback(0, NULL, 0);
+	m_deckLinkOutput->SetScheduledFrameCompletionCallback(NULL);
+
+	if ((m_framesLate > 0) || (m_framesDropped > 0))
+		fprintf(stderr, "Frame store playback: %llu late, %llu dropped\n",
+				(unsigned long long)m_framesLate, (unsigned long long)m_framesDropped);
+}
+
+HRESULT FrameStorePlayer::scheduleNextFrameLocked(void)
+{
+	HRESULT result;
+
+	if (m_nextFrameIndex >= m_frames.size())
+	{
+		if (!m_loopPlayback)
+			return S_FALSE;
+		m_nextFrameIndex = 0;
+	}
+
+	result = m_deckLinkOutput->ScheduleVideoFrame(m_frames[m_nextFrameIndex], m_nextDisplayTime, m_stillDuration, m_timeScale);
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Unable to schedule video frame\n");
+		return result;
+	}
+
+	m_nextFrameIndex++;
+	m_nextDisplayTime += m_stillDuration;
+	return S_OK;
+}
+
+HRESULT FrameStorePlayer::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	*ppv = NULL;
+	return E_NOINTERFACE;
+}
+
+ULONG FrameStorePlayer::AddRef()
+{
+	// gcc atomic operation builtin
+	return __sync_add_and_fetch(&m_refCount, 1);
+}
+
+ULONG FrameStorePlayer::Release()
+{
+	// gcc atomic operation builtin
+	ULONG newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
+	if (!newRefValue)
+		delete this;
+	return newRefValue;
+}
+
+HRESULT FrameStorePlayer::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (result == bmdOutputFrameDisplayedLate)
+		m_framesLate++;
+	else if (result == bmdOutputFrameDropped)
+		m_framesDropped++;
+
+	if (m_running && (result != bmdOutputFrameFlushed))
+		scheduleNextFrameLocked();
+
+	return S_OK;
+}
+
+HRESULT FrameStorePlayer::ScheduledPlaybackHasStopped()
+{
+	return S_OK;
+}
@@ -0,0 +1,75 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "FrameStore.h"
+
+// Scheduled playout straight from a mapped frame store. Each still is scheduled once for
+// the whole update interval, and the completion callback schedules the next, so the
+// output thread never decodes, converts or copies.
+class FrameStorePlayer : public IDeckLinkVideoOutputCallback
+{
+public:
+	FrameStorePlayer(IDeckLinkOutput* deckLinkOutput, FrameStore* frameStore, int updateInterval, bool loopPlayback);
+
+	HRESULT		Start(BMDTimeValue frameDuration, BMDTimeScale timeScale);
+	void		Stop(void);
+
+	// IUnknown
+	virtual HRESULT	STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG	STDMETHODCALLTYPE AddRef();
+	virtual ULONG	STDMETHODCALLTYPE Release();
+
+	// IDeckLinkVideoOutputCallback
+	virtual HRESULT	STDMETHODCALLTYPE ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result);
+	virtual HRESULT	STDMETHODCALLTYPE ScheduledPlaybackHasStopped();
+
+private:
+	virtual ~FrameStorePlayer();
+
+	HRESULT		scheduleNextFrameLocked(void);
+
+	int32_t								m_refCount;
+	IDeckLinkOutput*					m_deckLinkOutput;
+	FrameStore*							m_frameStore;
+	std::vector<IDeckLinkVideoFrame*>	m_frames;
+	int									m_updateInterval;
+	bool								m_loopPlayback;
+
+	std::mutex							m_mutex;
+	bool								m_running;
+	uint32_t							m_nextFrameIndex;
+	BMDTimeValue						m_nextDisplayTime;
+	BMDTimeValue						m_stillDuration;
+	BMDTimeScale						m_timeScale;
+	uint64_t							m_framesLate;
+	uint64_t							m_framesDropped;
+};
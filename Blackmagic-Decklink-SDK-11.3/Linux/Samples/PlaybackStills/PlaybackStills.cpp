@@ -32,94 +32,43 @@
 #include <condition_variable>
 #include "platform.h"
 #include "ImageLoader.h"
+#include "StillFrameCache.h"
+#include "FrameStore.h"
+#include "FrameStorePlayer.h"
 #include "DeckLinkAPI.h"
 
 static const BMDPixelFormat kConvertedPixelFormat = bmdFormat10BitYUV;
 
+static const unsigned kDefaultCacheSize			= 8;
+static const unsigned kDefaultLookAhead			= 3;
+static const unsigned kDefaultLoaderThreadCount	= 2;
+
 std::mutex					g_playbackMutex;
 std::condition_variable		g_playbackStopCondition;
 bool						g_keyPressed = false;
 
-void PlaybackStills(IDeckLinkOutput* deckLinkOutput, IDeckLinkVideoFrame* playbackFrame, std::vector<std::string>& pngFiles, long updateIntervalms, bool loopPlayback, bool convertOutput)
+void PlaybackStills(IDeckLinkOutput* deckLinkOutput, StillFrameCache* stillFrameCache, std::vector<std::string>& pngFiles, long updateIntervalms, bool loopPlayback)
 {
 	std::chrono::milliseconds	timerPeriod(updateIntervalms);
 	int							playbackStillsCount	= 0;
 	bool						playbackRunning		= true;
 	HRESULT						result				= S_OK;
-	IDeckLinkVideoConversion*	frameConverter		= NULL;
-	IDeckLinkMutableVideoFrame*	convertedVideoFrame	= NULL;
-	
-	if (convertOutput)
-	{
-		int outputBytesPerRow;
-
-		result = GetDeckLinkFrameConverter(&frameConverter);
-		if (result != S_OK)
-		{
-			fprintf(stderr, "Unable to get Video Conversion interface\n");
-			goto bail;
-		}
-
-		// Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats
-		switch (kConvertedPixelFormat)
-		{
-			case bmdFormat8BitYUV:
-				outputBytesPerRow = playbackFrame->GetWidth() * 2;
-				break;
-
-			case bmdFormat10BitYUV:
-				outputBytesPerRow = ((playbackFrame->GetWidth() + 47) / 48) * 128;
-				break;
-
-			default:
-				fprintf(stderr, "Unexpected output pixel format\n");
-				goto bail;
-		}
-
-		if (deckLinkOutput->CreateVideoFrame(playbackFrame->GetWidth(), playbackFrame->GetHeight(), outputBytesPerRow,
-			kConvertedPixelFormat, playbackFrame->GetFlags(), &convertedVideoFrame) != S_OK)
-		{
-			fprintf(stderr, "Could not create video frame to convert into\n");
-			playbackRunning = false;
-		}
-	}
 	
 	while (playbackRunning)
 	{
-		result = ImageLoader::ConvertPNGToDeckLinkVideoFrame(pngFiles[playbackStillsCount], playbackFrame);
+		// Stills are decoded and converted ahead of time by the cache's loader threads
+		IDeckLinkVideoFrame* playbackFrame = stillFrameCache->AcquireFrame(playbackStillsCount);
+		if (playbackFrame == NULL)
+			break;
+
+		result = deckLinkOutput->DisplayVideoFrameSync(playbackFrame);
+		stillFrameCache->ReleaseFrame(playbackStillsCount);
 		if (result != S_OK)
 		{
-			fprintf(stderr, "Error reading PNG file: %s\n", pngFiles[playbackStillsCount].c_str());
+			fprintf(stderr, "Unable to display video output\n");
 			playbackRunning = false;
 		}
 		
-		if (convertOutput)
-		{
-			// Pixel format conversion required to output frame
-			if (frameConverter->ConvertFrame(playbackFrame, convertedVideoFrame) != S_OK)
-			{
-				playbackRunning = false;
-				continue;
-			}
-
-			result = deckLinkOutput->DisplayVideoFrameSync(convertedVideoFrame);
-			if (result != S_OK)
-			{
-				fprintf(stderr, "Unable to display video output\n");
-				playbackRunning = false;
-			}
-		}
-		else
-		{
-			// Output frame without format conversion
-			result = deckLinkOutput->DisplayVideoFrameSync(playbackFrame);
-			if (result != S_OK)
-			{
-				fprintf(stderr, "Unable to display video output\n");
-				playbackRunning = false;
-			}
-		}
-		
 		std::unique_lock<std::mutex> lock(g_playbackMutex);
 		if (g_playbackStopCondition.wait_for(lock, timerPeriod, [&]{ return g_keyPressed; }))
 		{
@@ -138,14 +87,6 @@ void PlaybackStills(IDeckLinkOutput* deckLinkOutput, IDeckLinkVideoFrame* playba
 			}
 		}
 	}
-
-bail:
-	if (convertedVideoFrame != NULL)
-		convertedVideoFrame->Release();
-
-	if (frameConverter != NULL)
-		frameConverter->Release();
-
 }
 
 void DisplayUsage(const IDeckLinkOutput* selectedDeckLinkOutput, const std::vector<std::string>& deviceNames,
@@ -218,11 +159,16 @@ void DisplayUsage(const IDeckLinkOutput* selectedDeckLinkOutput, const std::vect
 	fprintf(stderr,
 		"    -i <interval>\n        Playback frame interval rate (default is 1 - every frame)\n"
 		"    -l\n        Loop playback\n"
+		"    -c <frames>\n        Number of decoded stills to keep cached (default is %u)\n"
+		"    -k <frames>\n        Number of stills to load ahead of playback (default is %u)\n"
+		"    -j <threads>\n        Number of loader threads (default is %u)\n"
+		"    -s <framestore>\n        Play pre-rendered frames built by BuildFrameStore instead of an image directory\n"
 		"    <imagedirectory>\n"
 		"\n"
 		"Playback PNG image stills from a specified directory. eg:\n"
 		"\n"
-		"    ./PlaybackStills -d 0 -m 2 -i 60 -l ~/Pictures/\n"
+		"    ./PlaybackStills -d 0 -m 2 -i 60 -l ~/Pictures/\n",
+		kDefaultCacheSize, kDefaultLookAhead, kDefaultLoaderThreadCount
 		);
 }
 
@@ -236,7 +182,11 @@ int main(int argc, char* argv[])
 	bool						loopPlayback		= false;
 	int							updateInterval		= 1;
 	bool						convertOutputFormat = false;
+	unsigned					cacheSize			= kDefaultCacheSize;
+	unsigned					lookAhead			= kDefaultLookAhead;
+	unsigned					loaderThreadCount	= kDefaultLoaderThreadCount;
 	std::string					playbackDirectory;
+	std::string					frameStorePath;
 
 	HRESULT						result;
 	int							exitStatus = 1;
@@ -247,7 +197,10 @@ int main(int argc, char* argv[])
 	IDeckLinkIterator*			deckLinkIterator		= NULL;
 	IDeckLink*					deckLink				= NULL;
 	IDeckLinkOutput*			selectedDeckLinkOutput	= NULL;
-	IDeckLinkMutableVideoFrame*	playbackFrame			= NULL;
+	StillFrameCache*			stillFrameCache			= NULL;
+	StillFrameCacheStatistics	cacheStatistics;
+	FrameStore*					frameStore				= NULL;
+	FrameStorePlayer*			frameStorePlayer		= NULL;
 
 	BMDDisplayMode				selectedDisplayMode		= bmdModeNTSC;
 	std::string					selectedDisplayModeName;
@@ -278,6 +231,18 @@ int main(int argc, char* argv[])
 		else if (strcmp(argv[i], "-l") == 0)
 			loopPlayback = true;
 
+		else if (strcmp(argv[i], "-c") == 0)
+			cacheSize = (unsigned)atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "-k") == 0)
+			lookAhead = (unsigned)atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "-j") == 0)
+			loaderThreadCount = (unsigned)atoi(argv[++i]);
+
+		else if (strcmp(argv[i], "-s") == 0)
+			frameStorePath = argv[++i];
+
 		else if ((strcmp(argv[i], "?") == 0) || (strcmp(argv[i], "-h") == 0))
 			displayHelp = true;
 
@@ -287,7 +252,13 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	if (playbackDirectory.empty())
+	if (!frameStorePath.empty())
+	{
+		// Pre-rendered frames, built with BuildFrameStore
+		if (FrameStore::Open(frameStorePath, &frameStore) != S_OK)
+			displayHelp = true;
+	}
+	else if (playbackDirectory.empty())
 	{
 		fprintf(stderr, "You must set a playback directory\n");
 		displayHelp = true;
@@ -411,21 +382,36 @@ int main(int argc, char* argv[])
 				goto bail;
 
 			// Check display mode is supported with given options
-			result = selectedDeckLinkOutput->DoesSupportVideoMode(bmdVideoConnectionUnspecified, selectedDisplayMode, ImageLoader::kImageLoaderPixelFormat, bmdSupportedVideoModeDefault, NULL, &displayModeSupported);
-			if ((result != S_OK) || (!displayModeSupported))
+			if (frameStore != NULL)
 			{
-				// Video mode is unsupported, check whether we can support with format conversion
-				result = selectedDeckLinkOutput->DoesSupportVideoMode(bmdVideoConnectionUnspecified, selectedDisplayMode, kConvertedPixelFormat, bmdSupportedVideoModeDefault, nullptr, &displayModeSupported);
-				if ((result != S_OK) || (!displayModeSupported))
+				// Stored frames are played as they are, so the mode must match them exactly
+				result = selectedDeckLinkOutput->DoesSupportVideoMode(bmdVideoConnectionUnspecified, selectedDisplayMode, frameStore->GetPixelFormat(), bmdSupportedVideoModeDefault, NULL, &displayModeSupported);
+				if ((result != S_OK) || (!displayModeSupported) ||
+					(displayModes[displayModeIndex]->GetWidth() != frameStore->GetWidth()) ||
+					(displayModes[displayModeIndex]->GetHeight() != frameStore->GetHeight()))
 				{
-					fprintf(stderr, "The display mode %s is not supported by device\n", selectedDisplayModeName.c_str());
+					fprintf(stderr, "The display mode %s does not match the frame store\n", selectedDisplayModeName.c_str());
 					displayHelp = true;
 				}
-				else
-					convertOutputFormat = true;
 			}
 			else
-				convertOutputFormat = false;
+			{
+				result = selectedDeckLinkOutput->DoesSupportVideoMode(bmdVideoConnectionUnspecified, selectedDisplayMode, ImageLoader::kImageLoaderPixelFormat, bmdSupportedVideoModeDefault, NULL, &displayModeSupported);
+				if ((result != S_OK) || (!displayModeSupported))
+				{
+					// Video mode is unsupported, check whether we can support with format conversion
+					result = selectedDeckLinkOutput->DoesSupportVideoMode(bmdVideoConnectionUnspecified, selectedDisplayMode, kConvertedPixelFormat, bmdSupportedVideoModeDefault, nullptr, &displayModeSupported);
+					if ((result != S_OK) || (!displayModeSupported))
+					{
+						fprintf(stderr, "The display mode %s is not supported by device\n", selectedDisplayModeName.c_str());
+						displayHelp = true;
+					}
+					else
+						convertOutputFormat = true;
+				}
+				else
+					convertOutputFormat = false;
+			}
 		}
 	}
 
@@ -443,53 +429,90 @@ int main(int argc, char* argv[])
 		goto bail;
 	}
 	
-	// Create video frame for playback, as we are outputting frame synchronously, 
-	// then we can reuse without waiting on callback 
-	result = selectedDeckLinkOutput->CreateVideoFrame((int32_t)displayModes[displayModeIndex]->GetWidth(),
-													  (int32_t)displayModes[displayModeIndex]->GetHeight(),
-													  (int32_t)displayModes[displayModeIndex]->GetWidth() * 4,
-													  ImageLoader::kImageLoaderPixelFormat,
-													  bmdFrameFlagDefault,
-													  &playbackFrame);
-	if (result != S_OK)
+	if (frameStore != NULL)
 	{
-		fprintf(stderr, "Unable to create video frame\n");
-		goto bail;
-	}
-	
-	// OK to start playback - print configuration
-	fprintf(stderr, "Output with the following configuration:\n"
-		" - Playback device: %s\n"
-		" - Video mode: %s\n"
-		" - Playback update interval: %d\n"
-		" - Loop Playback: %s\n"
-		" - Playback directory: %s\n"
-		" - Number of images to playback: %d\n",
-		deckLinkDeviceNames[deckLinkIndex].c_str(),
-		selectedDisplayModeName.c_str(),
-		updateInterval,
-		loopPlayback ? "YES" : "NO",
-		playbackDirectory.c_str(),
-		(int)pngFiles.size()
-		);
-	fprintf(stderr, "Starting Playback, press <RETURN> to exit\n");
+		// Schedule the mapped frames directly, nothing to decode
+		frameStorePlayer = new FrameStorePlayer(selectedDeckLinkOutput, frameStore, updateInterval, loopPlayback);
+		result = frameStorePlayer->Start(frameDuration, frameTimescale);
+		if (result != S_OK)
+			goto bail;
 
-	// Start thread for message processing
-	playbackStillsThread = std::thread([&]{
-		PlaybackStills(selectedDeckLinkOutput, (IDeckLinkVideoFrame*)playbackFrame, pngFiles,
-						updateInterval * 1000 * (long)frameDuration / (long)frameTimescale, loopPlayback, convertOutputFormat);
-	});
-	
-	// Wait on return press, then notify playback thread to finalize
-	getchar();
+		fprintf(stderr, "Output with the following configuration:\n"
+			" - Playback device: %s\n"
+			" - Video mode: %s\n"
+			" - Playback update interval: %d\n"
+			" - Loop Playback: %s\n"
+			" - Frame store: %s\n"
+			" - Number of frames to playback: %u\n",
+			deckLinkDeviceNames[deckLinkIndex].c_str(),
+			selectedDisplayModeName.c_str(),
+			updateInterval,
+			loopPlayback ? "YES" : "NO",
+			frameStorePath.c_str(),
+			frameStore->GetFrameCount()
+			);
+		fprintf(stderr, "Starting Playback, press <RETURN> to exit\n");
+
+		getchar();
+
+		fprintf(stderr, "Stopping Playback\n");
+		frameStorePlayer->Stop();
+	}
+	else
 	{
-		std::lock_guard<std::mutex> lock(g_playbackMutex);
-		g_keyPressed = true;
+		// Create the pool of output frames and start decoding the first stills
+		stillFrameCache = new StillFrameCache(selectedDeckLinkOutput, pngFiles, loopPlayback, cacheSize, lookAhead, loaderThreadCount);
+		result = stillFrameCache->Start(displayModes[displayModeIndex]->GetWidth(),
+										displayModes[displayModeIndex]->GetHeight(),
+										convertOutputFormat ? kConvertedPixelFormat : ImageLoader::kImageLoaderPixelFormat);
+		if (result != S_OK)
+		{
+			fprintf(stderr, "Unable to create still frame cache\n");
+			goto bail;
+		}
+		
+		// OK to start playback - print configuration
+		fprintf(stderr, "Output with the following configuration:\n"
+			" - Playback device: %s\n"
+			" - Video mode: %s\n"
+			" - Playback update interval: %d\n"
+			" - Loop Playback: %s\n"
+			" - Playback directory: %s\n"
+			" - Number of images to playback: %d\n"
+			" - Still cache: %u frames, %u look-ahead, %u loader threads\n",
+			deckLinkDeviceNames[deckLinkIndex].c_str(),
+			selectedDisplayModeName.c_str(),
+			updateInterval,
+			loopPlayback ? "YES" : "NO",
+			playbackDirectory.c_str(),
+			(int)pngFiles.size(),
+			cacheSize, lookAhead, loaderThreadCount
+			);
+		fprintf(stderr, "Starting Playback, press <RETURN> to exit\n");
+
+		// Start thread for message processing
+		playbackStillsThread = std::thread([&]{
+			PlaybackStills(selectedDeckLinkOutput, stillFrameCache, pngFiles,
+							updateInterval * 1000 * (long)frameDuration / (long)frameTimescale, loopPlayback);
+		});
+		
+		// Wait on return press, then notify playback thread to finalize
+		getchar();
+		{
+			std::lock_guard<std::mutex> lock(g_playbackMutex);
+			g_keyPressed = true;
+		}
+		g_playbackStopCondition.notify_one();
+		playbackStillsThread.join();
+
+		fprintf(stderr, "Stopping Playback\n");
+
+		stillFrameCache->GetStatistics(&cacheStatistics);
+		fprintf(stderr, "Still cache: %llu hits, %llu waits, %llu decodes, %llu evictions\n",
+				(unsigned long long)cacheStatistics.hits, (unsigned long long)cacheStatistics.waits,
+				(unsigned long long)cacheStatistics.decodes, (unsigned long long)cacheStatistics.evictions);
 	}
-	g_playbackStopCondition.notify_one();
-	playbackStillsThread.join();
 
-	fprintf(stderr, "Stopping Playback\n");
 	result = selectedDeckLinkOutput->DisableVideoOutput();
 	if (result != S_OK)
 		goto bail;
@@ -503,10 +526,22 @@ bail:
 		displayModes.pop_back();
 	}
 	
-	if (playbackFrame != NULL)
+	if (stillFrameCache != NULL)
+	{
+		delete stillFrameCache;
+		stillFrameCache = NULL;
+	}
+
+	if (frameStorePlayer != NULL)
+	{
+		frameStorePlayer->Release();
+		frameStorePlayer = NULL;
+	}
+
+	if (frameStore != NULL)
 	{
-		playbackFrame->Release();
-		playbackFrame = NULL;
+		frameStore->Release();
+		frameStore = NULL;
 	}
 
 	if (selectedDeckLinkOutput != NULL)
@@ -0,0 +1,320 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include "platform.h"
+#include "ImageLoader.h"
+#include "StillFrameCache.h"
+
+StillFrameCache::StillFrameCache(IDeckLinkOutput* deckLinkOutput, const std::vector<std::string>& pngFiles, bool loopPlayback,
+								 unsigned cacheSize, unsigned lookAhead, unsigned loaderThreadCount)
+	: m_deckLinkOutput(deckLinkOutput), m_frameConverter(NULL), m_pngFiles(pngFiles), m_loopPlayback(loopPlayback),
+	m_lookAhead(lookAhead), m_loaderThreadCount(std::max(1u, loaderThreadCount)), m_width(0), m_height(0), m_convertOutput(false),
+	m_windowStart(0), m_useCounter(0), m_stopping(false)
+{
+	// The still being played and the look-ahead window must fit, but there is no point
+	// in holding more frames than there are stills
+	m_cacheSize = std::min(std::max(cacheSize, lookAhead + 2), (unsigned)std::max((size_t)1, pngFiles.size()));
+
+	memset(&m_statistics, 0, sizeof(m_statistics));
+	m_deckLinkOutput->AddRef();
+}
+
+StillFrameCache::~StillFrameCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_loadCondition.notify_all();
+	m_readyCondition.notify_all();
+
+	for (std::thread& loaderThread : m_loaderThreads)
+		loaderThread.join();
+
+	for (Entry& entry : m_entries)
+		entry.frame->Release();
+
+	for (IDeckLinkMutableVideoFrame* decodeFrame : m_decodeFrames)
+		decodeFrame->Release();
+
+	if (m_frameConverter != NULL)
+		m_frameConverter->Release();
+
+	m_deckLinkOutput->Release();
+}
+
+static int32_t bytesPerRow(BMDPixelFormat pixelFormat, long width)
+{
+	// Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return (int32_t)width * 2;
+
+		case bmdFormat10BitYUV:
+			return (int32_t)((width + 47) / 48) * 128;
+
+		case bmdFormat8BitBGRA:
+			return (int32_t)width * 4;
+
+		default:
+			return 0;
+	}
+}
+
+HRESULT StillFrameCache::Start(long width, long height, BMDPixelFormat outputPixelFormat)
+{
+	IDeckLinkMutableVideoFrame* frame;
+
+	m_width = width;
+	m_height = height;
+	m_convertOutput = (outputPixelFormat != ImageLoader::kImageLoaderPixelFormat);
+
+	if (bytesPerRow(outputPixelFormat, width) == 0)
+	{
+		fprintf(stderr, "Unexpected output pixel format\n");
+		return E_FAIL;
+	}
+
+	if (m_convertOutput && (GetDeckLinkFrameConverter(&m_frameConverter) != S_OK))
+	{
+		fprintf(stderr, "Unable to get Video Conversion interface\n");
+		return E_FAIL;
+	}
+
+	// Allocate every frame up front; playback then never allocates
+	for (unsigned i = 0; i < m_cacheSize; i++)
+	{
+		if (m_deckLinkOutput->CreateVideoFrame((int32_t)width, (int32_t)height, bytesPerRow(outputPixelFormat, width),
+											   outputPixelFormat, bmdFrameFlagDefault, &frame) != S_OK)
+		{
+			fprintf(stderr, "Could not create video frame for still cache\n");
+			return E_FAIL;
+		}
+
+		m_entries.push_back({ frame, -1, kEntryEmpty, 0, 0 });
+	}
+
+	for (unsigned i = 0; i < m_loaderThreadCount; i++)
+	{
+		IDeckLinkMutableVideoFrame* decodeFrame = NULL;
+
+		// When the output format differs, each loader decodes into its own BGRA frame first
+		if (m_convertOutput)
+		{
+			if (m_deckLinkOutput->CreateVideoFrame((int32_t)width, (int32_t)height, bytesPerRow(ImageLoader::kImageLoaderPixelFormat, width),
+												   ImageLoader::kImageLoaderPixelFormat, bmdFrameFlagDefault, &decodeFrame) != S_OK)
+			{
+				fprintf(stderr, "Could not create video frame to decode into\n");
+				return E_FAIL;
+			}
+
+			m_decodeFrames.push_back(decodeFrame);
+		}
+
+		m_loaderThreads.emplace_back(&StillFrameCache::loaderThread, this, decodeFrame);
+	}
+
+	return S_OK;
+}
+
+IDeckLinkVideoFrame* StillFrameCache::AcquireFrame(int stillIndex)
+{
+	std::unique_lock<std::mutex>	lock(m_mutex);
+	int								entryIndex;
+
+	m_windowStart = stillIndex;
+
+	// Every frame may be pinned or loading; wait for one to become reusable
+	while ((entryIndex = requestLocked(stillIndex)) < 0)
+	{
+		if (m_stopping)
+			return NULL;
+		m_readyCondition.wait(lock);
+	}
+
+	for (unsigned i = 1; i <= m_lookAhead; i++)
+	{
+		int nextStillIndex = stillIndex + (int)i;
+
+		if (nextStillIndex >= (int)m_pngFiles.size())
+		{
+			if (!m_loopPlayback)
+				break;
+			nextStillIndex %= (int)m_pngFiles.size();
+		}
+
+		requestLocked(nextStillIndex);
+	}
+
+	Entry& entry = m_entries[entryIndex];
+
+	if (entry.state == kEntryLoading)
+	{
+		m_statistics.waits++;
+		m_readyCondition.wait(lock, [&]{ return (entry.state != kEntryLoading) || m_stopping; });
+	}
+	else
+	{
+		m_statistics.hits++;
+	}
+
+	if (entry.state != kEntryReady)
+		return NULL;
+
+	entry.lastUsed = ++m_useCounter;
+	entry.pinCount++;
+
+	return entry.frame;
+}
+
+void StillFrameCache::ReleaseFrame(int stillIndex)
+{
+	std::lock_guard<std::mutex>	lock(m_mutex);
+	auto						it = m_entryForStill.find(stillIndex);
+
+	if ((it != m_entryForStill.end()) && (m_entries[it->second].pinCount > 0))
+	{
+		m_entries[it->second].pinCount--;
+		m_readyCondition.notify_all();
+	}
+}
+
+void StillFrameCache::GetStatistics(StillFrameCacheStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	*statistics = m_statistics;
+}
+
+bool StillFrameCache::isInLookAheadWindow(int stillIndex) const
+{
+	int offset = stillIndex - m_windowStart;
+
+	if (m_loopPlayback && (offset < 0))
+		offset += (int)m_pngFiles.size();
+
+	return (offset >= 0) && (offset <= (int)m_lookAhead);
+}
+
+int StillFrameCache::requestLocked(int stillIndex)
+{
+	auto	it = m_entryForStill.find(stillIndex);
+	int		victim = -1;
+
+	if (it != m_entryForStill.end())
+		return it->second;
+
+	// Take an unused frame, or else the least recently used still outside the look-ahead window
+	for (int i = 0; i < (int)m_entries.size(); i++)
+	{
+		const Entry& entry = m_entries[i];
+
+		if (entry.state == kEntryEmpty)
+		{
+			victim = i;
+			break;
+		}
+
+		if ((entry.state == kEntryLoading) || (entry.pinCount > 0) || isInLookAheadWindow(entry.stillIndex))
+			continue;
+
+		if ((victim < 0) || (entry.lastUsed < m_entries[victim].lastUsed))
+			victim = i;
+	}
+
+	if (victim < 0)
+		return -1;
+
+	Entry& entry = m_entries[victim];
+
+	if (entry.stillIndex >= 0)
+	{
+		m_entryForStill.erase(entry.stillIndex);
+		m_statistics.evictions++;
+	}
+
+	entry.stillIndex = stillIndex;
+	entry.state = kEntryLoading;
+	entry.lastUsed = ++m_useCounter;
+	m_entryForStill[stillIndex] = victim;
+
+	m_loadQueue.push_back(victim);
+	m_loadCondition.notify_one();
+
+	return victim;
+}
+
+void StillFrameCache::loaderThread(IDeckLinkMutableVideoFrame* decodeFrame)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_loadCondition.wait(lock, [&]{ return !m_loadQueue.empty() || m_stopping; });
+		if (m_stopping)
+			break;
+
+		int							entryIndex = m_loadQueue.front();
+		int							stillIndex = m_entries[entryIndex].stillIndex;
+		IDeckLinkMutableVideoFrame*	outputFrame = m_entries[entryIndex].frame;
+
+		m_loadQueue.pop_front();
+
+		// A loading entry is never handed out or evicted, so its frame can be filled unlocked
+		lock.unlock();
+		HRESULT result = loadStill(stillIndex, outputFrame, decodeFrame);
+		lock.lock();
+
+		m_statistics.decodes++;
+		m_entries[entryIndex].state = (result == S_OK) ? kEntryReady : kEntryFailed;
+		m_readyCondition.notify_all();
+	}
+}
+
+HRESULT StillFrameCache::loadStill(int stillIndex, IDeckLinkMutableVideoFrame* outputFrame, IDeckLinkMutableVideoFrame* decodeFrame)
+{
+	HRESULT result;
+
+	result = ImageLoader::ConvertPNGToDeckLinkVideoFrame(m_pngFiles[stillIndex], m_convertOutput ? decodeFrame : outputFrame);
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Error reading PNG file: %s\n", m_pngFiles[stillIndex].c_str());
+		return result;
+	}
+
+	if (m_convertOutput)
+	{
+		// Pixel format conversion required to output frame
+		result = m_frameConverter->ConvertFrame(decodeFrame, outputFrame);
+		if (result != S_OK)
+			fprintf(stderr, "Unable to convert PNG file: %s\n", m_pngFiles[stillIndex].c_str());
+	}
+
+	return result;
+}
@@ -0,0 +1,116 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+struct StillFrameCacheStatistics
+{
+	uint64_t	hits;			// Frames that were ready when requested
+	uint64_t	waits;			// Frames the playback thread had to wait for
+	uint64_t	decodes;		// PNG files decoded, including look-ahead
+	uint64_t	evictions;
+};
+
+// Pool of output frames holding decoded, output-ready stills, filled ahead of playback
+// by a set of loader threads. Each request for a still also queues the next stills in
+// the playlist for loading, so the playback thread only waits when the loaders fall
+// behind. Stills stay cached until their frame is needed for another still, oldest use
+// first, so a looping playlist that fits in the cache is only decoded once.
+class StillFrameCache
+{
+public:
+	StillFrameCache(IDeckLinkOutput* deckLinkOutput, const std::vector<std::string>& pngFiles, bool loopPlayback,
+					unsigned cacheSize, unsigned lookAhead, unsigned loaderThreadCount);
+	~StillFrameCache();
+
+	// Allocates the frame pool and starts the loader threads
+	HRESULT		Start(long width, long height, BMDPixelFormat outputPixelFormat);
+
+	// Returns the output frame for a still, waiting for it to load if necessary, or NULL if
+	// the still could not be loaded. The frame stays valid until ReleaseFrame() is called.
+	IDeckLinkVideoFrame*	AcquireFrame(int stillIndex);
+	void		ReleaseFrame(int stillIndex);
+
+	void		GetStatistics(StillFrameCacheStatistics* statistics);
+
+private:
+	enum EntryState
+	{
+		kEntryEmpty,
+		kEntryLoading,
+		kEntryReady,
+		kEntryFailed
+	};
+
+	struct Entry
+	{
+		IDeckLinkMutableVideoFrame*	frame;
+		int							stillIndex;
+		EntryState					state;
+		unsigned					pinCount;
+		uint64_t					lastUsed;
+	};
+
+	int			requestLocked(int stillIndex);
+	bool		isInLookAheadWindow(int stillIndex) const;
+	void		loaderThread(IDeckLinkMutableVideoFrame* decodeFrame);
+	HRESULT		loadStill(int stillIndex, IDeckLinkMutableVideoFrame* outputFrame, IDeckLinkMutableVideoFrame* decodeFrame);
+
+	IDeckLinkOutput*				m_deckLinkOutput;
+	IDeckLinkVideoConversion*		m_frameConverter;
+	const std::vector<std::string>&	m_pngFiles;
+	bool							m_loopPlayback;
+	unsigned						m_cacheSize;
+	unsigned						m_lookAhead;
+	unsigned						m_loaderThreadCount;
+	long							m_width;
+	long							m_height;
+	bool							m_convertOutput;
+
+	std::mutex						m_mutex;
+	std::condition_variable			m_loadCondition;
+	std::condition_variable			m_readyCondition;
+	std::vector<Entry>				m_entries;
+	std::map<int, int>				m_entryForStill;
+	std::deque<int>					m_loadQueue;
+	int								m_windowStart;
+	uint64_t						m_useCounter;
+	bool							m_stopping;
+	StillFrameCacheStatistics		m_statistics;
+
+	std::vector<IDeckLinkMutableVideoFrame*>	m_decodeFrames;
+	std::vector<std::thread>		m_loaderThreads;
+};
@@ -26,6 +26,7 @@
 */
 
 #include "platform.h"
+#include "ParallelVideoConversion.h"
 
 HRESULT GetDeckLinkIterator(IDeckLinkIterator **deckLinkIterator)
 {
@@ -47,7 +48,7 @@ HRESULT GetDeckLinkFrameConverter(IDeckLinkVideoConversion** deckLinkFrameConver
 	HRESULT result = S_OK;
 
 	// Create an IDeckLinkVideoConversion interface object to provide pixel format conversion of video frame.
-	*deckLinkFrameConverter = CreateVideoConversionInstance();
+	*deckLinkFrameConverter = CreateParallelVideoConversionInstance();
 	if (*deckLinkFrameConverter == NULL)
 	{
 		fprintf(stderr, "A DeckLink Video Conversion interface could not be created.\n");
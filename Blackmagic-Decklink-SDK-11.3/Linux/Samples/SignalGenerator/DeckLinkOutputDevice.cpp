@@ -142,10 +142,10 @@ ULONG DeckLinkOutputDevice::Release(void)
 	return (ULONG)(oldValue - 1);
 }
 
-HRESULT	DeckLinkOutputDevice::ScheduledFrameCompleted(IDeckLinkVideoFrame* /* completedFrame */, BMDOutputFrameCompletionResult /* result */)
+HRESULT	DeckLinkOutputDevice::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult /* result */)
 {
-	// When a scheduled video frame is complete, schedule next frame
-	m_uiDelegate->scheduleNextFrame(false);
+	// When a scheduled video frame is complete, recycle it and schedule next frame
+	m_uiDelegate->scheduledFrameCompleted(completedFrame);
 	return S_OK;
 }
 
@@ -33,26 +33,15 @@
 #include "DeckLinkOutputDevice.h"
 #include "DeckLinkDeviceDiscovery.h"
 #include "ProfileCallback.h"
+#include "OutputFramePool.h"
+#include "PatternFrameCache.h"
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 const uint32_t		kAudioWaterlevel = 48000;
 
-// SD 75% Colour Bars
-static uint32_t gSD75pcColourBars[8] =
-{
-	0xeb80eb80, 0xa28ea22c, 0x832c839c, 0x703a7048,
-	0x54c654b8, 0x41d44164, 0x237223d4, 0x10801080
-};
-
-// HD 75% Colour Bars
-static uint32_t gHD75pcColourBars[8] =
-{
-	0xeb80eb80, 0xa888a82c, 0x912c9193, 0x8534853f,
-	0x3fcc3fc1, 0x33d4336d, 0x1c781cd4, 0x10801080
-};
-
 // Audio channels supported
 static const int gAudioChannels[] = { 2, 8, 16 };
 
@@ -174,6 +163,8 @@ SignalGenerator::SignalGenerator()
 	selectedDisplayMode = bmdModeUnknown;
 	videoFrameBlack = NULL;
 	videoFrameBars = NULL;
+	patternFrameCache = NULL;
+	outputFramePool = NULL;
 	audioBuffer = NULL;
 	timeCode = NULL;
 	scheduledPlaybackStopped = false;
@@ -199,6 +190,7 @@ SignalGenerator::SignalGenerator()
 	connect(ui->startButton, SIGNAL(clicked()), this, SLOT(toggleStart()));
 	connect(ui->videoFormatPopup, SIGNAL(currentIndexChanged(int)), this, SLOT(videoFormatChanged(int)));
 	connect(ui->outputDevicePopup, SIGNAL(currentIndexChanged(int)), this, SLOT(outputDeviceChanged(int)));
+	connect(ui->pixelFormatPopup, SIGNAL(currentIndexChanged(int)), this, SLOT(pixelFormatChanged(int)));
 	enableInterface(false);
 	show();
 }
@@ -213,6 +205,12 @@ SignalGenerator::~SignalGenerator()
 		selectedDevice->GetDeviceOutput()->SetScreenPreviewCallback(NULL);
 	}
 
+	if (patternFrameCache != NULL)
+	{
+		delete patternFrameCache;
+		patternFrameCache = NULL;
+	}
+
 	if (previewView != NULL)
 	{
 		previewView->Release();
@@ -453,6 +451,9 @@ void SignalGenerator::removeDevice(IDeckLink* deckLink)
 		// We have removed the last device, disable the interface.
 		enableInterface(false);
 		selectedDevice = NULL;
+
+		delete patternFrameCache;
+		patternFrameCache = NULL;
 	}
 	else if (selectedDevice == deviceToRemove)
 	{
@@ -491,63 +492,37 @@ void SignalGenerator::updateProfile(IDeckLinkProfile* /* newProfile */)
 	refreshAudioChannelMenu();
 }
 
-IDeckLinkMutableVideoFrame *SignalGenerator::CreateOutputFrame(std::function<void(IDeckLinkVideoFrame*)> fillFrame)
+IDeckLinkMutableVideoFrame *SignalGenerator::CreateOutputFrame(PatternType pattern)
 {
-	IDeckLinkOutput*                deckLinkOutput;
-	IDeckLinkMutableVideoFrame*		referenceFrame	= NULL;
 	IDeckLinkMutableVideoFrame*		scheduleFrame	= NULL;
-	HRESULT							hr;
 	BMDPixelFormat					pixelFormat;
-	int								bytesPerRow;
-	int								referenceBytesPerRow;
-	IDeckLinkVideoConversion*		frameConverter	= NULL;
 
 	pixelFormat = (BMDPixelFormat)ui->pixelFormatPopup->itemData(ui->pixelFormatPopup->currentIndex()).value<int>();
-	bytesPerRow = GetRowBytes(pixelFormat, frameWidth);
-	referenceBytesPerRow = GetRowBytes(bmdFormat8BitYUV, frameWidth);
 
-	deckLinkOutput = selectedDevice->GetDeviceOutput();
+	// Usually already rendered in the background when the mode or pixel format was selected
+	if (patternFrameCache->GetFrame(frameWidth, frameHeight, pixelFormat, pattern, &scheduleFrame) != S_OK)
+		return NULL;
 
-	frameConverter = CreateVideoConversionInstance();
-	if (frameConverter == NULL)
-		goto bail;
+	return scheduleFrame;
+}
 
-	hr = deckLinkOutput->CreateVideoFrame(frameWidth, frameHeight, referenceBytesPerRow, bmdFormat8BitYUV, bmdFrameFlagDefault, &referenceFrame);
-	if (hr != S_OK)
-		goto bail;
+void SignalGenerator::prefetchOutputFrames(void)
+{
+	IDeckLinkDisplayMode*	displayMode = NULL;
+	BMDPixelFormat			pixelFormat;
 
-	fillFrame(referenceFrame);
+	if ((patternFrameCache == NULL) || (ui->pixelFormatPopup->currentIndex() == -1))
+		return;
 
-	if (pixelFormat == bmdFormat8BitYUV)
-	{
-		// Frame is already 8-bit YUV, no conversion required
-		scheduleFrame = referenceFrame;
-		scheduleFrame->AddRef();
-	}
-	else
-	{
-		hr = deckLinkOutput->CreateVideoFrame(frameWidth, frameHeight, bytesPerRow, pixelFormat, bmdFrameFlagDefault, &scheduleFrame);
-		if (hr != S_OK)
-			goto bail;
+	if (selectedDevice->GetDeviceOutput()->GetDisplayMode(selectedDisplayMode, &displayMode) != S_OK)
+		return;
 
-		hr = frameConverter->ConvertFrame(referenceFrame, scheduleFrame);
-		if (hr != S_OK)
-			goto bail;
-	}
+	pixelFormat = (BMDPixelFormat)ui->pixelFormatPopup->itemData(ui->pixelFormatPopup->currentIndex()).value<int>();
 
-bail:
-	if (referenceFrame != NULL)
-	{
-		referenceFrame->Release();
-		referenceFrame = NULL;
-	}
-	if (frameConverter != NULL)
-	{
-		frameConverter->Release();
-		frameConverter = NULL;
-	}
+	patternFrameCache->Prefetch(displayMode->GetWidth(), displayMode->GetHeight(), pixelFormat, kPatternBlack);
+	patternFrameCache->Prefetch(displayMode->GetWidth(), displayMode->GetHeight(), pixelFormat, kPatternColourBars75);
 
-	return scheduleFrame;
+	displayMode->Release();
 }
 
 void SignalGenerator::startRunning()
@@ -636,10 +611,20 @@ void SignalGenerator::startRunning()
 	FillSine(audioBuffer, audioBufferSampleLength, audioChannelCount, audioSampleDepth);
 	
 	// Generate a frame of black
-	videoFrameBlack = CreateOutputFrame(FillBlack);
+	videoFrameBlack = CreateOutputFrame(kPatternBlack);
 	
 	// Generate a frame of colour bars
-	videoFrameBars = CreateOutputFrame(FillColourBars);
+	videoFrameBars = CreateOutputFrame(kPatternColourBars75);
+	if ((videoFrameBlack == NULL) || (videoFrameBars == NULL))
+		goto bail;
+
+	// Every scheduled frame carries its own timecode, so each frame queued on the device is a
+	// separate pooled copy of the black or bars frame. A frame is only copied into when it
+	// changes between black and bars, so the pip signal copies bars once per second.
+	outputFramePool = new OutputFramePool(deckLinkOutput);
+	if (outputFramePool->Allocate(framesPerSecond + kSpareOutputFrames, frameWidth, frameHeight, videoFrameBars->GetRowBytes(),
+								  videoFrameBars->GetPixelFormat(), bmdFrameFlagDefault) != S_OK)
+		goto bail;
 	
 	// Begin video preroll by scheduling a second of frames in hardware
 	totalFramesScheduled = 0;
@@ -702,6 +687,19 @@ void SignalGenerator::stopRunning()
 	if (videoFrameBars != NULL)
 		videoFrameBars->Release();
 	videoFrameBars = NULL;
+
+	// Playback has stopped, so every pooled frame has been returned by the device
+	if (outputFramePool != NULL)
+	{
+		OutputFramePoolStatistics poolStatistics;
+
+		outputFramePool->GetStatistics(&poolStatistics);
+		printf("Output frame pool: %u frames, at least %u free, at most %u queued, %u acquires failed\n",
+			   poolStatistics.frameCount, poolStatistics.minFreeFrames, poolStatistics.maxQueuedFrames, (unsigned)poolStatistics.acquireFailures);
+
+		delete outputFramePool;
+		outputFramePool = NULL;
+	}
 	
 	if (audioBuffer != NULL)
 		free(audioBuffer);
@@ -714,10 +712,22 @@ void SignalGenerator::stopRunning()
 }
 
 
+void SignalGenerator::scheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame)
+{
+	// The device has finished with the frame, so it can be drawn into again
+	if (outputFramePool != NULL)
+		outputFramePool->FrameCompleted(completedFrame);
+
+	scheduleNextFrame(false);
+}
+
 void SignalGenerator::scheduleNextFrame(bool prerolling)
 {
 	HRESULT							result = S_OK;
-	IDeckLinkMutableVideoFrame*		currentFrame;
+	IDeckLinkMutableVideoFrame*		currentFrame = nullptr;
+	IDeckLinkMutableVideoFrame*		patternFrame;
+	PatternType						pattern;
+	int64_t							frameContent;
 	IDeckLinkOutput*				deckLinkOutput = nullptr;
 	IDeckLinkDisplayMode*			outputDisplayMode = nullptr;
 	bool							setVITC1Timecode = false;
@@ -735,16 +745,35 @@ void SignalGenerator::scheduleNextFrame(bool prerolling)
 	if (outputSignal == kOutputSignalPip)
 	{
 		if ((totalFramesScheduled % framesPerSecond) == 0)
-			currentFrame = videoFrameBars;
+			pattern = kPatternColourBars75;
 		else
-			currentFrame = videoFrameBlack;
+			pattern = kPatternBlack;
 	}
 	else
 	{
 		if ((totalFramesScheduled % framesPerSecond) == 0)
-			currentFrame = videoFrameBlack;
+			pattern = kPatternBlack;
 		else
-			currentFrame = videoFrameBars;
+			pattern = kPatternColourBars75;
+	}
+
+	patternFrame = (pattern == kPatternBlack) ? videoFrameBlack : videoFrameBars;
+
+	result = outputFramePool->AcquireFrame(pattern, &currentFrame, &frameContent);
+	if (result != S_OK)
+	{
+		fprintf(stderr, "No free frame in the output frame pool\n");
+		goto bail;
+	}
+
+	if (frameContent != pattern)
+	{
+		void*	srcBytes;
+		void*	dstBytes;
+
+		patternFrame->GetBytes(&srcBytes);
+		currentFrame->GetBytes(&dstBytes);
+		memcpy(dstBytes, srcBytes, patternFrame->GetRowBytes() * patternFrame->GetHeight());
 	}
 	
 	if (timeCodeFormat == bmdTimecodeVITC)
@@ -844,10 +873,14 @@ void SignalGenerator::scheduleNextFrame(bool prerolling)
 
 	printf("Output frame: %02d:%02d:%02d:%03d\n", timeCode->hours(), timeCode->minutes(), timeCode->seconds(), timeCode->frames());
 
-	if (deckLinkOutput->ScheduleVideoFrame(currentFrame, (totalFramesScheduled * frameDuration), frameDuration, frameTimescale) != S_OK)
-		goto bail;
+	result = outputFramePool->ScheduleFrame(currentFrame, pattern, (totalFramesScheduled * frameDuration), frameDuration, frameTimescale);
+	currentFrame = nullptr;
 	
 bail:
+	// A frame that could not be completed goes back to the pool with its pattern intact
+	if (currentFrame != nullptr)
+		outputFramePool->ReleaseFrame(currentFrame, pattern);
+
 	totalFramesScheduled += 1;
 	timeCode->update();
 
@@ -888,6 +921,11 @@ void SignalGenerator::outputDeviceChanged(int selectedDeviceIndex)
 	
 	selectedDevice = (DeckLinkOutputDevice*)(selectedDeviceVariant.value<void*>());
 
+	// Rendered frames belong to the device that created them
+	if (patternFrameCache != NULL)
+		delete patternFrameCache;
+	patternFrameCache = new PatternFrameCache(selectedDevice->GetDeviceOutput());
+
 	// Register profile callback with newly selected device's profile manager
 	if (selectedDevice->GetProfileManager() != NULL)
 		selectedDevice->GetProfileManager()->SetCallback(profileCallback);
@@ -910,37 +948,17 @@ void SignalGenerator::videoFormatChanged(int videoFormatIndex)
 	refreshPixelFormatMenu();
 }
 
-/*****************************************/
-
-int		GetRowBytes(BMDPixelFormat pixelFormat, uint32_t frameWidth)
+void SignalGenerator::pixelFormatChanged(int pixelFormatIndex)
 {
-	int bytesPerRow;
-
-	// Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats
-	switch (pixelFormat)
-	{
-	case bmdFormat8BitYUV:
-		bytesPerRow = frameWidth * 2;
-		break;
-
-	case bmdFormat10BitYUV:
-		bytesPerRow = ((frameWidth + 47) / 48) * 128;
-		break;
-
-	case bmdFormat10BitRGB:
-		bytesPerRow = ((frameWidth + 63) / 64) * 256;
-		break;
-
-	case bmdFormat8BitARGB:
-	case bmdFormat8BitBGRA:
-	default:
-		bytesPerRow = frameWidth * 4;
-		break;
-	}
+	if (pixelFormatIndex == -1)
+		return;
 
-	return bytesPerRow;
+	// Render the frames for this mode and pixel format while the user is still choosing
+	prefetchOutputFrames();
 }
 
+/*****************************************/
+
 void	FillSine (void* audioBuffer, uint32_t samplesToWrite, uint32_t channels, uint32_t sampleDepth)
 {
 	if (sampleDepth == 16)
@@ -972,49 +990,3 @@ void	FillSine (void* audioBuffer, uint32_t samplesToWrite, uint32_t channels, ui
 		}
 	}
 }
-
-void	FillColourBars (IDeckLinkVideoFrame* theFrame)
-{
-	uint32_t*		nextWord;
-	uint32_t		width;
-	uint32_t		height;
-	uint32_t*		bars;
-	
-	theFrame->GetBytes((void**)&nextWord);
-	width = theFrame->GetWidth();
-	height = theFrame->GetHeight();
-	
-	if (width > 720)
-	{
-		bars = gHD75pcColourBars;
-	}
-	else
-	{
-		bars = gSD75pcColourBars;
-	}
-
-	for (uint32_t y = 0; y < height; y++)
-	{
-		for (uint32_t x = 0; x < width; x+=2)
-		{
-			*(nextWord++) = bars[(x * 8) / width];
-		}
-	}
-}
-
-void	FillBlack (IDeckLinkVideoFrame* theFrame)
-{
-	uint32_t*		nextWord;
-	uint32_t		width;
-	uint32_t		height;
-	uint32_t		wordsRemaining;
-	
-	theFrame->GetBytes((void**)&nextWord);
-	width = theFrame->GetWidth();
-	height = theFrame->GetHeight();
-	
-	wordsRemaining = (width*2 * height) / 4;
-	
-	while (wordsRemaining-- > 0)
-		*(nextWord++) = 0x10801080;
-}
@@ -43,6 +43,7 @@
 #include <functional>
 
 #include "ui_SignalGenerator.h"
+#include "PatternGenerator.h"
 
 // Define custom event type 
 const QEvent::Type ADD_DEVICE_EVENT			= static_cast<QEvent::Type>(QEvent::User + 1);
@@ -134,6 +135,12 @@ class CDeckLinkGLWidget;
 class DeckLinkOutputDevice;
 class DeckLinkDeviceDiscovery;
 class ProfileCallback;
+class PatternFrameCache;
+class OutputFramePool;
+
+// Output frames beyond the one second of preroll, so a completed frame is free to be drawn
+// into while the rest of the second is still queued
+const uint32_t kSpareOutputFrames = 2;
 
 class SignalGenerator : public QDialog
 {
@@ -158,6 +165,8 @@ public:
 	uint32_t					dropFrames;
 	IDeckLinkMutableVideoFrame*	videoFrameBlack;
 	IDeckLinkMutableVideoFrame*	videoFrameBars;
+	PatternFrameCache*			patternFrameCache;
+	OutputFramePool*			outputFramePool;
 	uint32_t					totalFramesScheduled;
 	//
 	OutputSignal				outputSignal;
@@ -180,6 +189,7 @@ public:
 
 	void setup();
 
+	void scheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame);
 	void scheduleNextFrame(bool prerolling);
 	void writeNextAudioSamples();
 	void enableInterface(bool);
@@ -190,6 +200,7 @@ public:
 	void refreshDisplayModeMenu(void);
 	void refreshPixelFormatMenu(void);
 	void refreshAudioChannelMenu(void);
+	void prefetchOutputFrames(void);
 	void addDevice(IDeckLink* deckLink);
 	void removeDevice(IDeckLink* deckLink);
 	void playbackStopped(void);
@@ -199,6 +210,7 @@ public:
 public slots:
 	void outputDeviceChanged(int selectedDeviceIndex);
 	void videoFormatChanged(int videoFormatIndex);
+	void pixelFormatChanged(int pixelFormatIndex);
 	void toggleStart();
 	
 private:
@@ -207,13 +219,10 @@ private:
 
 	bool scheduledPlaybackStopped;
 
-	IDeckLinkMutableVideoFrame* CreateOutputFrame(std::function<void(IDeckLinkVideoFrame*)> fillFrame);
+	IDeckLinkMutableVideoFrame* CreateOutputFrame(PatternType pattern);
 };
 
-int		GetRowBytes(BMDPixelFormat pixelFormat, uint32_t frameWidth);
 void	FillSine (void* audioBuffer, uint32_t samplesToWrite, uint32_t channels, uint32_t sampleDepth);
-void	FillColourBars (IDeckLinkVideoFrame* theFrame);
-void	FillBlack (IDeckLinkVideoFrame* theFrame);
 void	ScheduleNextVideoFrame (void);
 
 #endif
@@ -2,20 +2,28 @@ TEMPLATE	= app
 LANGUAGE	= C++
 CONFIG		+= qt opengl
 QT			+= opengl
-INCLUDEPATH =	../../include 
+INCLUDEPATH =	../../include ../VideoConversion
 LIBS		+= -ldl
 
 HEADERS 	=	SignalGenerator.h \
 				DeckLinkDeviceDiscovery.h \
 				DeckLinkOutputDevice.h \
-				ProfileCallback.h
+				ProfileCallback.h \
+				../VideoConversion/OutputFramePool.h \
+				../VideoConversion/PatternFrameCache.h \
+				../VideoConversion/PatternGenerator.h \
+				../VideoConversion/V210Conversion.h
 
 SOURCES 	= 	main.cpp \
 				../../include/DeckLinkAPIDispatch.cpp \
 				DeckLinkDeviceDiscovery.cpp \
 				DeckLinkOutputDevice.cpp \
 				SignalGenerator.cpp \
-				ProfileCallback.cpp
+				ProfileCallback.cpp \
+				../VideoConversion/OutputFramePool.cpp \
+				../VideoConversion/PatternFrameCache.cpp \
+				../VideoConversion/PatternGenerator.cpp \
+				../VideoConversion/V210Conversion.cpp
 
 FORMS 		= 	SignalGenerator.ui
 
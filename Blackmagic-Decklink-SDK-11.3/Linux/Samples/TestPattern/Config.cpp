@@ -39,6 +39,10 @@ BMDConfig::BMDConfig() :
 	m_audioSampleDepth(16),
 	m_outputFlags(bmdVideoOutputFlagDefault),
 	m_pixelFormat(bmdFormat8BitYUV),
+	m_pattern(kPatternColourBars100),
+	m_videoQueueDepth(3),
+	m_depthHistoryFile(NULL),
+	m_latencyFile(NULL),
 	m_deckLinkName(),
 	m_displayModeName()
 {
@@ -58,7 +62,7 @@ bool BMDConfig::ParseArguments(int argc,  char** argv)
 	int		ch;
 	bool	displayHelp = false;
 
-	while ((ch = getopt(argc, argv, "d:?h3c:s:f:a:m:n:p:t:")) != -1)
+	while ((ch = getopt(argc, argv, "d:?h3c:s:f:a:m:n:p:t:q:l:o:")) != -1)
 	{
 		switch (ch)
 		{
@@ -96,12 +100,45 @@ bool BMDConfig::ParseArguments(int argc,  char** argv)
 					case 0: m_pixelFormat = bmdFormat8BitYUV; break;
 					case 1: m_pixelFormat = bmdFormat10BitYUV; break;
 					case 2: m_pixelFormat = bmdFormat10BitRGB; break;
+					case 3: m_pixelFormat = bmdFormat8BitARGB; break;
+					case 4: m_pixelFormat = bmdFormat8BitBGRA; break;
 					default:
 						fprintf(stderr, "Invalid argument: Pixel format %d is not valid", atoi(optarg));
 						return false;
 				}
 				break;
 
+			case 't':
+				switch(atoi(optarg))
+				{
+					case 0: m_pattern = kPatternColourBars100; break;
+					case 1: m_pattern = kPatternColourBars75; break;
+					case 2: m_pattern = kPatternRamp; break;
+					case 3: m_pattern = kPatternZonePlate; break;
+					case 4: m_pattern = kPatternPip; break;
+					default:
+						fprintf(stderr, "Invalid argument: Pattern %d is not valid", atoi(optarg));
+						return false;
+				}
+				break;
+
+			case 'q':
+				m_videoQueueDepth = atoi(optarg);
+				if (m_videoQueueDepth < 1)
+				{
+					fprintf(stderr, "Invalid argument: Video queue depth must be at least 1 frame\n");
+					return false;
+				}
+				break;
+
+			case 'l':
+				m_depthHistoryFile = optarg;
+				break;
+
+			case 'o':
+				m_latencyFile = optarg;
+				break;
+
 			case '3':
 				m_outputFlags |= bmdVideoOutputDualStream3D;
 				break;
@@ -326,9 +363,23 @@ bail:
 		"         0:  8 bit YUV (4:2:2) (default)\n"
 		"         1:  10 bit YUV (4:2:2)\n"
 		"         2:  10 bit RGB (4:4:4)\n"
+		"         3:  8 bit ARGB (4:4:4)\n"
+		"         4:  8 bit BGRA (4:4:4)\n"
+		"    -t <pattern>\n"
+		"         0:  100%% colour bars (default)\n"
+		"         1:  75%% colour bars\n"
+		"         2:  Luma ramp\n"
+		"         3:  Zone plate\n"
+		"         4:  Centre box\n"
 		"    -c <channels>        Audio Channels (2, 8 or 16 - default is 2)\n"
 		"    -s <depth>           Audio Sample Depth (16 or 32 - default is 16)\n"
-		"    -3                   Playback Stereoscopic 3D (Requires 3D Hardware support)\n"
+		"    -3                   Playback Stereoscopic 3D (Requires 3D Hardware support). Colour bars\n"
+		"                         are mirrored in the right eye; other patterns are the same in both eyes\n"
+		"    -q <frames>          Initial video queue depth (default is 3). The depth then grows on\n"
+		"                         late or dropped frames and shrinks while playout is clean\n"
+		"    -l <filename>        Write the queue depth history to a CSV file when playback stops\n"
+		"    -o <filename>        Measure output latency and write it when playback stops: percentiles\n"
+		"                         as JSON if the name ends in .json, otherwise one CSV line per frame\n"
 		"\n"
 		"Output a test pattern eg:\n"
 		"\n"
@@ -356,14 +407,18 @@ void BMDConfig::DisplayConfiguration()
 		" - Playback device: %s\n"
 		" - Video mode: %s %s\n"
 		" - Pixel format: %s\n"
+		" - Pattern: %s\n"
 		" - Audio channels: %u\n"
-		" - Audio sample depth: %u bit \n",
+		" - Audio sample depth: %u bit \n"
+		" - Initial video queue depth: %d frames\n",
 		m_deckLinkName,
 		m_displayModeName,
 		(m_outputFlags & bmdVideoOutputDualStream3D) ? "3D" : "",
 		GetPixelFormatName(m_pixelFormat),
+		GetPatternName(m_pattern),
 		m_audioChannels,
-		m_audioSampleDepth
+		m_audioSampleDepth,
+		m_videoQueueDepth
 	);
 }
 
@@ -377,6 +432,30 @@ const char* BMDConfig::GetPixelFormatName(BMDPixelFormat pixelFormat)
 			return "10 bit YUV (4:2:2)";
 		case bmdFormat10BitRGB:
 			return "10 bit RGB (4:4:4)";
+		case bmdFormat8BitARGB:
+			return "8 bit ARGB (4:4:4)";
+		case bmdFormat8BitBGRA:
+			return "8 bit BGRA (4:4:4)";
+	}
+	return "unknown";
+}
+
+const char* BMDConfig::GetPatternName(PatternType pattern)
+{
+	switch (pattern)
+	{
+		case kPatternColourBars100:
+			return "100% colour bars";
+		case kPatternColourBars75:
+			return "75% colour bars";
+		case kPatternRamp:
+			return "Luma ramp";
+		case kPatternZonePlate:
+			return "Zone plate";
+		case kPatternPip:
+			return "Centre box";
+		default:
+			break;
 	}
 	return "unknown";
 }
@@ -29,6 +29,7 @@
 #define BMD_CONFIG_H
 
 #include "DeckLinkAPI.h"
+#include "PatternGenerator.h"
 
 class BMDConfig
 {
@@ -48,6 +49,10 @@ public:
 
 	BMDVideoOutputFlags		m_outputFlags;
 	BMDPixelFormat			m_pixelFormat;
+	PatternType				m_pattern;
+	int						m_videoQueueDepth;
+	const char*				m_depthHistoryFile;
+	const char*				m_latencyFile;
 
 	const char*				m_videoOutputFile;
 	const char*				m_audioOutputFile;
@@ -57,6 +62,7 @@ private:
 	char*					m_displayModeName;
 
 	static const char* GetPixelFormatName(BMDPixelFormat pixelFormat);
+	static const char* GetPatternName(PatternType pattern);
 
 	IDeckLink* GetDeckLink(int idx);
 	IDeckLinkDisplayMode* GetDeckLinkDisplayMode(IDeckLink* deckLink, int idx);
@@ -38,6 +38,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
 
 #include "TestPattern.h"
 #include "VideoFrame3D.h"
@@ -103,6 +105,9 @@ TestPattern::TestPattern(BMDConfig *config) :
 	m_deckLink(),
 	m_deckLinkOutput(),
 	m_displayMode(),
+	m_patternFrameCache(),
+	m_depthController(),
+	m_latencyRecorder(),
 	m_videoFrameBlack(),
 	m_videoFrameBars(),
 	m_outputSignal(kOutputSignalDrop),
@@ -193,6 +198,12 @@ bool TestPattern::Run()
 	m_deckLinkOutput->SetScheduledFrameCompletionCallback(this);
 	m_deckLinkOutput->SetAudioCallback(this);
 
+	// Frames rendered for the first start are reused when playback is restarted
+	m_patternFrameCache = new PatternFrameCache(m_deckLinkOutput);
+
+	if (m_config->m_latencyFile != NULL)
+		m_latencyRecorder = new OutputLatencyRecorder(m_deckLinkOutput);
+
 	success = true;
 
 	// Start.
@@ -221,6 +232,12 @@ bail:
 	if (displayModeIterator != NULL)
 		displayModeIterator->Release();
 
+	if (m_patternFrameCache != NULL)
+		delete m_patternFrameCache;
+
+	if (m_latencyRecorder != NULL)
+		delete m_latencyRecorder;
+
 	if (m_deckLinkOutput != NULL)
 		m_deckLinkOutput->Release();
 
@@ -239,6 +256,7 @@ void TestPattern::StartRunning()
 	unsigned long			audioSamplesPerFrame;
 	IDeckLinkVideoFrame*	rightFrame;
 	VideoFrame3D*			frame3D;
+	PlayoutDepthSettings	depthSettings;
 
 	m_frameWidth = m_displayMode->GetWidth();
 	m_frameHeight = m_displayMode->GetHeight();
@@ -282,8 +300,11 @@ void TestPattern::StartRunning()
 	else
 		FillSine((void*)((unsigned long)m_audioBuffer + (audioSamplesPerFrame * m_config->m_audioChannels * m_config->m_audioSampleDepth / 8)), (m_audioBufferSampleLength - audioSamplesPerFrame), m_config->m_audioChannels, m_config->m_audioSampleDepth);
 
+	// Render the pattern in the background while the black frame is rendered
+	m_patternFrameCache->Prefetch(m_frameWidth, m_frameHeight, m_config->m_pixelFormat, m_config->m_pattern);
+
 	// Generate a frame of black
-	if (CreateFrame(&m_videoFrameBlack, FillBlack) != S_OK)
+	if (CreateFrame(&m_videoFrameBlack, kPatternBlack) != S_OK)
 		goto bail;
 
 	if (m_config->m_outputFlags & bmdVideoOutputDualStream3D)
@@ -294,13 +315,13 @@ void TestPattern::StartRunning()
 		frame3D = NULL;
 	}
 
-	// Generate a frame of colour bars
-	if (CreateFrame(&m_videoFrameBars, FillForwardColourBars) != S_OK)
+	// Generate a frame of the test pattern
+	if (CreateFrame(&m_videoFrameBars, m_config->m_pattern) != S_OK)
 		goto bail;
 
 	if (m_config->m_outputFlags & bmdVideoOutputDualStream3D)
 	{
-		if (CreateFrame(&rightFrame, FillReverseColourBars) != S_OK)
+		if (CreateFrame(&rightFrame, GetRightEyePattern(m_config->m_pattern)) != S_OK)
 			goto bail;
 
 		frame3D = new VideoFrame3D(m_videoFrameBars, rightFrame);
@@ -310,11 +331,23 @@ void TestPattern::StartRunning()
 		frame3D = NULL;
 	}
 
-	// Begin video preroll by scheduling a second of frames in hardware
+	// The video queue starts at the configured depth and adapts to late and dropped frames,
+	// up to a second of frames
+	depthSettings.initialDepth = m_config->m_videoQueueDepth;
+	depthSettings.maximumDepth = std::max((unsigned)m_framesPerSecond, depthSettings.initialDepth);
+	depthSettings.stableFramesBeforeShrink = 10 * m_framesPerSecond;
+	m_depthController = new PlayoutDepthController(m_deckLinkOutput, m_frameDuration, m_frameTimescale, depthSettings);
+
+	// Each run is measured separately
+	if (m_latencyRecorder != NULL)
+		m_latencyRecorder->Reset();
+
+	// Begin video preroll by scheduling the initial queue depth of frames in hardware
 	m_totalFramesScheduled = 0;
 	m_totalFramesDropped = 0;
+	m_totalFramesLate = 0;
 	m_totalFramesCompleted = 0;
-	for (unsigned i = 0; i < m_framesPerSecond; i++)
+	for (unsigned i = m_depthController->GetFramesToSchedule(); i > 0; i--)
 		ScheduleNextFrame(true);
 
 	// Begin audio preroll.  This will begin calling our audio callback, which will start the DeckLink output stream.
@@ -351,6 +384,16 @@ void TestPattern::StopRunning()
 	m_deckLinkOutput->DisableAudioOutput();
 	m_deckLinkOutput->DisableVideoOutput();
 
+	if (m_depthController != NULL)
+	{
+		PrintDepthSummary();
+		delete m_depthController;
+		m_depthController = NULL;
+	}
+
+	if (m_latencyRecorder != NULL)
+		PrintLatencySummary();
+
 	if (m_videoFrameBlack != NULL)
 		m_videoFrameBlack->Release();
 	m_videoFrameBlack = NULL;
@@ -366,6 +409,8 @@ void TestPattern::StopRunning()
 
 void TestPattern::ScheduleNextFrame(bool prerolling)
 {
+	auto renderStart = std::chrono::steady_clock::now();
+
 	if (prerolling == false)
 	{
 		// If not prerolling, make sure that playback is still active
@@ -378,13 +423,13 @@ void TestPattern::ScheduleNextFrame(bool prerolling)
 		if ((m_totalFramesScheduled % m_framesPerSecond) == 0)
 		{
 			// On each second, schedule a frame of bars
-			if (m_deckLinkOutput->ScheduleVideoFrame(m_videoFrameBars, (m_totalFramesScheduled * m_frameDuration), m_frameDuration, m_frameTimescale) != S_OK)
+			if (ScheduleFrame(m_videoFrameBars) != S_OK)
 				return;
 		}
 		else
 		{
 			// Schedue frames of black
-			if (m_deckLinkOutput->ScheduleVideoFrame(m_videoFrameBlack, (m_totalFramesScheduled * m_frameDuration), m_frameDuration, m_frameTimescale) != S_OK)
+			if (ScheduleFrame(m_videoFrameBlack) != S_OK)
 				return;
 		}
 	}
@@ -393,18 +438,28 @@ void TestPattern::ScheduleNextFrame(bool prerolling)
 		if ((m_totalFramesScheduled % m_framesPerSecond) == 0)
 		{
 			// On each second, schedule a frame of black
-			if (m_deckLinkOutput->ScheduleVideoFrame(m_videoFrameBlack, (m_totalFramesScheduled * m_frameDuration), m_frameDuration, m_frameTimescale) != S_OK)
+			if (ScheduleFrame(m_videoFrameBlack) != S_OK)
 				return;
 		}
 		else
 		{
 			// Schedue frames of color bars
-			if (m_deckLinkOutput->ScheduleVideoFrame(m_videoFrameBars, (m_totalFramesScheduled * m_frameDuration), m_frameDuration, m_frameTimescale) != S_OK)
+			if (ScheduleFrame(m_videoFrameBars) != S_OK)
 				return;
 		}
 	}
 
 	m_totalFramesScheduled += 1;
+
+	m_depthController->RecordRenderTime(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - renderStart).count());
+}
+
+HRESULT TestPattern::ScheduleFrame(IDeckLinkVideoFrame* frame)
+{
+	if (m_latencyRecorder != NULL)
+		return m_latencyRecorder->ScheduleVideoFrame(frame, (m_totalFramesScheduled * m_frameDuration), m_frameDuration, m_frameTimescale);
+
+	return m_deckLinkOutput->ScheduleVideoFrame(frame, (m_totalFramesScheduled * m_frameDuration), m_frameDuration, m_frameTimescale);
 }
 
 void TestPattern::WriteNextAudioSamples()
@@ -430,70 +485,72 @@ void TestPattern::WriteNextAudioSamples()
 	}
 }
 
-HRESULT TestPattern::CreateFrame(IDeckLinkVideoFrame** frame, void (*fillFunc)(IDeckLinkVideoFrame*))
+HRESULT TestPattern::CreateFrame(IDeckLinkVideoFrame** frame, PatternType pattern)
 {
 	HRESULT						result;
-	int							bytesPerRow = GetRowBytes(m_config->m_pixelFormat, m_frameWidth);
-	int							referenceBytesPerRow = GetRowBytes(bmdFormat8BitYUV, m_frameWidth);
 	IDeckLinkMutableVideoFrame*	newFrame = NULL;
-	IDeckLinkMutableVideoFrame*	referenceFrame = NULL;
-	IDeckLinkVideoConversion*	frameConverter = NULL;
 
 	*frame = NULL;
 
-	result = m_deckLinkOutput->CreateVideoFrame(m_frameWidth, m_frameHeight, bytesPerRow, m_config->m_pixelFormat, bmdFrameFlagDefault, &newFrame);
+	// Patterns are rendered directly in the output pixel format, no conversion needed
+	result = m_patternFrameCache->GetFrame(m_frameWidth, m_frameHeight, m_config->m_pixelFormat, pattern, &newFrame);
 	if (result != S_OK)
 	{
 		fprintf(stderr, "Failed to create video frame\n");
-		goto bail;
+		return result;
 	}
 
-	if (m_config->m_pixelFormat == bmdFormat8BitYUV)
-	{
-		fillFunc(newFrame);
-	}
-	else
-	{
-		// Create a black frame in 8 bit YUV and convert to desired format
-		result = m_deckLinkOutput->CreateVideoFrame(m_frameWidth, m_frameHeight, referenceBytesPerRow, bmdFormat8BitYUV, bmdFrameFlagDefault, &referenceFrame);
-		if (result != S_OK)
-		{
-			fprintf(stderr, "Failed to create reference video frame\n");
-			goto bail;
-		}
+	*frame = newFrame;
+	return S_OK;
+}
 
-		fillFunc(referenceFrame);
+void TestPattern::PrintStatusLine()
+{
+	printf("\rscheduled %-16lu completed %-16lu late %-8lu dropped %-8lu depth %-4u\r",
+		m_totalFramesScheduled, m_totalFramesCompleted, m_totalFramesLate, m_totalFramesDropped, m_depthController->GetTargetDepth());
+}
 
-		frameConverter = CreateVideoConversionInstance();
+void TestPattern::PrintLatencySummary()
+{
+	OutputLatencySummary	summary;
+	LatencyHistogram		scheduleToAir;
+	LatencyHistogram		callbackJitter;
 
-		result = frameConverter->ConvertFrame(referenceFrame, newFrame);
-		if (result != S_OK)
-		{
-			fprintf(stderr, "Failed to convert frame\n");
-			goto bail;
-		}
-	}
+	m_latencyRecorder->GetSummary(&summary);
+	m_latencyRecorder->GetHistograms(&scheduleToAir, NULL, &callbackJitter);
 
-	*frame = newFrame;
-	newFrame = NULL;
+	fprintf(stderr, "Schedule to air p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms; callback jitter p99 %.2f ms\n",
+			scheduleToAir.GetValueAtPercentile(50.0) / 1e6, scheduleToAir.GetValueAtPercentile(99.0) / 1e6,
+			scheduleToAir.GetValueAtPercentile(99.9) / 1e6, callbackJitter.GetValueAtPercentile(99.0) / 1e6);
+	if (summary.negativeScheduleToAir != 0)
+		fprintf(stderr, "%llu frames began display before they were scheduled\n", (unsigned long long)summary.negativeScheduleToAir);
 
-bail:
-	if (referenceFrame != NULL)
-		referenceFrame->Release();
+	if (m_latencyRecorder->Write(m_config->m_latencyFile) != S_OK)
+		fprintf(stderr, "Could not write %s\n", m_config->m_latencyFile);
+}
 
-	if (frameConverter != NULL)
-		frameConverter->Release();
+void TestPattern::PrintDepthSummary()
+{
+	PlayoutDepthStatistics	statistics;
+	FILE*					historyFile;
 
-	if (newFrame != NULL)
-		newFrame->Release();
+	m_depthController->GetStatistics(&statistics);
 
-	return result;
-}
+	fprintf(stderr, "\nVideo queue depth %u frames (largest %u, render needs %u, peak render %llu us)\n",
+			statistics.targetDepth, statistics.largestTargetDepth, statistics.renderDepth, (unsigned long long)statistics.peakRenderMicroseconds);
 
-void TestPattern::PrintStatusLine()
-{
-	printf("\rscheduled %-16lu completed %-16lu dropped %-16lu\r",
-		m_totalFramesScheduled, m_totalFramesCompleted, m_totalFramesDropped);
+	if (m_config->m_depthHistoryFile == NULL)
+		return;
+
+	historyFile = fopen(m_config->m_depthHistoryFile, "w");
+	if (historyFile == NULL)
+	{
+		fprintf(stderr, "Could not open %s\n", m_config->m_depthHistoryFile);
+		return;
+	}
+
+	m_depthController->WriteHistory(historyFile);
+	fclose(historyFile);
 }
 
 /************************* DeckLink API Delegate Methods *****************************/
@@ -522,11 +579,21 @@ ULONG TestPattern::Release()
 
 HRESULT TestPattern::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
 {
+	if (m_latencyRecorder != NULL)
+		m_latencyRecorder->FrameCompleted(completedFrame, result);
+
 	++m_totalFramesCompleted;
+	if (result == bmdOutputFrameDisplayedLate)
+		++m_totalFramesLate;
+	else if (result == bmdOutputFrameDropped)
+		++m_totalFramesDropped;
+
+	m_depthController->FrameCompleted(result);
 	PrintStatusLine();
 
-	// When a video frame has been released by the API, schedule another video frame to be output
-	ScheduleNextFrame(false);
+	// When a video frame has been released by the API, top the queue up to the chosen depth
+	for (unsigned i = m_depthController->GetFramesToSchedule(); i > 0; i--)
+		ScheduleNextFrame(false);
 	return S_OK;
 }
 
@@ -586,83 +653,3 @@ void FillSine(void* audioBuffer, unsigned long samplesToWrite, unsigned long cha
 		}
 	}
 }
-
-void FillColourBars(IDeckLinkVideoFrame* theFrame, bool reverse)
-{
-	unsigned int*	nextWord;
-	unsigned long	width;
-	unsigned long	height;
-	unsigned int	bars[8] = {0xEA80EA80, 0xD292D210, 0xA910A9A5, 0x90229035, 0x6ADD6ACA, 0x51EF515A, 0x286D28EF, 0x10801080};
-
-	theFrame->GetBytes((void**)&nextWord);
-	width = theFrame->GetWidth();
-	height = theFrame->GetHeight();
-
-	if (reverse)
-	{
-		for (long y = 0; y < height; y++)
-		{
-			for (long x = width - 2; x >= 0; x -= 2)
-			{
-				*(nextWord++) = bars[(x * 8) / width];
-			}
-		}
-	}
-	else
-	{
-		for (long y = 0; y < height; y++)
-		{
-			for (long x = 0; x < width; x += 2)
-			{
-				*(nextWord++) = bars[(x * 8) / width];
-			}
-		}
-	}
-}
-
-void FillBlack(IDeckLinkVideoFrame* theFrame)
-{
-	unsigned int*	nextWord;
-	unsigned long	width;
-	unsigned long	height;
-	unsigned long	wordsRemaining;
-
-	theFrame->GetBytes((void**)&nextWord);
-	width = theFrame->GetWidth();
-	height = theFrame->GetHeight();
-
-	wordsRemaining = (width * 2 * height) / 4;
-
-	while (wordsRemaining-- > 0)
-		*(nextWord++) = 0x10801080;
-}
-
-int GetRowBytes(BMDPixelFormat pixelFormat, int frameWidth)
-{
-	int bytesPerRow;
-
-	// Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats
-	switch (pixelFormat)
-	{
-	case bmdFormat8BitYUV:
-		bytesPerRow = frameWidth * 2;
-		break;
-
-	case bmdFormat10BitYUV:
-		bytesPerRow = ((frameWidth + 47) / 48) * 128;
-		break;
-
-	case bmdFormat10BitRGB:
-		bytesPerRow = ((frameWidth + 63) / 64) * 256;
-		break;
-
-	case bmdFormat8BitARGB:
-	case bmdFormat8BitBGRA:
-	default:
-		bytesPerRow = frameWidth * 4;
-		break;
-	}
-
-	return bytesPerRow;
-}
-
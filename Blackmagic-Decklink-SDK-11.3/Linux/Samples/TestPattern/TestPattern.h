@@ -30,6 +30,9 @@
 
 #include "DeckLinkAPI.h"
 #include "Config.h"
+#include "OutputLatencyRecorder.h"
+#include "PatternFrameCache.h"
+#include "PlayoutDepthController.h"
 
 enum OutputSignal
 {
@@ -47,6 +50,9 @@ private:
 	IDeckLink*				m_deckLink;
 	IDeckLinkOutput*		m_deckLinkOutput;
 	IDeckLinkDisplayMode*	m_displayMode;
+	PatternFrameCache*		m_patternFrameCache;
+	PlayoutDepthController*	m_depthController;
+	OutputLatencyRecorder*	m_latencyRecorder;
 
 	unsigned long			m_frameWidth;
 	unsigned long			m_frameHeight;
@@ -57,6 +63,7 @@ private:
 	IDeckLinkVideoFrame*	m_videoFrameBars;
 	unsigned long			m_totalFramesScheduled;
 	unsigned long			m_totalFramesDropped;
+	unsigned long			m_totalFramesLate;
 	unsigned long			m_totalFramesCompleted;
 
 	OutputSignal			m_outputSignal;
@@ -74,9 +81,12 @@ private:
 	void			StartRunning();
 	void			StopRunning();
 	void			ScheduleNextFrame(bool prerolling);
+	HRESULT			ScheduleFrame(IDeckLinkVideoFrame* frame);
 	void			WriteNextAudioSamples();
 
 	void			PrintStatusLine();
+	void			PrintDepthSummary();
+	void			PrintLatencySummary();
 
 public:
 	TestPattern(BMDConfig *config);
@@ -93,18 +103,7 @@ public:
 
 	virtual HRESULT STDMETHODCALLTYPE RenderAudioSamples(bool preroll);
 
-	HRESULT CreateFrame(IDeckLinkVideoFrame** theFrame, void (*fillFunc)(IDeckLinkVideoFrame*));
+	HRESULT CreateFrame(IDeckLinkVideoFrame** theFrame, PatternType pattern);
 };
 
 void FillSine(void* audioBuffer, unsigned long samplesToWrite, unsigned long channels, unsigned long sampleDepth);
-void FillColourBars(IDeckLinkVideoFrame* theFrame, bool reverse);
-static inline void FillForwardColourBars(IDeckLinkVideoFrame* theFrame)
-{
-	FillColourBars(theFrame, false);
-}
-static inline void FillReverseColourBars(IDeckLinkVideoFrame* theFrame)
-{
-	FillColourBars(theFrame, true);
-}
-void FillBlack(IDeckLinkVideoFrame* theFrame);
-int GetRowBytes(BMDPixelFormat pixelFormat, int frameWidth);
@@ -0,0 +1,275 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include "CaptureGroupAligner.h"
+
+static const BMDTimeScale	kNanosecondTimeScale = 1000000000;
+static const BMDTimeValue	kNoStreamTime = INT64_MIN;
+
+CaptureGroupAligner::CaptureGroupAligner(unsigned deviceCount, BMDTimeScale timeScale, unsigned timeoutMilliseconds, const CaptureBundleHandler& handler) :
+	m_deviceCount(deviceCount),
+	m_timeScale(timeScale),
+	m_timeout(timeoutMilliseconds),
+	m_handler(handler),
+	m_running(false),
+	m_lastStreamTimes(deviceCount, kNoStreamTime),
+	m_delivered(false),
+	m_lastDeliveredTime(0),
+	m_sequence(0)
+{
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+CaptureGroupAligner::~CaptureGroupAligner()
+{
+	Stop();
+}
+
+HRESULT CaptureGroupAligner::Start(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_running)
+		return E_FAIL;
+
+	m_lastStreamTimes.assign(m_deviceCount, kNoStreamTime);
+	m_delivered = false;
+	m_running = true;
+	m_thread = std::thread(&CaptureGroupAligner::deliveryThread, this);
+
+	return S_OK;
+}
+
+void CaptureGroupAligner::Stop(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_condition.notify_all();
+
+	if (m_thread.joinable())
+		m_thread.join();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	discardPendingLocked();
+}
+
+HRESULT CaptureGroupAligner::FrameArrived(unsigned deviceIndex, IDeckLinkVideoInputFrame* videoFrame)
+{
+	BMDTimeValue	streamTime;
+	BMDTimeValue	frameDuration;
+	BMDTimeValue	hardwareTime;
+	HRESULT			result;
+
+	if ((deviceIndex >= m_deviceCount) || (videoFrame == NULL))
+		return E_INVALIDARG;
+
+	result = videoFrame->GetStreamTime(&streamTime, &frameDuration, m_timeScale);
+	if (result != S_OK)
+		return result;
+
+	if (videoFrame->GetHardwareReferenceTimestamp(kNanosecondTimeScale, &hardwareTime, NULL) != S_OK)
+		hardwareTime = -1;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_running)
+			return S_FALSE;
+
+		// A device's stream times only go forward unless its streams were restarted, in
+		// which case nothing pending can be matched any more
+		if ((m_lastStreamTimes[deviceIndex] != kNoStreamTime) && (streamTime <= m_lastStreamTimes[deviceIndex]))
+		{
+			discardPendingLocked();
+			m_lastStreamTimes.assign(m_deviceCount, kNoStreamTime);
+			m_delivered = false;
+			m_statistics.realignments++;
+		}
+
+		m_lastStreamTimes[deviceIndex] = streamTime;
+
+		if (m_delivered && (streamTime <= m_lastDeliveredTime))
+		{
+			m_statistics.lateFrames++;
+		}
+		else
+		{
+			auto inserted = m_pending.insert(std::make_pair(streamTime, PendingBundle()));
+			PendingBundle& bundle = inserted.first->second;
+
+			if (inserted.second)
+			{
+				bundle.frameDuration = frameDuration;
+				bundle.frames.assign(m_deviceCount, NULL);
+				bundle.hardwareTimes.assign(m_deviceCount, -1);
+				bundle.frameCount = 0;
+				bundle.deadline = std::chrono::steady_clock::now() + m_timeout;
+			}
+
+			videoFrame->AddRef();
+			bundle.frames[deviceIndex] = videoFrame;
+			bundle.hardwareTimes[deviceIndex] = hardwareTime;
+			bundle.frameCount++;
+		}
+	}
+
+	// Also wakes the delivery thread when a late device moving on completes an older bundle
+	m_condition.notify_one();
+
+	return S_OK;
+}
+
+bool CaptureGroupAligner::isReadyLocked(BMDTimeValue streamTime, const PendingBundle& bundle, bool* timedOut)
+{
+	bool	devicesPassed = true;
+
+	*timedOut = false;
+
+	if (bundle.frameCount == m_deviceCount)
+		return true;
+
+	// Devices deliver in stream time order, so one that has moved past this bundle
+	// dropped its frame and will not supply it
+	for (unsigned i = 0; i < m_deviceCount; i++)
+	{
+		if ((bundle.frames[i] == NULL) && ((m_lastStreamTimes[i] == kNoStreamTime) || (m_lastStreamTimes[i] <= streamTime)))
+		{
+			devicesPassed = false;
+			break;
+		}
+	}
+
+	if (devicesPassed)
+		return true;
+
+	if (std::chrono::steady_clock::now() >= bundle.deadline)
+	{
+		*timedOut = true;
+		return true;
+	}
+
+	return false;
+}
+
+void CaptureGroupAligner::discardPendingLocked(void)
+{
+	for (auto& pending : m_pending)
+	{
+		for (IDeckLinkVideoInputFrame* frame : pending.second.frames)
+		{
+			if (frame != NULL)
+			{
+				frame->Release();
+				m_statistics.discardedFrames++;
+			}
+		}
+	}
+	m_pending.clear();
+}
+
+void CaptureGroupAligner::deliveryThread(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (m_running)
+	{
+		CaptureFrameBundle	bundle;
+		bool				timedOut;
+		int64_t				earliest = INT64_MAX;
+		int64_t				latest = INT64_MIN;
+
+		if (m_pending.empty())
+		{
+			m_condition.wait(lock);
+			continue;
+		}
+
+		auto oldest = m_pending.begin();
+		if (!isReadyLocked(oldest->first, oldest->second, &timedOut))
+		{
+			m_condition.wait_until(lock, oldest->second.deadline);
+			continue;
+		}
+
+		bundle.sequence = m_sequence++;
+		bundle.streamTime = oldest->first;
+		bundle.frameDuration = oldest->second.frameDuration;
+		bundle.timeScale = m_timeScale;
+		bundle.frames = oldest->second.frames;
+		bundle.missingFrames = m_deviceCount - oldest->second.frameCount;
+
+		for (int64_t hardwareTime : oldest->second.hardwareTimes)
+		{
+			if (hardwareTime < 0)
+				continue;
+			if (hardwareTime < earliest)
+				earliest = hardwareTime;
+			if (hardwareTime > latest)
+				latest = hardwareTime;
+		}
+		bundle.skew = (latest >= earliest) ? (latest - earliest) : 0;
+
+		m_statistics.bundlesDelivered++;
+		m_statistics.missingFrames += bundle.missingFrames;
+		if (bundle.missingFrames > 0)
+			m_statistics.partialBundles++;
+		if (timedOut)
+			m_statistics.timeouts++;
+		if (oldest->second.frameCount > 1)
+			m_skew.Record(bundle.skew);
+
+		m_delivered = true;
+		m_lastDeliveredTime = oldest->first;
+		m_pending.erase(oldest);
+
+		// Deliver without the lock so the capture callbacks are never held up by the consumer
+		lock.unlock();
+
+		m_handler(bundle);
+
+		for (IDeckLinkVideoInputFrame* frame : bundle.frames)
+		{
+			if (frame != NULL)
+				frame->Release();
+		}
+
+		lock.lock();
+	}
+}
+
+void CaptureGroupAligner::GetStatistics(CaptureGroupAlignerStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	*statistics = m_statistics;
+	statistics->skewMedian = m_skew.GetValueAtPercentile(50);
+	statistics->skew99 = m_skew.GetValueAtPercentile(99);
+	statistics->skewMaximum = m_skew.GetMaximum();
+}
@@ -0,0 +1,127 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "LatencyHistogram.h"
+
+// The frames captured by every device of a capture group for one stream time
+struct CaptureFrameBundle
+{
+	uint64_t								sequence;
+	BMDTimeValue							streamTime;
+	BMDTimeValue							frameDuration;
+	BMDTimeScale							timeScale;
+	std::vector<IDeckLinkVideoInputFrame*>	frames;				// Indexed by device, NULL for a device that missed the frame
+	unsigned								missingFrames;
+	int64_t									skew;				// Spread of the frames' hardware timestamps, in nanoseconds
+};
+
+// Called on the aligner's delivery thread, one bundle at a time in stream time order.
+// The frames are released when the handler returns; AddRef() any frame kept longer.
+typedef std::function<void(const CaptureFrameBundle& bundle)> CaptureBundleHandler;
+
+struct CaptureGroupAlignerStatistics
+{
+	uint64_t	bundlesDelivered;
+	uint64_t	partialBundles;			// Bundles delivered with at least one frame missing
+	uint64_t	missingFrames;			// Frames absent from delivered bundles
+	uint64_t	timeouts;				// Partial bundles delivered because a device was late
+	uint64_t	lateFrames;				// Frames that arrived after their bundle was delivered
+	uint64_t	realignments;			// Times the pending bundles were discarded because a device's stream time went back
+	uint64_t	discardedFrames;		// Frames released by a realignment or Stop() without being delivered
+	int64_t		skewMedian;				// Hardware timestamp spread within bundles, in nanoseconds
+	int64_t		skew99;
+	int64_t		skewMaximum;
+};
+
+// Joins the frames of the devices in a bmdDeckLinkConfigCaptureGroup into one bundle per
+// frame. Each device's VideoInputFrameArrived() passes its frames to FrameArrived(), which
+// matches them by stream time; devices in a group started together share the same stream
+// times. A bundle is delivered once every device has supplied its frame or moved past it,
+// or when the timeout expires after its first frame arrived, so one stalled device
+// delays the group by at most the timeout. A frame that arrives after its bundle went
+// out is released and counted.
+//
+// Input frames are held until their bundle is delivered, and the driver has a limited
+// number of capture buffers, so keep the timeout to a frame or two.
+class CaptureGroupAligner
+{
+public:
+	CaptureGroupAligner(unsigned deviceCount, BMDTimeScale timeScale, unsigned timeoutMilliseconds, const CaptureBundleHandler& handler);
+	~CaptureGroupAligner();
+
+	HRESULT		Start(void);
+	// Stops the delivery thread and discards any bundles not yet delivered
+	void		Stop(void);
+
+	// Call from the device's VideoInputFrameArrived()
+	HRESULT		FrameArrived(unsigned deviceIndex, IDeckLinkVideoInputFrame* videoFrame);
+
+	void		GetStatistics(CaptureGroupAlignerStatistics* statistics);
+
+private:
+	struct PendingBundle
+	{
+		BMDTimeValue							frameDuration;
+		std::vector<IDeckLinkVideoInputFrame*>	frames;
+		std::vector<int64_t>					hardwareTimes;
+		unsigned								frameCount;
+		std::chrono::steady_clock::time_point	deadline;
+	};
+
+	bool		isReadyLocked(BMDTimeValue streamTime, const PendingBundle& bundle, bool* timedOut);
+	void		discardPendingLocked(void);
+	void		deliveryThread(void);
+
+	unsigned								m_deviceCount;
+	BMDTimeScale							m_timeScale;
+	std::chrono::milliseconds				m_timeout;
+	CaptureBundleHandler					m_handler;
+
+	std::mutex								m_mutex;
+	std::condition_variable					m_condition;
+	std::thread								m_thread;
+	bool									m_running;
+	std::map<BMDTimeValue, PendingBundle>	m_pending;
+	std::vector<BMDTimeValue>				m_lastStreamTimes;		// Newest stream time seen from each device
+	bool									m_delivered;
+	BMDTimeValue							m_lastDeliveredTime;
+	uint64_t								m_sequence;
+
+	CaptureGroupAlignerStatistics			m_statistics;
+	LatencyHistogram						m_skew;
+};
@@ -0,0 +1,274 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdlib.h>
+#include <chrono>
+#include "CaptureLatencyProfiler.h"
+
+static const BMDTimeScale	kNanosecondTimeScale = 1000000000;
+static const int			kCalibrationSamples = 5;
+static const int			kFoldsPerReport = 4;
+
+// Profiles each thread has recorded into, tagged with the owning profiler's id so a
+// recreated profiler never picks up a stale entry
+static std::atomic<uint64_t> g_nextProfilerId(1);
+static thread_local std::vector<std::pair<uint64_t, void*>> t_threadStates;
+
+static int64_t GetHostTime(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void ResetProfile(CaptureThreadProfile& profile)
+{
+	profile.frames = 0;
+	profile.deadlineMisses = 0;
+	profile.deliveryLatency.Reset();
+	profile.arrivalJitter.Reset();
+	profile.callbackDuration.Reset();
+}
+
+static void AddProfile(CaptureThreadProfile& profile, const CaptureThreadProfile& other)
+{
+	profile.frames += other.frames;
+	profile.deadlineMisses += other.deadlineMisses;
+	profile.deliveryLatency.Add(other.deliveryLatency);
+	profile.arrivalJitter.Add(other.arrivalJitter);
+	profile.callbackDuration.Add(other.callbackDuration);
+}
+
+CaptureLatencyProfiler::CaptureLatencyProfiler(IDeckLinkInput* deckLinkInput, const char* name, unsigned reportIntervalMilliseconds, FILE* reportFile) :
+	m_deckLinkInput(deckLinkInput),
+	m_name(name),
+	m_reportInterval((int64_t)reportIntervalMilliseconds * 1000000),
+	m_reportFile(reportFile),
+	m_id(g_nextProfilerId++),
+	m_clockOffset(0),
+	m_stopping(false)
+{
+	m_deckLinkInput->AddRef();
+	calibrateClockOffset();
+
+	if ((m_reportFile != NULL) && (m_reportInterval > 0))
+		m_reportThread = std::thread(&CaptureLatencyProfiler::reportThread, this);
+}
+
+CaptureLatencyProfiler::~CaptureLatencyProfiler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_stopCondition.notify_all();
+
+	if (m_reportThread.joinable())
+		m_reportThread.join();
+
+	m_deckLinkInput->Release();
+}
+
+CaptureLatencyProfiler::ThreadState* CaptureLatencyProfiler::getThreadState(void)
+{
+	ThreadState* state;
+
+	for (auto& entry : t_threadStates)
+	{
+		if (entry.first == m_id)
+			return (ThreadState*)entry.second;
+	}
+
+	// First callback on this thread
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	state = new ThreadState();
+	state->index = (unsigned)m_threads.size();
+	state->lastEntryTime = 0;
+	state->lastFoldTime = GetHostTime();
+	state->live.threadIndex = state->index;
+	state->interval.threadIndex = state->index;
+	state->total.threadIndex = state->index;
+	ResetProfile(state->live);
+	ResetProfile(state->interval);
+	ResetProfile(state->total);
+
+	m_threads.emplace_back(state);
+	t_threadStates.push_back(std::make_pair(m_id, (void*)state));
+
+	return state;
+}
+
+CaptureCallbackToken CaptureLatencyProfiler::CallbackEntered(IDeckLinkVideoInputFrame* videoFrame)
+{
+	CaptureCallbackToken	token;
+	ThreadState*			state;
+	BMDTimeValue			frameTime;
+	BMDTimeValue			frameDuration;
+
+	token.entryTime = GetHostTime();
+	token.deliveryLatency = -1;
+	token.frameDuration = 0;
+
+	state = getThreadState();
+	token.thread = state;
+
+	if (videoFrame->GetHardwareReferenceTimestamp(kNanosecondTimeScale, &frameTime, &frameDuration) == S_OK)
+	{
+		token.deliveryLatency = token.entryTime + m_clockOffset.load(std::memory_order_relaxed) - frameTime;
+		token.frameDuration = frameDuration;
+
+		// Clock offset drift can take a very short latency just below zero
+		if (token.deliveryLatency < 0)
+			token.deliveryLatency = 0;
+
+		if (state->lastEntryTime != 0)
+			state->live.arrivalJitter.Record(llabs(token.entryTime - state->lastEntryTime - frameDuration));
+	}
+	state->lastEntryTime = token.entryTime;
+
+	return token;
+}
+
+void CaptureLatencyProfiler::CallbackExited(const CaptureCallbackToken& token)
+{
+	ThreadState*	state = (ThreadState*)token.thread;
+	int64_t			exitTime = GetHostTime();
+	int64_t			duration = exitTime - token.entryTime;
+
+	state->live.frames++;
+	state->live.callbackDuration.Record(duration);
+
+	if (token.deliveryLatency >= 0)
+	{
+		state->live.deliveryLatency.Record(token.deliveryLatency);
+		// The next frame is delivered once it has been received, a frame after this one was
+		if (token.deliveryLatency + duration > 2 * token.frameDuration)
+			state->live.deadlineMisses++;
+	}
+
+	if (exitTime - state->lastFoldTime >= m_reportInterval / kFoldsPerReport)
+		foldThreadState(state, exitTime);
+}
+
+void CaptureLatencyProfiler::foldThreadState(ThreadState* state, int64_t now)
+{
+	// Never block the callback on the reporter; try again on the next frame
+	std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return;
+
+	AddProfile(state->interval, state->live);
+	AddProfile(state->total, state->live);
+	lock.unlock();
+
+	ResetProfile(state->live);
+	state->lastFoldTime = now;
+}
+
+void CaptureLatencyProfiler::calibrateClockOffset(void)
+{
+	BMDTimeValue	hardwareTime;
+	BMDTimeValue	timeInFrame;
+	BMDTimeValue	ticksPerFrame;
+	int64_t			bestWindow = INT64_MAX;
+
+	// Bracket the hardware clock read with host clock reads and keep the tightest pair
+	for (int i = 0; i < kCalibrationSamples; i++)
+	{
+		int64_t before = GetHostTime();
+		if (m_deckLinkInput->GetHardwareReferenceClock(kNanosecondTimeScale, &hardwareTime, &timeInFrame, &ticksPerFrame) != S_OK)
+			return;
+		int64_t after = GetHostTime();
+
+		if (after - before < bestWindow)
+		{
+			bestWindow = after - before;
+			m_clockOffset.store(hardwareTime - (before + (after - before) / 2), std::memory_order_relaxed);
+		}
+	}
+}
+
+void CaptureLatencyProfiler::reportThread(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_stopping)
+	{
+		m_stopCondition.wait_for(lock, std::chrono::nanoseconds(m_reportInterval));
+		if (m_stopping)
+			break;
+
+		for (auto& state : m_threads)
+		{
+			writeProfileLine(m_reportFile, "interval", state->interval);
+			ResetProfile(state->interval);
+		}
+		fflush(m_reportFile);
+
+		lock.unlock();
+		calibrateClockOffset();
+		lock.lock();
+	}
+}
+
+void CaptureLatencyProfiler::writeProfileLine(FILE* file, const char* period, const CaptureThreadProfile& profile)
+{
+	if (profile.frames == 0)
+	{
+		fprintf(file, "%s thread %u %s: no frames\n", m_name.c_str(), profile.threadIndex, period);
+		return;
+	}
+
+	fprintf(file, "%s thread %u %s: %llu frames, %llu missed deadlines, "
+			"delivery p50 %.3f p99 %.3f max %.3f ms, jitter p99 %.3f max %.3f ms, callback p50 %.3f p99 %.3f max %.3f ms\n",
+			m_name.c_str(), profile.threadIndex, period,
+			(unsigned long long)profile.frames, (unsigned long long)profile.deadlineMisses,
+			profile.deliveryLatency.GetValueAtPercentile(50) / 1e6,
+			profile.deliveryLatency.GetValueAtPercentile(99) / 1e6,
+			profile.deliveryLatency.GetMaximum() / 1e6,
+			profile.arrivalJitter.GetValueAtPercentile(99) / 1e6,
+			profile.arrivalJitter.GetMaximum() / 1e6,
+			profile.callbackDuration.GetValueAtPercentile(50) / 1e6,
+			profile.callbackDuration.GetValueAtPercentile(99) / 1e6,
+			profile.callbackDuration.GetMaximum() / 1e6);
+}
+
+void CaptureLatencyProfiler::GetThreadProfiles(std::vector<CaptureThreadProfile>& profiles)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	profiles.clear();
+	for (auto& state : m_threads)
+		profiles.push_back(state->total);
+}
+
+void CaptureLatencyProfiler::WriteSummary(FILE* file)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& state : m_threads)
+		writeProfileLine(file, "total", state->total);
+}
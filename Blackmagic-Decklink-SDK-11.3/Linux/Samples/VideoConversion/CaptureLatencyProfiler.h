@@ -0,0 +1,144 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "LatencyHistogram.h"
+
+// Distributions for one callback thread, in nanoseconds
+struct CaptureThreadProfile
+{
+	unsigned			threadIndex;
+	uint64_t			frames;
+	uint64_t			deadlineMisses;		// Callbacks still running when the next frame was due
+	LatencyHistogram	deliveryLatency;	// Frame hardware timestamp to callback entry
+	LatencyHistogram	arrivalJitter;		// Deviation of the callback interval from the frame duration
+	LatencyHistogram	callbackDuration;	// Callback entry to exit
+};
+
+struct CaptureCallbackToken
+{
+	void*		thread;
+	int64_t		entryTime;
+	int64_t		deliveryLatency;
+	int64_t		frameDuration;
+};
+
+// Profiles VideoInputFrameArrived(). At callback entry the frame's hardware reference
+// timestamp is compared with the host monotonic clock, mapped to the hardware clock by
+// an offset that is recalibrated every report. The timestamp marks the start of the
+// frame, so the delivery latency includes one frame duration of reception. The interval
+// between callbacks and the time spent in the callback are also measured.
+//
+// Each callback thread records into its own histograms without taking a lock. A few
+// times per report interval it folds them into the shared totals, but only when the
+// lock is free, so a callback never waits on the reporter. A reporter thread prints one
+// line per callback thread every interval.
+class CaptureLatencyProfiler
+{
+public:
+	CaptureLatencyProfiler(IDeckLinkInput* deckLinkInput, const char* name, unsigned reportIntervalMilliseconds, FILE* reportFile = stderr);
+	~CaptureLatencyProfiler();
+
+	CaptureCallbackToken	CallbackEntered(IDeckLinkVideoInputFrame* videoFrame);
+	void					CallbackExited(const CaptureCallbackToken& token);
+
+	// Totals since the profiler was created, as last folded in by each thread
+	void		GetThreadProfiles(std::vector<CaptureThreadProfile>& profiles);
+	void		WriteSummary(FILE* file);
+
+private:
+	struct ThreadState
+	{
+		unsigned				index;
+
+		// Written only by the callback thread
+		CaptureThreadProfile	live;
+		int64_t					lastEntryTime;
+		int64_t					lastFoldTime;
+
+		// Guarded by m_mutex
+		CaptureThreadProfile	interval;
+		CaptureThreadProfile	total;
+	};
+
+	ThreadState*	getThreadState(void);
+	void			foldThreadState(ThreadState* state, int64_t now);
+	void			calibrateClockOffset(void);
+	void			reportThread(void);
+	void			writeProfileLine(FILE* file, const char* period, const CaptureThreadProfile& profile);
+
+	IDeckLinkInput*								m_deckLinkInput;
+	std::string									m_name;
+	int64_t										m_reportInterval;
+	FILE*										m_reportFile;
+	uint64_t									m_id;
+
+	// Hardware reference clock less host monotonic clock
+	std::atomic<int64_t>						m_clockOffset;
+
+	std::mutex									m_mutex;
+	std::condition_variable						m_stopCondition;
+	bool										m_stopping;
+	std::vector<std::unique_ptr<ThreadState>>	m_threads;
+	std::thread									m_reportThread;
+};
+
+// Profiles the enclosing scope of a VideoInputFrameArrived() callback. A NULL profiler
+// disables profiling.
+class CaptureProfileScope
+{
+public:
+	CaptureProfileScope(CaptureLatencyProfiler* profiler, IDeckLinkVideoInputFrame* videoFrame) :
+		m_profiler(profiler)
+	{
+		if ((m_profiler != NULL) && (videoFrame != NULL))
+			m_token = m_profiler->CallbackEntered(videoFrame);
+		else
+			m_profiler = NULL;
+	}
+
+	~CaptureProfileScope()
+	{
+		if (m_profiler != NULL)
+			m_profiler->CallbackExited(m_token);
+	}
+
+private:
+	CaptureLatencyProfiler*		m_profiler;
+	CaptureCallbackToken		m_token;
+};
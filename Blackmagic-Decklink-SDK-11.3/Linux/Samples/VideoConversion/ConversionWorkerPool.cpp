@@ -0,0 +1,151 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include "ConversionWorkerPool.h"
+
+static std::vector<int> allowedCPUs(void)
+{
+	std::vector<int>	cpus;
+	cpu_set_t			cpuSet;
+
+	if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+	{
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (CPU_ISSET(cpu, &cpuSet))
+				cpus.push_back(cpu);
+		}
+	}
+
+	return cpus;
+}
+
+ConversionWorkerPool::ConversionWorkerPool(unsigned threadCount) :
+	m_task(NULL),
+	m_taskCount(0),
+	m_nextTask(0),
+	m_busyWorkers(0),
+	m_generation(0),
+	m_quit(false)
+{
+	std::vector<int> cpus = allowedCPUs();
+
+	if (threadCount == 0)
+		threadCount = cpus.empty() ? std::max(1u, std::thread::hardware_concurrency()) : (unsigned)cpus.size();
+
+	// The calling thread is left unpinned and usually shares the first CPU with
+	// the application, so workers are placed from the second allowed CPU onwards
+	for (unsigned i = 1; i < threadCount; i++)
+		m_workers.emplace_back(&ConversionWorkerPool::workerThread, this, cpus.empty() ? -1 : cpus[i % cpus.size()]);
+}
+
+ConversionWorkerPool::~ConversionWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_startCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ConversionWorkerPool::Run(unsigned taskCount, const std::function<void(unsigned)>& task)
+{
+	std::lock_guard<std::mutex> runLock(m_runMutex);
+
+	if (taskCount == 0)
+		return;
+
+	if ((taskCount == 1) || m_workers.empty())
+	{
+		for (unsigned i = 0; i < taskCount; i++)
+			task(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_taskCount = taskCount;
+		m_nextTask = 0;
+		m_busyWorkers = (unsigned)m_workers.size();
+		m_generation++;
+	}
+	m_startCondition.notify_all();
+
+	runTasks();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this]{ return m_busyWorkers == 0; });
+	m_task = NULL;
+}
+
+void ConversionWorkerPool::runTasks(void)
+{
+	unsigned index;
+
+	while ((index = m_nextTask.fetch_add(1)) < m_taskCount)
+		(*m_task)(index);
+}
+
+void ConversionWorkerPool::workerThread(int cpu)
+{
+	uint64_t generation = 0;
+
+	if (cpu >= 0)
+	{
+		cpu_set_t cpuSet;
+
+		CPU_ZERO(&cpuSet);
+		CPU_SET(cpu, &cpuSet);
+		// Pinning is an optimisation only; an unpinned worker still does its share
+		pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_startCondition.wait(lock, [&]{ return m_quit || (m_generation != generation); });
+		if (m_quit)
+			break;
+
+		generation = m_generation;
+
+		lock.unlock();
+		runTasks();
+		lock.lock();
+
+		if (--m_busyWorkers == 0)
+			m_doneCondition.notify_one();
+	}
+}
@@ -0,0 +1,68 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads, each pinned to its own CPU, that run the tasks of one job
+// in parallel. The thread calling Run() takes part in the job too, so a pool of
+// N threads owns N - 1 worker threads. Jobs are serialised.
+class ConversionWorkerPool
+{
+public:
+	// A thread count of 0 uses every CPU the process is allowed to run on
+	explicit ConversionWorkerPool(unsigned threadCount);
+	~ConversionWorkerPool();
+
+	unsigned	GetThreadCount(void) const { return (unsigned)m_workers.size() + 1; }
+
+	// Calls task(i) for every i in [0, taskCount) and returns once all have completed
+	void		Run(unsigned taskCount, const std::function<void(unsigned)>& task);
+
+private:
+	void		workerThread(int cpu);
+	void		runTasks(void);
+
+	std::vector<std::thread>				m_workers;
+	std::mutex								m_runMutex;
+
+	std::mutex								m_mutex;
+	std::condition_variable					m_startCondition;
+	std::condition_variable					m_doneCondition;
+	const std::function<void(unsigned)>*	m_task;
+	unsigned								m_taskCount;
+	std::atomic<unsigned>					m_nextTask;
+	unsigned								m_busyWorkers;
+	uint64_t								m_generation;
+	bool									m_quit;
+};
@@ -0,0 +1,100 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include "FastVideoConversion.h"
+#include "V210Conversion.h"
+
+FastVideoConversion::FastVideoConversion() :
+	m_refCount(1),
+	m_fallbackConversion(NULL)
+{
+}
+
+FastVideoConversion::~FastVideoConversion()
+{
+	if (m_fallbackConversion != NULL)
+	{
+		m_fallbackConversion->Release();
+		m_fallbackConversion = NULL;
+	}
+}
+
+HRESULT FastVideoConversion::ConvertFrame(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame)
+{
+	HRESULT result = ConvertVideoFrameWithKernels(srcFrame, dstFrame);
+
+	if (result != E_NOTIMPL)
+		return result;
+
+	// The API conversion object is only created when first needed. It may be
+	// unavailable, in which case only the kernel conversions are offered.
+	std::call_once(m_fallbackCreated, [this]{ m_fallbackConversion = CreateVideoConversionInstance(); });
+
+	if (m_fallbackConversion != NULL)
+		result = m_fallbackConversion->ConvertFrame(srcFrame, dstFrame);
+
+	return result;
+}
+
+HRESULT FastVideoConversion::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkVideoConversion, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkVideoConversion*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG FastVideoConversion::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG FastVideoConversion::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+	return newRefValue;
+}
+
+IDeckLinkVideoConversion* CreateFastVideoConversionInstance(void)
+{
+	return new FastVideoConversion();
+}
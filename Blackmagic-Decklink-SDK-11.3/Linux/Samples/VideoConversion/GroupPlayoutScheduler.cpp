@@ -0,0 +1,303 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <chrono>
+#include "GroupPlayoutScheduler.h"
+
+static const BMDTimeScale kNanosecondTimeScale = 1000000000;
+
+GroupPlayoutScheduler::GroupPlayoutScheduler(const std::vector<IDeckLinkOutput*>& outputs, BMDTimeValue frameDuration, BMDTimeScale timeScale) :
+	m_outputs(outputs),
+	m_frameDuration(frameDuration),
+	m_timeScale(timeScale),
+	m_running(false),
+	m_nextTick(0),
+	m_rendering(false)
+{
+	for (IDeckLinkOutput* output : m_outputs)
+		output->AddRef();
+
+	memset(&m_statistics, 0, sizeof(m_statistics));
+	m_statistics.outputCount = (unsigned)m_outputs.size();
+}
+
+GroupPlayoutScheduler::~GroupPlayoutScheduler()
+{
+	Stop();
+	releaseFrames();
+
+	for (IDeckLinkOutput* output : m_outputs)
+		output->Release();
+}
+
+HRESULT GroupPlayoutScheduler::Allocate(unsigned frameCount, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags)
+{
+	HRESULT		result = S_OK;
+
+	if (m_outputs.empty() || (frameCount == 0))
+		return E_INVALIDARG;
+
+	if (m_running)
+		return E_FAIL;
+
+	releaseFrames();
+
+	for (unsigned i = 0; i < frameCount; i++)
+	{
+		Slot slot;
+
+		slot.frame = NULL;
+		slot.tick = 0;
+		slot.pendingOutputs = 0;
+
+		result = m_outputs[0]->CreateVideoFrame((int32_t)width, (int32_t)height, (int32_t)rowBytes, pixelFormat, flags, &slot.frame);
+		if (result != S_OK)
+		{
+			releaseFrames();
+			return result;
+		}
+
+		m_slots.push_back(slot);
+		m_freeSlots.push_back(i);
+	}
+
+	m_statistics.frameCount = frameCount;
+
+	return S_OK;
+}
+
+void GroupPlayoutScheduler::releaseFrames(void)
+{
+	// Frames still queued on a device are kept alive by the device until they complete
+	for (Slot& slot : m_slots)
+		slot.frame->Release();
+
+	m_slots.clear();
+	m_freeSlots.clear();
+}
+
+HRESULT GroupPlayoutScheduler::Preroll(const GroupFrameRenderer& renderer)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	if (m_running || m_slots.empty())
+		return E_FAIL;
+
+	m_renderer = renderer;
+	m_nextTick = 0;
+	m_statistics.minQueuedFrames = (unsigned)m_slots.size();
+
+	while (!m_freeSlots.empty())
+	{
+		unsigned slotIndex = takeSlotLocked();
+
+		lock.unlock();
+		renderAndSchedule(slotIndex);
+		lock.lock();
+	}
+
+	m_running = true;
+	m_thread = std::thread(&GroupPlayoutScheduler::renderThread, this);
+
+	return S_OK;
+}
+
+void GroupPlayoutScheduler::Stop(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_condition.notify_all();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+unsigned GroupPlayoutScheduler::takeSlotLocked(void)
+{
+	unsigned	slotIndex = m_freeSlots.back();
+	Slot&		slot = m_slots[slotIndex];
+
+	m_freeSlots.pop_back();
+
+	slot.tick = m_nextTick++;
+	slot.pendingOutputs = (unsigned)m_outputs.size();
+	slot.completionTimes.assign(m_outputs.size(), -1);
+
+	m_rendering = true;
+
+	return slotIndex;
+}
+
+void GroupPlayoutScheduler::renderAndSchedule(unsigned slotIndex)
+{
+	Slot&		slot = m_slots[slotIndex];
+	HRESULT		result;
+
+	// Render once for the whole group
+	auto renderStart = std::chrono::steady_clock::now();
+	result = m_renderer(slot.frame, slot.tick);
+	uint64_t renderTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - renderStart).count();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_rendering = false;
+		m_statistics.ticksRendered++;
+		if (result != S_OK)
+			m_statistics.renderFailures++;
+		if (renderTime > m_statistics.peakRenderMicroseconds)
+			m_statistics.peakRenderMicroseconds = renderTime;
+	}
+
+	// A failed render still goes out, so the outputs keep their timeline
+	for (unsigned i = 0; i < m_outputs.size(); i++)
+	{
+		result = m_outputs[i]->ScheduleVideoFrame(slot.frame, (BMDTimeValue)slot.tick * m_frameDuration, m_frameDuration, m_timeScale);
+		if (result != S_OK)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_statistics.scheduleFailures++;
+			outputDoneLocked(slotIndex, i, -1);
+		}
+	}
+}
+
+int GroupPlayoutScheduler::findSlotLocked(IDeckLinkVideoFrame* frame)
+{
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if ((IDeckLinkVideoFrame*)m_slots[i].frame == frame)
+			return (int)i;
+	}
+	return -1;
+}
+
+void GroupPlayoutScheduler::outputDoneLocked(unsigned slotIndex, unsigned outputIndex, int64_t completionTime)
+{
+	Slot&		slot = m_slots[slotIndex];
+	int64_t		earliest = INT64_MAX;
+	int64_t		latest = INT64_MIN;
+	unsigned	timestamps = 0;
+	unsigned	queuedFrames;
+
+	slot.completionTimes[outputIndex] = completionTime;
+	if (--slot.pendingOutputs > 0)
+		return;
+
+	// Every output is done with the frame
+	for (int64_t time : slot.completionTimes)
+	{
+		if (time < 0)
+			continue;
+		if (time < earliest)
+			earliest = time;
+		if (time > latest)
+			latest = time;
+		timestamps++;
+	}
+	if (timestamps > 1)
+		m_skew.Record(latest - earliest);
+
+	m_freeSlots.push_back(slotIndex);
+
+	queuedFrames = (unsigned)(m_slots.size() - m_freeSlots.size()) - (m_rendering ? 1 : 0);
+	if (m_running && (queuedFrames < m_statistics.minQueuedFrames))
+		m_statistics.minQueuedFrames = queuedFrames;
+
+	m_condition.notify_one();
+}
+
+void GroupPlayoutScheduler::FrameCompleted(unsigned outputIndex, IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
+{
+	BMDTimeValue	completionTime = -1;
+
+	if (outputIndex >= m_outputs.size())
+		return;
+
+	// A flushed frame never went to air, so it has no completion time to compare
+	if ((result != bmdOutputFrameFlushed) &&
+		(m_outputs[outputIndex]->GetFrameCompletionReferenceTimestamp(completedFrame, kNanosecondTimeScale, &completionTime) != S_OK))
+		completionTime = -1;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	int slotIndex = findSlotLocked(completedFrame);
+	if ((slotIndex < 0) || (m_slots[slotIndex].pendingOutputs == 0))
+		return;
+
+	switch (result)
+	{
+		case bmdOutputFrameCompleted:
+			m_statistics.framesCompleted++;
+			break;
+		case bmdOutputFrameDisplayedLate:
+			m_statistics.framesLate++;
+			break;
+		case bmdOutputFrameDropped:
+			m_statistics.framesDropped++;
+			break;
+		case bmdOutputFrameFlushed:
+			m_statistics.framesFlushed++;
+			break;
+	}
+
+	outputDoneLocked((unsigned)slotIndex, outputIndex, completionTime);
+}
+
+void GroupPlayoutScheduler::renderThread(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_condition.wait(lock, [this] { return !m_running || !m_freeSlots.empty(); });
+		if (!m_running)
+			break;
+
+		unsigned slotIndex = takeSlotLocked();
+
+		lock.unlock();
+		renderAndSchedule(slotIndex);
+		lock.lock();
+	}
+}
+
+void GroupPlayoutScheduler::GetStatistics(GroupPlayoutStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	*statistics = m_statistics;
+	statistics->freeFrames = (unsigned)m_freeSlots.size();
+	statistics->queuedFrames = (unsigned)(m_slots.size() - m_freeSlots.size()) - (m_rendering ? 1 : 0);
+	statistics->skewMedian = m_skew.GetValueAtPercentile(50);
+	statistics->skew99 = m_skew.GetValueAtPercentile(99);
+	statistics->skewMaximum = m_skew.GetMaximum();
+}
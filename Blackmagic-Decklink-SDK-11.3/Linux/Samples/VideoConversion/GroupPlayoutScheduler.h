@@ -0,0 +1,126 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "LatencyHistogram.h"
+
+// Draws the frame for one tick. The same frame is then scheduled on every output.
+typedef std::function<HRESULT(IDeckLinkMutableVideoFrame* frame, uint64_t tick)> GroupFrameRenderer;
+
+struct GroupPlayoutStatistics
+{
+	unsigned	outputCount;
+	unsigned	frameCount;
+	unsigned	freeFrames;
+	unsigned	queuedFrames;			// Frames scheduled and not yet completed by every output
+	unsigned	minQueuedFrames;		// Low watermark of queuedFrames as each frame is freed
+	uint64_t	ticksRendered;
+	uint64_t	renderFailures;
+	uint64_t	scheduleFailures;		// Per output
+	uint64_t	framesCompleted;		// Per output
+	uint64_t	framesLate;				// Per output
+	uint64_t	framesDropped;			// Per output
+	uint64_t	framesFlushed;			// Per output
+	uint64_t	peakRenderMicroseconds;
+	int64_t		skewMedian;				// Spread of one tick's completion timestamps across outputs, in nanoseconds
+	int64_t		skew99;
+	int64_t		skewMaximum;
+};
+
+// Plays one rendered stream out of every device of a bmdVideoOutputSynchronizeToPlaybackGroup
+// group. Each tick is rendered once, by a single render thread, and the same frame is
+// scheduled on all outputs, so the render cost and the timing loop do not grow with the
+// number of outputs.
+//
+// The scheduler owns a small ring of frames shared by all outputs. A frame is free again
+// only once every output has completed it, so the slowest output paces the group and no
+// frame is drawn into while any device may still be reading it. The completion callbacks
+// only account for the frame and wake the render thread. The completion timestamps of
+// each tick are compared across outputs to measure how closely the group stays in step.
+//
+// The application enables the outputs, calls Preroll(), starts the group's playback,
+// and calls FrameCompleted() from every output's ScheduledFrameCompleted(). Call Stop()
+// before stopping playback.
+class GroupPlayoutScheduler
+{
+public:
+	GroupPlayoutScheduler(const std::vector<IDeckLinkOutput*>& outputs, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+	~GroupPlayoutScheduler();
+
+	// Creates the shared frames on the first output. The number of frames is the depth
+	// each output is kept scheduled to.
+	HRESULT		Allocate(unsigned frameCount, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags);
+
+	// Schedules every frame on every output, then starts the render thread
+	HRESULT		Preroll(const GroupFrameRenderer& renderer);
+	void		Stop(void);
+
+	void		FrameCompleted(unsigned outputIndex, IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result);
+
+	void		GetStatistics(GroupPlayoutStatistics* statistics);
+
+private:
+	struct Slot
+	{
+		IDeckLinkMutableVideoFrame*		frame;
+		uint64_t						tick;
+		unsigned						pendingOutputs;
+		std::vector<int64_t>			completionTimes;
+	};
+
+	int			findSlotLocked(IDeckLinkVideoFrame* frame);
+	void		outputDoneLocked(unsigned slotIndex, unsigned outputIndex, int64_t completionTime);
+	unsigned	takeSlotLocked(void);
+	void		renderAndSchedule(unsigned slotIndex);
+	void		renderThread(void);
+	void		releaseFrames(void);
+
+	std::vector<IDeckLinkOutput*>	m_outputs;
+	BMDTimeValue					m_frameDuration;
+	BMDTimeScale					m_timeScale;
+	GroupFrameRenderer				m_renderer;
+
+	std::mutex						m_mutex;
+	std::condition_variable			m_condition;
+	std::thread						m_thread;
+	bool							m_running;
+	std::vector<Slot>				m_slots;
+	std::vector<unsigned>			m_freeSlots;
+	uint64_t						m_nextTick;
+	bool							m_rendering;
+
+	GroupPlayoutStatistics			m_statistics;
+	LatencyHistogram				m_skew;
+};
@@ -0,0 +1,482 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "HugePageMemoryAllocator.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT		26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB		(21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB		(30 << MAP_HUGE_SHIFT)
+#endif
+
+static const size_t		kBufferAlignment		= 4096;
+static const size_t		kHugePageSize			= 2 * 1024 * 1024;
+static const size_t		kGiganticPageSize		= 1024 * 1024 * 1024;
+static const uint32_t	kNoSlot					= 0xFFFFFFFF;
+static const int		kMpolPreferred			= 1;		// From <linux/mempolicy.h>, which needs libnuma's headers on some distributions
+static const int		kMaxNumaNodes			= 1024;
+
+static size_t RoundUp(size_t value, size_t multiple)
+{
+	return ((value + multiple - 1) / multiple) * multiple;
+}
+
+// Prefer the node rather than bind to it, so a node without free huge pages falls back
+// to another instead of failing the page fault
+static bool PreferNumaNode(void* address, size_t length, int node)
+{
+	unsigned long	nodeMask[kMaxNumaNodes / (8 * sizeof(unsigned long))];
+
+	if ((node < 0) || (node >= kMaxNumaNodes))
+		return false;
+
+	memset(nodeMask, 0, sizeof(nodeMask));
+	nodeMask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+	return syscall(SYS_mbind, address, length, kMpolPreferred, nodeMask, (unsigned long)kMaxNumaNodes, 0) == 0;
+}
+
+HugePageMemoryAllocator::HugePageMemoryAllocator(const HugePageAllocatorSettings& settings) :
+	m_refCount(1),
+	m_settings(settings),
+	m_slots(new Slot[settings.maximumBuffers]),
+	m_arenas(new Arena[settings.maximumBuffers]),
+	m_slotCount(0),
+	m_arenaCount(0),
+	m_freeHead(kNoSlot),
+	m_slotSize(0),
+	m_outstanding(0),
+	m_peakOutstanding(0),
+	m_heapAllocations(0),
+	m_pageSize(0),
+	m_transparentHugePages(false),
+	m_numaBound(false)
+{
+	if (m_settings.buffersPerArena == 0)
+		m_settings.buffersPerArena = 1;
+}
+
+HugePageMemoryAllocator::~HugePageMemoryAllocator()
+{
+	unmapArenas();
+
+	// Any buffers still outstanding are owned by frames that outlived us
+	for (auto& buffer : m_heapBuffers)
+		free(buffer.first);
+}
+
+void HugePageMemoryAllocator::pushFreeSlot(uint32_t slot)
+{
+	uint64_t head = m_freeHead.load(std::memory_order_acquire);
+	uint64_t newHead;
+
+	do
+	{
+		m_slots[slot].next.store((uint32_t)head, std::memory_order_relaxed);
+		// The tag changes on every update, so a pop that raced with a pop and push of the same slot fails
+		newHead = (((head >> 32) + 1) << 32) | slot;
+	}
+	while (!m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_acquire));
+}
+
+uint32_t HugePageMemoryAllocator::popFreeSlot(void)
+{
+	uint64_t	head = m_freeHead.load(std::memory_order_acquire);
+	uint64_t	newHead;
+	uint32_t	slot;
+
+	do
+	{
+		slot = (uint32_t)head;
+		if (slot == kNoSlot)
+			return kNoSlot;
+
+		newHead = (((head >> 32) + 1) << 32) | m_slots[slot].next.load(std::memory_order_relaxed);
+	}
+	while (!m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire));
+
+	return slot;
+}
+
+int HugePageMemoryAllocator::findSlot(void* buffer)
+{
+	uint32_t	arenaCount = m_arenaCount.load(std::memory_order_acquire);
+	size_t		slotSize = m_slotSize.load(std::memory_order_relaxed);
+	uint8_t*	address = (uint8_t*)buffer;
+
+	for (uint32_t i = 0; i < arenaCount; i++)
+	{
+		const Arena& arena = m_arenas[i];
+
+		if ((address >= arena.base) && (address < arena.base + (size_t)arena.slotCount * slotSize))
+			return (int)(arena.firstSlot + (address - arena.base) / slotSize);
+	}
+
+	return -1;
+}
+
+bool HugePageMemoryAllocator::addArena(void)
+{
+	// Caller must hold m_mutex
+	uint32_t	firstSlot = m_slotCount.load(std::memory_order_relaxed);
+	uint32_t	arenaIndex = m_arenaCount.load(std::memory_order_relaxed);
+	size_t		slotSize = m_slotSize.load(std::memory_order_relaxed);
+	size_t		length;
+	size_t		mappedSize = 0;
+	size_t		pageSize = 0;
+	uint32_t	slotCount;
+	void*		base = MAP_FAILED;
+
+	if (firstSlot >= m_settings.maximumBuffers)
+		return false;
+
+	slotCount = m_settings.maximumBuffers - firstSlot;
+	if (slotCount > m_settings.buffersPerArena)
+		slotCount = m_settings.buffersPerArena;
+
+	length = slotCount * slotSize;
+
+	// Gigantic pages only pay off when rounding up wastes less than half a page
+	if (m_settings.allowGiganticPages && (length >= kGiganticPageSize / 2))
+	{
+		mappedSize = RoundUp(length, kGiganticPageSize);
+		base = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+		pageSize = kGiganticPageSize;
+	}
+
+	if (base == MAP_FAILED)
+	{
+		mappedSize = RoundUp(length, kHugePageSize);
+		base = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+		pageSize = kHugePageSize;
+	}
+
+	if (base == MAP_FAILED)
+	{
+		mappedSize = RoundUp(length, kHugePageSize);
+		base = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			return false;
+
+		madvise(base, mappedSize, MADV_HUGEPAGE);
+		m_transparentHugePages = true;
+		pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	}
+
+	if (m_settings.numaNode >= 0)
+	{
+		bool bound = PreferNumaNode(base, mappedSize, m_settings.numaNode);
+		m_numaBound = (arenaIndex == 0) ? bound : (m_numaBound && bound);
+	}
+
+	// Fault the pages in now, on the chosen node, rather than on the first DMA
+	for (size_t offset = 0; offset < mappedSize; offset += pageSize)
+		((volatile uint8_t*)base)[offset] = 0;
+
+	m_pageSize = pageSize;
+
+	// Use whatever the rounding up left over
+	if (mappedSize / slotSize > slotCount)
+	{
+		uint32_t extra = (uint32_t)(mappedSize / slotSize) - slotCount;
+		if (extra > m_settings.maximumBuffers - firstSlot - slotCount)
+			extra = m_settings.maximumBuffers - firstSlot - slotCount;
+		slotCount += extra;
+	}
+
+	for (uint32_t i = 0; i < slotCount; i++)
+		m_slots[firstSlot + i].buffer = (uint8_t*)base + i * slotSize;
+
+	m_arenas[arenaIndex].base = (uint8_t*)base;
+	m_arenas[arenaIndex].mappedSize = mappedSize;
+	m_arenas[arenaIndex].firstSlot = firstSlot;
+	m_arenas[arenaIndex].slotCount = slotCount;
+
+	m_slotCount.store(firstSlot + slotCount, std::memory_order_release);
+	m_arenaCount.store(arenaIndex + 1, std::memory_order_release);
+
+	for (uint32_t i = 0; i < slotCount; i++)
+		pushFreeSlot(firstSlot + i);
+
+	return true;
+}
+
+void HugePageMemoryAllocator::unmapArenas(void)
+{
+	uint32_t arenaCount = m_arenaCount.load(std::memory_order_relaxed);
+
+	for (uint32_t i = 0; i < arenaCount; i++)
+		munmap(m_arenas[i].base, m_arenas[i].mappedSize);
+
+	m_arenaCount.store(0, std::memory_order_release);
+	m_slotCount.store(0, std::memory_order_release);
+	m_freeHead.store(kNoSlot, std::memory_order_release);
+	m_slotSize.store(0, std::memory_order_relaxed);
+	m_transparentHugePages = false;
+	m_numaBound = false;
+}
+
+void* HugePageMemoryAllocator::allocateFromHeap(uint32_t bufferSize)
+{
+	// Caller must hold m_mutex
+	void* buffer;
+
+	if (posix_memalign(&buffer, kBufferAlignment, bufferSize) != 0)
+		return NULL;
+
+	if (m_settings.numaNode >= 0)
+		PreferNumaNode(buffer, RoundUp(bufferSize, kBufferAlignment), m_settings.numaNode);
+
+	m_heapBuffers[buffer] = bufferSize;
+	m_heapAllocations++;
+
+	return buffer;
+}
+
+HRESULT HugePageMemoryAllocator::AllocateBuffer(uint32_t bufferSize, void** allocatedBuffer)
+{
+	uint32_t	slot = kNoSlot;
+	size_t		slotSize;
+	unsigned	outstanding;
+	unsigned	peak;
+
+	if (allocatedBuffer == NULL)
+		return E_POINTER;
+
+	*allocatedBuffer = NULL;
+
+	slotSize = m_slotSize.load(std::memory_order_relaxed);
+	if (slotSize == 0)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		slotSize = m_slotSize.load(std::memory_order_relaxed);
+		if (slotSize == 0)
+		{
+			slotSize = RoundUp(bufferSize, kBufferAlignment);
+			m_slotSize.store(slotSize, std::memory_order_relaxed);
+		}
+	}
+
+	if (bufferSize <= slotSize)
+	{
+		slot = popFreeSlot();
+		if (slot == kNoSlot)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			// Another thread may have mapped an arena while we waited
+			slot = popFreeSlot();
+			if ((slot == kNoSlot) && addArena())
+				slot = popFreeSlot();
+		}
+	}
+
+	if (slot != kNoSlot)
+	{
+		*allocatedBuffer = m_slots[slot].buffer;
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		*allocatedBuffer = allocateFromHeap(bufferSize);
+		if (*allocatedBuffer == NULL)
+			return E_OUTOFMEMORY;
+	}
+
+	outstanding = ++m_outstanding;
+	peak = m_peakOutstanding.load(std::memory_order_relaxed);
+	while ((outstanding > peak) && !m_peakOutstanding.compare_exchange_weak(peak, outstanding))
+		;
+
+	return S_OK;
+}
+
+HRESULT HugePageMemoryAllocator::ReleaseBuffer(void* buffer)
+{
+	int slot = findSlot(buffer);
+
+	if (slot >= 0)
+	{
+		pushFreeSlot((uint32_t)slot);
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_heapBuffers.find(buffer);
+
+		if (iter == m_heapBuffers.end())
+			return E_INVALIDARG;
+
+		free(iter->first);
+		m_heapBuffers.erase(iter);
+	}
+
+	--m_outstanding;
+	return S_OK;
+}
+
+HRESULT HugePageMemoryAllocator::Commit(void)
+{
+	return S_OK;
+}
+
+HRESULT HugePageMemoryAllocator::Decommit(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// The arenas are kept while any buffer is in use; once idle they are unmapped, so the
+	// next stream may pick a different buffer size
+	if (m_outstanding.load() == 0)
+		unmapArenas();
+
+	return S_OK;
+}
+
+void HugePageMemoryAllocator::GetStatistics(HugePageAllocatorStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	statistics->bufferSize = m_slotSize.load(std::memory_order_relaxed);
+	statistics->arenaBuffers = m_slotCount.load(std::memory_order_relaxed);
+	statistics->outstandingBuffers = m_outstanding.load();
+	statistics->peakOutstandingBuffers = m_peakOutstanding.load();
+	statistics->pageSize = m_pageSize;
+	statistics->transparentHugePages = m_transparentHugePages;
+	statistics->numaNode = m_settings.numaNode;
+	statistics->numaBound = m_numaBound;
+	statistics->heapAllocations = m_heapAllocations;
+}
+
+HRESULT HugePageMemoryAllocator::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkMemoryAllocator, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkMemoryAllocator*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG HugePageMemoryAllocator::AddRef()
+{
+	return __sync_add_and_fetch(&m_refCount, 1);
+}
+
+ULONG HugePageMemoryAllocator::Release()
+{
+	int32_t newRefValue = __sync_sub_and_fetch(&m_refCount, 1);
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+static int ReadNumaNode(const char* path)
+{
+	FILE*	file = fopen(path, "r");
+	int		node = -1;
+
+	if (file == NULL)
+		return -1;
+
+	if (fscanf(file, "%d", &node) != 1)
+		node = -1;
+
+	fclose(file);
+	return node;
+}
+
+int GetDeckLinkNumaNode(IDeckLink* deckLink)
+{
+	IDeckLinkProfileAttributes*		attributes = NULL;
+	char*							handle = NULL;
+	char							path[256];
+	int								node = -1;
+
+	if (deckLink->QueryInterface(IID_IDeckLinkProfileAttributes, (void**)&attributes) != S_OK)
+		goto bail;
+
+	if (attributes->GetString(BMDDeckLinkDeviceHandle, (const char**)&handle) != S_OK)
+		goto bail;
+
+	// Look for a PCI address (domain:bus:device.function) within the handle
+	for (const char* p = handle; *p != '\0'; p++)
+	{
+		unsigned	domain = 0, bus, device, function;
+		int			length = 0;
+
+		if ((sscanf(p, "%4x:%2x:%2x.%1x%n", &domain, &bus, &device, &function, &length) == 4) ||
+			((domain = 0), sscanf(p, "%2x:%2x.%1x%n", &bus, &device, &function, &length) == 3))
+		{
+			snprintf(path, sizeof(path), "/sys/bus/pci/devices/%04x:%02x:%02x.%x/numa_node", domain, bus, device, function);
+			node = ReadNumaNode(path);
+			if (node >= 0)
+				goto bail;
+		}
+	}
+
+	// Otherwise a device node, whose sysfs entry links to the PCI device
+	{
+		const char* name = strrchr(handle, '/');
+		if (name != NULL)
+		{
+			snprintf(path, sizeof(path), "/sys/class/blackmagic/%s/device/numa_node", name + 1);
+			node = ReadNumaNode(path);
+		}
+	}
+
+bail:
+	if (handle != NULL)
+		free(handle);
+
+	if (attributes != NULL)
+		attributes->Release();
+
+	return node;
+}
@@ -0,0 +1,148 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+struct HugePageAllocatorSettings
+{
+	unsigned	maximumBuffers;			// Buffers served from huge page arenas; any beyond come from the heap
+	unsigned	buffersPerArena;		// Buffers mapped together by each arena
+	bool		allowGiganticPages;		// Try 1 GB pages for arenas of at least 512 MB
+	int			numaNode;				// Node to place buffers on, or -1 for the kernel's default
+
+	HugePageAllocatorSettings() :
+		maximumBuffers(64),
+		buffersPerArena(8),
+		allowGiganticPages(true),
+		numaNode(-1)
+	{ }
+};
+
+struct HugePageAllocatorStatistics
+{
+	size_t		bufferSize;				// Size of the pooled buffers, 0 until the first allocation
+	unsigned	arenaBuffers;			// Buffers carved from arenas
+	unsigned	outstandingBuffers;
+	unsigned	peakOutstandingBuffers;
+	size_t		pageSize;				// Page size backing the arenas: 1 GB, 2 MB, or 4 kB when huge pages were unavailable
+	bool		transparentHugePages;	// Arenas fell back to transparent huge pages
+	int			numaNode;
+	bool		numaBound;				// Every arena was placed on numaNode
+	uint64_t	heapAllocations;		// Buffers that did not fit the pool
+};
+
+// An IDeckLinkMemoryAllocator for SetVideoInputFrameMemoryAllocator() and
+// SetVideoOutputFrameMemoryAllocator() that places frame buffers in huge pages on the
+// NUMA node of the DeckLink device. At 4K a frame spans thousands of 4 kB pages, so
+// huge pages save the CPU many TLB misses when converting or writing out each frame,
+// and memory local to the card's socket keeps its DMA off the inter-socket link.
+//
+// Buffers are carved from arenas of several buffers, mapped with MAP_HUGETLB using 1 GB
+// pages, then 2 MB pages. If no huge pages are reserved (/proc/sys/vm/nr_hugepages) the
+// arena is mapped with ordinary pages and madvise(MADV_HUGEPAGE) is used instead. Each
+// arena is bound to the node with mbind(MPOL_PREFERRED) and faulted in up front, so
+// the pages are placed before the card starts streaming.
+//
+// Released buffers go on a lock-free free list; AllocateBuffer() and ReleaseBuffer()
+// only take a lock when a new arena is mapped or for buffers served from the heap. The
+// pool serves one buffer size, set by the first allocation; larger requests and any
+// beyond maximumBuffers are served from the heap.
+class HugePageMemoryAllocator : public IDeckLinkMemoryAllocator
+{
+public:
+	HugePageMemoryAllocator(const HugePageAllocatorSettings& settings = HugePageAllocatorSettings());
+
+	void		GetStatistics(HugePageAllocatorStatistics* statistics);
+
+	// IDeckLinkMemoryAllocator interface
+	virtual HRESULT		STDMETHODCALLTYPE	AllocateBuffer(uint32_t bufferSize, void** allocatedBuffer);
+	virtual HRESULT		STDMETHODCALLTYPE	ReleaseBuffer(void* buffer);
+	virtual HRESULT		STDMETHODCALLTYPE	Commit(void);
+	virtual HRESULT		STDMETHODCALLTYPE	Decommit(void);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~HugePageMemoryAllocator();
+
+	struct Slot
+	{
+		void*					buffer;
+		std::atomic<uint32_t>	next;
+	};
+
+	struct Arena
+	{
+		uint8_t*	base;
+		size_t		mappedSize;
+		uint32_t	firstSlot;
+		uint32_t	slotCount;
+	};
+
+	void		pushFreeSlot(uint32_t slot);
+	uint32_t	popFreeSlot(void);
+	int			findSlot(void* buffer);
+	bool		addArena(void);
+	void		unmapArenas(void);
+	void*		allocateFromHeap(uint32_t bufferSize);
+
+	int32_t							m_refCount;
+	HugePageAllocatorSettings		m_settings;
+
+	// Arenas and slots are only appended, under m_mutex, and published through the counts
+	std::unique_ptr<Slot[]>			m_slots;
+	std::unique_ptr<Arena[]>		m_arenas;
+	std::atomic<uint32_t>			m_slotCount;
+	std::atomic<uint32_t>			m_arenaCount;
+	std::atomic<uint64_t>			m_freeHead;			// Tag in the upper half, slot in the lower half
+	std::atomic<size_t>				m_slotSize;			// Buffer size served by the pool, 0 until the first allocation
+	std::atomic<unsigned>			m_outstanding;
+	std::atomic<unsigned>			m_peakOutstanding;
+
+	std::mutex						m_mutex;
+	std::map<void*, size_t>			m_heapBuffers;
+	uint64_t						m_heapAllocations;
+	size_t							m_pageSize;
+	bool							m_transparentHugePages;
+	bool							m_numaBound;
+};
+
+// NUMA node of the PCIe slot a DeckLink device sits in, found from its
+// BMDDeckLinkDeviceHandle through sysfs. Returns -1 when the node is unknown, including
+// on single node machines.
+int		GetDeckLinkNumaNode(IDeckLink* deckLink);
@@ -0,0 +1,150 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <algorithm>
+#include <math.h>
+#include "LatencyHistogram.h"
+
+// 2^11 exact values, then 2^10 buckets for each power of two from 2^11 up to 2^40
+static const unsigned	kExactBits = 11;
+static const unsigned	kSubBucketBits = 10;
+static const unsigned	kMaximumBits = 40;
+static const size_t		kBucketCount = ((size_t)1 << kExactBits) + (size_t)(kMaximumBits - kExactBits) * ((size_t)1 << kSubBucketBits);
+static const uint64_t	kMaximumValue = ((uint64_t)1 << kMaximumBits) - 1;
+
+LatencyHistogram::LatencyHistogram() :
+	m_counts(kBucketCount, 0),
+	m_count(0),
+	m_minimum(0),
+	m_maximum(0),
+	m_sum(0.0)
+{
+}
+
+void LatencyHistogram::Record(int64_t value)
+{
+	uint64_t clamped = (value > 0) ? std::min((uint64_t)value, kMaximumValue) : 0;
+
+	m_counts[bucketIndex(clamped)]++;
+
+	if ((m_count == 0) || ((int64_t)clamped < m_minimum))
+		m_minimum = (int64_t)clamped;
+	if ((int64_t)clamped > m_maximum)
+		m_maximum = (int64_t)clamped;
+
+	m_count++;
+	m_sum += (double)clamped;
+}
+
+void LatencyHistogram::Add(const LatencyHistogram& other)
+{
+	if (other.m_count == 0)
+		return;
+
+	for (size_t i = 0; i < kBucketCount; i++)
+		m_counts[i] += other.m_counts[i];
+
+	m_minimum = (m_count != 0) ? std::min(m_minimum, other.m_minimum) : other.m_minimum;
+	m_maximum = std::max(m_maximum, other.m_maximum);
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+}
+
+void LatencyHistogram::Reset(void)
+{
+	std::fill(m_counts.begin(), m_counts.end(), 0);
+	m_count = 0;
+	m_minimum = 0;
+	m_maximum = 0;
+	m_sum = 0.0;
+}
+
+double LatencyHistogram::GetMean(void) const
+{
+	return (m_count != 0) ? (m_sum / (double)m_count) : 0.0;
+}
+
+int64_t LatencyHistogram::GetValueAtPercentile(double percentile) const
+{
+	uint64_t	target;
+	uint64_t	seen = 0;
+
+	if (m_count == 0)
+		return 0;
+
+	percentile = std::min(std::max(percentile, 0.0), 100.0);
+	target = std::max((uint64_t)ceil((percentile / 100.0) * (double)m_count), (uint64_t)1);
+
+	for (size_t i = 0; i < kBucketCount; i++)
+	{
+		seen += m_counts[i];
+		if (seen >= target)
+			return std::min(highestEquivalentValue(i), m_maximum);
+	}
+
+	return m_maximum;
+}
+
+void LatencyHistogram::WriteJSON(FILE* file) const
+{
+	fprintf(file, "{\"count\":%llu,\"min\":%lld,\"mean\":%.1f,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p99.9\":%lld,\"max\":%lld}",
+			(unsigned long long)m_count, (long long)GetMinimum(), GetMean(),
+			(long long)GetValueAtPercentile(50.0), (long long)GetValueAtPercentile(90.0),
+			(long long)GetValueAtPercentile(99.0), (long long)GetValueAtPercentile(99.9),
+			(long long)m_maximum);
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+	unsigned	exponent;
+
+	if (value < ((uint64_t)1 << kExactBits))
+		return (size_t)value;
+
+	// Position of the top bit, at least kExactBits
+	exponent = 63 - __builtin_clzll(value);
+
+	return ((size_t)1 << kExactBits)
+		+ (size_t)(exponent - kExactBits) * ((size_t)1 << kSubBucketBits)
+		+ (size_t)((value >> (exponent - kSubBucketBits)) - ((uint64_t)1 << kSubBucketBits));
+}
+
+int64_t LatencyHistogram::highestEquivalentValue(size_t index)
+{
+	size_t		offset;
+	unsigned	exponent;
+	uint64_t	mantissa;
+
+	if (index < ((size_t)1 << kExactBits))
+		return (int64_t)index;
+
+	offset = index - ((size_t)1 << kExactBits);
+	exponent = kExactBits + (unsigned)(offset >> kSubBucketBits);
+	mantissa = ((uint64_t)1 << kSubBucketBits) + (offset & (((size_t)1 << kSubBucketBits) - 1));
+
+	return (int64_t)(((mantissa + 1) << (exponent - kSubBucketBits)) - 1);
+}
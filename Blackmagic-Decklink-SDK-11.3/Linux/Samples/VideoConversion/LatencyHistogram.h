@@ -0,0 +1,70 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Log-linear histogram of non-negative 64-bit values, in the manner of HdrHistogram.
+// Values below 2048 are counted exactly; above that each power of two is split into
+// 1024 buckets, so any reported value is within 0.1% of the recorded one. Values up
+// to 2^40 (about 18 minutes in nanoseconds) are tracked; larger values are clamped.
+//
+// Recording is a couple of shifts and an increment with no allocation, but is not
+// thread safe. Keep one histogram per thread and Add() them together to report.
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void		Record(int64_t value);
+	void		Add(const LatencyHistogram& other);
+	void		Reset(void);
+
+	uint64_t	GetCount(void) const		{ return m_count; }
+	int64_t		GetMinimum(void) const		{ return (m_count != 0) ? m_minimum : 0; }
+	int64_t		GetMaximum(void) const		{ return m_maximum; }
+	double		GetMean(void) const;
+
+	// Highest value equivalent to the value at the given percentile (0 - 100)
+	int64_t		GetValueAtPercentile(double percentile) const;
+
+	// Writes {"count":..,"min":..,"mean":..,"p50":..,"p90":..,"p99":..,"p99.9":..,"max":..}
+	void		WriteJSON(FILE* file) const;
+
+private:
+	static size_t	bucketIndex(uint64_t value);
+	static int64_t	highestEquivalentValue(size_t index);
+
+	std::vector<uint64_t>	m_counts;
+	uint64_t				m_count;
+	int64_t					m_minimum;
+	int64_t					m_maximum;
+	double					m_sum;
+};
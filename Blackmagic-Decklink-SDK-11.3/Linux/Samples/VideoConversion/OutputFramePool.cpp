@@ -0,0 +1,254 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <algorithm>
+#include "OutputFramePool.h"
+
+OutputFramePool::OutputFramePool(IDeckLinkOutput* deckLinkOutput) :
+	m_deckLinkOutput(deckLinkOutput),
+	m_renderingFrames(0),
+	m_queuedFrames(0),
+	m_minFreeFrames(0),
+	m_maxQueuedFrames(0),
+	m_framesAcquired(0),
+	m_contentReused(0),
+	m_acquireFailures(0)
+{
+	m_deckLinkOutput->AddRef();
+}
+
+OutputFramePool::~OutputFramePool()
+{
+	Clear();
+	m_deckLinkOutput->Release();
+}
+
+HRESULT OutputFramePool::Allocate(unsigned frameCount, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags)
+{
+	IDeckLinkOutput* deckLinkOutput = m_deckLinkOutput;
+
+	return Allocate(frameCount, [=](IDeckLinkMutableVideoFrame** frame) {
+		return deckLinkOutput->CreateVideoFrame((int32_t)width, (int32_t)height, (int32_t)rowBytes, pixelFormat, flags, frame);
+	});
+}
+
+HRESULT OutputFramePool::Allocate(unsigned frameCount, const OutputFrameFactory& factory)
+{
+	std::vector<Slot>	slots;
+	HRESULT				result = S_OK;
+
+	// Create the frames before touching the current set, so a failure leaves the pool unchanged
+	for (unsigned i = 0; i < frameCount; i++)
+	{
+		Slot slot = { NULL, kFrameFree, kOutputFrameContentUnknown };
+
+		result = factory(&slot.frame);
+		if (result != S_OK)
+			goto bail;
+
+		slots.push_back(slot);
+	}
+
+	Clear();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_slots.swap(slots);
+		for (unsigned i = 0; i < frameCount; i++)
+			m_freeSlots.push_back(frameCount - 1 - i);
+
+		m_minFreeFrames = frameCount;
+		m_maxQueuedFrames = 0;
+	}
+
+bail:
+	for (Slot& slot : slots)
+		slot.frame->Release();
+
+	return result;
+}
+
+void OutputFramePool::Clear(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (Slot& slot : m_slots)
+		slot.frame->Release();
+
+	m_slots.clear();
+	m_freeSlots.clear();
+	m_renderingFrames = 0;
+	m_queuedFrames = 0;
+}
+
+HRESULT OutputFramePool::AcquireFrame(int64_t preferredContent, IDeckLinkMutableVideoFrame** frame, int64_t* content)
+{
+	std::lock_guard<std::mutex>	lock(m_mutex);
+	size_t						position;
+
+	*frame = NULL;
+
+	if (m_freeSlots.empty())
+	{
+		m_acquireFailures++;
+		return E_OUTOFMEMORY;
+	}
+
+	// Take the most recently freed frame, whose memory is most likely still in cache,
+	// unless a less recent one already holds the content wanted
+	position = m_freeSlots.size() - 1;
+	if (preferredContent != kOutputFrameContentUnknown)
+	{
+		for (size_t i = m_freeSlots.size(); i-- > 0; )
+		{
+			if (m_slots[m_freeSlots[i]].content == preferredContent)
+			{
+				position = i;
+				m_contentReused++;
+				break;
+			}
+		}
+	}
+
+	Slot& slot = m_slots[m_freeSlots[position]];
+	m_freeSlots.erase(m_freeSlots.begin() + position);
+	setStateLocked(slot, kFrameRendering);
+	m_framesAcquired++;
+
+	*frame = slot.frame;
+	if (content != NULL)
+		*content = slot.content;
+
+	return S_OK;
+}
+
+HRESULT OutputFramePool::ScheduleFrame(IDeckLinkMutableVideoFrame* frame, int64_t content, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale)
+{
+	HRESULT		result;
+	int			index;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		index = findSlotLocked(frame);
+		if ((index < 0) || (m_slots[index].state != kFrameRendering))
+			return E_INVALIDARG;
+
+		// Mark the frame queued first, as the completion may arrive before ScheduleVideoFrame returns
+		m_slots[index].content = content;
+		setStateLocked(m_slots[index], kFrameQueued);
+	}
+
+	// The device may call back into FrameCompleted(), so do not hold the lock here
+	result = m_deckLinkOutput->ScheduleVideoFrame(frame, displayTime, displayDuration, timeScale);
+	if (result != S_OK)
+		FrameCompleted(frame);
+
+	return result;
+}
+
+void OutputFramePool::ReleaseFrame(IDeckLinkMutableVideoFrame* frame, int64_t content)
+{
+	std::lock_guard<std::mutex>	lock(m_mutex);
+	int							index = findSlotLocked(frame);
+
+	if ((index < 0) || (m_slots[index].state != kFrameRendering))
+		return;
+
+	m_slots[index].content = content;
+	setStateLocked(m_slots[index], kFrameFree);
+	m_freeSlots.push_back((unsigned)index);
+}
+
+bool OutputFramePool::FrameCompleted(IDeckLinkVideoFrame* completedFrame)
+{
+	std::lock_guard<std::mutex>	lock(m_mutex);
+	int							index = findSlotLocked(completedFrame);
+
+	if ((index < 0) || (m_slots[index].state != kFrameQueued))
+		return false;
+
+	setStateLocked(m_slots[index], kFrameFree);
+	m_freeSlots.push_back((unsigned)index);
+	return true;
+}
+
+void OutputFramePool::GetStatistics(OutputFramePoolStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	statistics->frameCount = (unsigned)m_slots.size();
+	statistics->freeFrames = (unsigned)m_freeSlots.size();
+	statistics->renderingFrames = m_renderingFrames;
+	statistics->queuedFrames = m_queuedFrames;
+	statistics->minFreeFrames = m_minFreeFrames;
+	statistics->maxQueuedFrames = m_maxQueuedFrames;
+	statistics->framesAcquired = m_framesAcquired;
+	statistics->contentReused = m_contentReused;
+	statistics->acquireFailures = m_acquireFailures;
+}
+
+void OutputFramePool::ResetWatermarks(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_minFreeFrames = (unsigned)m_freeSlots.size();
+	m_maxQueuedFrames = m_queuedFrames;
+}
+
+int OutputFramePool::findSlotLocked(IDeckLinkVideoFrame* frame)
+{
+	// Pools are a few dozen frames at most, so a scan is cheaper than a map.
+	// IDeckLinkMutableVideoFrame derives singly from IDeckLinkVideoFrame, so the
+	// completed frame pointer is the one that was scheduled.
+	for (size_t i = 0; i < m_slots.size(); i++)
+	{
+		if (static_cast<IDeckLinkVideoFrame*>(m_slots[i].frame) == frame)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+void OutputFramePool::setStateLocked(Slot& slot, FrameState state)
+{
+	if (slot.state == kFrameRendering)
+		m_renderingFrames--;
+	else if (slot.state == kFrameQueued)
+		m_queuedFrames--;
+
+	slot.state = state;
+
+	if (state == kFrameRendering)
+		m_renderingFrames++;
+	else if (state == kFrameQueued)
+		m_queuedFrames++;
+
+	m_minFreeFrames = std::min(m_minFreeFrames, (unsigned)(m_slots.size() - m_renderingFrames - m_queuedFrames));
+	m_maxQueuedFrames = std::max(m_maxQueuedFrames, m_queuedFrames);
+}
@@ -0,0 +1,129 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Creates one frame for the pool. Use this form of OutputFramePool::Allocate() for frames
+// that are not plain IDeckLinkOutput::CreateVideoFrame() calls, for example frames wrapping
+// application memory. Frames created with CreateVideoFrame() after
+// IDeckLinkOutput::SetVideoOutputFrameMemoryAllocator() use that allocator's buffers.
+typedef std::function<HRESULT(IDeckLinkMutableVideoFrame** frame)> OutputFrameFactory;
+
+// A content tag the application has never set, so the frame must be fully rendered
+const int64_t kOutputFrameContentUnknown = -1;
+
+struct OutputFramePoolStatistics
+{
+	unsigned	frameCount;
+	unsigned	freeFrames;
+	unsigned	renderingFrames;
+	unsigned	queuedFrames;
+	unsigned	minFreeFrames;			// Low watermark since the last ResetWatermarks()
+	unsigned	maxQueuedFrames;		// High watermark since the last ResetWatermarks()
+	uint64_t	framesAcquired;
+	uint64_t	contentReused;			// Acquired frames that already held the requested content
+	uint64_t	acquireFailures;		// AcquireFrame() calls made while no frame was free
+};
+
+// A fixed set of output frames, each of which is free, being rendered by the application,
+// or queued on the device. A free frame is taken with AcquireFrame(), drawn into, and
+// passed to ScheduleFrame(); the frame comes back to the pool when the application hands
+// the completed frame to FrameCompleted() from IDeckLinkVideoOutputCallback::
+// ScheduledFrameCompleted(). A frame is therefore never written while the device may
+// still be reading it, and no frames are allocated once playback has started.
+//
+// Each frame carries an application-defined content tag recording what was last drawn
+// into it, so static content (black, bars) need only be drawn when a frame changes role.
+// The pool keeps ownership of its frames: the pointer returned by AcquireFrame() is
+// valid until the frame is passed back with ScheduleFrame() or ReleaseFrame().
+class OutputFramePool
+{
+public:
+	OutputFramePool(IDeckLinkOutput* deckLinkOutput);
+	~OutputFramePool();
+
+	HRESULT		Allocate(unsigned frameCount, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags);
+	HRESULT		Allocate(unsigned frameCount, const OutputFrameFactory& factory);
+
+	// Drops the pool's frames. Frames still queued on the device are released by the
+	// device when they complete; their completions are then ignored by FrameCompleted().
+	void		Clear(void);
+
+	// Takes a free frame, preferring one whose content tag matches preferredContent.
+	// Returns E_OUTOFMEMORY when every frame is rendering or queued.
+	HRESULT		AcquireFrame(int64_t preferredContent, IDeckLinkMutableVideoFrame** frame, int64_t* content);
+
+	// Schedules a frame taken with AcquireFrame() and records its new content tag. On
+	// failure the frame is returned to the free list.
+	HRESULT		ScheduleFrame(IDeckLinkMutableVideoFrame* frame, int64_t content, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale);
+
+	// Returns a frame taken with AcquireFrame() without scheduling it
+	void		ReleaseFrame(IDeckLinkMutableVideoFrame* frame, int64_t content);
+
+	// Returns a completed (or flushed) frame to the free list. Returns false when the frame
+	// does not belong to this pool.
+	bool		FrameCompleted(IDeckLinkVideoFrame* completedFrame);
+
+	void		GetStatistics(OutputFramePoolStatistics* statistics);
+	void		ResetWatermarks(void);
+
+private:
+	enum FrameState
+	{
+		kFrameFree,
+		kFrameRendering,
+		kFrameQueued
+	};
+
+	struct Slot
+	{
+		IDeckLinkMutableVideoFrame*	frame;
+		FrameState					state;
+		int64_t						content;
+	};
+
+	int			findSlotLocked(IDeckLinkVideoFrame* frame);
+	void		setStateLocked(Slot& slot, FrameState state);
+
+	IDeckLinkOutput*				m_deckLinkOutput;
+	std::mutex						m_mutex;
+	std::vector<Slot>				m_slots;
+	std::vector<unsigned>			m_freeSlots;
+	unsigned						m_renderingFrames;
+	unsigned						m_queuedFrames;
+	unsigned						m_minFreeFrames;
+	unsigned						m_maxQueuedFrames;
+	uint64_t						m_framesAcquired;
+	uint64_t						m_contentReused;
+	uint64_t						m_acquireFailures;
+};
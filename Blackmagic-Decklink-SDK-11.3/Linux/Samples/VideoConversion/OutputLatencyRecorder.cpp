@@ -0,0 +1,268 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <iterator>
+#include "OutputLatencyRecorder.h"
+
+static const BMDTimeScale kNanosecondTimeScale = 1000000000;
+
+static const char* GetCompletionResultName(BMDOutputFrameCompletionResult result)
+{
+	switch (result)
+	{
+		case bmdOutputFrameCompleted:		return "completed";
+		case bmdOutputFrameDisplayedLate:	return "late";
+		case bmdOutputFrameDropped:			return "dropped";
+		case bmdOutputFrameFlushed:			return "flushed";
+	}
+	return "unknown";
+}
+
+OutputLatencyRecorder::OutputLatencyRecorder(IDeckLinkOutput* deckLinkOutput, size_t maximumRecords) :
+	m_deckLinkOutput(deckLinkOutput),
+	m_maximumRecords(maximumRecords)
+{
+	m_deckLinkOutput->AddRef();
+	m_records.reserve(m_maximumRecords);
+	Reset();
+}
+
+OutputLatencyRecorder::~OutputLatencyRecorder()
+{
+	m_deckLinkOutput->Release();
+}
+
+HRESULT OutputLatencyRecorder::ScheduleVideoFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale)
+{
+	PendingFrame	pending;
+	HRESULT			result;
+
+	memset(&pending, 0, sizeof(pending));
+	pending.frame = frame;
+	pending.record.displayTime = displayTime;
+	pending.record.timeScale = timeScale;
+	pending.duration = (timeScale != 0) ? (int64_t)((displayDuration * kNanosecondTimeScale) / timeScale) : 0;
+	pending.record.scheduledTime = getHardwareTime();
+
+	{
+		// Queue the record first, as the completion may arrive before ScheduleVideoFrame returns
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		pending.record.frameNumber = m_nextFrameNumber++;
+		m_pending.push_back(pending);
+	}
+
+	result = m_deckLinkOutput->ScheduleVideoFrame(frame, displayTime, displayDuration, timeScale);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (result == S_OK)
+	{
+		m_summary.framesScheduled++;
+	}
+	else
+	{
+		for (auto iter = m_pending.rbegin(); iter != m_pending.rend(); ++iter)
+		{
+			if (iter->record.frameNumber == pending.record.frameNumber)
+			{
+				m_pending.erase(std::next(iter).base());
+				break;
+			}
+		}
+	}
+
+	return result;
+}
+
+void OutputLatencyRecorder::FrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result)
+{
+	int64_t			callbackTime = getHardwareTime();
+	BMDTimeValue	completionTime = 0;
+
+	// Ask for the timestamp before taking the lock, as the driver takes its own
+	if (m_deckLinkOutput->GetFrameCompletionReferenceTimestamp(completedFrame, kNanosecondTimeScale, &completionTime) != S_OK)
+		completionTime = 0;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Completions arrive in schedule order, so this is nearly always the first pending frame
+	auto iter = m_pending.begin();
+	while ((iter != m_pending.end()) && (iter->frame != completedFrame))
+		++iter;
+
+	if (iter == m_pending.end())
+		return;
+
+	OutputLatencyRecord record = iter->record;
+	int64_t duration = iter->duration;
+	m_pending.erase(iter);
+
+	record.completionTime = completionTime;
+	record.callbackTime = callbackTime;
+	record.result = result;
+
+	m_summary.framesCompleted++;
+
+	switch (result)
+	{
+		case bmdOutputFrameDisplayedLate:	m_summary.framesLate++;		break;
+		case bmdOutputFrameDropped:			m_summary.framesDropped++;	break;
+		case bmdOutputFrameFlushed:			m_summary.framesFlushed++;	break;
+		default:														break;
+	}
+
+	if (result != bmdOutputFrameFlushed)
+	{
+		if (completionTime != 0)
+		{
+			record.scheduleToAir = (completionTime - duration) - record.scheduledTime;
+			if (record.scheduleToAir < 0)
+				m_summary.negativeScheduleToAir++;
+			else
+				m_scheduleToAir.Record(record.scheduleToAir);
+			m_callbackDelay.Record(callbackTime - completionTime);
+		}
+
+		if (m_lastCallbackTime != 0)
+		{
+			int64_t deviation = (callbackTime - m_lastCallbackTime) - duration;
+			m_callbackJitter.Record((deviation < 0) ? -deviation : deviation);
+		}
+		m_lastCallbackTime = callbackTime;
+	}
+
+	if (m_records.size() < m_maximumRecords)
+		m_records.push_back(record);
+	else
+		m_summary.recordsDiscarded++;
+}
+
+void OutputLatencyRecorder::Reset(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_pending.clear();
+	m_records.clear();
+	memset(&m_summary, 0, sizeof(m_summary));
+	m_nextFrameNumber = 0;
+	m_lastCallbackTime = 0;
+	m_scheduleToAir.Reset();
+	m_callbackDelay.Reset();
+	m_callbackJitter.Reset();
+}
+
+void OutputLatencyRecorder::GetSummary(OutputLatencySummary* summary)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	*summary = m_summary;
+}
+
+void OutputLatencyRecorder::GetHistograms(LatencyHistogram* scheduleToAir, LatencyHistogram* callbackDelay, LatencyHistogram* callbackJitter)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (scheduleToAir != NULL)
+		*scheduleToAir = m_scheduleToAir;
+	if (callbackDelay != NULL)
+		*callbackDelay = m_callbackDelay;
+	if (callbackJitter != NULL)
+		*callbackJitter = m_callbackJitter;
+}
+
+HRESULT OutputLatencyRecorder::WriteJSON(const char* path)
+{
+	FILE*	file = fopen(path, "w");
+
+	if (file == NULL)
+		return E_FAIL;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"frames_scheduled\": %llu,\n", (unsigned long long)m_summary.framesScheduled);
+	fprintf(file, "  \"frames_completed\": %llu,\n", (unsigned long long)m_summary.framesCompleted);
+	fprintf(file, "  \"frames_late\": %llu,\n", (unsigned long long)m_summary.framesLate);
+	fprintf(file, "  \"frames_dropped\": %llu,\n", (unsigned long long)m_summary.framesDropped);
+	fprintf(file, "  \"frames_flushed\": %llu,\n", (unsigned long long)m_summary.framesFlushed);
+	fprintf(file, "  \"negative_schedule_to_air\": %llu,\n", (unsigned long long)m_summary.negativeScheduleToAir);
+	fprintf(file, "  \"schedule_to_air_ns\": ");
+	m_scheduleToAir.WriteJSON(file);
+	fprintf(file, ",\n  \"callback_delay_ns\": ");
+	m_callbackDelay.WriteJSON(file);
+	fprintf(file, ",\n  \"callback_jitter_ns\": ");
+	m_callbackJitter.WriteJSON(file);
+	fprintf(file, "\n}\n");
+
+	fclose(file);
+	return S_OK;
+}
+
+HRESULT OutputLatencyRecorder::WriteCSV(const char* path)
+{
+	FILE*	file = fopen(path, "w");
+
+	if (file == NULL)
+		return E_FAIL;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	fprintf(file, "frame,display_time,time_scale,scheduled_ns,completion_ns,callback_ns,schedule_to_air_ns,result\n");
+	for (const OutputLatencyRecord& record : m_records)
+	{
+		fprintf(file, "%llu,%lld,%lld,%lld,%lld,%lld,%lld,%s\n",
+				(unsigned long long)record.frameNumber, (long long)record.displayTime, (long long)record.timeScale,
+				(long long)record.scheduledTime, (long long)record.completionTime, (long long)record.callbackTime,
+				(long long)record.scheduleToAir, GetCompletionResultName(record.result));
+	}
+
+	fclose(file);
+	return S_OK;
+}
+
+HRESULT OutputLatencyRecorder::Write(const char* path)
+{
+	size_t length = strlen(path);
+
+	if ((length >= 5) && (strcmp(path + length - 5, ".json") == 0))
+		return WriteJSON(path);
+
+	return WriteCSV(path);
+}
+
+int64_t OutputLatencyRecorder::getHardwareTime(void)
+{
+	BMDTimeValue hardwareTime = 0;
+
+	if (m_deckLinkOutput->GetHardwareReferenceClock(kNanosecondTimeScale, &hardwareTime, NULL, NULL) != S_OK)
+		return 0;
+
+	return hardwareTime;
+}
@@ -0,0 +1,122 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "LatencyHistogram.h"
+
+// One scheduled frame. Times are in nanoseconds of the device's hardware reference clock.
+struct OutputLatencyRecord
+{
+	uint64_t						frameNumber;
+	BMDTimeValue					displayTime;		// Stream time the frame was scheduled for
+	BMDTimeScale					timeScale;
+	int64_t							scheduledTime;		// Clock when ScheduleVideoFrame() was called
+	int64_t							completionTime;		// GetFrameCompletionReferenceTimestamp(), 0 if unavailable
+	int64_t							callbackTime;		// Clock when ScheduledFrameCompleted() was entered
+	int64_t							scheduleToAir;		// Start of display (completion less duration) less scheduledTime
+	BMDOutputFrameCompletionResult	result;
+};
+
+struct OutputLatencySummary
+{
+	uint64_t	framesScheduled;
+	uint64_t	framesCompleted;
+	uint64_t	framesLate;
+	uint64_t	framesDropped;
+	uint64_t	framesFlushed;
+	uint64_t	recordsDiscarded;		// Per-frame records beyond the record limit
+	uint64_t	negativeScheduleToAir;	// Frames whose display began before they were scheduled
+};
+
+// Instruments scheduled playback. The application schedules frames through
+// ScheduleVideoFrame() and calls FrameCompleted() from ScheduledFrameCompleted(); each
+// frame's schedule time, hardware completion timestamp and completion result are kept.
+//
+// Three distributions are built, all in nanoseconds:
+//  - schedule to air: from ScheduleVideoFrame() to the start of the frame's display,
+//    which is the completion timestamp less the frame's duration
+//  - callback delay: from the hardware completion to ScheduledFrameCompleted()
+//  - callback jitter: how far the interval between consecutive completion callbacks
+//    strays from the frame duration
+// Flushed frames were never displayed and are left out of the distributions. A negative
+// schedule to air time, from a frame scheduled after its display time had passed, is
+// counted on its own rather than recorded, as the histogram cannot hold it.
+//
+// Completions are matched to schedules in order, so the same frame object may be
+// scheduled many times over. Room for maximumRecords records is reserved up front, so
+// FrameCompleted() does not allocate.
+class OutputLatencyRecorder
+{
+public:
+	OutputLatencyRecorder(IDeckLinkOutput* deckLinkOutput, size_t maximumRecords = 216000);
+	~OutputLatencyRecorder();
+
+	HRESULT		ScheduleVideoFrame(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale);
+	void		FrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result);
+
+	// Starts a new run, for example when playback is restarted
+	void		Reset(void);
+
+	void		GetSummary(OutputLatencySummary* summary);
+	void		GetHistograms(LatencyHistogram* scheduleToAir, LatencyHistogram* callbackDelay, LatencyHistogram* callbackJitter);
+
+	// JSON holds the summary and percentiles of each distribution; CSV holds one line per frame
+	HRESULT		WriteJSON(const char* path);
+	HRESULT		WriteCSV(const char* path);
+	// Writes JSON when the path ends in ".json", otherwise CSV
+	HRESULT		Write(const char* path);
+
+private:
+	struct PendingFrame
+	{
+		IDeckLinkVideoFrame*	frame;
+		OutputLatencyRecord		record;
+		int64_t					duration;
+	};
+
+	int64_t		getHardwareTime(void);
+
+	IDeckLinkOutput*				m_deckLinkOutput;
+	size_t							m_maximumRecords;
+
+	std::mutex						m_mutex;
+	std::deque<PendingFrame>		m_pending;
+	std::vector<OutputLatencyRecord>	m_records;
+	OutputLatencySummary			m_summary;
+	uint64_t						m_nextFrameNumber;
+	int64_t							m_lastCallbackTime;
+
+	LatencyHistogram				m_scheduleToAir;
+	LatencyHistogram				m_callbackDelay;
+	LatencyHistogram				m_callbackJitter;
+};
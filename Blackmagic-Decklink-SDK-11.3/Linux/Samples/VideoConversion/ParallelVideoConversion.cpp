@@ -0,0 +1,196 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "ParallelVideoConversion.h"
+#include "FastVideoConversion.h"
+#include "V210Conversion.h"
+
+// Below this many rows per band the cost of waking a worker outweighs the work
+static const long kMinimumRowsPerBand = 16;
+
+ParallelVideoConversion::ParallelVideoConversion(unsigned threadCount) :
+	m_refCount(1),
+	m_workerPool(threadCount),
+	m_fallbackConversion(CreateFastVideoConversionInstance()),
+	m_reportTiming(getenv("DECKLINK_CONVERSION_TIMING") != NULL)
+{
+	ResetStatistics();
+}
+
+ParallelVideoConversion::~ParallelVideoConversion()
+{
+	if (m_fallbackConversion != NULL)
+	{
+		m_fallbackConversion->Release();
+		m_fallbackConversion = NULL;
+	}
+}
+
+void ParallelVideoConversion::GetStatistics(ParallelConversionStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_statisticsMutex);
+	*statistics = m_statistics;
+}
+
+void ParallelVideoConversion::ResetStatistics(void)
+{
+	std::lock_guard<std::mutex> lock(m_statisticsMutex);
+
+	memset(&m_statistics, 0, sizeof(m_statistics));
+	m_statistics.threadCount = m_workerPool.GetThreadCount();
+	m_totalFrameTime = 0.0;
+}
+
+void ParallelVideoConversion::recordFrameTime(double frameTime)
+{
+	std::lock_guard<std::mutex> lock(m_statisticsMutex);
+
+	if ((m_statistics.frameCount == 0) || (frameTime < m_statistics.minFrameTime))
+		m_statistics.minFrameTime = frameTime;
+
+	if (frameTime > m_statistics.maxFrameTime)
+		m_statistics.maxFrameTime = frameTime;
+
+	m_statistics.frameCount++;
+	m_statistics.lastFrameTime = frameTime;
+	m_totalFrameTime += frameTime;
+	m_statistics.meanFrameTime = m_totalFrameTime / m_statistics.frameCount;
+}
+
+HRESULT ParallelVideoConversion::convertBands(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame)
+{
+	void*						srcBytes;
+	void*						dstBytes;
+	long						height = srcFrame->GetHeight();
+	unsigned					bandCount;
+	VideoConversionColorspace	colorspace;
+
+	if ((srcFrame->GetWidth() != dstFrame->GetWidth()) || (height != dstFrame->GetHeight()))
+		return E_INVALIDARG;
+
+	if ((srcFrame->GetBytes(&srcBytes) != S_OK) || (dstFrame->GetBytes(&dstBytes) != S_OK))
+		return E_FAIL;
+
+	bandCount = (unsigned)std::max(1L, std::min((long)m_workerPool.GetThreadCount(), height / kMinimumRowsPerBand));
+	colorspace = GetColorspaceForFrameHeight(height);
+
+	std::vector<HRESULT> bandResults(bandCount, S_OK);
+
+	m_workerPool.Run(bandCount, [&](unsigned band) {
+		long firstRow = height * band / bandCount;
+		long lastRow = height * (band + 1) / bandCount;
+
+		bandResults[band] = ConvertPixelRows(srcFrame->GetPixelFormat(), (uint8_t*)srcBytes + firstRow * srcFrame->GetRowBytes(), srcFrame->GetRowBytes(),
+											 dstFrame->GetPixelFormat(), (uint8_t*)dstBytes + firstRow * dstFrame->GetRowBytes(), dstFrame->GetRowBytes(),
+											 srcFrame->GetWidth(), lastRow - firstRow, colorspace);
+	});
+
+	for (HRESULT bandResult : bandResults)
+	{
+		if (bandResult != S_OK)
+			return bandResult;
+	}
+
+	return S_OK;
+}
+
+HRESULT ParallelVideoConversion::ConvertFrame(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame)
+{
+	HRESULT									result;
+	std::chrono::steady_clock::time_point	startTime;
+	double									frameTime;
+
+	if ((srcFrame == NULL) || (dstFrame == NULL))
+		return E_INVALIDARG;
+
+	startTime = std::chrono::steady_clock::now();
+
+	if (IsPixelRowConversionSupported(srcFrame->GetPixelFormat(), dstFrame->GetPixelFormat()))
+		result = convertBands(srcFrame, dstFrame);
+	else if (m_fallbackConversion != NULL)
+		result = m_fallbackConversion->ConvertFrame(srcFrame, dstFrame);
+	else
+		result = E_NOTIMPL;
+
+	if (result != S_OK)
+		return result;
+
+	frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	recordFrameTime(frameTime);
+
+	if (m_reportTiming)
+	{
+		fprintf(stderr, "Converted %li x %li frame in %.3f ms on %u threads\n",
+				srcFrame->GetWidth(), srcFrame->GetHeight(), frameTime, m_workerPool.GetThreadCount());
+	}
+
+	return S_OK;
+}
+
+HRESULT ParallelVideoConversion::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	CFUUIDBytes		iunknown = CFUUIDGetUUIDBytes(IUnknownUUID);
+
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+
+	if ((memcmp(&iid, &iunknown, sizeof(REFIID)) == 0) ||
+		(memcmp(&iid, &IID_IDeckLinkVideoConversion, sizeof(REFIID)) == 0))
+	{
+		*ppv = (IDeckLinkVideoConversion*)this;
+		AddRef();
+		return S_OK;
+	}
+
+	return E_NOINTERFACE;
+}
+
+ULONG ParallelVideoConversion::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG ParallelVideoConversion::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+	return newRefValue;
+}
+
+ParallelVideoConversion* CreateParallelVideoConversionInstance(unsigned threadCount)
+{
+	return new ParallelVideoConversion(threadCount);
+}
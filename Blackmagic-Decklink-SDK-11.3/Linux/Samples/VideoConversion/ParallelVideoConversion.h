@@ -0,0 +1,87 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include "DeckLinkAPI.h"
+#include "ConversionWorkerPool.h"
+
+// Wall clock time taken by ConvertFrame, in milliseconds
+struct ParallelConversionStatistics
+{
+	unsigned	threadCount;
+	uint64_t	frameCount;
+	double		lastFrameTime;
+	double		minFrameTime;
+	double		maxFrameTime;
+	double		meanFrameTime;
+};
+
+// IDeckLinkVideoConversion that splits each frame into bands of rows and converts
+// the bands concurrently on a persistent ConversionWorkerPool, using the kernels in
+// V210Conversion.h. Pixel formats the kernels do not handle are converted on the
+// calling thread by a FastVideoConversion.
+//
+// Setting DECKLINK_CONVERSION_TIMING in the environment prints the time taken by
+// every frame to stderr.
+class ParallelVideoConversion : public IDeckLinkVideoConversion
+{
+public:
+	explicit ParallelVideoConversion(unsigned threadCount);
+
+	void				GetStatistics(ParallelConversionStatistics* statistics);
+	void				ResetStatistics(void);
+
+	// IDeckLinkVideoConversion interface
+	virtual HRESULT		STDMETHODCALLTYPE	ConvertFrame(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame);
+
+	// IUnknown interface
+	virtual HRESULT		STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG		STDMETHODCALLTYPE	AddRef();
+	virtual ULONG		STDMETHODCALLTYPE	Release();
+
+private:
+	virtual ~ParallelVideoConversion();
+
+	HRESULT				convertBands(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame);
+	void				recordFrameTime(double frameTime);
+
+	std::atomic<ULONG>				m_refCount;
+	ConversionWorkerPool			m_workerPool;
+	IDeckLinkVideoConversion*		m_fallbackConversion;
+	bool							m_reportTiming;
+
+	std::mutex						m_statisticsMutex;
+	ParallelConversionStatistics	m_statistics;
+	double							m_totalFrameTime;
+};
+
+// Drop-in replacement for CreateVideoConversionInstance(). A thread count of 0 uses
+// one thread per CPU available to the process.
+ParallelVideoConversion*	CreateParallelVideoConversionInstance(unsigned threadCount = 0);
@@ -0,0 +1,199 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include "PatternFrameCache.h"
+
+PatternFrameCache::PatternFrameCache(IDeckLinkOutput* deckLinkOutput) :
+	m_deckLinkOutput(deckLinkOutput),
+	m_stopping(false)
+{
+	m_deckLinkOutput->AddRef();
+	m_prefetchThread = std::thread(&PatternFrameCache::prefetchThread, this);
+}
+
+PatternFrameCache::~PatternFrameCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+		dropPrefetchQueueLocked();
+	}
+	m_prefetchCondition.notify_all();
+	m_prefetchThread.join();
+
+	Clear();
+	m_deckLinkOutput->Release();
+}
+
+HRESULT PatternFrameCache::GetFrame(long width, long height, BMDPixelFormat pixelFormat, PatternType pattern, IDeckLinkMutableVideoFrame** frame)
+{
+	std::unique_lock<std::mutex>	lock(m_mutex);
+	Key								key(width, height, pixelFormat, pattern);
+	auto							it = m_entries.find(key);
+	IDeckLinkMutableVideoFrame*		newFrame = NULL;
+	HRESULT							result;
+
+	*frame = NULL;
+
+	if (it != m_entries.end())
+	{
+		auto queued = std::find(m_prefetchQueue.begin(), m_prefetchQueue.end(), key);
+
+		// Render a queued prefetch now, or wait for one in progress rather than rendering it twice
+		if (queued != m_prefetchQueue.end())
+			m_prefetchQueue.erase(queued);
+		else
+			m_renderedCondition.wait(lock, [&]{ return !it->second.rendering; });
+
+		if (it->second.frame != NULL)
+		{
+			*frame = it->second.frame;
+			(*frame)->AddRef();
+			return S_OK;
+		}
+
+		if ((it->second.result != S_OK) && !it->second.rendering)
+			return it->second.result;
+	}
+
+	m_entries[key] = { NULL, true, S_OK };
+
+	lock.unlock();
+	result = renderEntry(key, &newFrame);
+	lock.lock();
+
+	m_entries[key] = { newFrame, false, result };
+	m_renderedCondition.notify_all();
+
+	if (newFrame != NULL)
+	{
+		*frame = newFrame;
+		newFrame->AddRef();
+	}
+
+	return result;
+}
+
+void PatternFrameCache::Prefetch(long width, long height, BMDPixelFormat pixelFormat, PatternType pattern)
+{
+	std::lock_guard<std::mutex>	lock(m_mutex);
+	Key							key(width, height, pixelFormat, pattern);
+
+	if (m_entries.find(key) != m_entries.end())
+		return;
+
+	m_entries[key] = { NULL, true, S_OK };
+	m_prefetchQueue.push_back(key);
+	m_prefetchCondition.notify_one();
+}
+
+void PatternFrameCache::Clear(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// Frames still being rendered are finished first, so nothing is released twice
+	dropPrefetchQueueLocked();
+	m_renderedCondition.wait(lock, [&]{
+		for (auto& entry : m_entries)
+		{
+			if (entry.second.rendering)
+				return false;
+		}
+		return true;
+	});
+
+	for (auto& entry : m_entries)
+	{
+		if (entry.second.frame != NULL)
+			entry.second.frame->Release();
+	}
+	m_entries.clear();
+}
+
+void PatternFrameCache::dropPrefetchQueueLocked(void)
+{
+	for (const Key& key : m_prefetchQueue)
+		m_entries.erase(key);
+	m_prefetchQueue.clear();
+}
+
+HRESULT PatternFrameCache::renderEntry(const Key& key, IDeckLinkMutableVideoFrame** frame)
+{
+	long			width = std::get<0>(key);
+	long			height = std::get<1>(key);
+	BMDPixelFormat	pixelFormat = std::get<2>(key);
+	long			rowBytes = GetPatternRowBytes(pixelFormat, width);
+	HRESULT			result;
+
+	*frame = NULL;
+
+	if (rowBytes == 0)
+		return E_NOTIMPL;
+
+	result = m_deckLinkOutput->CreateVideoFrame((int32_t)width, (int32_t)height, (int32_t)rowBytes, pixelFormat, bmdFrameFlagDefault, frame);
+	if (result != S_OK)
+	{
+		fprintf(stderr, "Failed to create pattern video frame\n");
+		return result;
+	}
+
+	result = RenderPatternToFrame(std::get<3>(key), *frame);
+	if (result != S_OK)
+	{
+		(*frame)->Release();
+		*frame = NULL;
+	}
+
+	return result;
+}
+
+void PatternFrameCache::prefetchThread(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_prefetchCondition.wait(lock, [&]{ return !m_prefetchQueue.empty() || m_stopping; });
+		if (m_stopping)
+			break;
+
+		Key							key = m_prefetchQueue.front();
+		IDeckLinkMutableVideoFrame*	frame = NULL;
+		HRESULT						result;
+
+		m_prefetchQueue.pop_front();
+
+		lock.unlock();
+		result = renderEntry(key, &frame);
+		lock.lock();
+
+		m_entries[key] = { frame, false, result };
+		m_renderedCondition.notify_all();
+	}
+}
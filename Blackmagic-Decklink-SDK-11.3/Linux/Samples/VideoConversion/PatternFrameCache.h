@@ -0,0 +1,79 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include "DeckLinkAPI.h"
+#include "PatternGenerator.h"
+
+// Rendered pattern frames for one output device, keyed by frame size, pixel format and
+// pattern. Frames are rendered on first use, or ahead of time on a background thread
+// with Prefetch(), and kept until Clear() so that restarting output in a mode or format
+// seen before costs nothing. Frames are shared: callers must not draw into them.
+class PatternFrameCache
+{
+public:
+	PatternFrameCache(IDeckLinkOutput* deckLinkOutput);
+	~PatternFrameCache();
+
+	// Returns the frame with a reference added, rendering it now if it is not cached
+	HRESULT		GetFrame(long width, long height, BMDPixelFormat pixelFormat, PatternType pattern, IDeckLinkMutableVideoFrame** frame);
+
+	// Queues the frame for rendering in the background
+	void		Prefetch(long width, long height, BMDPixelFormat pixelFormat, PatternType pattern);
+
+	void		Clear(void);
+
+private:
+	typedef std::tuple<long, long, BMDPixelFormat, PatternType> Key;
+
+	struct Entry
+	{
+		IDeckLinkMutableVideoFrame*	frame;
+		bool						rendering;
+		HRESULT						result;
+	};
+
+	void		dropPrefetchQueueLocked(void);
+	HRESULT		renderEntry(const Key& key, IDeckLinkMutableVideoFrame** frame);
+	void		prefetchThread(void);
+
+	IDeckLinkOutput*				m_deckLinkOutput;
+	std::mutex						m_mutex;
+	std::condition_variable			m_prefetchCondition;
+	std::condition_variable			m_renderedCondition;
+	std::map<Key, Entry>			m_entries;
+	std::deque<Key>					m_prefetchQueue;
+	bool							m_stopping;
+	std::thread						m_prefetchThread;
+};
@@ -0,0 +1,316 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "PatternGenerator.h"
+#include "V210Conversion.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define PATTERN_X86_STORES 1
+#endif
+
+static const uint16_t	kBlackLuma		= 64;
+static const uint16_t	kWhiteLuma		= 940;
+static const uint16_t	kNeutralChroma	= 512;
+
+// Zone plate luma is looked up from the phase, in 1/kZonePlatePhaseSteps of a cycle
+static const int		kZonePlatePhaseSteps = 1024;
+
+struct PatternColour
+{
+	uint16_t	y;
+	uint16_t	cb;
+	uint16_t	cr;
+};
+
+static PatternColour colourFromRGB(double r, double g, double b, VideoConversionColorspace colorspace)
+{
+	double			kr;
+	double			kb;
+	double			luma;
+	PatternColour	colour;
+
+	GetColorspaceLumaCoefficients(colorspace, &kr, &kb);
+	luma = kr * r + (1.0 - kr - kb) * g + kb * b;
+
+	colour.y	= (uint16_t)lround(64.0 + 876.0 * luma);
+	colour.cb	= (uint16_t)lround(512.0 + 896.0 * (b - luma) / (2.0 * (1.0 - kb)));
+	colour.cr	= (uint16_t)lround(512.0 + 896.0 * (r - luma) / (2.0 * (1.0 - kr)));
+	return colour;
+}
+
+static void fillColourBarsRow(uint16_t* components, long width, double level, bool reverse, VideoConversionColorspace colorspace)
+{
+	// White, yellow, cyan, green, magenta, red, blue, black
+	static const uint8_t kBarRGB[8][3] =
+	{
+		{ 1, 1, 1 }, { 1, 1, 0 }, { 0, 1, 1 }, { 0, 1, 0 },
+		{ 1, 0, 1 }, { 1, 0, 0 }, { 0, 0, 1 }, { 0, 0, 0 }
+	};
+	PatternColour bars[8];
+
+	for (int i = 0; i < 8; i++)
+	{
+		double barLevel = (i == 0) ? 1.0 : level;
+		bars[i] = colourFromRGB(kBarRGB[i][0] * barLevel, kBarRGB[i][1] * barLevel, kBarRGB[i][2] * barLevel, colorspace);
+	}
+
+	for (long x = 0; x < width; x += 2)
+	{
+		long				barX = reverse ? (width - 2 - x) : x;
+		const PatternColour& bar = bars[std::max(0L, barX) * 8 / width];
+
+		components[0] = bar.cb;
+		components[1] = bar.y;
+		components[2] = bar.cr;
+		components[3] = bar.y;
+		components += 4;
+	}
+}
+
+static void fillRampRow(uint16_t* components, long width)
+{
+	for (long x = 0; x < width; x++)
+	{
+		components[2 * x] = kNeutralChroma;
+		components[2 * x + 1] = (uint16_t)(kBlackLuma + (x * (kWhiteLuma - kBlackLuma)) / std::max(1L, width - 1));
+	}
+}
+
+static void fillFlatRow(uint16_t* components, long width, uint16_t luma)
+{
+	for (long x = 0; x < width; x++)
+	{
+		components[2 * x] = kNeutralChroma;
+		components[2 * x + 1] = luma;
+	}
+}
+
+static void fillZonePlateRow(uint16_t* components, long width, long height, long y, const std::vector<uint16_t>& lumaForPhase)
+{
+	// Phase is pi * r^2 / width cycles, so the local frequency reaches half the sample
+	// rate at the left and right edges. Fixed point with 16 fractional bits.
+	const int64_t	scale = ((int64_t)kZonePlatePhaseSteps << 16) / (2 * width);
+	const int64_t	dy = y - height / 2;
+
+	for (long x = 0; x < width; x++)
+	{
+		int64_t dx = x - width / 2;
+		int64_t phase = ((dx * dx + dy * dy) * scale) >> 16;
+
+		components[2 * x] = kNeutralChroma;
+		components[2 * x + 1] = lumaForPhase[phase & (kZonePlatePhaseSteps - 1)];
+	}
+}
+
+static void copyRow(uint8_t* dst, const uint8_t* src, long rowBytes)
+{
+#if defined(PATTERN_X86_STORES)
+	// Pattern frames are written once and then only read by the device, so bypass the cache
+	if (((((uintptr_t)dst | (uintptr_t)src | (uintptr_t)rowBytes) & 15) == 0))
+	{
+		for (long i = 0; i < rowBytes; i += 64)
+		{
+			long remaining = rowBytes - i;
+
+			_mm_stream_si128((__m128i*)(dst + i), _mm_load_si128((const __m128i*)(src + i)));
+			if (remaining > 16)
+				_mm_stream_si128((__m128i*)(dst + i + 16), _mm_load_si128((const __m128i*)(src + i + 16)));
+			if (remaining > 32)
+				_mm_stream_si128((__m128i*)(dst + i + 32), _mm_load_si128((const __m128i*)(src + i + 32)));
+			if (remaining > 48)
+				_mm_stream_si128((__m128i*)(dst + i + 48), _mm_load_si128((const __m128i*)(src + i + 48)));
+		}
+		return;
+	}
+#endif
+
+	memcpy(dst, src, rowBytes);
+}
+
+long GetPatternRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return width * 2;
+
+		case bmdFormat10BitYUV:
+			return ((width + 47) / 48) * 128;
+
+		case bmdFormat10BitRGB:
+			return ((width + 63) / 64) * 256;
+
+		case bmdFormat8BitARGB:
+		case bmdFormat8BitBGRA:
+			return width * 4;
+
+		default:
+			return 0;
+	}
+}
+
+HRESULT RenderPattern(PatternType pattern, BMDPixelFormat pixelFormat, void* buffer, long rowBytes, long width, long height)
+{
+	VideoConversionColorspace	colorspace = GetColorspaceForFrameHeight(height);
+	std::vector<uint16_t>		components;
+	std::vector<uint16_t>		lumaForPhase;
+	std::vector<uint8_t>		packedRow;
+	uint8_t*					dst = (uint8_t*)buffer;
+	long						pipLeft = (width * 3 / 8) & ~1L;
+	long						pipTop = height * 3 / 8;
+	long						pipBottom = height - pipTop;
+
+	if ((buffer == NULL) || (width <= 0) || (height <= 0))
+		return E_INVALIDARG;
+
+	if (!IsComponentRowPackingSupported(pixelFormat) || (rowBytes < GetPatternRowBytes(pixelFormat, width)))
+		return E_NOTIMPL;
+
+	components.resize(GetComponentRowLength(width));
+	// Aligned copy of the packed row, so repeated rows can be stored with streaming stores
+	packedRow.resize(rowBytes + 16);
+	uint8_t* alignedRow = (uint8_t*)(((uintptr_t)packedRow.data() + 15) & ~(uintptr_t)15);
+
+	if (pattern == kPatternZonePlate)
+	{
+		lumaForPhase.resize(kZonePlatePhaseSteps);
+		for (int i = 0; i < kZonePlatePhaseSteps; i++)
+			lumaForPhase[i] = (uint16_t)lround(502.0 + 438.0 * cos(2.0 * M_PI * i / kZonePlatePhaseSteps));
+	}
+
+	for (long y = 0; y < height; y++)
+	{
+		bool newRow;
+
+		// Only the zone plate and the edges of the pip change from one row to the next
+		switch (pattern)
+		{
+			case kPatternZonePlate:
+				newRow = true;
+				break;
+
+			case kPatternPip:
+				newRow = (y == 0) || (y == pipTop) || (y == pipBottom);
+				break;
+
+			default:
+				newRow = (y == 0);
+				break;
+		}
+
+		if (newRow)
+		{
+			switch (pattern)
+			{
+				case kPatternColourBars75:
+					fillColourBarsRow(components.data(), width, 0.75, false, colorspace);
+					break;
+
+				case kPatternColourBars75Reverse:
+					fillColourBarsRow(components.data(), width, 0.75, true, colorspace);
+					break;
+
+				case kPatternColourBars100:
+					fillColourBarsRow(components.data(), width, 1.0, false, colorspace);
+					break;
+
+				case kPatternColourBars100Reverse:
+					fillColourBarsRow(components.data(), width, 1.0, true, colorspace);
+					break;
+
+				case kPatternRamp:
+					fillRampRow(components.data(), width);
+					break;
+
+				case kPatternZonePlate:
+					fillZonePlateRow(components.data(), width, height, y, lumaForPhase);
+					break;
+
+				case kPatternPip:
+					fillFlatRow(components.data(), width, kBlackLuma);
+					if ((y >= pipTop) && (y < pipBottom))
+					{
+						for (long x = pipLeft; x < width - pipLeft; x++)
+							components[2 * x + 1] = kWhiteLuma;
+					}
+					break;
+
+				case kPatternBlack:
+				default:
+					fillFlatRow(components.data(), width, kBlackLuma);
+					break;
+			}
+
+			// Padding bytes at the end of the row are left as zero
+			memset(alignedRow, 0, rowBytes);
+			if (PackComponentRow(pixelFormat, components.data(), alignedRow, width, colorspace) != S_OK)
+				return E_FAIL;
+		}
+
+		copyRow(dst, alignedRow, rowBytes);
+		dst += rowBytes;
+	}
+
+#if defined(PATTERN_X86_STORES)
+	_mm_sfence();
+#endif
+
+	return S_OK;
+}
+
+HRESULT RenderPatternToFrame(PatternType pattern, IDeckLinkVideoFrame* frame)
+{
+	void* bytes;
+
+	if (frame == NULL)
+		return E_INVALIDARG;
+
+	if (frame->GetBytes(&bytes) != S_OK)
+		return E_FAIL;
+
+	return RenderPattern(pattern, frame->GetPixelFormat(), bytes, frame->GetRowBytes(), frame->GetWidth(), frame->GetHeight());
+}
+
+PatternType GetRightEyePattern(PatternType pattern)
+{
+	switch (pattern)
+	{
+		case kPatternColourBars75:
+			return kPatternColourBars75Reverse;
+
+		case kPatternColourBars100:
+			return kPatternColourBars100Reverse;
+
+		default:
+			return pattern;
+	}
+}
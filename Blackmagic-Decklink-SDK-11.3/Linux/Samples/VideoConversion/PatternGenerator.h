@@ -0,0 +1,61 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+// Test patterns rendered directly in any pixel format PackComponentRow() supports:
+// 8 and 10-bit YUV, 8-bit ARGB and BGRA, and 10-bit RGB. Patterns are described as
+// rows of 10-bit 4:2:2 components, and each distinct row is packed only once; rows
+// that repeat are copied with wide (non-temporal where aligned) stores.
+
+enum PatternType
+{
+	kPatternBlack,
+	kPatternColourBars75,			// 75% bars with 100% white
+	kPatternColourBars75Reverse,	// Mirrored, for the right eye of 3D output
+	kPatternColourBars100,
+	kPatternColourBars100Reverse,
+	kPatternRamp,					// Horizontal luma ramp, black to white
+	kPatternZonePlate,				// Circular zone plate, reaching Nyquist at the left and right edges
+	kPatternPip						// Black with a white box in the centre
+};
+
+// Row stride CreateVideoFrame expects for the format, or 0 if patterns cannot be
+// rendered in it. Refer to DeckLink SDK Manual - 2.7.4 Pixel Formats.
+long		GetPatternRowBytes(BMDPixelFormat pixelFormat, long width);
+
+// Renders a full frame. Colour values follow Rec.601 for SD frame heights and
+// Rec.709 otherwise.
+HRESULT		RenderPattern(PatternType pattern, BMDPixelFormat pixelFormat, void* buffer, long rowBytes, long width, long height);
+HRESULT		RenderPatternToFrame(PatternType pattern, IDeckLinkVideoFrame* frame);
+
+// Pattern for the right eye of 3D output: colour bars are mirrored, the other patterns
+// are the same in both eyes
+PatternType	GetRightEyePattern(PatternType pattern);
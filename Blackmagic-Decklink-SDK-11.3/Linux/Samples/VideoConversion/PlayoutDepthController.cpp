@@ -0,0 +1,244 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <algorithm>
+#include "PlayoutDepthController.h"
+
+// Longest run of clean completions required before shrinking, as a multiple of the setting
+static const unsigned kMaximumShrinkBackoff = 64;
+
+static const char* GetEventName(PlayoutDepthEventType type)
+{
+	switch (type)
+	{
+		case kPlayoutEventFrameLate:		return "late";
+		case kPlayoutEventFrameDropped:		return "dropped";
+		case kPlayoutEventDepthGrown:		return "grown";
+		case kPlayoutEventDepthShrunk:		return "shrunk";
+	}
+	return "unknown";
+}
+
+PlayoutDepthController::PlayoutDepthController(IDeckLinkOutput* deckLinkOutput, BMDTimeValue frameDuration, BMDTimeScale timeScale, const PlayoutDepthSettings& settings) :
+	m_deckLinkOutput(deckLinkOutput),
+	m_frameDuration(frameDuration),
+	m_timeScale(timeScale),
+	m_settings(settings),
+	m_cleanCompletions(0),
+	m_lastShrinkCompletion(0),
+	m_shrunk(false),
+	m_windowPeakRenderMicroseconds(0),
+	m_peakRenderMicroseconds(0),
+	m_renderSamples(0),
+	m_framesCompleted(0),
+	m_framesLate(0),
+	m_framesDropped(0),
+	m_framesFlushed(0)
+{
+	m_deckLinkOutput->AddRef();
+
+	m_settings.minimumDepth = std::max(m_settings.minimumDepth, 1u);
+	m_settings.maximumDepth = std::max(m_settings.maximumDepth, m_settings.minimumDepth);
+	m_settings.stableFramesBeforeShrink = std::max(m_settings.stableFramesBeforeShrink, 1u);
+
+	m_targetDepth = std::min(std::max(m_settings.initialDepth, m_settings.minimumDepth), m_settings.maximumDepth);
+	m_largestTargetDepth = m_targetDepth;
+	m_shrinkInterval = m_settings.stableFramesBeforeShrink;
+}
+
+PlayoutDepthController::~PlayoutDepthController()
+{
+	m_deckLinkOutput->Release();
+}
+
+unsigned PlayoutDepthController::GetFramesToSchedule(void)
+{
+	unsigned bufferedFrames = getBufferedFrames();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return (m_targetDepth > bufferedFrames) ? (m_targetDepth - bufferedFrames) : 0;
+}
+
+void PlayoutDepthController::FrameCompleted(BMDOutputFrameCompletionResult result)
+{
+	unsigned bufferedFrames = getBufferedFrames();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_framesCompleted++;
+
+	if (result == bmdOutputFrameFlushed)
+	{
+		m_framesFlushed++;
+		return;
+	}
+
+	if ((result == bmdOutputFrameDisplayedLate) || (result == bmdOutputFrameDropped))
+	{
+		if (result == bmdOutputFrameDisplayedLate)
+		{
+			m_framesLate++;
+			addEventLocked(kPlayoutEventFrameLate, bufferedFrames);
+		}
+		else
+		{
+			m_framesDropped++;
+			addEventLocked(kPlayoutEventFrameDropped, bufferedFrames);
+		}
+
+		// The last shrink gave up depth that was needed, so wait longer before the next one
+		if (m_shrunk && ((m_framesCompleted - m_lastShrinkCompletion) < m_shrinkInterval))
+			m_shrinkInterval = std::min(m_shrinkInterval * 2, m_settings.stableFramesBeforeShrink * kMaximumShrinkBackoff);
+		m_shrunk = false;
+		m_cleanCompletions = 0;
+
+		if (m_targetDepth < m_settings.maximumDepth)
+		{
+			m_targetDepth++;
+			m_largestTargetDepth = std::max(m_largestTargetDepth, m_targetDepth);
+			addEventLocked(kPlayoutEventDepthGrown, bufferedFrames);
+		}
+		return;
+	}
+
+	// Follow a rise in render time before it shows up as late frames
+	if (m_targetDepth < renderDepthLocked())
+	{
+		m_targetDepth = renderDepthLocked();
+		m_largestTargetDepth = std::max(m_largestTargetDepth, m_targetDepth);
+		m_cleanCompletions = 0;
+		addEventLocked(kPlayoutEventDepthGrown, bufferedFrames);
+		return;
+	}
+
+	if (++m_cleanCompletions < m_shrinkInterval)
+		return;
+
+	m_cleanCompletions = 0;
+
+	if (m_targetDepth > std::max(m_settings.minimumDepth, renderDepthLocked()))
+	{
+		m_targetDepth--;
+		m_lastShrinkCompletion = m_framesCompleted;
+		m_shrunk = true;
+		addEventLocked(kPlayoutEventDepthShrunk, bufferedFrames);
+	}
+}
+
+void PlayoutDepthController::RecordRenderTime(uint64_t microseconds)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_windowPeakRenderMicroseconds = std::max(m_windowPeakRenderMicroseconds, microseconds);
+
+	// The peak decays one shrink interval after the render time falls
+	if (++m_renderSamples >= m_settings.stableFramesBeforeShrink)
+	{
+		m_peakRenderMicroseconds = m_windowPeakRenderMicroseconds;
+		m_windowPeakRenderMicroseconds = 0;
+		m_renderSamples = 0;
+	}
+}
+
+unsigned PlayoutDepthController::GetTargetDepth(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_targetDepth;
+}
+
+void PlayoutDepthController::GetStatistics(PlayoutDepthStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	statistics->targetDepth = m_targetDepth;
+	statistics->renderDepth = renderDepthLocked();
+	statistics->largestTargetDepth = m_largestTargetDepth;
+	statistics->framesCompleted = m_framesCompleted;
+	statistics->framesLate = m_framesLate;
+	statistics->framesDropped = m_framesDropped;
+	statistics->framesFlushed = m_framesFlushed;
+	statistics->peakRenderMicroseconds = std::max(m_peakRenderMicroseconds, m_windowPeakRenderMicroseconds);
+	statistics->shrinkInterval = m_shrinkInterval;
+}
+
+void PlayoutDepthController::GetHistory(std::vector<PlayoutDepthEvent>& events)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	events.assign(m_history.begin(), m_history.end());
+}
+
+void PlayoutDepthController::WriteHistory(FILE* file)
+{
+	std::vector<PlayoutDepthEvent> events;
+
+	GetHistory(events);
+
+	fprintf(file, "completion,event,target_depth,buffered_frames\n");
+	for (const PlayoutDepthEvent& event : events)
+		fprintf(file, "%llu,%s,%u,%u\n", (unsigned long long)event.completion, GetEventName(event.type), event.targetDepth, event.bufferedFrames);
+}
+
+unsigned PlayoutDepthController::getBufferedFrames(void)
+{
+	uint32_t bufferedFrames = 0;
+
+	if (m_deckLinkOutput->GetBufferedVideoFrameCount(&bufferedFrames) != S_OK)
+		return 0;
+
+	return bufferedFrames;
+}
+
+unsigned PlayoutDepthController::renderDepthLocked(void)
+{
+	uint64_t	peak = std::max(m_peakRenderMicroseconds, m_windowPeakRenderMicroseconds);
+	uint64_t	frameMicroseconds = (uint64_t)((m_frameDuration * 1000000) / m_timeScale);
+	unsigned	depth;
+
+	if (frameMicroseconds == 0)
+		return m_settings.minimumDepth;
+
+	// One frame for each frame time a render can take, plus the frame being rendered
+	depth = (unsigned)((peak + frameMicroseconds - 1) / frameMicroseconds) + 1;
+
+	return std::min(std::max(depth, m_settings.minimumDepth), m_settings.maximumDepth);
+}
+
+void PlayoutDepthController::addEventLocked(PlayoutDepthEventType type, unsigned bufferedFrames)
+{
+	PlayoutDepthEvent event = { m_framesCompleted, type, m_targetDepth, bufferedFrames };
+
+	if (m_settings.historyLength == 0)
+		return;
+
+	if (m_history.size() >= m_settings.historyLength)
+		m_history.pop_front();
+
+	m_history.push_back(event);
+}
@@ -0,0 +1,141 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Limits of the controller. The depth is the number of frames the application keeps
+// scheduled on the device ahead of the frame on air.
+struct PlayoutDepthSettings
+{
+	unsigned	minimumDepth;
+	unsigned	maximumDepth;
+	unsigned	initialDepth;
+	unsigned	stableFramesBeforeShrink;	// Clean completions needed before the depth drops by one frame
+	unsigned	historyLength;				// Events kept for GetHistory()
+
+	PlayoutDepthSettings() :
+		minimumDepth(2),
+		maximumDepth(30),
+		initialDepth(3),
+		stableFramesBeforeShrink(300),
+		historyLength(256)
+	{ }
+};
+
+enum PlayoutDepthEventType
+{
+	kPlayoutEventFrameLate,
+	kPlayoutEventFrameDropped,
+	kPlayoutEventDepthGrown,
+	kPlayoutEventDepthShrunk
+};
+
+struct PlayoutDepthEvent
+{
+	uint64_t				completion;			// Completions seen before the event
+	PlayoutDepthEventType	type;
+	unsigned				targetDepth;		// Target depth after the event
+	unsigned				bufferedFrames;		// Frames buffered on the device when the event was seen
+};
+
+struct PlayoutDepthStatistics
+{
+	unsigned	targetDepth;
+	unsigned	renderDepth;				// Lowest depth that covers the recent peak render time
+	unsigned	largestTargetDepth;
+	uint64_t	framesCompleted;
+	uint64_t	framesLate;
+	uint64_t	framesDropped;
+	uint64_t	framesFlushed;
+	uint64_t	peakRenderMicroseconds;
+	unsigned	shrinkInterval;				// Current clean completions needed before shrinking
+};
+
+// Chooses how many frames a scheduled playback application keeps queued on the device.
+// Every late or dropped completion grows the target by one frame. After a run of clean
+// completions the target shrinks by one frame, but never below the depth needed to
+// cover the recent peak render time. When a shrink is followed by a late frame before
+// the next shrink would be due, the depth it gave up was needed, so the run required
+// before shrinking again is doubled. The depth therefore settles at the smallest queue,
+// and so the lowest latency, that plays out without late frames under the actual load.
+//
+// Call GetFramesToSchedule() when prerolling and after each completion, and schedule
+// that many frames. Call FrameCompleted() from ScheduledFrameCompleted() before that.
+class PlayoutDepthController
+{
+public:
+	PlayoutDepthController(IDeckLinkOutput* deckLinkOutput, BMDTimeValue frameDuration, BMDTimeScale timeScale, const PlayoutDepthSettings& settings = PlayoutDepthSettings());
+	~PlayoutDepthController();
+
+	unsigned	GetFramesToSchedule(void);
+	void		FrameCompleted(BMDOutputFrameCompletionResult result);
+
+	// Wall clock time spent producing one frame before it was scheduled
+	void		RecordRenderTime(uint64_t microseconds);
+
+	unsigned	GetTargetDepth(void);
+	void		GetStatistics(PlayoutDepthStatistics* statistics);
+	void		GetHistory(std::vector<PlayoutDepthEvent>& events);
+
+	// Writes the history as CSV: completion,event,target_depth,buffered_frames
+	void		WriteHistory(FILE* file);
+
+private:
+	unsigned	getBufferedFrames(void);
+	unsigned	renderDepthLocked(void);
+	void		addEventLocked(PlayoutDepthEventType type, unsigned bufferedFrames);
+
+	IDeckLinkOutput*				m_deckLinkOutput;
+	BMDTimeValue					m_frameDuration;
+	BMDTimeScale					m_timeScale;
+	PlayoutDepthSettings			m_settings;
+
+	std::mutex						m_mutex;
+	unsigned						m_targetDepth;
+	unsigned						m_largestTargetDepth;
+	unsigned						m_shrinkInterval;
+	uint64_t						m_cleanCompletions;
+	uint64_t						m_lastShrinkCompletion;
+	bool							m_shrunk;
+
+	uint64_t						m_windowPeakRenderMicroseconds;
+	uint64_t						m_peakRenderMicroseconds;
+	unsigned						m_renderSamples;
+
+	uint64_t						m_framesCompleted;
+	uint64_t						m_framesLate;
+	uint64_t						m_framesDropped;
+	uint64_t						m_framesFlushed;
+	std::deque<PlayoutDepthEvent>	m_history;
+};
@@ -0,0 +1,382 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include "Scte104Message.h"
+
+// multiple_operation_message fields before the timestamp: reserved, messageSize,
+// protocol_version, AS_index, message_number, DPI_PID_index and SCTE35_protocol_version
+static const uint32_t	kMessageHeaderSize			= 10;
+
+// opID and data_length of each operation
+static const uint32_t	kOperationHeaderSize		= 4;
+
+static const uint16_t	kMultipleOperationReserved	= 0xffff;
+
+static const uint16_t	kSpliceRequestSize			= 14;
+static const uint16_t	kTimeSignalRequestSize		= 2;
+
+// Payload descriptor flags of a message split across packets
+static const uint8_t	kPayloadContinuedPacket		= 0x04;
+static const uint8_t	kPayloadFollowingPacket		= 0x02;
+
+static uint32_t getTimestampSize(uint8_t timeType)
+{
+	switch (timeType)
+	{
+		case kScte104TimeUTC:	return 1 + 6;
+		case kScte104TimeVITC:	return 1 + 4;
+		case kScte104TimeGPI:	return 1 + 2;
+	}
+	return 1;
+}
+
+static uint32_t getMessageSize(const Scte104Message& message)
+{
+	uint32_t size = kMessageHeaderSize + getTimestampSize(message.timestamp.timeType) + 1;
+
+	for (unsigned i = 0; i < message.operationCount; i++)
+		size += kOperationHeaderSize + message.operations[i].dataLength;
+
+	return size;
+}
+
+static inline uint8_t* put16(uint8_t* p, uint16_t value)
+{
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+	return p + 2;
+}
+
+static inline uint8_t* put32(uint8_t* p, uint32_t value)
+{
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+	return p + 4;
+}
+
+static inline uint16_t get16(const uint8_t* p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void Scte104Message::Clear(void)
+{
+	asIndex = 0;
+	messageNumber = 0;
+	dpiPidIndex = 0;
+	scte35ProtocolVersion = 0;
+	memset(&timestamp, 0, sizeof(timestamp));
+	operationCount = 0;
+	operationDataSize = 0;
+}
+
+HRESULT Scte104Message::AddSpliceRequest(const Scte104SpliceRequest& request)
+{
+	if ((operationCount == kScte104MaxOperations) || (getMessageSize(*this) + kOperationHeaderSize + kSpliceRequestSize > kScte104MaxMessageSize))
+		return E_OUTOFMEMORY;
+
+	Scte104Operation& operation = operations[operationCount++];
+	operation.opId = kScte104OpSpliceRequest;
+	operation.dataLength = kSpliceRequestSize;
+	operation.dataOffset = 0;
+	operation.spliceRequest = request;
+	return S_OK;
+}
+
+HRESULT Scte104Message::AddSpliceNull(void)
+{
+	return AddOperation(kScte104OpSpliceNull, NULL, 0);
+}
+
+HRESULT Scte104Message::AddTimeSignalRequest(uint16_t preRollTime)
+{
+	if ((operationCount == kScte104MaxOperations) || (getMessageSize(*this) + kOperationHeaderSize + kTimeSignalRequestSize > kScte104MaxMessageSize))
+		return E_OUTOFMEMORY;
+
+	Scte104Operation& operation = operations[operationCount++];
+	operation.opId = kScte104OpTimeSignalRequest;
+	operation.dataLength = kTimeSignalRequestSize;
+	operation.dataOffset = 0;
+	operation.timeSignalPreRollTime = preRollTime;
+	return S_OK;
+}
+
+HRESULT Scte104Message::AddOperation(uint16_t opId, const uint8_t* data, uint16_t dataLength)
+{
+	if ((operationCount == kScte104MaxOperations) || (getMessageSize(*this) + kOperationHeaderSize + dataLength > kScte104MaxMessageSize))
+		return E_OUTOFMEMORY;
+
+	Scte104Operation& operation = operations[operationCount++];
+	operation.opId = opId;
+	operation.dataLength = dataLength;
+	operation.dataOffset = operationDataSize;
+	if (dataLength > 0)
+		memcpy(operationData + operationDataSize, data, dataLength);
+	operationDataSize += dataLength;
+	return S_OK;
+}
+
+HRESULT EncodeScte104Message(const Scte104Message& message, uint8_t* data, uint32_t* size)
+{
+	uint32_t	messageSize;
+	uint8_t*	p = data;
+
+	if (message.operationCount > kScte104MaxOperations)
+		return E_INVALIDARG;
+
+	messageSize = getMessageSize(message);
+	if (messageSize > kScte104MaxMessageSize)
+		return E_INVALIDARG;
+
+	*p++ = kScte104PayloadDescriptorSingle;
+
+	p = put16(p, kMultipleOperationReserved);
+	p = put16(p, (uint16_t)messageSize);
+	*p++ = 0;									// protocol_version
+	*p++ = message.asIndex;
+	*p++ = message.messageNumber;
+	p = put16(p, message.dpiPidIndex);
+	*p++ = message.scte35ProtocolVersion;
+
+	*p++ = message.timestamp.timeType;
+	switch (message.timestamp.timeType)
+	{
+		case kScte104TimeUTC:
+			p = put32(p, message.timestamp.utcSeconds);
+			p = put16(p, message.timestamp.utcMicroseconds);
+			break;
+		case kScte104TimeVITC:
+			*p++ = message.timestamp.hours;
+			*p++ = message.timestamp.minutes;
+			*p++ = message.timestamp.seconds;
+			*p++ = message.timestamp.frames;
+			break;
+		case kScte104TimeGPI:
+			*p++ = message.timestamp.gpiNumber;
+			*p++ = message.timestamp.gpiEdge;
+			break;
+	}
+
+	*p++ = message.operationCount;
+	for (unsigned i = 0; i < message.operationCount; i++)
+	{
+		const Scte104Operation& operation = message.operations[i];
+
+		p = put16(p, operation.opId);
+		p = put16(p, operation.dataLength);
+
+		if (operation.opId == kScte104OpSpliceRequest)
+		{
+			const Scte104SpliceRequest& request = operation.spliceRequest;
+
+			*p++ = request.spliceInsertType;
+			p = put32(p, request.spliceEventId);
+			p = put16(p, request.uniqueProgramId);
+			p = put16(p, request.preRollTime);
+			p = put16(p, request.breakDuration);
+			*p++ = request.availNum;
+			*p++ = request.availsExpected;
+			*p++ = request.autoReturn ? 1 : 0;
+		}
+		else if (operation.opId == kScte104OpTimeSignalRequest)
+		{
+			p = put16(p, operation.timeSignalPreRollTime);
+		}
+		else if (operation.dataLength > 0)
+		{
+			if (operation.dataOffset + operation.dataLength > message.operationDataSize)
+				return E_INVALIDARG;
+			memcpy(p, message.operationData + operation.dataOffset, operation.dataLength);
+			p += operation.dataLength;
+		}
+	}
+
+	*size = (uint32_t)(p - data);
+	return S_OK;
+}
+
+HRESULT DecodeScte104Message(const uint8_t* data, uint32_t size, Scte104Message* message)
+{
+	const uint8_t*	p;
+	const uint8_t*	end;
+	uint32_t		timestampSize;
+	uint8_t			operationCount;
+
+	message->Clear();
+
+	if (size < 1 + kMessageHeaderSize + 2)
+		return E_FAIL;
+
+	if (data[0] & (kPayloadContinuedPacket | kPayloadFollowingPacket))
+		return E_NOTIMPL;
+
+	// The message may be followed by padding up to the end of the packet
+	p = data + 1;
+	if ((get16(p) != kMultipleOperationReserved) || (get16(p + 2) > size - 1))
+		return E_FAIL;
+
+	end = p + get16(p + 2);
+	message->asIndex = p[5];
+	message->messageNumber = p[6];
+	message->dpiPidIndex = get16(p + 7);
+	message->scte35ProtocolVersion = p[9];
+	p += kMessageHeaderSize;
+
+	if (p >= end)
+		return E_FAIL;
+
+	message->timestamp.timeType = *p;
+	timestampSize = getTimestampSize(*p);
+	if (p + timestampSize + 1 > end)
+		return E_FAIL;
+
+	switch (message->timestamp.timeType)
+	{
+		case kScte104TimeUTC:
+			message->timestamp.utcSeconds = get32(p + 1);
+			message->timestamp.utcMicroseconds = get16(p + 5);
+			break;
+		case kScte104TimeVITC:
+			message->timestamp.hours = p[1];
+			message->timestamp.minutes = p[2];
+			message->timestamp.seconds = p[3];
+			message->timestamp.frames = p[4];
+			break;
+		case kScte104TimeGPI:
+			message->timestamp.gpiNumber = p[1];
+			message->timestamp.gpiEdge = p[2];
+			break;
+	}
+	p += timestampSize;
+
+	operationCount = *p++;
+	if (operationCount > kScte104MaxOperations)
+		return E_FAIL;
+
+	for (unsigned i = 0; i < operationCount; i++)
+	{
+		uint16_t opId;
+		uint16_t dataLength;
+
+		if (p + kOperationHeaderSize > end)
+			return E_FAIL;
+
+		opId = get16(p);
+		dataLength = get16(p + 2);
+		p += kOperationHeaderSize;
+		if (dataLength > end - p)
+			return E_FAIL;
+
+		if ((opId == kScte104OpSpliceRequest) && (dataLength == kSpliceRequestSize))
+		{
+			Scte104SpliceRequest request;
+
+			request.spliceInsertType = p[0];
+			request.spliceEventId = get32(p + 1);
+			request.uniqueProgramId = get16(p + 5);
+			request.preRollTime = get16(p + 7);
+			request.breakDuration = get16(p + 9);
+			request.availNum = p[11];
+			request.availsExpected = p[12];
+			request.autoReturn = (p[13] != 0);
+			message->AddSpliceRequest(request);
+		}
+		else if ((opId == kScte104OpTimeSignalRequest) && (dataLength == kTimeSignalRequestSize))
+		{
+			message->AddTimeSignalRequest(get16(p));
+		}
+		else
+		{
+			message->AddOperation(opId, p, dataLength);
+		}
+		p += dataLength;
+	}
+
+	return S_OK;
+}
+
+HRESULT DecodeScte104Packet(IDeckLinkAncillaryPacket* packet, Scte104Message* message)
+{
+	const void*	data;
+	uint32_t	size;
+	HRESULT		result;
+
+	if ((packet->GetDID() != kScte104DID) || (packet->GetSDID() != kScte104SDID))
+		return E_INVALIDARG;
+
+	result = packet->GetBytes(bmdAncillaryPacketFormatUInt8, &data, &size);
+	if (result != S_OK)
+		return result;
+
+	return DecodeScte104Message((const uint8_t*)data, size, message);
+}
+
+HRESULT GetScte104Message(IDeckLinkVideoFrame* frame, Scte104Message* message)
+{
+	IDeckLinkVideoFrameAncillaryPackets*	ancillaryPackets = NULL;
+	IDeckLinkAncillaryPacket*				packet = NULL;
+	HRESULT									result;
+
+	result = frame->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&ancillaryPackets);
+	if (result != S_OK)
+		goto bail;
+
+	result = ancillaryPackets->GetFirstPacketByID(kScte104DID, kScte104SDID, &packet);
+	if (result != S_OK)
+		goto bail;
+
+	result = DecodeScte104Packet(packet, message);
+
+bail:
+	if (packet != NULL)
+		packet->Release();
+
+	if (ancillaryPackets != NULL)
+		ancillaryPackets->Release();
+
+	return result;
+}
+
+const char* GetScte104OperationName(uint16_t opId)
+{
+	switch (opId)
+	{
+		case kScte104OpSpliceRequest:					return "splice_request";
+		case kScte104OpSpliceNull:						return "splice_null";
+		case kScte104OpTimeSignalRequest:				return "time_signal_request";
+		case kScte104OpInsertSegmentationDescriptor:	return "insert_segmentation_descriptor";
+	}
+	return "unknown";
+}
@@ -0,0 +1,152 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+// SCTE-104 automation messages carried in VANC as SMPTE 2010 packets. A message is built
+// as a Scte104Message of typed operations, encoded once into packet user data, and parsed
+// back from the user data of an IDeckLinkAncillaryPacket. Only messages that fit in one
+// packet are supported, which covers the multiple_operation_message of a splice or time
+// signal; segmentation descriptors and other operations are carried as raw operation data.
+
+const uint8_t	kScte104DID							= 0x41;
+const uint8_t	kScte104SDID						= 0x07;
+
+// SMPTE 2010 payload descriptor of a message that is not continued in another packet
+const uint8_t	kScte104PayloadDescriptorSingle		= 0x08;
+
+// User data of one packet, and the message that fits after the payload descriptor
+const uint32_t	kScte104MaxPacketSize				= 255;
+const uint32_t	kScte104MaxMessageSize				= kScte104MaxPacketSize - 1;
+
+const unsigned	kScte104MaxOperations				= 8;
+
+enum Scte104OpID
+{
+	kScte104OpSpliceRequest					= 0x0101,
+	kScte104OpSpliceNull					= 0x0102,
+	kScte104OpTimeSignalRequest				= 0x0104,
+	kScte104OpInsertSegmentationDescriptor	= 0x010b
+};
+
+enum Scte104SpliceInsertType
+{
+	kScte104SpliceStartNormal		= 1,
+	kScte104SpliceStartImmediate	= 2,
+	kScte104SpliceEndNormal			= 3,
+	kScte104SpliceEndImmediate		= 4,
+	kScte104SpliceCancel			= 5
+};
+
+enum Scte104TimeType
+{
+	kScte104TimeNone				= 0,
+	kScte104TimeUTC					= 1,
+	kScte104TimeVITC				= 2,
+	kScte104TimeGPI					= 3
+};
+
+struct Scte104Timestamp
+{
+	uint8_t		timeType;				// Scte104TimeType; only the fields of that type are used
+	uint32_t	utcSeconds;
+	uint16_t	utcMicroseconds;
+	uint8_t		hours;
+	uint8_t		minutes;
+	uint8_t		seconds;
+	uint8_t		frames;
+	uint8_t		gpiNumber;
+	uint8_t		gpiEdge;
+};
+
+struct Scte104SpliceRequest
+{
+	uint8_t		spliceInsertType;		// Scte104SpliceInsertType
+	uint32_t	spliceEventId;
+	uint16_t	uniqueProgramId;
+	uint16_t	preRollTime;			// Milliseconds from the message to the splice point
+	uint16_t	breakDuration;			// Tenths of a second
+	uint8_t		availNum;
+	uint8_t		availsExpected;
+	bool		autoReturn;
+};
+
+struct Scte104Operation
+{
+	uint16_t	opId;
+	uint16_t	dataLength;
+	uint16_t	dataOffset;				// Raw data in Scte104Message::operationData, for untyped operations
+
+	union
+	{
+		Scte104SpliceRequest	spliceRequest;			// kScte104OpSpliceRequest
+		uint16_t				timeSignalPreRollTime;	// kScte104OpTimeSignalRequest, milliseconds
+	};
+};
+
+struct Scte104Message
+{
+	uint8_t				asIndex;
+	uint8_t				messageNumber;
+	uint16_t			dpiPidIndex;
+	uint8_t				scte35ProtocolVersion;
+	Scte104Timestamp	timestamp;
+	uint8_t				operationCount;
+	Scte104Operation	operations[kScte104MaxOperations];
+	uint16_t			operationDataSize;
+	uint8_t				operationData[kScte104MaxMessageSize];
+
+	Scte104Message()	{ Clear(); }
+
+	// Empties the message, with no timestamp
+	void		Clear(void);
+
+	// Each returns E_OUTOFMEMORY when the message has no room for the operation
+	HRESULT		AddSpliceRequest(const Scte104SpliceRequest& request);
+	HRESULT		AddSpliceNull(void);
+	HRESULT		AddTimeSignalRequest(uint16_t preRollTime);
+	HRESULT		AddOperation(uint16_t opId, const uint8_t* data, uint16_t dataLength);
+};
+
+// Writes the payload descriptor and multiple_operation_message to data, which must hold
+// kScte104MaxPacketSize bytes. Returns E_INVALIDARG if the message does not fit one packet.
+HRESULT		EncodeScte104Message(const Scte104Message& message, uint8_t* data, uint32_t* size);
+
+// Parses packet user data starting at the payload descriptor. Returns E_NOTIMPL for
+// messages split across packets, and E_FAIL for malformed messages.
+HRESULT		DecodeScte104Message(const uint8_t* data, uint32_t size, Scte104Message* message);
+
+// Parses an SCTE-104 packet, returning E_INVALIDARG for a packet with another DID or SDID
+HRESULT		DecodeScte104Packet(IDeckLinkAncillaryPacket* packet, Scte104Message* message);
+
+// Parses the first SCTE-104 packet attached to a frame. Returns S_FALSE if there is none.
+HRESULT		GetScte104Message(IDeckLinkVideoFrame* frame, Scte104Message* message);
+
+const char*	GetScte104OperationName(uint16_t opId);
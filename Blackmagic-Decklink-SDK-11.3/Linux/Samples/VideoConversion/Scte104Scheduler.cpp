@@ -0,0 +1,256 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <algorithm>
+#include "Scte104Scheduler.h"
+
+// A packet of a Scte104Scheduler. Its storage belongs to the scheduler, and a packet with
+// no references is free to be queued again, so the final Release() returns it to the
+// scheduler rather than deleting it.
+class Scte104AncillaryPacket : public IDeckLinkAncillaryPacket
+{
+public:
+	Scte104AncillaryPacket(uint32_t lineNumber) :
+		m_refCount(0),
+		m_lineNumber(lineNumber),
+		m_size(0)
+	{
+	}
+
+	// Claims the packet with the first reference if it is free
+	bool TryAcquire(void)
+	{
+		return __sync_bool_compare_and_swap(&m_refCount, 0, 1);
+	}
+
+	bool IsFree(void)
+	{
+		return __sync_add_and_fetch(&m_refCount, 0) == 0;
+	}
+
+	HRESULT Encode(const Scte104Message& message)
+	{
+		return EncodeScte104Message(message, m_data, &m_size);
+	}
+
+	// IDeckLinkAncillaryPacket
+	virtual HRESULT STDMETHODCALLTYPE GetBytes(BMDAncillaryPacketFormat format, const void** data, uint32_t* size)
+	{
+		// DeckLink converts 8-bit user data to the format it needs
+		if (format != bmdAncillaryPacketFormatUInt8)
+			return E_NOTIMPL;
+		if (data)
+			*data = m_data;
+		if (size)
+			*size = m_size;
+		return S_OK;
+	}
+
+	virtual uint8_t STDMETHODCALLTYPE GetDID(void)				{ return kScte104DID; }
+	virtual uint8_t STDMETHODCALLTYPE GetSDID(void)				{ return kScte104SDID; }
+	virtual uint32_t STDMETHODCALLTYPE GetLineNumber(void)		{ return m_lineNumber; }
+	virtual uint8_t STDMETHODCALLTYPE GetDataStreamIndex(void)	{ return 0; }
+
+	// IUnknown
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		*ppv = NULL;
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG STDMETHODCALLTYPE AddRef(void)
+	{
+		return __sync_add_and_fetch(&m_refCount, 1);
+	}
+
+	// At zero the packet is back with its scheduler
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		return __sync_sub_and_fetch(&m_refCount, 1);
+	}
+
+private:
+	int32_t		m_refCount;
+	uint32_t	m_lineNumber;
+	uint32_t	m_size;
+	uint8_t		m_data[kScte104MaxPacketSize];
+};
+
+Scte104Scheduler::Scte104Scheduler(BMDTimeScale timeScale, unsigned packetCount, uint32_t lineNumber) :
+	m_timeScale(timeScale),
+	m_lineNumber(lineNumber),
+	m_messagesQueued(0),
+	m_messagesAttached(0),
+	m_messagesLate(0),
+	m_enqueueFailures(0)
+{
+	m_packets.reserve(packetCount);
+	for (unsigned i = 0; i < packetCount; i++)
+		m_packets.push_back(new Scte104AncillaryPacket(lineNumber));
+
+	// Every packet can be queued at once, so the queue never grows while playing
+	m_pending.reserve(packetCount);
+}
+
+Scte104Scheduler::~Scte104Scheduler()
+{
+	for (Scte104AncillaryPacket* packet : m_packets)
+		delete packet;
+}
+
+HRESULT Scte104Scheduler::Enqueue(BMDTimeValue streamTime, BMDTimeScale timeScale, const Scte104Message& message)
+{
+	Scte104AncillaryPacket*	packet = NULL;
+	PendingMessage			pending;
+	HRESULT					result;
+
+	for (Scte104AncillaryPacket* candidate : m_packets)
+	{
+		if (candidate->TryAcquire())
+		{
+			packet = candidate;
+			break;
+		}
+	}
+
+	if (packet == NULL)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_enqueueFailures++;
+		return E_OUTOFMEMORY;
+	}
+
+	result = packet->Encode(message);
+	if (result != S_OK)
+	{
+		packet->Release();
+		return result;
+	}
+
+	// Rounded down, so a time within a frame stays on that frame
+	if (timeScale != m_timeScale)
+	{
+		BMDTimeValue scaled = streamTime * m_timeScale;
+		pending.streamTime = scaled / timeScale - ((scaled % timeScale < 0) ? 1 : 0);
+	}
+	else
+	{
+		pending.streamTime = streamTime;
+	}
+	pending.packet = packet;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// Ahead of any message for the same time, which was queued first and so goes first
+		auto position = std::lower_bound(m_pending.begin(), m_pending.end(), pending,
+										 [](const PendingMessage& a, const PendingMessage& b) { return a.streamTime > b.streamTime; });
+		m_pending.insert(position, pending);
+		m_messagesQueued++;
+	}
+
+	return S_OK;
+}
+
+HRESULT Scte104Scheduler::AttachPackets(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime, BMDTimeValue displayDuration)
+{
+	IDeckLinkVideoFrameAncillaryPackets*	ancillaryPackets = NULL;
+	IDeckLinkAncillaryPacket*				previousPacket = NULL;
+	Scte104AncillaryPacket*					packet = NULL;
+	HRESULT									result;
+
+	result = frame->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&ancillaryPackets);
+	if (result != S_OK)
+		goto bail;
+
+	// DeckLink keeps the packets of a frame until they are detached, so a recycled frame
+	// still carries the message it was last scheduled with
+	while (ancillaryPackets->GetFirstPacketByID(kScte104DID, kScte104SDID, &previousPacket) == S_OK)
+	{
+		result = ancillaryPackets->DetachPacket(previousPacket);
+		previousPacket->Release();
+		if (result != S_OK)
+			goto bail;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_pending.empty() && (m_pending.back().streamTime < displayTime + displayDuration))
+		{
+			if (m_pending.back().streamTime < displayTime)
+				m_messagesLate++;
+
+			packet = m_pending.back().packet;
+			m_pending.pop_back();
+			m_messagesAttached++;
+		}
+	}
+
+	if (packet == NULL)
+	{
+		result = S_FALSE;
+		goto bail;
+	}
+
+	// The frame takes over the queue's reference to the packet
+	result = ancillaryPackets->AttachPacket(packet);
+	if (result != S_OK)
+		packet->Release();
+
+bail:
+	if (ancillaryPackets != NULL)
+		ancillaryPackets->Release();
+
+	return result;
+}
+
+void Scte104Scheduler::Clear(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (PendingMessage& pending : m_pending)
+		pending.packet->Release();
+	m_pending.clear();
+}
+
+void Scte104Scheduler::GetStatistics(Scte104SchedulerStatistics* statistics)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	statistics->pendingMessages = (unsigned)m_pending.size();
+	statistics->freePackets = 0;
+	for (Scte104AncillaryPacket* packet : m_packets)
+	{
+		if (packet->IsFree())
+			statistics->freePackets++;
+	}
+	statistics->messagesQueued = m_messagesQueued;
+	statistics->messagesAttached = m_messagesAttached;
+	statistics->messagesLate = m_messagesLate;
+	statistics->enqueueFailures = m_enqueueFailures;
+}
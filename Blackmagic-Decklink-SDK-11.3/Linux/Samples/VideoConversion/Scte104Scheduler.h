@@ -0,0 +1,96 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "Scte104Message.h"
+
+struct Scte104SchedulerStatistics
+{
+	unsigned	pendingMessages;
+	unsigned	freePackets;
+	uint64_t	messagesQueued;
+	uint64_t	messagesAttached;
+	uint64_t	messagesLate;			// Attached to a frame that starts after the message's time
+	uint64_t	enqueueFailures;		// Enqueue() calls made while no packet was free
+};
+
+class Scte104AncillaryPacket;
+
+// Places SCTE-104 messages on the output frames that cover their stream times. Messages
+// are encoded into preallocated packets by Enqueue(), from any thread and well ahead of
+// their frames, so AttachPackets(), called for each frame just before it is scheduled,
+// only moves a packet from the queue to the frame: no encoding and no allocation.
+//
+// At most one message is attached to each frame. A message whose frame has already been
+// scheduled goes on the next frame and is counted as late; messages due on the same frame
+// go on consecutive frames in the order they were queued. The packets belong to the
+// scheduler, which must therefore outlive the frames they are attached to.
+class Scte104Scheduler
+{
+public:
+	// lineNumber 0 lets DeckLink choose the VANC line
+	Scte104Scheduler(BMDTimeScale timeScale, unsigned packetCount, uint32_t lineNumber);
+	~Scte104Scheduler();
+
+	// Queues a message for the frame showing streamTime. Returns E_OUTOFMEMORY when every
+	// packet is queued or attached to a frame, and E_INVALIDARG if the message does not
+	// fit one packet.
+	HRESULT		Enqueue(BMDTimeValue streamTime, BMDTimeScale timeScale, const Scte104Message& message);
+
+	// Removes the SCTE-104 packets left on a recycled frame, then attaches the message due
+	// by the end of the frame, in the scheduler's time scale. Returns S_FALSE if no
+	// message was due.
+	HRESULT		AttachPackets(IDeckLinkVideoFrame* frame, BMDTimeValue displayTime, BMDTimeValue displayDuration);
+
+	// Drops the queued messages, for example after playback is stopped
+	void		Clear(void);
+
+	void		GetStatistics(Scte104SchedulerStatistics* statistics);
+
+private:
+	struct PendingMessage
+	{
+		BMDTimeValue			streamTime;
+		Scte104AncillaryPacket*	packet;
+	};
+
+	BMDTimeScale							m_timeScale;
+	uint32_t								m_lineNumber;
+	std::vector<Scte104AncillaryPacket*>	m_packets;
+
+	std::mutex								m_mutex;
+	std::vector<PendingMessage>				m_pending;		// Latest first, so the next message is at the back
+	uint64_t								m_messagesQueued;
+	uint64_t								m_messagesAttached;
+	uint64_t								m_messagesLate;
+	uint64_t								m_enqueueFailures;
+};
@@ -0,0 +1,703 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "SharedFrameRing.h"
+
+static const uint32_t		kRingMagic				= 0x44524e47;		// 'DRNG'
+static const uint32_t		kRingVersion			= 1;
+static const unsigned		kSequenceTableSize		= 256;
+static const size_t			kPageSize				= 4096;
+static const size_t			kDataAlignment			= 64;
+static const BMDTimeScale	kNanosecondTimeScale	= 1000000000;
+
+// Slot state: sequence in the upper 40 bits, writing flag, then the reader pin count
+static const unsigned		kStateSequenceShift		= 24;
+static const uint64_t		kStateWriting			= 1ULL << 23;
+static const uint64_t		kStatePinMask			= kStateWriting - 1;
+
+struct SharedFrameRingReaderEntry
+{
+	std::atomic<int32_t>	pid;				// 0 when free, -1 while its pins are reclaimed
+	std::atomic<uint64_t>	pinnedSlots;
+};
+
+// Shared by the writer and all readers, mapped read-write by both. Frame data follows at
+// dataOffset and is mapped read only by readers.
+struct SharedFrameRingControl
+{
+	uint32_t					magic;
+	uint32_t					version;
+	uint32_t					slotCount;
+	uint32_t					reserved;
+	uint64_t					slotBytes;
+	uint64_t					dataOffset;
+	uint64_t					totalBytes;
+
+	std::atomic<int32_t>		writerPid;
+	std::atomic<uint32_t>		wakeCounter;			// Futex word, bumped for every frame
+	std::atomic<uint32_t>		waiters;
+	std::atomic<uint64_t>		latestSequence;
+	std::atomic<uint64_t>		framesWritten;
+	std::atomic<uint64_t>		framesDropped;
+	std::atomic<uint64_t>		framesTruncated;
+	std::atomic<uint64_t>		readersReclaimed;
+
+	std::atomic<uint64_t>		sequenceTable[kSequenceTableSize];		// sequence << 8 | slot
+	std::atomic<uint64_t>		slotState[kSharedFrameRingMaxSlots];
+	SharedFrameRingReaderEntry	readers[kSharedFrameRingMaxReaders];
+};
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint64_t MakeState(uint64_t sequence, uint64_t flags)
+{
+	return (sequence << kStateSequenceShift) | flags;
+}
+
+static uint64_t StateSequence(uint64_t state)
+{
+	return state >> kStateSequenceShift;
+}
+
+static void FutexWake(std::atomic<uint32_t>* word)
+{
+	syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static bool FutexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeoutMilliseconds)
+{
+	struct timespec timeout;
+
+	timeout.tv_sec = timeoutMilliseconds / 1000;
+	timeout.tv_nsec = (timeoutMilliseconds % 1000) * 1000000L;
+
+	// Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+	return (syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, &timeout, NULL, 0) == 0) || (errno != ETIMEDOUT);
+}
+
+// Releases the pins of readers whose process has gone
+static unsigned ReclaimDeadReaders(SharedFrameRingControl* control)
+{
+	unsigned reclaimed = 0;
+
+	for (unsigned i = 0; i < kSharedFrameRingMaxReaders; i++)
+	{
+		SharedFrameRingReaderEntry&	reader = control->readers[i];
+		int32_t						pid = reader.pid.load(std::memory_order_acquire);
+
+		if ((pid <= 0) || (kill(pid, 0) == 0) || (errno != ESRCH))
+			continue;
+
+		if (!reader.pid.compare_exchange_strong(pid, -1))
+			continue;
+
+		uint64_t pinned = reader.pinnedSlots.exchange(0);
+		for (unsigned slot = 0; slot < control->slotCount; slot++)
+		{
+			if (pinned & (1ULL << slot))
+				control->slotState[slot].fetch_sub(1, std::memory_order_release);
+		}
+
+		reader.pid.store(0, std::memory_order_release);
+		control->readersReclaimed.fetch_add(1);
+		reclaimed++;
+	}
+
+	return reclaimed;
+}
+
+SharedFrameRingWriter::SharedFrameRingWriter() :
+	m_name(NULL),
+	m_fd(-1),
+	m_control(NULL),
+	m_data(NULL),
+	m_mappedBytes(0),
+	m_nextSlot(0),
+	m_sequence(0)
+{
+}
+
+SharedFrameRingWriter::~SharedFrameRingWriter()
+{
+	Close();
+}
+
+HRESULT SharedFrameRingWriter::Create(const char* name, const SharedFrameRingSettings& settings)
+{
+	size_t		controlBytes;
+	size_t		slotBytes;
+	size_t		totalBytes;
+	void*		mapping;
+	char		path[NAME_MAX];
+
+	if ((settings.slotCount < 2) || (settings.slotCount > kSharedFrameRingMaxSlots) || (settings.maxVideoBytes == 0))
+		return E_INVALIDARG;
+
+	Close();
+
+	snprintf(path, sizeof(path), "/%s", name);
+
+	controlBytes = AlignUp(sizeof(SharedFrameRingControl), kPageSize);
+	slotBytes = AlignUp(AlignUp(sizeof(SharedFrameInfo), kDataAlignment) +
+						AlignUp(settings.maxVideoBytes, kDataAlignment) +
+						AlignUp(settings.maxAudioBytes, kDataAlignment) +
+						AlignUp(settings.maxAncillaryBytes, kDataAlignment), kPageSize);
+	totalBytes = controlBytes + slotBytes * settings.slotCount;
+
+	// Readers still attached to a ring left behind keep their mapping of it
+	shm_unlink(path);
+
+	m_fd = shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (m_fd < 0)
+		return E_FAIL;
+
+	if (ftruncate(m_fd, (off_t)totalBytes) != 0)
+		goto bail;
+
+	mapping = mmap(NULL, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (mapping == MAP_FAILED)
+		goto bail;
+
+	m_mappedBytes = totalBytes;
+	m_control = new (mapping) SharedFrameRingControl();
+	m_data = (uint8_t*)mapping + controlBytes;
+	m_settings = settings;
+	m_name = strdup(path);
+	m_nextSlot = 0;
+	m_sequence = 0;
+
+	m_control->slotCount = settings.slotCount;
+	m_control->slotBytes = slotBytes;
+	m_control->dataOffset = controlBytes;
+	m_control->totalBytes = totalBytes;
+	m_control->writerPid.store(getpid());
+	m_control->version = kRingVersion;
+
+	// Readers check the magic last, once everything else is in place
+	std::atomic_thread_fence(std::memory_order_release);
+	m_control->magic = kRingMagic;
+
+	return S_OK;
+
+bail:
+	close(m_fd);
+	m_fd = -1;
+	shm_unlink(path);
+	return E_FAIL;
+}
+
+void SharedFrameRingWriter::Close(void)
+{
+	if (m_control != NULL)
+	{
+		// Wake every waiting reader so it sees the writer has gone
+		m_control->writerPid.store(0, std::memory_order_release);
+		m_control->wakeCounter.fetch_add(1, std::memory_order_release);
+		FutexWake(&m_control->wakeCounter);
+
+		munmap(m_control, m_mappedBytes);
+		m_control = NULL;
+		m_data = NULL;
+	}
+
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+
+	if (m_name != NULL)
+	{
+		shm_unlink(m_name);
+		free(m_name);
+		m_name = NULL;
+	}
+}
+
+bool SharedFrameRingWriter::claimSlot(unsigned* slot)
+{
+	unsigned slotCount = m_control->slotCount;
+
+	for (unsigned i = 0; i < slotCount; i++)
+	{
+		unsigned	candidate = (m_nextSlot + i) % slotCount;
+		uint64_t	state = m_control->slotState[candidate].load(std::memory_order_acquire);
+
+		// A pinned slot is being read in place; leave it and take the next
+		if ((state & kStatePinMask) != 0)
+			continue;
+
+		if (m_control->slotState[candidate].compare_exchange_strong(state, state | kStateWriting, std::memory_order_acquire))
+		{
+			*slot = candidate;
+			m_nextSlot = (candidate + 1) % slotCount;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t SharedFrameRingWriter::writeAncillary(IDeckLinkVideoInputFrame* videoFrame, uint8_t* destination, size_t capacity, uint32_t* packetCount, bool* truncated)
+{
+	IDeckLinkVideoFrameAncillaryPackets*	ancillaryPackets = NULL;
+	IDeckLinkAncillaryPacketIterator*		packetIterator = NULL;
+	IDeckLinkAncillaryPacket*				packet = NULL;
+	size_t									written = 0;
+
+	*packetCount = 0;
+
+	if (videoFrame->QueryInterface(IID_IDeckLinkVideoFrameAncillaryPackets, (void**)&ancillaryPackets) != S_OK)
+		goto bail;
+
+	if (ancillaryPackets->GetPacketIterator(&packetIterator) != S_OK)
+		goto bail;
+
+	while (packetIterator->Next(&packet) == S_OK)
+	{
+		const void*				data = NULL;
+		uint32_t				size = 0;
+		SharedAncillaryPacket	header;
+
+		if ((packet->GetBytes(bmdAncillaryPacketFormatUInt8, &data, &size) == S_OK) &&
+			(written + sizeof(header) + AlignUp(size, 4) <= capacity))
+		{
+			header.did = packet->GetDID();
+			header.sdid = packet->GetSDID();
+			header.dataStreamIndex = packet->GetDataStreamIndex();
+			header.reserved = 0;
+			header.lineNumber = packet->GetLineNumber();
+			header.size = size;
+
+			memcpy(destination + written, &header, sizeof(header));
+			memcpy(destination + written + sizeof(header), data, size);
+			written += sizeof(header) + AlignUp(size, 4);
+			(*packetCount)++;
+		}
+		else
+		{
+			*truncated = true;
+		}
+
+		packet->Release();
+	}
+
+bail:
+	if (packetIterator != NULL)
+		packetIterator->Release();
+
+	if (ancillaryPackets != NULL)
+		ancillaryPackets->Release();
+
+	return written;
+}
+
+HRESULT SharedFrameRingWriter::WriteFrame(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket)
+{
+	SharedFrameInfo		info;
+	unsigned			slot;
+	uint8_t*			slotBase;
+	bool				truncated = false;
+	void*				bytes;
+
+	if (m_control == NULL)
+		return E_FAIL;
+
+	if (!claimSlot(&slot))
+	{
+		// Every slot is pinned; free any held by readers that have gone and try again
+		if ((ReclaimDeadReaders(m_control) == 0) || !claimSlot(&slot))
+		{
+			m_control->framesDropped.fetch_add(1);
+			return S_FALSE;
+		}
+	}
+
+	slotBase = m_data + (size_t)slot * m_control->slotBytes;
+
+	memset(&info, 0, sizeof(info));
+	info.sequence = ++m_sequence;
+	info.colorspace = -1;
+	info.videoOffset = AlignUp(sizeof(SharedFrameInfo), kDataAlignment);
+	info.audioOffset = info.videoOffset + AlignUp(m_settings.maxVideoBytes, kDataAlignment);
+	info.ancillaryOffset = info.audioOffset + AlignUp(m_settings.maxAudioBytes, kDataAlignment);
+
+	if (videoFrame != NULL)
+	{
+		IDeckLinkTimecode*						timecode;
+		IDeckLinkVideoFrameMetadataExtensions*	metadata;
+
+		info.width = (int32_t)videoFrame->GetWidth();
+		info.height = (int32_t)videoFrame->GetHeight();
+		info.rowBytes = (int32_t)videoFrame->GetRowBytes();
+		info.pixelFormat = videoFrame->GetPixelFormat();
+		info.flags = videoFrame->GetFlags();
+
+		info.timeScale = kNanosecondTimeScale;
+		videoFrame->GetStreamTime(&info.streamTime, &info.frameDuration, info.timeScale);
+		videoFrame->GetHardwareReferenceTimestamp(kNanosecondTimeScale, &info.hardwareTime, NULL);
+
+		if ((m_settings.timecodeFormat != 0) && (videoFrame->GetTimecode(m_settings.timecodeFormat, &timecode) == S_OK))
+		{
+			info.hasTimecode = 1;
+			info.timecode = timecode->GetBCD();
+			info.timecodeFlags = timecode->GetFlags();
+			timecode->GetTimecodeUserBits(&info.timecodeUserBits);
+			timecode->Release();
+		}
+
+		if (videoFrame->QueryInterface(IID_IDeckLinkVideoFrameMetadataExtensions, (void**)&metadata) == S_OK)
+		{
+			SharedFrameHDRMetadata& hdr = info.hdrMetadata;
+
+			metadata->GetInt(bmdDeckLinkFrameMetadataColorspace, &info.colorspace);
+
+			if (info.flags & bmdFrameContainsHDRMetadata)
+			{
+				info.hasHDRMetadata = 1;
+				metadata->GetInt(bmdDeckLinkFrameMetadataHDRElectroOpticalTransferFunc, &hdr.electroOpticalTransferFunction);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRDisplayPrimariesRedX, &hdr.displayPrimariesRedX);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRDisplayPrimariesRedY, &hdr.displayPrimariesRedY);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRDisplayPrimariesGreenX, &hdr.displayPrimariesGreenX);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRDisplayPrimariesGreenY, &hdr.displayPrimariesGreenY);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRDisplayPrimariesBlueX, &hdr.displayPrimariesBlueX);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRDisplayPrimariesBlueY, &hdr.displayPrimariesBlueY);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRWhitePointX, &hdr.whitePointX);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRWhitePointY, &hdr.whitePointY);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRMaxDisplayMasteringLuminance, &hdr.maxDisplayMasteringLuminance);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRMinDisplayMasteringLuminance, &hdr.minDisplayMasteringLuminance);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRMaximumContentLightLevel, &hdr.maximumContentLightLevel);
+				metadata->GetFloat(bmdDeckLinkFrameMetadataHDRMaximumFrameAverageLightLevel, &hdr.maximumFrameAverageLightLevel);
+			}
+
+			metadata->Release();
+		}
+
+		size_t videoBytes = (size_t)info.rowBytes * info.height;
+		if (videoBytes > m_settings.maxVideoBytes)
+			truncated = true;
+		else if (!(info.flags & bmdFrameHasNoInputSource) && (videoFrame->GetBytes(&bytes) == S_OK))
+		{
+			memcpy(slotBase + info.videoOffset, bytes, videoBytes);
+			info.videoBytes = videoBytes;
+		}
+
+		info.ancillaryBytes = writeAncillary(videoFrame, slotBase + info.ancillaryOffset, m_settings.maxAncillaryBytes, &info.ancillaryPacketCount, &truncated);
+	}
+
+	if (audioPacket != NULL)
+	{
+		size_t audioBytes = (size_t)audioPacket->GetSampleFrameCount() * m_settings.audioChannels * (m_settings.audioSampleDepth / 8);
+
+		info.audioChannels = m_settings.audioChannels;
+		info.audioSampleDepth = m_settings.audioSampleDepth;
+		audioPacket->GetPacketTime(&info.audioPacketTime, kNanosecondTimeScale);
+
+		if (audioBytes > m_settings.maxAudioBytes)
+			truncated = true;
+		else if (audioPacket->GetBytes(&bytes) == S_OK)
+		{
+			memcpy(slotBase + info.audioOffset, bytes, audioBytes);
+			info.audioSampleFrames = (uint32_t)audioPacket->GetSampleFrameCount();
+			info.audioBytes = audioBytes;
+		}
+	}
+
+	info.truncated = truncated ? 1 : 0;
+	if (truncated)
+		m_control->framesTruncated.fetch_add(1);
+
+	memcpy(slotBase, &info, sizeof(info));
+
+	// Publish: the slot now holds this sequence and may be pinned
+	m_control->slotState[slot].store(MakeState(info.sequence, 0), std::memory_order_release);
+	m_control->sequenceTable[info.sequence % kSequenceTableSize].store((info.sequence << 8) | slot, std::memory_order_release);
+	m_control->latestSequence.store(info.sequence, std::memory_order_release);
+	m_control->framesWritten.fetch_add(1, std::memory_order_relaxed);
+
+	m_control->wakeCounter.fetch_add(1, std::memory_order_release);
+	if (m_control->waiters.load(std::memory_order_acquire) != 0)
+		FutexWake(&m_control->wakeCounter);
+
+	return S_OK;
+}
+
+void SharedFrameRingWriter::GetStatistics(SharedFrameRingStatistics* statistics)
+{
+	memset(statistics, 0, sizeof(*statistics));
+
+	if (m_control == NULL)
+		return;
+
+	statistics->framesWritten = m_control->framesWritten.load();
+	statistics->framesDropped = m_control->framesDropped.load();
+	statistics->framesTruncated = m_control->framesTruncated.load();
+	statistics->readersReclaimed = m_control->readersReclaimed.load();
+
+	for (unsigned i = 0; i < kSharedFrameRingMaxReaders; i++)
+	{
+		if (m_control->readers[i].pid.load() > 0)
+			statistics->readersAttached++;
+	}
+}
+
+SharedFrameRingReader::SharedFrameRingReader() :
+	m_fd(-1),
+	m_control(NULL),
+	m_controlBytes(0),
+	m_data(NULL),
+	m_dataBytes(0),
+	m_readerIndex(-1),
+	m_lastSequence(0),
+	m_framesRead(0),
+	m_framesSkipped(0)
+{
+}
+
+SharedFrameRingReader::~SharedFrameRingReader()
+{
+	Close();
+}
+
+HRESULT SharedFrameRingReader::Open(const char* name)
+{
+	SharedFrameRingControl*		control;
+	struct stat					ringStat;
+	void*						mapping;
+	char						path[NAME_MAX];
+	HRESULT						result = E_FAIL;
+
+	Close();
+
+	snprintf(path, sizeof(path), "/%s", name);
+
+	m_fd = shm_open(path, O_RDWR, 0);
+	if (m_fd < 0)
+		return E_FAIL;
+
+	// A ring still being created may not have been sized yet, and touching a mapping
+	// past the end of the file raises SIGBUS
+	m_controlBytes = AlignUp(sizeof(SharedFrameRingControl), kPageSize);
+	if ((fstat(m_fd, &ringStat) != 0) || ((size_t)ringStat.st_size < m_controlBytes))
+		goto bail;
+
+	mapping = mmap(NULL, m_controlBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (mapping == MAP_FAILED)
+		goto bail;
+
+	m_control = control = (SharedFrameRingControl*)mapping;
+
+	if ((control->magic != kRingMagic) || (control->version != kRingVersion) || (control->dataOffset != m_controlBytes))
+		goto bail;
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if (control->totalBytes > (uint64_t)ringStat.st_size)
+		goto bail;
+
+	// Frame data is read only to readers
+	m_dataBytes = control->totalBytes - control->dataOffset;
+	mapping = mmap(NULL, m_dataBytes, PROT_READ, MAP_SHARED, m_fd, (off_t)control->dataOffset);
+	if (mapping == MAP_FAILED)
+		goto bail;
+	m_data = (const uint8_t*)mapping;
+
+	for (int attempt = 0; (attempt < 2) && (m_readerIndex < 0); attempt++)
+	{
+		for (unsigned i = 0; i < kSharedFrameRingMaxReaders; i++)
+		{
+			int32_t freeEntry = 0;
+			if (control->readers[i].pid.compare_exchange_strong(freeEntry, getpid()))
+			{
+				control->readers[i].pinnedSlots.store(0);
+				m_readerIndex = (int)i;
+				break;
+			}
+		}
+
+		if (m_readerIndex < 0)
+			ReclaimDeadReaders(control);
+	}
+
+	if (m_readerIndex < 0)
+	{
+		result = E_OUTOFMEMORY;
+		goto bail;
+	}
+
+	m_lastSequence = 0;
+	m_framesRead = 0;
+	m_framesSkipped = 0;
+	return S_OK;
+
+bail:
+	Close();
+	return result;
+}
+
+void SharedFrameRingReader::Close(void)
+{
+	if ((m_control != NULL) && (m_readerIndex >= 0))
+	{
+		SharedFrameRingReaderEntry& reader = m_control->readers[m_readerIndex];
+
+		// Drop any pins the application did not release
+		uint64_t pinned = reader.pinnedSlots.exchange(0);
+		for (unsigned slot = 0; slot < m_control->slotCount; slot++)
+		{
+			if (pinned & (1ULL << slot))
+				m_control->slotState[slot].fetch_sub(1, std::memory_order_release);
+		}
+
+		reader.pid.store(0, std::memory_order_release);
+		m_readerIndex = -1;
+	}
+
+	if (m_data != NULL)
+	{
+		munmap((void*)m_data, m_dataBytes);
+		m_data = NULL;
+	}
+
+	if (m_control != NULL)
+	{
+		munmap(m_control, m_controlBytes);
+		m_control = NULL;
+	}
+
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+}
+
+bool SharedFrameRingReader::pinFrame(uint64_t sequence, SharedFrame* frame)
+{
+	uint64_t	entry = m_control->sequenceTable[sequence % kSequenceTableSize].load(std::memory_order_acquire);
+	unsigned	slot = (unsigned)(entry & 0xff);
+	uint64_t	state;
+
+	if (((entry >> 8) != sequence) || (slot >= m_control->slotCount))
+		return false;
+
+	// Pin only while the slot still holds this frame and is not being rewritten
+	state = m_control->slotState[slot].load(std::memory_order_acquire);
+	do
+	{
+		if ((StateSequence(state) != sequence) || (state & kStateWriting))
+			return false;
+	}
+	while (!m_control->slotState[slot].compare_exchange_weak(state, state + 1, std::memory_order_acquire));
+
+	// Recorded after the pin, so a reader that dies in between leaks the pin rather than
+	// having the writer release one it never took
+	m_control->readers[m_readerIndex].pinnedSlots.fetch_or(1ULL << slot);
+
+	const uint8_t* slotBase = m_data + (size_t)slot * m_control->slotBytes;
+
+	frame->info = (const SharedFrameInfo*)slotBase;
+	frame->video = slotBase + frame->info->videoOffset;
+	frame->audio = slotBase + frame->info->audioOffset;
+	frame->ancillary = slotBase + frame->info->ancillaryOffset;
+	frame->skipped = (m_lastSequence != 0) ? (sequence - m_lastSequence - 1) : 0;
+	frame->slot = slot;
+
+	m_framesRead++;
+	m_framesSkipped += frame->skipped;
+	m_lastSequence = sequence;
+
+	return true;
+}
+
+HRESULT SharedFrameRingReader::AcquireFrame(SharedFrame* frame, int timeoutMilliseconds)
+{
+	if (m_control == NULL)
+		return E_FAIL;
+
+	while (true)
+	{
+		uint32_t wakeCounter = m_control->wakeCounter.load(std::memory_order_acquire);
+		uint64_t latest = m_control->latestSequence.load(std::memory_order_acquire);
+
+		if (latest > m_lastSequence)
+		{
+			// Keep up frame by frame while we can, otherwise skip to the newest
+			if ((m_lastSequence != 0) && pinFrame(m_lastSequence + 1, frame))
+				return S_OK;
+
+			if (pinFrame(latest, frame))
+				return S_OK;
+
+			// The newest frame was overwritten while we looked; try again
+			continue;
+		}
+
+		if (m_control->writerPid.load(std::memory_order_acquire) == 0)
+			return E_FAIL;
+
+		m_control->waiters.fetch_add(1);
+		bool woken = FutexWait(&m_control->wakeCounter, wakeCounter, timeoutMilliseconds);
+		m_control->waiters.fetch_sub(1);
+
+		if (!woken)
+		{
+			// A writer that crashed never closes the ring
+			int32_t writerPid = m_control->writerPid.load(std::memory_order_acquire);
+			if ((writerPid > 0) && (kill(writerPid, 0) != 0) && (errno == ESRCH))
+				return E_FAIL;
+
+			return S_FALSE;
+		}
+	}
+}
+
+void SharedFrameRingReader::ReleaseFrame(const SharedFrame& frame)
+{
+	if ((m_control == NULL) || (m_readerIndex < 0))
+		return;
+
+	m_control->readers[m_readerIndex].pinnedSlots.fetch_and(~(1ULL << frame.slot));
+	m_control->slotState[frame.slot].fetch_sub(1, std::memory_order_release);
+}
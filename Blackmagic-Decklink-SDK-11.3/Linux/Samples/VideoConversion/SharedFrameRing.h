@@ -0,0 +1,222 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DeckLinkAPI.h"
+
+const unsigned kSharedFrameRingMaxSlots		= 64;
+const unsigned kSharedFrameRingMaxReaders	= 32;
+
+struct SharedFrameHDRMetadata
+{
+	int64_t		electroOpticalTransferFunction;
+	double		displayPrimariesRedX;
+	double		displayPrimariesRedY;
+	double		displayPrimariesGreenX;
+	double		displayPrimariesGreenY;
+	double		displayPrimariesBlueX;
+	double		displayPrimariesBlueY;
+	double		whitePointX;
+	double		whitePointY;
+	double		maxDisplayMasteringLuminance;
+	double		minDisplayMasteringLuminance;
+	double		maximumContentLightLevel;
+	double		maximumFrameAverageLightLevel;
+};
+
+// Describes one captured frame in the ring. Offsets are from the start of the info.
+struct SharedFrameInfo
+{
+	uint64_t				sequence;				// Starts at 1 and counts every frame written
+	BMDTimeValue			streamTime;
+	BMDTimeValue			frameDuration;
+	BMDTimeScale			timeScale;
+	BMDTimeValue			hardwareTime;			// Hardware reference timestamp, in nanoseconds
+
+	int32_t					width;
+	int32_t					height;
+	int32_t					rowBytes;
+	BMDPixelFormat			pixelFormat;
+	BMDFrameFlags			flags;
+	int64_t					colorspace;				// BMDColorspace, or -1 when not reported
+
+	uint32_t				hasTimecode;
+	BMDTimecodeBCD			timecode;
+	BMDTimecodeFlags		timecodeFlags;
+	BMDTimecodeUserBits		timecodeUserBits;
+
+	uint32_t				hasHDRMetadata;
+	SharedFrameHDRMetadata	hdrMetadata;
+
+	uint32_t				audioSampleFrames;
+	uint32_t				audioChannels;
+	uint32_t				audioSampleDepth;
+	BMDTimeValue			audioPacketTime;		// In timeScale units
+
+	uint32_t				ancillaryPacketCount;
+	uint32_t				truncated;				// Video, audio or ancillary data did not fit the slot and was left out
+
+	uint64_t				videoOffset;
+	uint64_t				videoBytes;
+	uint64_t				audioOffset;
+	uint64_t				audioBytes;
+	uint64_t				ancillaryOffset;
+	uint64_t				ancillaryBytes;
+};
+
+// Ancillary packets follow one another, each header followed by its 8-bit data padded
+// to a multiple of four bytes
+struct SharedAncillaryPacket
+{
+	uint8_t		did;
+	uint8_t		sdid;
+	uint8_t		dataStreamIndex;
+	uint8_t		reserved;
+	uint32_t	lineNumber;
+	uint32_t	size;
+};
+
+struct SharedFrameRingSettings
+{
+	unsigned			slotCount;
+	size_t				maxVideoBytes;
+	size_t				maxAudioBytes;
+	size_t				maxAncillaryBytes;
+	BMDTimecodeFormat	timecodeFormat;			// 0 to leave timecode out
+	unsigned			audioChannels;
+	unsigned			audioSampleDepth;
+
+	SharedFrameRingSettings() :
+		slotCount(8),
+		maxVideoBytes(0),
+		maxAudioBytes(0),
+		maxAncillaryBytes(64 * 1024),
+		timecodeFormat(0),
+		audioChannels(2),
+		audioSampleDepth(16)
+	{ }
+};
+
+struct SharedFrameRingStatistics
+{
+	uint64_t	framesWritten;
+	uint64_t	framesDropped;			// No slot was free because readers had pinned them all
+	uint64_t	framesTruncated;
+	uint64_t	readersReclaimed;		// Readers that exited without detaching, whose pins were released
+	unsigned	readersAttached;
+};
+
+struct SharedFrameRingControl;
+
+// Publishes captured frames, their audio and their metadata (timecode, HDR metadata,
+// ancillary packets) into a POSIX shared memory ring, for any number of local
+// SharedFrameRingReader processes.
+//
+// The writer never waits for readers. Each slot has a state word holding the sequence
+// number of the frame in it, a writing flag and a count of readers pinning it. The
+// writer takes the next slot that no reader has pinned, so readers can read a frame in
+// place for as long as they hold it, and a reader that falls behind finds its next
+// frame overwritten and skips ahead to the newest. Only when readers pin every slot is a
+// frame dropped. Pins held by a reader process that exits without detaching are
+// released by the writer.
+class SharedFrameRingWriter
+{
+public:
+	SharedFrameRingWriter();
+	~SharedFrameRingWriter();
+
+	// Creates /dev/shm/<name>, replacing one left behind by an earlier writer
+	HRESULT		Create(const char* name, const SharedFrameRingSettings& settings);
+	void		Close(void);
+
+	// Copies a captured frame into the ring. Returns S_FALSE when the frame was dropped.
+	HRESULT		WriteFrame(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket);
+
+	void		GetStatistics(SharedFrameRingStatistics* statistics);
+
+private:
+	bool		claimSlot(unsigned* slot);
+	size_t		writeAncillary(IDeckLinkVideoInputFrame* videoFrame, uint8_t* destination, size_t capacity, uint32_t* packetCount, bool* truncated);
+
+	char*						m_name;
+	int							m_fd;
+	SharedFrameRingControl*		m_control;
+	uint8_t*					m_data;
+	size_t						m_mappedBytes;
+	SharedFrameRingSettings		m_settings;
+	unsigned					m_nextSlot;
+	uint64_t					m_sequence;
+};
+
+// A frame pinned by a reader. The pointers stay valid until ReleaseFrame().
+struct SharedFrame
+{
+	const SharedFrameInfo*	info;
+	const void*				video;
+	const void*				audio;
+	const uint8_t*			ancillary;
+	uint64_t				skipped;				// Frames written since the previous frame this reader acquired
+	unsigned				slot;
+};
+
+// Attaches to a SharedFrameRingWriter's ring. The frame data is mapped read only and
+// read in place.
+class SharedFrameRingReader
+{
+public:
+	SharedFrameRingReader();
+	~SharedFrameRingReader();
+
+	HRESULT		Open(const char* name);
+	void		Close(void);
+
+	// Pins the frame after the last one acquired or, when that has been overwritten, the
+	// newest frame. The first call starts with the newest frame. Waits up to
+	// timeoutMilliseconds for a new frame, returning S_FALSE on timeout and E_FAIL once
+	// the writer has closed the ring.
+	HRESULT		AcquireFrame(SharedFrame* frame, int timeoutMilliseconds);
+	void		ReleaseFrame(const SharedFrame& frame);
+
+	uint64_t	GetFramesRead(void) const		{ return m_framesRead; }
+	uint64_t	GetFramesSkipped(void) const	{ return m_framesSkipped; }
+
+private:
+	bool		pinFrame(uint64_t sequence, SharedFrame* frame);
+
+	int							m_fd;
+	SharedFrameRingControl*		m_control;
+	size_t						m_controlBytes;
+	const uint8_t*				m_data;
+	size_t						m_dataBytes;
+	int							m_readerIndex;
+	uint64_t					m_lastSequence;
+	uint64_t					m_framesRead;
+	uint64_t					m_framesSkipped;
+};
@@ -0,0 +1,461 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TIMECODE_X86_KERNELS 1
+#endif
+
+// SMPTE 12M timecode arithmetic for a frame rate fixed at compile time. Each TimecodeRate
+// converts between a frame count from 00:00:00:00, timecode components and the packed
+// BCD of IDeckLinkTimecode::GetBCD (0xHHMMSSFF) in a constant number of operations: all
+// of the divisors are compile-time constants, so there are no division instructions, no
+// loops over minutes and no tables. Every conversion is constexpr.
+//
+// Timecode counts frames at the nominal rate, so 23.976 fps counts as 24 and 29.97 fps as
+// 30. Drop frame timecode, at 29.97, 59.94 and 119.88 fps, skips the first 2, 4 or 8
+// frame numbers of each minute except every tenth. Frame counts wrap at 24 hours.
+//
+// The batch conversions, for a recording index for example, convert 8 frames at a time
+// with AVX2 when the CPU supports it. For frame rates only known at runtime,
+// GetTimecodeKernel() returns the conversions of the matching TimecodeRate.
+
+struct TimecodeComponents
+{
+	uint8_t		hours;
+	uint8_t		minutes;
+	uint8_t		seconds;
+	uint8_t		frames;
+};
+
+// RP188 VITC timecodes that carry a frame's timecode (SMPTE ST 12-2:2014 7.2)
+enum TimecodeVitcFields
+{
+	kTimecodeVitcNone	= 0,
+	kTimecodeVitc1		= 1,
+	kTimecodeVitc2		= 2,
+	kTimecodeVitcBoth	= kTimecodeVitc1 | kTimecodeVitc2
+};
+
+// One BCD byte. The frame numbers from 100 of 119.88 and 120 fps timecode have a tens
+// digit of 10 or 11. (value * 103) >> 10 is value / 10 for values below 179.
+constexpr uint32_t TimecodeValueToBCD(unsigned value)
+{
+	return value + 6 * ((value * 103) >> 10);
+}
+
+constexpr unsigned TimecodeBCDToValue(uint32_t bcd)
+{
+	return ((bcd >> 4) & 0xf) * 10 + (bcd & 0xf);
+}
+
+constexpr unsigned TimecodeCeilLog2(uint64_t value, unsigned bits = 0)
+{
+	return ((1ULL << bits) >= value) ? bits : TimecodeCeilLog2(value, bits + 1);
+}
+
+// Division of values below 2^Bits by a constant, as a multiplication and a shift. The
+// multiplier rounds 2^Shift / Divisor up by less than Divisor / 2^Shift, and the error
+// this adds to a quotient stays below 1 / Divisor, so the result is exact.
+template <uint32_t Divisor, unsigned Bits>
+struct TimecodeDivisor
+{
+	static constexpr unsigned	kShift		= Bits + TimecodeCeilLog2(Divisor);
+	static constexpr uint64_t	kMultiplier	= ((1ULL << kShift) + Divisor - 1) / Divisor;
+
+	static_assert(kMultiplier <= 0xffffffffULL, "The multiplier must fit a 32-bit lane");
+};
+
+#if defined(TIMECODE_X86_KERNELS)
+
+inline bool TimecodeHasAVX2(void)
+{
+	static const bool hasAVX2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+	return hasAVX2;
+}
+
+// Eight 32-bit quotients, from the even and odd lanes' 64-bit products
+template <uint32_t Divisor, unsigned Bits>
+__attribute__((target("avx2")))
+inline __m256i TimecodeDivideAVX2(__m256i values)
+{
+	typedef TimecodeDivisor<Divisor, Bits> D;
+	const __m256i multiplier = _mm256_set1_epi64x((long long)D::kMultiplier);
+
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(values, multiplier), D::kShift);
+	__m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(values, 32), multiplier), D::kShift);
+	return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+__attribute__((target("avx2")))
+inline __m256i TimecodeValueToBCDAVX2(__m256i values)
+{
+	__m256i tens = _mm256_srli_epi32(_mm256_mullo_epi32(values, _mm256_set1_epi32(103)), 10);
+	return _mm256_add_epi32(values, _mm256_mullo_epi32(tens, _mm256_set1_epi32(6)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i TimecodeBCDToValueAVX2(__m256i bcd)
+{
+	__m256i tens = _mm256_and_si256(_mm256_srli_epi32(bcd, 4), _mm256_set1_epi32(0xf));
+	__m256i units = _mm256_and_si256(bcd, _mm256_set1_epi32(0xf));
+	return _mm256_add_epi32(_mm256_mullo_epi32(tens, _mm256_set1_epi32(10)), units);
+}
+
+#endif
+
+template <unsigned FramesPerSecond, bool DropFrame>
+struct TimecodeRate
+{
+	static_assert((FramesPerSecond > 0) && (FramesPerSecond <= 120), "Timecode frame rates run from 1 to 120 fps");
+	static_assert(!DropFrame || (FramesPerSecond % 30 == 0), "Drop frame timecode is defined for 29.97, 59.94 and 119.88 fps");
+
+	static constexpr unsigned	kFramesPerSecond		= FramesPerSecond;
+	static constexpr bool		kDropFrame				= DropFrame;
+
+	// Frame numbers skipped at the start of each minute that is not a multiple of ten
+	static constexpr unsigned	kDroppedFrames			= DropFrame ? FramesPerSecond / 15 : 0;
+
+	static constexpr uint32_t	kFramesPerMinute		= FramesPerSecond * 60 - kDroppedFrames;
+	static constexpr uint32_t	kFramesPerTenMinutes	= FramesPerSecond * 600 - 9 * kDroppedFrames;
+	static constexpr uint32_t	kFramesPerDay			= 144 * kFramesPerTenMinutes;
+
+	static constexpr TimecodeComponents FromFrameCount(uint32_t frameCount)
+	{
+		return labelToComponents(frameCountToLabel(frameCount % kFramesPerDay));
+	}
+
+	static constexpr uint32_t ToFrameCount(const TimecodeComponents& timecode)
+	{
+		return ToFrameCount(timecode.hours, timecode.minutes, timecode.seconds, timecode.frames);
+	}
+
+	static constexpr uint32_t ToFrameCount(unsigned hours, unsigned minutes, unsigned seconds, unsigned frames)
+	{
+		return ((hours * 3600 + minutes * 60 + seconds) * FramesPerSecond + frames)
+			- kDroppedFrames * ((hours * 60 + minutes) - (hours * 60 + minutes) / 10);
+	}
+
+	static constexpr uint32_t ToBCD(uint32_t frameCount)
+	{
+		return labelToBCD(frameCountToLabel(frameCount % kFramesPerDay));
+	}
+
+	static constexpr uint32_t FromBCD(uint32_t bcd)
+	{
+		return ToFrameCount(BCDToComponents(bcd));
+	}
+
+	static constexpr uint32_t ComponentsToBCD(const TimecodeComponents& timecode)
+	{
+		return (TimecodeValueToBCD(timecode.hours) << 24) | (TimecodeValueToBCD(timecode.minutes) << 16)
+			| (TimecodeValueToBCD(timecode.seconds) << 8) | TimecodeValueToBCD(timecode.frames);
+	}
+
+	static constexpr TimecodeComponents BCDToComponents(uint32_t bcd)
+	{
+		return TimecodeComponents{ (uint8_t)TimecodeBCDToValue(bcd >> 24), (uint8_t)TimecodeBCDToValue(bcd >> 16),
+								   (uint8_t)TimecodeBCDToValue(bcd >> 8), (uint8_t)TimecodeBCDToValue(bcd) };
+	}
+
+	// Batch conversions, with the same results as the conversions above
+	static void ToBCD(const uint32_t* frameCounts, uint32_t* bcd, size_t count)
+	{
+		size_t i = 0;
+
+#if defined(TIMECODE_X86_KERNELS)
+		if (TimecodeHasAVX2())
+			i = toBCDAVX2(frameCounts, bcd, count);
+#endif
+		for (; i < count; i++)
+			bcd[i] = ToBCD(frameCounts[i]);
+	}
+
+	static void FromBCD(const uint32_t* bcd, uint32_t* frameCounts, size_t count)
+	{
+		size_t i = 0;
+
+#if defined(TIMECODE_X86_KERNELS)
+		if (TimecodeHasAVX2())
+			i = fromBCDAVX2(bcd, frameCounts, count);
+#endif
+		for (; i < count; i++)
+			frameCounts[i] = FromBCD(bcd[i]);
+	}
+
+	// Interlaced and PsF frames carry their timecode in both VITC timecodes. Progressive
+	// frames up to 30 fps use VITC1. From 31 to 60 fps the frame number is halved, and
+	// frames with an even number use VITC1 and odd ones VITC2. Faster rates have only the
+	// high frame rate timecode.
+	static constexpr unsigned GetVitcFields(unsigned frames, bool progressive)
+	{
+		return !progressive ? kTimecodeVitcBoth
+			: (FramesPerSecond <= 30) ? kTimecodeVitc1
+			: (FramesPerSecond <= 60) ? ((frames & 1) ? kTimecodeVitc2 : kTimecodeVitc1)
+			: kTimecodeVitcNone;
+	}
+
+	static constexpr uint8_t GetVitcFrames(unsigned frames, bool progressive)
+	{
+		return (uint8_t)((progressive && (FramesPerSecond > 30)) ? (frames >> 1) : frames);
+	}
+
+private:
+	// Adds the frame numbers dropped before a frame, giving its position counted at the
+	// nominal rate
+	static constexpr uint32_t frameCountToLabel(uint32_t frameCount)
+	{
+		return !DropFrame ? frameCount
+			: frameCount + 9 * kDroppedFrames * (frameCount / kFramesPerTenMinutes)
+				+ ((frameCount % kFramesPerTenMinutes < kDroppedFrames) ? 0
+				   : kDroppedFrames * ((frameCount % kFramesPerTenMinutes - kDroppedFrames) / kFramesPerMinute));
+	}
+
+	// Each division's remainder is taken from its quotient, so a label costs three
+	// multiplications by reciprocals
+	static constexpr TimecodeComponents labelToComponents(uint32_t label)
+	{
+		return secondsToComponents(label / FramesPerSecond, label % FramesPerSecond);
+	}
+
+	static constexpr TimecodeComponents secondsToComponents(uint32_t seconds, uint32_t frames)
+	{
+		return minutesToComponents(seconds / 60, seconds % 60, frames);
+	}
+
+	static constexpr TimecodeComponents minutesToComponents(uint32_t minutes, uint32_t seconds, uint32_t frames)
+	{
+		return TimecodeComponents{ (uint8_t)(minutes / 60), (uint8_t)(minutes % 60), (uint8_t)seconds, (uint8_t)frames };
+	}
+
+	// As labelToComponents(), without the byte fields in between, which keeps the batch
+	// conversion in 32-bit lanes
+	static constexpr uint32_t labelToBCD(uint32_t label)
+	{
+		return secondsToBCD(label / FramesPerSecond, label % FramesPerSecond);
+	}
+
+	static constexpr uint32_t secondsToBCD(uint32_t seconds, uint32_t frames)
+	{
+		return minutesToBCD(seconds / 60, seconds % 60, frames);
+	}
+
+	static constexpr uint32_t minutesToBCD(uint32_t minutes, uint32_t seconds, uint32_t frames)
+	{
+		return (TimecodeValueToBCD(minutes / 60) << 24) | (TimecodeValueToBCD(minutes % 60) << 16)
+			| (TimecodeValueToBCD(seconds) << 8) | TimecodeValueToBCD(frames);
+	}
+
+#if defined(TIMECODE_X86_KERNELS)
+	// Returns the number of frames converted, a multiple of 8
+	__attribute__((target("avx2")))
+	static size_t toBCDAVX2(const uint32_t* frameCounts, uint32_t* bcd, size_t count)
+	{
+		// Bringing frame counts from 2^31 up below 2^31 keeps the day's divisor within 32 bits
+		const __m256i	dayMultiple = _mm256_set1_epi32((int)((0x80000000U / kFramesPerDay) * kFramesPerDay));
+		const __m256i	framesPerDay = _mm256_set1_epi32(kFramesPerDay);
+		const __m256i	framesPerTenMinutes = _mm256_set1_epi32(kFramesPerTenMinutes);
+		const __m256i	droppedFrames = _mm256_set1_epi32(kDroppedFrames);
+		const __m256i	framesPerSecond = _mm256_set1_epi32(FramesPerSecond);
+		const __m256i	sixty = _mm256_set1_epi32(60);
+		size_t			i = 0;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i n = _mm256_loadu_si256((const __m256i*)(frameCounts + i));
+			__m256i label;
+			__m256i seconds;
+			__m256i minutes;
+			__m256i hours;
+			__m256i frames;
+
+			n = _mm256_sub_epi32(n, _mm256_and_si256(_mm256_srai_epi32(n, 31), dayMultiple));
+			n = _mm256_sub_epi32(n, _mm256_and_si256(_mm256_srai_epi32(n, 31), dayMultiple));
+			n = _mm256_sub_epi32(n, _mm256_mullo_epi32(TimecodeDivideAVX2<kFramesPerDay, 31>(n), framesPerDay));
+
+			label = n;
+			if (DropFrame)
+			{
+				__m256i tenMinutes = TimecodeDivideAVX2<kFramesPerTenMinutes, 24>(n);
+				__m256i remainder = _mm256_sub_epi32(n, _mm256_mullo_epi32(tenMinutes, framesPerTenMinutes));
+				__m256i minuteFrames = _mm256_max_epi32(_mm256_sub_epi32(remainder, droppedFrames), _mm256_setzero_si256());
+
+				label = _mm256_add_epi32(label, _mm256_mullo_epi32(tenMinutes, _mm256_set1_epi32(9 * kDroppedFrames)));
+				label = _mm256_add_epi32(label, _mm256_mullo_epi32(TimecodeDivideAVX2<kFramesPerMinute, 24>(minuteFrames), droppedFrames));
+			}
+
+			seconds = TimecodeDivideAVX2<FramesPerSecond, 24>(label);
+			frames = _mm256_sub_epi32(label, _mm256_mullo_epi32(seconds, framesPerSecond));
+			minutes = TimecodeDivideAVX2<60, 24>(seconds);
+			seconds = _mm256_sub_epi32(seconds, _mm256_mullo_epi32(minutes, sixty));
+			hours = TimecodeDivideAVX2<60, 24>(minutes);
+			minutes = _mm256_sub_epi32(minutes, _mm256_mullo_epi32(hours, sixty));
+
+			__m256i result = _mm256_or_si256(
+				_mm256_or_si256(_mm256_slli_epi32(TimecodeValueToBCDAVX2(hours), 24), _mm256_slli_epi32(TimecodeValueToBCDAVX2(minutes), 16)),
+				_mm256_or_si256(_mm256_slli_epi32(TimecodeValueToBCDAVX2(seconds), 8), TimecodeValueToBCDAVX2(frames)));
+			_mm256_storeu_si256((__m256i*)(bcd + i), result);
+		}
+
+		return i;
+	}
+
+	__attribute__((target("avx2")))
+	static size_t fromBCDAVX2(const uint32_t* bcd, uint32_t* frameCounts, size_t count)
+	{
+		const __m256i	byteMask = _mm256_set1_epi32(0xff);
+		const __m256i	sixty = _mm256_set1_epi32(60);
+		size_t			i = 0;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i timecode = _mm256_loadu_si256((const __m256i*)(bcd + i));
+			__m256i hours = TimecodeBCDToValueAVX2(_mm256_srli_epi32(timecode, 24));
+			__m256i minutes = TimecodeBCDToValueAVX2(_mm256_and_si256(_mm256_srli_epi32(timecode, 16), byteMask));
+			__m256i seconds = TimecodeBCDToValueAVX2(_mm256_and_si256(_mm256_srli_epi32(timecode, 8), byteMask));
+			__m256i frames = TimecodeBCDToValueAVX2(_mm256_and_si256(timecode, byteMask));
+			__m256i totalMinutes = _mm256_add_epi32(_mm256_mullo_epi32(hours, sixty), minutes);
+			__m256i totalSeconds = _mm256_add_epi32(_mm256_mullo_epi32(totalMinutes, sixty), seconds);
+			__m256i result = _mm256_add_epi32(_mm256_mullo_epi32(totalSeconds, _mm256_set1_epi32(FramesPerSecond)), frames);
+
+			if (DropFrame)
+			{
+				__m256i droppedMinutes = _mm256_sub_epi32(totalMinutes, TimecodeDivideAVX2<10, 16>(totalMinutes));
+				result = _mm256_sub_epi32(result, _mm256_mullo_epi32(droppedMinutes, _mm256_set1_epi32(kDroppedFrames)));
+			}
+
+			_mm256_storeu_si256((__m256i*)(frameCounts + i), result);
+		}
+
+		return i;
+	}
+#endif
+};
+
+template <unsigned FramesPerSecond, bool DropFrame> constexpr unsigned TimecodeRate<FramesPerSecond, DropFrame>::kFramesPerSecond;
+template <unsigned FramesPerSecond, bool DropFrame> constexpr bool TimecodeRate<FramesPerSecond, DropFrame>::kDropFrame;
+template <unsigned FramesPerSecond, bool DropFrame> constexpr unsigned TimecodeRate<FramesPerSecond, DropFrame>::kDroppedFrames;
+template <unsigned FramesPerSecond, bool DropFrame> constexpr uint32_t TimecodeRate<FramesPerSecond, DropFrame>::kFramesPerMinute;
+template <unsigned FramesPerSecond, bool DropFrame> constexpr uint32_t TimecodeRate<FramesPerSecond, DropFrame>::kFramesPerTenMinutes;
+template <unsigned FramesPerSecond, bool DropFrame> constexpr uint32_t TimecodeRate<FramesPerSecond, DropFrame>::kFramesPerDay;
+
+// The timecode rate of a frame rate given as a DeckLink frame duration and time scale
+template <int64_t TimeScale, int64_t FrameDuration, bool DropFrame = false>
+using TimecodeRateOf = TimecodeRate<(unsigned)((TimeScale + FrameDuration - 1) / FrameDuration), DropFrame>;
+
+typedef TimecodeRate<24, false>		TimecodeRate23_976;
+typedef TimecodeRate<24, false>		TimecodeRate24;
+typedef TimecodeRate<25, false>		TimecodeRate25;
+typedef TimecodeRate<30, false>		TimecodeRate29_97;
+typedef TimecodeRate<30, true>		TimecodeRate29_97DF;
+typedef TimecodeRate<30, false>		TimecodeRate30;
+typedef TimecodeRate<48, false>		TimecodeRate47_95;
+typedef TimecodeRate<48, false>		TimecodeRate48;
+typedef TimecodeRate<50, false>		TimecodeRate50;
+typedef TimecodeRate<60, false>		TimecodeRate59_94;
+typedef TimecodeRate<60, true>		TimecodeRate59_94DF;
+typedef TimecodeRate<60, false>		TimecodeRate60;
+typedef TimecodeRate<100, false>	TimecodeRate100;
+typedef TimecodeRate<120, false>	TimecodeRate119_88;
+typedef TimecodeRate<120, true>		TimecodeRate119_88DF;
+typedef TimecodeRate<120, false>	TimecodeRate120;
+
+// The conversions of one TimecodeRate
+struct TimecodeKernel
+{
+	unsigned			framesPerSecond;
+	bool				dropFrame;
+	uint32_t			framesPerDay;
+	TimecodeComponents	(*fromFrameCount)(uint32_t frameCount);
+	uint32_t			(*toFrameCount)(const TimecodeComponents& timecode);
+	uint32_t			(*toBCD)(uint32_t frameCount);
+	uint32_t			(*fromBCD)(uint32_t bcd);
+	void				(*toBCDBatch)(const uint32_t* frameCounts, uint32_t* bcd, size_t count);
+	void				(*fromBCDBatch)(const uint32_t* bcd, uint32_t* frameCounts, size_t count);
+	unsigned			(*getVitcFields)(unsigned frames, bool progressive);
+	uint8_t				(*getVitcFrames)(unsigned frames, bool progressive);
+};
+
+template <typename Rate>
+constexpr TimecodeKernel MakeTimecodeKernel(void)
+{
+	return TimecodeKernel{
+		Rate::kFramesPerSecond, Rate::kDropFrame, Rate::kFramesPerDay,
+		&Rate::FromFrameCount,
+		static_cast<uint32_t (*)(const TimecodeComponents&)>(&Rate::ToFrameCount),
+		static_cast<uint32_t (*)(uint32_t)>(&Rate::ToBCD),
+		static_cast<uint32_t (*)(uint32_t)>(&Rate::FromBCD),
+		static_cast<void (*)(const uint32_t*, uint32_t*, size_t)>(&Rate::ToBCD),
+		static_cast<void (*)(const uint32_t*, uint32_t*, size_t)>(&Rate::FromBCD),
+		&Rate::GetVitcFields,
+		&Rate::GetVitcFrames
+	};
+}
+
+// Returns the conversions for a DeckLink frame rate, or NULL when there are none: drop
+// frame is only defined for 29.97, 59.94 and 119.88 fps.
+inline const TimecodeKernel* GetTimecodeKernel(BMDTimeValue frameDuration, BMDTimeScale timeScale, bool dropFrame)
+{
+	static const TimecodeKernel kKernels[] =
+	{
+		MakeTimecodeKernel<TimecodeRate24>(),
+		MakeTimecodeKernel<TimecodeRate25>(),
+		MakeTimecodeKernel<TimecodeRate30>(),
+		MakeTimecodeKernel<TimecodeRate29_97DF>(),
+		MakeTimecodeKernel<TimecodeRate48>(),
+		MakeTimecodeKernel<TimecodeRate50>(),
+		MakeTimecodeKernel<TimecodeRate60>(),
+		MakeTimecodeKernel<TimecodeRate59_94DF>(),
+		MakeTimecodeKernel<TimecodeRate100>(),
+		MakeTimecodeKernel<TimecodeRate120>(),
+		MakeTimecodeKernel<TimecodeRate119_88DF>()
+	};
+	unsigned framesPerSecond;
+
+	if ((frameDuration <= 0) || (timeScale <= 0))
+		return NULL;
+
+	framesPerSecond = (unsigned)((timeScale + frameDuration - 1) / frameDuration);
+
+	// Drop frame counts are only right for the 1000/1001 rates
+	if (dropFrame && ((timeScale * 1001) % (frameDuration * 1000) != 0 || (timeScale * 1001) / (frameDuration * 1000) != framesPerSecond))
+		return NULL;
+
+	for (const TimecodeKernel& kernel : kKernels)
+	{
+		if ((kernel.framesPerSecond == framesPerSecond) && (kernel.dropFrame == dropFrame))
+			return &kernel;
+	}
+
+	return NULL;
+}
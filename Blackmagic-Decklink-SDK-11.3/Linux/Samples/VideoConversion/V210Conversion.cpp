@@ -0,0 +1,926 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "V210Conversion.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define V210_X86_KERNELS 1
+#endif
+
+// v210 packs 6 pixels (12 components) into 4 little-endian 32-bit words:
+//   word 0: Cb0 Y0 Cr0,  word 1: Y1 Cb1 Y2,  word 2: Cr1 Y3 Cb2,  word 3: Y4 Cr2 Y5
+// which is the same component order as 2vuy, 10 bits at a time.
+static const long		kPixelsPerGroup			= 6;
+static const long		kComponentsPerGroup		= 12;
+static const long		kBytesPerGroup			= 16;
+
+static const uint16_t	kBlackLuma				= 64;
+static const uint16_t	kBlackChroma			= 512;
+
+struct ColorMatrix;
+
+typedef void (*UnpackV210Func)(const uint8_t* src, uint16_t* components, long groupCount);
+typedef void (*PackV210Func)(const uint16_t* components, uint8_t* dst, long groupCount);
+typedef void (*ComponentsToBGRAFunc)(const uint16_t* components, uint8_t* dst, long width, const ColorMatrix& matrix);
+typedef void (*BGRAToComponentsFunc)(const uint8_t* src, uint16_t* components, long width, const ColorMatrix& matrix);
+
+static long componentBufferSize(long width)
+{
+	// Whole groups, plus room for the widest SIMD store past the end
+	return ((width + kPixelsPerGroup - 1) / kPixelsPerGroup) * kComponentsPerGroup + 48;
+}
+
+// A row of components for the calling thread, so converting frames does not allocate
+static uint16_t* getComponentRow(long width)
+{
+	static thread_local std::vector<uint16_t> t_components;
+
+	if ((long)t_components.size() < componentBufferSize(width))
+		t_components.resize(componentBufferSize(width));
+
+	return t_components.data();
+}
+
+/* v210 unpack */
+
+static void unpackV210Scalar(const uint8_t* src, uint16_t* components, long groupCount)
+{
+	const uint32_t* words = (const uint32_t*)src;
+
+	for (long i = 0; i < groupCount * 4; i++)
+	{
+		uint32_t word = words[i];
+		components[0] = word & 0x3ff;
+		components[1] = (word >> 10) & 0x3ff;
+		components[2] = (word >> 20) & 0x3ff;
+		components += 3;
+	}
+}
+
+#if defined(V210_X86_KERNELS)
+
+// Each 16-bit lane gathers the two bytes holding one component. Multiplying by
+// 16, 4 or 1 and shifting right by 4 then extracts bits 0, 2 or 4 of the lane.
+// Three overlapping loads at byte offsets 0, 8 and 16 of every pair of groups
+// yield 8 components each.
+static const int8_t kV210Shuffle[3][16] =
+{
+	{  0,  1,  1,  2,  2,  3,  4,  5,  5,  6,  6,  7,  8,  9,  9, 10 },
+	{  2,  3,  4,  5,  5,  6,  6,  7,  8,  9,  9, 10, 10, 11, 12, 13 },
+	{  5,  6,  6,  7,  8,  9,  9, 10, 10, 11, 12, 13, 13, 14, 14, 15 },
+};
+
+static const int16_t kV210Multiplier[3][8] =
+{
+	{ 16, 4, 1, 16, 4, 1, 16, 4 },
+	{ 1, 16, 4, 1, 16, 4, 1, 16 },
+	{ 4, 1, 16, 4, 1, 16, 4, 1 },
+};
+
+__attribute__((target("ssse3")))
+static void unpackV210SSSE3(const uint8_t* src, uint16_t* components, long groupCount)
+{
+	const __m128i	mask = _mm_set1_epi16(0x3ff);
+	__m128i			shuffle[3];
+	__m128i			multiplier[3];
+	long			group = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		shuffle[i] = _mm_loadu_si128((const __m128i*)kV210Shuffle[i]);
+		multiplier[i] = _mm_loadu_si128((const __m128i*)kV210Multiplier[i]);
+	}
+
+	for (; group + 2 <= groupCount; group += 2)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			__m128i lanes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 8)), shuffle[i]);
+			lanes = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(lanes, multiplier[i]), 4), mask);
+			_mm_storeu_si128((__m128i*)(components + i * 8), lanes);
+		}
+
+		src += 2 * kBytesPerGroup;
+		components += 2 * kComponentsPerGroup;
+	}
+
+	unpackV210Scalar(src, components, groupCount - group);
+}
+
+__attribute__((target("avx2")))
+static void unpackV210AVX2(const uint8_t* src, uint16_t* components, long groupCount)
+{
+	const __m256i	mask = _mm256_set1_epi16(0x3ff);
+	__m256i			shuffle[3];
+	__m256i			multiplier[3];
+	long			group = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		shuffle[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kV210Shuffle[i]));
+		multiplier[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kV210Multiplier[i]));
+	}
+
+	// Four groups per iteration: groups 0-1 in the low lane, groups 2-3 in the high lane
+	for (; group + 4 <= groupCount; group += 4)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			__m256i lanes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + i * 8))),
+													_mm_loadu_si128((const __m128i*)(src + 32 + i * 8)), 1);
+			lanes = _mm256_shuffle_epi8(lanes, shuffle[i]);
+			lanes = _mm256_and_si256(_mm256_srli_epi16(_mm256_mullo_epi16(lanes, multiplier[i]), 4), mask);
+			_mm_storeu_si128((__m128i*)(components + i * 8), _mm256_castsi256_si128(lanes));
+			_mm_storeu_si128((__m128i*)(components + 24 + i * 8), _mm256_extracti128_si256(lanes, 1));
+		}
+
+		src += 4 * kBytesPerGroup;
+		components += 4 * kComponentsPerGroup;
+	}
+
+	unpackV210SSSE3(src, components, groupCount - group);
+}
+
+#endif
+
+/* v210 pack */
+
+static void packV210Scalar(const uint16_t* components, uint8_t* dst, long groupCount)
+{
+	uint32_t* words = (uint32_t*)dst;
+
+	for (long i = 0; i < groupCount * 4; i++)
+	{
+		words[i] = (uint32_t)components[0] | ((uint32_t)components[1] << 10) | ((uint32_t)components[2] << 20);
+		components += 3;
+	}
+}
+
+#if defined(V210_X86_KERNELS)
+
+// Each 32-bit lane gathers the first two components of a v210 word, which a multiply-add
+// by (1, 1024) combines, and separately its third component, shifted into bits 20-29.
+// One load holds components 0-7 of a group and a second components 4-11, so together they
+// cover the four words of the group.
+static const int8_t kV210PairShuffle[2][16] =
+{
+	{  0,  1,  2,  3,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ -1, -1, -1, -1, -1, -1, -1, -1,  4,  5,  6,  7, 10, 11, 12, 13 },
+};
+
+static const int8_t kV210ThirdShuffle[2][16] =
+{
+	{  4,  5, -1, -1, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ -1, -1, -1, -1, -1, -1, -1, -1,  8,  9, -1, -1, 14, 15, -1, -1 },
+};
+
+__attribute__((target("avx2")))
+static void packV210AVX2(const uint16_t* components, uint8_t* dst, long groupCount)
+{
+	const __m256i	multiplier = _mm256_set1_epi32(1 | (1024 << 16));
+	__m256i			pairShuffle[2];
+	__m256i			thirdShuffle[2];
+	long			group = 0;
+
+	for (int i = 0; i < 2; i++)
+	{
+		pairShuffle[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kV210PairShuffle[i]));
+		thirdShuffle[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kV210ThirdShuffle[i]));
+	}
+
+	// Two groups per iteration, one in each lane
+	for (; group + 2 <= groupCount; group += 2)
+	{
+		__m256i first = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)components)),
+												_mm_loadu_si128((const __m128i*)(components + kComponentsPerGroup)), 1);
+		__m256i second = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(components + 4))),
+												 _mm_loadu_si128((const __m128i*)(components + kComponentsPerGroup + 4)), 1);
+		__m256i pairs = _mm256_or_si256(_mm256_shuffle_epi8(first, pairShuffle[0]), _mm256_shuffle_epi8(second, pairShuffle[1]));
+		__m256i thirds = _mm256_or_si256(_mm256_shuffle_epi8(first, thirdShuffle[0]), _mm256_shuffle_epi8(second, thirdShuffle[1]));
+
+		_mm256_storeu_si256((__m256i*)dst, _mm256_or_si256(_mm256_madd_epi16(pairs, multiplier), _mm256_slli_epi32(thirds, 20)));
+
+		components += 2 * kComponentsPerGroup;
+		dst += 2 * kBytesPerGroup;
+	}
+
+	packV210Scalar(components, dst, groupCount - group);
+}
+
+#endif
+
+/* 2vuy */
+
+static void unpack2vuy(const uint8_t* src, uint16_t* components, long componentCount)
+{
+	long i = 0;
+
+#if defined(V210_X86_KERNELS)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= componentCount; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(components + i), _mm_slli_epi16(_mm_unpacklo_epi8(bytes, zero), 2));
+		_mm_storeu_si128((__m128i*)(components + i + 8), _mm_slli_epi16(_mm_unpackhi_epi8(bytes, zero), 2));
+	}
+#endif
+
+	for (; i < componentCount; i++)
+		components[i] = (uint16_t)src[i] << 2;
+}
+
+static void pack2vuy(const uint16_t* components, uint8_t* dst, long componentCount)
+{
+	long i = 0;
+
+#if defined(V210_X86_KERNELS)
+	const __m128i rounding = _mm_set1_epi16(2);
+
+	for (; i + 16 <= componentCount; i += 16)
+	{
+		__m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(components + i)), rounding), 2);
+		__m128i high = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(components + i + 8)), rounding), 2);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(low, high));
+	}
+#endif
+
+	for (; i < componentCount; i++)
+		dst[i] = (uint8_t)std::min(255, (components[i] + 2) >> 2);
+}
+
+/* BGRA */
+
+// Video range 10-bit YCbCr to and from full range 8-bit RGB. The BGRA conversions use
+// 16-bit coefficients, arranged in the pairs that _mm256_madd_epi16 multiplies; ARGB and
+// r210 use the same matrix in 16.16 fixed point.
+static const int		kBGRACoefficientShift	= 14;		// YCbCr to BGRA
+static const int		kYCbCrCoefficientShift	= 13;		// BGRA to YCbCr
+
+struct ColorMatrix
+{
+	int32_t		yToRGB;
+	int32_t		crToR;
+	int32_t		cbToG;
+	int32_t		crToG;
+	int32_t		cbToB;
+
+	int16_t		cbYToB[2];			// (Cb, Y) to B
+	int16_t		cbYToG[2];			// (Cb, Y) to G, less the Cr term
+	int16_t		crToGOnly[2];		// (Cr, 0) to G
+	int16_t		crYToR[2];			// (Cr, Y) to R
+
+	int16_t		bgraToY[4];			// (B, G, R, A) of one pixel
+	int16_t		bgraToCb[4];		// Half of (B, G, R, A), applied to each pixel of a pair
+	int16_t		bgraToCr[4];
+};
+
+void GetColorspaceLumaCoefficients(VideoConversionColorspace colorspace, double* kr, double* kb)
+{
+	switch (colorspace)
+	{
+		case kVideoConversionRec601:
+			*kr = 0.299;
+			*kb = 0.114;
+			break;
+
+		case kVideoConversionRec2020:
+			*kr = 0.2627;
+			*kb = 0.0593;
+			break;
+
+		case kVideoConversionRec709:
+		default:
+			*kr = 0.2126;
+			*kb = 0.0722;
+			break;
+	}
+}
+
+static inline int16_t fixedPoint(double value)
+{
+	return (int16_t)((value < 0.0) ? value - 0.5 : value + 0.5);
+}
+
+static ColorMatrix makeColorMatrix(VideoConversionColorspace colorspace)
+{
+	double			kr;
+	double			kb;
+	double			kg;
+	const double	ySwing = 876.0;
+	const double	cSwing = 896.0;
+	const double	scale = 65536.0;
+	ColorMatrix		matrix;
+
+	GetColorspaceLumaCoefficients(colorspace, &kr, &kb);
+	kg = 1.0 - kr - kb;
+
+	matrix.yToRGB	= (int32_t)(255.0 / ySwing * scale + 0.5);
+	matrix.crToR	= (int32_t)(2.0 * (1.0 - kr) * 255.0 / cSwing * scale + 0.5);
+	matrix.cbToG	= (int32_t)(2.0 * kb * (1.0 - kb) / kg * 255.0 / cSwing * scale + 0.5);
+	matrix.crToG	= (int32_t)(2.0 * kr * (1.0 - kr) / kg * 255.0 / cSwing * scale + 0.5);
+	matrix.cbToB	= (int32_t)(2.0 * (1.0 - kb) * 255.0 / cSwing * scale + 0.5);
+
+	// The largest coefficient, Rec.2020 Cb to B, is about 0.54 at a scale of 2^14
+	const double	bgraScale = (double)(1 << kBGRACoefficientShift);
+	const int16_t	yToBGRA = fixedPoint(255.0 / ySwing * bgraScale);
+
+	matrix.cbYToB[0]	= fixedPoint(2.0 * (1.0 - kb) * 255.0 / cSwing * bgraScale);
+	matrix.cbYToB[1]	= yToBGRA;
+	matrix.cbYToG[0]	= fixedPoint(-2.0 * kb * (1.0 - kb) / kg * 255.0 / cSwing * bgraScale);
+	matrix.cbYToG[1]	= yToBGRA;
+	matrix.crToGOnly[0]	= fixedPoint(-2.0 * kr * (1.0 - kr) / kg * 255.0 / cSwing * bgraScale);
+	matrix.crToGOnly[1]	= 0;
+	matrix.crYToR[0]	= fixedPoint(2.0 * (1.0 - kr) * 255.0 / cSwing * bgraScale);
+	matrix.crYToR[1]	= yToBGRA;
+
+	// G to Y reaches 2.46 for Rec.709, so the reverse direction is scaled by 2^13
+	const double ycbcrScale = (double)(1 << kYCbCrCoefficientShift);
+
+	matrix.bgraToY[0]	= fixedPoint(kb * ySwing / 255.0 * ycbcrScale);
+	matrix.bgraToY[1]	= fixedPoint(kg * ySwing / 255.0 * ycbcrScale);
+	matrix.bgraToY[2]	= fixedPoint(kr * ySwing / 255.0 * ycbcrScale);
+	matrix.bgraToY[3]	= 0;
+
+	// Chroma is computed from the sum of two pixels, so these carry an extra factor of 1/2
+	matrix.bgraToCb[0]	= fixedPoint(0.5 * cSwing / 255.0 * ycbcrScale / 2.0);
+	matrix.bgraToCb[1]	= fixedPoint(-kg / (2.0 * (1.0 - kb)) * cSwing / 255.0 * ycbcrScale / 2.0);
+	matrix.bgraToCb[2]	= fixedPoint(-kr / (2.0 * (1.0 - kb)) * cSwing / 255.0 * ycbcrScale / 2.0);
+	matrix.bgraToCb[3]	= 0;
+	matrix.bgraToCr[0]	= fixedPoint(-kb / (2.0 * (1.0 - kr)) * cSwing / 255.0 * ycbcrScale / 2.0);
+	matrix.bgraToCr[1]	= fixedPoint(-kg / (2.0 * (1.0 - kr)) * cSwing / 255.0 * ycbcrScale / 2.0);
+	matrix.bgraToCr[2]	= fixedPoint(0.5 * cSwing / 255.0 * ycbcrScale / 2.0);
+	matrix.bgraToCr[3]	= 0;
+
+	return matrix;
+}
+
+static inline uint8_t clampToByte(int32_t value)
+{
+	return (uint8_t)std::min(255, std::max(0, value));
+}
+
+static inline uint16_t clampTo10Bit(int32_t value)
+{
+	// Codes 0-3 and 1020-1023 are reserved for timing references
+	return (uint16_t)std::min(1019, std::max(4, value));
+}
+
+static void componentsToBGRAScalar(const uint16_t* components, uint8_t* dst, long width, const ColorMatrix& matrix)
+{
+	const int32_t rounding = 1 << (kBGRACoefficientShift - 1);
+
+	for (long x = 0; x < width; x += 2)
+	{
+		int32_t cb = (int32_t)components[0] - 512;
+		int32_t cr = (int32_t)components[2] - 512;
+
+		for (long i = 0; (i < 2) && (x + i < width); i++)
+		{
+			int32_t y = (int32_t)components[1 + 2 * i] - 64;
+			int32_t b = matrix.cbYToB[0] * cb + matrix.cbYToB[1] * y;
+			int32_t g = matrix.cbYToG[0] * cb + matrix.cbYToG[1] * y + matrix.crToGOnly[0] * cr;
+			int32_t r = matrix.crYToR[0] * cr + matrix.crYToR[1] * y;
+
+			dst[0] = clampToByte((b + rounding) >> kBGRACoefficientShift);
+			dst[1] = clampToByte((g + rounding) >> kBGRACoefficientShift);
+			dst[2] = clampToByte((r + rounding) >> kBGRACoefficientShift);
+			dst[3] = 255;
+			dst += 4;
+		}
+
+		components += 4;
+	}
+}
+
+#if defined(V210_X86_KERNELS)
+
+static inline int32_t coefficientPair(const int16_t* pair)
+{
+	return (int32_t)((uint32_t)(uint16_t)pair[0] | ((uint32_t)(uint16_t)pair[1] << 16));
+}
+
+// Two 32-bit lanes, for _mm256_set1_epi64x
+static inline int64_t lanePair(int32_t low, int32_t high)
+{
+	return (int64_t)(((uint64_t)(uint32_t)high << 32) | (uint32_t)low);
+}
+
+static inline int64_t coefficientQuad(const int16_t* quad)
+{
+	return lanePair(coefficientPair(quad), coefficientPair(quad + 2));
+}
+
+// Four pixels per 128-bit lane. The components Cb0 Y0 Cr0 Y1 form the pairs (Cb0, Y0) and
+// (Cr0, Y1), and with the chroma swapped (Cr0, Y0) and (Cb0, Y1), so multiply-adds by
+// alternating coefficient pairs give every pixel's B, G and R sums exactly as the scalar
+// code computes them. The offsets of the components are folded into the rounding, and
+// saturating packs clamp the sums to bytes.
+static const int8_t kChromaSwapShuffle[16]	= { 4, 5, 2, 3, 0, 1, 6, 7, 12, 13, 10, 11, 8, 9, 14, 15 };
+static const int8_t kBGRAShuffle[16]		= { 0, 8, 4, 12, 5, 9, 1, 13, 2, 10, 6, 14, 7, 11, 3, 15 };
+
+__attribute__((target("avx2")))
+static void componentsToBGRAAVX2(const uint16_t* components, uint8_t* dst, long width, const ColorMatrix& matrix)
+{
+	const int32_t	rounding = 1 << (kBGRACoefficientShift - 1);
+	const int32_t	bRounding = rounding - 512 * matrix.cbYToB[0] - 64 * matrix.cbYToB[1];
+	const int32_t	gRounding = rounding - 512 * matrix.cbYToG[0] - 64 * matrix.cbYToG[1] - 512 * matrix.crToGOnly[0];
+	const int32_t	rRounding = rounding - 512 * matrix.crYToR[0] - 64 * matrix.crYToR[1];
+	const int16_t	crYToG[2] = { matrix.crToGOnly[0], matrix.cbYToG[1] };
+	const int16_t	cbToG[2] = { matrix.cbYToG[0], 0 };
+
+	const __m256i	chromaSwap = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kChromaSwapShuffle));
+	const __m256i	bgraShuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kBGRAShuffle));
+	const __m256i	toBR = _mm256_set1_epi64x(lanePair(coefficientPair(matrix.cbYToB), coefficientPair(matrix.crYToR)));
+	const __m256i	toRB = _mm256_set1_epi64x(lanePair(coefficientPair(matrix.crYToR), coefficientPair(matrix.cbYToB)));
+	const __m256i	toG = _mm256_set1_epi64x(lanePair(coefficientPair(matrix.cbYToG), coefficientPair(crYToG)));
+	const __m256i	swappedToG = _mm256_set1_epi64x(lanePair(coefficientPair(matrix.crToGOnly), coefficientPair(cbToG)));
+	const __m256i	brRounding = _mm256_set1_epi64x(lanePair(bRounding, rRounding));
+	const __m256i	rbRounding = _mm256_set1_epi64x(lanePair(rRounding, bRounding));
+	const __m256i	gRoundingVector = _mm256_set1_epi32(gRounding);
+	const __m256i	alpha = _mm256_set1_epi32(255);
+	long			x = 0;
+
+	for (; x + 8 <= width; x += 8)
+	{
+		__m256i c = _mm256_loadu_si256((const __m256i*)components);
+		__m256i swapped = _mm256_shuffle_epi8(c, chromaSwap);
+
+		// B0 R1 B2 R3, R0 B1 R2 B3 and G0 G1 G2 G3 in each lane
+		__m256i br = _mm256_add_epi32(_mm256_madd_epi16(c, toBR), brRounding);
+		__m256i rb = _mm256_add_epi32(_mm256_madd_epi16(swapped, toRB), rbRounding);
+		__m256i g = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(c, toG), _mm256_madd_epi16(swapped, swappedToG)), gRoundingVector);
+
+		br = _mm256_srai_epi32(br, kBGRACoefficientShift);
+		rb = _mm256_srai_epi32(rb, kBGRACoefficientShift);
+		g = _mm256_srai_epi32(g, kBGRACoefficientShift);
+
+		__m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(br, rb), _mm256_packs_epi32(g, alpha));
+		_mm256_storeu_si256((__m256i*)dst, _mm256_shuffle_epi8(bytes, bgraShuffle));
+
+		components += 16;
+		dst += 32;
+	}
+
+	componentsToBGRAScalar(components, dst, width - x, matrix);
+}
+
+#endif
+
+// 8-bit ARGB, the same conversion with the alpha byte first
+static void componentsToARGB(const uint16_t* components, uint8_t* dst, long width, const ColorMatrix& matrix)
+{
+	const int32_t rounding = 1 << 15;
+
+	for (long x = 0; x < width; x += 2)
+	{
+		int32_t cb = (int32_t)components[0] - 512;
+		int32_t cr = (int32_t)components[2] - 512;
+		int32_t r = matrix.crToR * cr;
+		int32_t g = -matrix.cbToG * cb - matrix.crToG * cr;
+		int32_t b = matrix.cbToB * cb;
+
+		for (long i = 0; (i < 2) && (x + i < width); i++)
+		{
+			int32_t y = matrix.yToRGB * ((int32_t)components[1 + 2 * i] - 64) + rounding;
+			dst[0] = 255;
+			dst[1] = clampToByte((y + r) >> 16);
+			dst[2] = clampToByte((y + g) >> 16);
+			dst[3] = clampToByte((y + b) >> 16);
+			dst += 4;
+		}
+
+		components += 4;
+	}
+}
+
+// 10-bit RGB ('r210'): big-endian words holding 2 unused bits, then R, G and B.
+// The matrix is scaled for 8-bit output, so the sums are rescaled to 10 bits.
+static inline uint32_t clampTo10BitRGB(int64_t value)
+{
+	return (uint32_t)std::min<int64_t>(1023, std::max<int64_t>(0, (value * 1023 / 255 + (1 << 15)) >> 16));
+}
+
+static void componentsToR210(const uint16_t* components, uint8_t* dst, long width, const ColorMatrix& matrix)
+{
+	for (long x = 0; x < width; x += 2)
+	{
+		int32_t cb = (int32_t)components[0] - 512;
+		int32_t cr = (int32_t)components[2] - 512;
+		int64_t r = (int64_t)matrix.crToR * cr;
+		int64_t g = -(int64_t)matrix.cbToG * cb - (int64_t)matrix.crToG * cr;
+		int64_t b = (int64_t)matrix.cbToB * cb;
+
+		for (long i = 0; (i < 2) && (x + i < width); i++)
+		{
+			int64_t		y = (int64_t)matrix.yToRGB * ((int32_t)components[1 + 2 * i] - 64);
+			uint32_t	word = (clampTo10BitRGB(y + r) << 20) | (clampTo10BitRGB(y + g) << 10) | clampTo10BitRGB(y + b);
+
+			dst[0] = (uint8_t)(word >> 24);
+			dst[1] = (uint8_t)(word >> 16);
+			dst[2] = (uint8_t)(word >> 8);
+			dst[3] = (uint8_t)word;
+			dst += 4;
+		}
+
+		components += 4;
+	}
+}
+
+static void bgraToComponentsScalar(const uint8_t* src, uint16_t* components, long width, const ColorMatrix& matrix)
+{
+	const int32_t rounding = 1 << (kYCbCrCoefficientShift - 1);
+
+	for (long x = 0; x < width; x += 2)
+	{
+		// An odd final pixel is paired with itself
+		const uint8_t*	next = (x + 1 < width) ? src + 4 : src;
+		int32_t			b = src[0] + next[0];
+		int32_t			g = src[1] + next[1];
+		int32_t			r = src[2] + next[2];
+
+		components[0] = clampTo10Bit(512 + ((matrix.bgraToCb[0] * b + matrix.bgraToCb[1] * g + matrix.bgraToCb[2] * r + rounding) >> kYCbCrCoefficientShift));
+		components[1] = clampTo10Bit(64 + ((matrix.bgraToY[0] * src[0] + matrix.bgraToY[1] * src[1] + matrix.bgraToY[2] * src[2] + rounding) >> kYCbCrCoefficientShift));
+		components[2] = clampTo10Bit(512 + ((matrix.bgraToCr[0] * b + matrix.bgraToCr[1] * g + matrix.bgraToCr[2] * r + rounding) >> kYCbCrCoefficientShift));
+		components[3] = clampTo10Bit(64 + ((matrix.bgraToY[0] * next[0] + matrix.bgraToY[1] * next[1] + matrix.bgraToY[2] * next[2] + rounding) >> kYCbCrCoefficientShift));
+
+		src += 8;
+		components += 4;
+	}
+}
+
+#if defined(V210_X86_KERNELS)
+
+// Words Cb01 Cb23 Cr01 Cr23 Y0 Y1 Y2 Y3 of a lane reordered to Cb01 Y0 Cr01 Y1 Cb23 Y2 Cr23 Y3
+static const int8_t kComponentShuffle[16] = { 0, 1, 8, 9, 4, 5, 10, 11, 2, 3, 12, 13, 6, 7, 14, 15 };
+
+// Eight pixels per iteration. The pixels are widened to 16 bits, and multiply-adds by the
+// (B, G, R, A) coefficients followed by horizontal adds give each pixel's Y, Cb and Cr sums;
+// a further horizontal add sums the chroma of each pair of pixels.
+__attribute__((target("avx2")))
+static void bgraToComponentsAVX2(const uint8_t* src, uint16_t* components, long width, const ColorMatrix& matrix)
+{
+	const __m256i	zero = _mm256_setzero_si256();
+	const __m256i	yRounding = _mm256_set1_epi32((64 << kYCbCrCoefficientShift) + (1 << (kYCbCrCoefficientShift - 1)));
+	const __m256i	cRounding = _mm256_set1_epi32((512 << kYCbCrCoefficientShift) + (1 << (kYCbCrCoefficientShift - 1)));
+	const __m256i	minimum = _mm256_set1_epi16(4);
+	const __m256i	maximum = _mm256_set1_epi16(1019);
+	const __m256i	componentShuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kComponentShuffle));
+	const __m256i	toY = _mm256_set1_epi64x(coefficientQuad(matrix.bgraToY));
+	const __m256i	toCb = _mm256_set1_epi64x(coefficientQuad(matrix.bgraToCb));
+	const __m256i	toCr = _mm256_set1_epi64x(coefficientQuad(matrix.bgraToCr));
+	long			x = 0;
+
+	for (; x + 8 <= width; x += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)src);
+		__m256i first = _mm256_unpacklo_epi8(pixels, zero);		// Pixels 0-1 and 4-5
+		__m256i second = _mm256_unpackhi_epi8(pixels, zero);		// Pixels 2-3 and 6-7
+
+		__m256i y = _mm256_hadd_epi32(_mm256_madd_epi16(first, toY), _mm256_madd_epi16(second, toY));
+		__m256i cb = _mm256_hadd_epi32(_mm256_madd_epi16(first, toCb), _mm256_madd_epi16(second, toCb));
+		__m256i cr = _mm256_hadd_epi32(_mm256_madd_epi16(first, toCr), _mm256_madd_epi16(second, toCr));
+		__m256i cbCr = _mm256_hadd_epi32(cb, cr);
+
+		// The offsets are folded into the rounding, as whole multiples of the scale
+		y = _mm256_srai_epi32(_mm256_add_epi32(y, yRounding), kYCbCrCoefficientShift);
+		cbCr = _mm256_srai_epi32(_mm256_add_epi32(cbCr, cRounding), kYCbCrCoefficientShift);
+
+		__m256i values = _mm256_min_epi16(_mm256_max_epi16(_mm256_packs_epi32(cbCr, y), minimum), maximum);
+		_mm256_storeu_si256((__m256i*)components, _mm256_shuffle_epi8(values, componentShuffle));
+
+		src += 32;
+		components += 16;
+	}
+
+	bgraToComponentsScalar(src, components, width - x, matrix);
+}
+
+#endif
+
+struct V210Kernel
+{
+	UnpackV210Func			unpack;
+	PackV210Func			pack;
+	ComponentsToBGRAFunc	componentsToBGRA;
+	BGRAToComponentsFunc	bgraToComponents;
+	const char*				name;
+};
+
+static const V210Kernel& selectV210Kernel(void)
+{
+	static const V210Kernel kernel = []() -> V210Kernel {
+#if defined(V210_X86_KERNELS)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return { unpackV210AVX2, packV210AVX2, componentsToBGRAAVX2, bgraToComponentsAVX2, "avx2" };
+		if (__builtin_cpu_supports("ssse3"))
+			return { unpackV210SSSE3, packV210Scalar, componentsToBGRAScalar, bgraToComponentsScalar, "ssse3" };
+#endif
+		return { unpackV210Scalar, packV210Scalar, componentsToBGRAScalar, bgraToComponentsScalar, "scalar" };
+	}();
+
+	return kernel;
+}
+
+/* Row dispatch */
+
+static long groupCountForWidth(long width)
+{
+	return (width + kPixelsPerGroup - 1) / kPixelsPerGroup;
+}
+
+static long packedRowBytes(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:
+			return width * 2;
+		case bmdFormat10BitYUV:
+			return groupCountForWidth(width) * kBytesPerGroup;
+		case bmdFormat8BitBGRA:
+			return width * 4;
+		default:
+			return 0;
+	}
+}
+
+static void padComponents(uint16_t* components, long width)
+{
+	// Fill the unused pixels of a partial v210 group with black
+	for (long i = width * 2; i < groupCountForWidth(width) * kComponentsPerGroup; i++)
+		components[i] = (i & 1) ? kBlackLuma : kBlackChroma;
+}
+
+static void rowToComponents(BMDPixelFormat pixelFormat, const uint8_t* src, uint16_t* components, long width, const ColorMatrix& matrix)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat10BitYUV:
+			selectV210Kernel().unpack(src, components, groupCountForWidth(width));
+			break;
+
+		case bmdFormat8BitYUV:
+			unpack2vuy(src, components, width * 2);
+			padComponents(components, width);
+			break;
+
+		case bmdFormat8BitBGRA:
+			selectV210Kernel().bgraToComponents(src, components, width, matrix);
+			padComponents(components, width);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void componentsToRow(BMDPixelFormat pixelFormat, const uint16_t* components, uint8_t* dst, long width, const ColorMatrix& matrix)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat10BitYUV:
+			selectV210Kernel().pack(components, dst, groupCountForWidth(width));
+			break;
+
+		case bmdFormat8BitYUV:
+			pack2vuy(components, dst, width * 2);
+			break;
+
+		case bmdFormat8BitBGRA:
+			selectV210Kernel().componentsToBGRA(components, dst, width, matrix);
+			break;
+
+		default:
+			break;
+	}
+}
+
+bool IsPixelRowConversionSupported(BMDPixelFormat srcFormat, BMDPixelFormat dstFormat)
+{
+	return (packedRowBytes(srcFormat, 1) > 0) && (packedRowBytes(dstFormat, 1) > 0);
+}
+
+HRESULT ConvertPixelRows(BMDPixelFormat srcFormat, const void* src, long srcRowBytes,
+						 BMDPixelFormat dstFormat, void* dst, long dstRowBytes,
+						 long width, long height, VideoConversionColorspace colorspace)
+{
+	const uint8_t*	srcRow = (const uint8_t*)src;
+	uint8_t*		dstRow = (uint8_t*)dst;
+	ColorMatrix		matrix;
+	uint16_t*		components;
+
+	if (!IsPixelRowConversionSupported(srcFormat, dstFormat))
+		return E_NOTIMPL;
+
+	if ((src == NULL) || (dst == NULL) || (width <= 0) || (height < 0))
+		return E_INVALIDARG;
+
+	if ((srcRowBytes < packedRowBytes(srcFormat, width)) || (dstRowBytes < packedRowBytes(dstFormat, width)))
+		return E_INVALIDARG;
+
+	if (srcFormat == dstFormat)
+	{
+		for (long y = 0; y < height; y++)
+			memcpy(dstRow + y * dstRowBytes, srcRow + y * srcRowBytes, packedRowBytes(srcFormat, width));
+		return S_OK;
+	}
+
+	if ((srcFormat == bmdFormat8BitBGRA) || (dstFormat == bmdFormat8BitBGRA))
+		matrix = makeColorMatrix(colorspace);
+
+	components = getComponentRow(width);
+
+	for (long y = 0; y < height; y++)
+	{
+		rowToComponents(srcFormat, srcRow, components, width, matrix);
+		componentsToRow(dstFormat, components, dstRow, width, matrix);
+
+		srcRow += srcRowBytes;
+		dstRow += dstRowBytes;
+	}
+
+	return S_OK;
+}
+
+void ConvertV210To2vuy(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height)
+{
+	ConvertPixelRows(bmdFormat10BitYUV, src, srcRowBytes, bmdFormat8BitYUV, dst, dstRowBytes, width, height, kVideoConversionRec709);
+}
+
+void Convert2vuyToV210(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height)
+{
+	ConvertPixelRows(bmdFormat8BitYUV, src, srcRowBytes, bmdFormat10BitYUV, dst, dstRowBytes, width, height, kVideoConversionRec709);
+}
+
+void ConvertV210ToBGRA(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height, VideoConversionColorspace colorspace)
+{
+	ConvertPixelRows(bmdFormat10BitYUV, src, srcRowBytes, bmdFormat8BitBGRA, dst, dstRowBytes, width, height, colorspace);
+}
+
+void ConvertBGRAToV210(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height, VideoConversionColorspace colorspace)
+{
+	ConvertPixelRows(bmdFormat8BitBGRA, src, srcRowBytes, bmdFormat10BitYUV, dst, dstRowBytes, width, height, colorspace);
+}
+
+void ConvertV210ToPlanar16(const void* src, long srcRowBytes,
+						   uint16_t* yPlane, long yRowBytes, uint16_t* cbPlane, long cbRowBytes, uint16_t* crPlane, long crRowBytes,
+						   long width, long height)
+{
+	uint16_t* components = getComponentRow(width);
+
+	for (long y = 0; y < height; y++)
+	{
+		const uint16_t*	c = components;
+		uint16_t*		yRow = (uint16_t*)((uint8_t*)yPlane + y * yRowBytes);
+		uint16_t*		cbRow = (uint16_t*)((uint8_t*)cbPlane + y * cbRowBytes);
+		uint16_t*		crRow = (uint16_t*)((uint8_t*)crPlane + y * crRowBytes);
+
+		selectV210Kernel().unpack((const uint8_t*)src + y * srcRowBytes, components, groupCountForWidth(width));
+
+		// Replicate the top bits so that 10-bit peak white maps to 16-bit peak white
+		for (long x = 0; x < width; x += 2)
+		{
+			cbRow[x / 2] = (uint16_t)((c[0] << 6) | (c[0] >> 4));
+			yRow[x] = (uint16_t)((c[1] << 6) | (c[1] >> 4));
+			crRow[x / 2] = (uint16_t)((c[2] << 6) | (c[2] >> 4));
+			if (x + 1 < width)
+				yRow[x + 1] = (uint16_t)((c[3] << 6) | (c[3] >> 4));
+			c += 4;
+		}
+	}
+}
+
+void ConvertPlanar16ToV210(const uint16_t* yPlane, long yRowBytes, const uint16_t* cbPlane, long cbRowBytes, const uint16_t* crPlane, long crRowBytes,
+						   void* dst, long dstRowBytes, long width, long height)
+{
+	uint16_t* components = getComponentRow(width);
+
+	for (long y = 0; y < height; y++)
+	{
+		uint16_t*		c = components;
+		const uint16_t*	yRow = (const uint16_t*)((const uint8_t*)yPlane + y * yRowBytes);
+		const uint16_t*	cbRow = (const uint16_t*)((const uint8_t*)cbPlane + y * cbRowBytes);
+		const uint16_t*	crRow = (const uint16_t*)((const uint8_t*)crPlane + y * crRowBytes);
+
+		for (long x = 0; x < width; x += 2)
+		{
+			c[0] = cbRow[x / 2] >> 6;
+			c[1] = yRow[x] >> 6;
+			c[2] = crRow[x / 2] >> 6;
+			c[3] = (x + 1 < width) ? (yRow[x + 1] >> 6) : kBlackLuma;
+			c += 4;
+		}
+
+		padComponents(components, width);
+		selectV210Kernel().pack(components, (uint8_t*)dst + y * dstRowBytes, groupCountForWidth(width));
+	}
+}
+
+void UnpackV210Row(const void* src, uint16_t* components, long width)
+{
+	selectV210Kernel().unpack((const uint8_t*)src, components, groupCountForWidth(width));
+}
+
+long GetComponentRowLength(long width)
+{
+	return componentBufferSize(width);
+}
+
+bool IsComponentRowPackingSupported(BMDPixelFormat dstFormat)
+{
+	return (packedRowBytes(dstFormat, 1) > 0) || (dstFormat == bmdFormat8BitARGB) || (dstFormat == bmdFormat10BitRGB);
+}
+
+HRESULT PackComponentRow(BMDPixelFormat dstFormat, uint16_t* components, void* dst, long width, VideoConversionColorspace colorspace)
+{
+	ColorMatrix matrix;
+
+	if ((components == NULL) || (dst == NULL) || (width <= 0))
+		return E_INVALIDARG;
+
+	switch (dstFormat)
+	{
+		case bmdFormat8BitARGB:
+			componentsToARGB(components, (uint8_t*)dst, width, makeColorMatrix(colorspace));
+			return S_OK;
+
+		case bmdFormat10BitRGB:
+			componentsToR210(components, (uint8_t*)dst, width, makeColorMatrix(colorspace));
+			return S_OK;
+
+		default:
+			break;
+	}
+
+	if (packedRowBytes(dstFormat, 1) == 0)
+		return E_NOTIMPL;
+
+	if (dstFormat == bmdFormat8BitBGRA)
+		matrix = makeColorMatrix(colorspace);
+
+	padComponents(components, width);
+	componentsToRow(dstFormat, components, (uint8_t*)dst, width, matrix);
+	return S_OK;
+}
+
+VideoConversionColorspace GetColorspaceForFrameHeight(long height)
+{
+	return (height <= 576) ? kVideoConversionRec601 : kVideoConversionRec709;
+}
+
+HRESULT ConvertVideoFrameWithKernels(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame)
+{
+	void*	srcBytes;
+	void*	dstBytes;
+
+	if ((srcFrame == NULL) || (dstFrame == NULL))
+		return E_INVALIDARG;
+
+	if (!IsPixelRowConversionSupported(srcFrame->GetPixelFormat(), dstFrame->GetPixelFormat()))
+		return E_NOTIMPL;
+
+	if ((srcFrame->GetWidth() != dstFrame->GetWidth()) || (srcFrame->GetHeight() != dstFrame->GetHeight()))
+		return E_INVALIDARG;
+
+	if ((srcFrame->GetBytes(&srcBytes) != S_OK) || (dstFrame->GetBytes(&dstBytes) != S_OK))
+		return E_FAIL;
+
+	return ConvertPixelRows(srcFrame->GetPixelFormat(), srcBytes, srcFrame->GetRowBytes(),
+							dstFrame->GetPixelFormat(), dstBytes, dstFrame->GetRowBytes(),
+							srcFrame->GetWidth(), srcFrame->GetHeight(),
+							GetColorspaceForFrameHeight(srcFrame->GetHeight()));
+}
+
+const char* GetV210KernelName(void)
+{
+	return selectV210Kernel().name;
+}
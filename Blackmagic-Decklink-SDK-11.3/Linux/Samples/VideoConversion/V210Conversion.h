@@ -0,0 +1,94 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+// Pixel conversion kernels for v210 (bmdFormat10BitYUV), 2vuy (bmdFormat8BitYUV),
+// BGRA (bmdFormat8BitBGRA) and planar 16-bit 4:2:2. All functions take the row
+// stride of each buffer separately, so they can work directly on the memory
+// returned by IDeckLinkVideoFrame::GetBytes, or on a band of rows within it.
+//
+// Every conversion goes through a row of 10-bit 4:2:2 components (Cb Y Cr Y ...),
+// held per thread so that converting frames does not allocate. The v210 unpack and
+// pack and the BGRA colour matrix use AVX2 when the CPU supports it (the unpack
+// SSSE3 otherwise) and fall back to portable C, with the same results.
+
+enum VideoConversionColorspace
+{
+	kVideoConversionRec601,
+	kVideoConversionRec709,
+	kVideoConversionRec2020
+};
+
+// Generic entry point for the DeckLink pixel formats listed above. Returns E_NOTIMPL
+// for any other pair of formats; a format converted to itself is a plain row copy.
+HRESULT		ConvertPixelRows(BMDPixelFormat srcFormat, const void* src, long srcRowBytes,
+							 BMDPixelFormat dstFormat, void* dst, long dstRowBytes,
+							 long width, long height, VideoConversionColorspace colorspace);
+
+bool		IsPixelRowConversionSupported(BMDPixelFormat srcFormat, BMDPixelFormat dstFormat);
+
+void		ConvertV210To2vuy(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height);
+void		Convert2vuyToV210(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height);
+void		ConvertV210ToBGRA(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height, VideoConversionColorspace colorspace);
+void		ConvertBGRAToV210(const void* src, long srcRowBytes, void* dst, long dstRowBytes, long width, long height, VideoConversionColorspace colorspace);
+
+// Planar 4:2:2 with 16-bit samples (10-bit values scaled to the full 16-bit range).
+// The chroma planes are (width + 1) / 2 samples wide.
+void		ConvertV210ToPlanar16(const void* src, long srcRowBytes,
+								  uint16_t* yPlane, long yRowBytes, uint16_t* cbPlane, long cbRowBytes, uint16_t* crPlane, long crRowBytes,
+								  long width, long height);
+void		ConvertPlanar16ToV210(const uint16_t* yPlane, long yRowBytes, const uint16_t* cbPlane, long cbRowBytes, const uint16_t* crPlane, long crRowBytes,
+								  void* dst, long dstRowBytes, long width, long height);
+
+// Unpacks one v210 row into 10-bit components (Cb Y Cr Y ...) with the selected kernel.
+// The components buffer must hold GetComponentRowLength(width) values.
+void		UnpackV210Row(const void* src, uint16_t* components, long width);
+
+// Packs one row of 10-bit 4:2:2 components (Cb Y Cr Y ...) into a DeckLink pixel
+// format. Supports the formats above plus bmdFormat8BitARGB and bmdFormat10BitRGB.
+// The components buffer must hold GetComponentRowLength(width) values; any padding
+// of a partial v210 group is overwritten with black.
+long		GetComponentRowLength(long width);
+bool		IsComponentRowPackingSupported(BMDPixelFormat dstFormat);
+HRESULT		PackComponentRow(BMDPixelFormat dstFormat, uint16_t* components, void* dst, long width, VideoConversionColorspace colorspace);
+
+// Kr and Kb of the colourspace's luma equation
+void		GetColorspaceLumaCoefficients(VideoConversionColorspace colorspace, double* kr, double* kb);
+
+// Rec.601 for SD frame heights, Rec.709 otherwise
+VideoConversionColorspace	GetColorspaceForFrameHeight(long height);
+
+// Converts between two frames of the same dimensions, choosing the colorspace with
+// GetColorspaceForFrameHeight(). Returns E_NOTIMPL for unsupported formats.
+HRESULT		ConvertVideoFrameWithKernels(IDeckLinkVideoFrame* srcFrame, IDeckLinkVideoFrame* dstFrame);
+
+// Name of the instruction set selected for the kernels ("avx2", "ssse3" or "scalar")
+const char*	GetV210KernelName(void);
@@ -0,0 +1,445 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "VancPacketScanner.h"
+#include "V210Conversion.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VANC_X86_KERNELS 1
+#endif
+
+// SMPTE 291 ancillary data flag, then the DID, SDID / DBN and data count words
+static const uint16_t	kAncillaryFlagFirst		= 0x000;
+static const uint16_t	kAncillaryFlagOther		= 0x3ff;
+static const uint32_t	kHeaderWords			= 6;
+
+// Components after the line that the flag search may read: the two further words of a
+// flag and a vector. They are set to black, which can never start or continue a flag.
+static const uint32_t	kSearchSlack			= 2 * 2 + 16;
+static const uint16_t	kSearchPadding			= 0x040;
+
+// v210 groups of 6 pixels in 4 words of 3 components
+static const uint32_t	kPixelsPerGroup			= 6;
+static const uint32_t	kComponentsPerGroup		= 12;
+static const uint32_t	kWordsPerGroup			= 4;
+
+// Groups searched between checks for the next component of 000
+static const uint32_t	kSearchGroups			= 16;
+
+// Longest packet, from the flag to the checksum
+static const uint32_t	kMaxPacketWords			= 3 + 3 + 255 + 1;
+
+// Returns the index of the first v210 word with a 10-bit component of 000, or count if
+// there is none. Video never uses 000, so lines without an ADF are passed over unpacked.
+typedef uint32_t (*FindZeroComponentFunc)(const uint32_t* words, uint32_t count);
+
+// Fills flags with the indexes from start on where components[i] is 000 and the words
+// stride and 2 * stride further on are 3FF. Returns the count, at most maxFlags.
+typedef uint32_t (*FindFlagsFunc)(const uint16_t* components, uint32_t count, uint32_t stride, uint32_t start, uint32_t* flags, uint32_t maxFlags);
+
+static uint32_t findZeroComponentScalar(const uint32_t* words, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (((words[i] & 0x3ff) == 0) || ((words[i] & 0xffc00) == 0) || ((words[i] & 0x3ff00000) == 0))
+			return i;
+	}
+
+	return count;
+}
+
+static uint32_t findFlagsScalar(const uint16_t* components, uint32_t count, uint32_t stride, uint32_t start, uint32_t* flags, uint32_t maxFlags)
+{
+	uint32_t flagCount = 0;
+
+	for (uint32_t i = start; i < count; i++)
+	{
+		if ((components[i] == kAncillaryFlagFirst) && (components[i + stride] == kAncillaryFlagOther) && (components[i + 2 * stride] == kAncillaryFlagOther))
+		{
+			flags[flagCount++] = i;
+			if (flagCount == maxFlags)
+				break;
+		}
+	}
+
+	return flagCount;
+}
+
+#if defined(VANC_X86_KERNELS)
+
+// Each 16-bit lane that matches sets two bits of the byte mask
+static inline bool takeFlags(uint32_t mask, uint32_t base, uint32_t count, uint32_t* flags, uint32_t maxFlags, uint32_t* flagCount)
+{
+	while (mask != 0)
+	{
+		uint32_t bit = __builtin_ctz(mask);
+		uint32_t index = base + bit / 2;
+
+		if (index >= count)
+			return true;
+
+		flags[(*flagCount)++] = index;
+		if (*flagCount == maxFlags)
+			return true;
+
+		mask &= ~(3U << bit);
+	}
+
+	return false;
+}
+
+// Any zero component of a word gives a nonzero (word - kFieldLowBits) & ~word & kFieldHighBits,
+// in the way of the zero byte test. A borrow into the next component only happens when
+// the component below is zero, so the test is exact. Bits 30 and 31 are masked off first.
+static const uint32_t	kFieldMask				= 0x3fffffff;
+static const uint32_t	kFieldLowBits			= 0x00100401;
+static const uint32_t	kFieldHighBits			= 0x20080200;
+
+__attribute__((target("sse4.1")))
+static uint32_t findZeroComponentSSE41(const uint32_t* words, uint32_t count)
+{
+	const __m128i	mask = _mm_set1_epi32(kFieldMask);
+	const __m128i	lowBits = _mm_set1_epi32(kFieldLowBits);
+	const __m128i	highBits = _mm_set1_epi32(kFieldHighBits);
+	uint32_t		i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i w0 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(words + i)), mask);
+		__m128i w1 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(words + i + 4)), mask);
+		__m128i zero0 = _mm_andnot_si128(w0, _mm_sub_epi32(w0, lowBits));
+		__m128i zero1 = _mm_andnot_si128(w1, _mm_sub_epi32(w1, lowBits));
+
+		if (!_mm_testz_si128(_mm_or_si128(zero0, zero1), highBits))
+			break;
+	}
+
+	return i + findZeroComponentScalar(words + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static uint32_t findFlagsSSE2(const uint16_t* components, uint32_t count, uint32_t stride, uint32_t start, uint32_t* flags, uint32_t maxFlags)
+{
+	const __m128i	first = _mm_set1_epi16(kAncillaryFlagFirst);
+	const __m128i	other = _mm_set1_epi16(kAncillaryFlagOther);
+	uint32_t		flagCount = 0;
+
+	for (uint32_t i = start; i < count; i += 8)
+	{
+		__m128i match = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(components + i)), first);
+		match = _mm_and_si128(match, _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(components + i + stride)), other));
+		match = _mm_and_si128(match, _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(components + i + 2 * stride)), other));
+
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(match);
+		if ((mask != 0) && takeFlags(mask, i, count, flags, maxFlags, &flagCount))
+			break;
+	}
+
+	return flagCount;
+}
+
+__attribute__((target("avx2")))
+static uint32_t findZeroComponentAVX2(const uint32_t* words, uint32_t count)
+{
+	const __m256i	mask = _mm256_set1_epi32(kFieldMask);
+	const __m256i	lowBits = _mm256_set1_epi32(kFieldLowBits);
+	const __m256i	highBits = _mm256_set1_epi32(kFieldHighBits);
+	uint32_t		i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i w0 = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(words + i)), mask);
+		__m256i w1 = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(words + i + 8)), mask);
+		__m256i zero0 = _mm256_andnot_si256(w0, _mm256_sub_epi32(w0, lowBits));
+		__m256i zero1 = _mm256_andnot_si256(w1, _mm256_sub_epi32(w1, lowBits));
+
+		if (!_mm256_testz_si256(_mm256_or_si256(zero0, zero1), highBits))
+			break;
+	}
+
+	return i + findZeroComponentScalar(words + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t findFlagsAVX2(const uint16_t* components, uint32_t count, uint32_t stride, uint32_t start, uint32_t* flags, uint32_t maxFlags)
+{
+	const __m256i	first = _mm256_set1_epi16(kAncillaryFlagFirst);
+	const __m256i	other = _mm256_set1_epi16(kAncillaryFlagOther);
+	uint32_t		flagCount = 0;
+
+	for (uint32_t i = start; i < count; i += 16)
+	{
+		__m256i match = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(components + i)), first);
+		match = _mm256_and_si256(match, _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(components + i + stride)), other));
+		match = _mm256_and_si256(match, _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(components + i + 2 * stride)), other));
+
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(match);
+		if ((mask != 0) && takeFlags(mask, i, count, flags, maxFlags, &flagCount))
+			break;
+	}
+
+	return flagCount;
+}
+
+#endif
+
+struct VancScanKernel
+{
+	FindZeroComponentFunc	findZeroComponent;
+	FindFlagsFunc			findFlags;
+	const char*				name;
+};
+
+static const VancScanKernel& selectVancScanKernel(void)
+{
+	static const VancScanKernel kernel = []() -> VancScanKernel {
+#if defined(VANC_X86_KERNELS)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return { findZeroComponentAVX2, findFlagsAVX2, "avx2" };
+		if (__builtin_cpu_supports("sse4.1"))
+			return { findZeroComponentSSE41, findFlagsSSE2, "sse4.1" };
+#endif
+		return { findZeroComponentScalar, findFlagsScalar, "scalar" };
+	}();
+
+	return kernel;
+}
+
+// DID, SDID and data count words: b8 is the even parity of b0 - b7, and b9 is not b8
+static inline bool hasValidParity(uint16_t word)
+{
+	uint32_t b8 = (word >> 8) & 1;
+	return (b8 == (uint32_t)__builtin_parity(word & 0xff)) && (((word >> 9) & 1) != b8);
+}
+
+void VancPacketView::CopyBytes(uint8_t* bytes) const
+{
+	for (uint32_t i = 0; i < dataCount; i++)
+		bytes[i] = GetByte(i);
+}
+
+VancPacketScanner::VancPacketScanner(long maxWidth) :
+	m_maxWidth(maxWidth),
+	m_line(NULL),
+	m_groupCount(0),
+	m_componentCount(0),
+	m_unpackedGroups(0),
+	m_packetCount(0)
+{
+	m_components.resize(GetComponentRowLength(maxWidth) + kSearchSlack);
+	memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+HRESULT VancPacketScanner::ScanLine(const void* v210Line, long width)
+{
+	const VancScanKernel&	kernel = selectVancScanKernel();
+	const uint16_t*			components = m_components.data();
+	uint32_t				stride;
+	uint32_t				packetGroups;
+	uint32_t				streamEnd[2] = { 0, 0 };
+	uint32_t				flags[64];
+	uint32_t				flagCount;
+	uint32_t				group;
+
+	if ((v210Line == NULL) || (width <= 0) || (width > m_maxWidth))
+		return E_INVALIDARG;
+
+	m_packetCount = 0;
+	m_statistics.lines++;
+
+	m_line = (const uint32_t*)v210Line;
+	m_groupCount = ((uint32_t)width + kPixelsPerGroup - 1) / kPixelsPerGroup;
+	m_componentCount = (uint32_t)width * 2;
+
+	// SD carries one stream through every sample. HD carries a stream in the Y samples and
+	// another in the Cb and Cr samples, which are searched together at a stride of 2.
+	stride = (width <= 720) ? 1 : 2;
+	packetGroups = (kMaxPacketWords * stride) / kComponentsPerGroup + 2;
+
+	// Only the groups from a component of 000 on can hold packets, and after the packets
+	// of a line there is usually nothing more, so the line is unpacked and searched a few
+	// groups at a time, then checked for the next component of 000.
+	group = kernel.findZeroComponent(m_line, m_groupCount * kWordsPerGroup) / kWordsPerGroup;
+	m_unpackedGroups = group;
+
+	while (group < m_groupCount)
+	{
+		uint32_t searchEnd = std::min(group + kSearchGroups, m_groupCount);
+		uint32_t searchCount = std::min(searchEnd * kComponentsPerGroup, m_componentCount);
+		uint32_t start = group * kComponentsPerGroup;
+
+		// The search looks up to two groups past its end
+		m_unpackedGroups = std::max(m_unpackedGroups, group);
+		unpackGroups(searchEnd + 2);
+
+		do
+		{
+			flagCount = kernel.findFlags(components, searchCount, stride, start, flags, sizeof(flags) / sizeof(flags[0]));
+
+			for (uint32_t i = 0; i < flagCount; i++)
+			{
+				unpackGroups(flags[i] / kComponentsPerGroup + packetGroups);
+
+				if (stride == 1)
+					parsePacket(components, m_componentCount, flags[i], stride, kVancStreamMultiplexed, &streamEnd[0]);
+				else if (flags[i] & 1)
+					parsePacket(components, m_componentCount, flags[i], stride, kVancStreamLuma, &streamEnd[1]);
+				else
+					parsePacket(components, m_componentCount, flags[i], stride, kVancStreamChroma, &streamEnd[0]);
+			}
+
+			if (flagCount > 0)
+				start = flags[flagCount - 1] + 1;
+		}
+		while (flagCount == sizeof(flags) / sizeof(flags[0]));
+
+		// User data and checksum words are never 000, so this skips to the next flag
+		group = searchEnd + kernel.findZeroComponent(m_line + searchEnd * kWordsPerGroup, (m_groupCount - searchEnd) * kWordsPerGroup) / kWordsPerGroup;
+	}
+
+	return (m_packetCount > 0) ? S_OK : S_FALSE;
+}
+
+void VancPacketScanner::unpackGroups(uint32_t groupEnd)
+{
+	uint16_t* components = m_components.data();
+
+	groupEnd = std::min(groupEnd, m_groupCount);
+	if (groupEnd <= m_unpackedGroups)
+		return;
+
+	UnpackV210Row(m_line + m_unpackedGroups * kWordsPerGroup, components + m_unpackedGroups * kComponentsPerGroup,
+				  (groupEnd - m_unpackedGroups) * kPixelsPerGroup);
+	m_unpackedGroups = groupEnd;
+
+	// Past the line are the rest of the last v210 group and the search slack
+	if (groupEnd == m_groupCount)
+		std::fill(components + m_componentCount, components + m_componentCount + kComponentsPerGroup + kSearchSlack, kSearchPadding);
+}
+
+void VancPacketScanner::parsePacket(const uint16_t* components, uint32_t componentCount, uint32_t flagIndex, uint32_t stride,
+									VancDataStream stream, uint32_t* streamEnd)
+{
+	const uint16_t*	words = components + flagIndex;
+	uint32_t		dataCount;
+	uint32_t		checksumIndex;
+	uint32_t		checksum = 0;
+	uint16_t		checksumWord;
+
+	// Flags within a packet already found are user data that happens to look like one
+	if (flagIndex < *streamEnd)
+		return;
+
+	if (flagIndex + (kHeaderWords - 1) * stride >= componentCount)
+	{
+		m_statistics.truncatedPackets++;
+		return;
+	}
+
+	if (!hasValidParity(words[3 * stride]) || !hasValidParity(words[4 * stride]) || !hasValidParity(words[5 * stride]))
+	{
+		m_statistics.parityErrors++;
+		return;
+	}
+
+	dataCount = words[5 * stride] & 0xff;
+	checksumIndex = flagIndex + (kHeaderWords + dataCount) * stride;
+	if (checksumIndex >= componentCount)
+	{
+		m_statistics.truncatedPackets++;
+		return;
+	}
+
+	// The checksum is the 9-bit sum of the DID through the last user data word, with b9 not b8
+	for (uint32_t i = 3; i < kHeaderWords + dataCount; i++)
+		checksum += words[i * stride] & 0x1ff;
+	checksum &= 0x1ff;
+
+	checksumWord = components[checksumIndex];
+	if (((checksumWord & 0x1ff) != checksum) || (((checksumWord >> 9) & 1) == ((checksumWord >> 8) & 1)))
+	{
+		m_statistics.checksumErrors++;
+		return;
+	}
+
+	*streamEnd = checksumIndex + 1;
+
+	if (m_packetCount == kMaxPacketsPerLine)
+	{
+		m_statistics.droppedPackets++;
+		return;
+	}
+
+	VancPacketView& packet = m_packets[m_packetCount++];
+	packet.did			= (uint8_t)words[3 * stride];
+	packet.sdid			= (uint8_t)words[4 * stride];
+	packet.dataCount	= (uint8_t)dataCount;
+	packet.stream		= stream;
+	packet.position		= flagIndex / stride;
+	packet.userData		= words + kHeaderWords * stride;
+	packet.stride		= stride;
+
+	m_statistics.packets++;
+}
+
+HRESULT VancPacketScanner::ScanFrameLine(IDeckLinkVideoFrameAncillary* ancillary, uint32_t lineNumber, long width)
+{
+	void*	buffer;
+	HRESULT	result;
+
+	if (ancillary == NULL)
+		return E_INVALIDARG;
+
+	if (ancillary->GetPixelFormat() != bmdFormat10BitYUV)
+		return E_NOTIMPL;
+
+	result = ancillary->GetBufferForVerticalBlankingLine(lineNumber, &buffer);
+	if (result != S_OK)
+		return result;
+
+	return ScanLine(buffer, width);
+}
+
+const VancPacketView* VancPacketScanner::FindPacket(uint8_t did, uint8_t sdid) const
+{
+	for (uint32_t i = 0; i < m_packetCount; i++)
+	{
+		if ((m_packets[i].did == did) && (m_packets[i].sdid == sdid))
+			return &m_packets[i];
+	}
+
+	return NULL;
+}
+
+const char* GetVancScanKernelName(void)
+{
+	return selectVancScanKernel().name;
+}
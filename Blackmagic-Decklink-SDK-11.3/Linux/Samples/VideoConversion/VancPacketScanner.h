@@ -0,0 +1,125 @@
+/* -LICENSE-START-
+** Copyright (c) 2019 Blackmagic Design
+**
+** Permission is hereby granted, free of charge, to any person or organization
+** obtaining a copy of the software and accompanying documentation covered by
+** this license (the "Software") to use, reproduce, display, distribute,
+** execute, and transmit the Software, and to prepare derivative works of the
+** Software, and to permit third-parties to whom the Software is furnished to
+** do so, all subject to the following:
+**
+** The copyright notices in the Software and this entire statement, including
+** the above license grant, this restriction and the following disclaimer,
+** must be included in all copies of the Software, in whole or in part, and
+** all derivative works of the Software, unless such copies or derivative
+** works are solely in the form of machine-executable object code generated by
+** a source language processor.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+** SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+** FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+** ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+** DEALINGS IN THE SOFTWARE.
+** -LICENSE-END-
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "DeckLinkAPI.h"
+
+// Finds SMPTE 291 ancillary data packets in the VANC lines of v210 frame memory, as
+// returned by IDeckLinkVideoFrameAncillary::GetBufferForVerticalBlankingLine, without
+// the IDeckLinkAncillaryPacket object per packet of the packet iterator.
+//
+// VANC lines are first checked in their packed form for a component of 000, which video
+// never uses, so the many lines without packets are passed over without being unpacked.
+// From each component of 000 the line is unpacked to 10-bit components with the v210
+// kernel a few groups at a time, and searched for the ancillary data flag (000 3FF 3FF)
+// 16 words at a time with AVX2, or 8 with SSE, so the blank end of a line is skipped too.
+// Packets with valid DID, SDID and data count parity and a valid checksum are returned
+// as views into the unpacked line, valid until the next line is scanned.
+
+enum VancDataStream
+{
+	kVancStreamLuma,				// HD: packets in the Y samples
+	kVancStreamChroma,				// HD: packets in the Cb and Cr samples
+	kVancStreamMultiplexed			// SD: a single stream of Cb Y Cr Y samples
+};
+
+struct VancPacketView
+{
+	uint8_t				did;
+	uint8_t				sdid;			// Data block number for type 1 packets (DID 0x80 and above)
+	uint8_t				dataCount;
+	VancDataStream		stream;
+	uint32_t			position;		// Sample of the stream the ADF starts at
+	const uint16_t*		userData;		// First user data word
+	uint32_t			stride;			// Components from one user data word to the next
+
+	// Low 8 bits of a user data word, as IDeckLinkAncillaryPacket::GetBytes returns them
+	uint8_t				GetByte(uint32_t index) const	{ return (uint8_t)userData[index * stride]; }
+	uint16_t			GetWord(uint32_t index) const	{ return userData[index * stride]; }
+	void				CopyBytes(uint8_t* bytes) const;
+};
+
+struct VancScanStatistics
+{
+	uint64_t	lines;
+	uint64_t	packets;
+	uint64_t	parityErrors;			// ADFs followed by a DID, SDID or data count with bad parity
+	uint64_t	checksumErrors;
+	uint64_t	truncatedPackets;		// Packets running past the end of the line
+	uint64_t	droppedPackets;			// More than kMaxPacketsPerLine on one line
+};
+
+// Not thread safe; keep a scanner per input. Scanning allocates nothing.
+class VancPacketScanner
+{
+public:
+	enum
+	{
+		kMaxPacketsPerLine = 128
+	};
+
+	explicit VancPacketScanner(long maxWidth = 3840);
+
+	// Scans a v210 line of the given width in pixels. Lines up to 720 pixels wide are taken
+	// to be SD, with a single multiplexed data stream. Returns S_FALSE if no valid packets
+	// are found, and E_INVALIDARG for lines wider than the scanner was made for.
+	HRESULT					ScanLine(const void* v210Line, long width);
+
+	// Scans a VANC line of a frame's ancillary data, which must be in bmdFormat10BitYUV
+	HRESULT					ScanFrameLine(IDeckLinkVideoFrameAncillary* ancillary, uint32_t lineNumber, long width);
+
+	const VancPacketView*	GetPackets(void) const		{ return m_packets; }
+	uint32_t				GetPacketCount(void) const	{ return m_packetCount; }
+
+	// The first packet of the last line scanned with these IDs, or NULL
+	const VancPacketView*	FindPacket(uint8_t did, uint8_t sdid) const;
+
+	const VancScanStatistics&	GetStatistics(void) const	{ return m_statistics; }
+
+private:
+	void					unpackGroups(uint32_t groupEnd);
+	void					parsePacket(const uint16_t* components, uint32_t componentCount, uint32_t flagIndex, uint32_t stride, VancDataStream stream, uint32_t* streamEnd);
+
+	long					m_maxWidth;
+	std::vector<uint16_t>	m_components;
+
+	// The line being scanned, unpacked as far as needed
+	const uint32_t*			m_line;
+	uint32_t				m_groupCount;
+	uint32_t				m_componentCount;
+	uint32_t				m_unpackedGroups;
+
+	VancPacketView			m_packets[kMaxPacketsPerLine];
+	uint32_t				m_packetCount;
+	VancScanStatistics		m_statistics;
+};
+
+// Name of the instruction set selected for the ADF search ("avx2", "sse4.1" or "scalar")
+const char*	GetVancScanKernelName(void);